@@ -0,0 +1,705 @@
+#include "completion.h"
+#include "shell.h"
+#include "vfs/vfs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define COMPLETION_MAX_PROVIDERS    64
+
+// One directory child (or command name) in a sorted listing
+typedef struct {
+    uint64_t key;           // Sort scratch: 8 name bytes big-endian (pool offset while building)
+    const char* name;
+    VNode* node;            // NULL for command names
+    uint8_t is_dir;
+} CompletionEntry;
+
+typedef struct {
+    VNode* dir;
+    unsigned long generation;
+    CompletionEntry* entries;
+    int count;
+    int capacity;
+    char* names;
+    size_t names_used;
+    size_t names_size;
+    unsigned long last_used;
+    int built;              // Set once complete; an empty directory has no entries array
+} CompletionListing;
+
+typedef struct {
+    char command[32];
+    CompletionProviderFn provider;
+} CompletionProvider;
+
+static CompletionListing g_dir_cache[COMPLETION_DIR_CACHE];
+static unsigned long g_cache_clock = 0;
+static CompletionListing g_commands;
+static CompletionProvider g_providers[COMPLETION_MAX_PROVIDERS];
+static int g_provider_count = 0;
+static int g_builtins_registered = 0;
+
+static double completion_now_seconds(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Sorted listings
+// ---------------------------------------------------------------------------
+
+static uint64_t entry_key(const char* name) {
+    uint64_t key = 0;
+    for (int i = 0; i < 8; i++) {
+        key <<= 8;
+        if (*name) key |= (unsigned char)*name++;
+    }
+    return key;
+}
+
+// Sorts entries whose names agree on their first depth bytes: LSD radix on
+// the next 8 bytes, then recurse into runs that still tie.  Directory
+// listings are full of shared prefixes ("file_0001.c", ...), which is where
+// a strcmp-driven qsort spends most of its time.
+static void listing_sort(CompletionEntry* entries, CompletionEntry* scratch, int count, size_t depth) {
+    if (count < 32) {
+        for (int i = 1; i < count; i++) {
+            CompletionEntry entry = entries[i];
+            int j = i;
+            while (j > 0 && strcmp(entries[j - 1].name + depth, entry.name + depth) > 0) {
+                entries[j] = entries[j - 1];
+                j--;
+            }
+            entries[j] = entry;
+        }
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        entries[i].key = entry_key(entries[i].name + depth);
+    }
+
+    CompletionEntry* src = entries;
+    CompletionEntry* dst = scratch;
+    for (int shift = 0; shift < 64; shift += 8) {
+        int offsets[256] = {0};
+        for (int i = 0; i < count; i++) {
+            offsets[(src[i].key >> shift) & 0xFF]++;
+        }
+        if (offsets[(src[0].key >> shift) & 0xFF] == count) continue;
+
+        int position = 0;
+        for (int b = 0; b < 256; b++) {
+            int n = offsets[b];
+            offsets[b] = position;
+            position += n;
+        }
+        for (int i = 0; i < count; i++) {
+            dst[offsets[(src[i].key >> shift) & 0xFF]++] = src[i];
+        }
+        CompletionEntry* swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != entries) memcpy(entries, src, count * sizeof(CompletionEntry));
+
+    // A zero low byte means the names ended inside this window, so they are equal
+    for (int i = 0; i < count; ) {
+        int j = i + 1;
+        while (j < count && entries[j].key == entries[i].key) j++;
+        if (j - i > 1 && (entries[i].key & 0xFF) != 0) {
+            listing_sort(entries + i, scratch + i, j - i, depth + 8);
+        }
+        i = j;
+    }
+}
+
+static void listing_free(CompletionListing* listing) {
+    free(listing->entries);
+    free(listing->names);
+    memset(listing, 0, sizeof(*listing));
+}
+
+// Appends a name; entry names hold pool offsets until listing_finish()
+static int listing_append(CompletionListing* listing, const char* name, size_t length,
+                          VNode* node, int is_dir) {
+    if (listing->count == listing->capacity) {
+        int capacity = listing->capacity ? listing->capacity * 2 : 256;
+        CompletionEntry* entries = realloc(listing->entries, capacity * sizeof(CompletionEntry));
+        if (!entries) return -1;
+        listing->entries = entries;
+        listing->capacity = capacity;
+    }
+    if (listing->names_used + length + 1 > listing->names_size) {
+        size_t size = listing->names_size ? listing->names_size * 2 : 4096;
+        while (size < listing->names_used + length + 1) size *= 2;
+        char* names = realloc(listing->names, size);
+        if (!names) return -1;
+        listing->names = names;
+        listing->names_size = size;
+    }
+
+    memcpy(listing->names + listing->names_used, name, length);
+    listing->names[listing->names_used + length] = '\0';
+
+    CompletionEntry* entry = &listing->entries[listing->count++];
+    entry->name = NULL;
+    entry->key = listing->names_used;
+    entry->node = node;
+    entry->is_dir = (uint8_t)is_dir;
+    listing->names_used += length + 1;
+    return 0;
+}
+
+static int listing_finish(CompletionListing* listing) {
+    for (int i = 0; i < listing->count; i++) {
+        listing->entries[i].name = listing->names + listing->entries[i].key;
+    }
+    if (listing->count < 2) return 0;
+
+    CompletionEntry* scratch = malloc(listing->count * sizeof(CompletionEntry));
+    if (!scratch) return -1;
+    listing_sort(listing->entries, scratch, listing->count, 0);
+    free(scratch);
+    return 0;
+}
+
+// One pass over the child list; the list is the slow part (a cache miss per node)
+static int listing_build_directory(CompletionListing* listing, VNode* dir) {
+    for (VNode* child = dir->children; child; child = child->next) {
+        int is_dir = child->is_directory;
+        if (child->is_symlink) {
+            VNode* target = vfs_resolve_symlink(child);
+            is_dir = target && target->is_directory;
+        }
+        if (listing_append(listing, child->name, strlen(child->name), child, is_dir) != 0) {
+            listing_free(listing);
+            return -1;
+        }
+    }
+
+    if (listing_finish(listing) != 0) {
+        listing_free(listing);
+        return -1;
+    }
+    listing->dir = dir;
+    listing->generation = dir->generation;
+    listing->built = 1;
+    return 0;
+}
+
+// Index range [*first, *last) of entries starting with prefix
+static void listing_range(const CompletionListing* listing, const char* prefix,
+                          int* first, int* last) {
+    size_t length = strlen(prefix);
+    int lo = 0, hi = listing->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strncmp(listing->entries[mid].name, prefix, length) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    *first = lo;
+
+    hi = listing->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strncmp(listing->entries[mid].name, prefix, length) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+    *last = lo;
+}
+
+// Cached listing for a directory, rebuilt when its generation has moved on
+static CompletionListing* completion_dir_listing(VNode* dir) {
+    CompletionListing* slot = NULL;
+    for (int i = 0; i < COMPLETION_DIR_CACHE; i++) {
+        if (g_dir_cache[i].built && g_dir_cache[i].dir == dir) {
+            slot = &g_dir_cache[i];
+            break;
+        }
+    }
+
+    if (slot && slot->generation == dir->generation) {
+        slot->last_used = ++g_cache_clock;
+        return slot;
+    }
+
+    if (!slot) {
+        slot = &g_dir_cache[0];
+        for (int i = 1; i < COMPLETION_DIR_CACHE && slot->built; i++) {
+            if (!g_dir_cache[i].built || g_dir_cache[i].last_used < slot->last_used) {
+                slot = &g_dir_cache[i];
+            }
+        }
+    }
+
+    listing_free(slot);
+    if (listing_build_directory(slot, dir) != 0) return NULL;
+    slot->last_used = ++g_cache_clock;
+    return slot;
+}
+
+static VNode* listing_find(VNode* dir, const char* name) {
+    CompletionListing* listing = completion_dir_listing(dir);
+    if (!listing) return NULL;
+
+    int first, last;
+    listing_range(listing, name, &first, &last);
+    for (int i = first; i < last; i++) {
+        if (strcmp(listing->entries[i].name, name) == 0) return listing->entries[i].node;
+    }
+    return NULL;
+}
+
+// Resolve a VFS path with "." and ".." (vfs_find_node handles neither)
+static VNode* completion_resolve_dir(const char* path) {
+    VNode* root = vfs_find_node("/");
+    if (!root) return NULL;
+
+    char full[512];
+    if (path[0] == '/') {
+        snprintf(full, sizeof(full), "%s", path);
+    } else {
+        const char* cwd = vfs_getcwd();
+        snprintf(full, sizeof(full), "%s/%s", cwd ? cwd : "/", path);
+    }
+
+    VNode* current = root;
+    char* part = full;
+    while (current && *part) {
+        char* end = strchr(part, '/');
+        if (end) *end = '\0';
+        char* next = end ? end + 1 : part + strlen(part);
+
+        if (part[0] == '\0' || strcmp(part, ".") == 0) {
+            part = next;
+            continue;
+        }
+        if (strcmp(part, "..") == 0) {
+            if (current->parent) current = current->parent;
+            part = next;
+            continue;
+        }
+        current = listing_find(current, part);
+        if (current && current->is_symlink) current = vfs_resolve_symlink(current);
+        if (current && !current->is_directory) current = NULL;
+        part = next;
+    }
+    return current;
+}
+
+// Builtins plus scripts in /bin (extension stripped, as the shell runs them)
+static CompletionListing* completion_command_listing(void) {
+    VNode* bin = vfs_find_node("/bin");
+    unsigned long generation = bin ? bin->generation : 0;
+
+    if (g_commands.built && g_commands.dir == bin && g_commands.generation == generation) {
+        return &g_commands;
+    }
+    listing_free(&g_commands);
+
+    for (int i = 0; i < command_table_size; i++) {
+        const char* name = command_table[i].name;
+        if (listing_append(&g_commands, name, strlen(name), NULL, 0) != 0) {
+            listing_free(&g_commands);
+            return NULL;
+        }
+    }
+    if (bin) {
+        static const char* script_exts[] = { ".lua", ".py", ".pl" };
+        for (VNode* child = bin->children; child; child = child->next) {
+            if (child->is_directory) continue;
+            size_t length = strlen(child->name);
+            for (int e = 0; e < 3; e++) {
+                size_t ext_length = strlen(script_exts[e]);
+                if (length > ext_length && strcmp(child->name + length - ext_length, script_exts[e]) == 0) {
+                    length -= ext_length;
+                    break;
+                }
+            }
+            if (listing_append(&g_commands, child->name, length, NULL, 0) != 0) {
+                listing_free(&g_commands);
+                return NULL;
+            }
+        }
+    }
+
+    if (listing_finish(&g_commands) != 0) {
+        listing_free(&g_commands);
+        return NULL;
+    }
+
+    // The command table has a few names registered twice
+    int unique = 0;
+    for (int i = 0; i < g_commands.count; i++) {
+        if (unique > 0 && strcmp(g_commands.entries[unique - 1].name, g_commands.entries[i].name) == 0) {
+            continue;
+        }
+        g_commands.entries[unique++] = g_commands.entries[i];
+    }
+    g_commands.count = unique;
+    g_commands.dir = bin;
+    g_commands.generation = generation;
+    g_commands.built = 1;
+    return &g_commands;
+}
+
+void completion_invalidate(void) {
+    for (int i = 0; i < COMPLETION_DIR_CACHE; i++) {
+        listing_free(&g_dir_cache[i]);
+    }
+    listing_free(&g_commands);
+}
+
+// ---------------------------------------------------------------------------
+// Candidate sources
+// ---------------------------------------------------------------------------
+
+static void completion_reset(CompletionResult* result) {
+    result->count = 0;
+    result->total = 0;
+    result->common[0] = '\0';
+    result->common_length = 0;
+}
+
+void completion_add(CompletionResult* result, const char* text, char suffix) {
+    size_t length = strlen(text);
+
+    if (result->total == 0) {
+        if (length >= sizeof(result->common)) length = sizeof(result->common) - 1;
+        memcpy(result->common, text, length);
+        result->common_length = length;
+    } else {
+        size_t shared = 0;
+        while (shared < result->common_length && shared < length && result->common[shared] == text[shared]) {
+            shared++;
+        }
+        result->common_length = shared;
+    }
+    result->common[result->common_length] = '\0';
+
+    if (result->count < COMPLETION_MAX_RESULTS) {
+        result->items[result->count].text = text;
+        result->items[result->count].suffix = suffix;
+        result->count++;
+    }
+    result->total++;
+}
+
+static void completion_add_listing(CompletionListing* listing, const char* prefix, int dirs_only,
+                                   char file_suffix, CompletionResult* result) {
+    int first, last;
+    listing_range(listing, prefix, &first, &last);
+
+    for (int i = first; i < last; i++) {
+        const CompletionEntry* entry = &listing->entries[i];
+        // Dotfiles only show up once the user has typed the dot
+        if (entry->name[0] == '.' && prefix[0] != '.') continue;
+        if (dirs_only && !entry->is_dir) continue;
+        completion_add(result, entry->name, entry->is_dir ? '/' : file_suffix);
+    }
+}
+
+// Completes the last path component; moves result->start past the directory part
+void completion_add_paths(const char* word, int dirs_only, CompletionResult* result) {
+    const char* slash = strrchr(word, '/');
+    const char* base = slash ? slash + 1 : word;
+    char dir_path[512];
+
+    if (!slash) {
+        strcpy(dir_path, ".");
+    } else if (slash == word) {
+        strcpy(dir_path, "/");
+    } else if (word[0] == '~' && (word[1] == '/' || word + 1 == slash)) {
+        const char* home = get_env_var("HOME");
+        snprintf(dir_path, sizeof(dir_path), "%s%.*s", home ? home : "/home",
+                 (int)(slash - word - 1), word + 1);
+    } else {
+        snprintf(dir_path, sizeof(dir_path), "%.*s", (int)(slash - word), word);
+    }
+
+    result->start += (size_t)(base - word);
+    result->length = strlen(base);
+
+    VNode* dir = completion_resolve_dir(dir_path);
+    if (!dir) return;
+
+    CompletionListing* listing = completion_dir_listing(dir);
+    if (listing) completion_add_listing(listing, base, dirs_only, ' ', result);
+}
+
+void completion_add_commands(const char* word, CompletionResult* result) {
+    CompletionListing* listing = completion_command_listing();
+    if (listing) completion_add_listing(listing, word, 0, ' ', result);
+}
+
+void completion_add_env_vars(const char* word, CompletionResult* result) {
+    const char* names[128];
+    int count = get_env_var_names(names, 128);
+    size_t length = strlen(word);
+
+    for (int i = 0; i < count; i++) {
+        if (strncmp(names[i], word, length) == 0) {
+            completion_add(result, names[i], 0);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Argument providers
+// ---------------------------------------------------------------------------
+
+int completion_register(const char* command, CompletionProviderFn provider) {
+    for (int i = 0; i < g_provider_count; i++) {
+        if (strcmp(g_providers[i].command, command) == 0) {
+            g_providers[i].provider = provider;
+            return 0;
+        }
+    }
+    if (g_provider_count >= COMPLETION_MAX_PROVIDERS) return -1;
+
+    strncpy(g_providers[g_provider_count].command, command, sizeof(g_providers[0].command) - 1);
+    g_providers[g_provider_count].command[sizeof(g_providers[0].command) - 1] = '\0';
+    g_providers[g_provider_count].provider = provider;
+    g_provider_count++;
+    return 0;
+}
+
+static CompletionProviderFn completion_find_provider(const char* command) {
+    for (int i = 0; i < g_provider_count; i++) {
+        if (strcmp(g_providers[i].command, command) == 0) return g_providers[i].provider;
+    }
+    return NULL;
+}
+
+static int provide_directories(const char* word, int arg_index, CompletionResult* result) {
+    (void)arg_index;
+    completion_add_paths(word, 1, result);
+    return 1;
+}
+
+static int provide_commands(const char* word, int arg_index, CompletionResult* result) {
+    (void)arg_index;
+    completion_add_commands(word, result);
+    return 1;
+}
+
+static int provide_env_vars(const char* word, int arg_index, CompletionResult* result) {
+    (void)arg_index;
+    completion_add_env_vars(word, result);
+    return 1;
+}
+
+static int provide_options(const char* word, const char* const* options, CompletionResult* result) {
+    size_t length = strlen(word);
+    for (int i = 0; options[i]; i++) {
+        if (strncmp(options[i], word, length) == 0) completion_add(result, options[i], ' ');
+    }
+    return 1;
+}
+
+static int provide_history(const char* word, int arg_index, CompletionResult* result) {
+    static const char* const options[] = { "--bench", "-a", "-c", "-f", "-p", "-s", NULL };
+    return arg_index == 1 ? provide_options(word, options, result) : 1;
+}
+
+static int provide_complete(const char* word, int arg_index, CompletionResult* result) {
+    static const char* const options[] = { "--bench", NULL };
+    if (arg_index == 1 && word[0] == '-') return provide_options(word, options, result);
+    return arg_index == 1 ? provide_commands(word, arg_index, result) : 0;
+}
+
+static void completion_register_builtins(void) {
+    if (g_builtins_registered) return;
+    g_builtins_registered = 1;
+
+    completion_register("cd", provide_directories);
+    completion_register("rmdir", provide_directories);
+    completion_register("help", provide_commands);
+    completion_register("man", provide_commands);
+    completion_register("which", provide_commands);
+    completion_register("unset", provide_env_vars);
+    completion_register("export", provide_env_vars);
+    completion_register("history", provide_history);
+    completion_register("complete", provide_complete);
+}
+
+// ---------------------------------------------------------------------------
+// Line analysis
+// ---------------------------------------------------------------------------
+
+static int is_word_break(char ch) {
+    return ch == ' ' || ch == '\t' || ch == '|' || ch == ';' || ch == '&' ||
+           ch == '<' || ch == '>' || ch == '"' || ch == '\'';
+}
+
+static int candidate_compare(const void* a, const void* b) {
+    return strcmp(((const CompletionCandidate*)a)->text, ((const CompletionCandidate*)b)->text);
+}
+
+int completion_complete(const char* line, size_t cursor, CompletionResult* result) {
+    completion_register_builtins();
+    completion_reset(result);
+
+    size_t start = cursor;
+    while (start > 0 && !is_word_break(line[start - 1])) start--;
+    if (cursor - start >= COMPLETION_MAX_WORD) return 0;
+
+    char word[COMPLETION_MAX_WORD];
+    memcpy(word, line + start, cursor - start);
+    word[cursor - start] = '\0';
+    result->start = start;
+    result->length = cursor - start;
+
+    // Which word of the current pipeline stage is under the cursor?
+    char command[64] = "";
+    int arg_index = 0;
+    int after_redirect = 0;
+    size_t i = 0;
+    while (i < start) {
+        char ch = line[i];
+        if (ch == '|' || ch == ';' || ch == '&') {
+            command[0] = '\0';
+            arg_index = 0;
+            after_redirect = 0;
+            i++;
+        } else if (ch == '<' || ch == '>') {
+            after_redirect = 1;
+            i++;
+        } else if (is_word_break(ch)) {
+            i++;
+        } else {
+            size_t end = i;
+            while (end < start && !is_word_break(line[end])) end++;
+            if (after_redirect) {
+                after_redirect = 0;
+            } else {
+                if (arg_index == 0) {
+                    size_t length = end - i < sizeof(command) - 1 ? end - i : sizeof(command) - 1;
+                    memcpy(command, line + i, length);
+                    command[length] = '\0';
+                }
+                arg_index++;
+            }
+            i = end;
+        }
+    }
+
+    if (word[0] == '$') {
+        result->start++;
+        result->length--;
+        completion_add_env_vars(word + 1, result);
+    } else if (after_redirect || strchr(word, '/')) {
+        completion_add_paths(word, 0, result);
+    } else if (arg_index == 0) {
+        completion_add_commands(word, result);
+    } else {
+        CompletionProviderFn provider = completion_find_provider(command);
+        if (!provider || !provider(word, arg_index, result)) {
+            completion_add_paths(word, 0, result);
+        }
+    }
+
+    if (result->count > 1) {
+        qsort(result->items, result->count, sizeof(CompletionCandidate), candidate_compare);
+    }
+    return result->total;
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+void completion_benchmark(int entries) {
+    if (entries <= 0) entries = 100000;
+
+    static const char* stems[] = { "file", "kernel", "scheduler", "vfs", "network",
+                                   "docs", "build", "archive" };
+    static const char* exts[] = { "c", "h", "txt", "log" };
+
+    VNode* dir = vfs_create_directory_node("completion-bench");
+    if (!dir) {
+        printf("complete: out of memory\n");
+        return;
+    }
+
+    char name[64];
+    for (int i = 0; i < entries; i++) {
+        VNode* node;
+        if (i % 16 == 0) {
+            snprintf(name, sizeof(name), "%s_dir%06d", stems[i % 8], i);
+            node = vfs_create_directory_node(name);
+        } else {
+            snprintf(name, sizeof(name), "%s_%06d.%s", stems[i % 8], i, exts[(i / 8) % 4]);
+            node = vfs_create_file_node(name);
+        }
+        if (!node) break;
+        vfs_add_child(dir, node);
+    }
+
+    CompletionResult* result = malloc(sizeof(CompletionResult));
+    if (!result) {
+        vfs_cleanup_node(dir);
+        printf("complete: out of memory\n");
+        return;
+    }
+
+    double start = completion_now_seconds();
+    completion_dir_listing(dir);
+    double cold = completion_now_seconds() - start;
+
+    // Narrow prefixes, the common interactive case
+    int hits = 0;
+    start = completion_now_seconds();
+    for (int i = 0; i < 1000; i++) {
+        int n = (int)((unsigned)(i * 7919) % (unsigned)entries);
+        snprintf(name, sizeof(name), "%s_%06d", stems[n % 8], n);
+        name[strlen(stems[n % 8]) + 1 + (i % 5) + 1] = '\0';
+        completion_reset(result);
+        CompletionListing* listing = completion_dir_listing(dir);
+        if (listing) completion_add_listing(listing, name, 0, ' ', result);
+        hits += result->total;
+    }
+    double narrow = completion_now_seconds() - start;
+
+    // Broad prefix matching an eighth of the directory
+    start = completion_now_seconds();
+    for (int i = 0; i < 10; i++) {
+        completion_reset(result);
+        CompletionListing* listing = completion_dir_listing(dir);
+        if (listing) completion_add_listing(listing, stems[i % 8], i & 1, ' ', result);
+        hits += result->total;
+    }
+    double broad = completion_now_seconds() - start;
+
+    // A new file bumps the generation and forces one rebuild
+    VNode* extra = vfs_create_file_node("zzz_new_file.txt");
+    if (extra) vfs_add_child(dir, extra);
+    start = completion_now_seconds();
+    completion_dir_listing(dir);
+    double rebuild = completion_now_seconds() - start;
+
+    printf("completion benchmark: %d entries\n", entries);
+    printf("  cold listing:   %8.3f ms\n", cold * 1e3);
+    printf("  narrow prefix:  %8.3f us/op\n", narrow * 1e6 / 1000);
+    printf("  broad prefix:   %8.3f ms/op\n", broad * 1e3 / 10);
+    printf("  rebuild:        %8.3f ms\n", rebuild * 1e3);
+    printf("  (%d candidates)\n", hits);
+
+    free(result);
+    completion_invalidate();
+    vfs_cleanup_node(dir);
+}
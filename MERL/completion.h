@@ -0,0 +1,55 @@
+#ifndef COMPLETION_H
+#define COMPLETION_H
+
+#include <stddef.h>
+
+// Tab completion for the MERL shell.
+//
+// The word under the cursor is completed from one of several sources:
+//   - command names (builtins plus scripts in /bin) in command position
+//   - environment variable names after a '$'
+//   - a per-command argument provider, when one is registered
+//   - VFS paths otherwise
+// Directory listings are snapshotted into sorted arrays and cached per
+// directory; a cached listing stays valid until the directory's VFS
+// generation changes, so repeated completion in a large directory is a
+// binary search rather than a walk of the child list.
+
+#define COMPLETION_MAX_RESULTS   256
+#define COMPLETION_MAX_WORD      256
+#define COMPLETION_DIR_CACHE     8
+
+typedef struct {
+    const char* text;       // Borrowed; valid until the next completion call
+    char suffix;            // Appended when this is the only match ('/', ' ' or 0)
+} CompletionCandidate;
+
+typedef struct {
+    size_t start;           // Offset in the line where the replaced text begins
+    size_t length;          // Length of the text being replaced
+    CompletionCandidate items[COMPLETION_MAX_RESULTS];
+    int count;              // Candidates stored in items
+    int total;              // All matches, may exceed count
+    char common[COMPLETION_MAX_WORD];   // Longest prefix shared by every match
+    size_t common_length;
+} CompletionResult;
+
+// Argument providers get the word being completed and its argument index
+// (1 = first argument).  Return 0 to fall back to path completion.
+typedef int (*CompletionProviderFn)(const char* word, int arg_index, CompletionResult* result);
+
+int completion_register(const char* command, CompletionProviderFn provider);
+
+// Returns the number of matches for the word ending at cursor
+int completion_complete(const char* line, size_t cursor, CompletionResult* result);
+
+// Building blocks for providers
+void completion_add(CompletionResult* result, const char* text, char suffix);
+void completion_add_paths(const char* word, int dirs_only, CompletionResult* result);
+void completion_add_commands(const char* word, CompletionResult* result);
+void completion_add_env_vars(const char* word, CompletionResult* result);
+
+void completion_invalidate(void);
+void completion_benchmark(int entries);
+
+#endif // COMPLETION_H
@@ -0,0 +1,833 @@
+#include "history.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "vfs/vfs.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define HISTORY_NONE            0xFFFFFFFFu
+#define HISTORY_ARENA_CHUNK     (64 * 1024)
+#define HISTORY_FUZZY_SCAN      20000
+#define HISTORY_FUZZY_SLOTS     8192
+#define HISTORY_SHORT_SCAN      200000
+
+struct HistoryArena {
+    HistoryArena* next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+static HistoryStore g_history;
+static int g_history_ready = 0;
+
+// ===== Helpers =====
+
+static uint32_t history_hash(const char* text, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static const char* history_memmem(const char* haystack, size_t haystack_len,
+                                  const char* needle, size_t needle_len) {
+    if (needle_len == 0) return haystack;
+    if (needle_len > haystack_len) return NULL;
+
+    const char* last = haystack + haystack_len - needle_len;
+    for (const char* p = haystack; p <= last; p++) {
+        p = memchr(p, needle[0], (size_t)(last - p) + 1);
+        if (!p) return NULL;
+        if (memcmp(p, needle, needle_len) == 0) return p;
+    }
+    return NULL;
+}
+
+static char* history_arena_copy(HistoryStore* store, const char* text, size_t length) {
+    size_t needed = length + 1;
+    HistoryArena* arena = store->arena;
+
+    if (!arena || arena->size - arena->used < needed) {
+        size_t size = needed > HISTORY_ARENA_CHUNK ? needed : HISTORY_ARENA_CHUNK;
+        HistoryArena* chunk = malloc(sizeof(HistoryArena) + size);
+        if (!chunk) return NULL;
+        chunk->next = store->arena;
+        chunk->used = 0;
+        chunk->size = size;
+        store->arena = chunk;
+        arena = chunk;
+    }
+
+    char* copy = arena->data + arena->used;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    arena->used += needed;
+    return copy;
+}
+
+static double history_now_seconds(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+// ===== Deduplication table =====
+
+static int history_dedup_rehash(HistoryStore* store, uint32_t new_size) {
+    uint32_t* table = malloc(sizeof(uint32_t) * new_size);
+    if (!table) return -1;
+    memset(table, 0xFF, sizeof(uint32_t) * new_size);
+
+    // Only live entries survive a rehash; dead ones just waste probes
+    store->dedup_used = 0;
+    for (uint32_t i = store->first_live; i < store->count; i++) {
+        if (!store->entries[i].live) continue;
+        store->dedup_used++;
+        uint32_t slot = store->entries[i].hash & (new_size - 1);
+        while (table[slot] != HISTORY_NONE) {
+            slot = (slot + 1) & (new_size - 1);
+        }
+        table[slot] = i;
+    }
+
+    free(store->dedup_table);
+    store->dedup_table = table;
+    store->dedup_size = new_size;
+    return 0;
+}
+
+// Returns the slot holding `text`, or the empty slot where it belongs
+static uint32_t history_dedup_slot(HistoryStore* store, const char* text, uint32_t length, uint32_t hash) {
+    uint32_t mask = store->dedup_size - 1;
+    uint32_t slot = hash & mask;
+
+    while (store->dedup_table[slot] != HISTORY_NONE) {
+        const HistoryEntry* entry = &store->entries[store->dedup_table[slot]];
+        if (entry->hash == hash && entry->length == length &&
+            memcmp(entry->text, text, length) == 0) {
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// ===== Trie (prefix index) =====
+
+static uint32_t history_trie_new_node(HistoryStore* store, unsigned char ch) {
+    if (store->trie_count == store->trie_capacity) {
+        uint32_t new_capacity = store->trie_capacity ? store->trie_capacity * 2 : 1024;
+        HistoryTrieNode* grown = realloc(store->trie, sizeof(HistoryTrieNode) * new_capacity);
+        if (!grown) return 0;
+        store->trie = grown;
+        store->trie_capacity = new_capacity;
+    }
+
+    uint32_t index = store->trie_count++;
+    HistoryTrieNode* node = &store->trie[index];
+    node->child = 0;
+    node->sibling = 0;
+    node->latest = HISTORY_NONE;
+    node->chain = HISTORY_NONE;
+    node->ch = ch;
+    return index;
+}
+
+static uint32_t history_trie_child(HistoryStore* store, uint32_t node, unsigned char ch) {
+    for (uint32_t child = store->trie[node].child; child; child = store->trie[child].sibling) {
+        if (store->trie[child].ch == ch) return child;
+    }
+    return 0;
+}
+
+static void history_trie_insert(HistoryStore* store, uint32_t index) {
+    HistoryEntry* entry = &store->entries[index];
+    uint32_t depth = entry->length < HISTORY_TRIE_DEPTH ? entry->length : HISTORY_TRIE_DEPTH;
+    uint32_t node = 0;
+
+    store->trie[0].latest = index;
+    for (uint32_t d = 0; d < depth; d++) {
+        unsigned char ch = (unsigned char)entry->text[d];
+        uint32_t child = history_trie_child(store, node, ch);
+        if (!child) {
+            child = history_trie_new_node(store, ch);
+            if (!child) return;
+            store->trie[child].sibling = store->trie[node].child;
+            store->trie[node].child = child;
+        }
+        node = child;
+        store->trie[node].latest = index;
+    }
+
+    entry->trie_next = store->trie[node].chain;
+    store->trie[node].chain = index;
+}
+
+static int history_trie_build(HistoryStore* store) {
+    if (store->trie_built) return 0;
+
+    store->trie_count = 0;
+    history_trie_new_node(store, 0);
+    if (store->trie_count != 1) return -1;
+
+    for (uint32_t i = store->first_live; i < store->count; i++) {
+        if (store->entries[i].live) history_trie_insert(store, i);
+    }
+    store->trie_built = 1;
+    return 0;
+}
+
+static uint32_t history_trie_walk(HistoryStore* store, const char* prefix, size_t length) {
+    size_t depth = length < HISTORY_TRIE_DEPTH ? length : HISTORY_TRIE_DEPTH;
+    uint32_t node = 0;
+    for (size_t d = 0; d < depth; d++) {
+        node = history_trie_child(store, node, (unsigned char)prefix[d]);
+        if (!node) return HISTORY_NONE;
+    }
+    return node;
+}
+
+// Keep `results` sorted newest-first, bounded to max_results
+static void history_insert_result(uint32_t* results, int* count, int max_results, uint32_t index) {
+    int pos = *count;
+    if (pos == max_results) {
+        if (index <= results[pos - 1]) return;
+        pos--;
+    } else {
+        (*count)++;
+    }
+    while (pos > 0 && results[pos - 1] < index) {
+        results[pos] = results[pos - 1];
+        pos--;
+    }
+    results[pos] = index;
+}
+
+static void history_trie_collect(HistoryStore* store, uint32_t node, const char* prefix, size_t length,
+                                 uint32_t* results, int* count, int max_results) {
+    uint32_t* link = &store->trie[node].chain;
+    while (*link != HISTORY_NONE) {
+        uint32_t i = *link;
+        HistoryEntry* entry = &store->entries[i];
+
+        // Unlink superseded entries as we pass them so repeated commands don't pile up
+        if (!entry->live) {
+            *link = entry->trie_next;
+            continue;
+        }
+        link = &entry->trie_next;
+
+        if (length > HISTORY_TRIE_DEPTH &&
+            (entry->length < length || memcmp(entry->text, prefix, length) != 0)) {
+            continue;
+        }
+        history_insert_result(results, count, max_results, i);
+    }
+
+    for (uint32_t child = store->trie[node].child; child; child = store->trie[child].sibling) {
+        // Subtrees whose newest entry can't make the cut are skipped wholesale
+        if (*count == max_results && store->trie[child].latest <= results[max_results - 1]) continue;
+        history_trie_collect(store, child, prefix, length, results, count, max_results);
+    }
+}
+
+// ===== Trigram index (substring / fuzzy) =====
+
+static uint32_t history_ngram_bucket(const char* p) {
+    uint32_t key = ((uint32_t)(unsigned char)p[0] << 16) |
+                   ((uint32_t)(unsigned char)p[1] << 8) |
+                   (uint32_t)(unsigned char)p[2];
+    return (key * 2654435761u) >> 16 & (HISTORY_NGRAM_BUCKETS - 1);
+}
+
+static void history_ngram_insert(HistoryStore* store, uint32_t index) {
+    const HistoryEntry* entry = &store->entries[index];
+    if (entry->length < 3) return;
+
+    for (uint32_t p = 0; p + 3 <= entry->length; p++) {
+        HistoryPosting* posting = &store->ngrams[history_ngram_bucket(entry->text + p)];
+        if (posting->count > 0 && posting->items[posting->count - 1] == index) continue;
+
+        if (posting->count == posting->capacity) {
+            uint32_t new_capacity = posting->capacity ? posting->capacity * 2 : 8;
+            uint32_t* grown = realloc(posting->items, sizeof(uint32_t) * new_capacity);
+            if (!grown) return;
+            posting->items = grown;
+            posting->capacity = new_capacity;
+        }
+        posting->items[posting->count++] = index;
+    }
+}
+
+static int history_ngram_build(HistoryStore* store) {
+    if (store->ngrams_built) return 0;
+
+    store->ngrams = calloc(HISTORY_NGRAM_BUCKETS, sizeof(HistoryPosting));
+    if (!store->ngrams) return -1;
+
+    for (uint32_t i = store->first_live; i < store->count; i++) {
+        if (store->entries[i].live) history_ngram_insert(store, i);
+    }
+    store->ngrams_built = 1;
+    return 0;
+}
+
+static void history_ngram_free(HistoryStore* store) {
+    if (!store->ngrams) return;
+    for (uint32_t b = 0; b < HISTORY_NGRAM_BUCKETS; b++) {
+        free(store->ngrams[b].items);
+    }
+    free(store->ngrams);
+    store->ngrams = NULL;
+    store->ngrams_built = 0;
+}
+
+// ===== Entries =====
+
+static void history_evict_oldest(HistoryStore* store) {
+    while (store->first_live < store->count) {
+        HistoryEntry* entry = &store->entries[store->first_live++];
+        if (entry->live) {
+            entry->live = 0;
+            store->live_count--;
+            return;
+        }
+    }
+}
+
+// Insert an entry whose text is already stable (arena copy or mapping)
+static int history_append_entry(HistoryStore* store, const char* text, uint32_t length) {
+    if (store->count == store->capacity) {
+        uint32_t new_capacity = store->capacity ? store->capacity * 2 : 1024;
+        HistoryEntry* grown = realloc(store->entries, sizeof(HistoryEntry) * new_capacity);
+        if (!grown) return -1;
+        store->entries = grown;
+        store->capacity = new_capacity;
+    }
+
+    if ((store->dedup_used + 1) * 2 > store->dedup_size) {
+        uint32_t new_size = 2048;
+        while (new_size < (store->live_count + 1) * 4) new_size *= 2;
+        if (history_dedup_rehash(store, new_size) != 0) return -1;
+    }
+
+    uint32_t index = store->count;
+    uint32_t hash = history_hash(text, length);
+    uint32_t slot = history_dedup_slot(store, text, length, hash);
+
+    // A repeated command supersedes its older copy
+    if (store->dedup_table[slot] != HISTORY_NONE) {
+        HistoryEntry* old = &store->entries[store->dedup_table[slot]];
+        if (old->live) {
+            old->live = 0;
+            store->live_count--;
+        }
+    } else {
+        store->dedup_used++;
+    }
+
+    HistoryEntry* entry = &store->entries[index];
+    entry->text = text;
+    entry->length = length;
+    entry->hash = hash;
+    entry->trie_next = HISTORY_NONE;
+    entry->live = 1;
+
+    store->dedup_table[slot] = index;
+    store->count++;
+    store->live_count++;
+
+    if (store->live_count > HISTORY_MAX_ENTRIES) {
+        history_evict_oldest(store);
+    }
+
+    if (store->trie_built) history_trie_insert(store, index);
+    if (store->ngrams_built) history_ngram_insert(store, index);
+    return (int)index;
+}
+
+static void history_reset_indexes(HistoryStore* store) {
+    free(store->entries);
+    free(store->dedup_table);
+    free(store->trie);
+    history_ngram_free(store);
+
+    while (store->arena) {
+        HistoryArena* next = store->arena->next;
+        free(store->arena);
+        store->arena = next;
+    }
+
+    store->entries = NULL;
+    store->count = store->capacity = store->live_count = store->first_live = 0;
+    store->dedup_table = NULL;
+    store->dedup_size = store->dedup_used = 0;
+    store->trie = NULL;
+    store->trie_count = store->trie_capacity = 0;
+    store->trie_built = 0;
+}
+
+// ===== Backing log =====
+
+static void history_unmap(HistoryStore* store) {
+#ifdef _WIN32
+    if (store->map_view) UnmapViewOfFile(store->map_view);
+    if (store->map_handle) CloseHandle((HANDLE)store->map_handle);
+    if (store->map_file) CloseHandle((HANDLE)store->map_file);
+#else
+    free(store->map_view);
+#endif
+    store->map_view = NULL;
+    store->map_handle = NULL;
+    store->map_file = NULL;
+    store->map_size = 0;
+}
+
+static int history_map_log(HistoryStore* store) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(store->path, GENERIC_READ,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return 0; // No history yet
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return 0;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) {
+        CloseHandle(file);
+        return -1;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return -1;
+    }
+
+    store->map_file = file;
+    store->map_handle = mapping;
+    store->map_view = view;
+    store->map_size = (size_t)size.QuadPart;
+#else
+    FILE* file = fopen(store->path, "rb");
+    if (!file) return 0;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size > 0) {
+        store->map_view = malloc((size_t)size);
+        if (store->map_view && fread(store->map_view, 1, (size_t)size, file) == (size_t)size) {
+            store->map_size = (size_t)size;
+        } else {
+            free(store->map_view);
+            store->map_view = NULL;
+        }
+    }
+    fclose(file);
+#endif
+    return 0;
+}
+
+static void history_load_mapping(HistoryStore* store) {
+    const char* p = (const char*)store->map_view;
+    const char* end = p + store->map_size;
+
+    while (p < end) {
+        const char* newline = memchr(p, '\n', (size_t)(end - p));
+        const char* line_end = newline ? newline : end;
+        size_t length = (size_t)(line_end - p);
+        if (length > 0 && p[length - 1] == '\r') length--;
+
+        if (length > 0 && length < HISTORY_MAX_LINE) {
+            history_append_entry(store, p, (uint32_t)length);
+        }
+        p = newline ? newline + 1 : end;
+    }
+}
+
+// Rewrite the log with only live entries once it is mostly superseded lines
+static void history_compact_log(HistoryStore* store) {
+    if (!store->path[0] || store->count < 1024 || store->live_count * 2 > store->count) return;
+
+    char temp_path[520];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", store->path);
+    FILE* out = fopen(temp_path, "wb");
+    if (!out) return;
+
+    for (uint32_t i = store->first_live; i < store->count; i++) {
+        const HistoryEntry* entry = &store->entries[i];
+        if (!entry->live) continue;
+        fwrite(entry->text, 1, entry->length, out);
+        fputc('\n', out);
+    }
+    int ok = fclose(out) == 0;
+
+    if (store->log) {
+        fclose(store->log);
+        store->log = NULL;
+    }
+    history_unmap(store);
+
+#ifdef _WIN32
+    if (!ok || !MoveFileExA(temp_path, store->path, MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFileA(temp_path);
+    }
+#else
+    if (!ok || rename(temp_path, store->path) != 0) {
+        remove(temp_path);
+    }
+#endif
+}
+
+// ===== Public store API =====
+
+int history_store_init(HistoryStore* store, const char* host_path) {
+    memset(store, 0, sizeof(*store));
+
+    if (host_path && host_path[0]) {
+        strncpy(store->path, host_path, sizeof(store->path) - 1);
+        if (history_map_log(store) == 0 && store->map_view) {
+            history_load_mapping(store);
+        }
+        store->log = fopen(store->path, "ab");
+    }
+    return 0;
+}
+
+void history_store_close(HistoryStore* store) {
+    history_compact_log(store);
+
+    if (store->log) {
+        fclose(store->log);
+        store->log = NULL;
+    }
+    history_unmap(store);
+    history_reset_indexes(store);
+}
+
+int history_store_add(HistoryStore* store, const char* command) {
+    if (!command) return -1;
+
+    size_t length = strcspn(command, "\r\n");
+    if (length == 0 || length >= HISTORY_MAX_LINE) return -1;
+
+    // Repeating the previous command doesn't grow the log
+    if (store->count > 0) {
+        const HistoryEntry* last = &store->entries[store->count - 1];
+        if (last->live && last->length == length && memcmp(last->text, command, length) == 0) {
+            return (int)(store->count - 1);
+        }
+    }
+
+    char* copy = history_arena_copy(store, command, length);
+    if (!copy) return -1;
+
+    int index = history_append_entry(store, copy, (uint32_t)length);
+    if (index >= 0 && store->log) {
+        fwrite(copy, 1, length, store->log);
+        fputc('\n', store->log);
+        fflush(store->log);
+    }
+    return index;
+}
+
+const char* history_store_get(HistoryStore* store, uint32_t index, size_t* length) {
+    if (index >= store->count || !store->entries[index].live) return NULL;
+    if (length) *length = store->entries[index].length;
+    return store->entries[index].text;
+}
+
+void history_store_clear(HistoryStore* store) {
+    if (store->log) {
+        fclose(store->log);
+        store->log = NULL;
+    }
+    history_unmap(store);
+    history_reset_indexes(store);
+
+    if (store->path[0]) {
+        // Truncate, then keep appending to the fresh log
+        FILE* truncated = fopen(store->path, "wb");
+        if (truncated) fclose(truncated);
+        store->log = fopen(store->path, "ab");
+    }
+}
+
+int history_store_find_prefix(HistoryStore* store, const char* prefix) {
+    uint32_t result;
+    return history_store_search_prefix(store, prefix, &result, 1) == 1 ? (int)result : -1;
+}
+
+int history_store_search_prefix(HistoryStore* store, const char* prefix, uint32_t* results, int max_results) {
+    if (!prefix || max_results <= 0 || history_trie_build(store) != 0) return 0;
+
+    size_t length = strlen(prefix);
+    uint32_t node = history_trie_walk(store, prefix, length);
+    if (node == HISTORY_NONE) return 0;
+
+    // Fast path: the node already knows its newest entry
+    if (max_results == 1 && length <= HISTORY_TRIE_DEPTH) {
+        uint32_t latest = store->trie[node].latest;
+        if (latest == HISTORY_NONE || latest >= store->count || !store->entries[latest].live) return 0;
+        results[0] = latest;
+        return 1;
+    }
+
+    int count = 0;
+    history_trie_collect(store, node, prefix, length, results, &count, max_results);
+    return count;
+}
+
+int history_store_search_substring(HistoryStore* store, const char* query, uint32_t before) {
+    if (!query) return -1;
+    if (before > store->count) before = store->count;
+
+    size_t length = strlen(query);
+
+    if (length < 3) {
+        // Too short for the trigram index; bounded scan from the newest entry
+        uint32_t scanned = 0;
+        for (uint32_t i = before; i-- > store->first_live && scanned < HISTORY_SHORT_SCAN; scanned++) {
+            const HistoryEntry* entry = &store->entries[i];
+            if (entry->live && history_memmem(entry->text, entry->length, query, length)) {
+                return (int)i;
+            }
+        }
+        return -1;
+    }
+
+    if (history_ngram_build(store) != 0) return -1;
+
+    // Walk the rarest trigram's posting list and verify candidates
+    const HistoryPosting* best = NULL;
+    for (size_t p = 0; p + 3 <= length; p++) {
+        const HistoryPosting* posting = &store->ngrams[history_ngram_bucket(query + p)];
+        if (!best || posting->count < best->count) best = posting;
+    }
+    if (!best || best->count == 0) return -1;
+
+    // First posting at or after `before`
+    uint32_t lo = 0, hi = best->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (best->items[mid] < before) lo = mid + 1; else hi = mid;
+    }
+
+    for (uint32_t k = lo; k-- > 0;) {
+        uint32_t i = best->items[k];
+        if (i < store->first_live) break;
+        const HistoryEntry* entry = &store->entries[i];
+        if (entry->live && history_memmem(entry->text, entry->length, query, length)) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+int history_store_search_fuzzy(HistoryStore* store, const char* query, uint32_t* results, int max_results) {
+    if (!query || max_results <= 0) return 0;
+
+    size_t length = strlen(query);
+    if (length < 3) {
+        int count = 0;
+        uint32_t before = store->count;
+        while (count < max_results) {
+            int found = history_store_search_substring(store, query, before);
+            if (found < 0) break;
+            results[count++] = (uint32_t)found;
+            before = (uint32_t)found;
+        }
+        return count;
+    }
+
+    if (history_ngram_build(store) != 0) return 0;
+
+    // Unique query trigram buckets
+    uint32_t buckets[64];
+    int bucket_count = 0;
+    for (size_t p = 0; p + 3 <= length && bucket_count < 64; p++) {
+        uint32_t b = history_ngram_bucket(query + p);
+        int seen = 0;
+        for (int j = 0; j < bucket_count; j++) {
+            if (buckets[j] == b) { seen = 1; break; }
+        }
+        if (!seen) buckets[bucket_count++] = b;
+    }
+
+    // Count shared trigrams per candidate (recent postings only)
+    uint32_t* slot_entry = malloc(sizeof(uint32_t) * HISTORY_FUZZY_SLOTS);
+    uint16_t* slot_score = calloc(HISTORY_FUZZY_SLOTS, sizeof(uint16_t));
+    if (!slot_entry || !slot_score) {
+        free(slot_entry);
+        free(slot_score);
+        return 0;
+    }
+    memset(slot_entry, 0xFF, sizeof(uint32_t) * HISTORY_FUZZY_SLOTS);
+    int used = 0;
+
+    for (int j = 0; j < bucket_count; j++) {
+        const HistoryPosting* posting = &store->ngrams[buckets[j]];
+        uint32_t scanned = 0;
+        for (uint32_t k = posting->count; k-- > 0 && scanned < HISTORY_FUZZY_SCAN; scanned++) {
+            uint32_t i = posting->items[k];
+            if (i < store->first_live) break;
+            if (!store->entries[i].live) continue;
+
+            uint32_t slot = (i * 2654435761u) & (HISTORY_FUZZY_SLOTS - 1);
+            while (slot_entry[slot] != HISTORY_NONE && slot_entry[slot] != i) {
+                slot = (slot + 1) & (HISTORY_FUZZY_SLOTS - 1);
+            }
+            if (slot_entry[slot] == HISTORY_NONE) {
+                if (used >= HISTORY_FUZZY_SLOTS / 2) continue;
+                slot_entry[slot] = i;
+                used++;
+            }
+            slot_score[slot]++;
+        }
+    }
+
+    // Best score first, newest first among ties
+    int threshold = (bucket_count + 1) / 2;
+    int count = 0;
+    uint16_t scores[256];
+    if (max_results > 256) max_results = 256;
+
+    for (uint32_t s = 0; s < HISTORY_FUZZY_SLOTS; s++) {
+        if (slot_entry[s] == HISTORY_NONE || slot_score[s] < threshold) continue;
+
+        uint32_t index = slot_entry[s];
+        uint16_t score = slot_score[s];
+        int pos = count;
+        if (pos == max_results) {
+            if (score < scores[pos - 1] || (score == scores[pos - 1] && index < results[pos - 1])) continue;
+            pos--;
+        } else {
+            count++;
+        }
+        while (pos > 0 && (scores[pos - 1] < score ||
+                           (scores[pos - 1] == score && results[pos - 1] < index))) {
+            scores[pos] = scores[pos - 1];
+            results[pos] = results[pos - 1];
+            pos--;
+        }
+        scores[pos] = score;
+        results[pos] = index;
+    }
+
+    free(slot_entry);
+    free(slot_score);
+    return count;
+}
+
+// ===== Shell-wide history =====
+
+HistoryStore* history_get_store(void) {
+    if (!g_history_ready) history_init();
+    return &g_history;
+}
+
+int history_init(void) {
+    if (g_history_ready) return 0;
+
+    // ~/.merl_history on the host side of the VFS, or next to users.txt otherwise
+    char path[512] = "merl_history.log";
+    char* host_path = vfs_get_host_path_from_vfs_path("/home/.merl_history");
+    if (host_path && host_path[0]) {
+        strncpy(path, host_path, sizeof(path) - 1);
+        path[sizeof(path) - 1] = '\0';
+    }
+
+    history_store_init(&g_history, path);
+    g_history_ready = 1;
+    return 0;
+}
+
+void history_shutdown(void) {
+    if (!g_history_ready) return;
+    history_store_close(&g_history);
+    g_history_ready = 0;
+}
+
+void history_benchmark(uint32_t count) {
+    if (count == 0) count = HISTORY_MAX_ENTRIES;
+
+    static const char* verbs[] = { "ls", "cd", "cat", "grep -n", "make", "gzip", "tar -cvf",
+                                   "edit", "find . -name", "netstat", "ping", "lua" };
+    static const char* nouns[] = { "src", "kernel", "scheduler", "vfs", "network", "docs",
+                                   "build", "archive", "config", "notes" };
+
+    HistoryStore store;
+    history_store_init(&store, NULL);
+
+    char line[128];
+    unsigned int seed = 0xC0FFEEu;
+
+    double start = history_now_seconds();
+    for (uint32_t i = 0; i < count; i++) {
+        seed = seed * 1103515245u + 12345u;
+        unsigned int r = seed >> 8;
+        snprintf(line, sizeof(line), "%s %s/%s_%u.c", verbs[r % 12], nouns[(r / 12) % 10],
+                 nouns[(r / 120) % 10], (r / 1200) % (count / 4 + 1));
+        history_store_add(&store, line);
+    }
+    double add_time = history_now_seconds() - start;
+
+    start = history_now_seconds();
+    history_store_find_prefix(&store, "g");
+    double trie_build = history_now_seconds() - start;
+
+    uint32_t results[16];
+    int hits = 0;
+    start = history_now_seconds();
+    for (int i = 0; i < 1000; i++) {
+        snprintf(line, sizeof(line), "%s %s", verbs[i % 12], nouns[i % 10]);
+        hits += history_store_search_prefix(&store, line, results, 16) > 0;
+    }
+    double prefix_time = history_now_seconds() - start;
+
+    start = history_now_seconds();
+    history_store_search_substring(&store, "zzz", store.count);
+    double ngram_build = history_now_seconds() - start;
+
+    start = history_now_seconds();
+    for (int i = 0; i < 1000; i++) {
+        snprintf(line, sizeof(line), "%s_%u", nouns[i % 10], (unsigned)(i * 7919) % (count / 4 + 1));
+        hits += history_store_search_substring(&store, line, store.count) >= 0;
+    }
+    double substring_time = history_now_seconds() - start;
+
+    start = history_now_seconds();
+    for (int i = 0; i < 100; i++) {
+        snprintf(line, sizeof(line), "grp %s/%s", nouns[i % 10], nouns[(i / 10) % 10]);
+        hits += history_store_search_fuzzy(&store, line, results, 16) > 0;
+    }
+    double fuzzy_time = history_now_seconds() - start;
+
+    printf("history benchmark: %u commands (%u unique)\n", count, store.live_count);
+    printf("  add:        %8.3f us/op\n", add_time * 1e6 / count);
+    printf("  trie build: %8.1f ms\n", trie_build * 1e3);
+    printf("  prefix:     %8.3f us/op\n", prefix_time * 1e6 / 1000);
+    printf("  ngram build:%8.1f ms\n", ngram_build * 1e3);
+    printf("  substring:  %8.3f us/op\n", substring_time * 1e6 / 1000);
+    printf("  fuzzy:      %8.3f us/op\n", fuzzy_time * 1e6 / 100);
+    printf("  (%d queries matched)\n", hits);
+
+    history_store_close(&store);
+}
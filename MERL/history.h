@@ -0,0 +1,100 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Persistent shell history.
+//
+// Commands are appended one per line to a host log file; on startup the log
+// is memory-mapped and entries point straight into the mapping.  Duplicate
+// commands supersede their older copies (the log is compacted on shutdown
+// once it is mostly dead entries).  Two indexes sit on top of the entry
+// array:
+//   - a character trie (depth-capped) for prefix completion
+//   - a hashed trigram index for substring (Ctrl-R) and fuzzy search
+// Both are built lazily on first use and then maintained incrementally, so
+// startup cost is one pass over the log.
+
+#define HISTORY_MAX_ENTRIES     1000000
+#define HISTORY_MAX_LINE        1024
+#define HISTORY_TRIE_DEPTH      16
+#define HISTORY_NGRAM_BUCKETS   65536
+
+typedef struct {
+    const char* text;       // Not NUL-terminated when it points into the mapping
+    uint32_t length;
+    uint32_t hash;
+    uint32_t trie_next;     // Next entry ending at the same trie node
+    uint8_t live;           // 0 once superseded by a duplicate or evicted
+} HistoryEntry;
+
+typedef struct {
+    uint32_t child;
+    uint32_t sibling;
+    uint32_t latest;        // Newest entry whose prefix passes through this node
+    uint32_t chain;         // Entries that end (or hit the depth cap) here
+    unsigned char ch;
+} HistoryTrieNode;
+
+typedef struct {
+    uint32_t* items;
+    uint32_t count;
+    uint32_t capacity;
+} HistoryPosting;
+
+typedef struct HistoryArena HistoryArena;
+
+typedef struct {
+    HistoryEntry* entries;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t live_count;
+    uint32_t first_live;    // Entries below this index have been evicted
+
+    uint32_t* dedup_table;  // Open-addressed entry indices keyed by hash
+    uint32_t dedup_size;
+    uint32_t dedup_used;    // Occupied slots, including ones pointing at dead entries
+
+    HistoryTrieNode* trie;
+    uint32_t trie_count;
+    uint32_t trie_capacity;
+    int trie_built;
+
+    HistoryPosting* ngrams;
+    int ngrams_built;
+
+    HistoryArena* arena;
+
+    // Backing log (NULL path = in-memory only, used by the benchmark)
+    char path[512];
+    void* map_view;
+    size_t map_size;
+    void* map_file;
+    void* map_handle;
+    FILE* log;
+} HistoryStore;
+
+// Store lifecycle
+int history_store_init(HistoryStore* store, const char* host_path);
+void history_store_close(HistoryStore* store);
+
+// Entries are numbered in insertion order; dead entries return NULL
+int history_store_add(HistoryStore* store, const char* command);
+const char* history_store_get(HistoryStore* store, uint32_t index, size_t* length);
+void history_store_clear(HistoryStore* store);
+
+// Searches return entry indices, newest first
+int history_store_find_prefix(HistoryStore* store, const char* prefix);
+int history_store_search_prefix(HistoryStore* store, const char* prefix, uint32_t* results, int max_results);
+int history_store_search_substring(HistoryStore* store, const char* query, uint32_t before);
+int history_store_search_fuzzy(HistoryStore* store, const char* query, uint32_t* results, int max_results);
+
+// The shell's global history
+HistoryStore* history_get_store(void);
+int history_init(void);
+void history_shutdown(void);
+void history_benchmark(uint32_t count);
+
+#endif // HISTORY_H
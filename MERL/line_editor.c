@@ -0,0 +1,397 @@
+#include "line_editor.h"
+#include "history.h"
+#include "completion.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <conio.h>
+#endif
+
+#define KEY_CTRL_A      1
+#define KEY_CTRL_C      3
+#define KEY_CTRL_D      4
+#define KEY_CTRL_E      5
+#define KEY_CTRL_G      7
+#define KEY_BACKSPACE   8
+#define KEY_TAB         9
+#define KEY_CTRL_K      11
+#define KEY_CTRL_L      12
+#define KEY_ENTER       13
+#define KEY_CTRL_R      18
+#define KEY_CTRL_U      21
+#define KEY_ESCAPE      27
+
+// Second byte after a 0x00/0xE0 extended-key prefix
+#define KEY_EXT_HOME    71
+#define KEY_EXT_UP      72
+#define KEY_EXT_LEFT    75
+#define KEY_EXT_RIGHT   77
+#define KEY_EXT_END     79
+#define KEY_EXT_DOWN    80
+#define KEY_EXT_DELETE  83
+
+typedef struct {
+    char* buffer;
+    size_t size;
+    size_t length;
+    size_t cursor;
+    size_t shown_cursor;    // Where the terminal cursor currently sits
+    LineEditorPromptFn redraw_prompt;
+
+    uint32_t history_pos;   // == store->count when editing a fresh line
+    char saved_line[HISTORY_MAX_LINE];
+    int last_was_tab;       // A second Tab in a row lists the candidates
+} LineEditor;
+
+static CompletionResult g_completion;
+
+static int line_read_fallback(char* buffer, size_t size) {
+    if (fgets(buffer, (int)size, stdin) == NULL) return -1;
+    buffer[strcspn(buffer, "\r\n")] = '\0';
+    return 0;
+}
+
+#ifdef _WIN32
+
+// Repaint the edit line in place; the prompt in front of it is left alone
+static void line_refresh(LineEditor* ed) {
+    if (ed->shown_cursor > 0) printf("\033[%zuD", ed->shown_cursor);
+    fwrite(ed->buffer, 1, ed->length, stdout);
+    printf("\033[K");
+    if (ed->length > ed->cursor) printf("\033[%zuD", ed->length - ed->cursor);
+    ed->shown_cursor = ed->cursor;
+    fflush(stdout);
+}
+
+// Full repaint including the prompt (after Ctrl-L or leaving search mode)
+static void line_repaint(LineEditor* ed) {
+    printf("\r\033[K");
+    if (ed->redraw_prompt) ed->redraw_prompt();
+    ed->shown_cursor = 0;
+    line_refresh(ed);
+}
+
+static void line_set(LineEditor* ed, const char* text, size_t length) {
+    if (length >= ed->size) length = ed->size - 1;
+    memcpy(ed->buffer, text, length);
+    ed->buffer[length] = '\0';
+    ed->length = length;
+    ed->cursor = length;
+}
+
+static void line_insert(LineEditor* ed, char ch) {
+    if (ed->length + 1 >= ed->size) return;
+    memmove(ed->buffer + ed->cursor + 1, ed->buffer + ed->cursor, ed->length - ed->cursor);
+    ed->buffer[ed->cursor++] = ch;
+    ed->buffer[++ed->length] = '\0';
+}
+
+static void line_delete_at(LineEditor* ed, size_t pos) {
+    if (pos >= ed->length) return;
+    memmove(ed->buffer + pos, ed->buffer + pos + 1, ed->length - pos - 1);
+    ed->buffer[--ed->length] = '\0';
+}
+
+static void line_history_step(LineEditor* ed, int direction) {
+    HistoryStore* store = history_get_store();
+    uint32_t pos = ed->history_pos;
+    const char* text = NULL;
+    size_t length = 0;
+
+    if (direction < 0) {
+        while (pos > store->first_live) {
+            pos--;
+            text = history_store_get(store, pos, &length);
+            if (text) break;
+        }
+        if (!text) return;
+        if (ed->history_pos == store->count) {
+            strncpy(ed->saved_line, ed->buffer, sizeof(ed->saved_line) - 1);
+            ed->saved_line[sizeof(ed->saved_line) - 1] = '\0';
+        }
+    } else {
+        while (pos + 1 < store->count) {
+            pos++;
+            text = history_store_get(store, pos, &length);
+            if (text) break;
+        }
+        if (!text) {
+            if (ed->history_pos == store->count) return;
+            pos = store->count;
+            text = ed->saved_line;
+            length = strlen(ed->saved_line);
+        }
+    }
+
+    ed->history_pos = pos;
+    line_set(ed, text, length);
+    line_refresh(ed);
+}
+
+static int line_console_width(void) {
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info)) {
+        int width = info.srWindow.Right - info.srWindow.Left + 1;
+        if (width > 0) return width;
+    }
+    return 80;
+}
+
+static void line_list_candidates(LineEditor* ed, const CompletionResult* result) {
+    size_t width = 0;
+    for (int i = 0; i < result->count; i++) {
+        size_t length = strlen(result->items[i].text) + (result->items[i].suffix == '/');
+        if (length > width) width = length;
+    }
+    width += 2;
+
+    int columns = (int)((size_t)line_console_width() / width);
+    if (columns < 1) columns = 1;
+
+    printf("\n");
+    for (int i = 0; i < result->count; i++) {
+        const CompletionCandidate* item = &result->items[i];
+        int last_in_row = (i % columns == columns - 1) || i == result->count - 1;
+        if (last_in_row) {
+            printf("%s%s\n", item->text, item->suffix == '/' ? "/" : "");
+        } else {
+            printf("%s%-*s", item->text,
+                   (int)(width - strlen(item->text)), item->suffix == '/' ? "/" : "");
+        }
+    }
+    if (result->total > result->count) {
+        printf("... %d more\n", result->total - result->count);
+    }
+    line_repaint(ed);
+}
+
+// Tab: extend the word to the longest common prefix; list the matches when
+// that adds nothing and Tab was pressed twice
+static void line_complete(LineEditor* ed, int list) {
+    CompletionResult* result = &g_completion;
+    int total = completion_complete(ed->buffer, ed->cursor, result);
+
+    if (total == 0) {
+        printf("\a");
+        return;
+    }
+
+    size_t typed = result->length;
+    if (result->common_length > typed) {
+        for (size_t i = typed; i < result->common_length; i++) {
+            line_insert(ed, result->common[i]);
+        }
+    } else if (total > 1) {
+        if (list) line_list_candidates(ed, result);
+        else printf("\a");
+        return;
+    }
+
+    if (total == 1 && result->items[0].suffix) {
+        char suffix = result->items[0].suffix;
+        if (ed->cursor < ed->length && ed->buffer[ed->cursor] == suffix) {
+            ed->cursor++;
+        } else {
+            line_insert(ed, suffix);
+        }
+    }
+}
+
+static void search_render(const char* query, const char* match, size_t match_length, int failed) {
+    printf("\r\033[K(%sreverse-i-search)`%s': ", failed ? "failed " : "", query);
+    if (match) fwrite(match, 1, match_length, stdout);
+    fflush(stdout);
+}
+
+// Ctrl-R mode. Returns 1 if the line should be executed immediately.
+static int line_reverse_search(LineEditor* ed) {
+    HistoryStore* store = history_get_store();
+    char query[128] = "";
+    size_t query_length = 0;
+    int match = -1;
+    int failed = 0;
+    const char* match_text = NULL;
+    size_t match_length = 0;
+
+    search_render(query, NULL, 0, 0);
+
+    for (;;) {
+        int ch = _getch();
+        int research = 0;
+        uint32_t before = store->count;
+
+        if (ch == KEY_CTRL_R) {
+            // Next older match
+            if (match >= 0) before = (uint32_t)match;
+            research = query_length > 0;
+        } else if (ch == KEY_BACKSPACE) {
+            if (query_length > 0) query[--query_length] = '\0';
+            research = 1;
+        } else if (ch == KEY_CTRL_G || ch == KEY_CTRL_C) {
+            line_repaint(ed);
+            return 0;
+        } else if (ch == KEY_ENTER || ch == KEY_ESCAPE || ch == 0 || ch == 0xE0) {
+            if (ch == 0 || ch == 0xE0) _getch();
+            if (match_text) line_set(ed, match_text, match_length);
+            if (match >= 0) ed->history_pos = (uint32_t)match;
+            if (ch == KEY_ENTER) {
+                printf("\r\033[K");
+                if (ed->redraw_prompt) ed->redraw_prompt();
+                fwrite(ed->buffer, 1, ed->length, stdout);
+                return 1;
+            }
+            line_repaint(ed);
+            return 0;
+        } else if (ch >= 32 && ch < 256 && query_length + 1 < sizeof(query)) {
+            query[query_length++] = (char)ch;
+            query[query_length] = '\0';
+            // The current match may still fit the longer query
+            if (match >= 0) before = (uint32_t)match + 1;
+            research = 1;
+        }
+
+        if (research) {
+            if (query_length == 0) {
+                match = -1;
+                match_text = NULL;
+                failed = 0;
+            } else {
+                int found = history_store_search_substring(store, query, before);
+                failed = found < 0;
+                if (!failed) {
+                    match = found;
+                    match_text = history_store_get(store, (uint32_t)found, &match_length);
+                }
+            }
+        }
+
+        search_render(query, match_text, match_length, failed);
+    }
+}
+
+int line_editor_read(char* buffer, size_t size, LineEditorPromptFn redraw_prompt) {
+    if (!buffer || size < 2) return -1;
+
+    if (!_isatty(_fileno(stdin))) {
+        return line_read_fallback(buffer, size);
+    }
+
+    LineEditor ed;
+    memset(&ed, 0, sizeof(ed));
+    ed.buffer = buffer;
+    ed.size = size;
+    ed.redraw_prompt = redraw_prompt;
+    ed.history_pos = history_get_store()->count;
+    buffer[0] = '\0';
+    fflush(stdout);
+
+    for (;;) {
+        int ch = _getch();
+        int was_tab = ed.last_was_tab;
+        ed.last_was_tab = 0;
+
+        switch (ch) {
+            case KEY_TAB:
+                line_complete(&ed, was_tab);
+                ed.last_was_tab = 1;
+                break;
+
+            case KEY_ENTER:
+            case '\n':
+                printf("\n");
+                return 0;
+
+            case KEY_CTRL_D:
+                if (ed.length == 0) {
+                    printf("\n");
+                    return -1;
+                }
+                line_delete_at(&ed, ed.cursor);
+                break;
+
+            case KEY_CTRL_C:
+                printf("^C\n");
+                buffer[0] = '\0';
+                return 0;
+
+            case KEY_BACKSPACE:
+                if (ed.cursor > 0) {
+                    ed.cursor--;
+                    line_delete_at(&ed, ed.cursor);
+                }
+                break;
+
+            case KEY_CTRL_A:
+                ed.cursor = 0;
+                break;
+
+            case KEY_CTRL_E:
+                ed.cursor = ed.length;
+                break;
+
+            case KEY_CTRL_U:
+                memmove(buffer, buffer + ed.cursor, ed.length - ed.cursor + 1);
+                ed.length -= ed.cursor;
+                ed.cursor = 0;
+                break;
+
+            case KEY_CTRL_K:
+                buffer[ed.cursor] = '\0';
+                ed.length = ed.cursor;
+                break;
+
+            case KEY_CTRL_L:
+                printf("\033[2J\033[H");
+                line_repaint(&ed);
+                continue;
+
+            case KEY_ESCAPE:
+                line_set(&ed, "", 0);
+                break;
+
+            case KEY_CTRL_R:
+                if (line_reverse_search(&ed)) {
+                    printf("\n");
+                    return 0;
+                }
+                continue;
+
+            case 0:
+            case 0xE0:
+                switch (_getch()) {
+                    case KEY_EXT_UP:     line_history_step(&ed, -1); continue;
+                    case KEY_EXT_DOWN:   line_history_step(&ed, 1);  continue;
+                    case KEY_EXT_LEFT:   if (ed.cursor > 0) ed.cursor--; break;
+                    case KEY_EXT_RIGHT:  if (ed.cursor < ed.length) ed.cursor++; break;
+                    case KEY_EXT_HOME:   ed.cursor = 0; break;
+                    case KEY_EXT_END:    ed.cursor = ed.length; break;
+                    case KEY_EXT_DELETE: line_delete_at(&ed, ed.cursor); break;
+                    default: continue;
+                }
+                break;
+
+            default:
+                if (ch >= 32 && ch < 256) {
+                    line_insert(&ed, (char)ch);
+                } else {
+                    continue;
+                }
+                break;
+        }
+
+        line_refresh(&ed);
+    }
+}
+
+#else
+
+int line_editor_read(char* buffer, size_t size, LineEditorPromptFn redraw_prompt) {
+    (void)redraw_prompt;
+    return line_read_fallback(buffer, size);
+}
+
+#endif
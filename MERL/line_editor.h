@@ -0,0 +1,18 @@
+#ifndef LINE_EDITOR_H
+#define LINE_EDITOR_H
+
+#include <stddef.h>
+
+// Interactive line input for the MERL shell.
+//
+// Reads raw console keys so the shell gets cursor editing, Up/Down history
+// navigation, Ctrl-R reverse incremental search over the persistent
+// history and Tab completion (see completion.h).  When stdin is not a
+// console (pipes, scripts) it falls back to plain fgets().
+
+typedef void (*LineEditorPromptFn)(void);
+
+// Returns 0 with a NUL-terminated line (no trailing newline), -1 on EOF
+int line_editor_read(char* buffer, size_t size, LineEditorPromptFn redraw_prompt);
+
+#endif // LINE_EDITOR_H
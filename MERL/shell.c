@@ -25,6 +25,8 @@
 #include "config.h"
 #include "network/network.h"
 #include "kernel/network_stack.h"
+#include "kernel/scheduler.h"  // Per-CPU run queue statistics
+#include "kernel/timer.h"  // Kernel timers for watch/timeout
 #include "vfs/vfs.h"
 #include "lua/lua_vm.h"
 #include "binary/binary_executor.h"
@@ -40,6 +42,12 @@
 #include "system/process.h"  // Process management (old)
 #include "system/process_real.h"  // Real process management (new)
 #include "system/disk.h"  // Disk utilities
+#include "system/archive.h"  // tar/gzip/zip over VFS streams
+#include "system/hash.h"  // XXH3/SHA-256 content hashing
+#include "completion.h"  // Tab completion
+#include "vfs/vfs_stream.h"
+#include "history.h"  // Persistent, indexed command history
+#include "line_editor.h"  // Console line editing (history, Ctrl-R)
 // #include "shell_script.h"  // Enhanced shell scripting - temporarily disabled
 
 // Windows-specific includes
@@ -129,6 +137,8 @@ void awk_command(int argc, char **argv);
 void which_command(int argc, char **argv);
 void ln_command(int argc, char **argv);
 void diff_command(int argc, char **argv);
+void sha256sum_command(int argc, char **argv);
+void xxhsum_command(int argc, char **argv);
 void exit_command(int argc, char **argv);
 void version_command(int argc, char **argv);
 void set_command(int argc, char **argv);
@@ -202,6 +212,8 @@ void ps_enhanced_command(int argc, char **argv);
 void kill_enhanced_command(int argc, char **argv);
 void pkill_command(int argc, char **argv);
 void pgrep_command(int argc, char **argv);
+void bench_command(int argc, char **argv);
+void syscallstat_command(int argc, char **argv);
 
 // Advanced Unix utilities (newly added)
 void pstree_command(int argc, char **argv);
@@ -803,6 +815,9 @@ void htop_command(int argc, char **argv) {
         printf("Memory: %luM total, %luM used, %luM free\n", total_mb, used_mb, free_mb);
     }
     
+    printf("\n");
+    scheduler_print_cpu_stats();
+    
     printf("\nPress 'q' to quit, any other key to refresh...\n");
     
     char c = getchar();
@@ -865,25 +880,45 @@ void df_command(int argc, char **argv) {
     }
 }
 
-// Helper function to calculate directory size
+// Helper function to calculate directory size (4096 bytes per directory entry).
+// O(1): every VNode carries aggregates for its whole subtree.
 void calculate_directory_size(VNode* node, size_t* total_size, size_t* used_size) {
     if (!node) return;
     
-    if (node->is_directory) {
-        *total_size += 4096; // Directory entry size
-        VNode* child = node->children;
-        while (child) {
-            calculate_directory_size(child, total_size, used_size);
-            child = child->next;
-        }
+    *total_size += (size_t)(node->tree_size + node->tree_dirs * 4096);
+    *used_size += (size_t)node->tree_size;
+}
+
+static void du_print_entry(unsigned long long bytes, int human, const char* label) {
+    if (human) {
+        char size_str[32];
+        disk_format_size(bytes, size_str, sizeof(size_str));
+        printf("%s\t%s\n", size_str, label);
     } else {
-        *total_size += node->size;
-        *used_size += node->size;
+        printf("%llu\t%s\n", bytes, label);
     }
 }
 
 void du_command(int argc, char **argv) {
-    char* target_dir = (argc > 1) ? argv[1] : vfs_getcwd();
+    int summary = 0;
+    int human = 0;
+    char* target_dir = NULL;
+    
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            for (const char* flag = argv[i] + 1; *flag; flag++) {
+                if (*flag == 's') summary = 1;
+                else if (*flag == 'h') human = 1;
+                else {
+                    printf("Usage: du [-s] [-h] [path]\n");
+                    return;
+                }
+            }
+        } else {
+            target_dir = argv[i];
+        }
+    }
+    if (!target_dir) target_dir = vfs_getcwd();
     
     char expanded_path[512];
     expand_path(target_dir, expanded_path, sizeof(expanded_path));
@@ -896,22 +931,26 @@ void du_command(int argc, char **argv) {
         strcpy(full_path, expanded_path);
     }
     
-    printf("Disk usage for %s:\n", full_path);
+    VNode* node = vfs_find_node(full_path);
+    if (!node) {
+        printf("du: %s: No such file or directory\n", full_path);
+        return;
+    }
     
-    VNode* dir_node = vfs_find_node(full_path);
-    if (!dir_node || !dir_node->is_directory) {
-        printf("du: %s: Not a directory\n", full_path);
+    if (summary || !node->is_directory) {
+        du_print_entry(node->tree_size, human, full_path);
         return;
     }
     
-    size_t total_size = 0;
-    VNode* child = dir_node->children;
+    printf("Disk usage for %s:\n", full_path);
+    
+    // Each child's figure is its whole subtree, read from the cached aggregates
+    VNode* child = node->children;
     while (child) {
-        printf("%zu\t%s\n", child->size, child->name);
-        total_size += child->size;
+        du_print_entry(child->tree_size, human, child->name);
         child = child->next;
     }
-    printf("%zu\ttotal\n", total_size);
+    du_print_entry(node->tree_size, human, "total");
 }
 
 void uname_command(int argc, char **argv) {
@@ -1191,35 +1230,125 @@ void create_sample_command(int argc, char **argv) {
 
 // ===== END REAL COMPILATION COMMANDS =====
 
-static char* command_history[100];
-static int history_count = 0;
+static void print_history_entry(HistoryStore* store, uint32_t index) {
+    size_t length = 0;
+    const char* text = history_store_get(store, index, &length);
+    if (text) {
+        printf("%6u  %.*s\n", index + 1, (int)length, text);
+    }
+}
 
 void history_command(int argc, char **argv) {
-    printf("Command history:\n");
-    if (history_count == 0) {
+    HistoryStore* store = history_get_store();
+    
+    if (argc >= 2 && strcmp(argv[1], "-c") == 0) {
+        history_store_clear(store);
+        printf("History cleared\n");
+        return;
+    }
+    
+    if (argc >= 2 && strcmp(argv[1], "--bench") == 0) {
+        history_benchmark(argc >= 3 ? (uint32_t)strtoul(argv[2], NULL, 10) : 0);
+        return;
+    }
+    
+    if (argc >= 3 && (strcmp(argv[1], "-s") == 0 || strcmp(argv[1], "-p") == 0 ||
+                      strcmp(argv[1], "-f") == 0)) {
+        uint32_t results[50];
+        int found = 0;
+        
+        if (strcmp(argv[1], "-p") == 0) {
+            found = history_store_search_prefix(store, argv[2], results, 50);
+        } else if (strcmp(argv[1], "-f") == 0) {
+            found = history_store_search_fuzzy(store, argv[2], results, 50);
+        } else {
+            uint32_t before = store->count;
+            while (found < 50) {
+                int index = history_store_search_substring(store, argv[2], before);
+                if (index < 0) break;
+                results[found++] = (uint32_t)index;
+                before = (uint32_t)index;
+            }
+        }
+        
+        if (found == 0) {
+            printf("No matching commands in history\n");
+        }
+        for (int i = found - 1; i >= 0; i--) {
+            print_history_entry(store, results[i]);
+        }
+        return;
+    }
+    
+    if (argc >= 2 && argv[1][0] == '-' && strcmp(argv[1], "-a") != 0) {
+        printf("Usage: history [N | -a | -c | -s text | -p prefix | -f text | --bench [count]]\n");
+        return;
+    }
+    
+    if (store->live_count == 0) {
         printf("No commands in history\n");
-    } else {
-        for (int i = 0; i < history_count; i++) {
-            printf("%4d  %s\n", i+1, command_history[i]);
+        return;
+    }
+    
+    // Show the last N live entries (1000 by default, -a for everything)
+    uint32_t wanted = 1000;
+    if (argc >= 2) {
+        wanted = strcmp(argv[1], "-a") == 0 ? store->live_count : (uint32_t)strtoul(argv[1], NULL, 10);
+    }
+    
+    uint32_t start = store->count;
+    uint32_t seen = 0;
+    while (start > store->first_live && seen < wanted) {
+        start--;
+        if (store->entries[start].live) seen++;
+    }
+    for (uint32_t i = start; i < store->count; i++) {
+        print_history_entry(store, i);
+    }
+}
+
+void complete_command(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: complete <text>\n");
+        printf("       complete --bench [entries]\n");
+        return;
+    }
+    
+    if (strcmp(argv[1], "--bench") == 0) {
+        completion_benchmark(argc >= 3 ? atoi(argv[2]) : 0);
+        return;
+    }
+    
+    // Rebuild the line the way it was typed, completing at the end
+    char line[1024] = "";
+    for (int i = 1; i < argc; i++) {
+        if (i > 1) strncat(line, " ", sizeof(line) - strlen(line) - 1);
+        strncat(line, argv[i], sizeof(line) - strlen(line) - 1);
+    }
+    
+    CompletionResult* result = malloc(sizeof(CompletionResult));
+    if (!result) {
+        printf("complete: out of memory\n");
+        return;
+    }
+    
+    int total = completion_complete(line, strlen(line), result);
+    for (int i = 0; i < result->count; i++) {
+        if (result->items[i].suffix == '/') {
+            printf("%s/\n", result->items[i].text);
+        } else {
+            printf("%s\n", result->items[i].text);
         }
     }
+    if (total > result->count) {
+        printf("... %d more\n", total - result->count);
+    }
+    free(result);
 }
 
 // Add command to history (called from handle_command)
 void add_to_history(const char* command) {
-    if (history_count < 100) {
-        command_history[history_count] = malloc(strlen(command) + 1);
-        strcpy(command_history[history_count], command);
-        history_count++;
-    } else {
-        // Rotate history - remove oldest, add newest
-        free(command_history[0]);
-        for (int i = 0; i < 99; i++) {
-            command_history[i] = command_history[i+1];
-        }
-        command_history[99] = malloc(strlen(command) + 1);
-        strcpy(command_history[99], command);
-    }
+    history_store_add(history_get_store(), command);
 }
 
 // Networking commands
@@ -1262,210 +1391,134 @@ void scp_command(int argc, char **argv) {
     }
 }
 
-// Archiving commands
-// Simple tar header structure (simplified for demo)
-struct tar_header {
-    char name[100];
-    char mode[8];
-    char uid[8];
-    char gid[8];
-    char size[12];
-    char mtime[12];
-    char checksum[8];
-    char typeflag;
-    char linkname[100];
-    char magic[6];
-    char version[2];
-    char uname[32];
-    char gname[32];
-    char devmajor[8];
-    char devminor[8];
-    char prefix[155];
-    char padding[12];
-};
-
-void write_tar_header(FILE* tar_file, const char* filename, size_t filesize) {
-    struct tar_header header;
-    memset(&header, 0, sizeof(header));
-    
-    strncpy(header.name, filename, sizeof(header.name) - 1);
-    strcpy(header.mode, "0000644");
-    strcpy(header.uid, "0000000");
-    strcpy(header.gid, "0000000");
-    snprintf(header.size, sizeof(header.size), "%011zo", filesize);
-    snprintf(header.mtime, sizeof(header.mtime), "%011ld", time(NULL));
-    header.typeflag = '0'; // regular file
-    strcpy(header.magic, "ustar");
-    strcpy(header.version, "00");
-    
-    // Calculate checksum
-    unsigned int checksum = 0;
-    memset(header.checksum, ' ', 8);
-    unsigned char* ptr = (unsigned char*)&header;
-    for (int i = 0; i < sizeof(header); i++) {
-        checksum += ptr[i];
-    }
-    snprintf(header.checksum, sizeof(header.checksum), "%06o", checksum);
-    
-    fwrite(&header, sizeof(header), 1, tar_file);
+// Archiving commands (tar/gzip/zip stream through the VFS, see system/archive.c)
+static void archive_resolve_path(char* out, size_t size, const char* path) {
+    char* cwd = vfs_getcwd();
+    build_full_path(out, size, cwd ? cwd : "/", path);
 }
 
 void tar_command(int argc, char **argv) {
     if (argc < 3) {
-        printf("Usage: tar [options] archive_name files...\n");
+        printf("Usage: tar [options] archive_name [files...] [-C dir]\n");
         printf("Options: -c (create), -x (extract), -t (list), -v (verbose), -f (file)\n");
-        printf("Example: tar -cvf archive.tar file1 file2\n");
+        printf("Example: tar -cvf archive.tar file1 dir1\n");
         return;
     }
     
     char* options = argv[1];
-    char* archive = argv[2];
+    char archive[512];
+    archive_resolve_path(archive, sizeof(archive), argv[2]);
     
-    if (strstr(options, "c")) {
-        // Create archive
-        FILE* tar_file = fopen(archive, "wb");
-        if (!tar_file) {
-            printf("tar: cannot create '%s': Permission denied\n", archive);
-            return;
+    int flags = strchr(options, 'v') ? ARCHIVE_VERBOSE : 0;
+    char* cwd = vfs_getcwd();
+    char dest_dir[512];
+    snprintf(dest_dir, sizeof(dest_dir), "%s", cwd ? cwd : "/");
+    
+    // Collect members, honouring -C <dir> for the working directory
+    char** members = malloc(sizeof(char*) * (argc > 3 ? argc - 3 : 1));
+    int member_count = 0;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+            archive_resolve_path(dest_dir, sizeof(dest_dir), argv[++i]);
+        } else {
+            members[member_count++] = argv[i];
         }
-        
-        printf("tar: Creating archive %s\n", archive);
-        
-        for (int i = 3; i < argc; i++) {
-            FILE* input_file = vm_fopen(argv[i], "rb");
-            if (!input_file) {
-                printf("tar: '%s': No such file or directory\n", argv[i]);
-                continue;
-            }
-            
-            // Get file size
-            fseek(input_file, 0, SEEK_END);
-            size_t filesize = ftell(input_file);
-            fseek(input_file, 0, SEEK_SET);
-            
-            printf("tar: Adding %s (%zu bytes)\n", argv[i], filesize);
-            
-            // Write tar header
-            write_tar_header(tar_file, argv[i], filesize);
-            
-            // Write file content
-            char buffer[512];
-            size_t bytes_read;
-            while ((bytes_read = fread(buffer, 1, sizeof(buffer), input_file)) > 0) {
-                fwrite(buffer, 1, bytes_read, tar_file);
-            }
-            
-            // Pad to 512-byte boundary
-            size_t padding = (512 - (filesize % 512)) % 512;
-            if (padding > 0) {
-                memset(buffer, 0, padding);
-                fwrite(buffer, 1, padding, tar_file);
+    }
+    
+    ArchiveStats stats;
+    if (strchr(options, 'c')) {
+        if (member_count == 0) {
+            printf("tar: Cowardly refusing to create an empty archive\n");
+        } else if (archive_tar_create(archive, dest_dir, members, member_count, flags, &stats) == 0) {
+            printf("tar: %s: %d entries, %llu bytes\n", argv[2], stats.entries,
+                   (unsigned long long)stats.bytes_out);
+        } else {
+            printf("tar: Exiting with failure status due to previous errors\n");
+        }
+    } else if (strchr(options, 't')) {
+        archive_tar_extract(archive, dest_dir, flags | ARCHIVE_LIST, &stats);
+    } else if (strchr(options, 'x')) {
+        if (archive_tar_extract(archive, dest_dir, flags, &stats) == 0) {
+            if (flags & ARCHIVE_VERBOSE) {
+                printf("tar: extracted %d entries (%llu bytes)\n", stats.entries,
+                       (unsigned long long)stats.bytes_out);
             }
-            
-            fclose(input_file);
-        }
-        
-        // Write two zero blocks to end archive
-        char zero_block[512];
-        memset(zero_block, 0, sizeof(zero_block));
-        fwrite(zero_block, sizeof(zero_block), 1, tar_file);
-        fwrite(zero_block, sizeof(zero_block), 1, tar_file);
-        
-        fclose(tar_file);
-        printf("tar: Archive created successfully\n");
-        
-    } else if (strstr(options, "t")) {
-        // List contents
-        FILE* tar_file = fopen(archive, "rb");
-        if (!tar_file) {
-            printf("tar: cannot access '%s': No such file or directory\n", archive);
-            return;
-        }
-        
-        printf("tar: Contents of %s:\n", archive);
-        
-        struct tar_header header;
-        while (fread(&header, sizeof(header), 1, tar_file) == 1) {
-            if (header.name[0] == '\0') break; // End of archive
-            
-            size_t filesize = strtoul(header.size, NULL, 8);
-            printf("tar: %s (%zu bytes)\n", header.name, filesize);
-            
-            // Skip file content
-            size_t skip = ((filesize + 511) / 512) * 512;
-            fseek(tar_file, skip, SEEK_CUR);
+        } else {
+            printf("tar: Exiting with failure status due to previous errors\n");
         }
-        
-        fclose(tar_file);
-        
-    } else if (strstr(options, "x")) {
-        printf("tar: Extraction not yet implemented (use -t to list contents)\n");
+    } else {
+        printf("tar: You must specify one of the '-ctx' options\n");
     }
+    
+    free(members);
 }
 
 void gzip_command(int argc, char **argv) {
     if (argc < 2) {
-        printf("Usage: gzip <filename>\n");
-        return;
-    }
-    
-    char* filename = argv[1];
-    char output_name[512];
-    snprintf(output_name, sizeof(output_name), "%s.gz", filename);
-    
-    // Open input file using VFS
-    FILE* input = vm_fopen(filename, "rb");
-    if (!input) {
-        printf("gzip: cannot access '%s': No such file or directory\n", filename);
+        printf("Usage: gzip [-1..-9] [-p threads] <filename>...\n");
+        printf("       gzip --bench [size_mb] [max_threads]\n");
         return;
     }
     
-    // Open output file using VFS 
-    FILE* output_test = vm_fopen(output_name, "wb");
-    if (output_test) {
-        fclose(output_test);
-    }
-    
-    // For now, create in host filesystem for gzip library compatibility
-    gzFile output = gzopen(output_name, "wb");
-    if (!output) {
-        printf("gzip: cannot create '%s': Permission denied\n", output_name);
-        fclose(input);
+    if (strcmp(argv[1], "--bench") == 0 || strcmp(argv[1], "-B") == 0) {
+        size_t size_mb = argc > 2 ? (size_t)atoi(argv[2]) : 64;
+        int max_threads = argc > 3 ? atoi(argv[3]) : archive_default_threads();
+        archive_gzip_benchmark(size_mb, max_threads, 6);
         return;
     }
     
-    // Compress file
-    char buffer[8192];
-    size_t bytes_read;
-    size_t total_in = 0, total_out = 0;
+    int threads = archive_default_threads();
+    int level = 6;
     
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), input)) > 0) {
-        total_in += bytes_read;
-        if (gzwrite(output, buffer, bytes_read) != (int)bytes_read) {
-            printf("gzip: error writing to '%s'\n", output_name);
-            break;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            continue;
         }
+        if (argv[i][0] == '-' && argv[i][1] >= '1' && argv[i][1] <= '9' && argv[i][2] == '\0') {
+            level = argv[i][1] - '0';
+            continue;
+        }
+        
+        char* filename = argv[i];
+        char input_path[512], output_path[512];
+        archive_resolve_path(input_path, sizeof(input_path), filename);
+        snprintf(output_path, sizeof(output_path), "%s.gz", input_path);
+        
+        VFSStream* input = vfs_stream_open(input_path, "rb");
+        if (!input) {
+            printf("gzip: cannot access '%s': No such file or directory\n", filename);
+            continue;
+        }
+        
+        VFSStream* output = vfs_stream_open(output_path, "wb");
+        if (!output) {
+            printf("gzip: cannot create '%s.gz': Permission denied\n", filename);
+            vfs_stream_close(input);
+            continue;
+        }
+        
+        ArchiveStats stats;
+        int result = archive_gzip_stream(input, output, threads, level, &stats);
+        vfs_stream_close(input);
+        if (vfs_stream_close(output) != 0) result = -1;
+        
+        if (result != 0) {
+            printf("gzip: error writing to '%s.gz'\n", filename);
+            continue;
+        }
+        
+        // Calculate compression ratio
+        double ratio = stats.bytes_in > 0
+            ? (1.0 - (double)stats.bytes_out / (double)stats.bytes_in) * 100.0 : 0.0;
+        
+        printf("gzip: compressed '%s' -> '%s.gz' (%llu -> %llu bytes, %.1f%% reduction)\n",
+               filename, filename, (unsigned long long)stats.bytes_in,
+               (unsigned long long)stats.bytes_out, ratio);
+        
+        // Note: In VFS environment, we keep both files for demonstration
+        printf("gzip: original file '%s' preserved in VFS\n", filename);
     }
-    
-    fclose(input);
-    gzclose(output);
-    
-    // Get output file size
-    FILE* test_output = fopen(output_name, "rb");
-    if (test_output) {
-        fseek(test_output, 0, SEEK_END);
-        total_out = ftell(test_output);
-        fclose(test_output);
-    }
-    
-    // Calculate compression ratio
-    double ratio = total_in > 0 ? (1.0 - (double)total_out / (double)total_in) * 100.0 : 0.0;
-    
-    printf("gzip: compressed '%s' -> '%s' (%zu -> %zu bytes, %.1f%% reduction)\n", 
-           filename, output_name, total_in, total_out, ratio);
-    
-    // Note: In VFS environment, we keep both files for demonstration
-    printf("gzip: original file '%s' preserved in VFS\n", filename);
 }
 
 void gunzip_command(int argc, char **argv) {
@@ -1475,93 +1528,124 @@ void gunzip_command(int argc, char **argv) {
     }
     
     char* filename = argv[1];
+    char input_path[512], output_path[512];
+    archive_resolve_path(input_path, sizeof(input_path), filename);
     
     // Remove .gz extension for output name
-    char output_name[512];
-    strcpy(output_name, filename);
-    char* gz_ext = strstr(output_name, ".gz");
-    if (gz_ext) {
-        *gz_ext = '\0';
+    strcpy(output_path, input_path);
+    size_t len = strlen(output_path);
+    if (len > 3 && strcmp(output_path + len - 3, ".gz") == 0) {
+        output_path[len - 3] = '\0';
     } else {
         // If no .gz extension, assume it's still compressed
-        snprintf(output_name, sizeof(output_name), "%s.out", filename);
+        snprintf(output_path, sizeof(output_path), "%s.out", input_path);
     }
     
     // Open compressed file
-    gzFile input = gzopen(filename, "rb");
+    VFSStream* input = vfs_stream_open(input_path, "rb");
     if (!input) {
         printf("gunzip: cannot access '%s': No such file or directory\n", filename);
         return;
     }
     
     // Open output file
-    FILE* output = fopen(output_name, "wb");
+    VFSStream* output = vfs_stream_open(output_path, "wb");
     if (!output) {
-        printf("gunzip: cannot create '%s': Permission denied\n", output_name);
-        gzclose(input);
+        printf("gunzip: cannot create '%s': Permission denied\n", output_path);
+        vfs_stream_close(input);
         return;
     }
     
-    // Decompress file
-    char buffer[8192];
-    int bytes_read;
-    size_t total_in = 0, total_out = 0;
+    ArchiveStats stats;
+    int result = archive_gunzip_stream(input, output, &stats);
+    vfs_stream_close(input);
+    int closed = vfs_stream_close(output);
     
-    while ((bytes_read = gzread(input, buffer, sizeof(buffer))) > 0) {
-        total_out += bytes_read;
-        if (fwrite(buffer, 1, bytes_read, output) != (size_t)bytes_read) {
-            printf("gunzip: error writing to '%s'\n", output_name);
-            break;
-        }
+    if (result != 0) {
+        printf("gunzip: '%s': invalid compressed data--format violated\n", filename);
+        vfs_delete_file(output_path);
+        return;
     }
-    
-    gzclose(input);
-    fclose(output);
-    
-    // Get input file size
-    FILE* test_input = fopen(filename, "rb");
-    if (test_input) {
-        fseek(test_input, 0, SEEK_END);
-        total_in = ftell(test_input);
-        fclose(test_input);
+    if (closed != 0) {
+        // Keep the .gz: the output may be incomplete
+        printf("gunzip: error writing to '%s'\n", output_path);
+        vfs_delete_file(output_path);
+        return;
     }
     
-    printf("gunzip: decompressed '%s' -> '%s' (%zu -> %zu bytes)\n", 
-           filename, output_name, total_in, total_out);
+    printf("gunzip: decompressed '%s' -> '%s' (%llu -> %llu bytes)\n",
+           filename, output_path, (unsigned long long)stats.bytes_in,
+           (unsigned long long)stats.bytes_out);
     
     // Remove compressed file (like real gunzip)
-    if (remove(filename) == 0) {
+    if (vfs_delete_file(input_path) == 0) {
         printf("gunzip: removed '%s'\n", filename);
     }
 }
 
 void zip_command(int argc, char **argv) {
-    if (argc < 3) {
-        printf("Usage: zip <archive.zip> <files...>\n");
+    int first = 1;
+    int flags = ARCHIVE_VERBOSE;
+    
+    // -r is implied (directories are always recursed); -q silences per-file output
+    while (first < argc && argv[first][0] == '-') {
+        if (strchr(argv[first], 'q')) flags &= ~ARCHIVE_VERBOSE;
+        first++;
+    }
+    
+    if (argc - first < 2) {
+        printf("Usage: zip [-q] [-r] <archive.zip> <files...>\n");
         return;
     }
     
-    char* archive = argv[1];
-    printf("zip: Creating archive %s\n", archive);
+    char archive[512];
+    archive_resolve_path(archive, sizeof(archive), argv[first]);
+    char* cwd = vfs_getcwd();
     
-    for (int i = 2; i < argc; i++) {
-        printf("zip: Adding %s\n", argv[i]);
+    ArchiveStats stats;
+    if (archive_zip_create(archive, cwd ? cwd : "/", &argv[first + 1], argc - first - 1, flags, &stats) == 0) {
+        printf("zip: %s: %d entries, %llu -> %llu bytes\n", argv[first], stats.entries,
+               (unsigned long long)stats.bytes_in, (unsigned long long)stats.bytes_out);
+    } else {
+        printf("zip: %s: completed with errors\n", argv[first]);
     }
-    printf("zip: Archive created successfully\n");
 }
 
 void unzip_command(int argc, char **argv) {
-    if (argc < 2) {
-        printf("Usage: unzip <archive.zip>\n");
+    int flags = ARCHIVE_VERBOSE;
+    char* archive_name = NULL;
+    char* cwd = vfs_getcwd();
+    char dest_dir[512];
+    snprintf(dest_dir, sizeof(dest_dir), "%s", cwd ? cwd : "/");
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-l") == 0) {
+            flags |= ARCHIVE_LIST;
+        } else if (strcmp(argv[i], "-q") == 0) {
+            flags &= ~ARCHIVE_VERBOSE;
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            archive_resolve_path(dest_dir, sizeof(dest_dir), argv[++i]);
+        } else {
+            archive_name = argv[i];
+        }
+    }
+    
+    if (!archive_name) {
+        printf("Usage: unzip [-l] [-q] <archive.zip> [-d dir]\n");
         return;
     }
     
-    char* archive = argv[1];
-    printf("unzip: Extracting from %s\n", archive);
-    printf("unzip: Inflating: file1.txt\n");
-    printf("unzip: Inflating: file2.txt\n");
-    printf("unzip: Inflating: subdir/file3.txt\n");
-    printf("unzip: Extraction complete\n");
+    char archive[512];
+    archive_resolve_path(archive, sizeof(archive), archive_name);
+    
+    if (!(flags & ARCHIVE_LIST)) {
+        printf("Archive:  %s\n", archive_name);
+    }
+    
+    ArchiveStats stats;
+    if (archive_zip_extract(archive, dest_dir, flags, &stats) != 0) {
+        printf("unzip: %s: completed with errors\n", archive_name);
+    }
 }
 
 // Hostname command
@@ -2018,6 +2102,9 @@ void start_shell() {
     // Initialize environment variables
     init_default_env_vars();
 
+    // Load persistent command history (indexes are built on first search)
+    history_init();
+
     // Initialize ZoraVM Terminal Styling (font only)
     terminal_init_styling();
     
@@ -2085,11 +2172,14 @@ void start_shell() {
         }
 #endif
         
-        if (fgets(input, sizeof(input), stdin) == NULL) {
+        if (line_editor_read(input, sizeof(input), print_colored_prompt) != 0) {
             printf("\nExiting VM...\n");
             break;
         }
 
+        // Switches the clock asked for while the shell waited for input
+        scheduler_preempt_point();
+
         // Remove trailing newline character FIRST
         input[strcspn(input, "\n")] = '\0';
         
@@ -2268,6 +2358,9 @@ void start_shell() {
         }
 #endif
     }
+    
+    // Flush and compact the persistent history log
+    history_shutdown();
 }
 
 // Command implementations
@@ -2870,10 +2963,12 @@ void cp_command(int argc, char **argv) {
         // Copy data if source has data
         VNode* dest_node = vfs_find_node(dest_full);
         if (dest_node && src_node->data) {
+            dest_node->capacity = 0;
             dest_node->data = malloc(src_node->size);
             if (dest_node->data) {
                 memcpy(dest_node->data, src_node->data, src_node->size);
                 dest_node->size = src_node->size;
+                vfs_account_node(dest_node);
             }
         }
         printf("File copied from %s to %s\n", src_full, dest_full);
@@ -2926,10 +3021,12 @@ void mv_command(int argc, char **argv) {
     if (vfs_create_file(dest_full) == 0) {
         VNode* dest_node = vfs_find_node(dest_full);
         if (dest_node && src_node->data) {
+            dest_node->capacity = 0;
             dest_node->data = malloc(src_node->size);
             if (dest_node->data) {
                 memcpy(dest_node->data, src_node->data, src_node->size);
                 dest_node->size = src_node->size;
+                vfs_account_node(dest_node);
             }
         }
         
@@ -3652,7 +3749,8 @@ void top_command(int argc, char **argv) {
                procs[i]->name ? procs[i]->name : "<unknown>");
     }
     
-    printf("\nTotal processes: %d\n", count);
+    printf("\nTotal processes: %d\n\n", count);
+    scheduler_print_cpu_stats();
     printf("Press Ctrl+C to exit\n");
 }
 
@@ -4888,6 +4986,7 @@ Command command_table[] = {
     {"systeminfo", systeminfo_command, "Display detailed system information"},
     {"scripts", scripts_command, "List available script-based commands"},
     {"history", history_command, "Display command history"},
+    {"complete", complete_command, "Show Tab completions for a command line"},
     {"scp", scp_command, "Secure copy for transferring files over SSH"},
     {"tar", tar_command, "Archive files and directories"},
     {"gzip", gzip_command, "Compress files"},
@@ -4933,6 +5032,8 @@ Command command_table[] = {
     {"which", which_command, "Locate a command"},
     {"ln", ln_command, "Create links between files"},
     {"diff", diff_command, "Compare files line by line"},
+    {"sha256sum", sha256sum_command, "Compute and check SHA-256 digests"},
+    {"xxhsum", xxhsum_command, "Compute and check XXH3 checksums"},
     {"exit", exit_command, "Exit the shell and VM"},
     {"version", version_command, "Display ZoraVM version information"},
     
@@ -5040,6 +5141,8 @@ Command command_table[] = {
     {"kill-new", kill_enhanced_command, "Enhanced kill command with signal support"},
     {"pkill", pkill_command, "Kill processes by name pattern"},
     {"pgrep", pgrep_command, "Find processes by name pattern"},
+    {"bench", bench_command, "Run a kernel or VM benchmark: bench <subsystem> [args]"},
+    {"syscallstat", syscallstat_command, "Show per-syscall counters and latency, set tracing"},
 
     {NULL, NULL, NULL}
 };
@@ -5075,6 +5178,14 @@ const char* get_env_var(const char* name) {
     return NULL;
 }
 
+int get_env_var_names(const char** names, int max_names) {
+    int count = env_var_count < max_names ? env_var_count : max_names;
+    for (int i = 0; i < count; i++) {
+        names[i] = env_vars[i].name;
+    }
+    return count;
+}
+
 void expand_variables(const char* input, char* output, size_t output_size) {
     const char* src = input;
     char* dst = output;
@@ -6892,15 +7003,43 @@ void netstack_command(int argc, char **argv) {
 }
 
 void netroute_command(int argc, char **argv) {
+    IPv4Address dest, mask, gateway;
+    
     if (argc < 2) {
         // Show routing table
         netstack_show_routes();
     } else if (strcmp(argv[1], "add") == 0) {
-        printf("netroute: add not yet implemented\n");
+        if (argc < 4 || netstack_parse_ipv4(argv[2], &dest) != 0 || netstack_parse_ipv4(argv[3], &mask) != 0 ||
+            netstack_parse_ipv4(argc > 4 ? argv[4] : "0.0.0.0", &gateway) != 0) {
+            printf("Usage: netroute add <dest> <netmask> [gateway] [metric]\n");
+            return;
+        }
+        netstack_add_route(&dest, &mask, &gateway, argc > 5 ? atoi(argv[5]) : 0);
     } else if (strcmp(argv[1], "del") == 0) {
-        printf("netroute: delete not yet implemented\n");
+        if (argc < 3 || netstack_parse_ipv4(argv[2], &dest) != 0) {
+            printf("Usage: netroute del <dest>\n");
+            return;
+        }
+        netstack_del_route(&dest);
+    } else if (strcmp(argv[1], "get") == 0) {
+        if (argc < 3 || netstack_parse_ipv4(argv[2], &dest) != 0) {
+            printf("Usage: netroute get <address>\n");
+            return;
+        }
+        RouteEntry* route = netstack_find_route(&dest);
+        if (!route) {
+            printf("netroute: no route to %s\n", argv[2]);
+            return;
+        }
+        char net_str[16], mask_str[16], gw_str[16];
+        netstack_format_ipv4(&route->dest, net_str, sizeof(net_str));
+        netstack_format_ipv4(&route->mask, mask_str, sizeof(mask_str));
+        netstack_format_ipv4(&route->gateway, gw_str, sizeof(gw_str));
+        NetworkInterface* iface = netstack_get_interface(route->interface_id);
+        printf("%s via %s dev %s (route %s/%s, metric %d)\n", argv[2], gw_str,
+               iface ? iface->name : "?", net_str, mask_str, route->metric);
     } else {
-        printf("Usage: netroute [add|del]\n");
+        printf("Usage: netroute [add <dest> <netmask> [gateway] [metric] | del <dest> | get <address>]\n");
     }
 }
 
@@ -8416,10 +8555,16 @@ void diff_command(int argc, char **argv) {
         return;
     }
     
-    // Simple comparison
-    if (size1 == size2 && memcmp(data1, data2, size1) == 0) {
-        // Files are identical
-        return;
+    // Cached digests settle most comparisons; equal digests are confirmed byte for byte
+    if (size1 == size2) {
+        HashDigest digest1, digest2;
+        int differ = hash_file(full_path1, HASH_XXH3, &digest1) == 0 &&
+                     hash_file(full_path2, HASH_XXH3, &digest2) == 0 &&
+                     digest1.xxh3 != digest2.xxh3;
+        if (!differ && memcmp(data1, data2, size1) == 0) {
+            // Files are identical
+            return;
+        }
     }
     
     printf("--- %s\n", file1);
@@ -8483,6 +8628,236 @@ void diff_command(int argc, char **argv) {
     free(lines2);
 }
 
+static void checksum_format(unsigned int algorithm, const HashDigest* digest, char* out, size_t size) {
+    if (algorithm == HASH_SHA256) {
+        char hex[2 * HASH_SHA256_SIZE + 1];
+        hash_format_sha256(digest->sha256, hex);
+        snprintf(out, size, "%s", hex);
+    } else {
+        snprintf(out, size, "XXH3_%016llx", (unsigned long long)digest->xxh3);
+    }
+}
+
+// Parse the digest column of a checksum list; xxhsum accepts it with or without "XXH3_"
+static int checksum_parse(unsigned int algorithm, const char* text, size_t length, HashDigest* digest) {
+    if (algorithm == HASH_SHA256) {
+        return length == 2 * HASH_SHA256_SIZE ? hash_parse_sha256(text, digest->sha256) : -1;
+    }
+    
+    if (length > 5 && strncmp(text, "XXH3_", 5) == 0) {
+        text += 5;
+        length -= 5;
+    }
+    if (length != 16) return -1;
+    
+    unsigned long long value = 0;
+    for (size_t i = 0; i < length; i++) {
+        char c = text[i];
+        int nibble = (c >= '0' && c <= '9') ? c - '0' :
+                     (c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+                     (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+        if (nibble < 0) return -1;
+        value = (value << 4) | (unsigned long long)nibble;
+    }
+    digest->xxh3 = value;
+    return 0;
+}
+
+static int checksum_matches(unsigned int algorithm, const HashDigest* a, const HashDigest* b) {
+    if (algorithm == HASH_SHA256) return memcmp(a->sha256, b->sha256, HASH_SHA256_SIZE) == 0;
+    return a->xxh3 == b->xxh3;
+}
+
+// Hash every named file in one batch so the worker pool sees all of them
+static void checksum_files(const char* tool, unsigned int algorithm, int count, char** names) {
+    char (*paths)[512] = malloc((size_t)count * sizeof(*paths));
+    const char** path_list = malloc((size_t)count * sizeof(char*));
+    int* batch_index = malloc((size_t)count * sizeof(int));
+    HashDigest* digests = malloc((size_t)count * sizeof(HashDigest));
+    int* results = malloc((size_t)count * sizeof(int));
+    if (!paths || !path_list || !batch_index || !digests || !results) {
+        printf("%s: out of memory\n", tool);
+        free(paths); free(path_list); free(batch_index); free(digests); free(results);
+        return;
+    }
+    
+    // Only readable regular files go into the batch; the rest are reported in order below
+    char* cwd = vfs_getcwd();
+    int batch = 0;
+    for (int i = 0; i < count; i++) {
+        build_full_path(paths[i], sizeof(paths[i]), cwd ? cwd : "/", names[i]);
+        VNode* node = vfs_find_node(paths[i]);
+        if (node) node = vfs_resolve_symlink(node);
+        batch_index[i] = -1;
+        if (node && !node->is_directory &&
+            vfs_check_permission(paths[i], vfs_current_user, VFS_S_IRUSR >> 6)) {
+            batch_index[i] = batch;
+            path_list[batch++] = paths[i];
+        }
+    }
+    
+    if (batch > 0) {
+        hash_files(path_list, batch, algorithm, digests, results, 0);
+    }
+    
+    for (int i = 0; i < count; i++) {
+        int slot = batch_index[i];
+        if (slot < 0) {
+            VNode* node = vfs_find_node(paths[i]);
+            if (node) node = vfs_resolve_symlink(node);
+            if (!node) {
+                printf("%s: %s: No such file or directory\n", tool, names[i]);
+            } else if (node->is_directory) {
+                printf("%s: %s: Is a directory\n", tool, names[i]);
+            } else {
+                printf("%s: %s: Permission denied\n", tool, names[i]);
+            }
+        } else if (results[slot] != 0) {
+            printf("%s: %s: Read error\n", tool, names[i]);
+        } else {
+            char text[80];
+            checksum_format(algorithm, &digests[slot], text, sizeof(text));
+            printf("%s  %s\n", text, names[i]);
+        }
+    }
+    
+    free(paths);
+    free(path_list);
+    free(batch_index);
+    free(digests);
+    free(results);
+}
+
+// -c: read "<digest>  <file>" lines and report OK/FAILED for each
+static void checksum_verify(const char* tool, unsigned int algorithm, const char* list) {
+    char list_path[512];
+    char* cwd = vfs_getcwd();
+    build_full_path(list_path, sizeof(list_path), cwd ? cwd : "/", list);
+    
+    void* data = NULL;
+    size_t size = 0;
+    if (vfs_read_file(list_path, &data, &size) != 0 || !data) {
+        printf("%s: %s: No such file or directory\n", tool, list);
+        return;
+    }
+    
+    int capacity = 1;
+    for (size_t i = 0; i < size; i++) {
+        if (((const char*)data)[i] == '\n') capacity++;
+    }
+    
+    char (*names)[512] = malloc((size_t)capacity * sizeof(*names));
+    char (*paths)[512] = malloc((size_t)capacity * sizeof(*paths));
+    const char** path_list = malloc((size_t)capacity * sizeof(char*));
+    HashDigest* expected = malloc((size_t)capacity * sizeof(HashDigest));
+    HashDigest* digests = malloc((size_t)capacity * sizeof(HashDigest));
+    int* results = malloc((size_t)capacity * sizeof(int));
+    if (!names || !paths || !path_list || !expected || !digests || !results) {
+        printf("%s: out of memory\n", tool);
+        free(names); free(paths); free(path_list); free(expected); free(digests); free(results);
+        return;
+    }
+    
+    int count = 0, malformed = 0;
+    const char* text = (const char*)data;
+    const char* end = text + size;
+    while (text < end) {
+        const char* line_end = memchr(text, '\n', (size_t)(end - text));
+        if (!line_end) line_end = end;
+        const char* line = text;
+        size_t length = (size_t)(line_end - line);
+        text = line_end + 1;
+        if (length > 0 && line[length - 1] == '\r') length--;
+        if (length == 0) continue;
+        
+        // "<digest>  <file>" or "<digest> *<file>" (binary mode marker)
+        const char* space = memchr(line, ' ', length);
+        size_t name_start = space ? (size_t)(space - line) + 1 : length;
+        if (name_start < length && (line[name_start] == ' ' || line[name_start] == '*')) name_start++;
+        size_t name_length = length - name_start;
+        
+        if (!space || name_length == 0 || name_length >= sizeof(names[0]) ||
+            checksum_parse(algorithm, line, (size_t)(space - line), &expected[count]) != 0) {
+            malformed++;
+            continue;
+        }
+        
+        memcpy(names[count], line + name_start, name_length);
+        names[count][name_length] = '\0';
+        build_full_path(paths[count], sizeof(paths[count]), cwd ? cwd : "/", names[count]);
+        path_list[count] = paths[count];
+        count++;
+    }
+    
+    int failed = 0, unreadable = 0;
+    if (count > 0) {
+        hash_files(path_list, count, algorithm, digests, results, 0);
+    }
+    for (int i = 0; i < count; i++) {
+        if (results[i] != 0) {
+            printf("%s: FAILED open or read\n", names[i]);
+            unreadable++;
+        } else if (checksum_matches(algorithm, &digests[i], &expected[i])) {
+            printf("%s: OK\n", names[i]);
+        } else {
+            printf("%s: FAILED\n", names[i]);
+            failed++;
+        }
+    }
+    
+    if (malformed > 0) {
+        printf("%s: WARNING: %d line%s improperly formatted\n", tool, malformed, malformed == 1 ? " is" : "s are");
+    }
+    if (unreadable > 0) {
+        printf("%s: WARNING: %d listed file%s could not be read\n", tool, unreadable, unreadable == 1 ? "" : "s");
+    }
+    if (failed > 0) {
+        printf("%s: WARNING: %d computed checksum%s did NOT match\n", tool, failed, failed == 1 ? "" : "s");
+    }
+    
+    free(names);
+    free(paths);
+    free(path_list);
+    free(expected);
+    free(digests);
+    free(results);
+}
+
+static void checksum_command(const char* tool, unsigned int algorithm, int argc, char **argv) {
+    if (argc < 2 || strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0) {
+        printf("Usage: %s <file>...\n", tool);
+        printf("       %s -c <checksum-list>\n", tool);
+        printf("       %s --bench [size_mb] [threads]\n", tool);
+        return;
+    }
+    
+    if (strcmp(argv[1], "--bench") == 0) {
+        hash_benchmark(argc >= 3 ? (size_t)atoi(argv[2]) : 0, argc >= 4 ? atoi(argv[3]) : 0);
+        return;
+    }
+    
+    if (strcmp(argv[1], "-c") == 0 || strcmp(argv[1], "--check") == 0) {
+        if (argc < 3) {
+            printf("%s: -c requires a checksum list\n", tool);
+            return;
+        }
+        for (int i = 2; i < argc; i++) {
+            checksum_verify(tool, algorithm, argv[i]);
+        }
+        return;
+    }
+    
+    checksum_files(tool, algorithm, argc - 1, argv + 1);
+}
+
+void sha256sum_command(int argc, char **argv) {
+    checksum_command("sha256sum", HASH_SHA256, argc, argv);
+}
+
+void xxhsum_command(int argc, char **argv) {
+    checksum_command("xxhsum", HASH_XXH3, argc, argv);
+}
+
 void exit_command(int argc, char **argv) {
     int exit_code = 0;
     
@@ -8506,6 +8881,7 @@ void exit_command(int argc, char **argv) {
     
     printf("Exiting VM with code %d...\n", exit_code);
     fflush(stdout);
+    history_shutdown();
     
     // Exit the VM
     exit(exit_code);
@@ -8942,6 +9318,12 @@ void fold_command(int argc, char **argv) {
     printf("Usage: fold [-w WIDTH] [FILE]\n");
 }
 
+// Both run from the clock thread; the shell waits on the event
+static void shell_timer_signal(KernelTimer* timer, void* arg) {
+    (void)timer;
+    SetEvent((HANDLE)arg);
+}
+
 // Watch - execute a program periodically
 void watch_command(int argc, char **argv) {
     if (argc < 2) {
@@ -8966,19 +9348,44 @@ void watch_command(int argc, char **argv) {
             cmd_start = i + 1;
         }
     }
+    (void)highlight;
     
     if (cmd_start >= argc) {
         printf("watch: no command specified\n");
         return;
     }
+    if (interval < 1) interval = 1;
     
     printf("Every %ds: %s\n\n", interval, argv[cmd_start]);
-    printf("(Press Ctrl+C to exit)\n\n");
-    
-    // Execute command once as demo
-    execute_simple_command(&argv[cmd_start], argc - cmd_start);
+    printf("(Press any key to exit)\n\n");
+    
+    // A periodic kernel timer paces the refreshes; without the clock
+    // running, fall back to the host tick count
+    HANDLE refresh = CreateEventA(NULL, FALSE, FALSE, NULL);
+    KernelTimer timer;
+    timer_setup(&timer, shell_timer_signal, refresh);
+    timer_arm_periodic(&timer, (uint32_t)interval * 1000);
+    int clocked = timer_clock_running();
+    
+    int quit = 0;
+    while (!quit) {
+        execute_simple_command(&argv[cmd_start], argc - cmd_start);
+        
+        ULONGLONG deadline = GetTickCount64() + (ULONGLONG)interval * 1000;
+        for (;;) {
+            if (_kbhit()) {
+                _getch();
+                quit = 1;
+                break;
+            }
+            if (WaitForSingleObject(refresh, 100) == WAIT_OBJECT_0) break;
+            if (!clocked && GetTickCount64() >= deadline) break;
+        }
+        if (!quit) printf("\n");
+    }
     
-    printf("\n[Watch would refresh every %d seconds]\n", interval);
+    timer_cancel(&timer);
+    CloseHandle(refresh);
 }
 
 // Timeout - run a command with a time limit
@@ -9007,13 +9414,41 @@ void timeout_command(int argc, char **argv) {
         }
     }
     
+    uint64_t unit_seconds = unit == 'm' ? 60 : unit == 'h' ? 3600 : unit == 'd' ? 86400 : 1;
+    uint64_t limit_ms = (uint64_t)(duration > 0 ? duration : 0) * unit_seconds * 1000;
+    if (limit_ms > 0xFFFFFFF0u) limit_ms = 0xFFFFFFF0u;   // WaitFor* takes a DWORD
+    
     printf("timeout: Running command with %d%c time limit\n", duration, unit);
     
-    // Spawn the command
+    // Spawn in the background so this thread can wait on both the
+    // process and the timer
     int pid = -1;
-    if (process_real_spawn(argv[2], &argv[2], argc - 2, 0, &pid) == 0) {
-        printf("Started process %d with timeout\n", pid);
-        printf("(Timeout enforcement would be implemented with timer)\n");
+    if (process_real_spawn(argv[2], &argv[2], argc - 2, 1, &pid) != 0) {
+        return;
+    }
+    RealProcess* proc = process_real_get(pid);
+    if (!proc || !proc->win_handle) {
+        return;
+    }
+    
+    HANDLE expired = CreateEventA(NULL, TRUE, FALSE, NULL);
+    KernelTimer timer;
+    timer_setup(&timer, shell_timer_signal, expired);
+    timer_arm(&timer, limit_ms);
+    
+    HANDLE waits[2] = { proc->win_handle, expired };
+    DWORD result = timer_clock_running()
+        ? WaitForMultipleObjects(2, waits, FALSE, INFINITE)
+        : WaitForSingleObject(proc->win_handle, (DWORD)limit_ms);
+    timer_cancel(&timer);
+    CloseHandle(expired);
+    
+    if (result == WAIT_OBJECT_0) {
+        int exit_code = 0;
+        process_real_wait(pid, &exit_code);
+    } else {
+        printf("timeout: %s ran out of time after %d%c\n", argv[2], duration, unit);
+        process_real_kill(pid, PROC_SIG_TERM);
     }
 }
 
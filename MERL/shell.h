@@ -92,6 +92,10 @@ void unzip_command(int argc, char **argv);
 
 // Helper functions
 void add_to_history(const char* command);
+void build_full_path(char* full_path, size_t size, const char* cwd, const char* relative_path);
+const char* get_env_var(const char* name);
+int get_env_var_names(const char** names, int max_names);
+void complete_command(int argc, char **argv);
 
 // External references
 extern Command command_table[];
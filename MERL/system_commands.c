@@ -8,6 +8,17 @@
 #include "system/process.h"
 #include "system/disk.h"
 #include "vfs/vfs.h"
+#include "cpu.h"
+#include "memory.h"
+#include "kernel/mmu.h"
+#include "kernel/scheduler.h"
+#include "kernel/timer.h"
+#include "kernel/interrupts.h"
+#include "kernel/syscall_table.h"
+#include "kernel/io_ring.h"
+#include "kernel/network_stack.h"
+#include "kernel/fib.h"
+#include "kernel/inet_checksum.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -97,14 +108,16 @@ void diskinfo_command(int argc, char **argv) {
 
 // Disk quota management
 void quota_command(int argc, char **argv) {
-    if (argc < 2) {
+    if (argc >= 2 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)) {
         printf("Usage: quota [user]\n");
+        printf("  quota                - Show quota for the current user\n");
         printf("  quota <username>     - Show quota for user\n");
         return;
     }
     
-    const char* username = argv[1];
+    const char* username = argc >= 2 ? argv[1] : vfs_current_user;
     uint64_t quota_bytes = 0, used_bytes = 0;
+    unsigned long long used_inodes = 0;
     
     if (disk_get_quota(username, &quota_bytes, &used_bytes) == 0) {
         char used_buf[64], limit_buf[64];
@@ -115,6 +128,8 @@ void quota_command(int argc, char **argv) {
         printf("=== Disk Quota for %s ===\n", username);
         printf("Usage:    %s / %s\n", used_buf, limit_buf);
         printf("Percent:  %.1f%%\n", (used_bytes * 100.0) / quota_bytes);
+        vfs_get_usage(username, NULL, &used_inodes);
+        printf("Files:    %llu\n", used_inodes);
         
         if (disk_check_quota(username) != 0) {
             printf("\n*** WARNING: Quota exceeded! ***\n");
@@ -259,3 +274,261 @@ void pgrep_command(int argc, char **argv) {
         free(pid_list);
     }
 }
+
+// Syscall counters, latency histograms and tracing
+void syscallstat_command(int argc, char **argv) {
+    if (argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)) {
+        printf("Usage: syscallstat [name | -r | trace <name|all> [on|off] | bench [count]]\n");
+        printf("  With no arguments, show calls, errors and latency for each syscall used\n");
+        printf("  name              Latency histogram for one syscall\n");
+        printf("  -r, --reset       Clear the counters\n");
+        printf("  trace             Log calls of one syscall (or all) as they are dispatched\n");
+        printf("  bench             Time count calls (default 1000000) directly, dispatched and traced\n");
+        return;
+    }
+    
+    if (argc == 1) {
+        syscall_dump_stats();
+        return;
+    }
+    
+    if (strcmp(argv[1], "-r") == 0 || strcmp(argv[1], "--reset") == 0) {
+        syscall_reset_stats();
+        printf("syscallstat: counters cleared\n");
+        return;
+    }
+    
+    if (strcmp(argv[1], "bench") == 0) {
+        unsigned int count = argc > 2 ? (unsigned int)strtoul(argv[2], NULL, 10) : 0;
+        syscall_benchmark(count);
+        return;
+    }
+    
+    if (strcmp(argv[1], "trace") == 0) {
+        if (argc < 3) {
+            printf("syscallstat: trace needs a syscall name or 'all'\n");
+            return;
+        }
+        int enabled = !(argc > 3 && strcmp(argv[3], "off") == 0);
+        if (strcmp(argv[2], "all") == 0) {
+            syscall_trace_all(enabled);
+            printf("syscallstat: tracing %s for all syscalls\n", enabled ? "on" : "off");
+            return;
+        }
+        int num = syscall_lookup(argv[2]);
+        if (num < 0) {
+            printf("syscallstat: unknown syscall '%s'\n", argv[2]);
+            return;
+        }
+        syscall_trace_set((uint32_t)num, enabled);
+        printf("syscallstat: tracing %s for %s\n", enabled ? "on" : "off", argv[2]);
+        return;
+    }
+    
+    int num = syscall_lookup(argv[1]);
+    if (num < 0) {
+        printf("syscallstat: unknown syscall '%s'\n", argv[1]);
+        return;
+    }
+    syscall_dump_histogram((uint32_t)num);
+}
+
+// ===== Benchmarks =====
+
+// Positional argument i of a benchmark, 0 if absent so the benchmark
+// picks its default.  argv[0] is the subsystem name.
+static unsigned int bench_uint(int argc, char **argv, int i) {
+    return i < argc ? (unsigned int)strtoul(argv[i], NULL, 10) : 0;
+}
+
+static unsigned long long bench_ull(int argc, char **argv, int i) {
+    return i < argc ? strtoull(argv[i], NULL, 10) : 0;
+}
+
+static void bench_cpu(int argc, char **argv) {
+    int with_cache = 0;
+    unsigned long long instructions = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cache") == 0) {
+            with_cache = 1;
+        } else {
+            instructions = strtoull(argv[i], NULL, 10);
+        }
+    }
+    
+    if (!with_cache) {
+        cpu_bench(instructions);
+        cpu_print_performance();
+        return;
+    }
+    
+    int was_enabled = cpu_cache_is_enabled();
+    cpu_cache_enable(0);
+    double plain = cpu_bench(instructions);
+    if (cpu_cache_enable(1) != 0) {
+        printf("bench cpu: could not set up the cache model\n");
+        return;
+    }
+    cpu_reset_performance_counters();
+    double modelled = cpu_bench(instructions);
+    cpu_print_performance();
+    if (plain > 0 && modelled > 0) {
+        printf("Cache model overhead: %.2fx\n", plain / modelled);
+    }
+    if (!was_enabled) cpu_cache_enable(0);
+}
+
+static void bench_tlb(int argc, char **argv) {
+    mmu_tlb_benchmark(bench_uint(argc, argv, 1), bench_ull(argc, argv, 2));
+}
+
+static void bench_mem(int argc, char **argv) {
+    size_t size = 0;
+    if (argc > 1 && (size = memory_parse_size(argv[1])) == 0) {
+        printf("bench mem: invalid size '%s' (e.g. 512M, 4G)\n", argv[1]);
+        return;
+    }
+    memory_boot_benchmark(size);
+    
+    if (memory_get_total() > 0) {
+        printf("  This VM: %zu MB guest RAM, %zu KB committed, host RSS %zu MB\n",
+               memory_get_total() >> 20, memory_get_used() >> 10, memory_get_host_resident() >> 20);
+    }
+}
+
+static void bench_frame(int argc, char **argv) {
+    mmu_frame_benchmark(bench_uint(argc, argv, 1), bench_ull(argc, argv, 2));
+}
+
+static void bench_fork(int argc, char **argv) {
+    mmu_fork_benchmark(bench_uint(argc, argv, 1));
+}
+
+static void bench_map(int argc, char **argv) {
+    mmu_map_benchmark(bench_uint(argc, argv, 1));
+}
+
+static void bench_sched(int argc, char **argv) {
+    scheduler_benchmark(bench_uint(argc, argv, 1), bench_ull(argc, argv, 2));
+}
+
+static void bench_smp(int argc, char **argv) {
+    scheduler_smp_benchmark(bench_uint(argc, argv, 1), bench_uint(argc, argv, 2), bench_uint(argc, argv, 3));
+}
+
+static void bench_timer(int argc, char **argv) {
+    timer_benchmark(bench_uint(argc, argv, 1));
+    timer_dump_stats();
+}
+
+static void bench_irq(int argc, char **argv) {
+    interrupt_benchmark(bench_uint(argc, argv, 1), bench_uint(argc, argv, 2));
+}
+
+static void bench_ioring(int argc, char **argv) {
+    io_ring_benchmark(bench_uint(argc, argv, 1), bench_uint(argc, argv, 2), bench_uint(argc, argv, 3));
+    io_ring_dump_stats();
+}
+
+static void bench_net(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "demux") == 0) {
+        netstack_demux_benchmark(bench_uint(argc, argv, 2), bench_uint(argc, argv, 3));
+        return;
+    }
+    netstack_echo_benchmark(bench_uint(argc, argv, 1), bench_uint(argc, argv, 2), bench_uint(argc, argv, 3));
+    netstack_dump_stats();
+}
+
+static void bench_route(int argc, char **argv) {
+    fib_benchmark(bench_uint(argc, argv, 1), bench_uint(argc, argv, 2));
+}
+
+static void bench_csum(int argc, char **argv) {
+    inet_checksum_benchmark(bench_uint(argc, argv, 1));
+}
+
+typedef struct {
+    const char* name;
+    const char* args;
+    const char* summary;        // For the list
+    const char* help;           // For bench <name> -h
+    void (*run)(int argc, char **argv);
+} BenchCommand;
+
+static const BenchCommand bench_commands[] = {
+    {"cpu", "[--cache] [instructions]", "Virtual CPU translation cache against a plain interpreter",
+     "  Run a guest workload on the virtual CPU and report its speedup over\n"
+     "  a plain interpreter that decodes every instruction (target 10x)\n"
+     "  --cache   Run it again with the L1/L2 cache model and compare\n", bench_cpu},
+    {"tlb", "[pages] [accesses]", "Guest memory access through the software TLB",
+     "  Time random guest loads/stores through the TLB against a page walk per access\n", bench_tlb},
+    {"mem", "[size]", "Boot time and host RSS of lazily committed guest RAM",
+     "  Reserve a guest RAM arena (default 4G) and report boot time, host RSS and first-touch cost\n", bench_mem},
+    {"frame", "[frames] [operations]", "Physical frame allocator under fragmentation",
+     "  Time single-frame churn against the old bit scan and contiguous allocations under fragmentation\n",
+     bench_frame},
+    {"fork", "[max_heap_mb]", "Copy-on-write fork latency against heap size",
+     "  Fork address spaces with 1 MB up to max_heap_mb (default 64) of heap, COW against a full copy\n",
+     bench_fork},
+    {"map", "[size_mb]", "Bulk and 4 MB page mappings against page-by-page mapping",
+     "  Map size_mb (default 1024) page by page, with mmu_map_range and with 4 MB pages\n", bench_map},
+    {"sched", "[tasks] [operations]", "Run queue pick/enqueue and removal with 10k tasks",
+     "  Time run queue pick/enqueue and removal with tasks (default 10000) runnable,\n"
+     "  against the old linked-list queues\n", bench_sched},
+    {"smp", "[max_cpus] [processes] [slices]", "Run queue throughput against thread count",
+     "  Run synthetic CPU-bound processes (default 256) for slices (default 64) each on 1, 2, 4 ...\n"
+     "  max_cpus run queues, one host thread each (default: host cores), and report throughput,\n"
+     "  speedup and work steals.  Measures the scheduler's queues, not guest code.\n", bench_smp},
+    {"timer", "[count]", "Kernel timer wheel against a heap",
+     "  Arm count timers (default 1000000), cancel half and expire the rest on the timer\n"
+     "  wheel and on a binary heap, then show how often the live clock woke up\n", bench_timer},
+    {"irq", "[producers] [count]", "Lock-free IRQ posting and injection latency",
+     "  Post count IRQs (default 1000000) from producers threads (default 4) to a simulated CPU\n"
+     "  loop through the lock-free queue and a locked one, and report injection latency\n", bench_irq},
+    {"ioring", "[size_kb] [chunk_kb] [depth]", "File copy through the async I/O ring",
+     "  Copy a size_kb file (default 65536) in chunk_kb pieces (default 64), first with a read\n"
+     "  and write syscall per chunk, then through an I/O ring keeping depth (default 64) in flight\n",
+     bench_ioring},
+    {"net", "[size_kb] [msg_bytes] [rounds] | demux [sockets] [lookups]",
+     "TCP and UDP echo over loopback, and socket demux",
+     "  Stream size_kb (default 16384) through a TCP echo server on 127.0.0.1, then time rounds\n"
+     "  (default 10000) round trips of msg_bytes (default 64) over TCP and UDP\n"
+     "  demux             Time lookups (default 1000000) with sockets connections (default\n"
+     "                    100000) open, hashed and by linear scan, and a round trip over lo\n", bench_net},
+    {"route", "[routes] [lookups]", "Longest-prefix-match route lookups",
+     "  Fill a FIB with routes prefixes (default 100000) and time lookups (default 1000000)\n"
+     "  through the trie, the destination cache and a linear scan, then remove every route\n", bench_route},
+    {"csum", "[mb]", "Internet checksums and incremental updates",
+     "  Checksum mb (default 256) of packets from 20 to 65535 bytes with each implementation,\n"
+     "  copy-and-checksum, and TTL and NAT rewrites patched incrementally or summed again\n", bench_csum},
+};
+
+#define BENCH_COMMAND_COUNT (sizeof(bench_commands) / sizeof(bench_commands[0]))
+
+// Kernel and VM benchmarks: bench <subsystem> [args]
+void bench_command(int argc, char **argv) {
+    if (argc < 2 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+        printf("Usage: bench <subsystem> [args]\n");
+        printf("  Numeric arguments left out take the benchmark's default\n");
+        for (size_t i = 0; i < BENCH_COMMAND_COUNT; i++) {
+            printf("  %-8s %s\n", bench_commands[i].name, bench_commands[i].summary);
+        }
+        printf("  bench <subsystem> -h shows its arguments\n");
+        return;
+    }
+    
+    for (size_t i = 0; i < BENCH_COMMAND_COUNT; i++) {
+        const BenchCommand* bench = &bench_commands[i];
+        if (strcmp(argv[1], bench->name) != 0) continue;
+        
+        if (argc > 2 && (strcmp(argv[2], "-h") == 0 || strcmp(argv[2], "--help") == 0)) {
+            printf("Usage: bench %s %s\n%s", bench->name, bench->args, bench->help);
+            return;
+        }
+        bench->run(argc - 1, argv + 1);
+        return;
+    }
+    
+    printf("bench: unknown subsystem '%s'; try bench -h\n", argv[1]);
+}
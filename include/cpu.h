@@ -2,6 +2,7 @@
 #define CPU_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 // CPU Architecture Constants
 #define CPU_REGISTER_COUNT 16
@@ -65,9 +66,46 @@ typedef enum {
     INST_PUSH = 0x70,
     INST_POP = 0x71,
     INST_INT = 0x80,
-    INST_IRET = 0x81
+    INST_IRET = 0x81,
+    INST_HLT = 0xF4,
+    INST_CLI = 0xFA,
+    INST_STI = 0xFB
 } InstructionType;
 
+// Instruction encoding
+//
+// Every instruction starts with a little-endian 32-bit word:
+//   bits  0-7   opcode (InstructionType)
+//   bits  8-11  rd, the destination register
+//   bits 12-15  rs, the source register
+//   bits 16-23  operand mode (CPU_MODE_*)
+//   bits 24-31  reserved, must be zero
+// CPU_MODE_IMM and CPU_MODE_MEM add a second 32-bit word holding the
+// immediate, or the displacement added to the base register.  Branches and
+// CALL take an absolute target (IMM) or a register (REG); PUSH takes rs or
+// an immediate, POP writes rd, and STORE writes rs to [rd + disp].
+#define CPU_MODE_REG    0x00
+#define CPU_MODE_IMM    0x01
+#define CPU_MODE_MEM    0x02
+
+#define CPU_ENCODE(op, rd, rs, mode) \
+    ((uint32_t)(op) | ((uint32_t)(rd) << 8) | ((uint32_t)(rs) << 12) | ((uint32_t)(mode) << 16))
+
+// Interpreter tuning
+#define CPU_BLOCK_MAX_INSTRUCTIONS  32      // Translated block length limit
+#define CPU_TC_BLOCKS               4096    // Translation cache capacity, in blocks
+#define CPU_TC_BUCKETS              4096    // Translation lookup buckets (power of two)
+#define CPU_SLICE_INSTRUCTIONS      65536   // Budget per cpu_run() time slice
+#define CPU_BLOCK_FETCH_RANGES      4       // Contiguous code runs per block (limits inlined branches)
+
+// Cache model defaults, used by cpu_cache_enable()
+#define CPU_CACHE_LINE_SIZE         64
+#define CPU_L1_CACHE_SIZE           (32 * 1024)
+#define CPU_L1_CACHE_WAYS           8
+#define CPU_L2_CACHE_SIZE           (256 * 1024)
+#define CPU_L2_CACHE_WAYS           8
+#define CPU_CACHE_BATCH             4096    // Accesses queued before the model runs them
+
 // Interrupt vectors
 typedef enum {
     INT_TIMER = 0x00,
@@ -90,20 +128,50 @@ typedef struct {
     uint64_t branch_mispredictions;
     uint64_t page_faults;
     uint64_t interrupts_handled;
+    uint64_t translation_hits;          // Block lookups and chain links served from the cache
+    uint64_t translation_misses;        // Blocks translated
+    uint64_t translation_invalidations; // Blocks dropped by writes to their code
 } CPUPerfCounters;
 
-// CPU cache structure
-typedef struct {
-    uint8_t* data;
-    uint32_t* tags;
-    uint8_t* valid;
+// Cache access kinds, counted separately by the cache model
+typedef enum {
+    CPU_CACHE_READ = 0,
+    CPU_CACHE_WRITE = 1,
+    CPU_CACHE_FETCH = 2,
+    CPU_CACHE_ACCESS_TYPES
+} CPUCacheAccess;
+
+// A queued access for cpu_cache_simulate(): address, size and type packed
+// into one word so the interpreter only does a single store per access
+#define CPU_CACHE_RECORD(address, size, type) \
+    ((uint64_t)(uint32_t)(address) | ((uint64_t)(size) << 32) | ((uint64_t)(type) << 48))
+
+// CPU cache structure: a set-associative, write-back, write-allocate model
+// with tree pseudo-LRU replacement.  Only tags are simulated; the data
+// itself always lives in guest RAM.
+typedef struct CPUCache {
+    uint32_t* tags;             // Line number per way, sets * associativity
+    uint8_t* valid;             // CPU_CACHE_LINE_* state per way
+    uint32_t* plru;             // Pseudo-LRU tree bits, one word per set
+    uint32_t* mru;              // Most recently used way per set; hits on it
+                                // skip the set search and the LRU update
     uint32_t size;
     uint32_t line_size;
     uint32_t associativity;
+    uint32_t sets;
+    uint32_t line_shift;
     uint64_t hits;
     uint64_t misses;
+    uint64_t type_hits[CPU_CACHE_ACCESS_TYPES];
+    uint64_t type_misses[CPU_CACHE_ACCESS_TYPES];
+    uint64_t evictions;
+    uint64_t writebacks;        // Dirty lines written to the next level
+    struct CPUCache* next;      // Next level, or NULL for memory
 } CPUCache;
 
+#define CPU_CACHE_LINE_VALID    0x01
+#define CPU_CACHE_LINE_DIRTY    0x02
+
 // Main CPU state structure
 typedef struct {
     // Core registers
@@ -151,10 +219,17 @@ void cpu_reset(void);
 
 // Execution control
 void cpu_run(void);
+uint64_t cpu_run_slice(uint64_t budget);    // Returns instructions executed
 void cpu_step(void);
 void cpu_halt(void);
 CPUState* cpu_get_state(void);
 
+// Drop translated code covering [address, address + size) after it is
+// written.  memory_write() and memory_write_block() call this themselves.
+void cpu_invalidate_code(uint32_t address, uint32_t size);
+void cpu_flush_translations(void);
+int cpu_is_code_page(uint32_t physical_addr);   // Does the page hold translated code?
+
 // Instruction execution
 void cpu_execute_instruction(CPUState *cpu, uint32_t instruction);
 uint32_t cpu_fetch_instruction(CPUState *cpu);
@@ -177,17 +252,28 @@ void cpu_set_interrupt_pending(InterruptVector vector);
 void cpu_enable_interrupts(void);
 void cpu_disable_interrupts(void);
 
-// Cache operations
+// Cache operations.  The model is off by default; cpu_cache_enable() sets
+// up l1_cache -> l2_cache with the defaults above and starts feeding it the
+// interpreter's fetches, loads and stores in batches.
+int cpu_cache_init(CPUCache* cache, uint32_t size, uint32_t line_size, uint32_t associativity, CPUCache* next);
+void cpu_cache_destroy(CPUCache* cache);
+void cpu_cache_access(CPUCache* cache, uint32_t address, uint32_t size, CPUCacheAccess type);
+void cpu_cache_simulate(CPUCache* cache, const uint64_t* records, size_t count);
 int cpu_cache_read(CPUCache* cache, uint32_t address, uint8_t* data, size_t size);
 int cpu_cache_write(CPUCache* cache, uint32_t address, const uint8_t* data, size_t size);
-void cpu_cache_flush(CPUCache* cache);
-void cpu_cache_invalidate(CPUCache* cache);
+void cpu_cache_flush(CPUCache* cache);       // Write back dirty lines
+void cpu_cache_invalidate(CPUCache* cache);  // Drop every line without writing back
+void cpu_cache_reset_stats(CPUCache* cache);
+void cpu_cache_print_stats(const char* name, const CPUCache* cache);
+int cpu_cache_enable(int enabled);
+int cpu_cache_is_enabled(void);
 
 // Performance monitoring
 CPUPerfCounters* cpu_get_performance_counters(void);
 void cpu_reset_performance_counters(void);
 double cpu_get_mips(void); // Million Instructions Per Second
 double cpu_get_cache_hit_ratio(void);
+double cpu_bench(uint64_t instructions);  // Runs a guest workload, returns MIPS
 
 // Debug and diagnostics
 void cpu_print_state(void);
@@ -0,0 +1,53 @@
+#ifndef KERNEL_BENCH_BASELINES_H
+#define KERNEL_BENCH_BASELINES_H
+
+#include <stdint.h>
+#include "kernel/scheduler.h"
+
+// The implementations the kernel's current data structures replaced, kept
+// only so the benchmarks can measure against them.  Nothing outside a
+// *_benchmark() function should use these.
+
+// Frame allocator before the buddy maps: a bit-at-a-time scan from the
+// lowest frame that might be free
+typedef struct {
+    uint32_t* bitmap;
+    uint32_t total_frames;
+    uint32_t first_free_frame;
+} FrameScan;
+
+int frame_scan_init(FrameScan* scan, uint32_t frames);
+void frame_scan_destroy(FrameScan* scan);
+uint32_t frame_scan_alloc(FrameScan* scan);         // FRAME_INVALID when full
+void frame_scan_free(FrameScan* scan, uint32_t frame);
+
+// Run queue before the per-level bitmap: a malloc'd node per enqueue, a
+// linear search to remove, and a top-down scan of the levels to pick.
+// The pick/remove/clear calls take SCHEDULER_MAX_QUEUES levels.
+typedef struct LegacyNode LegacyNode;
+
+typedef struct {
+    LegacyNode* head;
+    LegacyNode* tail;
+} LegacyQueue;
+
+void legacy_enqueue(LegacyQueue* queue, Process* process);
+Process* legacy_pick(LegacyQueue* levels);
+void legacy_remove(LegacyQueue* levels, Process* process);
+void legacy_clear(LegacyQueue* levels);
+
+// Binary heap of timer ids on expiry, the structure the timer wheel is
+// measured against; pos[] lets a cancel find an entry without searching
+typedef struct {
+    uint32_t* heap;
+    uint32_t* pos;
+    uint64_t* expires;          // By id, filled in by timer_heap_push()
+    uint32_t count;
+} TimerHeap;
+
+int timer_heap_init(TimerHeap* h, uint32_t capacity);  // Ids 0 .. capacity-1
+void timer_heap_destroy(TimerHeap* h);
+void timer_heap_push(TimerHeap* h, uint32_t id, uint64_t expires);
+void timer_heap_remove(TimerHeap* h, uint32_t id);
+
+#endif // KERNEL_BENCH_BASELINES_H
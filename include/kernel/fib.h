@@ -0,0 +1,56 @@
+#ifndef KERNEL_FIB_H
+#define KERNEL_FIB_H
+
+#include <stdint.h>
+
+// Forwarding information base: longest-prefix match over IPv4 prefixes.
+// Routes sit in a path-compressed binary trie (Patricia), where a node
+// exists only for a route or for a bit where two routes' prefixes part.
+// As in poptrie, a table indexed by the top FIB_DIRECT_BITS of the
+// address points each lookup straight at the first node below them, so
+// only the few nodes of longer prefixes are walked.  Lookups go through a
+// small cache of recent destinations, which any route change invalidates
+// at once.
+//
+// A FIB maps each prefix to one value owned by the caller (its route
+// entry).  The system routing table is the network stack's one FIB; other
+// layers reach it through kernel/net_route.h.  Addresses and prefixes are
+// in host byte order.  Callers serialize access.
+#define FIB_DIRECT_BITS         16
+#define FIB_CACHE_BITS          12      // 4096 cached destinations, two per set
+
+typedef struct {
+    uint64_t routes;
+    uint64_t nodes;                     // Routes plus the branch nodes between them
+    uint64_t lookups;
+    uint64_t cache_hits;
+    uint64_t inserts;
+    uint64_t removes;
+} FibStats;
+
+typedef struct Fib Fib;
+typedef void (*FibVisit)(uint32_t prefix, int length, void* value, void* arg);
+
+Fib* fib_create(void);
+void fib_destroy(Fib* fib, void (*release)(void* value));  // release may be NULL
+
+// 0 if added, 1 if the prefix already has a route (left as it is), -1 on
+// a bad prefix or out of memory.  Host bits of `prefix` are ignored.
+int fib_insert(Fib* fib, uint32_t prefix, int length, void* value);
+// The route for exactly this prefix, or NULL; fib_remove() also takes it
+// out.  A length of -1 picks the most specific route whose network
+// address is exactly `prefix`.
+void* fib_remove(Fib* fib, uint32_t prefix, int length);
+void* fib_get(const Fib* fib, uint32_t prefix, int length);
+void* fib_lookup(Fib* fib, uint32_t addr);                   // Longest match
+void fib_walk(const Fib* fib, FibVisit visit, void* arg);     // Shorter prefixes first
+uint32_t fib_count(const Fib* fib);
+const FibStats* fib_get_stats(const Fib* fib);
+
+// Prefix length of a netmask, -1 if its bits are not contiguous
+int fib_mask_length(uint32_t mask);
+uint32_t fib_length_mask(int length);
+
+void fib_benchmark(uint32_t count, uint32_t lookups);
+
+#endif // KERNEL_FIB_H
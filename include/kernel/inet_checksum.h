@@ -0,0 +1,34 @@
+#ifndef KERNEL_INET_CHECKSUM_H
+#define KERNEL_INET_CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Internet checksum (RFC 1071): the one's complement of the one's
+// complement sum of a packet's 16-bit words.  The sum does not depend on
+// byte order, so words are added as they sit in memory and the result is
+// stored back the same way.  Bulk sums run 16 or 32 bytes per step with
+// SSE2 or AVX2, picked once from what the CPU supports.
+//
+// A partial sum is the folded, uncomplemented sum of some bytes; chain
+// them through `sum` to cover a header and payload kept apart, then
+// complement the total.  Chained pieces must start at even offsets, or be
+// joined with inet_checksum_combine().
+
+uint32_t inet_checksum_add(uint32_t sum, const void* data, size_t size);
+// Copy `size` bytes and add them to the sum in the same pass
+uint32_t inet_checksum_copy(uint32_t sum, void* dst, const void* src, size_t size);
+// Add a piece's partial sum taken as if it started at `offset`
+uint32_t inet_checksum_combine(uint32_t sum, uint32_t part, size_t offset);
+uint16_t inet_checksum(const void* data, size_t size);
+
+// Patch a stored checksum after a field changes from old to new, without
+// summing the packet again (RFC 1624, eqn. 3).  Values are raw, as they
+// sit in the packet; a 32-bit field must start at an even offset.
+uint16_t inet_checksum_adjust16(uint16_t check, uint16_t old_value, uint16_t new_value);
+uint16_t inet_checksum_adjust32(uint16_t check, uint32_t old_value, uint32_t new_value);
+
+const char* inet_checksum_impl(void);              // "scalar", "SSE2" or "AVX2"
+void inet_checksum_benchmark(uint32_t total_mb);
+
+#endif // KERNEL_INET_CHECKSUM_H
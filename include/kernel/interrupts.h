@@ -54,6 +54,15 @@
 
 #define MAX_INTERRUPTS          256     // Total interrupt vectors
 
+// Cross-thread IRQ posting.  Device threads post into a lock-free queue and
+// ring a doorbell bit per vector; the CPU loop checks the doorbell at block
+// boundaries and drains the queue in priority order (lowest vector first).
+#define IRQ_POST_FIRST          INT_IRQ_BASE    // Lowest postable vector
+#define IRQ_POST_LINES          32              // Vectors 0x20-0x3F, one doorbell bit each
+#define IRQ_QUEUE_SIZE          1024            // Posted IRQs in flight, power of two
+#define IRQ_DRAIN_BATCH         64              // Delivered per poll
+#define IRQ_LATENCY_BUCKETS     16              // Power-of-two microsecond buckets
+
 // Interrupt gate types
 #define IDT_GATE_TASK           0x5     // Task gate
 #define IDT_GATE_INTERRUPT_16   0x6     // 16-bit interrupt gate
@@ -121,6 +130,17 @@ typedef struct {
     uint64_t interrupt_counts[MAX_INTERRUPTS];
 } InterruptStats;
 
+// Posted IRQ statistics
+typedef struct {
+    uint64_t posted;
+    uint64_t delivered;
+    uint64_t dropped;                   // Queue full
+    uint64_t polls;                     // Polls that delivered something
+    uint64_t latency_total_ns;          // Post to handler entry
+    uint64_t latency_max_ns;
+    uint64_t latency_buckets[IRQ_LATENCY_BUCKETS];  // Bucket n: under 2^n us
+} IrqQueueStats;
+
 // Interrupt controller state
 typedef struct {
     IDTEntry idt[MAX_INTERRUPTS];
@@ -153,8 +173,19 @@ uint32_t interrupts_get_mask(void);
 
 // Interrupt handling
 void interrupt_dispatch(InterruptContext* context);
+void interrupt_raise(uint8_t int_no);   // Hardware IRQ from a host thread
 void interrupt_eoi(uint8_t int_no);  // End of interrupt
 
+// Posted IRQs.  interrupt_post is safe from any thread and never blocks;
+// it fails when the queue is full or the vector is not a device vector.
+// Only the thread holding the claim delivers, so a CPU loop that has
+// claimed the queue takes every posted IRQ at its own block boundaries.
+extern volatile long interrupt_doorbell;    // Bit n: vector IRQ_POST_FIRST + n posted
+int interrupt_post(uint8_t int_no, uint32_t data);  // data arrives in err_code
+uint32_t interrupt_poll(void);          // Deliver posted IRQs; returns count
+int interrupt_claim(void);              // 1 if this thread now delivers
+void interrupt_release(void);
+
 // Exception handlers
 void exception_divide_error(InterruptContext* ctx);
 void exception_debug(InterruptContext* ctx);
@@ -195,7 +226,9 @@ void interrupt_syscall_handler(InterruptContext* ctx);
 
 // Statistics
 InterruptStats* interrupts_get_stats(void);
+IrqQueueStats* interrupts_get_irq_stats(void);
 void interrupts_dump_stats(void);
+void interrupt_benchmark(uint32_t producers, uint32_t count);
 
 // Timer functions
 uint64_t interrupts_get_ticks(void);      // Get system ticks (ms since boot)
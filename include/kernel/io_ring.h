@@ -0,0 +1,99 @@
+#ifndef KERNEL_IO_RING_H
+#define KERNEL_IO_RING_H
+
+#include <stdint.h>
+#include "vfs/vfs_file.h"
+
+// Asynchronous I/O rings, after Linux io_uring.  The guest hands the kernel
+// a block of its own memory holding a submission queue (SQ) and a
+// completion queue (CQ).  It fills SQ entries and advances sq_tail; one
+// io_uring_enter() then takes the whole batch, posting a CQ entry per
+// operation.  File reads and writes complete inside the call, as the VFS
+// belongs to the submitting thread; socket, pipe and console I/O goes to a
+// pool of kernel worker threads.  The guest reaps completions by advancing
+// cq_head, so hundreds of I/Os can be issued per syscall.
+//
+// All addresses in the ring are 32-bit, like every syscall pointer.
+#define IO_RING_MAX_ENTRIES     4096    // SQ entries; the CQ has twice as many
+#define IO_RING_WORKERS         4
+#define IO_RING_OFF_CURRENT     0xFFFFFFFFu     // SQE offset: use the file position
+
+// Operations
+#define IO_OP_NOP               0
+#define IO_OP_READ              1       // fd, addr, len, off
+#define IO_OP_WRITE             2       // fd, addr, len, off
+#define IO_OP_OPEN              3       // addr = path, op_flags = open flags; res = fd
+#define IO_OP_CLOSE             4       // fd
+#define IO_OP_SEND              5       // fd, addr, len, op_flags = send flags
+#define IO_OP_RECV              6       // fd, addr, len, op_flags = recv flags
+#define IO_OP_COUNT             7
+
+// io_uring_enter() flags
+#define IO_ENTER_GETEVENTS      0x1     // Wait for min_complete completions
+
+typedef struct {
+    uint8_t opcode;                     // IO_OP_*
+    uint8_t flags;
+    uint16_t reserved;
+    int32_t fd;
+    uint32_t addr;
+    uint32_t len;
+    uint32_t off;                       // IO_RING_OFF_CURRENT for the file position
+    uint32_t op_flags;
+    uint64_t user_data;                 // Copied to the completion untouched
+} IoRingSqe;
+
+typedef struct {
+    uint64_t user_data;
+    int32_t res;                        // What the matching syscall would return
+    uint32_t flags;
+} IoRingCqe;
+
+// Start of the shared block.  The guest owns sq_tail and cq_head, the
+// kernel sq_head and cq_tail; the SQ and CQ arrays follow at the offsets.
+typedef struct {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    uint32_t sq_mask;
+    uint32_t sq_entries;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    uint32_t cq_mask;
+    uint32_t cq_entries;
+    uint32_t sq_offset;                 // Bytes from the start of the block
+    uint32_t cq_offset;
+    uint32_t dropped;                   // Invalid SQ entries skipped
+    uint32_t reserved;
+} IoRingShared;
+
+// Bytes the guest must provide for a ring of `entries` (a power of two)
+#define IO_RING_BYTES(entries) \
+    (sizeof(IoRingShared) + (size_t)(entries) * sizeof(IoRingSqe) + 2 * (size_t)(entries) * sizeof(IoRingCqe))
+
+typedef struct {
+    uint64_t rings_created;
+    uint64_t enters;                    // io_uring_enter() calls
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t inline_ops;                // Done in the submitting thread: open/close, file I/O
+    uint64_t waits;                     // Times a caller slept for completions
+    uint64_t ops[IO_OP_COUNT];
+} IoRingStats;
+
+typedef struct IoRing IoRing;
+
+int io_ring_init(void);
+void io_ring_cleanup(void);
+
+// Rings.  Operations resolve their fds in `fds` at submission.
+IoRing* io_ring_create(IoRingShared* shared, uint32_t entries, VFSFdTable* fds);
+void io_ring_destroy(IoRing* ring);                 // Waits for operations in flight
+int io_ring_submit(IoRing* ring, uint32_t to_submit);   // Returns entries consumed
+int io_ring_wait(IoRing* ring, uint32_t min_complete);  // Returns completions ready
+
+// Statistics
+IoRingStats* io_ring_get_stats(void);
+void io_ring_dump_stats(void);
+void io_ring_benchmark(uint32_t size_kb, uint32_t chunk_kb, uint32_t depth);
+
+#endif // KERNEL_IO_RING_H
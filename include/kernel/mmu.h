@@ -2,12 +2,16 @@
 #define KERNEL_MMU_H
 
 #include <stdint.h>
+#include <string.h>
+#include <windows.h>
 
 // Page size and masks
 #define PAGE_SIZE           4096        // 4KB pages
 #define PAGE_SHIFT          12          // 2^12 = 4096
 #define PAGE_MASK           0xFFFFF000  // Mask for page-aligned addresses
 #define PAGE_OFFSET_MASK    0x00000FFF  // Mask for offset within page
+#define LARGE_PAGE_SIZE     0x00400000  // 4MB pages (PAGE_SIZE_FLAG in a directory entry)
+#define LARGE_PAGE_MASK     0xFFC00000
 
 // Page directory and table sizes
 #define PAGE_DIRECTORY_ENTRIES  1024    // 1024 entries in page directory
@@ -40,43 +44,25 @@
 #define KERNEL_STACK_START  0x20000000  // Kernel stacks at 512MB
 #define KERNEL_STACK_SIZE   0x00400000  // 4MB kernel stack region
 
-// Page table entry
-typedef struct {
-    uint32_t present        : 1;    // Present in memory
-    uint32_t writable       : 1;    // Writable
-    uint32_t user_mode      : 1;    // User mode accessible
-    uint32_t write_through  : 1;    // Write-through caching
-    uint32_t cache_disable  : 1;    // Cache disabled
-    uint32_t accessed       : 1;    // Accessed
-    uint32_t dirty          : 1;    // Dirty (written to)
-    uint32_t pat            : 1;    // Page Attribute Table
-    uint32_t global         : 1;    // Global page
-    uint32_t available      : 3;    // Available for OS use
-    uint32_t frame          : 20;   // Physical frame address (bits 12-31)
-} __attribute__((packed)) PageTableEntry;
+// Page table entry: the frame's physical address in bits 12-31 and the
+// PAGE_* flags below it, so updates are plain mask operations
+typedef uint32_t PageTableEntry;
 
 // Page table
 typedef struct {
     PageTableEntry entries[PAGE_TABLE_ENTRIES];
 } __attribute__((aligned(PAGE_SIZE))) PageTable;
 
-// Page directory entry
-typedef struct {
-    uint32_t present        : 1;
-    uint32_t writable       : 1;
-    uint32_t user_mode      : 1;
-    uint32_t write_through  : 1;
-    uint32_t cache_disable  : 1;
-    uint32_t accessed       : 1;
-    uint32_t available1     : 1;
-    uint32_t page_size      : 1;    // 0=4KB, 1=4MB
-    uint32_t available2     : 4;
-    uint32_t table_addr     : 20;   // Page table physical address
-} __attribute__((packed)) PageDirectoryEntry;
-
-// Page directory
+// Page directory entry: PAGE_* flags for a page table, or with
+// PAGE_SIZE_FLAG a whole 4 MB page whose address is in bits 22-31
+typedef uint32_t PageDirectoryEntry;
+
+// Page directory.  Page tables live in host memory, so their pointers are
+// kept beside the entries instead of in them; tables[i] is set exactly
+// when entry i is present and not a large page.
 typedef struct {
     PageDirectoryEntry entries[PAGE_DIRECTORY_ENTRIES];
+    PageTable* tables[PAGE_DIRECTORY_ENTRIES];
 } __attribute__((aligned(PAGE_SIZE))) PageDirectory;
 
 // Page fault error codes
@@ -86,13 +72,39 @@ typedef struct {
 #define PF_RESERVED     0x08    // Reserved bit violation
 #define PF_INSTRUCTION  0x10    // Instruction fetch
 
-// Physical frame allocator
+// Physical frame allocator: a binary buddy system with one free bitmap per
+// block order, searched a 64-bit word at a time, and a small cache of
+// single frames per CPU in front of it
+#define FRAME_MAX_ORDER     10          // Largest buddy block: 1024 frames (4 MB)
+#define FRAME_ORDERS        (FRAME_MAX_ORDER + 1)
+#define FRAME_CPU_COUNT     8           // Frame caches, picked by mmu_current_cpu
+#define FRAME_CPU_CACHE     32          // Single frames a CPU may keep
+#define FRAME_CPU_BATCH     16          // Frames moved between a cache and the buddy maps at once
+#define FRAME_INVALID       0xFFFFFFFF
+
 typedef struct {
-    uint32_t* bitmap;           // Bitmap of free frames
+    volatile LONG busy;                 // Claimed by the thread using it
+    uint32_t count;
+    uint32_t frames[FRAME_CPU_CACHE];
+} FrameCache;
+
+typedef struct {
+    CRITICAL_SECTION lock;              // All but the caches, the bitmap and the counters
+    uint64_t* bitmap;                   // One bit per frame, set while allocated; interlocked
+    uint64_t* held;                     // One bit per frame, set while in no free block
+    uint16_t* shares;                   // References beyond the first, per frame
+    uint64_t* free_map[FRAME_ORDERS];   // Bit n of order k: frames n<<k .. are one free block
+    uint32_t free_blocks[FRAME_ORDERS];
+    uint32_t search[FRAME_ORDERS];      // free_map[k] words below this are known empty
+    uint32_t order_mask;                // Bit k set while free_blocks[k] != 0
+    FrameCache cpu_cache[FRAME_CPU_COUNT];
     uint32_t total_frames;      // Total number of frames
-    uint32_t used_frames;       // Number of used frames
-    uint32_t free_frames;       // Number of free frames
-    uint32_t first_free_frame;  // Hint for next allocation
+    uint32_t used_frames;       // Number of used frames; interlocked, like free_frames
+    uint32_t free_frames;       // Number of free frames, cached ones included
+    uint32_t shared_frames;     // Frames with more than one reference
+    uint64_t cache_allocs;      // Single-frame allocations served by a CPU cache
+    uint64_t cache_refills;
+    uint64_t cache_drains;      // Caches emptied to satisfy a contiguous request
 } FrameAllocator;
 
 // TLB management
@@ -100,8 +112,41 @@ typedef struct {
     uint32_t entries_flushed;
     uint32_t full_flushes;
     uint32_t single_flushes;
+    uint32_t asid_flushes;      // Entries dropped because an address space went away
+    uint64_t hits;
+    uint64_t misses;            // Page table walks
 } TLBStats;
 
+// Frame cache, TLB and address space of the calling thread's vCPU
+extern _Thread_local uint32_t mmu_current_cpu;
+
+// Software TLB
+#define MMU_TLB_ENTRIES     1024        // Direct-mapped, indexed by virtual page number
+#define MMU_ASID_COUNT      256         // Address space tags; 0 is never handed out
+#define MMU_TLB_INVALID     0           // Never matches, since tags include a nonzero ASID
+
+// A cached translation from a guest virtual page to a host pointer.  Tags
+// are the virtual page ORed with the owning address space's ASID, so
+// switching page directories does not flush anything.  write_tag is only
+// filled once the PTE is writable and dirty, and never for pages holding
+// translated CPU code, so those stores take the slow path.
+typedef struct {
+    uint32_t read_tag;
+    uint32_t write_tag;
+    uintptr_t addend;           // Host address = addend + virtual address
+} TLBEntry;
+
+// Each vCPU has its own TLB and current address space, picked by the
+// calling thread's mmu_current_cpu.  Flushes reach every CPU's TLB.
+typedef struct {
+    TLBEntry tlb[MMU_TLB_ENTRIES];
+    uint32_t asid;              // ASID of the current page directory
+    PageDirectory* directory;   // Current page directory
+    TLBStats stats;
+} MMUCpu;
+
+extern MMUCpu mmu_cpus[FRAME_CPU_COUNT];
+
 // MMU initialization and cleanup
 int mmu_init(void);
 void mmu_cleanup(void);
@@ -110,7 +155,8 @@ void mmu_disable_paging(void);
 
 // Page directory management
 PageDirectory* mmu_create_page_directory(void);
-void mmu_destroy_page_directory(PageDirectory* dir);
+void mmu_destroy_page_directory(PageDirectory* dir);   // Releases user-page frames too
+PageDirectory* mmu_clone_page_directory(PageDirectory* parent);   // Copy-on-write fork
 void mmu_switch_page_directory(PageDirectory* dir);
 PageDirectory* mmu_get_kernel_page_directory(void);
 PageDirectory* mmu_get_current_page_directory(void);
@@ -118,26 +164,47 @@ PageDirectory* mmu_get_current_page_directory(void);
 // Page mapping
 int mmu_map_page(PageDirectory* dir, uint32_t virtual_addr, uint32_t physical_addr, uint32_t flags);
 int mmu_unmap_page(PageDirectory* dir, uint32_t virtual_addr);
+// With PAGE_SIZE_FLAG, aligned 4 MB stretches of the range get large pages
 int mmu_map_range(PageDirectory* dir, uint32_t virtual_start, uint32_t physical_start, uint32_t size, uint32_t flags);
 int mmu_unmap_range(PageDirectory* dir, uint32_t virtual_start, uint32_t size);
+void mmu_map_benchmark(uint32_t size_mb);
 
 // Address translation
 uint32_t mmu_virtual_to_physical(PageDirectory* dir, uint32_t virtual_addr);
 int mmu_is_mapped(PageDirectory* dir, uint32_t virtual_addr);
 
+// Guest virtual memory access through the TLB.  Returns 0, or -1 after a
+// page fault that could not be resolved.  The inline helpers below only
+// fall back to this on a miss or an access that crosses a page.
+int mmu_access(uint32_t virtual_addr, void* data, uint32_t size, int write);
+
 // Page fault handling
 void mmu_page_fault_handler(uint32_t fault_addr, uint32_t error_code);
 int mmu_handle_cow_fault(uint32_t virtual_addr);
+void mmu_fork_benchmark(uint32_t max_heap_mb);
 
 // TLB management
 void mmu_flush_tlb(void);
 void mmu_flush_tlb_single(uint32_t virtual_addr);
 void mmu_invalidate_page(uint32_t virtual_addr);
+void mmu_tlb_protect_code(uint32_t physical_addr);  // Stop direct stores to a code page
+void mmu_tlb_benchmark(uint32_t pages, uint64_t accesses);
 
-// Frame allocation
+// Frame allocation.  mmu_alloc_frames() returns the first of count
+// physically contiguous frames whose number is a multiple of align (a power
+// of two, in frames), or FRAME_INVALID.  A frame mapped more than once
+// (copy-on-write) is shared: mmu_free_frame() then only drops a reference.
+int mmu_frames_init(uint32_t total_frames);
+void mmu_frames_cleanup(void);
 uint32_t mmu_alloc_frame(void);
 void mmu_free_frame(uint32_t frame);
+uint32_t mmu_alloc_frames(uint32_t count, uint32_t align);
+void mmu_free_frames(uint32_t frame, uint32_t count);   // Runs are never shared
+int mmu_frame_share(uint32_t frame);
+uint32_t mmu_frame_refcount(uint32_t frame);
 int mmu_is_frame_allocated(uint32_t frame);
+const FrameAllocator* mmu_get_frame_allocator(void);
+void mmu_frame_benchmark(uint32_t frames, uint64_t operations);
 
 // Memory protection
 int mmu_set_page_flags(PageDirectory* dir, uint32_t virtual_addr, uint32_t flags);
@@ -149,7 +216,7 @@ void mmu_identity_map_range(PageDirectory* dir, uint32_t physical_start, uint32_
 
 // Statistics
 void mmu_get_stats(uint32_t* total_pages, uint32_t* used_pages, uint32_t* free_pages);
-TLBStats* mmu_get_tlb_stats(void);
+TLBStats* mmu_get_tlb_stats(void);    // Summed over all CPUs
 void mmu_dump_page_tables(PageDirectory* dir, uint32_t virtual_addr);
 
 // Helper macros
@@ -162,5 +229,36 @@ void mmu_dump_page_tables(PageDirectory* dir, uint32_t virtual_addr);
 #define PD_INDEX(addr)          ((addr) >> 22)
 #define PT_INDEX(addr)          (((addr) >> 12) & 0x3FF)
 #define PAGE_OFFSET(addr)       ((addr) & 0xFFF)
+#define PTE_FRAME(entry)        ((entry) >> PAGE_SHIFT)
+
+// mmu_load8/16/32/64(addr, &value) and mmu_store8/16/32/64(addr, value)
+#define MMU_TLB_ACCESSORS(bits) \
+static inline int mmu_load##bits(uint32_t virtual_addr, uint##bits##_t* value) { \
+    MMUCpu* cpu = &mmu_cpus[mmu_current_cpu]; \
+    TLBEntry* entry = &cpu->tlb[(virtual_addr >> PAGE_SHIFT) & (MMU_TLB_ENTRIES - 1)]; \
+    if (entry->read_tag == ((virtual_addr & PAGE_MASK) | cpu->asid) && \
+        PAGE_OFFSET(virtual_addr) <= PAGE_SIZE - sizeof(*value)) { \
+        memcpy(value, (const void*)(entry->addend + virtual_addr), sizeof(*value)); \
+        cpu->stats.hits++; \
+        return 0; \
+    } \
+    return mmu_access(virtual_addr, value, sizeof(*value), 0); \
+} \
+static inline int mmu_store##bits(uint32_t virtual_addr, uint##bits##_t value) { \
+    MMUCpu* cpu = &mmu_cpus[mmu_current_cpu]; \
+    TLBEntry* entry = &cpu->tlb[(virtual_addr >> PAGE_SHIFT) & (MMU_TLB_ENTRIES - 1)]; \
+    if (entry->write_tag == ((virtual_addr & PAGE_MASK) | cpu->asid) && \
+        PAGE_OFFSET(virtual_addr) <= PAGE_SIZE - sizeof(value)) { \
+        memcpy((void*)(entry->addend + virtual_addr), &value, sizeof(value)); \
+        cpu->stats.hits++; \
+        return 0; \
+    } \
+    return mmu_access(virtual_addr, &value, sizeof(value), 1); \
+}
+
+MMU_TLB_ACCESSORS(8)
+MMU_TLB_ACCESSORS(16)
+MMU_TLB_ACCESSORS(32)
+MMU_TLB_ACCESSORS(64)
 
 #endif // KERNEL_MMU_H
@@ -0,0 +1,30 @@
+#ifndef KERNEL_NET_ROUTE_H
+#define KERNEL_NET_ROUTE_H
+
+#include <stdint.h>
+
+// The routing table, for callers that don't use the network stack's own
+// types.  There is one table, the network stack's FIB; these work on it
+// just as netstack_add_route() and friends do.  Addresses are in host
+// byte order.
+typedef struct {
+    uint32_t dest;              // Network address
+    uint32_t mask;
+    uint32_t gateway;           // 0 for an on-link route
+    int metric;
+    char iface[16];             // Interface it goes out of
+} NetRoute;
+
+typedef void (*NetRouteVisit)(const NetRoute* route, void* arg);
+
+// Add a route, or update the one for the same prefix.  The gateway, or
+// the destination of an on-link route, picks the interface.
+int netstack_route_add(uint32_t dest, uint32_t mask, uint32_t gateway, int metric);
+// Delete the most specific route for the network address `dest`, if it
+// goes through `gateway`
+int netstack_route_remove(uint32_t dest, uint32_t gateway);
+int netstack_route_lookup(uint32_t addr, NetRoute* route);     // Longest match; -1 if none
+void netstack_route_walk(NetRouteVisit visit, void* arg);       // Shorter prefixes first
+uint32_t netstack_route_count(void);
+
+#endif // KERNEL_NET_ROUTE_H
@@ -2,6 +2,7 @@
 #define KERNEL_NETWORK_STACK_H
 
 #include <stdint.h>
+#include "kernel/timer.h"
 
 // Protocol numbers (from RFC)
 #define IPPROTO_ICMP    1
@@ -30,8 +31,11 @@
 #define SOCKET_LAST_ACK     9
 #define SOCKET_TIME_WAIT    10
 
-// Maximum sockets
-#define MAX_SOCKETS         256
+// Socket table, indexed by fd.  It starts small and doubles as sockets
+// are created, up to the limit.
+#define SOCKET_TABLE_INITIAL 256
+#define SOCKET_LIMIT        (1 << 20)
+#define SOCKET_HASH_INITIAL 256         // Buckets; the demux tables double past one socket per bucket
 #define MAX_CONNECTIONS     64
 #define MAX_LISTEN_BACKLOG  128
 
@@ -41,10 +45,21 @@
 #define TCP_SEGMENT_SIZE    1460
 #define UDP_DATAGRAM_SIZE   65507
 
+// Socket buffers: send and receive rings of this many bytes (a power of
+// two).  The head and tail counters run freely and are masked on access.
+#define SOCKET_BUFFER_SIZE  65536
+#define TCP_MAX_WINDOW      65535   // No window scaling
+
+// TCP retransmission (RFC 6298): the timeout doubles on each retry
+#define TCP_RTO_INITIAL_MS  1000
+#define TCP_RTO_MAX_MS      60000
+#define TCP_SYN_RETRIES     6
+
 // Port ranges
 #define PORT_MIN            1
 #define PORT_MAX            65535
 #define PORT_PRIVILEGED     1024
+#define PORT_EPHEMERAL_MIN  49152   // RFC 6335 dynamic range, for unbound sockets
 
 // IPv4 address structure
 typedef struct {
@@ -141,8 +156,15 @@ typedef struct {
     uint16_t sequence;      // Sequence number
 } __attribute__((packed)) ICMPHeader;
 
-// Socket structure
-typedef struct {
+// Socket structure.  Data to a peer on this host really travels: send()
+// fills the send ring, TCP cuts it into segments no larger than the
+// peer's advertised window, and the IPv4 packets go round the lo queue
+// to the receiving socket's recv ring.  The receiver's ACKs free the
+// sender's ring and reopen its window as the data is read.  Peers
+// anywhere else are simulated, since nothing is wired behind zora0.
+// Arriving packets find their socket by hash: connections on protocol
+// and 4-tuple, listeners and UDP sockets on protocol, address and port.
+typedef struct Socket {
     int fd;                 // File descriptor
     int family;             // Address family (AF_INET)
     int type;               // Socket type (SOCK_STREAM, SOCK_DGRAM)
@@ -152,17 +174,27 @@ typedef struct {
     SocketAddress remote;   // Remote address/port
     int backlog;            // Listen backlog
     void* accept_queue;     // Queue of pending connections
-    uint8_t* recv_buffer;   // Receive buffer
+    uint8_t* recv_buffer;   // Receive buffer (allocated on first use, like send_buffer)
     uint32_t recv_size;     // Receive buffer size
-    uint32_t recv_head;     // Receive buffer head
-    uint32_t recv_tail;     // Receive buffer tail
+    uint32_t recv_head;     // Receive buffer head (next byte the owner reads)
+    uint32_t recv_tail;     // Receive buffer tail (next byte delivered)
     uint8_t* send_buffer;   // Send buffer
     uint32_t send_size;     // Send buffer size
-    uint32_t send_head;     // Send buffer head
-    uint32_t send_tail;     // Send buffer tail
+    uint32_t send_head;     // Send buffer head (byte at snd_una)
+    uint32_t send_tail;     // Send buffer tail (next byte written)
     int flags;              // Socket flags
-    uint32_t seq_num;       // TCP sequence number
-    uint32_t ack_num;       // TCP acknowledgment number
+    int loopback;           // Peer is on this host: packets go round lo
+    uint32_t seq_num;       // TCP sequence number (next to send)
+    uint32_t ack_num;       // TCP acknowledgment number (next expected)
+    uint32_t snd_una;       // Oldest unacknowledged sequence number
+    uint32_t snd_wnd;       // Window the peer last advertised
+    uint32_t rcv_adv;       // Right edge of the window we last advertised
+    KernelTimer rto_timer;  // TCP retransmission timer
+    uint32_t rto_ms;        // Current retransmission timeout
+    uint32_t retransmits;   // Retries of the unacknowledged segment
+    struct Socket* hash_next;   // Chain in the demux table it is on
+    uint32_t hash;          // Its key's hash there
+    int hashed;             // Which demux table, if any
 } Socket;
 
 // Routing table entry
@@ -185,6 +217,8 @@ typedef struct {
     uint64_t tcp_connections;
     uint64_t udp_datagrams;
     uint64_t icmp_messages;
+    uint64_t tcp_retransmits;
+    uint64_t tcp_timeouts;  // Connections dropped after the last retry
 } NetworkStats;
 
 // Network stack functions
@@ -210,7 +244,8 @@ NetworkInterface* netstack_find_interface(const char* name);
 int netstack_interface_up(const char* name);
 int netstack_interface_down(const char* name);
 
-// Routing
+// Routing, by longest-prefix match in a FIB (kernel/fib.h).  There is one
+// route per prefix: adding one again updates it.
 int netstack_add_route(const IPv4Address* dest, const IPv4Address* mask, const IPv4Address* gateway, int metric);
 int netstack_del_route(const IPv4Address* dest);
 RouteEntry* netstack_find_route(const IPv4Address* dest);
@@ -230,6 +265,8 @@ int netstack_icmp_ping(const IPv4Address* dest, uint16_t id, uint16_t seq);
 
 // Utilities
 uint16_t netstack_checksum(const void* data, uint32_t size);
+int netstack_decrement_ttl(IPv4Header* ip);
+int netstack_nat_rewrite(IPv4Header* ip, uint32_t length, int destination, const IPv4Address* addr, uint16_t port);
 int netstack_parse_ipv4(const char* str, IPv4Address* addr);
 void netstack_format_ipv4(const IPv4Address* addr, char* str, uint32_t size);
 int netstack_parse_mac(const char* str, MACAddress* mac);
@@ -239,5 +276,7 @@ void netstack_format_mac(const MACAddress* mac, char* str, uint32_t size);
 NetworkStats* netstack_get_stats(void);
 void netstack_dump_stats(void);
 void netstack_show_connections(void);
+void netstack_echo_benchmark(uint32_t size_kb, uint32_t msg_bytes, uint32_t rounds);
+void netstack_demux_benchmark(uint32_t count, uint32_t lookups);
 
 #endif // KERNEL_NETWORK_STACK_H
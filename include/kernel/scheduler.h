@@ -2,6 +2,7 @@
 #define KERNEL_SCHEDULER_H
 
 #include <stdint.h>
+#include <windows.h>
 #include "system/process.h"
 
 // Scheduling algorithms
@@ -14,43 +15,78 @@ typedef enum {
 
 // Scheduler configuration
 #define SCHEDULER_QUANTUM_MS        10      // Default time slice: 10ms
-#define SCHEDULER_MAX_QUEUES        5       // For multi-level scheduling
+#define SCHEDULER_MAX_QUEUES        8       // Run queue levels, 0 highest; at most 32
 #define SCHEDULER_BOOST_INTERVAL    100     // Priority boost every 100ms
+#define SCHEDULER_MAX_CPUS          16      // Run queues bench smp may drive; the VM uses one
+#define SCHEDULER_BALANCE_INTERVAL  20      // Load balance every 20ms
 
-// Process queue node
-typedef struct ProcessQueueNode {
-    Process* process;
-    struct ProcessQueueNode* next;
-    struct ProcessQueueNode* prev;
-} ProcessQueueNode;
+// Process.run_state
+#define SCHED_RUN_NONE      0       // Running, or not known to the scheduler
+#define SCHED_RUN_READY     1       // On a run queue
+#define SCHED_RUN_BLOCKED   2       // On the blocked list (sleepers too)
 
-// Process queue
+// Intrusive process list, linked through Process.run_next/run_prev
 typedef struct {
-    ProcessQueueNode* head;
-    ProcessQueueNode* tail;
+    Process* head;
+    Process* tail;
     int count;
 } ProcessQueue;
 
+// Run queue: a FIFO per level and a bitmap of the nonempty levels, so the
+// next process to run is a ctz and a list pop away
+typedef struct {
+    ProcessQueue levels[SCHEDULER_MAX_QUEUES];
+    uint32_t ready_mask;        // Bit n set while levels[n] is not empty
+    int count;
+} RunQueue;
+
+// A virtual CPU: its own run queue and running process.  Other CPUs only
+// touch the run queue, under the lock, when they steal or rebalance.
+typedef struct {
+    uint32_t id;
+    RunQueue run_queue;
+    CRITICAL_SECTION lock;
+    CRITICAL_SECTION switch_lock;       // Held while picking and switching
+    Process* current_process;
+    uint64_t current_quantum_remaining;
+    
+    // Statistics
+    uint64_t context_switches;
+    uint64_t steals;            // Processes taken from other CPUs while idle
+    uint64_t migrations;        // Processes moved here by load balancing
+    uint64_t busy_ticks;
+    uint64_t idle_ticks;
+} SchedulerCPU;
+
 // Scheduler state
 typedef struct {
     SchedulerAlgorithm algorithm;
-    Process* current_process;
     Process* idle_process;
     
-    // Queues
-    ProcessQueue ready_queue;
+    // Per-CPU run queues
+    SchedulerCPU cpus[SCHEDULER_MAX_CPUS];
+    uint32_t cpu_count;
+    
+    // Queues shared by all CPUs
     ProcessQueue blocked_queue;
-    ProcessQueue* priority_queues[SCHEDULER_MAX_QUEUES];
+    CRITICAL_SECTION blocked_lock;
+    volatile LONG sleeping;             // Blocked with a sleep timer pending
+    volatile LONG resched_mask;         // Bit n: the tick wants CPU n to switch
     
     // Statistics
     uint64_t total_context_switches;
     uint64_t total_preemptions;
     uint64_t total_yields;
+    uint64_t total_demotions;
+    uint64_t total_boosts;
+    uint64_t total_wakeups;
     
-    // Timing
+    // Timing, in ticks (1 ms)
     uint32_t quantum_ms;
+    uint64_t ticks;
     uint64_t last_schedule_time;
-    uint64_t current_quantum_remaining;
+    uint64_t last_boost_tick;
+    uint64_t last_balance_tick;
     
     // Flags
     int preemption_enabled;
@@ -67,13 +103,16 @@ void scheduler_stop(void);
 void scheduler_enqueue_ready(Process* process);
 void scheduler_enqueue_blocked(Process* process);
 void scheduler_remove_from_queue(Process* process);
+void scheduler_remove_process(Process* process);   // Before freeing it: off its queue and its CPU
 Process* scheduler_dequeue_ready(void);
 
 // Scheduling operations
-void scheduler_schedule(void);          // Main scheduling function
+void scheduler_schedule(void);          // Main scheduling function, on this thread's CPU
+void scheduler_schedule_cpu(uint32_t cpu);
 void scheduler_yield(void);             // Voluntary yield
 void scheduler_preempt(void);           // Forced preemption
-void scheduler_tick(void);              // Called on timer interrupt
+void scheduler_tick(void);              // Called on timer interrupt; only flags CPUs to switch
+void scheduler_preempt_point(void);     // Do the switches the tick asked for, from a vCPU thread
 
 // Process state changes
 void scheduler_block_process(Process* process);
@@ -95,10 +134,19 @@ void scheduler_boost_priorities(void);
 Process* scheduler_pick_next_process(void);
 int scheduler_should_preempt(Process* current, Process* candidate);
 
+// SMP
+uint32_t scheduler_cpu_count(void);
+int scheduler_has_work(void);           // Anything running or ready
+uint32_t scheduler_current_cpu(void);   // CPU the calling host thread runs
+void scheduler_balance(void);           // Even out run queue lengths
+
 // Utility functions
 Scheduler* scheduler_get_state(void);
 Process* scheduler_get_current_process(void);
 uint64_t scheduler_get_context_switches(void);
 void scheduler_dump_queues(void);
+void scheduler_print_cpu_stats(void);
+void scheduler_benchmark(uint32_t tasks, uint64_t operations);
+void scheduler_smp_benchmark(uint32_t max_cpus, uint32_t tasks, uint32_t slices);
 
 #endif // KERNEL_SCHEDULER_H
@@ -90,6 +90,12 @@
 #define SYS_setpriority     97
 #define SYS_statfs          99
 #define SYS_fstatfs         100
+#define SYS_readv           145
+#define SYS_writev          146
+#define SYS_sendfile        187
+#define SYS_splice          188     // Linux numbers it 313; the table stops at 255
+#define SYS_io_uring_setup  245     // Linux: 425 and 426
+#define SYS_io_uring_enter  246
 
 // Networking syscalls
 #define SYS_socket          200
@@ -113,6 +119,33 @@
 // Total number of syscalls
 #define MAX_SYSCALLS        256
 
+// open() flags (Linux values)
+#define SYS_O_RDONLY        0x000
+#define SYS_O_WRONLY        0x001
+#define SYS_O_RDWR          0x002
+#define SYS_O_ACCMODE       0x003
+#define SYS_O_CREAT         0x040
+#define SYS_O_TRUNC         0x200
+#define SYS_O_APPEND        0x400
+#define SYS_O_NONBLOCK      0x800
+#define SYS_O_CLOEXEC       0x80000
+
+// fcntl() commands
+#define SYS_F_DUPFD         0
+#define SYS_F_GETFD         1
+#define SYS_F_SETFD         2
+#define SYS_F_GETFL         3
+#define SYS_F_SETFL         4
+#define SYS_F_DUPFD_CLOEXEC 1030
+
+// readv/writev vector entry; addresses are 32-bit like all syscall pointers
+typedef struct {
+    uint32_t base;
+    uint32_t len;
+} SyscallIoVec;
+
+#define SYS_IOV_MAX         1024
+
 // Syscall handler function type
 typedef int (*syscall_handler_t)(uint32_t arg1, uint32_t arg2, uint32_t arg3, 
                                  uint32_t arg4, uint32_t arg5);
@@ -124,6 +157,18 @@ typedef struct {
     int arg_count;
 } SyscallTableEntry;
 
+// Per-syscall accounting, kept on every dispatch.  Latency is the
+// handler's run time, bucketed by powers of two in nanoseconds.
+#define SYSCALL_LATENCY_BUCKETS 24      // Last bucket holds 4 ms and up
+
+typedef struct {
+    uint64_t calls;
+    uint64_t errors;                    // Returned a negative value
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[SYSCALL_LATENCY_BUCKETS];  // Bucket n: under 2^n ns
+} SyscallStats;
+
 // Initialize syscall table
 void syscall_table_init(void);
 
@@ -131,6 +176,21 @@ void syscall_table_init(void);
 int syscall_dispatch(uint32_t syscall_num, uint32_t arg1, uint32_t arg2, 
                      uint32_t arg3, uint32_t arg4, uint32_t arg5);
 
+// Tracing.  Dispatch is silent unless a syscall's bit is set in the trace
+// mask; traced syscalls log the call, their arguments and errors.
+void syscall_trace_set(uint32_t syscall_num, int enabled);
+void syscall_trace_all(int enabled);
+int syscall_is_traced(uint32_t syscall_num);
+int syscall_lookup(const char* name);           // Number for a name, -1 if unknown
+const char* syscall_name(uint32_t syscall_num); // NULL if not implemented
+
+// Statistics
+const SyscallStats* syscall_get_stats(uint32_t syscall_num);
+void syscall_reset_stats(void);
+void syscall_dump_stats(void);
+void syscall_dump_histogram(uint32_t syscall_num);
+void syscall_benchmark(uint32_t count);
+
 // Syscall implementations
 int sys_exit(uint32_t status, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5);
 int sys_fork(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5);
@@ -138,8 +198,19 @@ int sys_read(uint32_t fd, uint32_t buf, uint32_t count, uint32_t arg4, uint32_t
 int sys_write(uint32_t fd, uint32_t buf, uint32_t count, uint32_t arg4, uint32_t arg5);
 int sys_open(uint32_t pathname, uint32_t flags, uint32_t mode, uint32_t arg4, uint32_t arg5);
 int sys_close(uint32_t fd, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5);
+int sys_dup(uint32_t oldfd, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5);
+int sys_dup2(uint32_t oldfd, uint32_t newfd, uint32_t arg3, uint32_t arg4, uint32_t arg5);
+int sys_fcntl(uint32_t fd, uint32_t cmd, uint32_t arg, uint32_t arg4, uint32_t arg5);
+int sys_pipe(uint32_t pipefd, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5);
+int sys_readv(uint32_t fd, uint32_t iov, uint32_t iovcnt, uint32_t arg4, uint32_t arg5);
+int sys_writev(uint32_t fd, uint32_t iov, uint32_t iovcnt, uint32_t arg4, uint32_t arg5);
+int sys_sendfile(uint32_t out_fd, uint32_t in_fd, uint32_t offset, uint32_t count, uint32_t arg5);
+int sys_splice(uint32_t fd_in, uint32_t off_in, uint32_t fd_out, uint32_t off_out, uint32_t len);
+int sys_io_uring_setup(uint32_t entries, uint32_t ring_addr, uint32_t arg3, uint32_t arg4, uint32_t arg5);
+int sys_io_uring_enter(uint32_t fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags, uint32_t arg5);
 int sys_getpid(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5);
 int sys_getuid(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5);
+int sys_alarm(uint32_t seconds, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5);
 int sys_brk(uint32_t addr, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5);
 int sys_mmap(uint32_t addr, uint32_t length, uint32_t prot, uint32_t flags, uint32_t fd);
 int sys_munmap(uint32_t addr, uint32_t length, uint32_t arg3, uint32_t arg4, uint32_t arg5);
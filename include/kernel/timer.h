@@ -0,0 +1,69 @@
+#ifndef KERNEL_TIMER_H
+#define KERNEL_TIMER_H
+
+#include <stdint.h>
+
+// Kernel timers: a hierarchical timing wheel in 1 ms ticks.  Level 0 has a
+// slot per tick for the next 64 ticks, and each level above covers 64 times
+// the span of the one below with slots 64 times as coarse; timers cascade
+// down a level as their slot comes up.  Arming and cancelling are O(1).
+#define TIMER_WHEEL_BITS        6
+#define TIMER_WHEEL_SLOTS       (1u << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS      5       // 64^5 ticks, about 12 days
+#define TIMER_IDLE_MAX_MS       1000    // Longest tickless sleep of the clock
+
+struct KernelTimer;
+typedef void (*TimerCallback)(struct KernelTimer* timer, void* arg);
+
+// Embed one of these wherever a timer is needed; no allocation involved
+typedef struct KernelTimer {
+    struct KernelTimer* next;
+    struct KernelTimer* prev;
+    uint64_t expires;           // Absolute tick
+    uint32_t period;            // Re-arm interval for periodic timers, 0 for one-shot
+    uint16_t slot;              // Wheel slot + 1 while pending, 0 otherwise
+    TimerCallback callback;
+    void* arg;
+} KernelTimer;
+
+typedef struct {
+    uint64_t armed;
+    uint64_t cancelled;
+    uint64_t fired;
+    uint64_t cascaded;          // Timers moved down a level
+    uint64_t pending;
+    uint64_t clock_wakeups;     // Times the clock thread ran
+    uint64_t idle_sleeps;       // Wakeups that slept past at least one tick
+    uint64_t ticks_skipped;     // Ticks no wakeup was needed for
+} TimerStats;
+
+// Wheel and clock
+int timer_init(void);
+void timer_cleanup(void);
+int timer_start_clock(void (*irq)(void));   // Host thread raising the timer IRQ
+void timer_stop_clock(void);
+int timer_clock_running(void);
+void timer_kick(void);                      // Work arrived; resume periodic ticks
+void timer_set_busy_check(int (*busy)(void));
+
+// Timers.  Callbacks run on the clock thread with the wheel locked; they
+// may arm or cancel timers, including their own.
+void timer_setup(KernelTimer* timer, TimerCallback callback, void* arg);
+void timer_arm(KernelTimer* timer, uint64_t delay_ms);
+void timer_arm_periodic(KernelTimer* timer, uint32_t period_ms);
+int timer_cancel(KernelTimer* timer);       // 1 if it was pending
+int timer_pending(const KernelTimer* timer);
+uint64_t timer_remaining(const KernelTimer* timer);
+
+// Time
+uint64_t timer_now(void);                   // Wheel time, in ticks since boot
+uint64_t timer_clock_ticks(void);           // Host time since boot, in ticks
+uint64_t timer_advance(uint64_t now);       // Run everything due by now; returns timers fired
+uint64_t timer_next_expiry(void);           // Earliest tick anything can fire, UINT64_MAX if none
+
+// Statistics
+TimerStats* timer_get_stats(void);
+void timer_dump_stats(void);
+void timer_benchmark(uint32_t count);
+
+#endif // KERNEL_TIMER_H
@@ -4,17 +4,29 @@
 #include <stdint.h>
 #include <stddef.h>
 
-#define MEMORY_SIZE 0x4000000 // 64 MB instead of 256 MB
+#define MEMORY_SIZE 0x4000000 // Default guest RAM: 64 MB
+#define MEMORY_MAX_SIZE 0x100000000ULL // The whole 32-bit physical address space
+#define MEMORY_COMMIT_CHUNK 0x10000 // Lazy arenas are committed 64 KB at a time
 
-// Memory structure
+// memory_configure() flags
+#define MEMORY_LARGE_PAGES 0x01 // Back guest RAM with large pages if the host allows
+
+// Memory structure.  Guest RAM is reserved address space; host pages are
+// committed the first time the guest (or the host on its behalf) touches
+// them, so a large configured size costs nothing until it is used.
 typedef struct {
     uint8_t* data;
     size_t size;
-    size_t allocated;
+    size_t allocated;                 // Bytes committed so far
     int initialized;
+    int large_pages;                  // Committed up front in large pages
+    volatile long* committed;         // One bit per MEMORY_COMMIT_CHUNK (Windows)
 } Memory;
 
 // Function declarations
+void memory_configure(size_t size, int flags);   // Call before memory_init()
+size_t memory_configured_size(void);
+size_t memory_parse_size(const char* text);      // "512", "512M", "4G"; MB by default
 Memory* memory_init(size_t size);
 void memory_cleanup(void);
 uint8_t memory_read(uint32_t address);
@@ -35,5 +47,7 @@ int memory_unmap(void* ptr, size_t size);
 size_t memory_get_total(void);
 size_t memory_get_used(void);
 size_t memory_get_free(void);
+size_t memory_get_host_resident(void);   // Working set of the whole host process
+void memory_boot_benchmark(size_t size);
 
-#endif // MEMORY_H
\ No newline at end of file
+#endif // MEMORY_H
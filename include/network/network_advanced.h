@@ -7,7 +7,6 @@
 
 // Maximum limits
 #define MAX_INTERFACES 16
-#define MAX_ROUTES 64
 #define MAX_CONNECTIONS 256
 #define MAX_VPN_TUNNELS 8
 #define MAX_FIREWALL_RULES 128
@@ -166,10 +165,6 @@ typedef struct {
     NetworkInterface interfaces[MAX_INTERFACES];
     int interface_count;
     
-    // Routing
-    RouteEntry routes[MAX_ROUTES];
-    int route_count;
-    
     // Active connections
     NetworkConnection connections[MAX_CONNECTIONS];
     int connection_count;
@@ -234,7 +229,7 @@ int network_add_route(const char* dest, const char* gateway, const char* netmask
 int network_remove_route(const char* dest, const char* gateway);
 int network_set_default_route(const char* gateway, const char* iface);
 void network_show_routing_table(void);
-RouteEntry* network_find_route(const char* destination);
+int network_find_route(const char* destination, RouteEntry* route);     // Copies out the longest match
 
 // Real socket operations
 int network_create_socket(NetworkProtocol protocol);
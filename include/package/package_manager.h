@@ -64,6 +64,12 @@ typedef struct {
     DependencyType type;
 } PackageDependency;
 
+// SHA-256 of one installed file, taken when the package was installed
+typedef struct {
+    uint8_t sha256[32];
+    uint8_t hashed;                // 0 if the file could not be read then
+} InstalledFileDigest;
+
 // Package information
 typedef struct {
     char name[MAX_PACKAGE_NAME];
@@ -93,6 +99,9 @@ typedef struct {
     char md5_hash[33];
     char sha256_hash[65];
     
+    // One per installed file, allocated at install; NULL if none were taken
+    InstalledFileDigest* installed_digests;
+    
     // Package metadata
     int priority;                  // Installation priority
     int is_essential;              // Essential package flag
@@ -0,0 +1,44 @@
+#ifndef ZORA_ARCHIVE_H
+#define ZORA_ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vfs/vfs_stream.h"
+
+// Block size handed to each compression worker (pigz uses the same default)
+#define ARCHIVE_GZIP_BLOCK_SIZE   (128 * 1024)
+#define ARCHIVE_GZIP_DICT_SIZE    (32 * 1024)
+#define ARCHIVE_MAX_THREADS       32
+
+// Byte counters reported back to the shell commands
+typedef struct {
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    int entries;
+} ArchiveStats;
+
+// Archive operation flags
+#define ARCHIVE_VERBOSE  0x01
+#define ARCHIVE_LIST     0x02
+
+// gzip (RFC 1952) over VFS streams
+int archive_default_threads(void);
+int archive_gzip_stream(VFSStream* in, VFSStream* out, int threads, int level, ArchiveStats* stats);
+int archive_gunzip_stream(VFSStream* in, VFSStream* out, ArchiveStats* stats);
+
+// Compress `size` bytes from memory with the parallel block compressor (used by the benchmark)
+int archive_gzip_buffer(const unsigned char* data, size_t size, int threads, int level,
+                        size_t* compressed_size);
+void archive_gzip_benchmark(size_t size_mb, int max_threads, int level);
+
+// ustar archives; paths are absolute VFS paths, member names are taken as given
+int archive_tar_create(const char* archive_path, const char* base_dir,
+                       char** members, int member_count, int flags, ArchiveStats* stats);
+int archive_tar_extract(const char* archive_path, const char* dest_dir, int flags, ArchiveStats* stats);
+
+// PKZIP archives (deflate, streamed with data descriptors)
+int archive_zip_create(const char* archive_path, const char* base_dir,
+                       char** members, int member_count, int flags, ArchiveStats* stats);
+int archive_zip_extract(const char* archive_path, const char* dest_dir, int flags, ArchiveStats* stats);
+
+#endif // ZORA_ARCHIVE_H
@@ -0,0 +1,73 @@
+#ifndef ZORA_HASH_H
+#define ZORA_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Content hashing for VFS files.
+//
+// XXH3-64 is the fast checksum (change detection, sync); SHA-256 is the
+// integrity digest (packages, sha256sum).  Both produce the same values as
+// the reference xxhsum -H3 / sha256sum tools.  Digests of VFS files are
+// cached on the VNode and dropped by vfs_account_node() whenever the
+// content changes.
+
+#define HASH_XXH3           0x01
+#define HASH_SHA256         0x02
+
+#define HASH_SHA256_SIZE    32
+#define HASH_CHUNK_SIZE     (64 * 1024)     // Streaming read size
+#define HASH_MAX_THREADS    32
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t buffer[64];
+    size_t buffered;
+} HashSha256;
+
+typedef struct {
+    uint64_t acc[8];
+    uint8_t buffer[256];
+    size_t buffered;
+    uint64_t length;
+    size_t stripes_in_block;
+} HashXxh3;
+
+typedef struct {
+    unsigned int valid;                     // HASH_* bits that were computed
+    uint64_t xxh3;
+    uint8_t sha256[HASH_SHA256_SIZE];
+} HashDigest;
+
+// Streaming primitives
+void hash_sha256_init(HashSha256* ctx);
+void hash_sha256_update(HashSha256* ctx, const void* data, size_t size);
+void hash_sha256_final(HashSha256* ctx, uint8_t out[HASH_SHA256_SIZE]);
+
+void hash_xxh3_init(HashXxh3* ctx);
+void hash_xxh3_update(HashXxh3* ctx, const void* data, size_t size);
+uint64_t hash_xxh3_final(const HashXxh3* ctx);
+
+// One-shot helpers
+uint64_t hash_xxh3(const void* data, size_t size);
+void hash_sha256(const void* data, size_t size, uint8_t out[HASH_SHA256_SIZE]);
+
+// Hash a VFS file (cached digests are reused); returns 0 or -1 if it cannot be read
+int hash_file(const char* path, unsigned int algorithms, HashDigest* digest);
+
+// Hash several VFS files on a worker pool.  results[i] is 0 or -1 per file.
+// Each (file, algorithm) pair is a separate job, so a single large file
+// asked for both digests still uses two threads.
+int hash_files(const char** paths, int count, unsigned int algorithms,
+               HashDigest* digests, int* results, int threads);
+
+// Hash a host file by streaming it (used by the host sync code)
+int hash_host_file(const char* host_path, unsigned int algorithms, HashDigest* digest);
+
+int hash_default_threads(void);
+void hash_format_sha256(const uint8_t digest[HASH_SHA256_SIZE], char out[2 * HASH_SHA256_SIZE + 1]);
+int hash_parse_sha256(const char* hex, uint8_t digest[HASH_SHA256_SIZE]);
+void hash_benchmark(size_t size_mb, int threads);
+
+#endif // ZORA_HASH_H
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <time.h>
+#include "kernel/timer.h"
 
 #define MAX_PROCESSES 256
 #define MAX_PROCESS_NAME 128
@@ -39,7 +40,21 @@ typedef struct Process {
     time_t start_time;              // Process start time
     time_t cpu_time;                // Total CPU time
     int exit_code;                  // Exit code (for zombies)
+    void* page_directory;           // Own address space (PageDirectory*), NULL to use the kernel's
+    struct VFSFdTable* fd_table;    // Open file descriptors (vfs/vfs_file.h)
     struct Process* next;           // Linked list pointer
+    
+    // Scheduler state (kernel/scheduler.c); run queues link through here
+    struct Process* run_next;
+    struct Process* run_prev;
+    uint8_t run_state;              // Which scheduler list holds it, 0 for none
+    uint8_t run_level;              // Run queue level while it is ready
+    uint8_t demotions;              // MLFQ levels below its base priority
+    uint8_t run_cpu;                // CPU it last ran on or is queued on
+    uint32_t slice_used;            // Ticks used at the current MLFQ level
+    KernelTimer sleep_timer;        // Wakes it from scheduler_sleep_process()
+    KernelTimer alarm_timer;        // alarm(2): SIGALRM when it expires
+    volatile long pending_signal;   // Posted by process_post_signal(), 0 for none
 } Process;
 
 // Process table
@@ -55,6 +70,7 @@ void process_cleanup(void);
 
 // Process creation and termination
 int process_create(const char* name, const char* args, ProcessPriority priority);
+int process_fork(int pid);          // Copy-on-write copy of pid; returns the child's PID
 int process_kill(int pid, int signal);
 int process_wait(int pid, int* exit_code);
 
@@ -83,8 +99,13 @@ int process_get_parent(int pid);
 #define PROC_SIG_KILL   9  // Force kill
 #define PROC_SIG_STOP  19  // Stop signal
 #define PROC_SIG_CONT  18  // Continue signal
+#define PROC_SIG_ALRM  14  // Alarm clock
 
 int process_send_signal(int pid, int signal);
+// From timer callbacks, which must not tear a process down on the clock
+// thread: the signal is delivered by the next process_deliver_signals()
+void process_post_signal(Process* proc, int signal);
+void process_deliver_signals(void);     // On a vCPU thread; see scheduler_preempt_point()
 
 // Process search and filtering
 int process_find_by_state(ProcessState state, int** pid_list);
@@ -38,6 +38,10 @@ struct VNode {
     char* symlink_target;       // NEW: Target path for symlinks
     size_t size;
     void* data;
+    unsigned int map_count;     // Live mmap()s of data; while nonzero data must not move or be freed
+    unsigned int open_count;    // Open VFSFiles on the node; while nonzero the node must not be freed
+    size_t capacity;            // Bytes allocated behind data by vfs_reserve_node(); 0 if only `size` is known.
+                                // Whatever frees or replaces data resets it.
     char* host_path;
     VNode* parent;
     VNode* children;
@@ -49,6 +53,27 @@ struct VNode {
     char group[50];             // Group name
     time_t created_time;        // Creation time
     time_t modified_time;       // Last modification time
+
+    // Bumped from a global counter whenever the children list changes, so a
+    // (node, generation) pair never repeats even if the node is freed and
+    // its address reused.  Lets callers cache directory listings.
+    unsigned long generation;
+
+    // Aggregates over this node and everything below it, kept current on
+    // every size or tree change so du/df/quota never walk the tree.
+    // accounted_size is the part of `size` already folded in; code that
+    // changes `size` directly calls vfs_account_node() afterwards.
+    size_t accounted_size;
+    unsigned long long tree_size;
+    unsigned long long tree_inodes;
+    unsigned long long tree_dirs;
+
+    // Content digests filled in by system/hash.c; digest_valid holds the
+    // HASH_* bits that are current.  Whatever changes data clears it, as
+    // does vfs_account_node(); none are cached while the data is mapped.
+    unsigned int digest_valid;
+    unsigned long long digest_xxh3;
+    unsigned char digest_sha256[32];
 };
 
 // Virtual filesystem structure
@@ -60,6 +85,7 @@ struct VirtualFS {
 // VFS Core functions
 int vfs_init(void);
 void vfs_cleanup(void);
+void vfs_cleanup_node(VNode* node);                  // Free a detached subtree
 VirtualFS* vfs_get_instance(void);
 
 // Directory operations
@@ -73,6 +99,8 @@ int vfs_create_file(const char* path);
 int vfs_delete_file(const char* path);
 int vfs_write_file(const char* path, const void* data, size_t size);
 int vfs_read_file(const char* path, void** data, size_t* size);
+int vfs_sync_node(VNode* node);                       // Commit in-place node changes
+int vfs_reserve_node(VNode* node, size_t needed);     // Room for `needed` bytes plus a terminator
 
 // Symlink operations
 int vfs_create_symlink(const char* link_path, const char* target_path);
@@ -84,6 +112,8 @@ VNode* vfs_find_node(const char* path);
 VNode* vfs_create_directory_node(const char* name);  // NEW: Returns VNode*
 VNode* vfs_create_file_node(const char* name);       // NEW: Returns VNode*
 void vfs_add_child(VNode* parent, VNode* child);     // NEW: Add child function
+void vfs_touch_directory(VNode* dir);                // Bump a directory's generation
+void vfs_account_node(VNode* node);                  // Call after changing a file's size or content
 int vfs_load_file_content(VNode* node);              // NEW: Load file content on-demand
 
 // Host directory operations
@@ -94,6 +124,9 @@ int vfs_mount_persistent(const char* vm_path, const char* host_path);
 // Utility functions
 int create_directory_recursive(const char* path);    // NEW: Declare this function
 
+// Space accounting (per owner, maintained alongside the tree aggregates)
+int vfs_get_usage(const char* owner, unsigned long long* bytes, unsigned long long* inodes);
+
 // Permission and ownership functions
 int vfs_chmod(const char* path, unsigned int mode);
 int vfs_chown(const char* path, const char* owner, const char* group);
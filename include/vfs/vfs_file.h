@@ -0,0 +1,96 @@
+#ifndef VFS_FILE_H
+#define VFS_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vfs.h"
+
+// Open files: the objects file descriptors point at.
+//
+// A VFSFile holds what POSIX calls the open file description: the VNode (or
+// pipe, socket or console) with its position and status flags.  dup() and
+// fork() share one VFSFile between several descriptors, so they also share
+// the position; the last vfs_file_release() closes it.  Node-backed files
+// read and write the node's buffer in place, growing it geometrically, and
+// commit size, mtime and host write-through when the last reference goes.
+#define VFS_FILE_NODE       1
+#define VFS_FILE_PIPE       2
+#define VFS_FILE_SOCKET     3       // Network stack socket, owned by the kernel
+#define VFS_FILE_CONSOLE    4       // stdin/stdout/stderr
+#define VFS_FILE_OBJECT     5       // Kernel object behind `object` (an I/O ring)
+
+// Open flags, Linux values
+#define VFS_O_RDONLY        0x000
+#define VFS_O_WRONLY        0x001
+#define VFS_O_RDWR          0x002
+#define VFS_O_ACCMODE       0x003
+#define VFS_O_CREAT         0x040
+#define VFS_O_TRUNC         0x200
+#define VFS_O_APPEND        0x400
+#define VFS_O_NONBLOCK      0x800
+#define VFS_O_SETFL_MASK    (VFS_O_APPEND | VFS_O_NONBLOCK)   // What F_SETFL may change
+
+#define VFS_PIPE_SIZE       65536
+
+typedef struct VFSPipe VFSPipe;
+
+typedef struct VFSFile {
+    int kind;                       // VFS_FILE_*
+    int flags;                      // VFS_O_* access mode and status flags
+    volatile long refs;
+    char* path;
+    VNode* node;                    // VFS_FILE_NODE
+    size_t position;
+    int dirty;                      // Written since the last sync
+    VFSPipe* pipe;                  // VFS_FILE_PIPE
+    int socket;                     // VFS_FILE_SOCKET
+    void* object;                   // VFS_FILE_OBJECT
+    void (*on_close)(struct VFSFile* file);     // Runs when the last reference goes
+} VFSFile;
+
+// Opening.  All return a file holding one reference, or NULL.
+VFSFile* vfs_file_open(const char* path, int flags);
+VFSFile* vfs_file_console(int flags);
+VFSFile* vfs_file_socket(int socket, void (*on_close)(VFSFile* file));
+VFSFile* vfs_file_object(void* object, void (*on_close)(VFSFile* file));
+int vfs_pipe_create(VFSFile** read_end, VFSFile** write_end);
+
+VFSFile* vfs_file_retain(VFSFile* file);
+int vfs_file_release(VFSFile* file);            // Result of the close on the last reference
+
+// I/O at the file position; -1 on error, and for a pipe that is empty or
+// full while the other end is still open
+int vfs_file_read(VFSFile* file, void* buffer, size_t size);
+int vfs_file_write(VFSFile* file, const void* buffer, size_t size);
+int vfs_file_readable(const VFSFile* file);
+int vfs_file_writable(const VFSFile* file);
+
+// Node-backed files only: direct access for zero-copy transfers
+const uint8_t* vfs_file_peek(VFSFile* file, size_t offset, size_t* length);    // By reference
+int vfs_file_store(VFSFile* file, size_t offset, const void* data, size_t size);
+void* vfs_file_reserve(VFSFile* file, size_t offset, size_t size);   // Room to fill in place
+void vfs_file_commit(VFSFile* file, size_t offset, size_t size);     // ... then mark it written
+size_t vfs_file_write_offset(const VFSFile* file);                   // Honours O_APPEND
+int vfs_file_sync(VFSFile* file);
+
+// Descriptor tables, one per process.  Descriptors are handed out lowest
+// free first from a bitmap; 0-2 start out on the console.
+#define VFS_MAX_FDS         256
+#define VFS_FD_CLOEXEC      1
+
+typedef struct VFSFdTable {
+    VFSFile* files[VFS_MAX_FDS];
+    uint8_t fd_flags[VFS_MAX_FDS];              // VFS_FD_CLOEXEC
+    uint32_t used[VFS_MAX_FDS / 32];
+    int open_count;
+} VFSFdTable;
+
+VFSFdTable* vfs_fdtable_create(void);
+VFSFdTable* vfs_fdtable_clone(const VFSFdTable* table);     // fork(): shares every open file
+void vfs_fdtable_destroy(VFSFdTable* table);
+int vfs_fd_install(VFSFdTable* table, VFSFile* file, int min_fd);   // Takes the reference; -1 if full
+int vfs_fd_install_at(VFSFdTable* table, int fd, VFSFile* file);    // dup2(); closes what was there
+VFSFile* vfs_fd_get(const VFSFdTable* table, int fd);
+int vfs_fd_close(VFSFdTable* table, int fd);
+
+#endif // VFS_FILE_H
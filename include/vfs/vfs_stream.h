@@ -0,0 +1,32 @@
+#ifndef VFS_STREAM_H
+#define VFS_STREAM_H
+
+#include <stddef.h>
+#include "vfs.h"
+
+// Sequential byte stream over a VFS file node.
+//
+// Readers see the node's in-memory content directly (no copy is made), and
+// writers append straight into the node's buffer with geometric growth, so
+// streaming a file through an archiver never holds more than the node itself.
+// The node's size, modification time and host write-through are committed on
+// vfs_stream_close().
+typedef struct VFSStream {
+    VNode* node;
+    char path[256];
+    size_t pos;          // Current offset
+    int writable;
+    int error;
+} VFSStream;
+
+// mode: "r" (read), "w" (truncate/create), "a" (append/create); 'b' is ignored
+VFSStream* vfs_stream_open(const char* path, const char* mode);
+size_t vfs_stream_read(VFSStream* stream, void* buffer, size_t size);
+size_t vfs_stream_write(VFSStream* stream, const void* buffer, size_t size);
+int vfs_stream_seek(VFSStream* stream, long long offset, int whence);
+size_t vfs_stream_tell(VFSStream* stream);
+size_t vfs_stream_size(VFSStream* stream);
+int vfs_stream_eof(VFSStream* stream);
+int vfs_stream_close(VFSStream* stream);
+
+#endif // VFS_STREAM_H
@@ -0,0 +1,288 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+#include "memory.h"
+
+// Cache model for workload analysis.  Tags, valid/dirty state and pseudo-LRU
+// bits are tracked per way; data is never copied, so the model can sit
+// beside the interpreter without changing what the guest sees.
+
+static int cache_is_pow2(uint32_t value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+static uint32_t cache_log2(uint32_t value) {
+    uint32_t shift = 0;
+    while ((1u << shift) < value) shift++;
+    return shift;
+}
+
+static void cache_free_arrays(CPUCache* cache) {
+    free(cache->tags);
+    free(cache->valid);
+    free(cache->plru);
+    free(cache->mru);
+    cache->tags = NULL;
+    cache->valid = NULL;
+    cache->plru = NULL;
+    cache->mru = NULL;
+}
+
+int cpu_cache_init(CPUCache* cache, uint32_t size, uint32_t line_size, uint32_t associativity, CPUCache* next) {
+    if (!cache) return -1;
+    if (!cache_is_pow2(size) || !cache_is_pow2(line_size) || !cache_is_pow2(associativity) ||
+        line_size < 4 || associativity > 32 || size < line_size * associativity) {
+        printf("cpu_cache: invalid geometry (%u bytes, %u-byte lines, %u-way)\n", size, line_size, associativity);
+        return -1;
+    }
+
+    uint32_t sets = size / (line_size * associativity);
+    uint32_t lines = sets * associativity;
+
+    cache_free_arrays(cache);
+    memset(cache, 0, sizeof(*cache));
+    cache->tags = calloc(lines, sizeof(uint32_t));
+    cache->valid = calloc(lines, sizeof(uint8_t));
+    cache->plru = calloc(sets, sizeof(uint32_t));
+    cache->mru = calloc(sets, sizeof(uint32_t));
+    if (!cache->tags || !cache->valid || !cache->plru || !cache->mru) {
+        cache_free_arrays(cache);
+        return -1;
+    }
+
+    cache->size = size;
+    cache->line_size = line_size;
+    cache->associativity = associativity;
+    cache->sets = sets;
+    cache->line_shift = cache_log2(line_size);
+    cache->next = next;
+    for (uint32_t set = 0; set < sets; set++) cache->mru[set] = set * associativity;
+    return 0;
+}
+
+void cpu_cache_destroy(CPUCache* cache) {
+    if (!cache) return;
+    cache_free_arrays(cache);
+    memset(cache, 0, sizeof(*cache));
+}
+
+// Tree pseudo-LRU: node n (1-based, heap order) has bit n set when the
+// victim search should go right.  Using a way points every node on its
+// path away from it.
+static void cache_touch(CPUCache* cache, uint32_t set, uint32_t way) {
+    uint32_t bits = cache->plru[set];
+    uint32_t node = 1;
+
+    for (uint32_t half = cache->associativity >> 1; half; half >>= 1) {
+        uint32_t right = (way & half) != 0;
+        if (right) bits &= ~(1u << node);
+        else bits |= 1u << node;
+        node = node * 2 + right;
+    }
+    cache->plru[set] = bits;
+}
+
+static uint32_t cache_victim(const CPUCache* cache, uint32_t set) {
+    uint32_t base = set * cache->associativity;
+    for (uint32_t way = 0; way < cache->associativity; way++) {
+        if (!(cache->valid[base + way] & CPU_CACHE_LINE_VALID)) return way;
+    }
+
+    uint32_t bits = cache->plru[set];
+    uint32_t node = 1;
+    while (node < cache->associativity) {
+        node = node * 2 + ((bits >> node) & 1);
+    }
+    return node - cache->associativity;
+}
+
+static void cache_line_lookup(CPUCache* cache, uint32_t line, CPUCacheAccess type) {
+    uint32_t ways = cache->associativity;
+    uint32_t set = line & (cache->sets - 1);
+    uint32_t base = set * ways;
+    uint32_t slot = base;
+    int hit = 0;
+
+    for (uint32_t way = 0; way < ways; way++) {
+        if (cache->tags[base + way] == line && (cache->valid[base + way] & CPU_CACHE_LINE_VALID)) {
+            slot = base + way;
+            hit = 1;
+            break;
+        }
+    }
+
+    if (hit) {
+        cache->hits++;
+        cache->type_hits[type]++;
+    } else {
+        cache->misses++;
+        cache->type_misses[type]++;
+
+        slot = base + cache_victim(cache, set);
+        if (cache->valid[slot] & CPU_CACHE_LINE_VALID) {
+            cache->evictions++;
+            if (cache->valid[slot] & CPU_CACHE_LINE_DIRTY) {
+                cache->writebacks++;
+                if (cache->next) {
+                    cpu_cache_access(cache->next, cache->tags[slot] << cache->line_shift,
+                                     cache->line_size, CPU_CACHE_WRITE);
+                }
+            }
+        }
+
+        // Write-allocate: a store miss reads the line in like a load would
+        if (cache->next) {
+            cpu_cache_access(cache->next, line << cache->line_shift, cache->line_size,
+                             type == CPU_CACHE_WRITE ? CPU_CACHE_READ : type);
+        }
+        cache->tags[slot] = line;
+        cache->valid[slot] = CPU_CACHE_LINE_VALID;
+    }
+
+    if (type == CPU_CACHE_WRITE) cache->valid[slot] |= CPU_CACHE_LINE_DIRTY;
+    cache_touch(cache, set, slot - base);
+    cache->mru[set] = slot;
+}
+
+// Hitting the MRU way of a set changes nothing but the counters (and the
+// dirty bit): its LRU path already points away from it
+static inline void cache_range_access(CPUCache* cache, uint32_t address, uint32_t size, CPUCacheAccess type) {
+    uint32_t line = address >> cache->line_shift;
+    uint32_t last = (uint32_t)(((uint64_t)address + size - 1) >> cache->line_shift);
+
+    for (;;) {
+        uint32_t slot = cache->mru[line & (cache->sets - 1)];
+        if (cache->tags[slot] == line && (cache->valid[slot] & CPU_CACHE_LINE_VALID)) {
+            cache->hits++;
+            cache->type_hits[type]++;
+            if (type == CPU_CACHE_WRITE) cache->valid[slot] |= CPU_CACHE_LINE_DIRTY;
+        } else {
+            cache_line_lookup(cache, line, type);
+        }
+        if (line == last) break;
+        line++;
+    }
+}
+
+void cpu_cache_access(CPUCache* cache, uint32_t address, uint32_t size, CPUCacheAccess type) {
+    if (!cache || !cache->tags || size == 0) return;
+    cache_range_access(cache, address, size, type);
+}
+
+// Same as cpu_cache_access() per record, with the MRU check inlined and its
+// hits counted locally; this is what the interpreter's batches go through
+void cpu_cache_simulate(CPUCache* cache, const uint64_t* records, size_t count) {
+    if (!cache || !cache->tags) return;
+
+    const uint32_t* tags = cache->tags;
+    uint8_t* valid = cache->valid;
+    const uint32_t* mru = cache->mru;
+    uint32_t shift = cache->line_shift;
+    uint32_t set_mask = cache->sets - 1;
+    uint64_t reads = 0, writes = 0, fetches = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t record = records[i];
+        uint32_t address = (uint32_t)record;
+        uint32_t size = (uint32_t)(record >> 32) & 0xFFFF;
+        CPUCacheAccess type = (CPUCacheAccess)(record >> 48);
+        if (size == 0) continue;
+
+        uint32_t line = address >> shift;
+        uint32_t last = (uint32_t)(((uint64_t)address + size - 1) >> shift);
+        for (;;) {
+            uint32_t slot = mru[line & set_mask];
+            if (tags[slot] == line && (valid[slot] & CPU_CACHE_LINE_VALID)) {
+                reads += type == CPU_CACHE_READ;
+                fetches += type == CPU_CACHE_FETCH;
+                if (type == CPU_CACHE_WRITE) {
+                    writes++;
+                    valid[slot] |= CPU_CACHE_LINE_DIRTY;
+                }
+            } else {
+                cache_line_lookup(cache, line, type);
+            }
+            if (line == last) break;
+            line++;
+        }
+    }
+
+    cache->hits += reads + writes + fetches;
+    cache->type_hits[CPU_CACHE_READ] += reads;
+    cache->type_hits[CPU_CACHE_WRITE] += writes;
+    cache->type_hits[CPU_CACHE_FETCH] += fetches;
+}
+
+int cpu_cache_read(CPUCache* cache, uint32_t address, uint8_t* data, size_t size) {
+    if (memory_read_block(address, data, size) != 0) return -1;
+    cpu_cache_access(cache, address, (uint32_t)size, CPU_CACHE_READ);
+    return 0;
+}
+
+int cpu_cache_write(CPUCache* cache, uint32_t address, const uint8_t* data, size_t size) {
+    if (memory_write_block(address, data, size) != 0) return -1;
+    cpu_cache_access(cache, address, (uint32_t)size, CPU_CACHE_WRITE);
+    return 0;
+}
+
+void cpu_cache_flush(CPUCache* cache) {
+    if (!cache || !cache->tags) return;
+
+    uint32_t lines = cache->sets * cache->associativity;
+    for (uint32_t slot = 0; slot < lines; slot++) {
+        if ((cache->valid[slot] & (CPU_CACHE_LINE_VALID | CPU_CACHE_LINE_DIRTY)) ==
+            (CPU_CACHE_LINE_VALID | CPU_CACHE_LINE_DIRTY)) {
+            cache->writebacks++;
+            cache->valid[slot] &= ~CPU_CACHE_LINE_DIRTY;
+            if (cache->next) {
+                cpu_cache_access(cache->next, cache->tags[slot] << cache->line_shift,
+                                 cache->line_size, CPU_CACHE_WRITE);
+            }
+        }
+    }
+}
+
+void cpu_cache_invalidate(CPUCache* cache) {
+    if (!cache || !cache->tags) return;
+    memset(cache->valid, 0, (size_t)cache->sets * cache->associativity);
+    memset(cache->plru, 0, (size_t)cache->sets * sizeof(uint32_t));
+}
+
+void cpu_cache_reset_stats(CPUCache* cache) {
+    if (!cache) return;
+    cache->hits = 0;
+    cache->misses = 0;
+    memset(cache->type_hits, 0, sizeof(cache->type_hits));
+    memset(cache->type_misses, 0, sizeof(cache->type_misses));
+    cache->evictions = 0;
+    cache->writebacks = 0;
+}
+
+static double cache_ratio(uint64_t hits, uint64_t misses) {
+    return hits + misses ? 100.0 * (double)hits / (double)(hits + misses) : 0.0;
+}
+
+void cpu_cache_print_stats(const char* name, const CPUCache* cache) {
+    if (!cache || !cache->tags) {
+        printf("%s: not configured\n", name);
+        return;
+    }
+
+    static const char* const kinds[CPU_CACHE_ACCESS_TYPES] = { "read", "write", "fetch" };
+
+    printf("%s: %u KB, %u-way, %u-byte lines: %.2f%% hit (%llu hits, %llu misses)\n",
+           name, cache->size / 1024, cache->associativity, cache->line_size,
+           cache_ratio(cache->hits, cache->misses),
+           (unsigned long long)cache->hits, (unsigned long long)cache->misses);
+    printf("   ");
+    for (int type = 0; type < CPU_CACHE_ACCESS_TYPES; type++) {
+        printf(" %s %.2f%% (%llu/%llu)", kinds[type],
+               cache_ratio(cache->type_hits[type], cache->type_misses[type]),
+               (unsigned long long)cache->type_hits[type],
+               (unsigned long long)(cache->type_hits[type] + cache->type_misses[type]));
+    }
+    printf("\n    %llu evictions, %llu writebacks\n",
+           (unsigned long long)cache->evictions, (unsigned long long)cache->writebacks);
+}
@@ -1,25 +1,133 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <windows.h>
 #include "cpu.h"
 #include "memory.h"
 #include "kernel/privilege.h"
+#include "kernel/mmu.h"
 #include "kernel/interrupts.h"
+#include "kernel/scheduler.h"
+
+// GCC and Clang dispatch through a table of label addresses; other
+// compilers fall back to a switch over the same handlers
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU_THREADED_DISPATCH 1
+#endif
+
+// Handlers the decoder can select.  Operand modes are resolved at decode
+// time, so the hot loop never looks at them.  The last group is only
+// produced by the translator: a compare or SUB fused with the conditional
+// branch that follows it, and direct CALL/JMP whose target was inlined
+// into the same block.
+#define CPU_OPS(X) \
+    X(OP_NOP) X(OP_HALT) X(OP_LOAD_IMM) X(OP_LOAD_MEM) X(OP_STORE) X(OP_STORE_ABS) X(OP_MOVE) \
+    X(OP_ADD) X(OP_ADD_IMM) X(OP_SUB) X(OP_SUB_IMM) X(OP_MUL) X(OP_MUL_IMM) \
+    X(OP_DIV) X(OP_DIV_IMM) X(OP_AND) X(OP_AND_IMM) X(OP_OR) X(OP_OR_IMM) \
+    X(OP_XOR) X(OP_XOR_IMM) X(OP_NOT) X(OP_CMP) X(OP_CMP_IMM) X(OP_ALU_MEM) \
+    X(OP_JMP) X(OP_JMP_REG) X(OP_JZ) X(OP_JZ_REG) X(OP_JNZ) X(OP_JNZ_REG) \
+    X(OP_CALL) X(OP_CALL_REG) X(OP_RET) X(OP_PUSH) X(OP_PUSH_IMM) X(OP_POP) \
+    X(OP_INT) X(OP_IRET) X(OP_CLI) X(OP_STI) X(OP_HLT) X(OP_INVALID) X(OP_BLOCK_END) \
+    X(OP_SUB_IMM_JZ) X(OP_SUB_IMM_JNZ) X(OP_CMP_JZ) X(OP_CMP_JNZ) \
+    X(OP_CMP_IMM_JZ) X(OP_CMP_IMM_JNZ) X(OP_CALL_TRACE) X(OP_JMP_TRACE)
+
+#define CPU_OP_ENUM(name) name,
+typedef enum { CPU_OPS(CPU_OP_ENUM) OP_COUNT } CPUOp;
+
+typedef struct {
+    uint8_t op;         // CPUOp handler
+    uint8_t rd;
+    uint8_t rs;
+    uint8_t opcode;     // Original InstructionType, for OP_ALU_MEM and disassembly
+    uint32_t imm;
+    uint32_t pc;        // Address of this instruction
+    uint32_t next_pc;   // Address of the one after it
+} CPUDecoded;
+
+// A translated guest basic block: decoded instructions up to the first
+// control transfer (direct CALL/JMP on the same page are followed), then an
+// OP_BLOCK_END sentinel for the fall-through case.  Blocks never span more
+// than one page, except that the first instruction may straddle two.
+typedef struct CPUBlock {
+    uint32_t start_pc;
+    uint32_t count;                 // Instructions, not counting the sentinel
+    uint32_t valid;
+    uint32_t page_count;
+    uint32_t pages[2];              // Guest pages holding the block's bytes
+    struct CPUBlock* hash_next;     // Translation table bucket chain
+    struct CPUBlock* page_next[2];  // Per-page block lists, one per pages[] entry
+    struct CPUBlock* link[2];       // Chained successors: [1] fall-through, [0] anything else
+    uint32_t fetch_count;           // Contiguous code runs, for the cache model
+    uint32_t fetch_pc[CPU_BLOCK_FETCH_RANGES];
+    uint32_t fetch_size[CPU_BLOCK_FETCH_RANGES];
+    CPUDecoded insts[CPU_BLOCK_MAX_INSTRUCTIONS + 1];
+} CPUBlock;
+
+#define CPU_PAGE_SHIFT      12
+#define CPU_PAGE_GRANULES   ((1u << CPU_PAGE_SHIFT) / 4)
+
+// Translated code on one guest page.  Stores check the granule bitmap, so a
+// write to data that merely shares a page with code does not throw the
+// page's blocks away.
+typedef struct {
+    CPUBlock* blocks;
+    uint32_t code[CPU_PAGE_GRANULES / 32];     // One bit per 4-byte granule
+} CPUCodePage;
 
 static CPUState cpu;
 
+// Translation cache: a bump-allocated block pool indexed by a hash of the
+// guest PC.  Invalidated blocks stay in the pool until it fills up and the
+// whole cache is flushed; tc_generation changes on every flush so chain
+// links made across one are never stored.
+static CPUBlock* tc_pool = NULL;
+static uint32_t tc_used = 0;
+static CPUBlock* tc_hash[CPU_TC_BUCKETS];
+static CPUCodePage** tc_pages = NULL;
+static uint32_t tc_page_count = 0;
+static uint32_t tc_generation = 0;
+static uint64_t tc_flushes = 0;
+
+// Benchmark baseline only: translate and run the way the interpreter did
+// before the translation cache, with a block ending at every control
+// transfer, no fused branches, and the slice loop looking up each block
+static int tc_plain_blocks = 0;
+
+// Cache model feed: the interpreter appends CPU_CACHE_RECORD()s here and the
+// batch goes through l1_cache when it fills.  NULL while the model is off.
+static uint64_t cpu_cache_trace[CPU_CACHE_BATCH];
+static uint64_t* cpu_cache_trace_pos = NULL;
+
+// Guest RAM as seen by the interpreter, refreshed at the start of every slice
+static uint8_t* cpu_ram = NULL;
+static uint32_t cpu_ram_limit = 0;     // Highest address a 32-bit access may start at
+
+static double cpu_run_seconds = 0.0;
+static uint64_t cpu_run_instructions = 0;
+
+static double cpu_now_seconds(void) {
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+}
+
 int cpu_init(void) {
     cpu.pc = 0;
     cpu.sp = 0x1000; // Stack pointer starts at 4KB
     cpu.flags = 0;
     cpu.running = 1;
+    cpu.state = CPU_STATE_RESET;
     cpu.privilege_level = PRIVILEGE_KERNEL;  // Start in kernel mode
-    
+    cpu.frequency_mhz = CPU_FREQUENCY_MHZ;
+
     // Initialize registers
-    for (int i = 0; i < 8; i++) {
+    for (int i = 0; i < CPU_REGISTER_COUNT; i++) {
         cpu.registers[i] = 0;
     }
-    
+    cpu.registers[REG_SP] = cpu.sp;
+
 #if ZORA_VERBOSE_BOOT
     printf("CPU initialized (privilege level: %d)\n", cpu.privilege_level);
 #endif
@@ -28,47 +136,990 @@ int cpu_init(void) {
 
 void cpu_cleanup(void) {
     cpu.running = 0;
+    cpu_cache_enable(0);
+    cpu_cache_destroy(&cpu.l1_cache);
+    cpu_cache_destroy(&cpu.l2_cache);
+    cpu_flush_translations();
+    free(tc_pages);
+    tc_pages = NULL;
+    tc_page_count = 0;
+    free(tc_pool);
+    tc_pool = NULL;
     printf("CPU cleaned up\n");
 }
 
-void cpu_execute_instruction(CPUState *cpu, unsigned int instruction) {
-    // Check privilege for certain instructions
-    switch (instruction) {
-        case 0x00: // NOP
-            break;
-        case 0x01: // HALT (privileged)
-            if (cpu->privilege_level != PRIVILEGE_KERNEL) {
-                privilege_raise_exception(EXCEPTION_GENERAL_PROTECTION);
-                return;
-            }
-            cpu->running = 0;
-            break;
-        case 0xFA: // CLI (clear interrupts - privileged)
-            if (cpu->privilege_level != PRIVILEGE_KERNEL) {
-                privilege_raise_exception(EXCEPTION_GENERAL_PROTECTION);
-                return;
-            }
-            privilege_cli();
+void cpu_reset(void) {
+    cpu_init();
+    cpu_reset_performance_counters();
+    cpu.interrupt_pending = 0;
+    cpu_flush_translations();
+}
+
+// ===== Decoder =====
+
+static int cpu_ends_block(uint8_t op) {
+    switch (op) {
+        case OP_HALT: case OP_JMP: case OP_JMP_REG: case OP_JZ: case OP_JZ_REG:
+        case OP_JNZ: case OP_JNZ_REG: case OP_CALL: case OP_CALL_REG: case OP_RET:
+        case OP_INT: case OP_IRET: case OP_STI: case OP_HLT: case OP_INVALID:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Pick the handler for one instruction word; returns OP_INVALID for
+// encodings the ISA does not define
+static uint8_t cpu_select_op(uint8_t opcode, uint8_t mode) {
+    int reg = mode == CPU_MODE_REG;
+    int imm = mode == CPU_MODE_IMM;
+
+    switch (opcode) {
+        case INST_NOP:   return OP_NOP;
+        case INST_HALT:  return OP_HALT;
+        case INST_LOAD:  return imm ? OP_LOAD_IMM : OP_LOAD_MEM;
+        case INST_STORE: return imm ? OP_STORE_ABS : OP_STORE;
+        case INST_MOVE:  return reg ? OP_MOVE : imm ? OP_LOAD_IMM : OP_LOAD_MEM;
+        case INST_ADD:   return reg ? OP_ADD : imm ? OP_ADD_IMM : OP_ALU_MEM;
+        case INST_SUB:   return reg ? OP_SUB : imm ? OP_SUB_IMM : OP_ALU_MEM;
+        case INST_MUL:   return reg ? OP_MUL : imm ? OP_MUL_IMM : OP_ALU_MEM;
+        case INST_DIV:   return reg ? OP_DIV : imm ? OP_DIV_IMM : OP_ALU_MEM;
+        case INST_AND:   return reg ? OP_AND : imm ? OP_AND_IMM : OP_ALU_MEM;
+        case INST_OR:    return reg ? OP_OR : imm ? OP_OR_IMM : OP_ALU_MEM;
+        case INST_XOR:   return reg ? OP_XOR : imm ? OP_XOR_IMM : OP_ALU_MEM;
+        case INST_NOT:   return OP_NOT;
+        case INST_CMP:   return reg ? OP_CMP : imm ? OP_CMP_IMM : OP_ALU_MEM;
+        case INST_JMP:   return reg ? OP_JMP_REG : imm ? OP_JMP : OP_INVALID;
+        case INST_JZ:    return reg ? OP_JZ_REG : imm ? OP_JZ : OP_INVALID;
+        case INST_JNZ:   return reg ? OP_JNZ_REG : imm ? OP_JNZ : OP_INVALID;
+        case INST_CALL:  return reg ? OP_CALL_REG : imm ? OP_CALL : OP_INVALID;
+        case INST_RET:   return OP_RET;
+        case INST_PUSH:  return reg ? OP_PUSH : imm ? OP_PUSH_IMM : OP_INVALID;
+        case INST_POP:   return OP_POP;
+        case INST_INT:   return imm ? OP_INT : OP_INVALID;
+        case INST_IRET:  return OP_IRET;
+        case INST_CLI:   return OP_CLI;
+        case INST_STI:   return OP_STI;
+        case INST_HLT:   return OP_HLT;
+        default:         return OP_INVALID;
+    }
+}
+
+static void cpu_decode_fields(CPUDecoded* d, uint32_t pc, uint32_t word, uint32_t imm, uint32_t length) {
+    uint8_t mode = (uint8_t)(word >> 16);
+
+    d->opcode = (uint8_t)word;
+    d->rd = (uint8_t)((word >> 8) & 0x0F);
+    d->rs = (uint8_t)((word >> 12) & 0x0F);
+    d->imm = imm;
+    d->pc = pc;
+    d->next_pc = pc + length;
+    d->op = (mode > CPU_MODE_MEM || (word >> 24) != 0) ? OP_INVALID : cpu_select_op(d->opcode, mode);
+}
+
+static void cpu_decode_one(CPUDecoded* d, uint32_t pc) {
+    uint8_t bytes[8];
+
+    if (memory_read_block(pc, bytes, 4) != 0) {
+        memset(d, 0, sizeof(*d));
+        d->op = OP_INVALID;
+        d->pc = pc;
+        d->next_pc = pc + 4;
+        return;
+    }
+
+    uint32_t word = (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) |
+                    ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+    uint8_t mode = (uint8_t)(word >> 16);
+    uint32_t imm = 0;
+    uint32_t length = 4;
+
+    if (mode == CPU_MODE_IMM || mode == CPU_MODE_MEM) {
+        if (memory_read_block(pc + 4, bytes + 4, 4) != 0) {
+            cpu_decode_fields(d, pc, word, 0, 8);
+            d->op = OP_INVALID;
+            return;
+        }
+        imm = (uint32_t)bytes[4] | ((uint32_t)bytes[5] << 8) |
+              ((uint32_t)bytes[6] << 16) | ((uint32_t)bytes[7] << 24);
+        length = 8;
+    }
+
+    cpu_decode_fields(d, pc, word, imm, length);
+}
+
+// Decode up to max instructions starting at pc into block.  Direct CALL and
+// JMP targets on the same page are decoded inline instead of ending the
+// block, so a loop calling a small helper stays one block.
+static void cpu_decode_block(CPUBlock* block, uint32_t pc, uint32_t max) {
+    uint32_t page = pc >> CPU_PAGE_SHIFT;
+    uint32_t count = 0;
+
+    block->start_pc = pc;
+    block->pages[0] = page;
+    block->page_count = 1;
+    block->fetch_count = 0;
+
+    while (count < max) {
+        CPUDecoded* d = &block->insts[count];
+        cpu_decode_one(d, pc);
+        if ((d->next_pc - 1) >> CPU_PAGE_SHIFT != page) {
+            // Only the first instruction may run onto the next page
+            if (count > 0) break;
+            block->pages[1] = page + 1;
+            block->page_count = 2;
+        }
+        if (count == 0 || pc != block->insts[count - 1].next_pc) {
+            block->fetch_pc[block->fetch_count] = pc;
+            block->fetch_size[block->fetch_count++] = 0;
+        }
+        block->fetch_size[block->fetch_count - 1] += d->next_pc - pc;
+        count++;
+
+        int direct = (d->op == OP_CALL || d->op == OP_JMP) && !tc_plain_blocks;
+        if (direct && count < max && d->imm >> CPU_PAGE_SHIFT == page &&
+            block->fetch_count < CPU_BLOCK_FETCH_RANGES) {
+            d->op = d->op == OP_CALL ? OP_CALL_TRACE : OP_JMP_TRACE;
+            pc = d->imm;
+            continue;
+        }
+        pc = d->next_pc;
+        if (cpu_ends_block(d->op) || pc >> CPU_PAGE_SHIFT != page) break;
+    }
+
+    // Fuse a compare with the conditional branch that ends the block
+    if (count >= 2 && !tc_plain_blocks) {
+        CPUDecoded* cond = &block->insts[count - 2];
+        uint8_t branch = block->insts[count - 1].op;
+        int jz = branch == OP_JZ;
+        if (jz || branch == OP_JNZ) {
+            if (cond->op == OP_SUB_IMM) cond->op = jz ? OP_SUB_IMM_JZ : OP_SUB_IMM_JNZ;
+            else if (cond->op == OP_CMP) cond->op = jz ? OP_CMP_JZ : OP_CMP_JNZ;
+            else if (cond->op == OP_CMP_IMM) cond->op = jz ? OP_CMP_IMM_JZ : OP_CMP_IMM_JNZ;
+        }
+    }
+
+    // The cache model sees fetches a line at a time, so widen each run to
+    // whole lines and fold together runs that share or abut a line
+    uint32_t runs = block->fetch_count;
+    block->fetch_count = 0;
+    for (uint32_t i = 0; i < runs; i++) {
+        uint32_t first = block->fetch_pc[i] & ~(CPU_CACHE_LINE_SIZE - 1);
+        uint32_t last = (block->fetch_pc[i] + block->fetch_size[i] - 1) & ~(CPU_CACHE_LINE_SIZE - 1);
+        uint32_t j;
+        for (j = 0; j < block->fetch_count; j++) {
+            uint32_t lo = block->fetch_pc[j];
+            uint32_t hi = lo + block->fetch_size[j];
+            if (first > hi || last + CPU_CACHE_LINE_SIZE < lo) continue;
+            if (first < lo) lo = first;
+            if (last + CPU_CACHE_LINE_SIZE > hi) hi = last + CPU_CACHE_LINE_SIZE;
+            block->fetch_pc[j] = lo;
+            block->fetch_size[j] = hi - lo;
             break;
-        case 0xFB: // STI (set interrupts - privileged)
-            if (cpu->privilege_level != PRIVILEGE_KERNEL) {
-                privilege_raise_exception(EXCEPTION_GENERAL_PROTECTION);
-                return;
-            }
-            privilege_sti();
+        }
+        if (j == block->fetch_count) {
+            block->fetch_pc[j] = first;
+            block->fetch_size[j] = last + CPU_CACHE_LINE_SIZE - first;
+            block->fetch_count++;
+        }
+    }
+
+    CPUDecoded* end = &block->insts[count];
+    memset(end, 0, sizeof(*end));
+    end->op = OP_BLOCK_END;
+    end->pc = pc;
+    end->next_pc = pc;
+
+    block->count = count;
+    block->valid = 1;
+    block->hash_next = NULL;
+    block->page_next[0] = block->page_next[1] = NULL;
+    block->link[0] = block->link[1] = NULL;
+}
+
+// ===== Translation cache =====
+
+static uint32_t cpu_tc_bucket(uint32_t pc) {
+    return ((pc >> 2) ^ (pc >> 14)) & (CPU_TC_BUCKETS - 1);
+}
+
+static CPUCodePage* cpu_code_page(uint32_t index) {
+    if (index >= tc_page_count) return NULL;
+    if (!tc_pages[index]) {
+        tc_pages[index] = calloc(1, sizeof(CPUCodePage));
+        // Stores through the software TLB must come back through memory.c
+        mmu_tlb_protect_code(index << CPU_PAGE_SHIFT);
+    }
+    return tc_pages[index];
+}
+
+int cpu_is_code_page(uint32_t physical_addr) {
+    uint32_t index = physical_addr >> CPU_PAGE_SHIFT;
+    return tc_pages && index < tc_page_count && tc_pages[index] != NULL;
+}
+
+static void cpu_mark_code(uint32_t start, uint32_t end) {
+    for (uint32_t granule = start >> 2; granule <= (end - 1) >> 2; granule++) {
+        CPUCodePage* page = cpu_code_page(granule / CPU_PAGE_GRANULES);
+        if (page) page->code[(granule % CPU_PAGE_GRANULES) >> 5] |= 1u << (granule & 31);
+    }
+}
+
+void cpu_flush_translations(void) {
+    if (tc_used > 0) tc_flushes++;
+    tc_used = 0;
+    tc_generation++;
+    memset(tc_hash, 0, sizeof(tc_hash));
+    for (uint32_t i = 0; i < tc_page_count; i++) {
+        free(tc_pages[i]);
+        tc_pages[i] = NULL;
+    }
+}
+
+static CPUBlock* cpu_translate(uint32_t pc) {
+    if (tc_used == CPU_TC_BLOCKS) cpu_flush_translations();
+
+    CPUBlock* block = &tc_pool[tc_used++];
+    cpu_decode_block(block, pc, CPU_BLOCK_MAX_INSTRUCTIONS);
+    cpu.perf.translation_misses++;
+
+    for (uint32_t i = 0; i < block->count; i++) {
+        cpu_mark_code(block->insts[i].pc, block->insts[i].next_pc);
+    }
+    for (uint32_t i = 0; i < block->page_count; i++) {
+        CPUCodePage* page = cpu_code_page(block->pages[i]);
+        if (!page) continue;
+        block->page_next[i] = page->blocks;
+        page->blocks = block;
+    }
+
+    uint32_t bucket = cpu_tc_bucket(pc);
+    block->hash_next = tc_hash[bucket];
+    tc_hash[bucket] = block;
+    return block;
+}
+
+static CPUBlock* cpu_lookup_block(uint32_t pc) {
+    CPUBlock** link = &tc_hash[cpu_tc_bucket(pc)];
+    CPUBlock* block;
+
+    while ((block = *link) != NULL) {
+        if (!block->valid) {
+            *link = block->hash_next;   // Unlink invalidated blocks as we pass them
+            continue;
+        }
+        if (block->start_pc == pc) {
+            cpu.perf.translation_hits++;
+            return block;
+        }
+        link = &block->hash_next;
+    }
+    return cpu_translate(pc);
+}
+
+// Does [address, address + size) overlap translated code?
+static int cpu_code_hit(uint32_t address, uint32_t size) {
+    uint32_t last = (uint32_t)(((uint64_t)address + size - 1) >> 2);
+    for (uint32_t granule = address >> 2; granule <= last; granule++) {
+        uint32_t index = granule / CPU_PAGE_GRANULES;
+        if (index >= tc_page_count) break;
+        CPUCodePage* page = tc_pages[index];
+        if (page && (page->code[(granule % CPU_PAGE_GRANULES) >> 5] >> (granule & 31) & 1)) return 1;
+    }
+    return 0;
+}
+
+// Drop every block on a page; the page is rebuilt as blocks are retranslated
+static void cpu_invalidate_page(uint32_t index) {
+    CPUCodePage* page = tc_pages[index];
+    CPUBlock* block = page->blocks;
+
+    while (block) {
+        CPUBlock* next = block->page_next[block->pages[0] == index ? 0 : 1];
+        if (block->valid) {
+            block->valid = 0;
+            cpu.perf.translation_invalidations++;
+        }
+        block = next;
+    }
+    tc_pages[index] = NULL;
+    free(page);
+}
+
+void cpu_invalidate_code(uint32_t address, uint32_t size) {
+    if (!tc_pages || size == 0) return;
+
+    uint64_t end = (uint64_t)address + size;
+    for (uint64_t base = address & ~0xFFFull; base < end; base += 1u << CPU_PAGE_SHIFT) {
+        uint32_t index = (uint32_t)(base >> CPU_PAGE_SHIFT);
+        if (index >= tc_page_count) break;
+        if (!tc_pages[index]) continue;
+
+        uint64_t from = base > address ? base : address;
+        uint64_t to = end < base + (1u << CPU_PAGE_SHIFT) ? end : base + (1u << CPU_PAGE_SHIFT);
+        if (cpu_code_hit((uint32_t)from, (uint32_t)(to - from))) cpu_invalidate_page(index);
+    }
+}
+
+// ===== Interpreter =====
+
+static int cpu_prepare(void) {
+    size_t ram_size = memory_get_total();
+    if (ram_size < 4) return 0;
+
+    cpu_ram = memory_map(0, ram_size);
+    if (!cpu_ram) return 0;
+    cpu_ram_limit = (uint32_t)(ram_size - 4);
+
+    if (!tc_pool) {
+        tc_pool = malloc(CPU_TC_BLOCKS * sizeof(CPUBlock));
+        if (!tc_pool) return 0;
+        tc_used = 0;
+    }
+
+    uint32_t page_count = (uint32_t)((ram_size + (1u << CPU_PAGE_SHIFT) - 1) >> CPU_PAGE_SHIFT);
+    if (tc_page_count != page_count) {
+        cpu_flush_translations();
+        CPUCodePage** pages = calloc(page_count, sizeof(CPUCodePage*));
+        if (!pages) return 0;
+        free(tc_pages);
+        tc_pages = pages;
+        tc_page_count = page_count;
+    }
+    return 1;
+}
+
+static uint32_t cpu_read32(uint32_t address) {
+    uint32_t value;
+    memcpy(&value, cpu_ram + address, sizeof(value));
+    return value;
+}
+
+static void cpu_write32(uint32_t address, uint32_t value) {
+    memcpy(cpu_ram + address, &value, sizeof(value));
+}
+
+// Fast check for stores: pages without translated code are a NULL pointer
+static int cpu_is_code(uint32_t address) {
+    if (!tc_pages[address >> CPU_PAGE_SHIFT] && !tc_pages[(address + 3) >> CPU_PAGE_SHIFT]) return 0;
+    return cpu_code_hit(address, 4);
+}
+
+#define CPU_ARITH_FLAGS (FLAG_ZERO | FLAG_NEGATIVE | FLAG_CARRY | FLAG_OVERFLOW)
+
+static uint32_t cpu_flags_logic(uint32_t flags, uint32_t result) {
+    return (flags & ~CPU_ARITH_FLAGS) | (result == 0 ? FLAG_ZERO : 0) |
+           ((result >> 31) ? FLAG_NEGATIVE : 0);
+}
+
+static uint32_t cpu_flags_add(uint32_t flags, uint32_t a, uint32_t b, uint32_t result) {
+    flags = cpu_flags_logic(flags, result);
+    if (result < a) flags |= FLAG_CARRY;
+    if (((a ^ result) & (b ^ result)) >> 31) flags |= FLAG_OVERFLOW;
+    return flags;
+}
+
+static uint32_t cpu_flags_sub(uint32_t flags, uint32_t a, uint32_t b, uint32_t result) {
+    flags = cpu_flags_logic(flags, result);
+    if (a < b) flags |= FLAG_CARRY;
+    if (((a ^ b) & (a ^ result)) >> 31) flags |= FLAG_OVERFLOW;
+    return flags;
+}
+
+static uint32_t cpu_flags_mul(uint32_t flags, uint32_t a, uint32_t b, uint32_t* result) {
+    uint64_t wide = (uint64_t)a * b;
+    *result = (uint32_t)wide;
+    flags = cpu_flags_logic(flags, *result);
+    if (wide >> 32) flags |= FLAG_CARRY | FLAG_OVERFLOW;
+    return flags;
+}
+
+// Slow path for ALU instructions with a memory operand.  Returns 0, or -1
+// on a divide by zero.
+static int cpu_alu(uint8_t opcode, uint32_t* target, uint32_t b, uint32_t* flags) {
+    uint32_t a = *target;
+    uint32_t result = a;
+
+    switch (opcode) {
+        case INST_ADD: result = a + b; *flags = cpu_flags_add(*flags, a, b, result); break;
+        case INST_SUB: result = a - b; *flags = cpu_flags_sub(*flags, a, b, result); break;
+        case INST_CMP: *flags = cpu_flags_sub(*flags, a, b, a - b); return 0;
+        case INST_MUL: *flags = cpu_flags_mul(*flags, a, b, &result); break;
+        case INST_DIV:
+            if (b == 0) return -1;
+            result = a / b;
+            *flags = cpu_flags_logic(*flags, result);
             break;
-        case 0xF4: // HLT (halt - privileged)
-            if (cpu->privilege_level != PRIVILEGE_KERNEL) {
-                privilege_raise_exception(EXCEPTION_GENERAL_PROTECTION);
-                return;
+        case INST_AND: result = a & b; *flags = cpu_flags_logic(*flags, result); break;
+        case INST_OR:  result = a | b; *flags = cpu_flags_logic(*flags, result); break;
+        case INST_XOR: result = a ^ b; *flags = cpu_flags_logic(*flags, result); break;
+    }
+
+    *target = result;
+    return 0;
+}
+
+static void cpu_fault(CPUState* c, uint32_t pc, uint32_t exception) {
+    c->pc = pc;
+    c->state = CPU_STATE_EXCEPTION;
+    c->running = 0;
+    privilege_raise_exception(exception);
+}
+
+#ifdef CPU_THREADED_DISPATCH
+#define CPU_CASE(name)  L_##name:
+#define CPU_DISPATCH()  goto *dispatch[ip->op]
+#else
+#define CPU_CASE(name)  case name:
+#define CPU_DISPATCH()  goto dispatch_top
+#endif
+#define CPU_NEXT()      do { ip++; CPU_DISPATCH(); } while (0)
+#define CPU_PRIVILEGED() \
+    do { if (c->privilege_level != PRIVILEGE_KERNEL) { exception = EXCEPTION_GENERAL_PROTECTION; goto fault; } } while (0)
+#define CPU_CHECK(address) \
+    do { if ((address) > ram_limit) { exception = EXCEPTION_GENERAL_PROTECTION; goto fault; } } while (0)
+#define CPU_TRACE(address, size, type) \
+    do { \
+        if (trace) { \
+            *trace++ = CPU_CACHE_RECORD(address, size, type); \
+            if (trace == cpu_cache_trace + CPU_CACHE_BATCH) trace = cpu_cache_drain(trace); \
+        } \
+    } while (0)
+
+// Run the queued accesses through the cache model; returns the emptied queue
+static uint64_t* cpu_cache_drain(uint64_t* end) {
+    CPUCache* l1 = &cpu.l1_cache;
+    uint64_t hits = l1->hits, misses = l1->misses;
+
+    cpu_cache_simulate(l1, cpu_cache_trace, (size_t)(end - cpu_cache_trace));
+    cpu.perf.cache_hits += l1->hits - hits;
+    cpu.perf.cache_misses += l1->misses - misses;
+    return cpu_cache_trace;
+}
+
+// Run translated code starting at block, following chain links from block
+// to block until budget instructions have run, an interrupt can be taken or
+// an instruction needs the outer loop.  Returns the number of instructions
+// that completed; c->pc is left at the next instruction to execute.
+static uint64_t cpu_execute(CPUState* c, CPUBlock* block, uint64_t budget) {
+#ifdef CPU_THREADED_DISPATCH
+#define CPU_OP_LABEL(name) &&L_##name,
+    static const void* const dispatch[OP_COUNT] = { CPU_OPS(CPU_OP_LABEL) };
+#undef CPU_OP_LABEL
+#endif
+    const CPUDecoded* ip;
+    uint32_t* r = c->registers;
+    uint32_t flags = c->flags;
+    uint32_t ram_limit = cpu_ram_limit;
+    uint64_t executed = 0;
+    uint64_t* trace = cpu_cache_trace_pos;
+    uint32_t next_pc;
+    uint32_t address, value, exception;
+
+enter:
+    // Count the whole block up front; early exits take back what did not run
+    ip = block->insts;
+    executed += block->count;
+    if (trace) {
+        for (uint32_t i = 0; i < block->fetch_count; i++) {
+            CPU_TRACE(block->fetch_pc[i], block->fetch_size[i], CPU_CACHE_FETCH);
+        }
+    }
+
+#ifdef CPU_THREADED_DISPATCH
+    CPU_DISPATCH();
+#else
+dispatch_top:
+    switch (ip->op) {
+#endif
+
+    CPU_CASE(OP_NOP)
+        CPU_NEXT();
+
+    CPU_CASE(OP_HALT)
+        CPU_PRIVILEGED();
+        c->running = 0;
+        c->state = CPU_STATE_HALTED;
+        next_pc = ip->next_pc;
+        goto done;
+
+    CPU_CASE(OP_LOAD_IMM)
+        r[ip->rd] = ip->imm;
+        CPU_NEXT();
+
+    CPU_CASE(OP_LOAD_MEM)
+        address = r[ip->rs] + ip->imm;
+        CPU_CHECK(address);
+        CPU_TRACE(address, 4, CPU_CACHE_READ);
+        r[ip->rd] = cpu_read32(address);
+        CPU_NEXT();
+
+    CPU_CASE(OP_STORE)
+        address = r[ip->rd] + ip->imm;
+        goto store;
+
+    CPU_CASE(OP_STORE_ABS)
+        address = ip->imm;
+    store:
+        CPU_CHECK(address);
+        CPU_TRACE(address, 4, CPU_CACHE_WRITE);
+        cpu_write32(address, r[ip->rs]);
+        if (cpu_is_code(address)) {
+            // Self-modifying code: this block may be stale now, so leave it
+            cpu_invalidate_code(address, 4);
+            next_pc = ip->next_pc;
+            goto done;
+        }
+        CPU_NEXT();
+
+    CPU_CASE(OP_MOVE)
+        r[ip->rd] = r[ip->rs];
+        CPU_NEXT();
+
+    CPU_CASE(OP_ADD)
+        value = r[ip->rs];
+        goto add;
+    CPU_CASE(OP_ADD_IMM)
+        value = ip->imm;
+    add: {
+        uint32_t a = r[ip->rd];
+        r[ip->rd] = a + value;
+        flags = cpu_flags_add(flags, a, value, a + value);
+        CPU_NEXT();
+    }
+
+    CPU_CASE(OP_SUB)
+        value = r[ip->rs];
+        goto sub;
+    CPU_CASE(OP_SUB_IMM)
+        value = ip->imm;
+    sub: {
+        uint32_t a = r[ip->rd];
+        r[ip->rd] = a - value;
+        flags = cpu_flags_sub(flags, a, value, a - value);
+        CPU_NEXT();
+    }
+
+    CPU_CASE(OP_MUL)
+        value = r[ip->rs];
+        goto mul;
+    CPU_CASE(OP_MUL_IMM)
+        value = ip->imm;
+    mul:
+        flags = cpu_flags_mul(flags, r[ip->rd], value, &r[ip->rd]);
+        CPU_NEXT();
+
+    CPU_CASE(OP_DIV)
+        value = r[ip->rs];
+        goto divide;
+    CPU_CASE(OP_DIV_IMM)
+        value = ip->imm;
+    divide:
+        if (value == 0) {
+            exception = INT_DIVIDE_ERROR;
+            goto fault;
+        }
+        r[ip->rd] /= value;
+        flags = cpu_flags_logic(flags, r[ip->rd]);
+        CPU_NEXT();
+
+    CPU_CASE(OP_AND)
+        r[ip->rd] &= r[ip->rs];
+        flags = cpu_flags_logic(flags, r[ip->rd]);
+        CPU_NEXT();
+    CPU_CASE(OP_AND_IMM)
+        r[ip->rd] &= ip->imm;
+        flags = cpu_flags_logic(flags, r[ip->rd]);
+        CPU_NEXT();
+
+    CPU_CASE(OP_OR)
+        r[ip->rd] |= r[ip->rs];
+        flags = cpu_flags_logic(flags, r[ip->rd]);
+        CPU_NEXT();
+    CPU_CASE(OP_OR_IMM)
+        r[ip->rd] |= ip->imm;
+        flags = cpu_flags_logic(flags, r[ip->rd]);
+        CPU_NEXT();
+
+    CPU_CASE(OP_XOR)
+        r[ip->rd] ^= r[ip->rs];
+        flags = cpu_flags_logic(flags, r[ip->rd]);
+        CPU_NEXT();
+    CPU_CASE(OP_XOR_IMM)
+        r[ip->rd] ^= ip->imm;
+        flags = cpu_flags_logic(flags, r[ip->rd]);
+        CPU_NEXT();
+
+    CPU_CASE(OP_NOT)
+        r[ip->rd] = ~r[ip->rd];
+        flags = cpu_flags_logic(flags, r[ip->rd]);
+        CPU_NEXT();
+
+    CPU_CASE(OP_CMP)
+        value = r[ip->rs];
+        goto compare;
+    CPU_CASE(OP_CMP_IMM)
+        value = ip->imm;
+    compare:
+        flags = cpu_flags_sub(flags, r[ip->rd], value, r[ip->rd] - value);
+        CPU_NEXT();
+
+    // Fused forms: set flags, then resolve the JZ/JNZ in the next slot
+    // without dispatching it
+    CPU_CASE(OP_SUB_IMM_JZ)
+    CPU_CASE(OP_SUB_IMM_JNZ) {
+        uint32_t a = r[ip->rd];
+        r[ip->rd] = a - ip->imm;
+        flags = cpu_flags_sub(flags, a, ip->imm, a - ip->imm);
+        goto fused_branch;
+    }
+    CPU_CASE(OP_CMP_JZ)
+    CPU_CASE(OP_CMP_JNZ)
+        value = r[ip->rs];
+        goto fused_compare;
+    CPU_CASE(OP_CMP_IMM_JZ)
+    CPU_CASE(OP_CMP_IMM_JNZ)
+        value = ip->imm;
+    fused_compare:
+        flags = cpu_flags_sub(flags, r[ip->rd], value, r[ip->rd] - value);
+    fused_branch:
+        ip++;
+        next_pc = ((flags & FLAG_ZERO) != 0) == (ip->op == OP_JZ) ? ip->imm : ip->next_pc;
+        goto taken;
+
+    CPU_CASE(OP_ALU_MEM)
+        address = r[ip->rs] + ip->imm;
+        CPU_CHECK(address);
+        CPU_TRACE(address, 4, CPU_CACHE_READ);
+        if (cpu_alu(ip->opcode, &r[ip->rd], cpu_read32(address), &flags) != 0) {
+            exception = INT_DIVIDE_ERROR;
+            goto fault;
+        }
+        CPU_NEXT();
+
+    CPU_CASE(OP_JMP)
+        next_pc = ip->imm;
+        goto taken;
+    CPU_CASE(OP_JMP_TRACE)
+        // The target was decoded into the following slots
+        c->perf.branch_predictions++;
+        CPU_NEXT();
+    CPU_CASE(OP_JMP_REG)
+        next_pc = r[ip->rs];
+        goto taken;
+
+    CPU_CASE(OP_JZ)
+        next_pc = (flags & FLAG_ZERO) ? ip->imm : ip->next_pc;
+        goto taken;
+    CPU_CASE(OP_JZ_REG)
+        next_pc = (flags & FLAG_ZERO) ? r[ip->rs] : ip->next_pc;
+        goto taken;
+
+    CPU_CASE(OP_JNZ)
+        next_pc = (flags & FLAG_ZERO) ? ip->next_pc : ip->imm;
+        goto taken;
+    CPU_CASE(OP_JNZ_REG)
+        next_pc = (flags & FLAG_ZERO) ? ip->next_pc : r[ip->rs];
+        goto taken;
+
+    CPU_CASE(OP_CALL)
+        next_pc = ip->imm;
+        goto call;
+    CPU_CASE(OP_CALL_REG)
+        next_pc = r[ip->rs];
+    call:
+        address = r[REG_SP] - 4;
+        if (address > ram_limit) {
+            exception = EXCEPTION_STACK_FAULT;
+            goto fault;
+        }
+        CPU_TRACE(address, 4, CPU_CACHE_WRITE);
+        cpu_write32(address, ip->next_pc);
+        r[REG_SP] = address;
+        goto taken;
+    CPU_CASE(OP_CALL_TRACE)
+        address = r[REG_SP] - 4;
+        if (address > ram_limit) {
+            exception = EXCEPTION_STACK_FAULT;
+            goto fault;
+        }
+        CPU_TRACE(address, 4, CPU_CACHE_WRITE);
+        cpu_write32(address, ip->next_pc);
+        r[REG_SP] = address;
+        c->perf.branch_predictions++;
+        CPU_NEXT();
+
+    CPU_CASE(OP_RET)
+        address = r[REG_SP];
+        if (address > ram_limit) {
+            exception = EXCEPTION_STACK_FAULT;
+            goto fault;
+        }
+        CPU_TRACE(address, 4, CPU_CACHE_READ);
+        next_pc = cpu_read32(address);
+        r[REG_SP] = address + 4;
+        goto taken;
+
+    CPU_CASE(OP_PUSH)
+        value = r[ip->rs];
+        goto push;
+    CPU_CASE(OP_PUSH_IMM)
+        value = ip->imm;
+    push:
+        address = r[REG_SP] - 4;
+        if (address > ram_limit) {
+            exception = EXCEPTION_STACK_FAULT;
+            goto fault;
+        }
+        CPU_TRACE(address, 4, CPU_CACHE_WRITE);
+        cpu_write32(address, value);
+        r[REG_SP] = address;
+        CPU_NEXT();
+
+    CPU_CASE(OP_POP)
+        address = r[REG_SP];
+        if (address > ram_limit) {
+            exception = EXCEPTION_STACK_FAULT;
+            goto fault;
+        }
+        CPU_TRACE(address, 4, CPU_CACHE_READ);
+        r[REG_SP] = address + 4;
+        r[ip->rd] = cpu_read32(address);
+        CPU_NEXT();
+
+    CPU_CASE(OP_INT)
+        // Push the frame IRET pops: the return address, and the flags
+        // above it.  Handlers are host code standing for a whole guest
+        // handler, IRET included, so the frame comes off again after.
+        address = r[REG_SP] - 8;
+        if (address > ram_limit - 4) {
+            exception = EXCEPTION_STACK_FAULT;
+            goto fault;
+        }
+        CPU_TRACE(address, 8, CPU_CACHE_WRITE);
+        cpu_write32(address, ip->next_pc);
+        cpu_write32(address + 4, flags);
+        r[REG_SP] = address;
+        c->pc = ip->next_pc;
+        c->flags = flags;
+        cpu_handle_interrupt(c, ip->imm & 0xFF);
+        c->perf.interrupts_handled++;
+        flags = c->flags;
+        r[REG_SP] = address + 8;
+        next_pc = ip->next_pc;
+        goto done;
+
+    CPU_CASE(OP_IRET)
+        // Pops what INT pushes
+        CPU_PRIVILEGED();
+        address = r[REG_SP];
+        if (address > ram_limit - 4) {
+            exception = EXCEPTION_STACK_FAULT;
+            goto fault;
+        }
+        CPU_TRACE(address, 8, CPU_CACHE_READ);
+        next_pc = cpu_read32(address);
+        flags = cpu_read32(address + 4);
+        r[REG_SP] = address + 8;
+        goto done;
+
+    CPU_CASE(OP_CLI)
+        CPU_PRIVILEGED();
+        privilege_cli();
+        flags &= ~FLAG_INTERRUPT;
+        CPU_NEXT();
+
+    CPU_CASE(OP_STI)
+        CPU_PRIVILEGED();
+        privilege_sti();
+        flags |= FLAG_INTERRUPT;
+        next_pc = ip->next_pc;
+        goto done;
+
+    CPU_CASE(OP_HLT)
+        CPU_PRIVILEGED();
+        privilege_hlt();
+        c->state = CPU_STATE_HALTED;
+        next_pc = ip->next_pc;
+        goto done;
+
+    CPU_CASE(OP_INVALID)
+        exception = EXCEPTION_INVALID_OPCODE;
+        goto fault;
+
+    CPU_CASE(OP_BLOCK_END)
+        next_pc = ip->pc;
+        goto chain;
+
+#ifndef CPU_THREADED_DISPATCH
+    default:
+        exception = EXCEPTION_INVALID_OPCODE;
+        goto fault;
+    }
+#endif
+
+taken:
+    c->perf.branch_predictions++;
+chain:
+    // Every instruction in the block ran; go straight to the next block
+    if (executed < budget && !((c->interrupt_pending || interrupt_doorbell) && (flags & FLAG_INTERRUPT))) {
+        int slot = next_pc == ip->next_pc;
+        CPUBlock* next = block->link[slot];
+        if (next && next->valid && next->start_pc == next_pc) {
+            c->perf.translation_hits++;
+        } else {
+            // Translating may flush the cache, and block with it
+            uint32_t generation = tc_generation;
+            next = cpu_lookup_block(next_pc);
+            if (generation == tc_generation) block->link[slot] = next;
+        }
+        block = next;
+        goto enter;
+    }
+    goto leave;
+
+done:
+    executed -= block->count - (uint32_t)(ip - block->insts + 1);
+leave:
+    cpu_cache_trace_pos = trace;
+    c->pc = next_pc;
+    c->flags = flags;
+    c->sp = r[REG_SP];
+    c->bp = r[REG_BP];
+    return executed;
+
+fault:
+    executed -= block->count - (uint32_t)(ip - block->insts);
+    cpu_cache_trace_pos = trace;
+    c->flags = flags;
+    c->sp = r[REG_SP];
+    c->bp = r[REG_BP];
+    cpu_fault(c, ip->pc, exception);
+    return executed;
+}
+
+static void cpu_deliver_interrupts(void) {
+    // IRQs posted by device threads, then the CPU's own pending vectors
+    cpu.perf.interrupts_handled += interrupt_poll();
+    for (uint32_t vector = 0; vector < 32; vector++) {
+        if (cpu.interrupt_pending & (1u << vector)) {
+            cpu.interrupt_pending &= ~(1u << vector);
+            cpu_handle_interrupt(&cpu, vector);
+            cpu.perf.interrupts_handled++;
+            return;
+        }
+    }
+}
+
+static void cpu_account(uint64_t executed, double seconds) {
+    cpu.perf.instructions_executed += executed;
+    cpu.perf.cycles_elapsed += executed;
+    cpu.cycle_count += executed;
+    cpu_run_instructions += executed;
+    cpu_run_seconds += seconds;
+}
+
+uint64_t cpu_run_slice(uint64_t budget) {
+    if (!cpu_prepare()) return 0;
+    if (cpu.state == CPU_STATE_RESET) cpu.state = CPU_STATE_RUNNING;
+
+    double start = cpu_now_seconds();
+    uint64_t executed = 0;
+
+    // Posted IRQs are delivered here, between blocks, while the slice runs
+    interrupt_claim();
+    while (cpu.running && cpu.state == CPU_STATE_RUNNING && executed < budget) {
+        if ((cpu.interrupt_pending || interrupt_doorbell) && (cpu.flags & FLAG_INTERRUPT)) {
+            cpu_deliver_interrupts();
+            scheduler_preempt_point();      // The timer IRQ may have asked for a switch
+        }
+        executed += cpu_execute(&cpu, cpu_lookup_block(cpu.pc), tc_plain_blocks ? 1 : budget - executed);
+    }
+    interrupt_release();
+    if (cpu_cache_trace_pos && cpu_cache_trace_pos != cpu_cache_trace) {
+        cpu_cache_trace_pos = cpu_cache_drain(cpu_cache_trace_pos);
+    }
+
+    cpu_account(executed, cpu_now_seconds() - start);
+    return executed;
+}
+
+void cpu_run(void) {
+    cpu.running = 1;
+    if (cpu.state != CPU_STATE_HALTED) cpu.state = CPU_STATE_RUNNING;
+
+    // Hold the IRQ claim for the whole run so device IRQs wait for a block
+    // boundary instead of being delivered on the clock thread
+    interrupt_claim();
+    while (cpu.running) {
+        if (cpu.state == CPU_STATE_HALTED) {
+            // HLT: idle until an interrupt arrives
+            if (!cpu.interrupt_pending && !interrupt_doorbell) {
+                Sleep(1);
+                continue;
             }
-            privilege_hlt();
-            break;
-        default:
-            printf("Unknown instruction: 0x%02X\n", instruction);
-            privilege_raise_exception(EXCEPTION_INVALID_OPCODE);
-            break;
+            cpu.state = CPU_STATE_RUNNING;
+        }
+        if (cpu.state != CPU_STATE_RUNNING) break;
+
+        if (cpu_run_slice(CPU_SLICE_INSTRUCTIONS) == 0 && cpu.state == CPU_STATE_RUNNING) {
+            break;  // Guest memory is not available
+        }
+
+        // Give the rest of the VM a turn between slices
+        Sleep(0);
     }
+    interrupt_release();
+}
+
+// Decode and run exactly one instruction, bypassing the translation cache
+void cpu_step(void) {
+    if (!cpu_prepare()) return;
+    if (cpu.state == CPU_STATE_RESET || cpu.state == CPU_STATE_HALTED) cpu.state = CPU_STATE_RUNNING;
+    cpu.running = 1;
+
+    CPUBlock block;
+    double start = cpu_now_seconds();
+    cpu_decode_block(&block, cpu.pc, 1);
+    uint64_t executed = cpu_execute(&cpu, &block, 1);
+    cpu_account(executed, cpu_now_seconds() - start);
+}
+
+void cpu_halt(void) {
+    cpu.running = 0;
+    cpu.state = CPU_STATE_HALTED;
+}
+
+// Execute a single encoded word (no immediate) against the given state
+void cpu_execute_instruction(CPUState *cpu, uint32_t instruction) {
+    if (!cpu_prepare()) return;
+
+    CPUBlock block;
+    cpu_decode_fields(&block.insts[0], cpu->pc, instruction, 0, 4);
+    memset(&block.insts[1], 0, sizeof(block.insts[1]));
+    block.insts[1].op = OP_BLOCK_END;
+    block.insts[1].pc = cpu->pc + 4;
+    block.insts[1].next_pc = cpu->pc + 4;
+    block.start_pc = cpu->pc;
+    block.count = 1;
+    block.valid = 1;
+    block.link[0] = block.link[1] = NULL;
+    block.fetch_count = 1;
+    block.fetch_pc[0] = cpu->pc;
+    block.fetch_size[0] = 4;
+
+    cpu->perf.instructions_executed += cpu_execute(cpu, &block, 1);
+}
+
+void cpu_decode_and_execute(CPUState *cpu, uint32_t instruction) {
+    cpu_execute_instruction(cpu, instruction);
+}
+
+uint32_t cpu_fetch_instruction(CPUState *cpu) {
+    uint8_t bytes[4];
+    if (memory_read_block(cpu->pc, bytes, 4) != 0) return 0;
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) |
+           ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
 }
 
 void cpu_handle_interrupt(CPUState *cpu, unsigned int interrupt) {
@@ -83,10 +1134,10 @@ void cpu_handle_interrupt(CPUState *cpu, unsigned int interrupt) {
     ctx.ebx = cpu->registers[1];
     ctx.ecx = cpu->registers[2];
     ctx.edx = cpu->registers[3];
-    
+
     // Dispatch to interrupt handler
     interrupt_dispatch(&ctx);
-    
+
     // Restore registers
     cpu->registers[0] = ctx.eax;
     cpu->registers[1] = ctx.ebx;
@@ -94,17 +1145,350 @@ void cpu_handle_interrupt(CPUState *cpu, unsigned int interrupt) {
     cpu->registers[3] = ctx.edx;
 }
 
-void cpu_run(void) {
-    while (cpu.running) {
-        uint8_t instruction = memory_read(cpu.pc);
-        cpu_execute_instruction(&cpu, instruction);
-        cpu.pc++;
-        
-        // Simple delay to prevent 100% CPU usage
-        Sleep(1);
+void cpu_set_interrupt_pending(InterruptVector vector) {
+    if ((uint32_t)vector < 32) {
+        cpu.interrupt_pending |= 1u << vector;
     }
 }
 
+void cpu_enable_interrupts(void) {
+    cpu.flags |= FLAG_INTERRUPT;
+}
+
+void cpu_disable_interrupts(void) {
+    cpu.flags &= ~FLAG_INTERRUPT;
+}
+
 CPUState* cpu_get_state(void) {
     return &cpu;
-}
\ No newline at end of file
+}
+
+// ===== Registers and flags =====
+
+uint32_t cpu_get_register(CPURegister reg) {
+    if (reg == REG_IP) return cpu.pc;
+    if (reg == REG_FLAGS) return cpu.flags;
+    return (uint32_t)reg < CPU_REGISTER_COUNT ? cpu.registers[reg] : 0;
+}
+
+void cpu_set_register(CPURegister reg, uint32_t value) {
+    if (reg == REG_IP) {
+        cpu.pc = value;
+    } else if (reg == REG_FLAGS) {
+        cpu.flags = value;
+    } else if ((uint32_t)reg < CPU_REGISTER_COUNT) {
+        cpu.registers[reg] = value;
+        if (reg == REG_SP) cpu.sp = value;
+        if (reg == REG_BP) cpu.bp = value;
+    }
+}
+
+void cpu_set_flag(uint32_t flag) {
+    cpu.flags |= flag;
+}
+
+void cpu_clear_flag(uint32_t flag) {
+    cpu.flags &= ~flag;
+}
+
+int cpu_test_flag(uint32_t flag) {
+    return (cpu.flags & flag) != 0;
+}
+
+void cpu_update_flags(uint32_t result) {
+    cpu.flags = cpu_flags_logic(cpu.flags, result);
+}
+
+void cpu_dump_registers(void) {
+    for (int i = 0; i < 8; i++) {
+        printf("R%d=%08X%s", i, cpu.registers[i], (i % 4 == 3) ? "\n" : "  ");
+    }
+    printf("SP=%08X  BP=%08X  IP=%08X  FLAGS=%08X\n",
+           cpu.registers[REG_SP], cpu.registers[REG_BP], cpu.pc, cpu.flags);
+}
+
+// ===== Performance and diagnostics =====
+
+CPUPerfCounters* cpu_get_performance_counters(void) {
+    return &cpu.perf;
+}
+
+void cpu_reset_performance_counters(void) {
+    if (cpu_cache_trace_pos) cpu_cache_trace_pos = cpu_cache_drain(cpu_cache_trace_pos);
+    memset(&cpu.perf, 0, sizeof(cpu.perf));
+    cpu_cache_reset_stats(&cpu.l1_cache);
+    cpu_cache_reset_stats(&cpu.l2_cache);
+    cpu_run_seconds = 0.0;
+    cpu_run_instructions = 0;
+}
+
+// Turn the L1/L2 model on or off.  Caches are built with the default
+// geometry the first time; cpu_cache_init() can reshape them beforehand.
+int cpu_cache_enable(int enabled) {
+    if (!enabled) {
+        if (cpu_cache_trace_pos) cpu_cache_drain(cpu_cache_trace_pos);
+        cpu_cache_trace_pos = NULL;
+        return 0;
+    }
+
+    if (!cpu.l2_cache.tags &&
+        cpu_cache_init(&cpu.l2_cache, CPU_L2_CACHE_SIZE, CPU_CACHE_LINE_SIZE, CPU_L2_CACHE_WAYS, NULL) != 0) {
+        return -1;
+    }
+    if (!cpu.l1_cache.tags &&
+        cpu_cache_init(&cpu.l1_cache, CPU_L1_CACHE_SIZE, CPU_CACHE_LINE_SIZE, CPU_L1_CACHE_WAYS, &cpu.l2_cache) != 0) {
+        return -1;
+    }
+    if (!cpu_cache_trace_pos) cpu_cache_trace_pos = cpu_cache_trace;
+    return 0;
+}
+
+int cpu_cache_is_enabled(void) {
+    return cpu_cache_trace_pos != NULL;
+}
+
+double cpu_get_cache_hit_ratio(void) {
+    if (cpu_cache_trace_pos) cpu_cache_trace_pos = cpu_cache_drain(cpu_cache_trace_pos);
+    uint64_t accesses = cpu.l1_cache.hits + cpu.l1_cache.misses;
+    return accesses ? (double)cpu.l1_cache.hits / (double)accesses : 0.0;
+}
+
+double cpu_get_mips(void) {
+    if (cpu_run_seconds <= 0.0) return 0.0;
+    return (double)cpu_run_instructions / cpu_run_seconds / 1e6;
+}
+
+const char* cpu_get_state_string(void) {
+    switch (cpu.state) {
+        case CPU_STATE_RESET:     return "reset";
+        case CPU_STATE_RUNNING:   return "running";
+        case CPU_STATE_HALTED:    return "halted";
+        case CPU_STATE_INTERRUPT: return "interrupt";
+        case CPU_STATE_EXCEPTION: return "exception";
+        case CPU_STATE_DEBUG:     return "debug";
+    }
+    return "unknown";
+}
+
+const char* cpu_instruction_to_string(uint32_t instruction) {
+    switch ((InstructionType)(instruction & 0xFF)) {
+        case INST_NOP:   return "NOP";
+        case INST_HALT:  return "HALT";
+        case INST_LOAD:  return "LOAD";
+        case INST_STORE: return "STORE";
+        case INST_MOVE:  return "MOVE";
+        case INST_ADD:   return "ADD";
+        case INST_SUB:   return "SUB";
+        case INST_MUL:   return "MUL";
+        case INST_DIV:   return "DIV";
+        case INST_AND:   return "AND";
+        case INST_OR:    return "OR";
+        case INST_XOR:   return "XOR";
+        case INST_NOT:   return "NOT";
+        case INST_CMP:   return "CMP";
+        case INST_JMP:   return "JMP";
+        case INST_JZ:    return "JZ";
+        case INST_JNZ:   return "JNZ";
+        case INST_CALL:  return "CALL";
+        case INST_RET:   return "RET";
+        case INST_PUSH:  return "PUSH";
+        case INST_POP:   return "POP";
+        case INST_INT:   return "INT";
+        case INST_IRET:  return "IRET";
+        case INST_HLT:   return "HLT";
+        case INST_CLI:   return "CLI";
+        case INST_STI:   return "STI";
+    }
+    return "???";
+}
+
+void cpu_print_state(void) {
+    printf("CPU state: %s (privilege %u)\n", cpu_get_state_string(), cpu.privilege_level);
+    cpu_dump_registers();
+}
+
+void cpu_print_performance(void) {
+    printf("Instructions: %llu\n", (unsigned long long)cpu.perf.instructions_executed);
+    printf("Branches:     %llu\n", (unsigned long long)cpu.perf.branch_predictions);
+    printf("Interrupts:   %llu\n", (unsigned long long)cpu.perf.interrupts_handled);
+    uint64_t lookups = cpu.perf.translation_hits + cpu.perf.translation_misses;
+    printf("Translations: %llu hits, %llu misses (%.2f%% hit), %llu invalidated, %llu flushes\n",
+           (unsigned long long)cpu.perf.translation_hits, (unsigned long long)cpu.perf.translation_misses,
+           lookups ? 100.0 * (double)cpu.perf.translation_hits / (double)lookups : 0.0,
+           (unsigned long long)cpu.perf.translation_invalidations, (unsigned long long)tc_flushes);
+    printf("MIPS:         %.1f\n", cpu_get_mips());
+    if (cpu_cache_is_enabled()) {
+        cpu_get_cache_hit_ratio();  // Runs anything still queued
+        cpu_cache_print_stats("L1", &cpu.l1_cache);
+        cpu_cache_print_stats("L2", &cpu.l2_cache);
+    }
+}
+
+// ===== Benchmark =====
+
+#define CPU_BENCH_CODE      0x00100000
+#define CPU_BENCH_DATA      0x00102000
+#define CPU_BENCH_STACK     0x00104000
+#define CPU_BENCH_SPAN      (CPU_BENCH_STACK - CPU_BENCH_CODE)
+#define CPU_BENCH_LOOP_LEN  10          // Instructions per loop iteration
+
+// Loop body mixing ALU, memory, call/return and a conditional branch:
+//   loop: ADD r1,r0; XOR r1,#0x5A5A; STORE [r2],r1; LOAD r3,[r2]; MUL r3,#3
+//         CALL func; SUB r0,#1; JNZ loop; HALT
+//   func: ADD r1,r3; RET
+static size_t cpu_bench_program(uint32_t* code, uint32_t iterations) {
+    size_t n = 0;
+    code[n++] = CPU_ENCODE(INST_LOAD, REG_R0, 0, CPU_MODE_IMM);     code[n++] = iterations;
+    code[n++] = CPU_ENCODE(INST_LOAD, REG_R1, 0, CPU_MODE_IMM);     code[n++] = 0;
+    code[n++] = CPU_ENCODE(INST_LOAD, REG_R2, 0, CPU_MODE_IMM);     code[n++] = CPU_BENCH_DATA;
+    code[n++] = CPU_ENCODE(INST_LOAD, REG_SP, 0, CPU_MODE_IMM);     code[n++] = CPU_BENCH_STACK;
+    uint32_t loop = CPU_BENCH_CODE + (uint32_t)n * 4;
+    code[n++] = CPU_ENCODE(INST_ADD, REG_R1, REG_R0, CPU_MODE_REG);
+    code[n++] = CPU_ENCODE(INST_XOR, REG_R1, 0, CPU_MODE_IMM);      code[n++] = 0x5A5A;
+    code[n++] = CPU_ENCODE(INST_STORE, REG_R2, REG_R1, CPU_MODE_REG);
+    code[n++] = CPU_ENCODE(INST_LOAD, REG_R3, REG_R2, CPU_MODE_MEM); code[n++] = 0;
+    code[n++] = CPU_ENCODE(INST_MUL, REG_R3, 0, CPU_MODE_IMM);      code[n++] = 3;
+    code[n++] = CPU_ENCODE(INST_CALL, 0, 0, CPU_MODE_IMM);
+    size_t call_target = n++;
+    code[n++] = CPU_ENCODE(INST_SUB, REG_R0, 0, CPU_MODE_IMM);      code[n++] = 1;
+    code[n++] = CPU_ENCODE(INST_JNZ, 0, 0, CPU_MODE_IMM);           code[n++] = loop;
+    code[n++] = CPU_ENCODE(INST_HALT, 0, 0, CPU_MODE_REG);
+    code[call_target] = CPU_BENCH_CODE + (uint32_t)n * 4;
+    code[n++] = CPU_ENCODE(INST_ADD, REG_R1, REG_R3, CPU_MODE_REG);
+    code[n++] = CPU_ENCODE(INST_RET, 0, 0, CPU_MODE_REG);
+    return n;
+}
+
+static uint32_t cpu_bench_expected(uint32_t iterations) {
+    uint32_t r0 = iterations, r1 = 0;
+    do {
+        r1 += r0;
+        r1 ^= 0x5A5A;
+        r1 += r1 * 3;
+    } while (--r0 != 0);
+    return r1;
+}
+
+// Load the program and run it to HALT: through the translation cache,
+// through plain unchained blocks, or as a plain interpreter that fetches
+// and decodes every instruction it runs.  Returns elapsed seconds or -1.
+#define CPU_BENCH_CHAINED   0
+#define CPU_BENCH_PLAIN     1
+#define CPU_BENCH_STEP      2
+
+static double cpu_bench_run(uint32_t iterations, int mode) {
+    uint32_t code[64];
+    size_t words = cpu_bench_program(code, iterations);
+    if (memory_write_block(CPU_BENCH_CODE, (const uint8_t*)code, words * 4) != 0) return -1;
+
+    cpu.pc = CPU_BENCH_CODE;
+    cpu.flags = 0;
+    cpu.running = 1;
+    cpu.state = CPU_STATE_RUNNING;
+    cpu.privilege_level = PRIVILEGE_KERNEL;
+
+    // Writing the program dropped any blocks there, so they are
+    // translated again the way this mode wants
+    tc_plain_blocks = mode == CPU_BENCH_PLAIN;
+    double start = cpu_now_seconds();
+    if (mode == CPU_BENCH_STEP) {
+        CPUBlock block;
+        uint64_t executed = 0;
+        while (cpu.running && cpu.state == CPU_STATE_RUNNING) {
+            cpu_decode_block(&block, cpu.pc, 1);
+            executed += cpu_execute(&cpu, &block, 1);
+        }
+        cpu_account(executed, cpu_now_seconds() - start);
+    } else {
+        while (cpu.running && cpu.state == CPU_STATE_RUNNING) cpu_run_slice(CPU_SLICE_INSTRUCTIONS);
+    }
+    double elapsed = cpu_now_seconds() - start;
+    tc_plain_blocks = 0;
+
+    if (cpu.state != CPU_STATE_HALTED || cpu.registers[REG_R1] != cpu_bench_expected(iterations)) {
+        printf("cpu_bench: wrong result (state %s, r1=%08X, expected %08X)\n",
+               cpu_get_state_string(), cpu.registers[REG_R1], cpu_bench_expected(iterations));
+        return -1;
+    }
+    return elapsed;
+}
+
+double cpu_bench(uint64_t instructions) {
+    if (instructions == 0) instructions = 100000000ULL;
+    if (instructions / CPU_BENCH_LOOP_LEN > 0xFFFFFFFFULL) instructions = 0xFFFFFFFFULL * CPU_BENCH_LOOP_LEN;
+    uint32_t iterations = (uint32_t)(instructions / CPU_BENCH_LOOP_LEN);
+    if (iterations == 0) iterations = 1;
+
+    if (memory_get_total() < CPU_BENCH_STACK || !cpu_prepare()) {
+        printf("cpu_bench: guest memory is not available\n");
+        return 0.0;
+    }
+
+    // The benchmark borrows guest memory and the CPU; put both back afterwards
+    uint8_t* saved_memory = malloc(CPU_BENCH_SPAN);
+    if (!saved_memory) {
+        printf("cpu_bench: out of memory\n");
+        return 0.0;
+    }
+    memory_read_block(CPU_BENCH_CODE, saved_memory, CPU_BENCH_SPAN);
+    CPUState saved = cpu;
+
+    uint64_t before = cpu.perf.instructions_executed;
+    double elapsed = cpu_bench_run(iterations, CPU_BENCH_CHAINED);
+    uint64_t executed = cpu.perf.instructions_executed - before;
+
+    // The slower paths get less work: plain blocks return to the slice
+    // loop after every few instructions, and the uncached path decodes
+    // every instruction again
+    uint32_t plain_iterations = iterations / 4 ? iterations / 4 : 1;
+    before = cpu.perf.instructions_executed;
+    double plain_elapsed = elapsed >= 0 ? cpu_bench_run(plain_iterations, CPU_BENCH_PLAIN) : -1;
+    uint64_t plain_executed = cpu.perf.instructions_executed - before;
+
+    uint32_t step_iterations = iterations / 20 ? iterations / 20 : 1;
+    before = cpu.perf.instructions_executed;
+    double step_elapsed = plain_elapsed >= 0 ? cpu_bench_run(step_iterations, CPU_BENCH_STEP) : -1;
+    uint64_t step_executed = cpu.perf.instructions_executed - before;
+
+    CPUPerfCounters perf = cpu.perf;
+    CPUCache l1 = cpu.l1_cache, l2 = cpu.l2_cache;
+    cpu = saved;
+    cpu.perf = perf;
+    cpu.l1_cache = l1;
+    cpu.l2_cache = l2;
+    memory_write_block(CPU_BENCH_CODE, saved_memory, CPU_BENCH_SPAN);
+    free(saved_memory);
+
+    if (elapsed < 0) return 0.0;
+
+    double mips = elapsed > 0 ? (double)executed / elapsed / 1e6 : 0.0;
+#ifdef CPU_THREADED_DISPATCH
+    const char* dispatch = "threaded";
+#else
+    const char* dispatch = "switch";
+#endif
+    double plain_mips = plain_elapsed > 0 ? (double)plain_executed / plain_elapsed / 1e6 : 0.0;
+    double step_mips = step_elapsed > 0 ? (double)step_executed / step_elapsed / 1e6 : 0.0;
+    printf("cpu_bench: %s dispatch\n", dispatch);
+    printf("  %-34s %14s %9s %10s %9s\n", "", "Instructions", "Time", "MIPS", "Speedup");
+    printf("  %-34s %14llu %7.3f s %10.1f %8.2fx\n", "Translated, chained blocks",
+           (unsigned long long)executed, elapsed, mips, step_mips > 0 ? mips / step_mips : 0.0);
+    if (plain_elapsed > 0) {
+        printf("  %-34s %14llu %7.3f s %10.1f %8.2fx\n", "Plain blocks, no chaining",
+               (unsigned long long)plain_executed, plain_elapsed, plain_mips,
+               step_mips > 0 ? plain_mips / step_mips : 0.0);
+    }
+    if (step_elapsed > 0) {
+        printf("  %-34s %14llu %7.3f s %10.1f %8.2fx\n", "Plain interpreter, decode each",
+               (unsigned long long)step_executed, step_elapsed, step_mips, 1.0);
+    }
+
+    // The goal was 10x over the plain interpreter; chaining alone, against
+    // blocks that are decoded once but not chained, is a smaller step
+    if (step_mips > 0) {
+        double speedup = mips / step_mips;
+        printf("  Target 10x over the plain interpreter: %.1fx, %s\n", speedup, speedup >= 10.0 ? "met" : "MISSED");
+    }
+    if (plain_mips > 0) printf("  Chaining and fusion over plain blocks: %.2fx\n", mips / plain_mips);
+    return mips;
+}
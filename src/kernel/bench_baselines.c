@@ -0,0 +1,149 @@
+#include "kernel/bench_baselines.h"
+#include "kernel/mmu.h"
+#include <stdlib.h>
+
+// ===== Frame bit scan =====
+
+int frame_scan_init(FrameScan* scan, uint32_t frames) {
+    scan->total_frames = frames;
+    scan->first_free_frame = 0;
+    scan->bitmap = calloc((frames + 31) / 32, sizeof(uint32_t));
+    return scan->bitmap ? 0 : -1;
+}
+
+void frame_scan_destroy(FrameScan* scan) {
+    free(scan->bitmap);
+    scan->bitmap = NULL;
+}
+
+uint32_t frame_scan_alloc(FrameScan* scan) {
+    for (uint32_t frame = scan->first_free_frame; frame < scan->total_frames; frame++) {
+        if (!(scan->bitmap[frame / 32] & (1u << (frame % 32)))) {
+            scan->bitmap[frame / 32] |= 1u << (frame % 32);
+            scan->first_free_frame = frame + 1;
+            return frame;
+        }
+    }
+    return FRAME_INVALID;
+}
+
+void frame_scan_free(FrameScan* scan, uint32_t frame) {
+    scan->bitmap[frame / 32] &= ~(1u << (frame % 32));
+    if (frame < scan->first_free_frame) scan->first_free_frame = frame;
+}
+
+// ===== Linked-list run queue =====
+
+struct LegacyNode {
+    Process* process;
+    struct LegacyNode* next;
+    struct LegacyNode* prev;
+};
+
+void legacy_enqueue(LegacyQueue* queue, Process* process) {
+    LegacyNode* node = (LegacyNode*)malloc(sizeof(LegacyNode));
+    if (!node) return;
+    node->process = process;
+    node->next = NULL;
+    node->prev = queue->tail;
+    if (queue->tail) queue->tail->next = node; else queue->head = node;
+    queue->tail = node;
+}
+
+static void legacy_unlink(LegacyQueue* queue, LegacyNode* node) {
+    if (node->prev) node->prev->next = node->next; else queue->head = node->next;
+    if (node->next) node->next->prev = node->prev; else queue->tail = node->prev;
+    free(node);
+}
+
+Process* legacy_pick(LegacyQueue* levels) {
+    for (int i = 0; i < SCHEDULER_MAX_QUEUES; i++) {
+        if (levels[i].head) {
+            Process* process = levels[i].head->process;
+            legacy_unlink(&levels[i], levels[i].head);
+            return process;
+        }
+    }
+    return NULL;
+}
+
+void legacy_remove(LegacyQueue* levels, Process* process) {
+    for (int i = 0; i < SCHEDULER_MAX_QUEUES; i++) {
+        for (LegacyNode* node = levels[i].head; node; node = node->next) {
+            if (node->process == process) {
+                legacy_unlink(&levels[i], node);
+                return;
+            }
+        }
+    }
+}
+
+void legacy_clear(LegacyQueue* levels) {
+    for (int i = 0; i < SCHEDULER_MAX_QUEUES; i++) {
+        while (levels[i].head) legacy_unlink(&levels[i], levels[i].head);
+    }
+}
+
+// ===== Timer heap =====
+
+int timer_heap_init(TimerHeap* h, uint32_t capacity) {
+    h->heap = (uint32_t*)malloc(capacity * sizeof(uint32_t));
+    h->pos = (uint32_t*)malloc(capacity * sizeof(uint32_t));
+    h->expires = (uint64_t*)malloc(capacity * sizeof(uint64_t));
+    h->count = 0;
+    if (h->heap && h->pos && h->expires) return 0;
+    timer_heap_destroy(h);
+    return -1;
+}
+
+void timer_heap_destroy(TimerHeap* h) {
+    free(h->heap);
+    free(h->pos);
+    free(h->expires);
+    h->heap = h->pos = NULL;
+    h->expires = NULL;
+    h->count = 0;
+}
+
+static void heap_place(TimerHeap* h, uint32_t slot, uint32_t id) {
+    h->heap[slot] = id;
+    h->pos[id] = slot;
+}
+
+static void heap_sift_up(TimerHeap* h, uint32_t slot) {
+    uint32_t id = h->heap[slot];
+    while (slot > 0) {
+        uint32_t parent = (slot - 1) / 2;
+        if (h->expires[h->heap[parent]] <= h->expires[id]) break;
+        heap_place(h, slot, h->heap[parent]);
+        slot = parent;
+    }
+    heap_place(h, slot, id);
+}
+
+static void heap_sift_down(TimerHeap* h, uint32_t slot) {
+    uint32_t id = h->heap[slot];
+    for (;;) {
+        uint32_t child = slot * 2 + 1;
+        if (child >= h->count) break;
+        if (child + 1 < h->count && h->expires[h->heap[child + 1]] < h->expires[h->heap[child]]) child++;
+        if (h->expires[h->heap[child]] >= h->expires[id]) break;
+        heap_place(h, slot, h->heap[child]);
+        slot = child;
+    }
+    heap_place(h, slot, id);
+}
+
+void timer_heap_push(TimerHeap* h, uint32_t id, uint64_t expires) {
+    h->expires[id] = expires;
+    h->heap[h->count] = id;
+    heap_sift_up(h, h->count++);
+}
+
+void timer_heap_remove(TimerHeap* h, uint32_t id) {
+    uint32_t slot = h->pos[id];
+    if (--h->count == slot) return;
+    heap_place(h, slot, h->heap[h->count]);
+    heap_sift_down(h, slot);
+    heap_sift_up(h, h->pos[h->heap[slot]]);
+}
@@ -0,0 +1,466 @@
+#include "kernel/fib.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#define FIB_CACHE_SETS      (1u << (FIB_CACHE_BITS - 1))   // Two ways each
+#define FIB_DIRECT_SLOTS    (1u << FIB_DIRECT_BITS)
+
+// A route, or a branch where prefixes part.  Every node's key extends its
+// parent's; child[b] holds the keys whose bit `length` is b.  Branch
+// nodes (no value) always have both children.
+typedef struct FibNode {
+    struct FibNode* child[2];
+    void* value;
+    uint32_t key;                   // Bits past `length` are zero
+    uint8_t length;
+} FibNode;
+
+// Where a lookup resumes for addresses with these top bits: the first
+// node on their path at least FIB_DIRECT_BITS long, with the best route
+// seen above it
+typedef struct {
+    FibNode* node;
+    void* value;
+} FibDirect;
+
+typedef struct {
+    uint32_t addr;
+    uint32_t generation;            // Valid while it equals the FIB's
+    void* value;                    // NULL: no route
+} FibCacheEntry;
+
+struct Fib {
+    FibNode* root;
+    uint32_t generation;            // Bumped by every route change
+    FibStats stats;
+    FibCacheEntry cache[FIB_CACHE_SETS][2];     // Most recent way first
+    FibDirect direct[FIB_DIRECT_SLOTS];
+};
+
+static double fib_now_seconds(void) {
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+}
+
+uint32_t fib_length_mask(int length) {
+    return length <= 0 ? 0 : 0xFFFFFFFFu << (32 - length);
+}
+
+int fib_mask_length(uint32_t mask) {
+    int length = mask ? __builtin_popcount(mask) : 0;
+    return fib_length_mask(length) == mask ? length : -1;
+}
+
+static inline int fib_bit(uint32_t key, int index) {
+    return (key >> (31 - index)) & 1;
+}
+
+static FibNode* fib_node_new(Fib* fib, uint32_t key, int length, void* value) {
+    FibNode* node = (FibNode*)calloc(1, sizeof(FibNode));
+    if (!node) return NULL;
+    node->key = key;
+    node->length = (uint8_t)length;
+    node->value = value;
+    fib->stats.nodes++;
+    return node;
+}
+
+// Recompute the direct slots under a prefix
+static void fib_direct_fill(Fib* fib, uint32_t key, int length) {
+    uint32_t count = length >= FIB_DIRECT_BITS ? 1 : 1u << (FIB_DIRECT_BITS - length);
+    uint32_t first = (key >> (32 - FIB_DIRECT_BITS)) & ~(count - 1);
+    for (uint32_t slot = first; slot < first + count; slot++) {
+        uint32_t addr = slot << (32 - FIB_DIRECT_BITS);
+        void* best = NULL;
+        FibNode* node = fib->root;
+        while (node && node->length < FIB_DIRECT_BITS && !((addr ^ node->key) & fib_length_mask(node->length))) {
+            if (node->value) best = node->value;
+            node = node->child[fib_bit(addr, node->length)];
+        }
+        fib->direct[slot].node = node;
+        fib->direct[slot].value = best;
+    }
+}
+
+// The link on `key`'s side of `parent` (NULL: the root) changed.  Slots
+// resume at the first node at least FIB_DIRECT_BITS long, so only below a
+// shorter parent are there slots that can reach the link.
+static void fib_direct_relink(Fib* fib, const FibNode* parent, uint32_t key) {
+    if (!parent) {
+        fib_direct_fill(fib, 0, 0);
+    } else if (parent->length < FIB_DIRECT_BITS) {
+        int length = parent->length + 1;
+        fib_direct_fill(fib, key & fib_length_mask(length), length);
+    }
+}
+
+// A node's value changed; slots resuming below it carry it as their best
+static void fib_direct_revalue(Fib* fib, const FibNode* node) {
+    if (node->length < FIB_DIRECT_BITS) fib_direct_fill(fib, node->key, node->length);
+}
+
+static void fib_changed(Fib* fib) {
+    if (++fib->generation == 0) {
+        memset(fib->cache, 0, sizeof(fib->cache));
+        fib->generation = 1;
+    }
+}
+
+Fib* fib_create(void) {
+    Fib* fib = (Fib*)calloc(1, sizeof(Fib));
+    if (fib) fib->generation = 1;
+    return fib;
+}
+
+static void fib_free_nodes(FibNode* node, void (*release)(void* value)) {
+    if (!node) return;
+    fib_free_nodes(node->child[0], release);
+    fib_free_nodes(node->child[1], release);
+    if (node->value && release) release(node->value);
+    free(node);
+}
+
+void fib_destroy(Fib* fib, void (*release)(void* value)) {
+    if (!fib) return;
+    fib_free_nodes(fib->root, release);
+    free(fib);
+}
+
+int fib_insert(Fib* fib, uint32_t prefix, int length, void* value) {
+    if (length < 0 || length > 32 || !value) return -1;
+    uint32_t key = prefix & fib_length_mask(length);
+
+    FibNode** link = &fib->root;
+    FibNode* parent = NULL;
+    while (*link) {
+        FibNode* node = *link;
+        uint32_t diff = key ^ node->key;
+        int common = diff ? __builtin_clz(diff) : 32;
+        if (common > length) common = length;
+        if (common > node->length) common = node->length;
+
+        if (common == node->length) {
+            if (length == node->length) {
+                if (node->value) return 1;
+                node->value = value;        // A branch becomes a route
+                fib_direct_revalue(fib, node);
+                break;
+            }
+            parent = node;
+            link = &node->child[fib_bit(key, node->length)];
+            continue;
+        }
+
+        // The new prefix parts from this node's above it: it either
+        // contains the node or needs a branch where they differ
+        FibNode* added = fib_node_new(fib, key, length, value);
+        if (!added) return -1;
+        if (common == length) {
+            added->child[fib_bit(node->key, length)] = node;
+            *link = added;
+        } else {
+            FibNode* branch = fib_node_new(fib, key & fib_length_mask(common), common, NULL);
+            if (!branch) {
+                free(added);
+                fib->stats.nodes--;
+                return -1;
+            }
+            branch->child[fib_bit(key, common)] = added;
+            branch->child[fib_bit(node->key, common)] = node;
+            *link = branch;
+        }
+        fib_direct_relink(fib, parent, key);
+        break;
+    }
+    if (!*link) {
+        if (!(*link = fib_node_new(fib, key, length, value))) return -1;
+        fib_direct_relink(fib, parent, key);
+    }
+
+    fib->stats.routes++;
+    fib->stats.inserts++;
+    fib_changed(fib);
+    return 0;
+}
+
+// The deepest route on the path of `prefix` whose key is the address itself
+static int fib_exact_length(const Fib* fib, uint32_t prefix) {
+    int length = -1;
+    for (FibNode* node = fib->root; node && !((prefix ^ node->key) & fib_length_mask(node->length));
+         node = node->length < 32 ? node->child[fib_bit(prefix, node->length)] : NULL) {
+        if (node->value && node->key == prefix) length = node->length;
+    }
+    return length;
+}
+
+void* fib_remove(Fib* fib, uint32_t prefix, int length) {
+    if (length < 0) length = fib_exact_length(fib, prefix);
+    if (length < 0 || length > 32) return NULL;
+
+    uint32_t key = prefix & fib_length_mask(length);
+    FibNode** link = &fib->root;
+    FibNode** parent_link = NULL;
+    FibNode* grandparent = NULL;
+    while (*link && (*link)->length < length && !((key ^ (*link)->key) & fib_length_mask((*link)->length))) {
+        grandparent = parent_link ? *parent_link : NULL;
+        parent_link = link;
+        link = &(*link)->child[fib_bit(key, (*link)->length)];
+    }
+    FibNode* node = *link;
+    if (!node || node->length != length || node->key != key || !node->value) return NULL;
+
+    void* value = node->value;
+    node->value = NULL;
+    if (node->child[0] && node->child[1]) {
+        fib_direct_revalue(fib, node);      // Stays on as a branch
+    } else {
+        // Splice it out; a branch left above with one child goes too
+        FibNode* child = node->child[0] ? node->child[0] : node->child[1];
+        FibNode* parent = parent_link ? *parent_link : NULL;
+        *link = child;
+        free(node);
+        fib->stats.nodes--;
+        if (!child && parent && !parent->value) {
+            *parent_link = parent->child[0] ? parent->child[0] : parent->child[1];
+            free(parent);
+            fib->stats.nodes--;
+            fib_direct_relink(fib, grandparent, key);
+        } else {
+            fib_direct_relink(fib, parent, key);
+        }
+    }
+
+    fib->stats.routes--;
+    fib->stats.removes++;
+    fib_changed(fib);
+    return value;
+}
+
+void* fib_get(const Fib* fib, uint32_t prefix, int length) {
+    if (length < 0) length = fib_exact_length(fib, prefix);
+    if (length < 0 || length > 32) return NULL;
+    uint32_t key = prefix & fib_length_mask(length);
+    FibNode* node = fib->root;
+    while (node && node->length < length && !((key ^ node->key) & fib_length_mask(node->length))) {
+        node = node->child[fib_bit(key, node->length)];
+    }
+    return node && node->length == length && node->key == key ? node->value : NULL;
+}
+
+// The trie walk behind fib_lookup(), without the cache.  The direct
+// slot for the top bits skips the nodes above FIB_DIRECT_BITS.
+static void* fib_match(const Fib* fib, uint32_t addr) {
+    const FibDirect* slot = &fib->direct[addr >> (32 - FIB_DIRECT_BITS)];
+    void* best = slot->value;
+    FibNode* node = slot->node;
+    while (node && !((addr ^ node->key) & fib_length_mask(node->length))) {
+        if (node->value) best = node->value;
+        if (node->length == 32) break;
+        node = node->child[fib_bit(addr, node->length)];
+    }
+    return best;
+}
+
+void* fib_lookup(Fib* fib, uint32_t addr) {
+    FibCacheEntry* set = fib->cache[(addr * 2654435761u) >> (33 - FIB_CACHE_BITS)];
+    fib->stats.lookups++;
+    if (set[0].generation == fib->generation && set[0].addr == addr) {
+        fib->stats.cache_hits++;
+        return set[0].value;
+    }
+    if (set[1].generation == fib->generation && set[1].addr == addr) {
+        FibCacheEntry hit = set[1];
+        set[1] = set[0];
+        set[0] = hit;
+        fib->stats.cache_hits++;
+        return hit.value;
+    }
+
+    set[1] = set[0];
+    set[0].addr = addr;
+    set[0].generation = fib->generation;
+    set[0].value = fib_match(fib, addr);
+    return set[0].value;
+}
+
+static void fib_walk_nodes(const FibNode* node, FibVisit visit, void* arg) {
+    if (!node) return;
+    if (node->value) visit(node->key, node->length, node->value, arg);
+    fib_walk_nodes(node->child[0], visit, arg);
+    fib_walk_nodes(node->child[1], visit, arg);
+}
+
+void fib_walk(const Fib* fib, FibVisit visit, void* arg) {
+    fib_walk_nodes(fib->root, visit, arg);
+}
+
+uint32_t fib_count(const Fib* fib) {
+    return fib ? (uint32_t)fib->stats.routes : 0;
+}
+
+const FibStats* fib_get_stats(const Fib* fib) {
+    return &fib->stats;
+}
+
+// ===== Benchmark =====
+
+typedef struct {
+    uint32_t prefix;
+    int length;
+    int inserted;                   // 0 for a duplicate of an earlier prefix
+} FibBenchRoute;
+
+// Nodes visited on the way to each route
+static void fib_depth(const FibNode* node, uint32_t depth, uint32_t* deepest, uint64_t* total) {
+    if (!node) return;
+    if (node->value) {
+        *total += depth;
+        if (depth > *deepest) *deepest = depth;
+    }
+    fib_depth(node->child[0], depth + 1, deepest, total);
+    fib_depth(node->child[1], depth + 1, deepest, total);
+}
+
+// What a route table array costs: every route checked for every lookup
+static void* fib_bench_scan(FibBenchRoute* routes, uint32_t count, uint32_t addr) {
+    FibBenchRoute* best = NULL;
+    for (uint32_t i = 0; i < count; i++) {
+        if (routes[i].inserted && !((addr ^ routes[i].prefix) & fib_length_mask(routes[i].length)) &&
+            (!best || routes[i].length > best->length)) {
+            best = &routes[i];
+        }
+    }
+    return best;
+}
+
+// A table shaped like a backbone's: mostly /24s, then /16-/23, a few
+// shorter and longer prefixes, and a default route.  Lookups go half to
+// hosts inside a random route and half to random addresses.
+void fib_benchmark(uint32_t count, uint32_t lookups) {
+    if (count == 0) count = 100000;
+    if (lookups == 0) lookups = 1000000;
+
+    Fib* fib = fib_create();
+    FibBenchRoute* routes = (FibBenchRoute*)malloc(((size_t)count + 1) * sizeof(FibBenchRoute));
+    uint32_t* addrs = (uint32_t*)malloc(lookups * sizeof(uint32_t));
+    void** results = (void**)malloc(lookups * sizeof(void*));
+    if (!fib || !routes || !addrs || !results) {
+        printf("bench route: out of memory\n");
+        fib_destroy(fib, NULL);
+        free(routes);
+        free(addrs);
+        free(results);
+        return;
+    }
+
+    uint32_t seed = 0x2545F491;
+#define FIB_BENCH_RANDOM() (seed ^= seed << 13, seed ^= seed >> 17, seed ^= seed << 5, seed)
+    routes[0].prefix = 0;
+    routes[0].length = 0;
+    for (uint32_t i = 1; i <= count; i++) {
+        uint32_t shape = FIB_BENCH_RANDOM() % 100;
+        int length = shape < 60 ? 24 : shape < 88 ? 16 + (int)(FIB_BENCH_RANDOM() % 8)
+                   : shape < 96 ? 8 + (int)(FIB_BENCH_RANDOM() % 8) : 25 + (int)(FIB_BENCH_RANDOM() % 8);
+        routes[i].prefix = FIB_BENCH_RANDOM() & fib_length_mask(length);
+        routes[i].length = length;
+    }
+    for (uint32_t i = 0; i < lookups; i++) {
+        uint32_t addr = FIB_BENCH_RANDOM();
+        if (i & 1) {
+            FibBenchRoute* route = &routes[1 + addr % count];
+            addr = route->prefix | (FIB_BENCH_RANDOM() & ~fib_length_mask(route->length));
+        }
+        addrs[i] = addr;
+    }
+#undef FIB_BENCH_RANDOM
+
+    static const char* const phases[] = { "insert", "trie", "cached, random", "cached, hot", "linear scan",
+                                          "remove" };
+    uint64_t ops[6];
+    double seconds[6];
+    int ok[6] = { 1, 1, 1, 1, 1, 1 };
+
+    uint32_t distinct = 0;
+    double start = fib_now_seconds();
+    for (uint32_t i = 0; i <= count; i++) {
+        int result = fib_insert(fib, routes[i].prefix, routes[i].length, &routes[i]);
+        routes[i].inserted = result == 0;
+        distinct += result == 0;
+        ok[0] &= result >= 0;
+    }
+    seconds[0] = fib_now_seconds() - start;
+    ops[0] = (uint64_t)count + 1;
+    ok[0] &= fib_count(fib) == distinct;
+
+    uint64_t nodes = fib->stats.nodes;
+    uint32_t deepest = 0;
+    uint64_t total_depth = 0;
+    fib_depth(fib->root, 1, &deepest, &total_depth);
+
+    start = fib_now_seconds();
+    for (uint32_t i = 0; i < lookups; i++) {
+        results[i] = fib_match(fib, addrs[i]);
+    }
+    seconds[1] = fib_now_seconds() - start;
+    ops[1] = lookups;
+
+    uint64_t hits = fib->stats.cache_hits;
+    start = fib_now_seconds();
+    for (uint32_t i = 0; i < lookups; i++) {
+        ok[2] &= fib_lookup(fib, addrs[i]) == results[i];
+    }
+    seconds[2] = fib_now_seconds() - start;
+    ops[2] = lookups;
+    uint64_t random_hits = fib->stats.cache_hits - hits;
+
+    // A working set of 1024 destinations stays in the cache
+    hits = fib->stats.cache_hits;
+    start = fib_now_seconds();
+    for (uint32_t i = 0; i < lookups; i++) {
+        ok[3] &= fib_lookup(fib, addrs[i & 1023]) == results[i & 1023];
+    }
+    seconds[3] = fib_now_seconds() - start;
+    ops[3] = lookups;
+    uint64_t hot_hits = fib->stats.cache_hits - hits;
+
+    // Keep the scan to about 10^8 route checks; it also checks the trie
+    ops[4] = 100000000 / ((uint64_t)count + 1);
+    if (ops[4] > lookups) ops[4] = lookups;
+    if (ops[4] < 10) ops[4] = lookups < 10 ? lookups : 10;
+    start = fib_now_seconds();
+    for (uint32_t i = 0; i < ops[4]; i++) {
+        ok[4] &= fib_bench_scan(routes, count + 1, addrs[i]) == results[i];
+    }
+    seconds[4] = fib_now_seconds() - start;
+    ok[1] = ok[4];
+
+    start = fib_now_seconds();
+    for (uint32_t i = 0; i <= count; i++) {
+        if (routes[i].inserted) ok[5] &= fib_remove(fib, routes[i].prefix, routes[i].length) == &routes[i];
+    }
+    seconds[5] = fib_now_seconds() - start;
+    ops[5] = distinct;
+    ok[5] &= fib_count(fib) == 0 && fib->stats.nodes == 0 && fib->root == NULL;
+
+    printf("bench route: %u routes (%u distinct prefixes), %u lookups\n", count + 1, distinct, lookups);
+    printf("  %-16s %10s %10s %8s\n", "", "Ops", "ns/op", "Check");
+    for (int phase = 0; phase < 6; phase++) {
+        printf("  %-16s %10llu %10.1f %8s\n", phases[phase], (unsigned long long)ops[phase],
+               ops[phase] ? seconds[phase] * 1e9 / (double)ops[phase] : 0.0, ok[phase] ? "ok" : "FAILED");
+    }
+    printf("  Trie: %llu nodes (%.2f per route, %llu KB), route depth %.1f average, %u deepest\n",
+           (unsigned long long)nodes, distinct ? (double)nodes / distinct : 0.0,
+           (unsigned long long)(nodes * sizeof(FibNode) >> 10),
+           distinct ? (double)total_depth / distinct : 0.0, deepest);
+    printf("  Cache: %.1f%% hits on random destinations, %.1f%% on the hot set\n",
+           lookups ? 100.0 * random_hits / lookups : 0.0, lookups ? 100.0 * hot_hits / lookups : 0.0);
+
+    fib_destroy(fib, NULL);
+    free(routes);
+    free(addrs);
+    free(results);
+}
@@ -0,0 +1,609 @@
+#include "kernel/mmu.h"
+#include "kernel/bench_baselines.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+// Physical frame allocator.
+//
+// Free memory is kept as buddy blocks of 2^order frames, naturally aligned.
+// Each order has a bitmap with one bit per possible block; finding a block
+// is a ctz over 64-bit words starting at a per-order hint, and the lowest
+// nonempty order at or above a request comes from another ctz over
+// order_mask.  Frees coalesce with their buddy while it is free too.
+//
+// Single frames, by far the common case, go through a per-CPU cache that is
+// refilled and flushed FRAME_CPU_BATCH frames at a time, so most of them
+// never touch the buddy maps.  Cached frames are free but not coalesced;
+// contiguous requests that fail drain the caches and retry.
+//
+// fa->lock covers the buddy maps, the held map and share counts.  A cache
+// is claimed with an interlocked flag by the thread using it, so the
+// single-frame fast path takes no lock; a thread that finds its cache
+// claimed, by a drain or another thread on the same index, goes to the
+// buddy maps under the lock instead.  The fast path also sets and clears
+// frame bits and counters, so those are only changed with interlocked ops.
+
+static FrameAllocator g_frames;
+
+// Each host thread picks its own vCPU (frame cache, TLB, address space),
+// so a switch on one vCPU cannot point another thread at the wrong one
+_Thread_local uint32_t mmu_current_cpu = 0;
+
+static inline uint32_t frame_ctz(uint64_t value) {
+    return (uint32_t)__builtin_ctzll(value);
+}
+
+static inline int frame_test(const uint64_t* map, uint32_t bit) {
+    return (int)((map[bit >> 6] >> (bit & 63)) & 1);
+}
+
+static inline void frame_set(uint64_t* map, uint32_t bit) {
+    map[bit >> 6] |= 1ULL << (bit & 63);
+}
+
+static inline void frame_clear(uint64_t* map, uint32_t bit) {
+    map[bit >> 6] &= ~(1ULL << (bit & 63));
+}
+
+static inline void frame_set_atomic(uint64_t* map, uint32_t bit) {
+    InterlockedOr64((volatile LONG64*)&map[bit >> 6], (LONG64)(1ULL << (bit & 63)));
+}
+
+static inline void frame_clear_atomic(uint64_t* map, uint32_t bit) {
+    InterlockedAnd64((volatile LONG64*)&map[bit >> 6], (LONG64)~(1ULL << (bit & 63)));
+}
+
+static inline void frame_count(FrameAllocator* fa, int32_t used) {
+    InterlockedExchangeAdd((volatile LONG*)&fa->used_frames, used);
+    InterlockedExchangeAdd((volatile LONG*)&fa->free_frames, -used);
+}
+
+static uint32_t frame_map_words(uint32_t bits) {
+    return (bits + 63) / 64;
+}
+
+// Set or clear count consecutive bits of a per-frame map, a word at a
+// time; `atomic` for the frame bitmap, which the fast path changes too
+static void frame_mark(uint64_t* map, uint32_t start, uint32_t count, int used, int atomic) {
+    while (count > 0) {
+        uint32_t offset = start & 63;
+        uint32_t run = 64 - offset < count ? 64 - offset : count;
+        uint64_t bits = (run == 64 ? ~0ULL : ((1ULL << run) - 1)) << offset;
+        volatile LONG64* word = (volatile LONG64*)&map[start >> 6];
+        if (atomic && used) InterlockedOr64(word, (LONG64)bits);
+        else if (atomic) InterlockedAnd64(word, (LONG64)~bits);
+        else if (used) map[start >> 6] |= bits;
+        else map[start >> 6] &= ~bits;
+        start += run;
+        count -= run;
+    }
+}
+
+static void frame_push_block(FrameAllocator* fa, uint32_t block, uint32_t order) {
+    frame_set(fa->free_map[order], block);
+    fa->free_blocks[order]++;
+    fa->order_mask |= 1u << order;
+    if ((block >> 6) < fa->search[order]) fa->search[order] = block >> 6;
+}
+
+static void frame_pop_block(FrameAllocator* fa, uint32_t block, uint32_t order) {
+    frame_clear(fa->free_map[order], block);
+    if (--fa->free_blocks[order] == 0) fa->order_mask &= ~(1u << order);
+}
+
+// Lowest free block of exactly this order; the caller knows there is one
+static uint32_t frame_find_block(FrameAllocator* fa, uint32_t order) {
+    const uint64_t* map = fa->free_map[order];
+    uint32_t words = frame_map_words(fa->total_frames >> order);
+
+    for (uint32_t word = fa->search[order]; word < words; word++) {
+        if (map[word]) {
+            fa->search[order] = word;
+            return (word << 6) + frame_ctz(map[word]);
+        }
+    }
+    return FRAME_INVALID;
+}
+
+// Take a block of 2^order frames, splitting a larger one if needed.
+// Returns its first frame, not yet marked allocated.
+static uint32_t frame_take_block(FrameAllocator* fa, uint32_t order) {
+    uint32_t available = fa->order_mask >> order;
+    if (!available) return FRAME_INVALID;
+
+    uint32_t from = order + frame_ctz(available);
+    uint32_t block = frame_find_block(fa, from);
+    if (block == FRAME_INVALID) return FRAME_INVALID;
+    frame_pop_block(fa, block, from);
+
+    // Keep the lower half, hand the upper half back at each level
+    while (from > order) {
+        from--;
+        block <<= 1;
+        frame_push_block(fa, block | 1, from);
+    }
+    frame_mark(fa->held, block << order, 1u << order, 1, 0);
+    return block << order;
+}
+
+// Return a free block, merging with its buddy as far up as possible
+static void frame_release_block(FrameAllocator* fa, uint32_t frame, uint32_t order) {
+    uint32_t block = frame >> order;
+    frame_mark(fa->held, frame, 1u << order, 0, 0);
+
+    while (order < FRAME_MAX_ORDER) {
+        uint32_t buddy = block ^ 1;
+        if (buddy >= (fa->total_frames >> order) || !frame_test(fa->free_map[order], buddy)) break;
+        frame_pop_block(fa, buddy, order);
+        block >>= 1;
+        order++;
+    }
+    frame_push_block(fa, block, order);
+}
+
+// Return an arbitrary run of free frames as the largest aligned blocks that fit
+static void frame_release_range(FrameAllocator* fa, uint32_t start, uint32_t count) {
+    while (count > 0) {
+        uint32_t order = start ? frame_ctz(start) : FRAME_MAX_ORDER;
+        if (order > FRAME_MAX_ORDER) order = FRAME_MAX_ORDER;
+        while ((1u << order) > count) order--;
+        frame_release_block(fa, start, order);
+        start += 1u << order;
+        count -= 1u << order;
+    }
+}
+
+static int frame_init(FrameAllocator* fa, uint32_t total_frames) {
+    memset(fa, 0, sizeof(*fa));
+    InitializeCriticalSection(&fa->lock);
+    fa->total_frames = total_frames;
+    fa->bitmap = calloc(frame_map_words(total_frames), sizeof(uint64_t));
+    fa->held = calloc(frame_map_words(total_frames), sizeof(uint64_t));
+    fa->shares = calloc(total_frames ? total_frames : 1, sizeof(uint16_t));
+    if (!fa->bitmap || !fa->held || !fa->shares) return -1;
+    for (uint32_t order = 0; order < FRAME_ORDERS; order++) {
+        fa->free_map[order] = calloc(frame_map_words(total_frames >> order) + 1, sizeof(uint64_t));
+        if (!fa->free_map[order]) return -1;
+    }
+
+    frame_release_range(fa, 0, total_frames);
+    fa->free_frames = total_frames;
+    return 0;
+}
+
+// Only for an allocator frame_init() has seen, successfully or not
+static void frame_destroy(FrameAllocator* fa) {
+    free(fa->bitmap);
+    free(fa->held);
+    free(fa->shares);
+    for (uint32_t order = 0; order < FRAME_ORDERS; order++) free(fa->free_map[order]);
+    DeleteCriticalSection(&fa->lock);
+    memset(fa, 0, sizeof(*fa));
+}
+
+static int frame_cache_claim(FrameCache* cache) {
+    return InterlockedCompareExchange(&cache->busy, 1, 0) == 0;
+}
+
+static void frame_cache_unclaim(FrameCache* cache) {
+    InterlockedExchange(&cache->busy, 0);
+}
+
+// Move up to count frames from the end of a CPU cache back to the buddy
+// maps.  The lock is held and the cache claimed.
+static void frame_cache_flush(FrameAllocator* fa, FrameCache* cache, uint32_t count) {
+    while (count-- > 0 && cache->count > 0) {
+        frame_release_block(fa, cache->frames[--cache->count], 0);
+    }
+}
+
+// Empty every cache no other thread is using; the lock is held
+static int frame_drain_caches(FrameAllocator* fa) {
+    int drained = 0;
+    for (int cpu = 0; cpu < FRAME_CPU_COUNT; cpu++) {
+        FrameCache* cache = &fa->cpu_cache[cpu];
+        if (cache->count == 0 || !frame_cache_claim(cache)) continue;
+        drained |= cache->count > 0;
+        frame_cache_flush(fa, cache, FRAME_CPU_CACHE);
+        frame_cache_unclaim(cache);
+    }
+    if (drained) fa->cache_drains++;
+    return drained;
+}
+
+static void frame_cache_refill(FrameAllocator* fa, FrameCache* cache) {
+    uint32_t batch_order = 0;
+    while ((1u << (batch_order + 1)) <= FRAME_CPU_BATCH) batch_order++;
+
+    // One batch-sized block if there is one, else whatever singles are left.
+    // Stored highest first so the cache hands out low frames first.
+    uint32_t frame = frame_take_block(fa, batch_order);
+    if (frame != FRAME_INVALID) {
+        for (uint32_t i = 1u << batch_order; i-- > 0;) cache->frames[cache->count++] = frame + i;
+    } else {
+        while (cache->count < FRAME_CPU_BATCH && (frame = frame_take_block(fa, 0)) != FRAME_INVALID) {
+            cache->frames[cache->count++] = frame;
+        }
+    }
+    fa->cache_refills++;
+}
+
+static uint32_t frame_alloc_one(FrameAllocator* fa, uint32_t cpu) {
+    FrameCache* cache = &fa->cpu_cache[cpu % FRAME_CPU_COUNT];
+    uint32_t frame = FRAME_INVALID;
+
+    if (frame_cache_claim(cache)) {
+        if (cache->count > 0) {
+            InterlockedIncrement64((volatile LONGLONG*)&fa->cache_allocs);
+        } else {
+            EnterCriticalSection(&fa->lock);
+            frame_cache_refill(fa, cache);
+            if (cache->count == 0 && frame_drain_caches(fa)) frame_cache_refill(fa, cache);
+            LeaveCriticalSection(&fa->lock);
+        }
+        if (cache->count > 0) frame = cache->frames[--cache->count];
+        frame_cache_unclaim(cache);
+    } else {
+        EnterCriticalSection(&fa->lock);
+        frame = frame_take_block(fa, 0);
+        if (frame == FRAME_INVALID && frame_drain_caches(fa)) frame = frame_take_block(fa, 0);
+        LeaveCriticalSection(&fa->lock);
+    }
+    if (frame == FRAME_INVALID) return FRAME_INVALID;
+
+    frame_set_atomic(fa->bitmap, frame);
+    frame_count(fa, 1);
+    return frame;
+}
+
+static void frame_free_one(FrameAllocator* fa, uint32_t frame, uint32_t cpu) {
+    FrameCache* cache = &fa->cpu_cache[cpu % FRAME_CPU_COUNT];
+
+    frame_clear_atomic(fa->bitmap, frame);
+    frame_count(fa, -1);
+    if (frame_cache_claim(cache)) {
+        if (cache->count == FRAME_CPU_CACHE) {
+            EnterCriticalSection(&fa->lock);
+            frame_cache_flush(fa, cache, FRAME_CPU_BATCH);
+            LeaveCriticalSection(&fa->lock);
+        }
+        cache->frames[cache->count++] = frame;
+        frame_cache_unclaim(cache);
+    } else {
+        EnterCriticalSection(&fa->lock);
+        frame_release_block(fa, frame, 0);
+        LeaveCriticalSection(&fa->lock);
+    }
+}
+
+// First set bit in [from, to) of a bitmap, or FRAME_INVALID
+static uint32_t frame_find_set(const uint64_t* map, uint32_t from, uint32_t to) {
+    while (from < to) {
+        uint64_t word = map[from >> 6] & (~0ULL << (from & 63));
+        if (word) {
+            uint32_t bit = (from & ~63u) + frame_ctz(word);
+            return bit < to ? bit : FRAME_INVALID;
+        }
+        from = (from | 63) + 1;
+    }
+    return FRAME_INVALID;
+}
+
+// Take [start, start + count) out of the free blocks covering it, handing
+// back the parts of those blocks outside the range
+static void frame_carve(FrameAllocator* fa, uint32_t start, uint32_t count) {
+    uint32_t end = start + count;
+    uint32_t frame = start;
+
+    while (frame < end) {
+        uint32_t order = 0;
+        while (order <= FRAME_MAX_ORDER && !frame_test(fa->free_map[order], frame >> order)) order++;
+        if (order > FRAME_MAX_ORDER) return;   // Not free; callers check first
+
+        uint32_t block_start = frame >> order << order;
+        uint32_t block_end = block_start + (1u << order);
+        frame_pop_block(fa, frame >> order, order);
+        if (block_start < start) frame_release_range(fa, block_start, start - block_start);
+        if (block_end > end) frame_release_range(fa, end, block_end - end);
+        frame = block_end;
+    }
+    frame_mark(fa->held, start, count, 1, 0);
+}
+
+// Runs longer than the largest block: first fit over the held map, in
+// which every clear bit is in some free block
+static uint32_t frame_take_run(FrameAllocator* fa, uint32_t count, uint32_t align) {
+    uint32_t start = 0;
+
+    while ((uint64_t)start + count <= fa->total_frames) {
+        uint64_t word = fa->held[start >> 6] | ((1ULL << (start & 63)) - 1);
+        if (word == ~0ULL) {
+            start = (start | 63) + 1;
+            continue;
+        }
+        start = (start & ~63u) + frame_ctz(~word);
+        start = (start + align - 1) & ~(align - 1);
+        if ((uint64_t)start + count > fa->total_frames) break;
+
+        uint32_t used = frame_find_set(fa->held, start, start + count);
+        if (used == FRAME_INVALID) {
+            frame_carve(fa, start, count);
+            return start;
+        }
+        start = used + 1;
+    }
+    return FRAME_INVALID;
+}
+
+static uint32_t frame_alloc_run(FrameAllocator* fa, uint32_t count, uint32_t align) {
+    if (count == 0 || (align & (align - 1)) != 0 || count > fa->total_frames) return FRAME_INVALID;
+    if (align == 0) align = 1;
+
+    // Smallest order that covers both the size and the alignment
+    uint32_t order = 0;
+    while ((1ULL << order) < count || (1ULL << order) < align) order++;
+
+    EnterCriticalSection(&fa->lock);
+    uint32_t frame;
+    if (order <= FRAME_MAX_ORDER) {
+        frame = frame_take_block(fa, order);
+        if (frame == FRAME_INVALID && frame_drain_caches(fa)) frame = frame_take_block(fa, order);
+        // Give back whatever the power-of-two rounding took beyond count
+        if (frame != FRAME_INVALID && (1u << order) > count) {
+            frame_release_range(fa, frame + count, (1u << order) - count);
+        }
+    } else {
+        frame_drain_caches(fa);
+        frame = frame_take_run(fa, count, align);
+    }
+    if (frame != FRAME_INVALID) frame_mark(fa->bitmap, frame, count, 1, 1);
+    LeaveCriticalSection(&fa->lock);
+
+    if (frame != FRAME_INVALID) frame_count(fa, (int32_t)count);
+    return frame;
+}
+
+static void frame_free_run(FrameAllocator* fa, uint32_t frame, uint32_t count) {
+    if (frame >= fa->total_frames) return;
+    if (count > fa->total_frames - frame) count = fa->total_frames - frame;
+
+    // Only frames that really are allocated go back, in contiguous pieces
+    EnterCriticalSection(&fa->lock);
+    uint32_t end = frame + count;
+    while (frame < end) {
+        while (frame < end && !frame_test(fa->bitmap, frame)) frame++;
+        uint32_t start = frame;
+        while (frame < end && frame_test(fa->bitmap, frame)) frame++;
+        if (frame == start) break;
+
+        frame_mark(fa->bitmap, start, frame - start, 0, 1);
+        frame_count(fa, -(int32_t)(frame - start));
+        frame_release_range(fa, start, frame - start);
+    }
+    LeaveCriticalSection(&fa->lock);
+}
+
+// ===== MMU interface =====
+
+int mmu_frames_init(uint32_t total_frames) {
+    if (g_frames.total_frames) frame_destroy(&g_frames);
+    if (frame_init(&g_frames, total_frames) != 0) {
+        frame_destroy(&g_frames);
+        return -1;
+    }
+    return 0;
+}
+
+void mmu_frames_cleanup(void) {
+    if (g_frames.total_frames) frame_destroy(&g_frames);
+}
+
+const FrameAllocator* mmu_get_frame_allocator(void) {
+    return &g_frames;
+}
+
+// Allocate physical frame
+uint32_t mmu_alloc_frame(void) {
+    uint32_t frame = g_frames.total_frames ? frame_alloc_one(&g_frames, mmu_current_cpu) : FRAME_INVALID;
+    if (frame == FRAME_INVALID) printf("[MMU] Out of physical memory!\n");
+    return frame;
+}
+
+// Free physical frame, or drop one reference if it is shared
+void mmu_free_frame(uint32_t frame) {
+    if (frame >= g_frames.total_frames || !frame_test(g_frames.bitmap, frame)) return;
+    EnterCriticalSection(&g_frames.lock);
+    int shared = g_frames.shares[frame] != 0;
+    if (shared && --g_frames.shares[frame] == 0) g_frames.shared_frames--;
+    LeaveCriticalSection(&g_frames.lock);
+    if (!shared) frame_free_one(&g_frames, frame, mmu_current_cpu);
+}
+
+// Add a reference to an allocated frame, e.g. a second mapping of it.
+// Fails once the count saturates; callers copy the page instead.
+int mmu_frame_share(uint32_t frame) {
+    if (frame >= g_frames.total_frames || !frame_test(g_frames.bitmap, frame)) return -1;
+    EnterCriticalSection(&g_frames.lock);
+    int saturated = g_frames.shares[frame] == UINT16_MAX;
+    if (!saturated && g_frames.shares[frame]++ == 0) g_frames.shared_frames++;
+    LeaveCriticalSection(&g_frames.lock);
+    return saturated ? -1 : 0;
+}
+
+// Number of references to a frame: 0 if free, 1 if it has a single owner
+uint32_t mmu_frame_refcount(uint32_t frame) {
+    if (frame >= g_frames.total_frames || !frame_test(g_frames.bitmap, frame)) return 0;
+    EnterCriticalSection(&g_frames.lock);
+    uint32_t refs = 1u + g_frames.shares[frame];
+    LeaveCriticalSection(&g_frames.lock);
+    return refs;
+}
+
+uint32_t mmu_alloc_frames(uint32_t count, uint32_t align) {
+    if (count == 1 && align <= 1) return mmu_alloc_frame();
+    uint32_t frame = g_frames.total_frames ? frame_alloc_run(&g_frames, count, align) : FRAME_INVALID;
+    if (frame == FRAME_INVALID) {
+        printf("[MMU] No run of %u contiguous frames (align %u) available\n", count, align);
+    }
+    return frame;
+}
+
+void mmu_free_frames(uint32_t frame, uint32_t count) {
+    if (count == 1) {
+        mmu_free_frame(frame);
+        return;
+    }
+    frame_free_run(&g_frames, frame, count);
+}
+
+// Check if frame is allocated
+int mmu_is_frame_allocated(uint32_t frame) {
+    if (frame >= g_frames.total_frames) return 0;
+    return frame_test(g_frames.bitmap, frame);
+}
+
+// ===== Benchmark =====
+
+static double frame_now_seconds(void) {
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+}
+
+static uint32_t frame_random(uint32_t* seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+// Largest free block, counting cached frames as order 0
+static uint32_t frame_largest_free(const FrameAllocator* fa) {
+    for (int order = FRAME_MAX_ORDER; order >= 0; order--) {
+        if (fa->free_blocks[order]) return 1u << order;
+    }
+    return fa->free_frames ? 1 : 0;
+}
+
+// Single-frame churn on a nearly full, fragmented pool with both
+// allocators, then a mixed workload of contiguous requests to see how well
+// the buddy maps hold up against fragmentation
+void mmu_frame_benchmark(uint32_t frames, uint64_t operations) {
+    if (frames < 1024) frames = 65536;
+    if (operations == 0) operations = 2000000;
+
+    FrameAllocator fa;
+    FrameScan scan;
+    uint32_t* live = malloc(frames * sizeof(uint32_t));
+    uint32_t* runs = malloc(frames * sizeof(uint32_t));
+    uint32_t* sizes = malloc(frames * sizeof(uint32_t));
+    memset(&fa, 0, sizeof(fa));
+    int scan_ok = frame_scan_init(&scan, frames) == 0;
+    if (!live || !runs || !sizes || !scan_ok || frame_init(&fa, frames) != 0) {
+        printf("bench frame: out of memory\n");
+        if (fa.total_frames) frame_destroy(&fa);
+        if (scan_ok) frame_scan_destroy(&scan);
+        free(live);
+        free(runs);
+        free(sizes);
+        return;
+    }
+
+    // Fill both pools, then free a random 10% so free frames are scattered
+    uint32_t seed = 0x2545F491;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < frames; i++) {
+        live[count++] = frame_alloc_one(&fa, 0);
+        frame_scan_alloc(&scan);
+    }
+    for (uint32_t i = 0; i < frames / 10; i++) {
+        uint32_t victim = frame_random(&seed) % count;
+        frame_free_one(&fa, live[victim], 0);
+        frame_scan_free(&scan, live[victim]);
+        live[victim] = live[--count];
+    }
+
+    // Churn: free a random live frame, allocate one
+    uint32_t scan_seed = seed;
+    uint32_t* scan_live = malloc(count * sizeof(uint32_t));
+    if (scan_live) memcpy(scan_live, live, count * sizeof(uint32_t));
+    double start = frame_now_seconds();
+    for (uint64_t i = 0; i < operations / 2; i++) {
+        uint32_t victim = frame_random(&seed) % count;
+        frame_free_one(&fa, live[victim], (uint32_t)i & 3);
+        live[victim] = frame_alloc_one(&fa, (uint32_t)i & 3);
+    }
+    double buddy_seconds = frame_now_seconds() - start;
+
+    uint64_t cache_allocs = fa.cache_allocs, cache_refills = fa.cache_refills, cache_drains = fa.cache_drains;
+
+    // The bit scan is O(frames) per allocation here, so give it fewer rounds
+    uint64_t scan_rounds = operations / 2 < 50000 ? operations / 2 : 50000;
+    double scan_seconds = 0.0;
+    if (scan_live) {
+        start = frame_now_seconds();
+        for (uint64_t i = 0; i < scan_rounds; i++) {
+            uint32_t victim = frame_random(&scan_seed) % count;
+            frame_scan_free(&scan, scan_live[victim]);
+            scan_live[victim] = frame_scan_alloc(&scan);
+        }
+        scan_seconds = frame_now_seconds() - start;
+        free(scan_live);
+    }
+
+    // Contiguous: random sizes and alignments at roughly 75% occupancy
+    frame_destroy(&fa);
+    frame_init(&fa, frames);
+    uint32_t nruns = 0;
+    uint64_t requests = 0, failures = 0, requested_frames = 0;
+    start = frame_now_seconds();
+    for (uint64_t i = 0; i < operations / 4; i++) {
+        uint32_t r = frame_random(&seed);
+        if (nruns > 0 && (fa.used_frames > frames / 4 * 3 || (r & 1))) {
+            uint32_t victim = (r >> 1) % nruns;
+            frame_free_run(&fa, runs[victim], sizes[victim]);
+            runs[victim] = runs[--nruns];
+            sizes[victim] = sizes[nruns];
+            continue;
+        }
+        uint32_t size = 1 + (r >> 8) % ((r >> 4) & 3 ? 8 : 64);
+        uint32_t align = 1u << ((r >> 20) % 5);
+        requests++;
+        requested_frames += size;
+        uint32_t frame = frame_alloc_run(&fa, size, align);
+        if (frame == FRAME_INVALID || (frame & (align - 1)) != 0) {
+            failures++;
+            continue;
+        }
+        runs[nruns] = frame;
+        sizes[nruns++] = size;
+    }
+    double run_seconds = frame_now_seconds() - start;
+
+    printf("bench frame: %u frames (%u MB), %llu operations\n", frames, frames / (1024 * 1024 / PAGE_SIZE),
+           (unsigned long long)operations);
+    double buddy_ns = operations >= 2 ? buddy_seconds * 1e9 / (double)(operations / 2 * 2) : 0.0;
+    double scan_ns = scan_rounds ? scan_seconds * 1e9 / (double)(scan_rounds * 2) : 0.0;
+    printf("  Single frames, 90%% full: buddy %.1f ns/op, bit scan %.1f ns/op (%.1fx)\n",
+           buddy_ns, scan_ns, buddy_ns > 0 ? scan_ns / buddy_ns : 0.0);
+    printf("  CPU caches: %llu hits, %llu refills, %llu drains\n",
+           (unsigned long long)cache_allocs, (unsigned long long)cache_refills,
+           (unsigned long long)cache_drains);
+    printf("  Contiguous 1-64 frames, align 1-16: %llu requests (avg %.1f frames), %llu failed (%.2f%%), %.1f ns/op\n",
+           (unsigned long long)requests, requests ? (double)requested_frames / (double)requests : 0.0,
+           (unsigned long long)failures, requests ? 100.0 * (double)failures / (double)requests : 0.0,
+           run_seconds * 1e9 / (double)(operations / 4));
+    printf("  Free blocks by order:");
+    for (int order = 0; order < FRAME_ORDERS; order++) printf(" %u", fa.free_blocks[order]);
+    printf("\n  %u of %u frames free, largest free block %u frames\n",
+           fa.free_frames, frames, frame_largest_free(&fa));
+
+    frame_destroy(&fa);
+    free(live);
+    free(runs);
+    free(sizes);
+    frame_scan_destroy(&scan);
+}
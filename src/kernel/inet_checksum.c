@@ -0,0 +1,486 @@
+#include "kernel/inet_checksum.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define INET_CHECKSUM_SSE2 1
+#endif
+
+// AVX2 is built per function and only used when the CPU reports it, since
+// the kernel itself is compiled for baseline x86
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define INET_CHECKSUM_AVX2 1
+#endif
+
+// Bulk sums add 32-bit words into 64-bit lanes.  2^16 = 1 modulo 0xFFFF,
+// so folding that total to 16 bits gives the sum of the 16-bit words.
+typedef uint64_t (*ChecksumSum)(const uint8_t* data, size_t size);
+typedef uint64_t (*ChecksumCopy)(uint8_t* dst, const uint8_t* src, size_t size);
+
+typedef struct {
+    const char* name;
+    ChecksumSum sum;
+    ChecksumCopy copy;
+} ChecksumImpl;
+
+static double checksum_now_seconds(void) {
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+}
+
+static uint32_t checksum_fold(uint64_t sum) {
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    uint32_t folded = (uint32_t)sum;
+    folded = (folded & 0xFFFF) + (folded >> 16);
+    folded = (folded & 0xFFFF) + (folded >> 16);
+    return folded;
+}
+
+// A trailing odd byte is the first byte of a word padded with zero
+static uint64_t checksum_sum_tail(const uint8_t* data, size_t size) {
+    uint64_t sum = 0;
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        uint32_t word;
+        memcpy(&word, data + i, 4);
+        sum += word;
+    }
+    if (i + 2 <= size) {
+        uint16_t word;
+        memcpy(&word, data + i, 2);
+        sum += word;
+        i += 2;
+    }
+    if (i < size) {
+        uint16_t word = 0;
+        memcpy(&word, data + i, 1);
+        sum += word;
+    }
+    return sum;
+}
+
+static uint64_t checksum_sum_scalar(const uint8_t* data, size_t size) {
+    uint64_t sum0 = 0, sum1 = 0;
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        uint32_t words[4];
+        memcpy(words, data + i, 16);
+        sum0 += (uint64_t)words[0] + words[1];
+        sum1 += (uint64_t)words[2] + words[3];
+    }
+    return sum0 + sum1 + checksum_sum_tail(data + i, size - i);
+}
+
+static uint64_t checksum_copy_scalar(uint8_t* dst, const uint8_t* src, size_t size) {
+    uint64_t sum0 = 0, sum1 = 0;
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        uint32_t words[4];
+        memcpy(words, src + i, 16);
+        memcpy(dst + i, words, 16);
+        sum0 += (uint64_t)words[0] + words[1];
+        sum1 += (uint64_t)words[2] + words[3];
+    }
+    memcpy(dst + i, src + i, size - i);
+    return sum0 + sum1 + checksum_sum_tail(src + i, size - i);
+}
+
+#ifdef INET_CHECKSUM_SSE2
+// Each 16 bytes: the four 32-bit words widened into two pairs of 64-bit lanes
+static uint64_t checksum_sum_sse2(const uint8_t* data, size_t size) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero, acc1 = zero;
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(data + i + 16));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(a, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(a, zero));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(b, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(b, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1] + checksum_sum_scalar(data + i, size - i);
+}
+
+static uint64_t checksum_copy_sse2(uint8_t* dst, const uint8_t* src, size_t size) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero, acc1 = zero;
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 16));
+        _mm_storeu_si128((__m128i*)(dst + i), a);
+        _mm_storeu_si128((__m128i*)(dst + i + 16), b);
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(a, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(a, zero));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(b, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(b, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1] + checksum_copy_scalar(dst + i, src + i, size - i);
+}
+#endif
+
+#ifdef INET_CHECKSUM_AVX2
+__attribute__((target("avx2")))
+static uint64_t checksum_avx2_lanes(__m256i acc) {
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, half);
+    return lanes[0] + lanes[1];
+}
+
+__attribute__((target("avx2")))
+static uint64_t checksum_sum_avx2(const uint8_t* data, size_t size) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero, acc1 = zero;
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(data + i + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(b, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(b, zero));
+    }
+    return checksum_avx2_lanes(_mm256_add_epi64(acc0, acc1)) + checksum_sum_scalar(data + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static uint64_t checksum_copy_avx2(uint8_t* dst, const uint8_t* src, size_t size) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero, acc1 = zero;
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + i + 32));
+        _mm256_storeu_si256((__m256i*)(dst + i), a);
+        _mm256_storeu_si256((__m256i*)(dst + i + 32), b);
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(b, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(b, zero));
+    }
+    return checksum_avx2_lanes(_mm256_add_epi64(acc0, acc1)) + checksum_copy_scalar(dst + i, src + i, size - i);
+}
+#endif
+
+// Fastest first
+static const ChecksumImpl checksum_impls[] = {
+#ifdef INET_CHECKSUM_AVX2
+    { "AVX2", checksum_sum_avx2, checksum_copy_avx2 },
+#endif
+#ifdef INET_CHECKSUM_SSE2
+    { "SSE2", checksum_sum_sse2, checksum_copy_sse2 },
+#endif
+    { "scalar", checksum_sum_scalar, checksum_copy_scalar },
+};
+
+#define CHECKSUM_IMPLS ((int)(sizeof(checksum_impls) / sizeof(checksum_impls[0])))
+
+static int checksum_supported(const ChecksumImpl* impl) {
+#ifdef INET_CHECKSUM_AVX2
+    if (impl->sum == checksum_sum_avx2) return __builtin_cpu_supports("avx2");
+#endif
+    (void)impl;
+    return 1;
+}
+
+// Chosen on first use; racing callers pick the same one
+static const ChecksumImpl* checksum_select(void) {
+    static const ChecksumImpl* volatile selected = NULL;
+    const ChecksumImpl* impl = selected;
+    if (!impl) {
+        impl = &checksum_impls[CHECKSUM_IMPLS - 1];
+        for (int i = 0; i < CHECKSUM_IMPLS; i++) {
+            if (checksum_supported(&checksum_impls[i])) {
+                impl = &checksum_impls[i];
+                break;
+            }
+        }
+        selected = impl;
+    }
+    return impl;
+}
+
+uint32_t inet_checksum_add(uint32_t sum, const void* data, size_t size) {
+    return checksum_fold((uint64_t)sum + checksum_select()->sum((const uint8_t*)data, size));
+}
+
+uint32_t inet_checksum_copy(uint32_t sum, void* dst, const void* src, size_t size) {
+    return checksum_fold((uint64_t)sum + checksum_select()->copy((uint8_t*)dst, (const uint8_t*)src, size));
+}
+
+// Starting at an odd offset puts every byte in the other half of its word
+uint32_t inet_checksum_combine(uint32_t sum, uint32_t part, size_t offset) {
+    part = checksum_fold(part);
+    if (offset & 1) part = ((part & 0xFF) << 8) | (part >> 8);
+    return checksum_fold((uint64_t)sum + part);
+}
+
+uint16_t inet_checksum(const void* data, size_t size) {
+    return (uint16_t)~inet_checksum_add(0, data, size);
+}
+
+// HC' = ~(~HC + ~m + m')
+uint16_t inet_checksum_adjust16(uint16_t check, uint16_t old_value, uint16_t new_value) {
+    uint32_t sum = (uint32_t)(uint16_t)~check + (uint16_t)~old_value + new_value;
+    return (uint16_t)~checksum_fold(sum);
+}
+
+uint16_t inet_checksum_adjust32(uint16_t check, uint32_t old_value, uint32_t new_value) {
+    uint64_t sum = (uint64_t)(uint16_t)~check + (uint16_t)~old_value + (uint16_t)~(old_value >> 16) +
+                   (uint16_t)new_value + (uint16_t)(new_value >> 16);
+    return (uint16_t)~checksum_fold(sum);
+}
+
+const char* inet_checksum_impl(void) {
+    return checksum_select()->name;
+}
+
+// ===== Benchmark =====
+
+// The plain loop of 16-bit words every implementation is checked against
+static uint32_t checksum_reference(uint32_t sum, const uint8_t* data, size_t size) {
+    uint64_t total = sum;
+    size_t i = 0;
+    for (; i + 2 <= size; i += 2) {
+        uint16_t word;
+        memcpy(&word, data + i, 2);
+        total += word;
+    }
+    if (i < size) total += checksum_sum_tail(data + i, 1);
+    return checksum_fold(total);
+}
+
+static volatile uint32_t checksum_bench_sink;
+
+// GB/s summing `size` bytes until `total` bytes have gone by
+static double checksum_bench_sum(const ChecksumImpl* impl, const uint8_t* data, size_t size, size_t total) {
+    size_t rounds = total / size ? total / size : 1;
+    uint32_t sink = 0;
+    double start = checksum_now_seconds();
+    for (size_t r = 0; r < rounds; r++) {
+        sink += impl ? checksum_fold(impl->sum(data, size)) : checksum_reference(0, data, size);
+    }
+    double seconds = checksum_now_seconds() - start;
+    checksum_bench_sink = sink;
+    return seconds > 0 ? (double)rounds * size / seconds / 1e9 : 0.0;
+}
+
+static double checksum_bench_copy(int fused, uint8_t* dst, const uint8_t* src, size_t size, size_t total) {
+    size_t rounds = total / size ? total / size : 1;
+    uint32_t sink = 0;
+    double start = checksum_now_seconds();
+    for (size_t r = 0; r < rounds; r++) {
+        if (fused) {
+            sink += inet_checksum_copy(0, dst, src, size);
+        } else {
+            memcpy(dst, src, size);
+            sink += inet_checksum_add(0, dst, size);
+        }
+    }
+    double seconds = checksum_now_seconds() - start;
+    checksum_bench_sink = sink;
+    return seconds > 0 ? (double)rounds * size / seconds / 1e9 : 0.0;
+}
+
+// Every implementation against the reference over odd and even lengths
+// and alignments, chained from a non-zero sum
+static int checksum_bench_verify(const ChecksumImpl* impl, const uint8_t* data, uint8_t* scratch,
+                                 size_t size) {
+    static const size_t offsets[] = { 0, 1, 2, 3, 8, 13 };
+    for (size_t o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++) {
+        for (size_t length = size > 70 ? size - 70 : 0; length <= size; length++) {
+            const uint8_t* src = data + offsets[o];
+            uint32_t expect = checksum_reference(0xFFFE, src, length);
+            if (checksum_fold(0xFFFE + impl->sum(src, length)) != expect) return 0;
+            if (checksum_fold(0xFFFE + impl->copy(scratch + offsets[o], src, length)) != expect ||
+                memcmp(scratch + offsets[o], src, length) != 0) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// A 20-byte IPv4 header followed by a TCP segment, both checksums filled in
+static void checksum_bench_packet(uint8_t* packet, uint32_t length) {
+    uint8_t pseudo[12];
+    uint16_t check;
+    packet[0] = 0x45;
+    packet[2] = (uint8_t)(length >> 8);
+    packet[3] = (uint8_t)length;
+    packet[8] = 64;
+    packet[9] = 6;
+    memset(packet + 10, 0, 2);
+    check = inet_checksum(packet, 20);
+    memcpy(packet + 10, &check, 2);
+
+    memcpy(pseudo, packet + 12, 8);
+    pseudo[8] = 0;
+    pseudo[9] = 6;
+    pseudo[10] = (uint8_t)((length - 20) >> 8);
+    pseudo[11] = (uint8_t)(length - 20);
+    memset(packet + 36, 0, 2);
+    check = (uint16_t)~inet_checksum_add(inet_checksum_add(0, pseudo, 12), packet + 20, length - 20);
+    memcpy(packet + 36, &check, 2);
+}
+
+// Both checksums of a checksum_bench_packet() sum to zero
+static int checksum_bench_valid(const uint8_t* packet, uint32_t length) {
+    uint8_t pseudo[12];
+    memcpy(pseudo, packet + 12, 8);
+    pseudo[8] = 0;
+    pseudo[9] = 6;
+    pseudo[10] = (uint8_t)((length - 20) >> 8);
+    pseudo[11] = (uint8_t)(length - 20);
+    return inet_checksum(packet, 20) == 0 &&
+           (uint16_t)~inet_checksum_add(inet_checksum_add(0, pseudo, 12), packet + 20, length - 20) == 0;
+}
+
+// Sums over packet sizes from a bare header to the largest datagram for
+// each implementation, the fused copy against a copy then a sum, and the
+// incremental updates against summing the packet again
+void inet_checksum_benchmark(uint32_t total_mb) {
+    if (total_mb == 0) total_mb = 256;
+
+    static const uint32_t sizes[] = { 20, 64, 576, 1500, 9000, 65535 };
+    const int size_count = (int)(sizeof(sizes) / sizeof(sizes[0]));
+    size_t total = (size_t)total_mb << 20;
+    size_t buffer_bytes = 65536 + 64;
+    uint8_t* data = (uint8_t*)malloc(buffer_bytes);
+    uint8_t* scratch = (uint8_t*)malloc(buffer_bytes);
+    if (!data || !scratch) {
+        printf("bench csum: out of memory\n");
+        free(data);
+        free(scratch);
+        return;
+    }
+    uint32_t seed = 0x9E3779B9;
+    for (size_t i = 0; i < buffer_bytes; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        data[i] = (uint8_t)(seed >> 24);
+    }
+
+    // Columns: the reference loop, then each implementation this CPU runs
+    static const char* const columns[] = { "AVX2", "SSE2", "scalar" };
+    const ChecksumImpl* impls[3] = { NULL, NULL, NULL };
+    int ok = 1;
+    for (int i = 0; i < CHECKSUM_IMPLS; i++) {
+        if (!checksum_supported(&checksum_impls[i])) continue;
+        for (int c = 0; c < 3; c++) {
+            if (strcmp(checksum_impls[i].name, columns[c]) == 0) impls[c] = &checksum_impls[i];
+        }
+        for (int s = 0; s < size_count; s++) {
+            ok &= checksum_bench_verify(&checksum_impls[i], data, scratch, sizes[s]);
+        }
+    }
+
+    printf("bench csum: %u MB per case, %s in use; GB/s\n", total_mb, inet_checksum_impl());
+    printf("  %-8s %8s %8s %8s %8s %10s %8s\n", "Bytes", "16-bit", "Scalar", "SSE2", "AVX2", "Copy, sum", "Fused");
+    for (int s = 0; s < size_count; s++) {
+        char cells[3][16];
+        for (int c = 0; c < 3; c++) {
+            if (impls[2 - c]) {
+                snprintf(cells[c], sizeof(cells[c]), "%.2f", checksum_bench_sum(impls[2 - c], data, sizes[s], total));
+            } else {
+                snprintf(cells[c], sizeof(cells[c]), "-");
+            }
+        }
+        printf("  %-8u %8.2f %8s %8s %8s %10.2f %8.2f\n", sizes[s],
+               checksum_bench_sum(NULL, data, sizes[s], total), cells[0], cells[1], cells[2],
+               checksum_bench_copy(0, scratch, data, sizes[s], total),
+               checksum_bench_copy(1, scratch, data, sizes[s], total));
+    }
+    printf("  Sums and copies match the 16-bit loop: %s\n", ok ? "ok" : "FAILED");
+
+    // TTL decrement on a forwarded header, and a NAT rewrite of the source
+    // address and port of a full-sized TCP segment
+    uint32_t rounds = 1000000;
+    uint32_t length = 1500;
+    uint8_t* packet = scratch;
+    memcpy(packet, data, length);
+    checksum_bench_packet(packet, length);
+    int ttl_ok = 1, nat_ok = 1;
+    double seconds[4];
+
+    double start = checksum_now_seconds();
+    for (uint32_t r = 0; r < rounds; r++) {
+        uint16_t old_word, new_word, check;
+        memcpy(&old_word, packet + 8, 2);
+        packet[8] = packet[8] > 1 ? packet[8] - 1 : 64;
+        memcpy(&new_word, packet + 8, 2);
+        memcpy(&check, packet + 10, 2);
+        check = inet_checksum_adjust16(check, old_word, new_word);
+        memcpy(packet + 10, &check, 2);
+    }
+    seconds[0] = checksum_now_seconds() - start;
+    ttl_ok &= checksum_bench_valid(packet, length);
+
+    start = checksum_now_seconds();
+    for (uint32_t r = 0; r < rounds; r++) {
+        uint16_t check = 0;
+        packet[8] = packet[8] > 1 ? packet[8] - 1 : 64;
+        memcpy(packet + 10, &check, 2);
+        check = inet_checksum(packet, 20);
+        memcpy(packet + 10, &check, 2);
+    }
+    seconds[1] = checksum_now_seconds() - start;
+    ttl_ok &= checksum_bench_valid(packet, length);
+
+    start = checksum_now_seconds();
+    for (uint32_t r = 0; r < rounds; r++) {
+        uint32_t old_addr, new_addr;
+        uint16_t old_port, new_port, ip_check, tcp_check;
+        memcpy(&old_addr, packet + 12, 4);
+        memcpy(&old_port, packet + 20, 2);
+        new_addr = old_addr + 0x01000000;
+        new_port = (uint16_t)(old_port + 1);
+        memcpy(packet + 12, &new_addr, 4);
+        memcpy(packet + 20, &new_port, 2);
+        memcpy(&ip_check, packet + 10, 2);
+        memcpy(&tcp_check, packet + 36, 2);
+        ip_check = inet_checksum_adjust32(ip_check, old_addr, new_addr);
+        tcp_check = inet_checksum_adjust32(tcp_check, old_addr, new_addr);
+        tcp_check = inet_checksum_adjust16(tcp_check, old_port, new_port);
+        memcpy(packet + 10, &ip_check, 2);
+        memcpy(packet + 36, &tcp_check, 2);
+    }
+    seconds[2] = checksum_now_seconds() - start;
+    nat_ok &= checksum_bench_valid(packet, length);
+
+    start = checksum_now_seconds();
+    for (uint32_t r = 0; r < rounds; r++) {
+        uint32_t addr;
+        uint16_t port;
+        memcpy(&addr, packet + 12, 4);
+        memcpy(&port, packet + 20, 2);
+        addr += 0x01000000;
+        port++;
+        memcpy(packet + 12, &addr, 4);
+        memcpy(packet + 20, &port, 2);
+        checksum_bench_packet(packet, length);
+    }
+    seconds[3] = checksum_now_seconds() - start;
+    nat_ok &= checksum_bench_valid(packet, length);
+
+    printf("  %-16s %12s %12s %8s\n", "", "Incremental", "Full", "Check");
+    printf("  %-16s %9.1f ns %9.1f ns %8s\n", "TTL decrement", seconds[0] * 1e9 / rounds,
+           seconds[1] * 1e9 / rounds, ttl_ok ? "ok" : "FAILED");
+    printf("  %-16s %9.1f ns %9.1f ns %8s\n", "NAT, 1500 B TCP", seconds[2] * 1e9 / rounds,
+           seconds[3] * 1e9 / rounds, nat_ok ? "ok" : "FAILED");
+
+    free(data);
+    free(scratch);
+}
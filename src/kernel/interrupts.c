@@ -2,8 +2,11 @@
 #include "kernel/privilege.h"
 #include "kernel/scheduler.h"
 #include "kernel/mmu.h"
+#include "kernel/timer.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <windows.h>
 
 // Global interrupt controller
 static InterruptController g_int_controller;
@@ -20,6 +23,37 @@ static volatile int g_kb_read_pos = 0;
 static volatile int g_kb_write_pos = 0;
 static volatile int g_kb_count = 0;
 
+// Posted IRQ queue: a bounded multi-producer, single-consumer ring (after
+// Vyukov).  Each cell's sequence says whose turn it is: equal to the slot
+// position when free for a producer, position + 1 once published for the
+// consumer.  Producers race only on the tail CAS, never on a lock, and the
+// consumer never writes anything a producer spins on except the sequence.
+typedef struct {
+    volatile LONG sequence;
+    uint8_t int_no;
+    uint32_t data;
+    int64_t posted;                     // QPC count when posted
+} IrqCell;
+
+typedef struct {
+    IrqCell cells[IRQ_QUEUE_SIZE];
+    volatile LONG tail;                 // Next position producers claim
+    LONG head;                          // Next position the consumer takes
+    volatile LONG posted;
+    volatile LONG dropped;
+} IrqQueue;
+
+static IrqQueue g_irq_queue;
+static IrqQueueStats g_irq_stats;
+static double g_qpc_ns = 0.0;           // Nanoseconds per QPC count
+volatile long interrupt_doorbell = 0;
+
+// Thread allowed to deliver posted IRQs, and how many claims it holds
+static volatile LONG g_irq_owner = 0;
+static LONG g_irq_owner_depth = 0;
+
+static void irq_queue_init(IrqQueue* queue);
+
 // Initialize interrupt system
 int interrupts_init(void) {
     if (g_interrupts_initialized) {
@@ -30,6 +64,13 @@ int interrupts_init(void) {
     
     memset(&g_int_controller, 0, sizeof(InterruptController));
     
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    g_qpc_ns = 1e9 / (double)freq.QuadPart;
+    irq_queue_init(&g_irq_queue);
+    memset(&g_irq_stats, 0, sizeof(g_irq_stats));
+    interrupt_doorbell = 0;
+    
     // Setup IDT pointer
     g_int_controller.idt_ptr.limit = sizeof(g_int_controller.idt) - 1;
     g_int_controller.idt_ptr.base = (uint32_t)&g_int_controller.idt;
@@ -190,6 +231,189 @@ void interrupt_dispatch(InterruptContext* context) {
     g_int_controller.nested_level--;
 }
 
+// Run a hardware IRQ handler on the calling thread.  Like an IRQ taken on
+// another CPU, the interrupted CPU's privilege state is left alone.
+static void interrupt_deliver(uint8_t int_no, uint32_t data) {
+    InterruptContext context;
+    memset(&context, 0, sizeof(context));
+    context.int_no = int_no;
+    context.err_code = data;
+    
+    g_int_controller.stats.total_interrupts++;
+    g_int_controller.stats.interrupt_counts[int_no]++;
+    if (g_int_controller.handlers[int_no]) {
+        g_int_controller.handlers[int_no](&context);
+        g_int_controller.stats.handled_interrupts++;
+    } else {
+        g_int_controller.stats.spurious_interrupts++;
+    }
+    interrupt_eoi(int_no);
+}
+
+// Raise a hardware interrupt synchronously from a host thread
+void interrupt_raise(uint8_t int_no) {
+    if (!g_interrupts_initialized || !g_int_controller.interrupts_enabled) return;
+    
+    interrupt_deliver(int_no, 0);
+}
+
+static void irq_queue_init(IrqQueue* queue) {
+    for (LONG i = 0; i < IRQ_QUEUE_SIZE; i++) {
+        queue->cells[i].sequence = i;
+    }
+    queue->tail = 0;
+    queue->head = 0;
+    queue->posted = 0;
+    queue->dropped = 0;
+}
+
+// Positions wrap; compare them as a signed distance
+static inline int32_t irq_queue_diff(LONG a, LONG b) {
+    return (int32_t)((uint32_t)a - (uint32_t)b);
+}
+
+static int irq_queue_push(IrqQueue* queue, uint8_t int_no, uint32_t data, int64_t posted) {
+    LONG pos = queue->tail;
+    for (;;) {
+        IrqCell* cell = &queue->cells[(uint32_t)pos & (IRQ_QUEUE_SIZE - 1)];
+        int32_t diff = irq_queue_diff(cell->sequence, pos);
+        if (diff == 0) {
+            LONG seen = InterlockedCompareExchange(&queue->tail, (LONG)((uint32_t)pos + 1), pos);
+            if (seen == pos) {
+                cell->int_no = int_no;
+                cell->data = data;
+                cell->posted = posted;
+                InterlockedExchange(&cell->sequence, (LONG)((uint32_t)pos + 1));  // Publish
+                InterlockedIncrement(&queue->posted);
+                return 0;
+            }
+            pos = seen;
+        } else if (diff < 0) {
+            InterlockedIncrement(&queue->dropped);  // Consumer is a lap behind
+            return -1;
+        } else {
+            pos = queue->tail;                      // Another producer got there first
+        }
+    }
+}
+
+// Consumer side; only the claim holder calls these
+static int irq_queue_ready(IrqQueue* queue) {
+    IrqCell* cell = &queue->cells[(uint32_t)queue->head & (IRQ_QUEUE_SIZE - 1)];
+    return irq_queue_diff(cell->sequence, (LONG)((uint32_t)queue->head + 1)) == 0;
+}
+
+static int irq_queue_pop(IrqQueue* queue, IrqCell* out) {
+    IrqCell* cell = &queue->cells[(uint32_t)queue->head & (IRQ_QUEUE_SIZE - 1)];
+    if (irq_queue_diff(cell->sequence, (LONG)((uint32_t)queue->head + 1)) != 0) return 0;
+    
+    out->int_no = cell->int_no;
+    out->data = cell->data;
+    out->posted = cell->posted;
+    // Hand the cell back to producers for the next lap
+    InterlockedExchange(&cell->sequence, (LONG)((uint32_t)queue->head + IRQ_QUEUE_SIZE));
+    queue->head = (LONG)((uint32_t)queue->head + 1);
+    return 1;
+}
+
+// Order a drained batch by priority, stable within a vector
+static void irq_batch_sort(const IrqCell* batch, uint32_t count, uint16_t* order) {
+    uint16_t start[IRQ_POST_LINES + 1];
+    memset(start, 0, sizeof(start));
+    for (uint32_t i = 0; i < count; i++) {
+        start[batch[i].int_no - IRQ_POST_FIRST + 1]++;
+    }
+    for (uint32_t line = 0; line < IRQ_POST_LINES; line++) {
+        start[line + 1] += start[line];
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        order[start[batch[i].int_no - IRQ_POST_FIRST]++] = (uint16_t)i;
+    }
+}
+
+static uint32_t irq_latency_bucket(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    uint32_t bucket = us ? 64 - (uint32_t)__builtin_clzll(us) : 0;
+    return bucket < IRQ_LATENCY_BUCKETS ? bucket : IRQ_LATENCY_BUCKETS - 1;
+}
+
+static void irq_record_latency(IrqQueueStats* stats, int64_t posted, int64_t now) {
+    uint64_t ns = now > posted ? (uint64_t)((double)(now - posted) * g_qpc_ns) : 0;
+    stats->latency_total_ns += ns;
+    if (ns > stats->latency_max_ns) stats->latency_max_ns = ns;
+    stats->latency_buckets[irq_latency_bucket(ns)]++;
+}
+
+// Post a device IRQ from any thread
+int interrupt_post(uint8_t int_no, uint32_t data) {
+    if (!g_interrupts_initialized) return -1;
+    if (int_no < IRQ_POST_FIRST || int_no >= IRQ_POST_FIRST + IRQ_POST_LINES) return -1;
+    
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    if (irq_queue_push(&g_irq_queue, int_no, data, now.QuadPart) != 0) return -1;
+    
+    // Ring after publishing, so a consumer that sees the bit finds the cell
+    InterlockedOr((LONG volatile*)&interrupt_doorbell, (LONG)(1u << (int_no - IRQ_POST_FIRST)));
+    return 0;
+}
+
+// Claims nest on the owning thread
+int interrupt_claim(void) {
+    LONG self = (LONG)GetCurrentThreadId();
+    if (g_irq_owner == self) {
+        g_irq_owner_depth++;
+        return 1;
+    }
+    if (InterlockedCompareExchange(&g_irq_owner, self, 0) != 0) return 0;
+    g_irq_owner_depth = 1;
+    return 1;
+}
+
+void interrupt_release(void) {
+    if (g_irq_owner != (LONG)GetCurrentThreadId()) return;
+    if (--g_irq_owner_depth == 0) {
+        InterlockedExchange(&g_irq_owner, 0);
+    }
+}
+
+// Deliver up to a batch of posted IRQs, highest priority first.  Returns
+// how many ran; 0 if nothing was posted or another thread holds the claim.
+uint32_t interrupt_poll(void) {
+    if (!interrupt_doorbell || !g_int_controller.interrupts_enabled) return 0;
+    if (!interrupt_claim()) return 0;
+    
+    // Clear before draining: a post that lands after this re-rings
+    InterlockedExchange((LONG volatile*)&interrupt_doorbell, 0);
+    
+    IrqCell batch[IRQ_DRAIN_BATCH];
+    uint16_t order[IRQ_DRAIN_BATCH];
+    uint32_t count = 0;
+    while (count < IRQ_DRAIN_BATCH && irq_queue_pop(&g_irq_queue, &batch[count])) {
+        count++;
+    }
+    irq_batch_sort(batch, count, order);
+    
+    for (uint32_t i = 0; i < count; i++) {
+        const IrqCell* irq = &batch[order[i]];
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        irq_record_latency(&g_irq_stats, irq->posted, now.QuadPart);
+        interrupt_deliver(irq->int_no, irq->data);
+    }
+    
+    // Batch limit hit: leave the rest for the next boundary
+    if (irq_queue_ready(&g_irq_queue)) {
+        const IrqCell* next = &g_irq_queue.cells[(uint32_t)g_irq_queue.head & (IRQ_QUEUE_SIZE - 1)];
+        InterlockedOr((LONG volatile*)&interrupt_doorbell, (LONG)(1u << (next->int_no - IRQ_POST_FIRST)));
+    }
+    
+    g_irq_stats.delivered += count;
+    if (count) g_irq_stats.polls++;
+    interrupt_release();
+    return count;
+}
+
 // End of interrupt
 void interrupt_eoi(uint8_t int_no) {
     // For hardware IRQs, send EOI to PIC
@@ -283,17 +507,16 @@ void exception_simd_exception(InterruptContext* ctx) {
 
 // Hardware IRQ handlers
 void irq_timer(InterruptContext* ctx) {
-    // Increment system tick counter
-    g_system_ticks++;
+    // The clock skips ticks while idle, so catch up to the real time
+    // rather than counting interrupts
+    g_system_ticks = timer_clock_ticks();
+    
+    // Expired kernel timers first, so woken sleepers are ready for the
+    // scheduler to see
+    timer_advance(g_system_ticks);
     
     // Update scheduler (call every tick)
     scheduler_tick();
-    
-    // Print tick info every 1000 ticks (1 second at 1000 Hz)
-    if (g_system_ticks % 1000 == 0) {
-        uint64_t seconds = g_system_ticks / g_timer_frequency;
-        printf("[TIMER] System uptime: %llu seconds\n", seconds);
-    }
 }
 
 void irq_keyboard(InterruptContext* ctx) {
@@ -301,8 +524,9 @@ void irq_keyboard(InterruptContext* ctx) {
     // In real kernel, would read from port 0x60
     // For simulation, we'll generate a dummy scancode
     
-    // Simulate reading from keyboard controller (0x60)
-    uint8_t scancode = 0x1E;  // Dummy scancode (would be actual IN instruction)
+    // Simulate reading from keyboard controller (0x60): a posted IRQ
+    // carries the scancode, a bare one gets a dummy
+    uint8_t scancode = ctx->err_code ? (uint8_t)ctx->err_code : 0x1E;
     
     // Add to circular buffer if not full
     if (g_kb_count < KB_BUFFER_SIZE) {
@@ -374,6 +598,12 @@ InterruptStats* interrupts_get_stats(void) {
     return &g_int_controller.stats;
 }
 
+IrqQueueStats* interrupts_get_irq_stats(void) {
+    g_irq_stats.posted = (uint64_t)g_irq_queue.posted;
+    g_irq_stats.dropped = (uint64_t)g_irq_queue.dropped;
+    return &g_irq_stats;
+}
+
 // Get system ticks (milliseconds since boot)
 uint64_t interrupts_get_ticks(void) {
     return g_system_ticks;
@@ -416,6 +646,243 @@ void interrupts_dump_stats(void) {
             printf("  INT 0x%02X: %llu\n", i, g_int_controller.stats.interrupt_counts[i]);
         }
     }
+    
+    IrqQueueStats* irq = interrupts_get_irq_stats();
+    printf("\nPosted IRQs:\n");
+    printf("  Posted: %llu, delivered: %llu, dropped: %llu, polls: %llu\n",
+           (unsigned long long)irq->posted, (unsigned long long)irq->delivered,
+           (unsigned long long)irq->dropped, (unsigned long long)irq->polls);
+    if (irq->delivered > 0) {
+        printf("  Injection latency: avg %.1f us, max %.1f us\n",
+               (double)irq->latency_total_ns / (double)irq->delivered / 1000.0,
+               (double)irq->latency_max_ns / 1000.0);
+        for (int i = 0; i < IRQ_LATENCY_BUCKETS; i++) {
+            if (irq->latency_buckets[i] > 0) {
+                printf("    < %6u us: %llu\n", 1u << i, (unsigned long long)irq->latency_buckets[i]);
+            }
+        }
+    }
+}
+
+// IRQ injection benchmark: producer threads post into a private queue
+// while this thread plays the CPU loop, running a short block and then
+// checking the doorbell.  The baseline is the same ring behind a
+// critical section.
+typedef struct {
+    CRITICAL_SECTION lock;
+    IrqCell cells[IRQ_QUEUE_SIZE];
+    uint32_t head;
+    uint32_t tail;
+} IrqLockedQueue;
+
+typedef struct {
+    IrqQueue* queue;                    // Lock-free run
+    IrqLockedQueue* locked;             // Baseline run
+    volatile LONG* doorbell;
+    volatile LONG* go;
+    uint32_t producer;
+    uint32_t count;
+    uint64_t full;                      // Posts retried because the queue was full
+    double seconds;
+} IrqBenchProducer;
+
+static double interrupt_now_seconds(void) {
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+}
+
+static int irq_locked_push(IrqLockedQueue* queue, uint8_t int_no, uint32_t data, int64_t posted) {
+    EnterCriticalSection(&queue->lock);
+    if (queue->tail - queue->head == IRQ_QUEUE_SIZE) {
+        LeaveCriticalSection(&queue->lock);
+        return -1;
+    }
+    IrqCell* cell = &queue->cells[queue->tail & (IRQ_QUEUE_SIZE - 1)];
+    cell->int_no = int_no;
+    cell->data = data;
+    cell->posted = posted;
+    queue->tail++;
+    LeaveCriticalSection(&queue->lock);
+    return 0;
+}
+
+static uint32_t irq_locked_drain(IrqLockedQueue* queue, IrqCell* out, uint32_t max) {
+    uint32_t count = 0;
+    EnterCriticalSection(&queue->lock);
+    while (count < max && queue->head != queue->tail) {
+        out[count++] = queue->cells[queue->head & (IRQ_QUEUE_SIZE - 1)];
+        queue->head++;
+    }
+    LeaveCriticalSection(&queue->lock);
+    return count;
+}
+
+static DWORD WINAPI irq_bench_producer(LPVOID param) {
+    IrqBenchProducer* producer = (IrqBenchProducer*)param;
+    uint8_t int_no = (uint8_t)(IRQ_POST_FIRST + producer->producer % IRQ_POST_LINES);
+    while (!*producer->go) {
+        Sleep(0);
+    }
+    
+    double start = interrupt_now_seconds();
+    for (uint32_t i = 0; i < producer->count; i++) {
+        uint32_t data = (producer->producer << 24) | i;
+        for (;;) {
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            int result = producer->queue
+                ? irq_queue_push(producer->queue, int_no, data, now.QuadPart)
+                : irq_locked_push(producer->locked, int_no, data, now.QuadPart);
+            if (result == 0) break;
+            producer->full++;
+            Sleep(0);
+        }
+        InterlockedOr(producer->doorbell, (LONG)(1u << (int_no - IRQ_POST_FIRST)));
+    }
+    producer->seconds = interrupt_now_seconds() - start;
+    return 0;
+}
+
+static int irq_bench_compare(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    double seconds;                     // First post to last delivery
+    double post_ns;                     // Producer time per post
+    uint64_t full;
+    uint32_t p50_ns, p99_ns, max_ns;
+    int ok;                             // Everything arrived, FIFO per producer
+} IrqBenchResult;
+
+static void irq_bench_run(int locked, uint32_t producers, uint32_t count, uint32_t* latency, IrqBenchResult* result) {
+    IrqQueue* queue = locked ? NULL : (IrqQueue*)calloc(1, sizeof(IrqQueue));
+    IrqLockedQueue* locked_queue = locked ? (IrqLockedQueue*)calloc(1, sizeof(IrqLockedQueue)) : NULL;
+    IrqBenchProducer* workers = (IrqBenchProducer*)calloc(producers, sizeof(IrqBenchProducer));
+    HANDLE* threads = (HANDLE*)calloc(producers, sizeof(HANDLE));
+    uint32_t* expect = (uint32_t*)calloc(producers, sizeof(uint32_t));
+    memset(result, 0, sizeof(*result));
+    if ((!queue && !locked_queue) || !workers || !threads || !expect) {
+        free(queue);
+        free(locked_queue);
+        free(workers);
+        free(threads);
+        free(expect);
+        return;
+    }
+    if (queue) irq_queue_init(queue);
+    if (locked_queue) InitializeCriticalSection(&locked_queue->lock);
+    
+    volatile LONG doorbell = 0, go = 0;
+    uint32_t total = 0, started = 0;
+    for (uint32_t i = 0; i < producers; i++) {
+        workers[i].queue = queue;
+        workers[i].locked = locked_queue;
+        workers[i].doorbell = &doorbell;
+        workers[i].go = &go;
+        workers[i].producer = i;
+        workers[i].count = count / producers + (i < count % producers ? 1 : 0);
+        threads[i] = CreateThread(NULL, 0, irq_bench_producer, &workers[i], 0, NULL);
+        if (!threads[i]) break;
+        total += workers[i].count;
+        started++;
+    }
+    
+    IrqCell batch[IRQ_DRAIN_BATCH];
+    uint32_t received = 0, disorder = 0, sink = 1;
+    double start = interrupt_now_seconds();
+    InterlockedExchange(&go, 1);
+    while (received < total) {
+        // One translated block's worth of work, then the boundary check
+        for (int k = 0; k < 64; k++) {
+            sink = sink * 1103515245u + 12345u;
+        }
+        if (!doorbell) continue;
+        InterlockedExchange(&doorbell, 0);
+        
+        for (;;) {
+            uint32_t n = 0;
+            if (queue) {
+                while (n < IRQ_DRAIN_BATCH && irq_queue_pop(queue, &batch[n])) n++;
+            } else {
+                n = irq_locked_drain(locked_queue, batch, IRQ_DRAIN_BATCH);
+            }
+            if (n == 0) break;
+            
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            for (uint32_t i = 0; i < n && received < total; i++) {
+                uint32_t producer = batch[i].data >> 24;
+                if (producer >= started || (batch[i].data & 0xFFFFFF) != (expect[producer] & 0xFFFFFF)) disorder++;
+                else expect[producer]++;
+                int64_t ticks = now.QuadPart - batch[i].posted;
+                latency[received++] = ticks > 0 ? (uint32_t)((double)ticks * g_qpc_ns) : 0;
+            }
+        }
+    }
+    result->seconds = interrupt_now_seconds() - start;
+    WaitForMultipleObjects(started, threads, TRUE, INFINITE);
+    
+    double post_seconds = 0.0;
+    for (uint32_t i = 0; i < started; i++) {
+        CloseHandle(threads[i]);
+        post_seconds += workers[i].seconds;
+        result->full += workers[i].full;
+    }
+    result->post_ns = total ? post_seconds * 1e9 / (double)total : 0.0;
+    result->ok = started == producers && disorder == 0 && received == count;
+    if (received > 0) {
+        qsort(latency, received, sizeof(uint32_t), irq_bench_compare);
+        result->p50_ns = latency[received / 2];
+        result->p99_ns = latency[(uint32_t)((uint64_t)received * 99 / 100)];
+        result->max_ns = latency[received - 1];
+    }
+    (void)sink;
+    
+    if (locked_queue) DeleteCriticalSection(&locked_queue->lock);
+    free(queue);
+    free(locked_queue);
+    free(workers);
+    free(threads);
+    free(expect);
+}
+
+void interrupt_benchmark(uint32_t producers, uint32_t count) {
+    if (producers == 0) producers = 4;
+    if (producers > 64) producers = 64;     // WaitForMultipleObjects limit
+    if (count == 0) count = 1000000;
+    if (count > 0xFFFFFF) count = 0xFFFFFF; // Sequence numbers are 24 bits
+    if (g_qpc_ns == 0.0) {
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        g_qpc_ns = 1e9 / (double)freq.QuadPart;
+    }
+    
+    uint32_t* latency = (uint32_t*)malloc(count * sizeof(uint32_t));
+    if (!latency) {
+        printf("bench irq: out of memory\n");
+        return;
+    }
+    
+    IrqBenchResult results[2];
+    irq_bench_run(0, producers, count, latency, &results[0]);
+    irq_bench_run(1, producers, count, latency, &results[1]);
+    free(latency);
+    
+    static const char* const names[] = { "lock-free", "locked" };
+    printf("bench irq: %u producers, %u IRQs, queue of %u\n", producers, count, IRQ_QUEUE_SIZE);
+    printf("  %-10s %10s %9s %9s %9s %9s %8s\n", "", "IRQs/s", "post", "p50", "p99", "max", "full");
+    for (int i = 0; i < 2; i++) {
+        IrqBenchResult* r = &results[i];
+        printf("  %-10s %10.0f %6.1f ns %6.2f us %6.2f us %6.1f us %8llu\n", names[i],
+               r->seconds > 0 ? (double)count / r->seconds : 0.0, r->post_ns,
+               r->p50_ns / 1000.0, r->p99_ns / 1000.0, r->max_ns / 1000.0,
+               (unsigned long long)r->full);
+    }
+    printf("  Checks: lock-free %s, locked %s\n", results[0].ok ? "ok" : "FAILED", results[1].ok ? "ok" : "FAILED");
 }
 
 // Stub implementations for assembly functions (these would be in .asm file)
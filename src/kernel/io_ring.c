@@ -0,0 +1,606 @@
+#include "kernel/io_ring.h"
+#include "kernel/network_stack.h"
+#include "kernel/syscall_table.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+// An operation handed to the workers.  Each ring owns one per CQ entry,
+// since it never has more in flight than its CQ can take.
+typedef struct IoRingWork {
+    struct IoRingWork* next;
+    IoRing* ring;
+    IoRingSqe sqe;                  // Copied out: the guest may reuse the slot
+    VFSFile* file;                  // Retained at submission
+} IoRingWork;
+
+struct IoRing {
+    IoRingShared* shared;
+    IoRingSqe* sq;
+    IoRingCqe* cq;
+    VFSFdTable* fds;
+    CRITICAL_SECTION lock;          // CQ tail, free work, in-flight count
+    HANDLE event;                   // Completion arrived for a waiter
+    int waiting;
+    uint32_t inflight;
+    IoRingWork* work;
+    IoRingWork* free_work;
+};
+
+// Worker pool, shared by every ring: a FIFO of work under a lock, with a
+// semaphore counting what's queued
+static CRITICAL_SECTION g_io_queue_lock;
+static HANDLE g_io_queue_sem = NULL;
+static IoRingWork* g_io_queue_head = NULL;
+static IoRingWork* g_io_queue_tail = NULL;
+static HANDLE g_io_workers[IO_RING_WORKERS];
+static volatile LONG g_io_running = 0;
+static int g_io_initialized = 0;
+static IoRingStats g_io_stats;
+
+static double io_ring_now_seconds(void) {
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+}
+
+static int io_ring_execute(const IoRingSqe* sqe, VFSFile* file) {
+    void* buffer = (void*)(uintptr_t)sqe->addr;
+    int positioned = file->kind == VFS_FILE_NODE && sqe->off != IO_RING_OFF_CURRENT;
+
+    switch (sqe->opcode) {
+        case IO_OP_READ:
+            if (file->kind == VFS_FILE_SOCKET) return netstack_recv(file->socket, buffer, sqe->len, 0);
+            if (positioned) {
+                size_t length = sqe->len;
+                const uint8_t* data = vfs_file_peek(file, sqe->off, &length);
+                if (length) memcpy(buffer, data, length);
+                return (int)length;
+            }
+            return vfs_file_read(file, buffer, sqe->len);
+        case IO_OP_WRITE:
+            if (file->kind == VFS_FILE_SOCKET) return netstack_send(file->socket, buffer, sqe->len, 0);
+            if (positioned) return vfs_file_store(file, sqe->off, buffer, sqe->len);
+            return vfs_file_write(file, buffer, sqe->len);
+        case IO_OP_SEND:
+            return netstack_send(file->socket, buffer, sqe->len, (int)sqe->op_flags);
+        case IO_OP_RECV:
+            return netstack_recv(file->socket, buffer, sqe->len, (int)sqe->op_flags);
+        default:
+            return -1;
+    }
+}
+
+// Post a completion; the ring lock is held
+static void io_ring_post(IoRing* ring, uint64_t user_data, int res) {
+    IoRingShared* shared = ring->shared;
+    IoRingCqe* cqe = &ring->cq[shared->cq_tail & shared->cq_mask];
+    cqe->user_data = user_data;
+    cqe->res = res;
+    cqe->flags = 0;
+    MemoryBarrier();                // Entry before tail
+    shared->cq_tail++;
+}
+
+static void io_ring_finish(IoRing* ring, IoRingWork* work, int res) {
+    EnterCriticalSection(&ring->lock);
+    io_ring_post(ring, work->sqe.user_data, res);
+    work->next = ring->free_work;
+    ring->free_work = work;
+    ring->inflight--;
+    int wake = ring->waiting;
+    ring->waiting = 0;
+    LeaveCriticalSection(&ring->lock);
+
+    InterlockedIncrement64((volatile LONGLONG*)&g_io_stats.completed);
+    if (wake) SetEvent(ring->event);
+}
+
+static DWORD WINAPI io_ring_worker(LPVOID param) {
+    (void)param;
+    for (;;) {
+        WaitForSingleObject(g_io_queue_sem, INFINITE);
+        if (!g_io_running) break;
+
+        EnterCriticalSection(&g_io_queue_lock);
+        IoRingWork* work = g_io_queue_head;
+        if (work) {
+            g_io_queue_head = work->next;
+            if (!g_io_queue_head) g_io_queue_tail = NULL;
+        }
+        LeaveCriticalSection(&g_io_queue_lock);
+        if (!work) continue;
+
+        // Only sockets, pipes and the console get here, and those lock for
+        // themselves, last release included
+        int res = io_ring_execute(&work->sqe, work->file);
+        vfs_file_release(work->file);
+
+        io_ring_finish(work->ring, work, res);
+    }
+    return 0;
+}
+
+int io_ring_init(void) {
+    if (g_io_initialized) return 0;
+
+    memset(&g_io_stats, 0, sizeof(g_io_stats));
+    InitializeCriticalSection(&g_io_queue_lock);
+    g_io_queue_sem = CreateSemaphoreA(NULL, 0, LONG_MAX, NULL);
+    if (!g_io_queue_sem) return -1;
+
+    g_io_running = 1;
+    for (int i = 0; i < IO_RING_WORKERS; i++) {
+        g_io_workers[i] = CreateThread(NULL, 0, io_ring_worker, NULL, 0, NULL);
+        if (!g_io_workers[i]) {
+            printf("[IORING] Failed to start worker %d\n", i);
+            return -1;
+        }
+    }
+    g_io_initialized = 1;
+    return 0;
+}
+
+// Rings should be gone by now; anything still queued is dropped
+void io_ring_cleanup(void) {
+    if (!g_io_initialized) return;
+
+    g_io_running = 0;
+    ReleaseSemaphore(g_io_queue_sem, IO_RING_WORKERS, NULL);
+    WaitForMultipleObjects(IO_RING_WORKERS, g_io_workers, TRUE, INFINITE);
+    for (int i = 0; i < IO_RING_WORKERS; i++) {
+        CloseHandle(g_io_workers[i]);
+    }
+    CloseHandle(g_io_queue_sem);
+    DeleteCriticalSection(&g_io_queue_lock);
+    g_io_queue_head = g_io_queue_tail = NULL;
+    g_io_initialized = 0;
+}
+
+IoRing* io_ring_create(IoRingShared* shared, uint32_t entries, VFSFdTable* fds) {
+    if (!shared || !fds || entries == 0 || entries > IO_RING_MAX_ENTRIES || (entries & (entries - 1))) {
+        return NULL;
+    }
+    if (io_ring_init() != 0) return NULL;
+
+    IoRing* ring = calloc(1, sizeof(IoRing));
+    IoRingWork* work = calloc(2 * entries, sizeof(IoRingWork));
+    HANDLE event = CreateEventA(NULL, FALSE, FALSE, NULL);
+    if (!ring || !work || !event) {
+        free(ring);
+        free(work);
+        if (event) CloseHandle(event);
+        return NULL;
+    }
+
+    memset(shared, 0, sizeof(IoRingShared));
+    shared->sq_entries = entries;
+    shared->sq_mask = entries - 1;
+    shared->cq_entries = 2 * entries;
+    shared->cq_mask = 2 * entries - 1;
+    shared->sq_offset = sizeof(IoRingShared);
+    shared->cq_offset = sizeof(IoRingShared) + entries * sizeof(IoRingSqe);
+
+    ring->shared = shared;
+    ring->sq = (IoRingSqe*)((uint8_t*)shared + shared->sq_offset);
+    ring->cq = (IoRingCqe*)((uint8_t*)shared + shared->cq_offset);
+    ring->fds = fds;
+    ring->event = event;
+    ring->work = work;
+    for (uint32_t i = 0; i < 2 * entries; i++) {
+        work[i].ring = ring;
+        work[i].next = ring->free_work;
+        ring->free_work = &work[i];
+    }
+    InitializeCriticalSection(&ring->lock);
+
+    g_io_stats.rings_created++;
+    return ring;
+}
+
+void io_ring_destroy(IoRing* ring) {
+    if (!ring) return;
+
+    // Workers still hold pointers into it
+    for (;;) {
+        EnterCriticalSection(&ring->lock);
+        if (ring->inflight == 0) {
+            LeaveCriticalSection(&ring->lock);
+            break;
+        }
+        ring->waiting = 1;
+        LeaveCriticalSection(&ring->lock);
+        WaitForSingleObject(ring->event, INFINITE);
+    }
+
+    DeleteCriticalSection(&ring->lock);
+    CloseHandle(ring->event);
+    free(ring->work);
+    free(ring);
+}
+
+// Open and close change the fd table, which belongs to the submitting
+// thread, so they complete here; -1 means the data operation can't start.
+// Reads and writes on VFS nodes complete here too: node data, sizes, the
+// directory aggregates and digests are only ever touched from this thread,
+// by the syscalls and the shell alike, so workers must keep off them.
+static int io_ring_inline(IoRing* ring, const IoRingSqe* sqe) {
+    switch (sqe->opcode) {
+        case IO_OP_NOP:
+            return 0;
+        case IO_OP_OPEN: {
+            VFSFile* file = vfs_file_open((const char*)(uintptr_t)sqe->addr, (int)sqe->op_flags);
+            if (!file) return -1;
+            int fd = vfs_fd_install(ring->fds, file, 0);
+            if (fd < 0) vfs_file_release(file);
+            return fd;
+        }
+        case IO_OP_CLOSE: {
+            VFSFile* file = vfs_fd_get(ring->fds, sqe->fd);
+            if (file && file->kind == VFS_FILE_OBJECT && file->object == ring) return -1;
+            return vfs_fd_close(ring->fds, sqe->fd);
+        }
+        default:
+            return -1;
+    }
+}
+
+// The open file a data operation works on, or NULL if it can't
+static VFSFile* io_ring_target(IoRing* ring, const IoRingSqe* sqe) {
+    VFSFile* file = vfs_fd_get(ring->fds, sqe->fd);
+    if (!file || !sqe->addr) return NULL;
+
+    switch (sqe->opcode) {
+        case IO_OP_READ:
+            return file->kind != VFS_FILE_OBJECT && vfs_file_readable(file) ? file : NULL;
+        case IO_OP_WRITE:
+            return file->kind != VFS_FILE_OBJECT && vfs_file_writable(file) ? file : NULL;
+        case IO_OP_SEND:
+        case IO_OP_RECV:
+            return file->kind == VFS_FILE_SOCKET ? file : NULL;
+        default:
+            return NULL;
+    }
+}
+
+int io_ring_submit(IoRing* ring, uint32_t to_submit) {
+    IoRingShared* shared = ring->shared;
+    uint32_t head = shared->sq_head;
+    uint32_t ready = shared->sq_tail - head;
+    MemoryBarrier();                // Tail before entries
+    if (to_submit > ready) to_submit = ready;
+
+    // Submit only what the CQ has room for; completions in flight and
+    // ones not yet reaped both hold a place
+    EnterCriticalSection(&ring->lock);
+    uint32_t used = ring->inflight + (shared->cq_tail - shared->cq_head);
+    uint32_t space = used < shared->cq_entries ? shared->cq_entries - used : 0;
+    LeaveCriticalSection(&ring->lock);
+    if (to_submit > space) to_submit = space;
+
+    IoRingWork* batch = NULL;
+    IoRingWork** link = &batch;
+    uint32_t queued = 0;
+
+    for (uint32_t i = 0; i < to_submit; i++, head++) {
+        const IoRingSqe* sqe = &ring->sq[head & shared->sq_mask];
+        if (sqe->opcode >= IO_OP_COUNT) {
+            shared->dropped++;
+            continue;
+        }
+        g_io_stats.ops[sqe->opcode]++;
+
+        VFSFile* file = NULL;
+        int inline_op = sqe->opcode == IO_OP_NOP || sqe->opcode == IO_OP_OPEN || sqe->opcode == IO_OP_CLOSE;
+        if (!inline_op) file = io_ring_target(ring, sqe);
+        if (!file || file->kind == VFS_FILE_NODE) {
+            int res = file ? io_ring_execute(sqe, file) : io_ring_inline(ring, sqe);
+            EnterCriticalSection(&ring->lock);
+            io_ring_post(ring, sqe->user_data, res);
+            LeaveCriticalSection(&ring->lock);
+            g_io_stats.inline_ops++;
+            InterlockedIncrement64((volatile LONGLONG*)&g_io_stats.completed);
+            continue;
+        }
+
+        EnterCriticalSection(&ring->lock);
+        IoRingWork* work = ring->free_work;
+        ring->free_work = work->next;
+        ring->inflight++;
+        LeaveCriticalSection(&ring->lock);
+
+        work->sqe = *sqe;
+        work->file = vfs_file_retain(file);
+        work->next = NULL;
+        *link = work;
+        link = &work->next;
+        queued++;
+    }
+
+    MemoryBarrier();
+    shared->sq_head = head;
+    g_io_stats.enters++;
+    g_io_stats.submitted += to_submit;
+
+    // Hand the batch over with one lock round trip
+    if (queued) {
+        EnterCriticalSection(&g_io_queue_lock);
+        if (g_io_queue_tail) {
+            g_io_queue_tail->next = batch;
+        } else {
+            g_io_queue_head = batch;
+        }
+        g_io_queue_tail = (IoRingWork*)((uint8_t*)link - offsetof(IoRingWork, next));
+        LeaveCriticalSection(&g_io_queue_lock);
+        ReleaseSemaphore(g_io_queue_sem, (LONG)queued, NULL);
+    }
+    return (int)to_submit;
+}
+
+int io_ring_wait(IoRing* ring, uint32_t min_complete) {
+    IoRingShared* shared = ring->shared;
+
+    for (;;) {
+        EnterCriticalSection(&ring->lock);
+        uint32_t ready = shared->cq_tail - shared->cq_head;
+        if (ready >= min_complete || ring->inflight == 0) {
+            LeaveCriticalSection(&ring->lock);
+            return (int)ready;
+        }
+        ring->waiting = 1;
+        LeaveCriticalSection(&ring->lock);
+
+        g_io_stats.waits++;
+        WaitForSingleObject(ring->event, INFINITE);
+    }
+}
+
+IoRingStats* io_ring_get_stats(void) {
+    return &g_io_stats;
+}
+
+void io_ring_dump_stats(void) {
+    static const char* const names[IO_OP_COUNT] = { "nop", "read", "write", "open", "close", "send", "recv" };
+
+    printf("[IORING] %d workers %s, %llu rings created\n", IO_RING_WORKERS,
+           g_io_initialized ? "running" : "stopped", (unsigned long long)g_io_stats.rings_created);
+    printf("[IORING] %llu enters, %llu submitted, %llu completed (%llu inline), %llu waits\n",
+           (unsigned long long)g_io_stats.enters, (unsigned long long)g_io_stats.submitted,
+           (unsigned long long)g_io_stats.completed, (unsigned long long)g_io_stats.inline_ops,
+           (unsigned long long)g_io_stats.waits);
+    printf("[IORING] Operations:");
+    for (int op = 0; op < IO_OP_COUNT; op++) {
+        printf(" %s %llu", names[op], (unsigned long long)g_io_stats.ops[op]);
+    }
+    printf("\n");
+}
+
+// ===== BENCHMARK =====
+
+// Syscall pointers are 32-bit, so the benchmark's "guest" memory has to
+// sit below 4 GB of the host address space
+static void* io_bench_alloc_low(size_t size) {
+    for (uintptr_t addr = 0x10000000; addr + size < 0xF0000000u; addr += 0x1000000) {
+        void* block = VirtualAlloc((void*)addr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (block) return block;
+    }
+    return NULL;
+}
+
+static uint32_t io_bench_addr(const void* p) {
+    return (uint32_t)(uintptr_t)p;
+}
+
+// Copy src to dst with a read() and a write() per chunk
+static int io_bench_copy_sync(const char* src, const char* dst, uint8_t* buffer, uint32_t chunk,
+                              uint64_t* syscalls) {
+    int in = syscall_dispatch(SYS_open, io_bench_addr(src), SYS_O_RDONLY, 0, 0, 0);
+    int out = syscall_dispatch(SYS_open, io_bench_addr(dst), SYS_O_WRONLY | SYS_O_CREAT | SYS_O_TRUNC, 0, 0, 0);
+    *syscalls += 2;
+    if (in < 0 || out < 0) return -1;
+
+    int ok = 0;
+    for (;;) {
+        int got = syscall_dispatch(SYS_read, (uint32_t)in, io_bench_addr(buffer), chunk, 0, 0);
+        (*syscalls)++;
+        if (got <= 0) {
+            ok = got == 0 ? 0 : -1;
+            break;
+        }
+        int put = syscall_dispatch(SYS_write, (uint32_t)out, io_bench_addr(buffer), (uint32_t)got, 0, 0);
+        (*syscalls)++;
+        if (put != got) {
+            ok = -1;
+            break;
+        }
+    }
+    syscall_dispatch(SYS_close, (uint32_t)in, 0, 0, 0, 0);
+    syscall_dispatch(SYS_close, (uint32_t)out, 0, 0, 0, 0);
+    *syscalls += 2;
+    return ok;
+}
+
+typedef struct {
+    IoRingShared* shared;
+    IoRingSqe* sq;
+    IoRingCqe* cq;
+    int fd;
+    uint32_t pending;               // SQEs filled since the last enter
+    uint64_t* syscalls;
+} IoBenchRing;
+
+static void io_bench_queue(IoBenchRing* r, uint8_t opcode, int fd, uint32_t addr, uint32_t len,
+                           uint32_t off, uint32_t op_flags, uint64_t user_data) {
+    IoRingSqe* sqe = &r->sq[r->shared->sq_tail & r->shared->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = addr;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->op_flags = op_flags;
+    sqe->user_data = user_data;
+    MemoryBarrier();
+    r->shared->sq_tail++;
+    r->pending++;
+}
+
+static void io_bench_enter(IoBenchRing* r, uint32_t min_complete) {
+    int submitted = syscall_dispatch(SYS_io_uring_enter, (uint32_t)r->fd, r->pending, min_complete,
+                                     IO_ENTER_GETEVENTS, 0);
+    (*r->syscalls)++;
+    if (submitted > 0) r->pending -= (uint32_t)submitted;
+}
+
+static int io_bench_reap(IoBenchRing* r, IoRingCqe* out) {
+    IoRingShared* shared = r->shared;
+    if (shared->cq_head == shared->cq_tail) return 0;
+    MemoryBarrier();
+    *out = r->cq[shared->cq_head & shared->cq_mask];
+    shared->cq_head++;
+    return 1;
+}
+
+// Copy src to dst keeping up to `depth` chunks queued: each slot reads its
+// chunk, then writes it at the same offset, then takes the next one.  One
+// enter per round submits everything queued; file I/O completes inside it.
+static int io_bench_copy_ring(const char* src, const char* dst, void* memory, uint32_t depth, uint8_t* buffers,
+                              uint32_t chunk, size_t size, uint64_t* syscalls) {
+    IoBenchRing r = { memory, NULL, NULL, -1, 0, syscalls };
+    r.fd = syscall_dispatch(SYS_io_uring_setup, depth, io_bench_addr(memory), 0, 0, 0);
+    (*syscalls)++;
+    if (r.fd < 0) return -1;
+    r.sq = (IoRingSqe*)((uint8_t*)memory + r.shared->sq_offset);
+    r.cq = (IoRingCqe*)((uint8_t*)memory + r.shared->cq_offset);
+
+    int fds[2] = { -1, -1 };
+    IoRingCqe cqe;
+    io_bench_queue(&r, IO_OP_OPEN, 0, io_bench_addr(src), 0, 0, SYS_O_RDONLY, 0);
+    io_bench_queue(&r, IO_OP_OPEN, 0, io_bench_addr(dst), 0, 0, SYS_O_WRONLY | SYS_O_CREAT | SYS_O_TRUNC, 1);
+    io_bench_enter(&r, 2);
+    while (io_bench_reap(&r, &cqe)) fds[cqe.user_data] = cqe.res;
+
+    uint32_t* offsets = calloc(depth, sizeof(uint32_t));
+    int ok = fds[0] >= 0 && fds[1] >= 0 && offsets ? 0 : -1;
+    size_t next = 0;
+    uint32_t active = 0;
+
+    // user_data: slot << 1 | 1 for a write
+    for (uint32_t slot = 0; ok == 0 && slot < depth && next < size; slot++, next += chunk) {
+        io_bench_queue(&r, IO_OP_READ, fds[0], io_bench_addr(buffers + (size_t)slot * chunk), chunk,
+                       (uint32_t)next, 0, (uint64_t)slot << 1);
+        offsets[slot] = (uint32_t)next;
+        active++;
+    }
+
+    while (ok == 0 && active > 0) {
+        io_bench_enter(&r, 1);
+        while (io_bench_reap(&r, &cqe)) {
+            uint32_t slot = (uint32_t)(cqe.user_data >> 1);
+            uint8_t* buffer = buffers + (size_t)slot * chunk;
+            if (cqe.res < 0) {
+                ok = -1;
+            } else if (!(cqe.user_data & 1)) {
+                io_bench_queue(&r, IO_OP_WRITE, fds[1], io_bench_addr(buffer), (uint32_t)cqe.res,
+                               offsets[slot], 0, cqe.user_data | 1);
+            } else if (next < size) {
+                offsets[slot] = (uint32_t)next;
+                io_bench_queue(&r, IO_OP_READ, fds[0], io_bench_addr(buffer), chunk, (uint32_t)next, 0,
+                               (uint64_t)slot << 1);
+                next += chunk;
+            } else {
+                active--;
+            }
+        }
+    }
+    free(offsets);
+
+    // Closing the ring waits for anything an error left in flight
+    for (int i = 0; i < 2; i++) {
+        if (fds[i] >= 0) io_bench_queue(&r, IO_OP_CLOSE, fds[i], 0, 0, 0, 0, 2);
+    }
+    io_bench_enter(&r, r.pending);
+    while (io_bench_reap(&r, &cqe)) {}
+    syscall_dispatch(SYS_close, (uint32_t)r.fd, 0, 0, 0, 0);     // Waits for anything in flight
+    (*syscalls)++;
+    return ok;
+}
+
+void io_ring_benchmark(uint32_t size_kb, uint32_t chunk_kb, uint32_t depth) {
+    if (size_kb == 0) size_kb = 64 * 1024;
+    if (chunk_kb == 0) chunk_kb = 64;
+    if (depth == 0) depth = 64;
+    if (depth > IO_RING_MAX_ENTRIES / 2) depth = IO_RING_MAX_ENTRIES / 2;
+    depth = 1u << (31 - __builtin_clz(depth));     // Rings come in powers of two
+    if (size_kb < chunk_kb) chunk_kb = size_kb;
+
+    size_t size = (size_t)size_kb << 10;
+    uint32_t chunk = chunk_kb << 10;
+    size_t ring_bytes = (IO_RING_BYTES(depth) + 4095) & ~(size_t)4095;
+    size_t low_bytes = ring_bytes + (size_t)depth * chunk + 4096;
+
+    uint8_t* low = io_bench_alloc_low(low_bytes);
+    uint8_t* data = malloc(size);
+    if (!low || !data) {
+        printf("bench ioring: out of memory%s\n", low ? "" : " below 4 GB");
+        if (low) VirtualFree(low, 0, MEM_RELEASE);
+        free(data);
+        return;
+    }
+    uint8_t* buffers = low + ring_bytes;
+    char* src = (char*)(buffers + (size_t)depth * chunk);
+    char* dst = src + 64;
+    strcpy(src, "/tmp/ioringbench.src");
+    strcpy(dst, "/tmp/ioringbench.dst");
+
+    uint32_t seed = 0x9E3779B9;
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        data[i] = (uint8_t)(seed >> 24);
+    }
+    if (vfs_write_file(src, data, size) != 0) {
+        printf("bench ioring: cannot create %s\n", src);
+        VirtualFree(low, 0, MEM_RELEASE);
+        free(data);
+        return;
+    }
+
+    uint64_t calls[2] = { 0, 0 };
+    double seconds[2];
+    int ok[2];
+
+    double start = io_ring_now_seconds();
+    ok[0] = io_bench_copy_sync(src, dst, buffers, chunk, &calls[0]) == 0;
+    seconds[0] = io_ring_now_seconds() - start;
+    VNode* node = vfs_find_node(dst);
+    ok[0] = ok[0] && node && node->size == size && memcmp(node->data, data, size) == 0;
+
+    start = io_ring_now_seconds();
+    ok[1] = io_bench_copy_ring(src, dst, low, depth, buffers, chunk, size, &calls[1]) == 0;
+    seconds[1] = io_ring_now_seconds() - start;
+    node = vfs_find_node(dst);
+    ok[1] = ok[1] && node && node->size == size && memcmp(node->data, data, size) == 0;
+
+    static const char* const modes[] = { "Syscall per op", "Ring" };
+    double mb = (double)size / (1024.0 * 1024.0);
+    printf("bench ioring: copy %u KB in %u KB chunks, ring depth %u, %d workers\n",
+           size_kb, chunk_kb, depth, IO_RING_WORKERS);
+    printf("  %-16s %10s %10s %10s %8s\n", "", "Time", "MB/s", "Syscalls", "Check");
+    for (int mode = 0; mode < 2; mode++) {
+        printf("  %-16s %7.2f ms %10.1f %10llu %8s\n", modes[mode], seconds[mode] * 1e3,
+               seconds[mode] > 0 ? mb / seconds[mode] : 0.0, (unsigned long long)calls[mode],
+               ok[mode] ? "ok" : "FAILED");
+    }
+    if (calls[1] > 0) {
+        printf("  Syscalls cut %.1fx; ring time %.2fx of per-op\n", (double)calls[0] / (double)calls[1],
+               seconds[0] > 0 ? seconds[1] / seconds[0] : 0.0);
+    }
+
+    vfs_delete_file(dst);
+    vfs_delete_file(src);
+    VirtualFree(low, 0, MEM_RELEASE);
+    free(data);
+}
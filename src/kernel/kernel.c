@@ -14,6 +14,8 @@
 #include "kernel/scheduler.h"
 #include "kernel/mmu.h"
 #include "kernel/interrupts.h"
+#include "kernel/timer.h"
+#include "kernel/io_ring.h"
 #include "kernel/network_stack.h"
 
 // Global kernel state
@@ -129,12 +131,21 @@ int kernel_check_hardware(void) {
 int kernel_init_memory_manager(void) {
     kernel_log("MM", "Initializing memory management subsystem...");
     
-    if (memory_init(MEMORY_SIZE) == NULL) {
+    LARGE_INTEGER freq, start, end;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+    Memory* mem = memory_init(memory_configured_size());
+    QueryPerformanceCounter(&end);
+    if (mem == NULL) {
         kernel_error("Failed to initialize memory manager");
         return -1;
     }
     
-    kernel_log("MM", "Memory manager initialized - %d MB virtual memory", MEMORY_SIZE / (1024 * 1024));
+    kernel_log("MM", "Memory manager initialized - %zu MB guest RAM reserved%s in %.2f ms",
+               memory_get_total() / (1024 * 1024), mem->large_pages ? " (large pages)" : "",
+               (double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)freq.QuadPart);
+    kernel_log("MM", "Committed %zu KB, host RSS %zu MB",
+               memory_get_used() / 1024, memory_get_host_resident() / (1024 * 1024));
     return 0;
 }
 
@@ -239,6 +250,13 @@ int kernel_late_init(void) {
         return -1;
     }
     
+    // Kernel timers, so subsystems can arm them as they come up
+    kernel_log("INIT", "Initializing timer wheel...");
+    if (timer_init() != 0) {
+        kernel_error("Failed to initialize timers");
+        return -1;
+    }
+    
     // Initialize all major subsystems
     if (kernel_init_memory_manager() != 0) return -1;
     if (kernel_init_scheduler() != 0) return -1;
@@ -260,18 +278,42 @@ int kernel_late_init(void) {
     kernel_log("INIT", "Enabling interrupts...");
     interrupts_enable();
     
+    // Start the interval timer: 1 ms ticks while there is work, tickless
+    // when idle
+    timer_set_busy_check(scheduler_has_work);
+    if (timer_start_clock(kernel_timer_tick) != 0) {
+        kernel_error("Failed to start the system clock");
+        return -1;
+    }
+    
     kernel_log("INIT", "Late initialization completed successfully");
     return 0;
 }
 
+// Clock thread entry: one call may stand for many ticks when idle
 void kernel_timer_tick(void) {
     EnterCriticalSection(&g_kernel_lock);
-    g_tick_counter++;
+    g_tick_counter = timer_clock_ticks();
     g_kernel_stats.uptime_ticks = g_tick_counter;
     LeaveCriticalSection(&g_kernel_lock);
     
-    // Trigger scheduler tick
-    scheduler_tick();
+    // Timer IRQ: expired timers, then the scheduler.  Post it like any
+    // device so a running CPU loop takes it at a block boundary; a tick
+    // still queued covers this one too, since the handler reads the clock.
+    // With no CPU loop running the poll delivers it right here.
+    if (!(interrupt_doorbell & (1u << (INT_TIMER - IRQ_POST_FIRST)))) {
+        if (interrupt_post(INT_TIMER, 0) != 0) {
+            // Ring full: deliver inline only while holding the claim, so
+            // handlers never run on two threads.  If a CPU loop holds it,
+            // it is draining the ring and the next tick covers this one.
+            if (interrupt_claim()) {
+                interrupt_raise(INT_TIMER);
+                interrupt_release();
+            }
+            return;
+        }
+    }
+    interrupt_poll();
 }
 
 void kernel_schedule(void) {
@@ -451,10 +493,9 @@ int kernel_main(void) {
     kernel_log("SECURITY", " System is CLEAN! No Java contamination detected.");
     kernel_log("SECURITY", "Kernel integrity maintained. Proceeding with normal operation.");
     
-    // Main kernel loop with timer
+    // The clock thread drives the timer; this thread just stays alive
     while (g_kernel_state == KERNEL_STATE_RUNNING) {
-        kernel_timer_tick();
-        Sleep(1); // 1ms timer resolution
+        Sleep(TIMER_IDLE_MAX_MS);
     }
     
     return 0;
@@ -497,6 +538,8 @@ void kernel_shutdown(void) {
     kernel_set_state(KERNEL_STATE_SHUTTING_DOWN);
     
     // Cleanup subsystems
+    timer_stop_clock();
+    io_ring_cleanup();
     cpu_cleanup();
     device_cleanup();
     
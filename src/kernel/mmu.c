@@ -1,10 +1,17 @@
 #include "kernel/mmu.h"
 #include "kernel/privilege.h"
+#include "memory.h"
+#include "cpu.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <windows.h>  // For VirtualAlloc
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MMU_FILL_SSE2 1
+#endif
+
 // Windows-compatible aligned allocation
 static void* windows_aligned_alloc(size_t alignment, size_t size) {
     // Use VirtualAlloc for page-aligned allocation on Windows
@@ -26,38 +33,90 @@ static void windows_aligned_free(void* ptr, size_t size) {
 
 // Global MMU state
 static PageDirectory* g_kernel_page_directory = NULL;
-static PageDirectory* g_current_page_directory = NULL;
-static FrameAllocator g_frame_allocator;
-static TLBStats g_tlb_stats;
 static int g_paging_enabled = 0;
 static int g_mmu_initialized = 0;
 
-// Physical memory size (64MB as defined in original memory.c)
-#define PHYSICAL_MEMORY_SIZE (64 * 1024 * 1024)
-#define TOTAL_FRAMES (PHYSICAL_MEMORY_SIZE / PAGE_SIZE)
+// Software TLBs, one per CPU, each shared by all address spaces and told
+// apart by ASID.  ASIDs are global; g_asid_lock covers handing them out.
+MMUCpu mmu_cpus[FRAME_CPU_COUNT];
+static PageDirectory* g_asid_owner[MMU_ASID_COUNT];
+static CRITICAL_SECTION g_asid_lock;
+
+static inline MMUCpu* mmu_this_cpu(void) {
+    return &mmu_cpus[mmu_current_cpu];
+}
+
+// Copy-on-write faults taken, and how many of them had to copy the page
+static uint64_t g_cow_faults = 0;
+static uint64_t g_cow_copies = 0;
+
+// Flags mmu_map_page()/mmu_map_range() copy into an entry; the CPU side
+// (accessed, dirty) starts clear and the size bit is the directory's
+#define PTE_MAP_FLAGS (PAGE_OFFSET_MASK & ~(PAGE_ACCESSED | PAGE_DIRTY | PAGE_SIZE_FLAG))
+
+// A present directory entry either maps a 4 MB page or points at a table
+static inline int pde_is_large(PageDirectoryEntry pde) {
+    return (pde & (PAGE_PRESENT | PAGE_SIZE_FLAG)) == (PAGE_PRESENT | PAGE_SIZE_FLAG);
+}
+
+// Physical memory size when guest RAM is not set up yet (the memory.c default)
+#define PHYSICAL_MEMORY_SIZE MEMORY_SIZE
 
-// Frame bitmap
-static uint32_t g_frame_bitmap[TOTAL_FRAMES / 32];
+// The kernel directory identity-maps guest RAM, but page tables are only
+// built for pages that are actually used (see mmu_kernel_demand_map)
+static uint64_t g_kernel_identity_limit = 0;
 
-// Helper: Check if frame is allocated
-static int is_frame_allocated(uint32_t frame) {
-    uint32_t index = frame / 32;
-    uint32_t bit = frame % 32;
-    return (g_frame_bitmap[index] & (1 << bit)) != 0;
+// ASID of a page directory, handing out a new one on first use.  When all
+// are taken every TLB is flushed and numbering starts over, with the
+// directories CPUs are running in first.  Call with g_asid_lock held.
+static uint32_t mmu_asid_for(PageDirectory* dir) {
+    uint32_t free_asid = 0;
+    for (uint32_t asid = 1; asid < MMU_ASID_COUNT; asid++) {
+        if (g_asid_owner[asid] == dir) return asid;
+        if (!free_asid && !g_asid_owner[asid]) free_asid = asid;
+    }
+    if (!free_asid) {
+        mmu_flush_tlb();
+        memset(g_asid_owner, 0, sizeof(g_asid_owner));
+        for (int i = 0; i < FRAME_CPU_COUNT; i++) {
+            if (mmu_cpus[i].directory) mmu_cpus[i].asid = mmu_asid_for(mmu_cpus[i].directory);
+        }
+        return mmu_asid_for(dir);
+    }
+    g_asid_owner[free_asid] = dir;
+    return free_asid;
 }
 
-// Helper: Set frame as allocated
-static void set_frame_allocated(uint32_t frame) {
-    uint32_t index = frame / 32;
-    uint32_t bit = frame % 32;
-    g_frame_bitmap[index] |= (1 << bit);
+// Drop a destroyed directory's entries from every TLB so its ASID can be
+// reused safely
+static void mmu_release_asid(PageDirectory* dir) {
+    if (!g_mmu_initialized) return;
+    EnterCriticalSection(&g_asid_lock);
+    for (uint32_t asid = 1; asid < MMU_ASID_COUNT; asid++) {
+        if (g_asid_owner[asid] != dir) continue;
+        for (int c = 0; c < FRAME_CPU_COUNT; c++) {
+            MMUCpu* cpu = &mmu_cpus[c];
+            for (int i = 0; i < MMU_TLB_ENTRIES; i++) {
+                if (cpu->tlb[i].read_tag != MMU_TLB_INVALID && (cpu->tlb[i].read_tag & PAGE_OFFSET_MASK) == asid) {
+                    cpu->tlb[i].read_tag = cpu->tlb[i].write_tag = MMU_TLB_INVALID;
+                    cpu->stats.asid_flushes++;
+                    cpu->stats.entries_flushed++;
+                }
+            }
+        }
+        g_asid_owner[asid] = NULL;
+    }
+    LeaveCriticalSection(&g_asid_lock);
 }
 
-// Helper: Set frame as free
-static void set_frame_free(uint32_t frame) {
-    uint32_t index = frame / 32;
-    uint32_t bit = frame % 32;
-    g_frame_bitmap[index] &= ~(1 << bit);
+// Make dir current on this thread's CPU.  TLB entries are tagged with the
+// ASID, so nothing needs flushing.
+static void mmu_set_current_directory(PageDirectory* dir) {
+    MMUCpu* cpu = mmu_this_cpu();
+    EnterCriticalSection(&g_asid_lock);
+    cpu->directory = dir;
+    cpu->asid = dir ? mmu_asid_for(dir) : 1;
+    LeaveCriticalSection(&g_asid_lock);
 }
 
 // Initialize MMU
@@ -68,39 +127,40 @@ int mmu_init(void) {
     
     printf("[MMU] Initializing memory management unit...\n");
     
-    // Initialize frame allocator
-    memset(&g_frame_allocator, 0, sizeof(FrameAllocator));
-    memset(g_frame_bitmap, 0, sizeof(g_frame_bitmap));
-    
-    g_frame_allocator.total_frames = TOTAL_FRAMES;
-    g_frame_allocator.free_frames = TOTAL_FRAMES;
-    g_frame_allocator.used_frames = 0;
-    g_frame_allocator.first_free_frame = 0;
+    // Initialize frame allocator: one frame per page of guest RAM
+    uint64_t ram_size = memory_get_total() ? memory_get_total() : PHYSICAL_MEMORY_SIZE;
+    if (mmu_frames_init((uint32_t)(ram_size / PAGE_SIZE)) != 0) {
+        printf("[MMU] Failed to set up the frame allocator\n");
+        return -1;
+    }
     
-    // Initialize TLB stats
-    memset(&g_tlb_stats, 0, sizeof(TLBStats));
+    // Initialize the TLBs
+    memset(mmu_cpus, 0, sizeof(mmu_cpus));
+    memset(g_asid_owner, 0, sizeof(g_asid_owner));
+    InitializeCriticalSection(&g_asid_lock);
     
     // Create kernel page directory
     g_kernel_page_directory = mmu_create_page_directory();
     if (!g_kernel_page_directory) {
         printf("[MMU] Failed to create kernel page directory\n");
+        DeleteCriticalSection(&g_asid_lock);
         return -1;
     }
     
-    // Identity map kernel space (only first 64MB for now, not full 1GB)
-    // Mapping 1GB would require too much memory for page tables
-    printf("[MMU] Identity mapping kernel space (0x00000000 - 0x03FFFFFF = 64MB)...\n");
-    mmu_identity_map_range(g_kernel_page_directory, 0x00000000, PHYSICAL_MEMORY_SIZE,
-                          PAGE_PRESENT | PAGE_WRITABLE | PAGE_KERNEL);
+    // Identity map kernel space over all of guest RAM.  Page tables are
+    // filled in on first access rather than for every page at boot.
+    g_kernel_identity_limit = ram_size;
+    printf("[MMU] Identity mapping kernel space (0x00000000 - 0x%08llX, on demand)...\n",
+           (unsigned long long)(ram_size - 1));
     
     // Set as current page directory
-    g_current_page_directory = g_kernel_page_directory;
+    mmu_set_current_directory(g_kernel_page_directory);
     
     g_mmu_initialized = 1;
     
     printf("[MMU] Initialized successfully\n");
-    printf("[MMU] Total frames: %d (%d MB)\n", g_frame_allocator.total_frames,
-           g_frame_allocator.total_frames * PAGE_SIZE / 1024 / 1024);
+    printf("[MMU] Total frames: %u (%u MB)\n", mmu_get_frame_allocator()->total_frames,
+           mmu_get_frame_allocator()->total_frames / (1024 * 1024 / PAGE_SIZE));
     
     return 0;
 }
@@ -114,8 +174,12 @@ void mmu_cleanup(void) {
         g_kernel_page_directory = NULL;
     }
     
-    g_current_page_directory = NULL;
+    for (int i = 0; i < FRAME_CPU_COUNT; i++) mmu_cpus[i].directory = NULL;
+    g_kernel_identity_limit = 0;
+    mmu_frames_cleanup();
     g_mmu_initialized = 0;
+    mmu_flush_tlb();
+    DeleteCriticalSection(&g_asid_lock);
     
     printf("[MMU] Cleaned up\n");
 }
@@ -125,8 +189,9 @@ void mmu_enable_paging(void) {
     if (!g_mmu_initialized || g_paging_enabled) return;
     
     // In real kernel, would load CR3 with page directory address and set CR0.PG bit
-    // For simulation, just mark as enabled
+    // For simulation, just mark as enabled; identity-mapped TLB entries go
     g_paging_enabled = 1;
+    mmu_flush_tlb();
     
     printf("[MMU] Paging enabled\n");
 }
@@ -137,6 +202,7 @@ void mmu_disable_paging(void) {
     
     // In real kernel, would clear CR0.PG bit
     g_paging_enabled = 0;
+    mmu_flush_tlb();
     
     printf("[MMU] Paging disabled\n");
 }
@@ -156,11 +222,21 @@ PageDirectory* mmu_create_page_directory(void) {
 void mmu_destroy_page_directory(PageDirectory* dir) {
     if (!dir) return;
     
-    // Free all page tables
+    mmu_release_asid(dir);
+    
+    // Free all page tables, dropping this directory's reference to each
+    // user page (kernel identity pages do not own their frames)
     for (int i = 0; i < PAGE_DIRECTORY_ENTRIES; i++) {
-        if (dir->entries[i].present) {
-            PageTable* table = (PageTable*)(uintptr_t)(dir->entries[i].table_addr << PAGE_SHIFT);
+        PageTable* table = dir->tables[i];
+        if (table) {
+            for (int j = 0; j < PAGE_TABLE_ENTRIES; j++) {
+                if ((table->entries[j] & (PAGE_PRESENT | PAGE_USER)) == (PAGE_PRESENT | PAGE_USER)) {
+                    mmu_free_frame(PTE_FRAME(table->entries[j]));
+                }
+            }
             windows_aligned_free(table, sizeof(PageTable));
+        } else if (pde_is_large(dir->entries[i]) && (dir->entries[i] & PAGE_USER)) {
+            mmu_free_frames(PTE_FRAME(dir->entries[i] & LARGE_PAGE_MASK), PAGE_TABLE_ENTRIES);
         }
     }
     
@@ -169,15 +245,13 @@ void mmu_destroy_page_directory(PageDirectory* dir) {
 
 // Switch page directory
 void mmu_switch_page_directory(PageDirectory* dir) {
-    if (!dir) return;
-    
-    g_current_page_directory = dir;
+    if (!dir || !g_mmu_initialized) return;
     
-    // In real kernel, would load CR3 with directory physical address
-    // This automatically flushes TLB
-    g_tlb_stats.full_flushes++;
+    mmu_set_current_directory(dir);
     
+#if ZORA_VERBOSE_BOOT
     printf("[MMU] Switched page directory\n");
+#endif
 }
 
 // Get kernel page directory
@@ -185,48 +259,76 @@ PageDirectory* mmu_get_kernel_page_directory(void) {
     return g_kernel_page_directory;
 }
 
-// Get current page directory
+// Get the current page directory of this thread's CPU
 PageDirectory* mmu_get_current_page_directory(void) {
-    return g_current_page_directory;
-}
-
-// Allocate physical frame
-uint32_t mmu_alloc_frame(void) {
-    // Find first free frame
-    for (uint32_t frame = g_frame_allocator.first_free_frame; 
-         frame < g_frame_allocator.total_frames; frame++) {
-        if (!is_frame_allocated(frame)) {
-            set_frame_allocated(frame);
-            g_frame_allocator.used_frames++;
-            g_frame_allocator.free_frames--;
-            g_frame_allocator.first_free_frame = frame + 1;
-            return frame;
-        }
+    return mmu_this_cpu()->directory;
+}
+
+// Copy one physical frame to another.  Goes through memory_write_block()
+// so translated code in the destination is invalidated.
+static void mmu_copy_frame(uint32_t dst_frame, uint32_t src_frame) {
+    uint8_t* ram = memory_map(0, memory_get_total());
+    if (!ram) return;
+    memory_write_block(dst_frame << PAGE_SHIFT, ram + ((size_t)src_frame << PAGE_SHIFT), PAGE_SIZE);
+}
+
+// Fill in the kernel identity mapping on first use.  Returns 0 if
+// virtual_addr is (now) mapped that way, -1 if it is outside it.
+static int mmu_kernel_demand_map(PageDirectory* dir, uint32_t virtual_addr) {
+    if (dir != g_kernel_page_directory || virtual_addr >= g_kernel_identity_limit) return -1;
+    
+    // A 4 MB stretch that is all RAM gets a large page rather than a table
+    uint32_t base = virtual_addr & LARGE_PAGE_MASK;
+    if (!(dir->entries[PD_INDEX(base)] & PAGE_PRESENT) && (uint64_t)base + LARGE_PAGE_SIZE <= g_kernel_identity_limit) {
+        return mmu_map_range(dir, base, base, LARGE_PAGE_SIZE, PAGE_PRESENT | PAGE_WRITABLE | PAGE_KERNEL | PAGE_SIZE_FLAG);
     }
-    
-    printf("[MMU] Out of physical memory!\n");
-    return 0xFFFFFFFF;
+    return mmu_map_page(dir, PAGE_ALIGN_DOWN(virtual_addr), PAGE_ALIGN_DOWN(virtual_addr),
+                        PAGE_PRESENT | PAGE_WRITABLE | PAGE_KERNEL);
 }
 
-// Free physical frame
-void mmu_free_frame(uint32_t frame) {
-    if (frame >= g_frame_allocator.total_frames) return;
+// Write count consecutive PTEs from first, mapping successive frames
+// starting with entry's.  Four entries per store with SSE2.
+static void mmu_fill_table(PageTable* table, uint32_t first, uint32_t count, PageTableEntry entry) {
+    PageTableEntry* out = &table->entries[first];
+    uint32_t i = 0;
+    
+#ifdef MMU_FILL_SSE2
+    __m128i value = _mm_add_epi32(_mm_set1_epi32((int)entry),
+                                  _mm_setr_epi32(0, PAGE_SIZE, 2 * PAGE_SIZE, 3 * PAGE_SIZE));
+    __m128i step = _mm_set1_epi32(4 * PAGE_SIZE);
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_si128((__m128i*)(out + i), value);
+        value = _mm_add_epi32(value, step);
+    }
+    entry += i * PAGE_SIZE;
+#endif
     
-    if (is_frame_allocated(frame)) {
-        set_frame_free(frame);
-        g_frame_allocator.used_frames--;
-        g_frame_allocator.free_frames++;
-        
-        if (frame < g_frame_allocator.first_free_frame) {
-            g_frame_allocator.first_free_frame = frame;
-        }
+    for (; i < count; i++) {
+        out[i] = entry;
+        entry += PAGE_SIZE;
+    }
+}
+
+// Replace a 4 MB page with a page table mapping the same frames, so that
+// part of it can be remapped, unmapped or protected on its own
+static PageTable* mmu_split_large_page(PageDirectory* dir, uint32_t pd_index) {
+    PageDirectoryEntry pde = dir->entries[pd_index];
+    PageTable* table = (PageTable*)windows_aligned_alloc(PAGE_SIZE, sizeof(PageTable));
+    if (!table) {
+        return NULL;
     }
+    
+    mmu_fill_table(table, 0, PAGE_TABLE_ENTRIES, pde & ~PAGE_SIZE_FLAG);
+    dir->tables[pd_index] = table;
+    dir->entries[pd_index] = PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+    return table;
 }
 
-// Check if frame is allocated
-int mmu_is_frame_allocated(uint32_t frame) {
-    if (frame >= g_frame_allocator.total_frames) return 0;
-    return is_frame_allocated(frame);
+// The PTE for virtual_addr, or NULL if no page table covers it (large
+// pages have none)
+static inline PageTableEntry* mmu_find_pte(PageDirectory* dir, uint32_t virtual_addr) {
+    PageTable* table = dir->tables[PD_INDEX(virtual_addr)];
+    return table ? &table->entries[PT_INDEX(virtual_addr)] : NULL;
 }
 
 // Get or create page table for directory entry
@@ -234,8 +336,11 @@ static PageTable* get_or_create_page_table(PageDirectory* dir, uint32_t pd_index
     if (!dir) return NULL;
     
     // If page table exists, return it
-    if (dir->entries[pd_index].present) {
-        return (PageTable*)(uintptr_t)(dir->entries[pd_index].table_addr << PAGE_SHIFT);
+    if (dir->tables[pd_index]) {
+        return dir->tables[pd_index];
+    }
+    if (pde_is_large(dir->entries[pd_index])) {
+        return mmu_split_large_page(dir, pd_index);
     }
     
     // Allocate new page table
@@ -247,10 +352,8 @@ static PageTable* get_or_create_page_table(PageDirectory* dir, uint32_t pd_index
     memset(table, 0, sizeof(PageTable));
     
     // Setup directory entry
-    dir->entries[pd_index].present = 1;
-    dir->entries[pd_index].writable = 1;
-    dir->entries[pd_index].user_mode = 1;
-    dir->entries[pd_index].table_addr = (uint32_t)((uintptr_t)table >> PAGE_SHIFT);
+    dir->tables[pd_index] = table;
+    dir->entries[pd_index] = PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
     
     return table;
 }
@@ -259,26 +362,14 @@ static PageTable* get_or_create_page_table(PageDirectory* dir, uint32_t pd_index
 int mmu_map_page(PageDirectory* dir, uint32_t virtual_addr, uint32_t physical_addr, uint32_t flags) {
     if (!dir) return -1;
     
-    // Extract indices
-    uint32_t pd_index = PD_INDEX(virtual_addr);
-    uint32_t pt_index = PT_INDEX(virtual_addr);
-    
     // Get or create page table
-    PageTable* table = get_or_create_page_table(dir, pd_index);
+    PageTable* table = get_or_create_page_table(dir, PD_INDEX(virtual_addr));
     if (!table) {
         return -1;
     }
     
-    // Setup page table entry
-    table->entries[pt_index].present = (flags & PAGE_PRESENT) ? 1 : 0;
-    table->entries[pt_index].writable = (flags & PAGE_WRITABLE) ? 1 : 0;
-    table->entries[pt_index].user_mode = (flags & PAGE_USER) ? 1 : 0;
-    table->entries[pt_index].write_through = (flags & PAGE_WRITE_THROUGH) ? 1 : 0;
-    table->entries[pt_index].cache_disable = (flags & PAGE_CACHE_DISABLE) ? 1 : 0;
-    table->entries[pt_index].accessed = 0;
-    table->entries[pt_index].dirty = 0;
-    table->entries[pt_index].global = (flags & PAGE_GLOBAL) ? 1 : 0;
-    table->entries[pt_index].frame = physical_addr >> PAGE_SHIFT;
+    // Setup page table entry; accessed and dirty start clear
+    table->entries[PT_INDEX(virtual_addr)] = PAGE_ALIGN_DOWN(physical_addr) | (flags & PTE_MAP_FLAGS);
     
     // Invalidate TLB for this page
     mmu_flush_tlb_single(virtual_addr);
@@ -291,21 +382,22 @@ int mmu_unmap_page(PageDirectory* dir, uint32_t virtual_addr) {
     if (!dir) return -1;
     
     uint32_t pd_index = PD_INDEX(virtual_addr);
-    uint32_t pt_index = PT_INDEX(virtual_addr);
     
-    if (!dir->entries[pd_index].present) {
+    if (!(dir->entries[pd_index] & PAGE_PRESENT)) {
         return 0;  // Not mapped
     }
+    if (pde_is_large(dir->entries[pd_index]) && !mmu_split_large_page(dir, pd_index)) {
+        return -1;
+    }
     
-    PageTable* table = (PageTable*)(uintptr_t)(dir->entries[pd_index].table_addr << PAGE_SHIFT);
+    PageTableEntry* entry = mmu_find_pte(dir, virtual_addr);
     
-    if (table->entries[pt_index].present) {
+    if (*entry & PAGE_PRESENT) {
         // Free physical frame
-        uint32_t frame = table->entries[pt_index].frame;
-        mmu_free_frame(frame);
+        mmu_free_frame(PTE_FRAME(*entry));
         
         // Clear entry
-        memset(&table->entries[pt_index], 0, sizeof(PageTableEntry));
+        *entry = 0;
         
         // Invalidate TLB
         mmu_flush_tlb_single(virtual_addr);
@@ -314,34 +406,76 @@ int mmu_unmap_page(PageDirectory* dir, uint32_t virtual_addr) {
     return 0;
 }
 
-// Map range of pages
+// Drop TLB entries for pages in [virtual_addr, +pages), whichever ASID
+// they belong to.  Past the TLB's size one pass over it is cheaper.
+static void mmu_flush_tlb_range(uint32_t virtual_addr, uint64_t pages) {
+    if (pages < MMU_TLB_ENTRIES) {
+        for (uint64_t i = 0; i < pages; i++) mmu_flush_tlb_single(virtual_addr + (uint32_t)i * PAGE_SIZE);
+        return;
+    }
+    
+    uint64_t first = virtual_addr >> PAGE_SHIFT;
+    for (int c = 0; c < FRAME_CPU_COUNT; c++) {
+        MMUCpu* cpu = &mmu_cpus[c];
+        for (int i = 0; i < MMU_TLB_ENTRIES; i++) {
+            if (cpu->tlb[i].read_tag != MMU_TLB_INVALID && (cpu->tlb[i].read_tag >> PAGE_SHIFT) - first < pages) {
+                cpu->tlb[i].read_tag = cpu->tlb[i].write_tag = MMU_TLB_INVALID;
+                cpu->stats.entries_flushed++;
+            }
+        }
+    }
+}
+
+// Map range of pages.  Page tables are filled a run at a time rather than
+// through mmu_map_page(), and the TLB is flushed once at the end.
 int mmu_map_range(PageDirectory* dir, uint32_t virtual_start, uint32_t physical_start, 
                   uint32_t size, uint32_t flags) {
     uint32_t virtual_addr = PAGE_ALIGN_DOWN(virtual_start);
     uint32_t physical_addr = PAGE_ALIGN_DOWN(physical_start);
-    uint32_t end_addr = virtual_start + size;  // Don't align up to prevent overflow
     
-    // Safety check
-    if (size == 0 || size > 0x80000000) {  // Max 2GB
+    if (!dir) return -1;
+    if (size == 0) {
         printf("[MMU] ERROR: Invalid size for mmu_map_range: %u bytes\n", size);
         return -1;
     }
     
-    int pages_mapped = 0;
-    while (virtual_addr < end_addr && pages_mapped < 100000) {  // Safety limit
-        if (mmu_map_page(dir, virtual_addr, physical_addr, flags) < 0) {
-            return -1;
+    // Counted in pages so a range ending at 4 GB does not wrap
+    uint64_t pages = ((uint64_t)PAGE_OFFSET(virtual_start) + size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    uint64_t remaining = pages;
+    PageTableEntry entry_flags = flags & PTE_MAP_FLAGS;
+    
+    while (remaining > 0) {
+        uint32_t pd_index = PD_INDEX(virtual_addr);
+        uint32_t pt_index = PT_INDEX(virtual_addr);
+        uint32_t count;
+        
+        if ((flags & PAGE_SIZE_FLAG) && pt_index == 0 && (physical_addr & ~LARGE_PAGE_MASK) == 0 &&
+            remaining >= PAGE_TABLE_ENTRIES) {
+            // Whole 4 MB page; a table it replaces is dropped, as
+            // mmu_map_page() overwrites entries without freeing frames
+            if (dir->tables[pd_index]) {
+                windows_aligned_free(dir->tables[pd_index], sizeof(PageTable));
+                dir->tables[pd_index] = NULL;
+            }
+            dir->entries[pd_index] = physical_addr | entry_flags | PAGE_SIZE_FLAG;
+            count = PAGE_TABLE_ENTRIES;
+        } else {
+            PageTable* table = get_or_create_page_table(dir, pd_index);
+            if (!table) {
+                mmu_flush_tlb_range(PAGE_ALIGN_DOWN(virtual_start), pages - remaining);
+                return -1;
+            }
+            count = PAGE_TABLE_ENTRIES - pt_index;
+            if (count > remaining) count = (uint32_t)remaining;
+            mmu_fill_table(table, pt_index, count, physical_addr | entry_flags);
         }
         
-        virtual_addr += PAGE_SIZE;
-        physical_addr += PAGE_SIZE;
-        pages_mapped++;
-    }
-    
-    if (pages_mapped >= 100000) {
-        printf("[MMU] WARNING: Mapped max limit of 100000 pages\n");
+        virtual_addr += count * PAGE_SIZE;
+        physical_addr += count * PAGE_SIZE;
+        remaining -= count;
     }
     
+    mmu_flush_tlb_range(PAGE_ALIGN_DOWN(virtual_start), pages);
     return 0;
 }
 
@@ -350,7 +484,21 @@ int mmu_unmap_range(PageDirectory* dir, uint32_t virtual_start, uint32_t size) {
     uint32_t virtual_addr = PAGE_ALIGN_DOWN(virtual_start);
     uint32_t end_addr = PAGE_ALIGN_UP(virtual_start + size);
     
+    if (!dir) return -1;
+    
     while (virtual_addr < end_addr) {
+        PageDirectoryEntry pde = dir->entries[PD_INDEX(virtual_addr)];
+        
+        // A large page the range covers entirely goes in one step
+        if (pde_is_large(pde) && PT_INDEX(virtual_addr) == 0 && end_addr - virtual_addr >= LARGE_PAGE_SIZE) {
+            mmu_free_frames(PTE_FRAME(pde & LARGE_PAGE_MASK), PAGE_TABLE_ENTRIES);
+            dir->entries[PD_INDEX(virtual_addr)] = 0;
+            mmu_flush_tlb_range(virtual_addr, PAGE_TABLE_ENTRIES);
+            virtual_addr += LARGE_PAGE_SIZE;
+            if (virtual_addr == 0) break;  // Wrapped at 4 GB
+            continue;
+        }
+        
         mmu_unmap_page(dir, virtual_addr);
         virtual_addr += PAGE_SIZE;
     }
@@ -362,22 +510,18 @@ int mmu_unmap_range(PageDirectory* dir, uint32_t virtual_start, uint32_t size) {
 uint32_t mmu_virtual_to_physical(PageDirectory* dir, uint32_t virtual_addr) {
     if (!dir) return 0xFFFFFFFF;
     
-    uint32_t pd_index = PD_INDEX(virtual_addr);
-    uint32_t pt_index = PT_INDEX(virtual_addr);
-    uint32_t offset = PAGE_OFFSET(virtual_addr);
-    
-    if (!dir->entries[pd_index].present) {
-        return 0xFFFFFFFF;  // Not mapped
+    PageDirectoryEntry pde = dir->entries[PD_INDEX(virtual_addr)];
+    if (pde_is_large(pde)) {
+        return (pde & LARGE_PAGE_MASK) | (virtual_addr & ~LARGE_PAGE_MASK);
     }
     
-    PageTable* table = (PageTable*)(uintptr_t)(dir->entries[pd_index].table_addr << PAGE_SHIFT);
-    
-    if (!table->entries[pt_index].present) {
-        return 0xFFFFFFFF;  // Not mapped
+    // Kernel identity pages nobody has touched yet have no PTE
+    PageTableEntry* entry = mmu_find_pte(dir, virtual_addr);
+    if (!entry || !(*entry & PAGE_PRESENT)) {
+        return dir == g_kernel_page_directory && virtual_addr < g_kernel_identity_limit ? virtual_addr : 0xFFFFFFFF;
     }
     
-    uint32_t frame = table->entries[pt_index].frame;
-    return (frame << PAGE_SHIFT) | offset;
+    return (*entry & PAGE_MASK) | PAGE_OFFSET(virtual_addr);
 }
 
 // Check if virtual address is mapped
@@ -385,6 +529,101 @@ int mmu_is_mapped(PageDirectory* dir, uint32_t virtual_addr) {
     return (mmu_virtual_to_physical(dir, virtual_addr) != 0xFFFFFFFF);
 }
 
+// Walk the current page tables for virtual_addr and load the TLB entry.
+// Sets the accessed bit, and the dirty bit for writes.  Returns NULL if the
+// page fault handler could not make the access valid.
+static TLBEntry* mmu_tlb_fill(uint32_t virtual_addr, int write) {
+    MMUCpu* cpu = mmu_this_cpu();
+    PageDirectory* dir = cpu->directory;
+    TLBEntry* entry = &cpu->tlb[(virtual_addr >> PAGE_SHIFT) & (MMU_TLB_ENTRIES - 1)];
+    uint32_t tag = PAGE_ALIGN_DOWN(virtual_addr) | cpu->asid;
+    
+    if (entry->read_tag == tag && (!write || entry->write_tag == tag)) {
+        cpu->stats.hits++;
+        return entry;
+    }
+    cpu->stats.misses++;
+    
+    size_t ram_size = memory_get_total();
+    uint8_t* ram = memory_map(0, ram_size);
+    if (!ram) return NULL;
+    
+    // Without paging, virtual = physical and everything is writable
+    if (!g_paging_enabled || !dir) {
+        uint32_t physical = PAGE_ALIGN_DOWN(virtual_addr);
+        if ((size_t)physical + PAGE_SIZE > ram_size) return NULL;
+        entry->read_tag = tag;
+        entry->write_tag = cpu_is_code_page(physical) ? MMU_TLB_INVALID : tag;
+        entry->addend = (uintptr_t)ram + physical - PAGE_ALIGN_DOWN(virtual_addr);
+        return entry;
+    }
+    
+    for (int attempt = 0; attempt < 2; attempt++) {
+        // A large page's directory entry is its leaf entry
+        PageDirectoryEntry* pde = &dir->entries[PD_INDEX(virtual_addr)];
+        int large = pde_is_large(*pde);
+        uint32_t* leaf = large ? pde : mmu_find_pte(dir, virtual_addr);
+        
+        if (!leaf || !(*leaf & PAGE_PRESENT)) {
+            if (attempt == 0 && mmu_kernel_demand_map(dir, virtual_addr) == 0) continue;
+            mmu_page_fault_handler(virtual_addr, write ? PF_WRITE : 0);
+            return NULL;
+        }
+        if (write && !(*leaf & PAGE_WRITABLE)) {
+            // A resolved copy-on-write fault changed the PTE; walk again
+            if (attempt == 0 && mmu_handle_cow_fault(virtual_addr) == 0) continue;
+            mmu_page_fault_handler(virtual_addr, PF_PROTECTION | PF_WRITE);
+            return NULL;
+        }
+        
+        uint32_t physical = large ? (*leaf & LARGE_PAGE_MASK) | (virtual_addr & ~LARGE_PAGE_MASK & PAGE_MASK)
+                                  : *leaf & PAGE_MASK;
+        if ((size_t)physical + PAGE_SIZE > ram_size) return NULL;
+        
+        *leaf |= write ? PAGE_ACCESSED | PAGE_DIRTY : PAGE_ACCESSED;
+        
+        // Reads leave write_tag alone until the page is dirty, so the first
+        // store still comes through here to set the dirty bit
+        entry->read_tag = tag;
+        entry->write_tag = ((*leaf & (PAGE_WRITABLE | PAGE_DIRTY)) == (PAGE_WRITABLE | PAGE_DIRTY) &&
+                            !cpu_is_code_page(physical)) ? tag : MMU_TLB_INVALID;
+        entry->addend = (uintptr_t)ram + physical - PAGE_ALIGN_DOWN(virtual_addr);
+        return entry;
+    }
+    
+    return NULL;
+}
+
+// Slow path behind mmu_load*/mmu_store*: misses, and accesses that cross a page
+int mmu_access(uint32_t virtual_addr, void* data, uint32_t size, int write) {
+    uint8_t* bytes = (uint8_t*)data;
+    
+    while (size > 0) {
+        uint32_t chunk = PAGE_SIZE - PAGE_OFFSET(virtual_addr);
+        if (chunk > size) chunk = size;
+        
+        TLBEntry* entry = mmu_tlb_fill(virtual_addr, write);
+        if (!entry) return -1;
+        
+        uint8_t* host = (uint8_t*)(entry->addend + virtual_addr);
+        if (!write) {
+            memcpy(bytes, host, chunk);
+        } else if (entry->write_tag != MMU_TLB_INVALID) {
+            memcpy(host, bytes, chunk);
+        } else {
+            // Translated code lives here; let memory.c invalidate it
+            uint32_t physical = (uint32_t)(host - (uint8_t*)memory_map(0, memory_get_total()));
+            if (memory_write_block(physical, bytes, chunk) != 0) return -1;
+        }
+        
+        virtual_addr += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+    
+    return 0;
+}
+
 // Identity map range (virtual = physical)
 void mmu_identity_map_range(PageDirectory* dir, uint32_t physical_start, uint32_t size, uint32_t flags) {
     mmu_map_range(dir, physical_start, physical_start, size, flags);
@@ -392,6 +631,11 @@ void mmu_identity_map_range(PageDirectory* dir, uint32_t physical_start, uint32_
 
 // Page fault handler
 void mmu_page_fault_handler(uint32_t fault_addr, uint32_t error_code) {
+    // First touch of a kernel identity page: not a fault as far as anyone knows
+    if (!(error_code & PF_PROTECTION) && mmu_kernel_demand_map(mmu_this_cpu()->directory, fault_addr) == 0) {
+        return;
+    }
+    
     printf("[MMU] Page fault at 0x%08X (error: 0x%02X)\n", fault_addr, error_code);
     
     // Decode error code
@@ -422,36 +666,160 @@ void mmu_page_fault_handler(uint32_t fault_addr, uint32_t error_code) {
 // Handle copy-on-write fault
 int mmu_handle_cow_fault(uint32_t virtual_addr) {
     // Check if page is marked as COW
-    PageDirectory* dir = g_current_page_directory;
+    PageDirectory* dir = mmu_this_cpu()->directory;
     if (!dir) return -1;
     
-    uint32_t pd_index = PD_INDEX(virtual_addr);
-    uint32_t pt_index = PT_INDEX(virtual_addr);
+    // Large pages are never copy-on-write: cloning splits them first
+    PageTableEntry* entry = mmu_find_pte(dir, virtual_addr);
+    if (!entry || (*entry & (PAGE_PRESENT | PAGE_COW)) != (PAGE_PRESENT | PAGE_COW)) return -1;
+    
+    // Still shared: take a private copy and drop our reference to the
+    // original.  The last owner just gets write access back.
+    g_cow_faults++;
+    uint32_t frame = PTE_FRAME(*entry);
+    if (mmu_frame_refcount(frame) > 1) {
+        uint32_t copy = mmu_alloc_frame();
+        if (copy == FRAME_INVALID) return -1;
+        mmu_copy_frame(copy, frame);
+        mmu_free_frame(frame);
+        *entry = (*entry & PAGE_OFFSET_MASK) | (copy << PAGE_SHIFT);
+        g_cow_copies++;
+    }
     
-    if (!dir->entries[pd_index].present) return -1;
+    *entry = (*entry | PAGE_WRITABLE) & ~PAGE_COW;
+    mmu_flush_tlb_single(virtual_addr);
+    return 0;
+}
+
+// Stop direct stores through dir's TLB entries, on every CPU, after its
+// pages went read-only
+static void mmu_tlb_revoke_writes(PageDirectory* dir) {
+    EnterCriticalSection(&g_asid_lock);
+    for (uint32_t asid = 1; asid < MMU_ASID_COUNT; asid++) {
+        if (g_asid_owner[asid] != dir) continue;
+        for (int c = 0; c < FRAME_CPU_COUNT; c++) {
+            TLBEntry* tlb = mmu_cpus[c].tlb;
+            for (int i = 0; i < MMU_TLB_ENTRIES; i++) {
+                if (tlb[i].write_tag != MMU_TLB_INVALID && (tlb[i].write_tag & PAGE_OFFSET_MASK) == asid) {
+                    tlb[i].write_tag = MMU_TLB_INVALID;
+                }
+            }
+        }
+    }
+    LeaveCriticalSection(&g_asid_lock);
+}
+
+// Give child the parent's view of one page table.  User pages backed by
+// allocated frames are shared and both sides lose write access to them
+// (copy-on-write); with copy set, or once a frame's count saturates, the
+// page is copied instead.  Returns -1 if no frame was left for a copy; the
+// child then holds only the entries before it.
+static int mmu_clone_table(PageTable* parent, PageTable* child, int copy) {
+    memcpy(child, parent, sizeof(PageTable));
+    
+    for (int i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+        PageTableEntry* entry = &parent->entries[i];
+        if ((*entry & (PAGE_PRESENT | PAGE_USER)) != (PAGE_PRESENT | PAGE_USER) ||
+            !mmu_is_frame_allocated(PTE_FRAME(*entry))) continue;
+        
+        if (!copy && mmu_frame_share(PTE_FRAME(*entry)) == 0) {
+            if (*entry & PAGE_WRITABLE) *entry = (*entry & ~PAGE_WRITABLE) | PAGE_COW;
+            child->entries[i] = *entry;
+            continue;
+        }
+        
+        uint32_t frame = mmu_alloc_frame();
+        if (frame == FRAME_INVALID) {
+            memset(&child->entries[i], 0, (PAGE_TABLE_ENTRIES - i) * sizeof(PageTableEntry));
+            return -1;
+        }
+        mmu_copy_frame(frame, PTE_FRAME(*entry));
+        child->entries[i] = (*entry & PAGE_OFFSET_MASK) | (frame << PAGE_SHIFT);
+    }
     
-    PageTable* table = (PageTable*)(uintptr_t)(dir->entries[pd_index].table_addr << PAGE_SHIFT);
-    PageTableEntry* entry = &table->entries[pt_index];
+    return 0;
+}
+
+static PageDirectory* mmu_clone_directory(PageDirectory* parent, int copy) {
+    if (!parent) return NULL;
     
-    if (!entry->present) return -1;
+    PageDirectory* child = mmu_create_page_directory();
+    if (!child) return NULL;
+    
+    for (int i = 0; i < PAGE_DIRECTORY_ENTRIES; i++) {
+        PageDirectoryEntry pde = parent->entries[i];
+        if (!(pde & PAGE_PRESENT)) continue;
+        
+        // Kernel large pages own no frames and are simply shared.  User
+        // ones are split so their pages can be copied on write one by one.
+        if (pde_is_large(pde) && !(pde & PAGE_USER)) {
+            child->entries[i] = pde;
+            continue;
+        }
+        
+        PageTable* source = pde_is_large(pde) ? mmu_split_large_page(parent, i) : parent->tables[i];
+        PageTable* table = source ? get_or_create_page_table(child, i) : NULL;
+        if (!table || mmu_clone_table(source, table, copy) != 0) {
+            printf("[MMU] Out of memory cloning page directory\n");
+            mmu_tlb_revoke_writes(parent);
+            mmu_destroy_page_directory(child);
+            return NULL;
+        }
+        
+        child->entries[i] = parent->entries[i];
+    }
     
-    // Check if COW (using available bits)
-    // For now, just return -1 (not implemented)
-    return -1;
+    mmu_tlb_revoke_writes(parent);
+    return child;
 }
 
-// Flush entire TLB
+// Fork an address space.  Only page tables are copied; user pages stay
+// shared until one side writes to them.
+PageDirectory* mmu_clone_page_directory(PageDirectory* parent) {
+    return mmu_clone_directory(parent, 0);
+}
+
+// Flush every CPU's entire TLB (every address space)
 void mmu_flush_tlb(void) {
-    // In real kernel, would reload CR3
-    g_tlb_stats.full_flushes++;
-    g_tlb_stats.entries_flushed += PAGE_DIRECTORY_ENTRIES * PAGE_TABLE_ENTRIES;
+    for (int c = 0; c < FRAME_CPU_COUNT; c++) {
+        MMUCpu* cpu = &mmu_cpus[c];
+        for (int i = 0; i < MMU_TLB_ENTRIES; i++) {
+            if (cpu->tlb[i].read_tag != MMU_TLB_INVALID) cpu->stats.entries_flushed++;
+            cpu->tlb[i].read_tag = cpu->tlb[i].write_tag = MMU_TLB_INVALID;
+        }
+    }
+    mmu_this_cpu()->stats.full_flushes++;
 }
 
-// Flush single TLB entry
+// Flush single TLB entry on every CPU.  Callers may be editing a directory
+// that is not the current one, so the entry goes whichever ASID it belongs to.
 void mmu_flush_tlb_single(uint32_t virtual_addr) {
-    // In real kernel, would use INVLPG instruction
-    g_tlb_stats.single_flushes++;
-    g_tlb_stats.entries_flushed++;
+    mmu_this_cpu()->stats.single_flushes++;
+    for (int c = 0; c < FRAME_CPU_COUNT; c++) {
+        MMUCpu* cpu = &mmu_cpus[c];
+        TLBEntry* entry = &cpu->tlb[(virtual_addr >> PAGE_SHIFT) & (MMU_TLB_ENTRIES - 1)];
+        if (entry->read_tag != MMU_TLB_INVALID && (entry->read_tag & PAGE_MASK) == PAGE_ALIGN_DOWN(virtual_addr)) {
+            entry->read_tag = entry->write_tag = MMU_TLB_INVALID;
+            cpu->stats.entries_flushed++;
+        }
+    }
+}
+
+// The CPU translated code from this physical page: stores to it must go
+// through memory_write_block() so the translations are invalidated
+void mmu_tlb_protect_code(uint32_t physical_addr) {
+    uint8_t* ram = memory_map(0, memory_get_total());
+    if (!ram) return;
+    
+    uintptr_t page = (uintptr_t)ram + PAGE_ALIGN_DOWN(physical_addr);
+    for (int c = 0; c < FRAME_CPU_COUNT; c++) {
+        for (int i = 0; i < MMU_TLB_ENTRIES; i++) {
+            TLBEntry* entry = &mmu_cpus[c].tlb[i];
+            if (entry->write_tag != MMU_TLB_INVALID && entry->addend + (entry->write_tag & PAGE_MASK) == page) {
+                entry->write_tag = MMU_TLB_INVALID;
+            }
+        }
+    }
 }
 
 // Invalidate page
@@ -464,44 +832,33 @@ int mmu_set_page_flags(PageDirectory* dir, uint32_t virtual_addr, uint32_t flags
     if (!dir) return -1;
     
     uint32_t pd_index = PD_INDEX(virtual_addr);
-    uint32_t pt_index = PT_INDEX(virtual_addr);
     
-    if (!dir->entries[pd_index].present) return -1;
+    if (!(dir->entries[pd_index] & PAGE_PRESENT)) return -1;
+    if (pde_is_large(dir->entries[pd_index]) && !mmu_split_large_page(dir, pd_index)) return -1;
     
-    PageTable* table = (PageTable*)(uintptr_t)(dir->entries[pd_index].table_addr << PAGE_SHIFT);
-    PageTableEntry* entry = &table->entries[pt_index];
+    PageTableEntry* entry = mmu_find_pte(dir, virtual_addr);
     
-    if (!entry->present) return -1;
+    if (!(*entry & PAGE_PRESENT)) return -1;
     
     // Update flags
-    entry->writable = (flags & PAGE_WRITABLE) ? 1 : 0;
-    entry->user_mode = (flags & PAGE_USER) ? 1 : 0;
+    *entry = (*entry & ~(PAGE_WRITABLE | PAGE_USER)) | (flags & (PAGE_WRITABLE | PAGE_USER));
     
     mmu_flush_tlb_single(virtual_addr);
     
     return 0;
 }
 
-// Get page flags
+// Get page flags (PAGE_SIZE_FLAG for a page inside a large page)
 uint32_t mmu_get_page_flags(PageDirectory* dir, uint32_t virtual_addr) {
     if (!dir) return 0;
     
-    uint32_t pd_index = PD_INDEX(virtual_addr);
-    uint32_t pt_index = PT_INDEX(virtual_addr);
-    
-    if (!dir->entries[pd_index].present) return 0;
-    
-    PageTable* table = (PageTable*)(uintptr_t)(dir->entries[pd_index].table_addr << PAGE_SHIFT);
-    PageTableEntry* entry = &table->entries[pt_index];
+    PageDirectoryEntry pde = dir->entries[PD_INDEX(virtual_addr)];
+    if (pde_is_large(pde)) return pde & PAGE_OFFSET_MASK;
     
-    if (!entry->present) return 0;
+    PageTableEntry* entry = mmu_find_pte(dir, virtual_addr);
+    if (!entry || !(*entry & PAGE_PRESENT)) return 0;
     
-    uint32_t flags = 0;
-    if (entry->present) flags |= PAGE_PRESENT;
-    if (entry->writable) flags |= PAGE_WRITABLE;
-    if (entry->user_mode) flags |= PAGE_USER;
-    
-    return flags;
+    return *entry & PAGE_OFFSET_MASK;
 }
 
 // Protect memory range
@@ -519,14 +876,26 @@ int mmu_protect_range(PageDirectory* dir, uint32_t virtual_start, uint32_t size,
 
 // Get statistics
 void mmu_get_stats(uint32_t* total_pages, uint32_t* used_pages, uint32_t* free_pages) {
-    if (total_pages) *total_pages = g_frame_allocator.total_frames;
-    if (used_pages) *used_pages = g_frame_allocator.used_frames;
-    if (free_pages) *free_pages = g_frame_allocator.free_frames;
+    const FrameAllocator* frames = mmu_get_frame_allocator();
+    if (total_pages) *total_pages = frames->total_frames;
+    if (used_pages) *used_pages = frames->used_frames;
+    if (free_pages) *free_pages = frames->free_frames;
 }
 
-// Get TLB stats
+// Get TLB stats, summed over the CPUs
 TLBStats* mmu_get_tlb_stats(void) {
-    return &g_tlb_stats;
+    static TLBStats total;
+    memset(&total, 0, sizeof(total));
+    for (int c = 0; c < FRAME_CPU_COUNT; c++) {
+        const TLBStats* stats = &mmu_cpus[c].stats;
+        total.entries_flushed += stats->entries_flushed;
+        total.full_flushes += stats->full_flushes;
+        total.single_flushes += stats->single_flushes;
+        total.asid_flushes += stats->asid_flushes;
+        total.hits += stats->hits;
+        total.misses += stats->misses;
+    }
+    return &total;
 }
 
 // Dump page tables
@@ -534,20 +903,317 @@ void mmu_dump_page_tables(PageDirectory* dir, uint32_t virtual_addr) {
     if (!dir) return;
     
     uint32_t pd_index = PD_INDEX(virtual_addr);
+    PageDirectoryEntry pde = dir->entries[pd_index];
     
     printf("[MMU] Page directory entry %d:\n", pd_index);
-    printf("  Present: %d\n", dir->entries[pd_index].present);
-    printf("  Writable: %d\n", dir->entries[pd_index].writable);
-    printf("  User: %d\n", dir->entries[pd_index].user_mode);
+    printf("  Present: %d\n", (pde & PAGE_PRESENT) != 0);
+    printf("  Writable: %d\n", (pde & PAGE_WRITABLE) != 0);
+    printf("  User: %d\n", (pde & PAGE_USER) != 0);
     
-    if (dir->entries[pd_index].present) {
-        PageTable* table = (PageTable*)(uintptr_t)(dir->entries[pd_index].table_addr << PAGE_SHIFT);
+    if (pde_is_large(pde)) {
+        printf("  4MB page at: 0x%08X\n", pde & LARGE_PAGE_MASK);
+    } else if (dir->tables[pd_index]) {
         uint32_t pt_index = PT_INDEX(virtual_addr);
+        PageTableEntry entry = dir->tables[pd_index]->entries[pt_index];
         
         printf("  Page table entry %d:\n", pt_index);
-        printf("    Present: %d\n", table->entries[pt_index].present);
-        printf("    Writable: %d\n", table->entries[pt_index].writable);
-        printf("    User: %d\n", table->entries[pt_index].user_mode);
-        printf("    Frame: 0x%05X\n", table->entries[pt_index].frame);
+        printf("    Present: %d\n", (entry & PAGE_PRESENT) != 0);
+        printf("    Writable: %d\n", (entry & PAGE_WRITABLE) != 0);
+        printf("    User: %d\n", (entry & PAGE_USER) != 0);
+        printf("    Frame: 0x%05X\n", PTE_FRAME(entry));
+    }
+}
+
+static double mmu_now_seconds(void) {
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+}
+
+// Random read-modify-write traffic over the benchmark pages, either through
+// the TLB helpers or with a page table walk per access.  Returns a checksum
+// of the values read, or 0 if an access faulted.
+static uint32_t mmu_bench_pass(PageDirectory* dir, uint32_t pages, uint64_t accesses, int walk) {
+    uint32_t words = pages * (PAGE_SIZE / 4);
+    uint32_t seed = 0x9E3779B9;
+    uint32_t sum = 1;
+    
+    for (uint64_t i = 0; i < accesses / 2; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        uint32_t addr = USER_SPACE_START + (seed % words) * 4;
+        uint32_t value;
+        
+        if (walk) {
+            uint32_t physical = mmu_virtual_to_physical(dir, addr);
+            if (physical == 0xFFFFFFFF || memory_read_block(physical, (uint8_t*)&value, 4) != 0) return 0;
+            value += (uint32_t)i;
+            if (memory_write_block(physical, (const uint8_t*)&value, 4) != 0) return 0;
+        } else {
+            if (mmu_load32(addr, &value) != 0) return 0;
+            value += (uint32_t)i;
+            if (mmu_store32(addr, value) != 0) return 0;
+        }
+        sum = sum * 31 + value;
+    }
+    
+    return sum;
+}
+
+// Compare TLB-backed guest accesses with walking the page tables every time
+void mmu_tlb_benchmark(uint32_t pages, uint64_t accesses) {
+    if (pages == 0) pages = 64;
+    if (pages > 4096) pages = 4096;
+    if (accesses < 2) accesses = 10000000ULL;
+    
+    // Frames come from the MMU's allocator
+    if (!g_mmu_initialized && mmu_init() != 0) return;
+    
+    size_t ram_size = memory_get_total();
+    PageDirectory* dir = mmu_create_page_directory();
+    uint32_t* frames = malloc(pages * sizeof(uint32_t));
+    uint8_t* saved = malloc((size_t)pages * PAGE_SIZE);
+    uint8_t* zero = calloc(1, PAGE_SIZE);
+    if (ram_size == 0 || !dir || !frames || !saved || !zero) {
+        printf("bench tlb: %s\n", ram_size == 0 ? "guest memory is not available" : "out of memory");
+        if (dir) mmu_destroy_page_directory(dir);
+        free(frames);
+        free(saved);
+        free(zero);
+        return;
+    }
+    
+    // Borrow frames from guest RAM, keeping their contents to put back
+    uint32_t mapped = 0;
+    while (mapped < pages) {
+        uint32_t frame = mmu_alloc_frame();
+        if (frame == 0xFFFFFFFF) break;
+        if ((size_t)(frame + 1) * PAGE_SIZE > ram_size) {
+            mmu_free_frame(frame);
+            break;
+        }
+        frames[mapped] = frame;
+        memory_read_block(frame << PAGE_SHIFT, saved + (size_t)mapped * PAGE_SIZE, PAGE_SIZE);
+        mmu_map_page(dir, USER_SPACE_START + mapped * PAGE_SIZE, frame << PAGE_SHIFT,
+                     PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER);
+        mapped++;
+    }
+    
+    PageDirectory* previous = mmu_get_current_page_directory();
+    int previous_paging = g_paging_enabled;
+    mmu_set_current_directory(dir);
+    g_paging_enabled = 1;
+    
+    double tlb_seconds = 0.0, walk_seconds = 0.0;
+    uint32_t tlb_sum = 0, walk_sum = 0;
+    uint64_t hits = 0, misses = 0;
+    
+    if (mapped == pages) {
+        for (uint32_t i = 0; i < pages; i++) memory_write_block(frames[i] << PAGE_SHIFT, zero, PAGE_SIZE);
+        const TLBStats* stats = &mmu_this_cpu()->stats;
+        uint64_t hits_before = stats->hits, misses_before = stats->misses;
+        double start = mmu_now_seconds();
+        tlb_sum = mmu_bench_pass(dir, pages, accesses, 0);
+        tlb_seconds = mmu_now_seconds() - start;
+        hits = stats->hits - hits_before;
+        misses = stats->misses - misses_before;
+        
+        for (uint32_t i = 0; i < pages; i++) memory_write_block(frames[i] << PAGE_SHIFT, zero, PAGE_SIZE);
+        start = mmu_now_seconds();
+        walk_sum = mmu_bench_pass(dir, pages, accesses, 1);
+        walk_seconds = mmu_now_seconds() - start;
+    }
+    
+    mmu_set_current_directory(previous);
+    g_paging_enabled = previous_paging;
+    for (uint32_t i = 0; i < mapped; i++) {
+        memory_write_block(frames[i] << PAGE_SHIFT, saved + (size_t)i * PAGE_SIZE, PAGE_SIZE);
+    }
+    mmu_unmap_range(dir, USER_SPACE_START, mapped * PAGE_SIZE);   // Frees the frames too
+    mmu_destroy_page_directory(dir);
+    free(frames);
+    free(saved);
+    free(zero);
+    
+    if (mapped < pages) {
+        printf("bench tlb: only %u of %u frames available\n", mapped, pages);
+        return;
+    }
+    
+    printf("bench tlb: %u pages, %llu accesses, %d-entry TLB\n", pages, (unsigned long long)accesses, MMU_TLB_ENTRIES);
+    printf("  TLB:       %.3f s, %.1f ns/access (%llu hits, %llu misses, %.2f%% hit)\n",
+           tlb_seconds, tlb_seconds * 1e9 / (double)accesses,
+           (unsigned long long)hits, (unsigned long long)misses,
+           hits + misses ? 100.0 * (double)hits / (double)(hits + misses) : 0.0);
+    printf("  Page walk: %.3f s, %.1f ns/access\n", walk_seconds, walk_seconds * 1e9 / (double)accesses);
+    if (tlb_seconds > 0) {
+        printf("  Speedup:   %.1fx, results %s\n", walk_seconds / tlb_seconds,
+               tlb_sum != 0 && tlb_sum == walk_sum ? "match" : "DIFFER");
+    }
+    const TLBStats* flushes = mmu_get_tlb_stats();
+    printf("  Flushes:   %u full, %u single, %u by ASID, %u entries\n",
+           flushes->full_flushes, flushes->single_flushes,
+           flushes->asid_flushes, flushes->entries_flushed);
+}
+
+// Time mapping size_mb of address space page by page, with bulk table
+// fills, and with 4 MB pages, checking a sample of translations each time.
+// Nothing is freed: the mappings are kernel pages and own no frames.
+void mmu_map_benchmark(uint32_t size_mb) {
+    if (size_mb == 0) size_mb = 1024;
+    if (size_mb > 3072) size_mb = 3072;   // What fits above USER_SPACE_START
+    
+    static const char* const methods[] = { "mmu_map_page loop", "mmu_map_range", "mmu_map_range, 4MB pages" };
+    uint32_t size = size_mb * 1024 * 1024;
+    uint32_t physical_start = 0x00400000;
+    double seconds[3] = { 0.0, 0.0, 0.0 };
+    
+    printf("bench map: mapping %u MB (%u pages)\n", size_mb, size / PAGE_SIZE);
+    for (int method = 0; method < 3; method++) {
+        PageDirectory* dir = mmu_create_page_directory();
+        if (!dir) {
+            printf("bench map: out of memory\n");
+            return;
+        }
+        
+        int result = 0;
+        double start = mmu_now_seconds();
+        if (method == 0) {
+            for (uint32_t offset = 0; offset < size && result == 0; offset += PAGE_SIZE) {
+                result = mmu_map_page(dir, USER_SPACE_START + offset, physical_start + offset,
+                                      PAGE_PRESENT | PAGE_WRITABLE);
+            }
+        } else {
+            result = mmu_map_range(dir, USER_SPACE_START, physical_start, size,
+                                   PAGE_PRESENT | PAGE_WRITABLE | (method == 2 ? PAGE_SIZE_FLAG : 0));
+        }
+        seconds[method] = mmu_now_seconds() - start;
+        
+        uint32_t seed = 0x2545F491, bad = 0;
+        for (int i = 0; i < 4096; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            uint32_t offset = seed % size;
+            if (mmu_virtual_to_physical(dir, USER_SPACE_START + offset) != physical_start + offset) bad++;
+        }
+        mmu_destroy_page_directory(dir);
+        
+        printf("  %-26s %10.3f ms  %7.2f ns/page%s\n", methods[method], seconds[method] * 1e3,
+               seconds[method] * 1e9 / (double)(size / PAGE_SIZE),
+               result != 0 ? "  (failed)" : bad ? "  (WRONG TRANSLATIONS)" : "");
     }
+    if (seconds[1] > 0 && seconds[2] > 0) {
+        printf("  Bulk fill %.1fx, 4MB pages %.1fx faster than page by page\n",
+               seconds[0] / seconds[1], seconds[0] / seconds[2]);
+    }
+}
+
+// Fork latency against heap size: copy-on-write clones against copying
+// every page up front, plus what the child's first write to each page
+// costs afterwards
+void mmu_fork_benchmark(uint32_t max_heap_mb) {
+    if (max_heap_mb == 0) max_heap_mb = 64;
+    if (!g_mmu_initialized && mmu_init() != 0) return;
+    if (memory_get_total() == 0) {
+        printf("bench fork: guest memory is not available\n");
+        return;
+    }
+    
+    const FrameAllocator* frames = mmu_get_frame_allocator();
+    PageDirectory* previous = mmu_get_current_page_directory();
+    int previous_paging = g_paging_enabled;
+    uint8_t* page = calloc(1, PAGE_SIZE);
+    if (!page) {
+        printf("bench fork: out of memory\n");
+        return;
+    }
+    
+    printf("bench fork: fork of an address space with a fully touched heap\n");
+    printf("  %8s %12s %12s %10s %14s\n", "Heap", "COW fork", "Copy fork", "Speedup", "First writes");
+    
+    for (uint32_t heap_mb = 1; heap_mb <= max_heap_mb; heap_mb *= 2) {
+        uint32_t pages = heap_mb * (1024 * 1024 / PAGE_SIZE);
+        if (frames->free_frames < pages * 2 + 1024) {
+            printf("  %6u MB: not enough free frames (%u)\n", heap_mb, frames->free_frames);
+            break;
+        }
+        
+        // Parent heap: every page allocated, written and tagged with its number
+        uint32_t used_before = frames->used_frames;
+        PageDirectory* parent = mmu_create_page_directory();
+        uint32_t mapped = 0;
+        while (parent && mapped < pages) {
+            uint32_t frame = mmu_alloc_frame();
+            if (frame == FRAME_INVALID) break;
+            memcpy(page, &mapped, sizeof(mapped));
+            memory_write_block(frame << PAGE_SHIFT, page, PAGE_SIZE);
+            mmu_map_page(parent, USER_SPACE_START + mapped * PAGE_SIZE, frame << PAGE_SHIFT,
+                         PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER);
+            mapped++;
+        }
+        
+        PageDirectory* child = NULL;
+        PageDirectory* copied = NULL;
+        double cow_seconds = 0.0, copy_seconds = 0.0, write_seconds = 0.0;
+        uint64_t faults_before = g_cow_faults, copies_before = g_cow_copies;
+        uint32_t shared = frames->shared_frames, mismatches = 0;
+        
+        if (mapped == pages) {
+            double start = mmu_now_seconds();
+            child = mmu_clone_page_directory(parent);
+            cow_seconds = mmu_now_seconds() - start;
+            shared = frames->shared_frames - shared;
+            
+            start = mmu_now_seconds();
+            copied = mmu_clone_directory(parent, 1);
+            copy_seconds = mmu_now_seconds() - start;
+        }
+        
+        if (child && copied) {
+            // The child writes one word per page; the parent must not see it
+            mmu_set_current_directory(child);
+            g_paging_enabled = 1;
+            double start = mmu_now_seconds();
+            for (uint32_t i = 0; i < pages; i++) {
+                if (mmu_store32(USER_SPACE_START + i * PAGE_SIZE + 4, ~i) != 0) mismatches++;
+            }
+            write_seconds = mmu_now_seconds() - start;
+            
+            mmu_set_current_directory(parent);
+            for (uint32_t i = 0; i < pages; i++) {
+                uint32_t tag = 0, word = 0;
+                if (mmu_load32(USER_SPACE_START + i * PAGE_SIZE, &tag) != 0 ||
+                    mmu_load32(USER_SPACE_START + i * PAGE_SIZE + 4, &word) != 0 || tag != i || word != 0) {
+                    mismatches++;
+                }
+            }
+            mmu_set_current_directory(previous);
+            g_paging_enabled = previous_paging;
+        }
+        
+        uint64_t faults = g_cow_faults - faults_before, copies = g_cow_copies - copies_before;
+        if (child) mmu_destroy_page_directory(child);
+        if (copied) mmu_destroy_page_directory(copied);
+        if (parent) mmu_destroy_page_directory(parent);   // Frees the heap frames too
+        
+        if (!child || !copied) {
+            printf("  %6u MB: out of frames after mapping %u pages\n", heap_mb, mapped);
+            break;
+        }
+        
+        printf("  %6u MB %9.1f us %9.1f us %9.1fx %9.1f ns/page\n", heap_mb,
+               cow_seconds * 1e6, copy_seconds * 1e6, cow_seconds > 0 ? copy_seconds / cow_seconds : 0.0,
+               write_seconds * 1e9 / (double)pages);
+        if (shared != pages || copies != pages || faults != pages || mismatches != 0 ||
+            frames->used_frames != used_before) {
+            printf("    CHECK FAILED: %u of %u frames shared, %llu COW faults, %llu copies, %u bad pages, %d frames leaked\n",
+                   shared, pages, (unsigned long long)faults, (unsigned long long)copies, mismatches,
+                   (int)(frames->used_frames - used_before));
+        }
+    }
+    
+    free(page);
 }
@@ -1,50 +1,1046 @@
 #include "kernel/network_stack.h"
+#include "kernel/fib.h"
+#include "kernel/net_route.h"
+#include "kernel/inet_checksum.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#define WIN32_LEAN_AND_MEAN     // Keep winsock out: this file has its own htons() and friends
+#include <windows.h>
+
+// Private socket flags
+#define SOCKET_ORPHAN       0x1     // Closed by its owner, finishing the FIN exchange
+#define SOCKET_FIN_QUEUED   0x2     // Send a FIN once the send ring drains
+#define SOCKET_FIN_SENT     0x4
+
+// Each datagram in a UDP receive ring is preceded by its length, source
+// port and source address
+#define UDP_RECORD_HEADER   8
+
+// A packet on an interface queue: an IPv4 header and what it carries
+typedef struct NetPacket {
+    struct NetPacket* next;
+    uint32_t length;
+    uint8_t data[];
+} NetPacket;
+
+// Connections waiting for accept() on a listening socket, oldest first
+typedef struct {
+    int head;
+    int count;
+    Socket* entries[MAX_LISTEN_BACKLOG];
+} AcceptQueue;
+
+// Demux tables.  Each chains its sockets through Socket.hash_next and
+// doubles its buckets when it holds more sockets than buckets.
+#define SOCKET_UNHASHED     0
+#define SOCKET_HASH_CONN    1       // Connections: protocol and 4-tuple
+#define SOCKET_HASH_BIND    2       // Listeners and UDP: protocol, local address and port
+
+typedef struct {
+    Socket** buckets;
+    uint32_t mask;
+    uint32_t count;
+} SocketHash;
 
 // Global network state
-static Socket* sockets[MAX_SOCKETS];
+static Socket** socket_table = NULL;   // Indexed by fd
+static int socket_capacity = 0;
+static int socket_count = 0;
+static int* free_fds = NULL;            // Released fds, reused last in first out
+static int free_fd_count = 0;
+static SocketHash conn_hash;
+static SocketHash bind_hash;
+static uint32_t port_refs[3][PORT_MAX + 1];     // Sockets holding each port, per socket type
 static NetworkInterface interfaces[8];
 static int interface_count = 0;
-static RouteEntry routes[256];
-static int route_count = 0;
+static Fib* routes = NULL;              // A RouteEntry per prefix
 static NetworkStats global_stats;
 static int next_fd = 3; // Start after stdin/stdout/stderr
+static int next_ephemeral = PORT_EPHEMERAL_MIN;
+static uint16_t next_ip_id = 0;
+
+// Packets written to lo, waiting to come back in
+static NetPacket* lo_queue_head = NULL;
+static NetPacket* lo_queue_tail = NULL;
+
+// One lock over sockets and interfaces: socket calls come from the
+// syscall thread, I/O ring workers and the clock thread's retransmits
+static CRITICAL_SECTION net_lock;
+static int net_lock_ready = 0;
 
 // Helper: Convert network byte order
 static uint16_t htons(uint16_t hostshort) {
     return ((hostshort & 0xFF) << 8) | ((hostshort >> 8) & 0xFF);
 }
 
-static uint32_t htonl(uint32_t hostlong) {
-    return ((hostlong & 0xFF) << 24) |
-           ((hostlong & 0xFF00) << 8) |
-           ((hostlong & 0xFF0000) >> 8) |
-           ((hostlong & 0xFF000000) >> 24);
+static uint32_t htonl(uint32_t hostlong) {
+    return ((hostlong & 0xFF) << 24) |
+           ((hostlong & 0xFF00) << 8) |
+           ((hostlong & 0xFF0000) >> 8) |
+           ((hostlong & 0xFF000000) >> 24);
+}
+
+static uint16_t ntohs(uint16_t netshort) {
+    return htons(netshort);
+}
+
+static uint32_t ntohl(uint32_t netlong) {
+    return htonl(netlong);
+}
+
+static double netstack_now_seconds(void) {
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+}
+
+// Sequence number comparison, modulo 2^32
+static int seq_after(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) > 0;
+}
+
+static const IPv4Address ipv4_any = { { 0, 0, 0, 0 } };
+
+static int ipv4_equal(const IPv4Address* a, const IPv4Address* b) {
+    return memcmp(a, b, sizeof(IPv4Address)) == 0;
+}
+
+static int ipv4_is_any(const IPv4Address* addr) {
+    return (addr->octets[0] | addr->octets[1] | addr->octets[2] | addr->octets[3]) == 0;
+}
+
+// Addresses of this host: all of 127/8 and every interface address
+static int ipv4_is_local(const IPv4Address* addr) {
+    if (addr->octets[0] == 127) return 1;
+    for (int i = 0; i < interface_count; i++) {
+        if (ipv4_equal(&interfaces[i].ip, addr)) return 1;
+    }
+    return 0;
+}
+
+static uint32_t ipv4_host(const IPv4Address* addr) {
+    return (uint32_t)addr->octets[0] << 24 | (uint32_t)addr->octets[1] << 16 |
+           (uint32_t)addr->octets[2] << 8 | addr->octets[3];
+}
+
+static IPv4Address ipv4_from_host(uint32_t value) {
+    IPv4Address addr = { { (uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value } };
+    return addr;
+}
+
+static RouteEntry* route_lookup(const IPv4Address* dest) {
+    return routes ? (RouteEntry*)fib_lookup(routes, ipv4_host(dest)) : NULL;
+}
+
+// Source address for packets from `sock` to `dest`, unless it is bound to
+// one: the address of the interface the route goes out of
+static IPv4Address ipv4_source(const Socket* sock, const IPv4Address* dest) {
+    if (!ipv4_is_any(&sock->local.addr)) return sock->local.addr;
+    if (dest->octets[0] == 127) return interfaces[0].ip;
+    if (ipv4_is_local(dest)) return *dest;
+    RouteEntry* route = route_lookup(dest);
+    return interfaces[route ? route->interface_id : 1].ip;
+}
+
+static Socket* find_socket(int sockfd) {
+    if (sockfd < 0 || sockfd >= socket_capacity) return NULL;
+    Socket* sock = socket_table[sockfd];
+    return sock && !(sock->flags & SOCKET_ORPHAN) ? sock : NULL;   // Orphans have no owner left
+}
+
+static uint32_t hash_mix(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDull;
+    key ^= key >> 33;
+    key *= 0xC4CEB9FE1A85EC53ull;
+    key ^= key >> 33;
+    return (uint32_t)key;
+}
+
+static uint32_t ipv4_word(const IPv4Address* addr) {
+    uint32_t word;
+    memcpy(&word, addr, sizeof(word));
+    return word;
+}
+
+static uint32_t conn_hash_key(int type, const IPv4Address* local, uint16_t local_port,
+                              const IPv4Address* remote, uint16_t remote_port) {
+    uint64_t addrs = (uint64_t)ipv4_word(local) << 32 | ipv4_word(remote);
+    uint64_t ports = ((uint64_t)local_port << 24 | (uint64_t)remote_port << 8 | (uint64_t)type);
+    return hash_mix(addrs ^ ports * 0x9E3779B97F4A7C15ull);
+}
+
+static uint32_t bind_hash_key(int type, const IPv4Address* addr, uint16_t port) {
+    return hash_mix((uint64_t)ipv4_word(addr) << 32 | (uint32_t)port << 8 | (uint32_t)type);
+}
+
+static int socket_hash_grow(SocketHash* table) {
+    uint32_t size = table->buckets ? (table->mask + 1) * 2 : SOCKET_HASH_INITIAL;
+    Socket** buckets = (Socket**)calloc(size, sizeof(Socket*));
+    if (!buckets) return -1;
+    
+    for (uint32_t i = 0; table->buckets && i <= table->mask; i++) {
+        Socket* sock = table->buckets[i];
+        while (sock) {
+            Socket* next = sock->hash_next;
+            sock->hash_next = buckets[sock->hash & (size - 1)];
+            buckets[sock->hash & (size - 1)] = sock;
+            sock = next;
+        }
+    }
+    free(table->buckets);
+    table->buckets = buckets;
+    table->mask = size - 1;
+    return 0;
+}
+
+static void socket_unhash(Socket* sock) {
+    if (sock->hashed == SOCKET_UNHASHED) return;
+    
+    SocketHash* table = sock->hashed == SOCKET_HASH_CONN ? &conn_hash : &bind_hash;
+    Socket** link = &table->buckets[sock->hash & table->mask];
+    while (*link && *link != sock) link = &(*link)->hash_next;
+    if (*link) {
+        *link = sock->hash_next;
+        table->count--;
+    }
+    sock->hash_next = NULL;
+    sock->hashed = SOCKET_UNHASHED;
+}
+
+// Past the load factor a failed grow only makes the chains longer
+static void socket_hash_insert(Socket* sock, int which) {
+    socket_unhash(sock);
+    SocketHash* table = which == SOCKET_HASH_CONN ? &conn_hash : &bind_hash;
+    if ((!table->buckets || table->count > table->mask) && socket_hash_grow(table) < 0 && !table->buckets) {
+        global_stats.errors++;
+        return;
+    }
+    
+    sock->hash = which == SOCKET_HASH_CONN
+        ? conn_hash_key(sock->type, &sock->local.addr, sock->local.port, &sock->remote.addr, sock->remote.port)
+        : bind_hash_key(sock->type, &sock->local.addr, sock->local.port);
+    sock->hashed = which;
+    sock->hash_next = table->buckets[sock->hash & table->mask];
+    table->buckets[sock->hash & table->mask] = sock;
+    table->count++;
+}
+
+static Socket* conn_lookup(int type, const IPv4Address* local, uint16_t local_port,
+                           const IPv4Address* remote, uint16_t remote_port) {
+    uint32_t hash = conn_hash_key(type, local, local_port, remote, remote_port);
+    for (Socket* sock = conn_hash.buckets[hash & conn_hash.mask]; sock; sock = sock->hash_next) {
+        if (sock->hash == hash && sock->type == type && sock->local.port == local_port &&
+            sock->remote.port == remote_port && ipv4_equal(&sock->local.addr, local) &&
+            ipv4_equal(&sock->remote.addr, remote)) {
+            return sock;
+        }
+    }
+    return NULL;
+}
+
+static Socket* bind_lookup(int type, const IPv4Address* addr, uint16_t port) {
+    uint32_t hash = bind_hash_key(type, addr, port);
+    for (Socket* sock = bind_hash.buckets[hash & bind_hash.mask]; sock; sock = sock->hash_next) {
+        if (sock->hash == hash && sock->type == type && sock->local.port == port &&
+            ipv4_equal(&sock->local.addr, addr)) {
+            return sock;
+        }
+    }
+    return NULL;
+}
+
+// Ports are exclusive per socket type, except that accepted connections
+// share their listener's.  Every socket with a local port holds a reference.
+static int port_in_use(int type, uint16_t port) {
+    return port_refs[type - 1][ntohs(port)] != 0;
+}
+
+static void port_hold(Socket* sock, uint16_t port) {
+    sock->local.family = AF_INET;
+    sock->local.port = port;
+    port_refs[sock->type - 1][ntohs(port)]++;
+}
+
+// Give an unbound socket a free port from the ephemeral range
+static int socket_autobind(Socket* sock) {
+    for (int tries = 0; tries <= PORT_MAX - PORT_EPHEMERAL_MIN; tries++) {
+        uint16_t port = htons((uint16_t)next_ephemeral);
+        next_ephemeral = next_ephemeral == PORT_MAX ? PORT_EPHEMERAL_MIN : next_ephemeral + 1;
+        if (!port_in_use(sock->type, port)) {
+            port_hold(sock, port);
+            if (sock->type == SOCK_DGRAM) socket_hash_insert(sock, SOCKET_HASH_BIND);
+            return 0;
+        }
+    }
+    printf("[NetStack] No free ephemeral ports\n");
+    return -1;
+}
+
+static int socket_table_grow(void) {
+    if (socket_capacity >= SOCKET_LIMIT) return -1;
+    int capacity = socket_capacity ? socket_capacity * 2 : SOCKET_TABLE_INITIAL;
+    if (capacity > SOCKET_LIMIT) capacity = SOCKET_LIMIT;
+    
+    Socket** table = (Socket**)realloc(socket_table, capacity * sizeof(Socket*));
+    if (!table) return -1;
+    socket_table = table;
+    memset(table + socket_capacity, 0, (capacity - socket_capacity) * sizeof(Socket*));
+    
+    int* fds = (int*)realloc(free_fds, capacity * sizeof(int));
+    if (!fds) return -1;
+    free_fds = fds;
+    socket_capacity = capacity;
+    return 0;
+}
+
+static Socket* socket_alloc(int family, int type, int protocol) {
+    if (free_fd_count == 0 && next_fd >= socket_capacity && socket_table_grow() < 0) return NULL;
+    
+    Socket* sock = (Socket*)calloc(1, sizeof(Socket));
+    if (!sock) return NULL;
+    
+    sock->fd = free_fd_count > 0 ? free_fds[--free_fd_count] : next_fd++;
+    sock->family = family;
+    sock->type = type;
+    sock->protocol = protocol;
+    sock->state = SOCKET_CLOSED;
+    sock->recv_size = SOCKET_BUFFER_SIZE;
+    sock->send_size = SOCKET_BUFFER_SIZE;
+    
+    // Random initial sequence number
+    sock->seq_num = rand();
+    sock->snd_una = sock->seq_num;
+    socket_table[sock->fd] = sock;
+    socket_count++;
+    return sock;
+}
+
+static void socket_free(Socket* sock) {
+    timer_cancel(&sock->rto_timer);
+    socket_unhash(sock);
+    if (sock->local.port != 0) port_refs[sock->type - 1][ntohs(sock->local.port)]--;
+    socket_table[sock->fd] = NULL;
+    free_fds[free_fd_count++] = sock->fd;
+    socket_count--;
+    
+    free(sock->accept_queue);
+    free(sock->recv_buffer);
+    free(sock->send_buffer);
+    free(sock);
+}
+
+// Rings are allocated on first use, so listening and idle sockets stay small
+static int socket_ring(uint8_t** ring) {
+    if (!*ring) *ring = (uint8_t*)malloc(SOCKET_BUFFER_SIZE);
+    return *ring ? 0 : -1;
+}
+
+// Ring buffer copies; `pos` is a free-running head or tail
+static void ring_put(uint8_t* ring, uint32_t size, uint32_t pos, const void* data, uint32_t length) {
+    uint32_t index = pos & (size - 1);
+    uint32_t first = size - index < length ? size - index : length;
+    memcpy(ring + index, data, first);
+    memcpy(ring, (const uint8_t*)data + first, length - first);
+}
+
+static void ring_get(const uint8_t* ring, uint32_t size, uint32_t pos, void* data, uint32_t length) {
+    uint32_t index = pos & (size - 1);
+    uint32_t first = size - index < length ? size - index : length;
+    memcpy(data, ring + index, first);
+    memcpy((uint8_t*)data + first, ring, length - first);
+}
+
+// ring_get() that adds the bytes to a checksum in the same pass; `data`
+// is at an even offset of what the checksum covers
+static uint32_t ring_get_checksum(const uint8_t* ring, uint32_t size, uint32_t pos, void* data, uint32_t length,
+                                  uint32_t sum) {
+    uint32_t index = pos & (size - 1);
+    uint32_t first = size - index < length ? size - index : length;
+    sum = inet_checksum_copy(sum, data, ring + index, first);
+    if (length == first) return sum;
+    return inet_checksum_combine(sum, inet_checksum_copy(0, (uint8_t*)data + first, ring, length - first), first);
+}
+
+// Partial sum of the IPv4 pseudo-header for a TCP or UDP segment
+static uint32_t transport_pseudo_sum(const IPv4Header* ip, uint32_t length) {
+    uint8_t pseudo[12];
+    memcpy(pseudo, &ip->src_addr, 4);
+    memcpy(pseudo + 4, &ip->dest_addr, 4);
+    pseudo[8] = 0;
+    pseudo[9] = ip->protocol;
+    pseudo[10] = (uint8_t)(length >> 8);
+    pseudo[11] = (uint8_t)length;
+    return inet_checksum_add(0, pseudo, sizeof(pseudo));
+}
+
+// TCP and UDP checksum over the segment and the IPv4 pseudo-header
+static uint16_t transport_checksum(const IPv4Header* ip, const void* segment, uint32_t length) {
+    return (uint16_t)~inet_checksum_add(transport_pseudo_sum(ip, length), segment, length);
+}
+
+// A packet with its IPv4 header filled in and room for `transport_bytes`
+static NetPacket* packet_alloc(const IPv4Address* src, const IPv4Address* dest, uint8_t protocol,
+                               uint32_t transport_bytes) {
+    uint32_t length = sizeof(IPv4Header) + transport_bytes;
+    NetPacket* pkt = (NetPacket*)malloc(sizeof(NetPacket) + length);
+    if (!pkt) {
+        global_stats.errors++;
+        return NULL;
+    }
+    pkt->next = NULL;
+    pkt->length = length;
+    
+    IPv4Header* ip = (IPv4Header*)pkt->data;
+    ip->version_ihl = 0x45;
+    ip->tos = 0;
+    ip->total_length = htons((uint16_t)length);
+    ip->id = htons(next_ip_id++);
+    ip->flags_offset = htons(0x4000);      // Don't fragment
+    ip->ttl = 64;
+    ip->protocol = protocol;
+    ip->checksum = 0;
+    ip->src_addr = *src;
+    ip->dest_addr = *dest;
+    ip->checksum = netstack_checksum(ip, sizeof(IPv4Header));
+    return pkt;
+}
+
+// Hand a finished packet to its interface.  Anything for this host goes
+// on the loopback queue; nothing is wired behind zora0, so packets routed
+// there are counted as sent and dropped.
+static void packet_transmit(NetPacket* pkt) {
+    const IPv4Header* ip = (const IPv4Header*)pkt->data;
+    int local = ipv4_is_local(&ip->dest_addr);
+    RouteEntry* route = local ? NULL : route_lookup(&ip->dest_addr);
+    if (!local && !route) {
+        global_stats.packets_dropped++;     // No route to host
+        free(pkt);
+        return;
+    }
+    NetworkInterface* iface = &interfaces[local ? 0 : route->interface_id];
+    
+    iface->tx_packets++;
+    iface->tx_bytes += pkt->length;
+    global_stats.packets_sent++;
+    global_stats.bytes_sent += pkt->length;
+    
+    if (!local) {
+        free(pkt);
+        return;
+    }
+    if (lo_queue_tail) lo_queue_tail->next = pkt;
+    else lo_queue_head = pkt;
+    lo_queue_tail = pkt;
+}
+
+static void tcp_input(const IPv4Header* ip, const uint8_t* segment, uint32_t length);
+static void udp_input(const IPv4Header* ip, const uint8_t* segment, uint32_t length);
+
+static void ip_input(const uint8_t* data, uint32_t length) {
+    const IPv4Header* ip = (const IPv4Header*)data;
+    uint32_t header_bytes = (ip->version_ihl & 0x0F) * 4;
+    uint32_t total = length >= sizeof(IPv4Header) ? ntohs(ip->total_length) : 0;
+    
+    if (length < sizeof(IPv4Header) || (ip->version_ihl >> 4) != 4 ||
+        header_bytes < sizeof(IPv4Header) || total < header_bytes || total > length ||
+        netstack_checksum(ip, header_bytes) != 0) {
+        global_stats.errors++;
+        return;
+    }
+    if (!ipv4_is_local(&ip->dest_addr)) {
+        global_stats.packets_dropped++;     // No forwarding
+        return;
+    }
+    
+    global_stats.packets_received++;
+    global_stats.bytes_received += total;
+    
+    switch (ip->protocol) {
+        case IPPROTO_TCP: tcp_input(ip, data + header_bytes, total - header_bytes); break;
+        case IPPROTO_UDP: udp_input(ip, data + header_bytes, total - header_bytes); break;
+        default: global_stats.packets_dropped++; break;
+    }
+}
+
+// Bring in everything queued on lo.  Socket calls run this before they
+// return, like a softirq on the way out of a syscall; replies the input
+// handlers send join the queue and are delivered by the same loop.
+static void loopback_poll(void) {
+    NetworkInterface* lo = &interfaces[0];
+    
+    while (lo_queue_head) {
+        NetPacket* pkt = lo_queue_head;
+        lo_queue_head = pkt->next;
+        if (!lo_queue_head) lo_queue_tail = NULL;
+        
+        lo->rx_packets++;
+        lo->rx_bytes += pkt->length;
+        ip_input(pkt->data, pkt->length);
+        free(pkt);
+    }
+}
+
+// ===== TCP =====
+
+// lo's MTU is one more than an IPv4 packet can hold
+static uint32_t tcp_mss(void) {
+    uint32_t mtu = interfaces[0].mtu < IP_PACKET_SIZE ? (uint32_t)interfaces[0].mtu : IP_PACKET_SIZE;
+    return mtu - sizeof(IPv4Header) - sizeof(TCPHeader);
+}
+
+static uint32_t tcp_receive_window(const Socket* sock) {
+    uint32_t room = sock->recv_size - (sock->recv_tail - sock->recv_head);
+    return room < TCP_MAX_WINDOW ? room : TCP_MAX_WINDOW;
+}
+
+// Send one segment carrying `length` bytes of the send ring from `offset`
+// bytes past snd_una, advertising the receive window we have right now
+static void tcp_send_segment(Socket* sock, uint8_t flags, uint32_t seq, uint32_t offset, uint32_t length) {
+    NetPacket* pkt = packet_alloc(&sock->local.addr, &sock->remote.addr, IPPROTO_TCP,
+                                  sizeof(TCPHeader) + length);
+    if (!pkt) return;
+    
+    IPv4Header* ip = (IPv4Header*)pkt->data;
+    TCPHeader* tcp = (TCPHeader*)(ip + 1);
+    uint32_t window = tcp_receive_window(sock);
+    tcp->src_port = sock->local.port;
+    tcp->dest_port = sock->remote.port;
+    tcp->seq_num = htonl(seq);
+    tcp->ack_num = (flags & TCP_ACK) ? htonl(sock->ack_num) : 0;
+    tcp->offset_reserved = (sizeof(TCPHeader) / 4) << 4;
+    tcp->flags = flags;
+    tcp->window = htons((uint16_t)window);
+    tcp->checksum = 0;
+    tcp->urgent_ptr = 0;
+    
+    // The payload is summed as it leaves the ring, so only the header is
+    // read again for the checksum
+    uint32_t sum = transport_pseudo_sum(ip, sizeof(TCPHeader) + length);
+    if (length > 0) {
+        sum = ring_get_checksum(sock->send_buffer, sock->send_size, sock->send_head + offset, tcp + 1, length, sum);
+    }
+    tcp->checksum = (uint16_t)~inet_checksum_add(sum, tcp, sizeof(TCPHeader));
+    
+    if (flags & TCP_ACK) sock->rcv_adv = sock->ack_num + window;
+    packet_transmit(pkt);
+}
+
+// Answer a segment no socket wants with a reset (RFC 793, 3.4)
+static void tcp_send_reset(const IPv4Header* ip, const TCPHeader* tcp, uint32_t payload_bytes) {
+    NetPacket* pkt = packet_alloc(&ip->dest_addr, &ip->src_addr, IPPROTO_TCP, sizeof(TCPHeader));
+    if (!pkt) return;
+    
+    IPv4Header* reply_ip = (IPv4Header*)pkt->data;
+    TCPHeader* reply = (TCPHeader*)(reply_ip + 1);
+    memset(reply, 0, sizeof(TCPHeader));
+    reply->src_port = tcp->dest_port;
+    reply->dest_port = tcp->src_port;
+    reply->offset_reserved = (sizeof(TCPHeader) / 4) << 4;
+    if (tcp->flags & TCP_ACK) {
+        reply->seq_num = tcp->ack_num;
+        reply->flags = TCP_RST;
+    } else {
+        uint32_t consumed = payload_bytes + ((tcp->flags & TCP_SYN) ? 1 : 0) + ((tcp->flags & TCP_FIN) ? 1 : 0);
+        reply->ack_num = htonl(ntohl(tcp->seq_num) + consumed);
+        reply->flags = TCP_RST | TCP_ACK;
+    }
+    reply->checksum = transport_checksum(reply_ip, reply, sizeof(TCPHeader));
+    packet_transmit(pkt);
+}
+
+// Send what the peer's window allows, then the FIN once the ring is empty.
+// Loopback never loses a segment, so nothing here is ever retransmitted:
+// a closed window reopens with the ACK the receiver sends when it reads.
+static void tcp_output(Socket* sock) {
+    if (!sock->loopback) return;
+    if (sock->state != SOCKET_ESTABLISHED && sock->state != SOCKET_CLOSE_WAIT) return;
+    
+    uint32_t queued = sock->send_tail - sock->send_head;
+    uint32_t mss = tcp_mss();
+    for (;;) {
+        uint32_t in_flight = sock->seq_num - sock->snd_una;
+        uint32_t length = queued - in_flight;
+        uint32_t usable = sock->snd_wnd > in_flight ? sock->snd_wnd - in_flight : 0;
+        if (length > usable) length = usable;
+        if (length > mss) length = mss;
+        if (length == 0) break;
+        
+        tcp_send_segment(sock, TCP_ACK | TCP_PSH, sock->seq_num, in_flight, length);
+        sock->seq_num += length;
+    }
+    
+    if ((sock->flags & SOCKET_FIN_QUEUED) && sock->seq_num - sock->snd_una == queued) {
+        tcp_send_segment(sock, TCP_FIN | TCP_ACK, sock->seq_num, 0, 0);
+        sock->seq_num++;
+        sock->flags = (sock->flags & ~SOCKET_FIN_QUEUED) | SOCKET_FIN_SENT;
+        sock->state = sock->state == SOCKET_ESTABLISHED ? SOCKET_FIN_WAIT_1 : SOCKET_LAST_ACK;
+    }
+}
+
+// Connection reset by the peer
+static void tcp_reset(Socket* sock) {
+    if (sock->flags & SOCKET_ORPHAN) {
+        socket_free(sock);
+        return;
+    }
+    timer_cancel(&sock->rto_timer);
+    socket_unhash(sock);
+    sock->state = SOCKET_CLOSED;
+}
+
+// Established connections first, then a listener on the address or the
+// wildcard
+static Socket* tcp_demux(const IPv4Address* dest, uint16_t dest_port,
+                         const IPv4Address* src, uint16_t src_port) {
+    Socket* sock = conn_lookup(SOCK_STREAM, dest, dest_port, src, src_port);
+    if (sock) return sock;
+    
+    // Only listeners are on the bind table
+    sock = bind_lookup(SOCK_STREAM, dest, dest_port);
+    if (!sock) sock = bind_lookup(SOCK_STREAM, &ipv4_any, dest_port);
+    return sock;
+}
+
+// SYN to a listening socket: queue a new connection and answer SYN-ACK
+static void tcp_listen_input(Socket* listener, const IPv4Header* ip, const TCPHeader* tcp,
+                             uint32_t payload_bytes) {
+    if (tcp->flags & TCP_RST) return;
+    if (tcp->flags & TCP_ACK) {
+        tcp_send_reset(ip, tcp, payload_bytes);
+        return;
+    }
+    if (!(tcp->flags & TCP_SYN)) return;
+    
+    // With the backlog full the SYN is dropped, and the client's
+    // retransmit timer tries again later
+    AcceptQueue* queue = (AcceptQueue*)listener->accept_queue;
+    Socket* child = queue->count < listener->backlog
+        ? socket_alloc(listener->family, listener->type, listener->protocol) : NULL;
+    if (!child) {
+        global_stats.packets_dropped++;
+        return;
+    }
+    
+    child->local.addr = ip->dest_addr;
+    port_hold(child, tcp->dest_port);
+    child->remote.family = AF_INET;
+    child->remote.addr = ip->src_addr;
+    child->remote.port = tcp->src_port;
+    child->loopback = 1;
+    socket_hash_insert(child, SOCKET_HASH_CONN);
+    child->state = SOCKET_SYN_RECEIVED;
+    child->ack_num = ntohl(tcp->seq_num) + 1;
+    child->snd_wnd = ntohs(tcp->window);
+    tcp_send_segment(child, TCP_SYN | TCP_ACK, child->seq_num, 0, 0);
+    child->seq_num++;
+    
+    queue->entries[(queue->head + queue->count) % MAX_LISTEN_BACKLOG] = child;
+    queue->count++;
+}
+
+static void tcp_input(const IPv4Header* ip, const uint8_t* segment, uint32_t length) {
+    const TCPHeader* tcp = (const TCPHeader*)segment;
+    uint32_t header_bytes = length >= sizeof(TCPHeader) ? (tcp->offset_reserved >> 4) * 4u : 0;
+    if (header_bytes < sizeof(TCPHeader) || header_bytes > length ||
+        transport_checksum(ip, segment, length) != 0) {
+        global_stats.errors++;
+        return;
+    }
+    
+    const uint8_t* payload = segment + header_bytes;
+    uint32_t payload_bytes = length - header_bytes;
+    uint32_t seq = ntohl(tcp->seq_num);
+    uint32_t ack = ntohl(tcp->ack_num);
+    uint8_t flags = tcp->flags;
+    
+    Socket* sock = tcp_demux(&ip->dest_addr, tcp->dest_port, &ip->src_addr, tcp->src_port);
+    if (!sock) {
+        // Closed port: refuse it
+        if (!(flags & TCP_RST)) {
+            global_stats.packets_dropped++;
+            tcp_send_reset(ip, tcp, payload_bytes);
+        }
+        return;
+    }
+    
+    if (sock->state == SOCKET_LISTEN) {
+        tcp_listen_input(sock, ip, tcp, payload_bytes);
+        return;
+    }
+    
+    if (sock->state == SOCKET_SYN_SENT) {
+        if ((flags & TCP_ACK) && ack != sock->seq_num) {
+            if (!(flags & TCP_RST)) tcp_send_reset(ip, tcp, payload_bytes);
+            return;
+        }
+        if (flags & TCP_RST) {
+            if (flags & TCP_ACK) tcp_reset(sock);      // Connection refused
+            return;
+        }
+        if ((flags & (TCP_SYN | TCP_ACK)) != (TCP_SYN | TCP_ACK)) return;
+        
+        timer_cancel(&sock->rto_timer);
+        sock->ack_num = seq + 1;
+        sock->snd_una = ack;
+        sock->snd_wnd = ntohs(tcp->window);
+        sock->state = SOCKET_ESTABLISHED;
+        global_stats.tcp_connections++;
+        tcp_send_segment(sock, TCP_ACK, sock->seq_num, 0, 0);
+        return;
+    }
+    
+    if (flags & TCP_RST) {
+        tcp_reset(sock);
+        return;
+    }
+    if ((flags & TCP_SYN) || !(flags & TCP_ACK)) return;
+    
+    if (sock->state == SOCKET_SYN_RECEIVED) {
+        if (ack != sock->seq_num) {
+            tcp_send_reset(ip, tcp, payload_bytes);
+            return;
+        }
+        sock->state = SOCKET_ESTABLISHED;
+        global_stats.tcp_connections++;
+    }
+    
+    // Acknowledgment: free what the peer has, and take its window.  The
+    // FIN takes a sequence number but no byte of the ring.
+    if (seq_after(ack, sock->snd_una) && !seq_after(ack, sock->seq_num)) {
+        uint32_t acked = ack - sock->snd_una;
+        uint32_t queued = sock->send_tail - sock->send_head;
+        sock->send_head += acked < queued ? acked : queued;
+        sock->snd_una = ack;
+    }
+    sock->snd_wnd = ntohs(tcp->window);
+    
+    int release = 0;
+    if ((sock->flags & SOCKET_FIN_SENT) && sock->snd_una == sock->seq_num) {
+        if (sock->state == SOCKET_FIN_WAIT_1) sock->state = SOCKET_FIN_WAIT_2;
+        else if (sock->state == SOCKET_CLOSING || sock->state == SOCKET_LAST_ACK) release = 1;
+    }
+    
+    // Data and FIN.  Loopback delivers in order, so anything but the next
+    // expected byte is a duplicate; it only gets an ACK.
+    if (!release && (payload_bytes > 0 || (flags & TCP_FIN))) {
+        if (seq == sock->ack_num) {
+            uint32_t accepted = payload_bytes;
+            if (!(sock->flags & SOCKET_ORPHAN)) {
+                uint32_t room = sock->recv_size - (sock->recv_tail - sock->recv_head);
+                if (accepted > room) accepted = room;
+                if (accepted > 0 && socket_ring(&sock->recv_buffer) == 0) {
+                    ring_put(sock->recv_buffer, sock->recv_size, sock->recv_tail, payload, accepted);
+                } else {
+                    accepted = 0;
+                }
+                sock->recv_tail += accepted;
+            }
+            sock->ack_num += accepted;
+            
+            if ((flags & TCP_FIN) && accepted == payload_bytes) {
+                sock->ack_num++;
+                if (sock->state == SOCKET_ESTABLISHED) sock->state = SOCKET_CLOSE_WAIT;
+                else if (sock->state == SOCKET_FIN_WAIT_1) sock->state = SOCKET_CLOSING;
+                else if (sock->state == SOCKET_FIN_WAIT_2) release = 1;    // No TIME_WAIT: lo has no stray duplicates
+            }
+        }
+        tcp_send_segment(sock, TCP_ACK, sock->seq_num, 0, 0);
+    }
+    
+    if (release) {
+        socket_free(sock);
+        return;
+    }
+    tcp_output(sock);
+}
+
+// Reading opened the window: tell the peer once it has grown by half the
+// ring or a full segment, whichever is less (RFC 1122 receiver-side SWS
+// avoidance)
+static void tcp_window_update(Socket* sock) {
+    if (!sock->loopback || sock->state != SOCKET_ESTABLISHED) return;
+    
+    uint32_t threshold = sock->recv_size / 2 < tcp_mss() ? sock->recv_size / 2 : tcp_mss();
+    uint32_t right_edge = sock->ack_num + tcp_receive_window(sock);
+    if ((int32_t)(right_edge - sock->rcv_adv) >= (int32_t)threshold) {
+        tcp_send_segment(sock, TCP_ACK, sock->seq_num, 0, 0);
+    }
+}
+
+// ===== UDP =====
+
+// The socket bound to the address, else the one bound to the wildcard.  A
+// connected socket only hears from its peer.
+static Socket* udp_demux(const IPv4Address* dest, uint16_t dest_port,
+                         const IPv4Address* src, uint16_t src_port) {
+    for (int pass = 0; pass < 2; pass++) {
+        Socket* sock = bind_lookup(SOCK_DGRAM, pass == 0 ? dest : &ipv4_any, dest_port);
+        if (sock && (sock->remote.port == 0 ||
+                     (sock->remote.port == src_port && ipv4_equal(&sock->remote.addr, src)))) {
+            return sock;
+        }
+    }
+    return NULL;
+}
+
+static int udp_output(Socket* sock, const void* data, uint32_t size, const SocketAddress* dest) {
+    if (size > UDP_DATAGRAM_SIZE) {
+        printf("[NetStack] Datagram of %u bytes too large\n", size);
+        return -1;
+    }
+    if (sock->local.port == 0 && socket_autobind(sock) < 0) return -1;
+    
+    IPv4Address src = ipv4_source(sock, &dest->addr);
+    NetPacket* pkt = packet_alloc(&src, &dest->addr, IPPROTO_UDP, sizeof(UDPHeader) + size);
+    if (!pkt) return -1;
+    
+    IPv4Header* ip = (IPv4Header*)pkt->data;
+    UDPHeader* udp = (UDPHeader*)(ip + 1);
+    udp->src_port = sock->local.port;
+    udp->dest_port = dest->port;
+    udp->length = htons((uint16_t)(sizeof(UDPHeader) + size));
+    udp->checksum = 0;
+    uint32_t sum = inet_checksum_copy(transport_pseudo_sum(ip, sizeof(UDPHeader) + size), udp + 1, data, size);
+    uint16_t checksum = (uint16_t)~inet_checksum_add(sum, udp, sizeof(UDPHeader));
+    udp->checksum = checksum ? checksum : 0xFFFF;  // 0 means no checksum
+    
+    global_stats.udp_datagrams++;
+    packet_transmit(pkt);
+    return size;
+}
+
+// Datagrams have no flow control: one that does not fit the ring is dropped
+static void udp_input(const IPv4Header* ip, const uint8_t* segment, uint32_t length) {
+    const UDPHeader* udp = (const UDPHeader*)segment;
+    uint32_t udp_length = length >= sizeof(UDPHeader) ? ntohs(udp->length) : 0;
+    if (udp_length < sizeof(UDPHeader) || udp_length > length ||
+        (udp->checksum != 0 && transport_checksum(ip, segment, udp_length) != 0)) {
+        global_stats.errors++;
+        return;
+    }
+    
+    Socket* sock = udp_demux(&ip->dest_addr, udp->dest_port, &ip->src_addr, udp->src_port);
+    uint32_t payload_bytes = udp_length - sizeof(UDPHeader);
+    if (!sock || sock->recv_size - (sock->recv_tail - sock->recv_head) < UDP_RECORD_HEADER + payload_bytes ||
+        socket_ring(&sock->recv_buffer) < 0) {
+        global_stats.packets_dropped++;
+        return;
+    }
+    
+    uint8_t record[UDP_RECORD_HEADER];
+    uint16_t record_length = (uint16_t)payload_bytes;
+    memcpy(record, &record_length, 2);
+    memcpy(record + 2, &udp->src_port, 2);
+    memcpy(record + 4, &ip->src_addr, 4);
+    ring_put(sock->recv_buffer, sock->recv_size, sock->recv_tail, record, UDP_RECORD_HEADER);
+    ring_put(sock->recv_buffer, sock->recv_size, sock->recv_tail + UDP_RECORD_HEADER, udp + 1, payload_bytes);
+    sock->recv_tail += UDP_RECORD_HEADER + payload_bytes;
+    global_stats.udp_datagrams++;
+}
+
+// One datagram per call; the part that does not fit `size` is discarded
+static int udp_recv(Socket* sock, void* data, uint32_t size, SocketAddress* addr) {
+    if (sock->recv_tail == sock->recv_head) return -1;
+    
+    uint8_t record[UDP_RECORD_HEADER];
+    uint16_t record_length;
+    ring_get(sock->recv_buffer, sock->recv_size, sock->recv_head, record, UDP_RECORD_HEADER);
+    memcpy(&record_length, record, 2);
+    
+    uint32_t copied = record_length < size ? record_length : size;
+    ring_get(sock->recv_buffer, sock->recv_size, sock->recv_head + UDP_RECORD_HEADER, data, copied);
+    sock->recv_head += UDP_RECORD_HEADER + record_length;
+    
+    if (addr) {
+        memset(addr, 0, sizeof(SocketAddress));
+        addr->family = AF_INET;
+        memcpy(&addr->port, record + 2, 2);
+        memcpy(&addr->addr, record + 4, 4);
+    }
+    return copied;
+}
+
+// ===== Routing =====
+
+// The interface whose subnet holds `addr`; zora0 for anything else
+static int route_interface(const IPv4Address* addr) {
+    if (addr->octets[0] == 127) return 0;
+    for (int i = 1; i < interface_count; i++) {
+        uint32_t mask = ipv4_host(&interfaces[i].netmask);
+        if (mask && !((ipv4_host(addr) ^ ipv4_host(&interfaces[i].ip)) & mask)) return i;
+    }
+    return 1;
+}
+
+// Add a route or update the one for the same prefix in place.  The
+// gateway, or the destination of an on-link route, picks the interface.
+static int route_add(const IPv4Address* dest, const IPv4Address* mask, const IPv4Address* gateway, int metric) {
+    int length = fib_mask_length(ipv4_host(mask));
+    if (length < 0) {
+        printf("[NetStack] Netmask is not contiguous\n");
+        return -1;
+    }
+    
+    uint32_t prefix = ipv4_host(dest) & fib_length_mask(length);
+    RouteEntry* route = (RouteEntry*)fib_get(routes, prefix, length);
+    int added = !route;
+    if (added && !(route = (RouteEntry*)malloc(sizeof(RouteEntry)))) return -1;
+    route->dest = ipv4_from_host(prefix);
+    route->mask = *mask;
+    route->gateway = *gateway;
+    route->metric = metric;
+    route->interface_id = route_interface(ipv4_is_any(gateway) ? &route->dest : gateway);
+    if (added && fib_insert(routes, prefix, length, route) != 0) {
+        free(route);
+        return -1;
+    }
+    return 0;
+}
+
+int netstack_add_route(const IPv4Address* dest, const IPv4Address* mask, const IPv4Address* gateway, int metric) {
+    EnterCriticalSection(&net_lock);
+    int result = routes ? route_add(dest, mask, gateway, metric) : -1;
+    LeaveCriticalSection(&net_lock);
+    
+    if (result == 0) {
+        char dest_str[16], gw_str[16];
+        netstack_format_ipv4(dest, dest_str, sizeof(dest_str));
+        netstack_format_ipv4(gateway, gw_str, sizeof(gw_str));
+        printf("[NetStack] Added route %s/%d via %s metric %d\n", dest_str, fib_mask_length(ipv4_host(mask)),
+               gw_str, metric);
+    }
+    return result;
+}
+
+// Deletes the most specific route whose network address is `dest`
+int netstack_del_route(const IPv4Address* dest) {
+    EnterCriticalSection(&net_lock);
+    RouteEntry* route = routes ? (RouteEntry*)fib_remove(routes, ipv4_host(dest), -1) : NULL;
+    LeaveCriticalSection(&net_lock);
+    
+    char dest_str[16];
+    netstack_format_ipv4(dest, dest_str, sizeof(dest_str));
+    if (!route) {
+        printf("[NetStack] No route for %s\n", dest_str);
+        return -1;
+    }
+    printf("[NetStack] Deleted route %s/%d\n", dest_str, fib_mask_length(ipv4_host(&route->mask)));
+    free(route);
+    return 0;
+}
+
+// Longest-prefix match.  The entry stays valid until its route is deleted.
+RouteEntry* netstack_find_route(const IPv4Address* dest) {
+    EnterCriticalSection(&net_lock);
+    RouteEntry* route = route_lookup(dest);
+    LeaveCriticalSection(&net_lock);
+    return route;
+}
+
+// The same table in host byte order, for network_advanced.c; net_lock held
+static void route_export(const RouteEntry* route, NetRoute* out) {
+    NetworkInterface* iface = netstack_get_interface(route->interface_id);
+    out->dest = ipv4_host(&route->dest);
+    out->mask = ipv4_host(&route->mask);
+    out->gateway = ipv4_host(&route->gateway);
+    out->metric = route->metric;
+    strncpy(out->iface, iface ? iface->name : "?", sizeof(out->iface) - 1);
+    out->iface[sizeof(out->iface) - 1] = '\0';
+}
+
+int netstack_route_add(uint32_t dest, uint32_t mask, uint32_t gateway, int metric) {
+    IPv4Address dest_addr = ipv4_from_host(dest), mask_addr = ipv4_from_host(mask);
+    IPv4Address gateway_addr = ipv4_from_host(gateway);
+    EnterCriticalSection(&net_lock);
+    int result = routes ? route_add(&dest_addr, &mask_addr, &gateway_addr, metric) : -1;
+    LeaveCriticalSection(&net_lock);
+    return result;
+}
+
+int netstack_route_remove(uint32_t dest, uint32_t gateway) {
+    EnterCriticalSection(&net_lock);
+    RouteEntry* route = routes ? (RouteEntry*)fib_get(routes, dest, -1) : NULL;
+    if (route && ipv4_host(&route->gateway) == gateway) {
+        fib_remove(routes, dest, fib_mask_length(ipv4_host(&route->mask)));
+    } else {
+        route = NULL;
+    }
+    LeaveCriticalSection(&net_lock);
+    
+    int removed = route != NULL;
+    free(route);
+    return removed ? 0 : -1;
+}
+
+int netstack_route_lookup(uint32_t addr, NetRoute* route) {
+    EnterCriticalSection(&net_lock);
+    RouteEntry* entry = routes ? (RouteEntry*)fib_lookup(routes, addr) : NULL;
+    if (entry) route_export(entry, route);
+    LeaveCriticalSection(&net_lock);
+    return entry ? 0 : -1;
+}
+
+typedef struct {
+    NetRouteVisit visit;
+    void* arg;
+} RouteWalk;
+
+static void route_walk_visit(uint32_t prefix, int length, void* value, void* arg) {
+    RouteWalk* walk = (RouteWalk*)arg;
+    NetRoute route;
+    (void)prefix;
+    (void)length;
+    route_export((const RouteEntry*)value, &route);
+    walk->visit(&route, walk->arg);
 }
 
-static uint16_t ntohs(uint16_t netshort) {
-    return htons(netshort);
+void netstack_route_walk(NetRouteVisit visit, void* arg) {
+    RouteWalk walk = { visit, arg };
+    EnterCriticalSection(&net_lock);
+    if (routes) fib_walk(routes, route_walk_visit, &walk);
+    LeaveCriticalSection(&net_lock);
 }
 
-static uint32_t ntohl(uint32_t netlong) {
-    return htonl(netlong);
+uint32_t netstack_route_count(void) {
+    EnterCriticalSection(&net_lock);
+    uint32_t count = routes ? fib_count(routes) : 0;
+    LeaveCriticalSection(&net_lock);
+    return count;
 }
 
+// ===== Sockets =====
+
 // Initialize network stack
 int netstack_init(void) {
     printf("[NetStack] Initializing network stack...\n");
     
+    if (!net_lock_ready) {
+        InitializeCriticalSection(&net_lock);
+        net_lock_ready = 1;
+    }
+    
     // Clear all state
-    memset(sockets, 0, sizeof(sockets));
     memset(&interfaces, 0, sizeof(interfaces));
-    memset(&routes, 0, sizeof(routes));
     memset(&global_stats, 0, sizeof(global_stats));
     interface_count = 0;
-    route_count = 0;
     next_fd = 3;
+    next_ephemeral = PORT_EPHEMERAL_MIN;
+    lo_queue_head = lo_queue_tail = NULL;
+    memset(port_refs, 0, sizeof(port_refs));
+    if ((!conn_hash.buckets && socket_hash_grow(&conn_hash) < 0) ||
+        (!bind_hash.buckets && socket_hash_grow(&bind_hash) < 0)) {
+        printf("[NetStack] Out of memory for the socket tables\n");
+        return -1;
+    }
+    fib_destroy(routes, free);
+    if (!(routes = fib_create())) {
+        printf("[NetStack] Out of memory for the routing table\n");
+        return -1;
+    }
     
     // Create loopback interface (lo)
     NetworkInterface* lo = &interfaces[interface_count++];
@@ -96,24 +1092,11 @@ int netstack_init(void) {
     eth0->broadcast.octets[3] = 255;
     eth0->mtu = 1500;
     
-    // Add default route
-    RouteEntry* default_route = &routes[route_count++];
-    memset(&default_route->dest, 0, sizeof(IPv4Address));
-    memset(&default_route->mask, 0, sizeof(IPv4Address));
-    default_route->gateway = eth0->gateway;
-    default_route->metric = 0;
-    default_route->interface_id = 1;
-    
-    // Add local network route
-    RouteEntry* local_route = &routes[route_count++];
-    local_route->dest.octets[0] = 10;
-    local_route->dest.octets[1] = 0;
-    local_route->dest.octets[2] = 2;
-    local_route->dest.octets[3] = 0;
-    local_route->mask = eth0->netmask;
-    memset(&local_route->gateway, 0, sizeof(IPv4Address));
-    local_route->metric = 0;
-    local_route->interface_id = 1;
+    // Default, local network and loopback routes
+    route_add(&ipv4_any, &ipv4_any, &eth0->gateway, 0);
+    IPv4Address local_net = ipv4_from_host(ipv4_host(&eth0->ip) & ipv4_host(&eth0->netmask));
+    route_add(&local_net, &eth0->netmask, &ipv4_any, 0);
+    route_add(&lo->ip, &lo->netmask, &ipv4_any, 0);
     
     printf("[NetStack] Created interfaces: lo (127.0.0.1), zora0 (10.0.2.15)\n");
     printf("[NetStack] Default gateway: 10.0.2.1\n");
@@ -126,14 +1109,26 @@ void netstack_cleanup(void) {
     printf("[NetStack] Cleaning up network stack...\n");
     
     // Close all sockets
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i]) {
-            if (sockets[i]->recv_buffer) free(sockets[i]->recv_buffer);
-            if (sockets[i]->send_buffer) free(sockets[i]->send_buffer);
-            free(sockets[i]);
-            sockets[i] = NULL;
-        }
+    for (int fd = 0; fd < socket_capacity; fd++) {
+        if (socket_table[fd]) socket_free(socket_table[fd]);
+    }
+    free(socket_table);
+    free(free_fds);
+    free(conn_hash.buckets);
+    free(bind_hash.buckets);
+    socket_table = NULL;
+    free_fds = NULL;
+    socket_capacity = socket_count = free_fd_count = 0;
+    memset(&conn_hash, 0, sizeof(conn_hash));
+    memset(&bind_hash, 0, sizeof(bind_hash));
+    while (lo_queue_head) {
+        NetPacket* pkt = lo_queue_head;
+        lo_queue_head = pkt->next;
+        free(pkt);
     }
+    lo_queue_tail = NULL;
+    fib_destroy(routes, free);
+    routes = NULL;
 }
 
 // Create socket
@@ -142,348 +1137,398 @@ int netstack_socket(int family, int type, int protocol) {
         printf("[NetStack] Unsupported address family: %d\n", family);
         return -1;
     }
-    
-    // Find free socket slot
-    int fd = -1;
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (!sockets[i]) {
-            fd = next_fd++;
-            sockets[i] = (Socket*)calloc(1, sizeof(Socket));
-            sockets[i]->fd = fd;
-            sockets[i]->family = family;
-            sockets[i]->type = type;
-            sockets[i]->protocol = protocol;
-            sockets[i]->state = SOCKET_CLOSED;
-            
-            // Allocate buffers (64KB each)
-            sockets[i]->recv_buffer = (uint8_t*)malloc(65536);
-            sockets[i]->recv_size = 65536;
-            sockets[i]->send_buffer = (uint8_t*)malloc(65536);
-            sockets[i]->send_size = 65536;
-            
-            // Random initial sequence number
-            sockets[i]->seq_num = rand();
-            
-            printf("[NetStack] Created socket fd=%d (type=%d, proto=%d)\n", fd, type, protocol);
-            return fd;
-        }
+    if (type < SOCK_STREAM || type > SOCK_RAW) {
+        printf("[NetStack] Unsupported socket type: %d\n", type);
+        return -1;
     }
     
-    printf("[NetStack] No available sockets\n");
-    return -1;
+    EnterCriticalSection(&net_lock);
+    Socket* sock = socket_alloc(family, type, protocol);
+    int fd = sock ? sock->fd : -1;
+    LeaveCriticalSection(&net_lock);
+    
+    if (fd < 0) {
+        printf("[NetStack] No available sockets\n");
+        return -1;
+    }
+    printf("[NetStack] Created socket fd=%d (type=%d, proto=%d)\n", fd, type, protocol);
+    return fd;
 }
 
-// Bind socket
+// Bind socket; port 0 picks an ephemeral port
 int netstack_bind(int sockfd, const SocketAddress* addr) {
-    Socket* sock = NULL;
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i] && sockets[i]->fd == sockfd) {
-            sock = sockets[i];
-            break;
-        }
-    }
+    EnterCriticalSection(&net_lock);
+    Socket* sock = find_socket(sockfd);
+    int result = -1;
     
     if (!sock) {
         printf("[NetStack] Invalid socket fd=%d\n", sockfd);
-        return -1;
-    }
-    
-    // Check if port is already in use
-    uint16_t port = ntohs(addr->port);
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i] && sockets[i] != sock && 
-            ntohs(sockets[i]->local.port) == port) {
-            printf("[NetStack] Port %d already in use\n", port);
-            return -1;
+    } else if (sock->local.port != 0) {
+        printf("[NetStack] Socket fd=%d already bound\n", sockfd);
+    } else if (addr->port != 0 && port_in_use(sock->type, addr->port)) {
+        printf("[NetStack] Port %d already in use\n", ntohs(addr->port));
+    } else {
+        sock->local.addr = addr->addr;
+        if (addr->port != 0) {
+            port_hold(sock, addr->port);
+            if (sock->type == SOCK_DGRAM) socket_hash_insert(sock, SOCKET_HASH_BIND);
+            result = 0;
+        } else {
+            result = socket_autobind(sock);
         }
+        if (result == 0) printf("[NetStack] Bound socket fd=%d to port %d\n", sockfd, ntohs(sock->local.port));
     }
     
-    sock->local = *addr;
-    printf("[NetStack] Bound socket fd=%d to port %d\n", sockfd, port);
-    return 0;
+    LeaveCriticalSection(&net_lock);
+    return result;
 }
 
 // Listen on socket
 int netstack_listen(int sockfd, int backlog) {
-    Socket* sock = NULL;
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i] && sockets[i]->fd == sockfd) {
-            sock = sockets[i];
-            break;
-        }
-    }
+    EnterCriticalSection(&net_lock);
+    Socket* sock = find_socket(sockfd);
+    int result = -1;
     
     if (!sock) {
         printf("[NetStack] Invalid socket fd=%d\n", sockfd);
-        return -1;
-    }
-    
-    if (sock->type != SOCK_STREAM) {
+    } else if (sock->type != SOCK_STREAM) {
         printf("[NetStack] Listen only supported on SOCK_STREAM\n");
-        return -1;
+    } else if (!sock->accept_queue && !(sock->accept_queue = calloc(1, sizeof(AcceptQueue)))) {
+        printf("[NetStack] Out of memory for the accept queue of fd=%d\n", sockfd);
+    } else if (sock->state != SOCKET_CLOSED && sock->state != SOCKET_LISTEN) {
+        printf("[NetStack] Socket fd=%d already connected\n", sockfd);
+    } else if (sock->local.port != 0 || socket_autobind(sock) == 0) {
+        if (sock->hashed == SOCKET_UNHASHED) socket_hash_insert(sock, SOCKET_HASH_BIND);
+        sock->state = SOCKET_LISTEN;
+        sock->backlog = (backlog > MAX_LISTEN_BACKLOG) ? MAX_LISTEN_BACKLOG : (backlog < 1 ? 1 : backlog);
+        printf("[NetStack] Socket fd=%d listening (backlog=%d)\n", sockfd, sock->backlog);
+        result = 0;
     }
     
-    sock->state = SOCKET_LISTEN;
-    sock->backlog = (backlog > MAX_LISTEN_BACKLOG) ? MAX_LISTEN_BACKLOG : backlog;
-    printf("[NetStack] Socket fd=%d listening (backlog=%d)\n", sockfd, sock->backlog);
-    return 0;
+    LeaveCriticalSection(&net_lock);
+    return result;
 }
 
-// Accept connection
+// Accept connection.  Returns -1 while no handshake has completed.
 int netstack_accept(int sockfd, SocketAddress* addr) {
-    Socket* sock = NULL;
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i] && sockets[i]->fd == sockfd) {
-            sock = sockets[i];
-            break;
-        }
-    }
+    EnterCriticalSection(&net_lock);
+    Socket* sock = find_socket(sockfd);
     
     if (!sock || sock->state != SOCKET_LISTEN) {
+        LeaveCriticalSection(&net_lock);
         printf("[NetStack] Socket not listening\n");
         return -1;
     }
     
-    // Simulate accepting a connection (in real impl, would check accept_queue)
-    int new_fd = netstack_socket(sock->family, sock->type, sock->protocol);
-    if (new_fd < 0) return -1;
+    AcceptQueue* queue = (AcceptQueue*)sock->accept_queue;
+    if (queue->count == 0 || queue->entries[queue->head]->state == SOCKET_SYN_RECEIVED) {
+        LeaveCriticalSection(&net_lock);
+        return -1;
+    }
+    
+    Socket* new_sock = queue->entries[queue->head];
+    queue->head = (queue->head + 1) % MAX_LISTEN_BACKLOG;
+    queue->count--;
+    int new_fd = new_sock->fd;
+    SocketAddress remote = new_sock->remote;
+    LeaveCriticalSection(&net_lock);
     
-    Socket* new_sock = NULL;
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i] && sockets[i]->fd == new_fd) {
-            new_sock = sockets[i];
-            break;
-        }
+    if (addr) *addr = remote;
+    printf("[NetStack] Accepted connection fd=%d from %d.%d.%d.%d:%d\n",
+           new_fd,
+           remote.addr.octets[0], remote.addr.octets[1],
+           remote.addr.octets[2], remote.addr.octets[3],
+           ntohs(remote.port));
+    return new_fd;
+}
+
+// Retransmission timeout, run on the clock thread.  A SYN is the only
+// segment that ever waits for an acknowledgment here.
+static void netstack_rto_expired(KernelTimer* timer, void* arg) {
+    // The clock thread holds the wheel lock, and socket calls cancel this
+    // timer holding the network lock: never wait for it, come back instead
+    if (!TryEnterCriticalSection(&net_lock)) {
+        timer_arm(timer, 1);
+        return;
     }
     
-    if (new_sock) {
-        new_sock->state = SOCKET_ESTABLISHED;
-        new_sock->local = sock->local;
-        // Simulate remote address
-        new_sock->remote.family = AF_INET;
-        new_sock->remote.port = htons(50000 + rand() % 15000);
-        new_sock->remote.addr.octets[0] = 10;
-        new_sock->remote.addr.octets[1] = 0;
-        new_sock->remote.addr.octets[2] = 2;
-        new_sock->remote.addr.octets[3] = 2 + rand() % 253;
-        
-        if (addr) *addr = new_sock->remote;
-        
-        global_stats.tcp_connections++;
-        printf("[NetStack] Accepted connection fd=%d from %d.%d.%d.%d:%d\n",
-               new_fd,
-               new_sock->remote.addr.octets[0],
-               new_sock->remote.addr.octets[1],
-               new_sock->remote.addr.octets[2],
-               new_sock->remote.addr.octets[3],
-               ntohs(new_sock->remote.port));
+    Socket* sock = (Socket*)arg;
+    if (sock->state != SOCKET_SYN_SENT) {
+        LeaveCriticalSection(&net_lock);
+        return;
     }
     
-    return new_fd;
+    if (sock->retransmits >= TCP_SYN_RETRIES) {
+        printf("[NetStack] Connection fd=%d timed out\n", sock->fd);
+        socket_unhash(sock);
+        sock->state = SOCKET_CLOSED;
+        global_stats.tcp_timeouts++;
+        LeaveCriticalSection(&net_lock);
+        return;
+    }
+    
+    sock->retransmits++;
+    sock->rto_ms = sock->rto_ms * 2 < TCP_RTO_MAX_MS ? sock->rto_ms * 2 : TCP_RTO_MAX_MS;
+    global_stats.tcp_retransmits++;
+    printf("[NetStack] fd=%d SYN retransmit %u, next timeout %u ms\n",
+           sock->fd, sock->retransmits, sock->rto_ms);
+    timer_arm(timer, sock->rto_ms);
+    if (sock->loopback) {
+        tcp_send_segment(sock, TCP_SYN, sock->snd_una, 0, 0);
+        loopback_poll();
+    } else {
+        global_stats.packets_sent++;
+    }
+    LeaveCriticalSection(&net_lock);
 }
 
-// Connect socket
+// Connect socket.  Over loopback the handshake completes before this
+// returns; -1 if it was refused or the SYN is still being retried.
 int netstack_connect(int sockfd, const SocketAddress* addr) {
-    Socket* sock = NULL;
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i] && sockets[i]->fd == sockfd) {
-            sock = sockets[i];
-            break;
-        }
-    }
+    EnterCriticalSection(&net_lock);
+    Socket* sock = find_socket(sockfd);
     
     if (!sock) {
+        LeaveCriticalSection(&net_lock);
         printf("[NetStack] Invalid socket fd=%d\n", sockfd);
         return -1;
     }
     
-    sock->remote = *addr;
-    
-    if (sock->type == SOCK_STREAM) {
-        // TCP: Perform 3-way handshake
-        sock->state = SOCKET_SYN_SENT;
-        printf("[NetStack] Connecting fd=%d to %d.%d.%d.%d:%d (SYN sent)\n",
-               sockfd,
-               addr->addr.octets[0], addr->addr.octets[1],
-               addr->addr.octets[2], addr->addr.octets[3],
-               ntohs(addr->port));
-        
-        // Simulate handshake completion
-        sock->state = SOCKET_ESTABLISHED;
-        global_stats.tcp_connections++;
-        printf("[NetStack] Connection fd=%d established\n", sockfd);
-    } else {
+    if (sock->type != SOCK_STREAM) {
         // UDP: Just set remote address
+        if (sock->local.port == 0 && socket_autobind(sock) < 0) {
+            LeaveCriticalSection(&net_lock);
+            return -1;
+        }
+        sock->remote = *addr;
+        sock->loopback = ipv4_is_local(&addr->addr);
+        LeaveCriticalSection(&net_lock);
         printf("[NetStack] Connected fd=%d to %d.%d.%d.%d:%d (UDP)\n",
                sockfd,
                addr->addr.octets[0], addr->addr.octets[1],
                addr->addr.octets[2], addr->addr.octets[3],
                ntohs(addr->port));
+        return 0;
     }
     
-    return 0;
-}
-
-// Send data
-int netstack_send(int sockfd, const void* data, uint32_t size, int flags) {
-    Socket* sock = NULL;
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i] && sockets[i]->fd == sockfd) {
-            sock = sockets[i];
-            break;
-        }
+    if (sock->state != SOCKET_CLOSED) {
+        LeaveCriticalSection(&net_lock);
+        printf("[NetStack] Socket fd=%d already connected\n", sockfd);
+        return -1;
     }
     
-    if (!sock) {
-        printf("[NetStack] Invalid socket fd=%d\n", sockfd);
+    if (!ipv4_is_local(&addr->addr) && !route_lookup(&addr->addr)) {
+        LeaveCriticalSection(&net_lock);
+        printf("[NetStack] No route to host for fd=%d\n", sockfd);
         return -1;
     }
     
-    if (sock->state != SOCKET_ESTABLISHED) {
-        printf("[NetStack] Socket not connected\n");
+    sock->remote = *addr;
+    sock->loopback = ipv4_is_local(&addr->addr);
+    sock->local.family = AF_INET;
+    sock->local.addr = ipv4_source(sock, &addr->addr);
+    if (sock->local.port == 0 && socket_autobind(sock) < 0) {
+        LeaveCriticalSection(&net_lock);
         return -1;
     }
+    socket_hash_insert(sock, SOCKET_HASH_CONN);
     
-    // Update statistics
-    global_stats.packets_sent++;
-    global_stats.bytes_sent += size;
+    // TCP: Perform 3-way handshake, retransmitting the SYN until
+    // the SYN-ACK arrives
+    sock->state = SOCKET_SYN_SENT;
+    sock->rto_ms = TCP_RTO_INITIAL_MS;
+    sock->retransmits = 0;
+    timer_setup(&sock->rto_timer, netstack_rto_expired, sock);
+    timer_arm(&sock->rto_timer, sock->rto_ms);
+    printf("[NetStack] Connecting fd=%d to %d.%d.%d.%d:%d (SYN sent)\n",
+           sockfd,
+           addr->addr.octets[0], addr->addr.octets[1],
+           addr->addr.octets[2], addr->addr.octets[3],
+           ntohs(addr->port));
     
-    if (sock->type == SOCK_STREAM) {
+    if (sock->loopback) {
+        tcp_send_segment(sock, TCP_SYN, sock->seq_num, 0, 0);
+        sock->seq_num++;
+        loopback_poll();
+    } else {
+        // Nothing answers behind zora0: simulate handshake completion
+        timer_cancel(&sock->rto_timer);
+        global_stats.packets_sent++;
+        sock->snd_una = sock->seq_num;
+        sock->state = SOCKET_ESTABLISHED;
         global_stats.tcp_connections++;
-    } else if (sock->type == SOCK_DGRAM) {
-        global_stats.udp_datagrams++;
     }
     
-    printf("[NetStack] Sent %u bytes on fd=%d\n", size, sockfd);
-    return size;
+    int state = sock->state;
+    LeaveCriticalSection(&net_lock);
+    
+    if (state == SOCKET_ESTABLISHED) {
+        printf("[NetStack] Connection fd=%d established\n", sockfd);
+        return 0;
+    }
+    if (state == SOCKET_CLOSED) {
+        printf("[NetStack] Connection fd=%d refused\n", sockfd);
+    } else {
+        printf("[NetStack] Connection fd=%d not answered yet, retrying SYN\n", sockfd);
+    }
+    return -1;
 }
 
-// Receive data
-int netstack_recv(int sockfd, void* data, uint32_t size, int flags) {
-    Socket* sock = NULL;
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i] && sockets[i]->fd == sockfd) {
-            sock = sockets[i];
-            break;
+// Stream data goes into the send ring and out as far as the peer's window
+// allows.  Returns the bytes taken, or -1 when the ring is full.
+static int socket_send(Socket* sock, const void* data, uint32_t size) {
+    if (sock->type == SOCK_DGRAM) {
+        if (sock->remote.port == 0) {
+            printf("[NetStack] Socket not connected\n");
+            return -1;
         }
+        return udp_output(sock, data, size, &sock->remote);
     }
     
-    if (!sock) {
-        printf("[NetStack] Invalid socket fd=%d\n", sockfd);
+    if (sock->state != SOCKET_ESTABLISHED && sock->state != SOCKET_CLOSE_WAIT) {
+        printf("[NetStack] Socket not connected\n");
         return -1;
     }
     
-    // Simulate receiving data (in real impl, would read from recv_buffer)
-    uint32_t bytes_received = (rand() % size) + 1;
-    if (bytes_received > size) bytes_received = size;
+    if (!sock->loopback) {
+        // Nothing is wired behind zora0: count the segments and take them
+        // as delivered
+        uint32_t mss = (uint32_t)interfaces[1].mtu - sizeof(IPv4Header) - sizeof(TCPHeader);
+        uint32_t segments = (size + mss - 1) / mss;
+        uint64_t bytes = size + (uint64_t)segments * (sizeof(IPv4Header) + sizeof(TCPHeader));
+        interfaces[1].tx_packets += segments;
+        interfaces[1].tx_bytes += bytes;
+        global_stats.packets_sent += segments;
+        global_stats.bytes_sent += bytes;
+        sock->seq_num += size;
+        sock->snd_una = sock->seq_num;
+        return size;
+    }
     
-    // Update statistics
-    global_stats.packets_received++;
-    global_stats.bytes_received += bytes_received;
+    uint32_t room = sock->send_size - (sock->send_tail - sock->send_head);
+    if (room == 0 || socket_ring(&sock->send_buffer) < 0) return -1;
+    if (size > room) size = room;
     
-    printf("[NetStack] Received %u bytes on fd=%d\n", bytes_received, sockfd);
-    return bytes_received;
+    ring_put(sock->send_buffer, sock->send_size, sock->send_tail, data, size);
+    sock->send_tail += size;
+    tcp_output(sock);
+    return size;
 }
 
-// Send datagram
-int netstack_sendto(int sockfd, const void* data, uint32_t size, const SocketAddress* addr, int flags) {
-    Socket* sock = NULL;
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i] && sockets[i]->fd == sockfd) {
-            sock = sockets[i];
-            break;
-        }
-    }
+// Returns 0 at end of stream and -1 while nothing has arrived
+static int socket_recv(Socket* sock, void* data, uint32_t size, SocketAddress* addr) {
+    if (sock->type == SOCK_DGRAM) return udp_recv(sock, data, size, addr);
     
-    if (!sock) {
-        printf("[NetStack] Invalid socket fd=%d\n", sockfd);
-        return -1;
+    uint32_t pending = sock->recv_tail - sock->recv_head;
+    if (pending == 0) {
+        int eof = sock->state == SOCKET_CLOSE_WAIT || sock->state == SOCKET_CLOSING ||
+                  sock->state == SOCKET_LAST_ACK;
+        return eof ? 0 : -1;
     }
     
-    // Update statistics
-    global_stats.packets_sent++;
-    global_stats.bytes_sent += size;
-    global_stats.udp_datagrams++;
-    
-    printf("[NetStack] Sent %u bytes to %d.%d.%d.%d:%d\n",
-           size,
-           addr->addr.octets[0], addr->addr.octets[1],
-           addr->addr.octets[2], addr->addr.octets[3],
-           ntohs(addr->port));
+    if (size > pending) size = pending;
+    ring_get(sock->recv_buffer, sock->recv_size, sock->recv_head, data, size);
+    sock->recv_head += size;
+    if (addr) *addr = sock->remote;
     
+    tcp_window_update(sock);
     return size;
 }
 
+// Send data
+int netstack_send(int sockfd, const void* data, uint32_t size, int flags) {
+    EnterCriticalSection(&net_lock);
+    Socket* sock = find_socket(sockfd);
+    int sent = sock ? socket_send(sock, data, size) : -1;
+    loopback_poll();
+    LeaveCriticalSection(&net_lock);
+    
+    if (!sock) printf("[NetStack] Invalid socket fd=%d\n", sockfd);
+    return sent;
+}
+
+// Receive data
+int netstack_recv(int sockfd, void* data, uint32_t size, int flags) {
+    EnterCriticalSection(&net_lock);
+    Socket* sock = find_socket(sockfd);
+    int received = sock ? socket_recv(sock, data, size, NULL) : -1;
+    loopback_poll();
+    LeaveCriticalSection(&net_lock);
+    
+    if (!sock) printf("[NetStack] Invalid socket fd=%d\n", sockfd);
+    return received;
+}
+
+// Send datagram
+int netstack_sendto(int sockfd, const void* data, uint32_t size, const SocketAddress* addr, int flags) {
+    EnterCriticalSection(&net_lock);
+    Socket* sock = find_socket(sockfd);
+    int sent = -1;
+    if (sock) {
+        sent = (sock->type == SOCK_DGRAM && addr) ? udp_output(sock, data, size, addr)
+                                                  : socket_send(sock, data, size);
+    }
+    loopback_poll();
+    LeaveCriticalSection(&net_lock);
+    
+    if (!sock) printf("[NetStack] Invalid socket fd=%d\n", sockfd);
+    return sent;
+}
+
 // Receive datagram
 int netstack_recvfrom(int sockfd, void* data, uint32_t size, SocketAddress* addr, int flags) {
-    Socket* sock = NULL;
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i] && sockets[i]->fd == sockfd) {
-            sock = sockets[i];
-            break;
-        }
-    }
+    EnterCriticalSection(&net_lock);
+    Socket* sock = find_socket(sockfd);
+    int received = sock ? socket_recv(sock, data, size, addr) : -1;
+    loopback_poll();
+    LeaveCriticalSection(&net_lock);
+    
+    if (!sock) printf("[NetStack] Invalid socket fd=%d\n", sockfd);
+    return received;
+}
+
+// Close socket.  A loopback connection lingers as an orphan, unreachable
+// through its fd, until its queued data and FIN have been acknowledged.
+int netstack_close(int sockfd) {
+    EnterCriticalSection(&net_lock);
+    Socket* sock = find_socket(sockfd);
     
     if (!sock) {
+        LeaveCriticalSection(&net_lock);
         printf("[NetStack] Invalid socket fd=%d\n", sockfd);
         return -1;
     }
     
-    // Simulate receiving datagram
-    uint32_t bytes_received = (rand() % size) + 1;
-    if (bytes_received > size) bytes_received = size;
-    
-    // Simulate source address
-    if (addr) {
-        addr->family = AF_INET;
-        addr->port = htons(50000 + rand() % 15000);
-        addr->addr.octets[0] = 10;
-        addr->addr.octets[1] = 0;
-        addr->addr.octets[2] = 2;
-        addr->addr.octets[3] = 2 + rand() % 253;
+    if (sock->state == SOCKET_ESTABLISHED && sock->type == SOCK_STREAM) {
+        // TCP: Send FIN
+        printf("[NetStack] Closing connection fd=%d (FIN sent)\n", sockfd);
     }
     
-    // Update statistics
-    global_stats.packets_received++;
-    global_stats.bytes_received += bytes_received;
-    global_stats.udp_datagrams++;
-    
-    printf("[NetStack] Received %u bytes from %d.%d.%d.%d:%d\n",
-           bytes_received,
-           addr->addr.octets[0], addr->addr.octets[1],
-           addr->addr.octets[2], addr->addr.octets[3],
-           ntohs(addr->port));
-    
-    return bytes_received;
-}
-
-// Close socket
-int netstack_close(int sockfd) {
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i] && sockets[i]->fd == sockfd) {
-            Socket* sock = sockets[i];
-            
-            if (sock->state == SOCKET_ESTABLISHED && sock->type == SOCK_STREAM) {
-                // TCP: Send FIN
-                printf("[NetStack] Closing connection fd=%d (FIN sent)\n", sockfd);
-                sock->state = SOCKET_FIN_WAIT_1;
-            }
-            
-            // Free buffers
-            if (sock->recv_buffer) free(sock->recv_buffer);
-            if (sock->send_buffer) free(sock->send_buffer);
-            
-            // Free socket
-            free(sock);
-            sockets[i] = NULL;
-            
-            printf("[NetStack] Closed socket fd=%d\n", sockfd);
-            return 0;
+    if (sock->state == SOCKET_LISTEN) {
+        // Connections nobody accepted are reset
+        AcceptQueue* queue = (AcceptQueue*)sock->accept_queue;
+        while (queue->count > 0) {
+            Socket* child = queue->entries[queue->head];
+            queue->head = (queue->head + 1) % MAX_LISTEN_BACKLOG;
+            queue->count--;
+            if (child->state != SOCKET_CLOSED) tcp_send_segment(child, TCP_RST | TCP_ACK, child->seq_num, 0, 0);
+            socket_free(child);
         }
+        socket_free(sock);
+    } else if (sock->type == SOCK_STREAM && sock->loopback &&
+               (sock->state == SOCKET_ESTABLISHED || sock->state == SOCKET_CLOSE_WAIT)) {
+        sock->flags |= SOCKET_ORPHAN | SOCKET_FIN_QUEUED;
+        sock->recv_head = sock->recv_tail;      // Unread data is discarded
+        tcp_output(sock);
+    } else {
+        if (sock->state == SOCKET_ESTABLISHED && sock->type == SOCK_STREAM) global_stats.packets_sent++;
+        socket_free(sock);
     }
     
-    printf("[NetStack] Invalid socket fd=%d\n", sockfd);
-    return -1;
+    loopback_poll();
+    LeaveCriticalSection(&net_lock);
+    printf("[NetStack] Closed socket fd=%d\n", sockfd);
+    return 0;
 }
 
 // Get interface
@@ -504,23 +1549,58 @@ NetworkInterface* netstack_find_interface(const char* name) {
 
 // Calculate checksum (RFC 1071)
 uint16_t netstack_checksum(const void* data, uint32_t size) {
-    const uint16_t* words = (const uint16_t*)data;
-    uint32_t sum = 0;
+    return inet_checksum(data, size);
+}
+
+// Forwarding's TTL decrement, with the header checksum patched rather than
+// summed again.  -1 when the TTL runs out and the packet is to be dropped.
+int netstack_decrement_ttl(IPv4Header* ip) {
+    if (ip->ttl <= 1) return -1;
     
-    while (size > 1) {
-        sum += *words++;
-        size -= 2;
+    uint16_t old_word, new_word;
+    memcpy(&old_word, &ip->ttl, 2);         // TTL and protocol share a word
+    ip->ttl--;
+    memcpy(&new_word, &ip->ttl, 2);
+    ip->checksum = inet_checksum_adjust16(ip->checksum, old_word, new_word);
+    return 0;
+}
+
+// Rewrite a packet's source or destination address and port in place, as
+// NAT does, patching the IPv4 checksum and the TCP or UDP one (which
+// covers the address through the pseudo-header).  `port` is in network
+// byte order; 0 keeps the port.  Later fragments carry no ports.
+int netstack_nat_rewrite(IPv4Header* ip, uint32_t length, int destination, const IPv4Address* addr, uint16_t port) {
+    uint32_t header_bytes = (ip->version_ihl & 0x0F) * 4;
+    if (length < sizeof(IPv4Header) || header_bytes < sizeof(IPv4Header) || header_bytes > length) {
+        return -1;
     }
     
-    if (size > 0) {
-        sum += *(const uint8_t*)words;
-    }
+    uint8_t* field = (uint8_t*)ip + (destination ? 16 : 12);
+    uint32_t old_addr, new_addr;
+    memcpy(&old_addr, field, 4);
+    memcpy(&new_addr, addr, 4);
+    memcpy(field, &new_addr, 4);
+    ip->checksum = inet_checksum_adjust32(ip->checksum, old_addr, new_addr);
     
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
+    uint8_t* segment = (uint8_t*)ip + header_bytes;
+    uint32_t check_at = ip->protocol == IPPROTO_TCP ? 16 : ip->protocol == IPPROTO_UDP ? 6 : 0;
+    if (check_at == 0 || (ntohs(ip->flags_offset) & 0x1FFF) || length - header_bytes < check_at + 2) {
+        return 0;
     }
     
-    return ~sum;
+    uint16_t check, old_port;
+    uint8_t* port_field = segment + (destination ? 2 : 0);
+    memcpy(&check, segment + check_at, 2);
+    memcpy(&old_port, port_field, 2);
+    if (port == 0) port = old_port;
+    memcpy(port_field, &port, 2);
+    if (ip->protocol == IPPROTO_UDP && check == 0) return 0;   // Sent without a checksum
+    
+    check = inet_checksum_adjust32(check, old_addr, new_addr);
+    check = inet_checksum_adjust16(check, old_port, port);
+    if (ip->protocol == IPPROTO_UDP && check == 0) check = 0xFFFF;
+    memcpy(segment + check_at, &check, 2);
+    return 0;
 }
 
 // Parse IPv4 address
@@ -571,6 +1651,15 @@ void netstack_dump_stats(void) {
     printf("TCP connections:  %llu\n", (unsigned long long)global_stats.tcp_connections);
     printf("UDP datagrams:    %llu\n", (unsigned long long)global_stats.udp_datagrams);
     printf("ICMP messages:    %llu\n", (unsigned long long)global_stats.icmp_messages);
+    printf("TCP retransmits:  %llu (%llu timeouts)\n", (unsigned long long)global_stats.tcp_retransmits,
+           (unsigned long long)global_stats.tcp_timeouts);
+    if (routes) {
+        const FibStats* fib = fib_get_stats(routes);
+        printf("Routes:           %llu (%llu lookups, %llu from the cache)\n", (unsigned long long)fib->routes,
+               (unsigned long long)fib->lookups, (unsigned long long)fib->cache_hits);
+    }
+    printf("Sockets:          %d open (%d slots, %u/%u hash buckets)\n", socket_count, socket_capacity,
+           conn_hash.mask + 1, bind_hash.mask + 1);
 }
 
 // Show active connections
@@ -579,9 +1668,9 @@ void netstack_show_connections(void) {
     printf("Proto  Local Address          Remote Address         State\n");
     
     int count = 0;
-    for (int i = 0; i < MAX_SOCKETS; i++) {
-        if (sockets[i] && sockets[i]->state != SOCKET_CLOSED) {
-            Socket* sock = sockets[i];
+    for (int fd = 0; fd < socket_capacity; fd++) {
+        if (socket_table[fd] && socket_table[fd]->state != SOCKET_CLOSED) {
+            Socket* sock = socket_table[fd];
             const char* proto = (sock->type == SOCK_STREAM) ? "TCP" : "UDP";
             const char* state = "";
             
@@ -634,22 +1723,422 @@ int netstack_icmp_ping(const IPv4Address* dest, uint16_t id, uint16_t seq) {
     return rtt_ms;
 }
 
+static void route_show(uint32_t prefix, int length, void* value, void* arg) {
+    RouteEntry* route = (RouteEntry*)value;
+    NetworkInterface* iface = netstack_get_interface(route->interface_id);
+    
+    char dest_str[16], gw_str[16], mask_str[16];
+    netstack_format_ipv4(&route->dest, dest_str, sizeof(dest_str));
+    netstack_format_ipv4(&route->gateway, gw_str, sizeof(gw_str));
+    netstack_format_ipv4(&route->mask, mask_str, sizeof(mask_str));
+    
+    printf("%-15s %-15s %-15s %-10s %d\n",
+           dest_str, gw_str, mask_str,
+           iface ? iface->name : "?", route->metric);
+}
+
 // Show routes
 void netstack_show_routes(void) {
     printf("\n=== Routing Table ===\n");
     printf("Destination     Gateway         Netmask         Interface  Metric\n");
     
-    for (int i = 0; i < route_count; i++) {
-        RouteEntry* route = &routes[i];
-        NetworkInterface* iface = netstack_get_interface(route->interface_id);
-        
-        char dest_str[16], gw_str[16], mask_str[16];
-        netstack_format_ipv4(&route->dest, dest_str, sizeof(dest_str));
-        netstack_format_ipv4(&route->gateway, gw_str, sizeof(gw_str));
-        netstack_format_ipv4(&route->mask, mask_str, sizeof(mask_str));
-        
-        printf("%-15s %-15s %-15s %-10s %d\n",
-               dest_str, gw_str, mask_str,
-               iface ? iface->name : "?", route->metric);
+    EnterCriticalSection(&net_lock);
+    if (routes) fib_walk(routes, route_show, NULL);
+    LeaveCriticalSection(&net_lock);
+}
+
+// ===== Benchmark =====
+
+static int bench_compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Move `length` bytes from one connected socket to another
+static int bench_hop(int from, int to, const uint8_t* data, uint8_t* out, uint32_t length) {
+    uint32_t sent = 0, received = 0;
+    while (received < length) {
+        int progress = 0;
+        if (sent < length) {
+            int n = netstack_send(from, data + sent, length - sent, 0);
+            if (n > 0) {
+                sent += n;
+                progress = 1;
+            }
+        }
+        int n = netstack_recv(to, out + received, length - received, 0);
+        if (n > 0) {
+            received += n;
+            progress = 1;
+        }
+        if (!progress) return -1;
+    }
+    return 0;
+}
+
+// Round trips of `length` bytes; fills samples[] with each one's time
+static int bench_ping_pong(int client, int server, int udp, const SocketAddress* server_addr,
+                           const uint8_t* msg, uint8_t* bounce, uint8_t* reply, uint32_t length,
+                           uint32_t rounds, double* samples) {
+    int ok = 1;
+    for (uint32_t r = 0; r < rounds; r++) {
+        double start = netstack_now_seconds();
+        if (udp) {
+            SocketAddress from;
+            ok &= netstack_sendto(client, msg, length, server_addr, 0) == (int)length;
+            ok &= netstack_recvfrom(server, bounce, length, &from, 0) == (int)length;
+            ok &= netstack_sendto(server, bounce, length, &from, 0) == (int)length;
+            ok &= netstack_recvfrom(client, reply, length, NULL, 0) == (int)length;
+        } else {
+            ok &= bench_hop(client, server, msg, bounce, length) == 0;
+            ok &= bench_hop(server, client, bounce, reply, length) == 0;
+        }
+        samples[r] = netstack_now_seconds() - start;
+        if (!ok || memcmp(msg, reply, length) != 0) return 0;
+    }
+    return 1;
+}
+
+// Echo over lo: the client streams size_kb through a server that sends
+// every byte back, then msg_bytes round trips are timed over TCP and UDP
+void netstack_echo_benchmark(uint32_t size_kb, uint32_t msg_bytes, uint32_t rounds) {
+    if (size_kb == 0) size_kb = 16 * 1024;
+    if (msg_bytes == 0) msg_bytes = 64;
+    if (msg_bytes > SOCKET_BUFFER_SIZE / 2) msg_bytes = SOCKET_BUFFER_SIZE / 2;
+    if (rounds == 0) rounds = 10000;
+    
+    size_t size = (size_t)size_kb << 10;
+    uint8_t* pattern = (uint8_t*)malloc(size > msg_bytes ? size : msg_bytes);
+    uint8_t* echoed = (uint8_t*)malloc(size > msg_bytes ? size : msg_bytes);
+    uint8_t* bounce = (uint8_t*)malloc(SOCKET_BUFFER_SIZE);
+    double* samples = (double*)malloc(rounds * sizeof(double));
+    if (!pattern || !echoed || !bounce || !samples) {
+        printf("bench net: out of memory\n");
+        free(pattern);
+        free(echoed);
+        free(bounce);
+        free(samples);
+        return;
+    }
+    uint32_t seed = 0x9E3779B9;
+    for (size_t i = 0; i < (size > msg_bytes ? size : msg_bytes); i++) {
+        seed = seed * 1664525u + 1013904223u;
+        pattern[i] = (uint8_t)(seed >> 24);
+    }
+    
+    // A listener on an ephemeral port of 127.0.0.1, a client connected to it
+    SocketAddress addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.family = AF_INET;
+    netstack_parse_ipv4("127.0.0.1", &addr.addr);
+    
+    int listener = netstack_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    int client = netstack_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    int server = -1;
+    SocketAddress listen_addr = addr;
+    if (listener >= 0 && client >= 0 && netstack_bind(listener, &addr) == 0 && netstack_listen(listener, 1) == 0) {
+        EnterCriticalSection(&net_lock);
+        listen_addr = find_socket(listener)->local;
+        LeaveCriticalSection(&net_lock);
+        if (netstack_connect(client, &listen_addr) == 0) server = netstack_accept(listener, NULL);
+    }
+    if (server < 0) {
+        printf("bench net: cannot set up a loopback connection\n");
+        if (client >= 0) netstack_close(client);
+        if (listener >= 0) netstack_close(listener);
+        free(pattern);
+        free(echoed);
+        free(bounce);
+        free(samples);
+        return;
+    }
+    
+    NetworkInterface* lo = &interfaces[0];
+    uint64_t lo_packets = lo->tx_packets;
+    double seconds[3] = { 0, 0, 0 };
+    double avg_us[3] = { 0, 0, 0 }, p99_us[3] = { 0, 0, 0 };
+    uint64_t packets[3];
+    int ok[3];
+    
+    // Stream: keep the client sending while the server echoes what it has
+    size_t sent = 0, received = 0;
+    uint32_t pending = 0, pending_off = 0;
+    double start = netstack_now_seconds();
+    while (received < size) {
+        int progress = 0;
+        if (sent < size) {
+            uint32_t chunk = size - sent < SOCKET_BUFFER_SIZE ? (uint32_t)(size - sent) : SOCKET_BUFFER_SIZE;
+            int n = netstack_send(client, pattern + sent, chunk, 0);
+            if (n > 0) {
+                sent += n;
+                progress = 1;
+            }
+        }
+        if (pending == 0) {
+            int n = netstack_recv(server, bounce, SOCKET_BUFFER_SIZE, 0);
+            if (n > 0) {
+                pending = n;
+                pending_off = 0;
+                progress = 1;
+            }
+        }
+        if (pending > 0) {
+            int n = netstack_send(server, bounce + pending_off, pending, 0);
+            if (n > 0) {
+                pending -= n;
+                pending_off += n;
+                progress = 1;
+            }
+        }
+        int n = netstack_recv(client, echoed + received,
+                              size - received < SOCKET_BUFFER_SIZE ? (uint32_t)(size - received) : SOCKET_BUFFER_SIZE, 0);
+        if (n > 0) {
+            received += n;
+            progress = 1;
+        }
+        if (!progress) break;       // Stalled: a window never reopened
+    }
+    seconds[0] = netstack_now_seconds() - start;
+    ok[0] = received == size && memcmp(pattern, echoed, size) == 0;
+    packets[0] = lo->tx_packets - lo_packets;
+    
+    // TCP round trips
+    lo_packets = lo->tx_packets;
+    start = netstack_now_seconds();
+    ok[1] = bench_ping_pong(client, server, 0, NULL, pattern, bounce, echoed, msg_bytes, rounds, samples);
+    seconds[1] = netstack_now_seconds() - start;
+    packets[1] = lo->tx_packets - lo_packets;
+    if (ok[1]) {
+        qsort(samples, rounds, sizeof(double), bench_compare_double);
+        avg_us[1] = seconds[1] / rounds * 1e6;
+        p99_us[1] = samples[(size_t)rounds * 99 / 100] * 1e6;
+    }
+    netstack_close(client);
+    netstack_close(server);
+    netstack_close(listener);
+    
+    // UDP round trips between two sockets on 127.0.0.1
+    int udp_client = netstack_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    int udp_server = netstack_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    ok[2] = 0;
+    packets[2] = 0;
+    if (udp_client >= 0 && udp_server >= 0 && netstack_bind(udp_server, &addr) == 0) {
+        EnterCriticalSection(&net_lock);
+        listen_addr = find_socket(udp_server)->local;
+        LeaveCriticalSection(&net_lock);
+        lo_packets = lo->tx_packets;
+        start = netstack_now_seconds();
+        ok[2] = bench_ping_pong(udp_client, udp_server, 1, &listen_addr, pattern, bounce, echoed,
+                                msg_bytes, rounds, samples);
+        seconds[2] = netstack_now_seconds() - start;
+        packets[2] = lo->tx_packets - lo_packets;
+        if (ok[2]) {
+            qsort(samples, rounds, sizeof(double), bench_compare_double);
+            avg_us[2] = seconds[2] / rounds * 1e6;
+            p99_us[2] = samples[(size_t)rounds * 99 / 100] * 1e6;
+        }
+    }
+    if (udp_client >= 0) netstack_close(udp_client);
+    if (udp_server >= 0) netstack_close(udp_server);
+    
+    static const char* const modes[] = { "TCP stream", "TCP ping-pong", "UDP ping-pong" };
+    double mb[3];
+    mb[0] = (double)size / (1024.0 * 1024.0);
+    mb[1] = mb[2] = 2.0 * msg_bytes * rounds / (1024.0 * 1024.0);
+    printf("bench net: echo %u KB through lo, then %u round trips of %u bytes\n", size_kb, rounds, msg_bytes);
+    printf("  %-16s %10s %10s %10s %10s %10s %8s\n", "", "Time", "MB/s", "Avg us", "p99 us", "Packets", "Check");
+    for (int mode = 0; mode < 3; mode++) {
+        if (mode == 0) {
+            printf("  %-16s %7.2f ms %10.1f %10s %10s %10llu %8s\n", modes[mode], seconds[mode] * 1e3,
+                   seconds[mode] > 0 ? mb[mode] / seconds[mode] : 0.0, "-", "-",
+                   (unsigned long long)packets[mode], ok[mode] ? "ok" : "FAILED");
+        } else {
+            printf("  %-16s %7.2f ms %10.1f %10.2f %10.2f %10llu %8s\n", modes[mode], seconds[mode] * 1e3,
+                   seconds[mode] > 0 ? mb[mode] / seconds[mode] : 0.0, avg_us[mode], p99_us[mode],
+                   (unsigned long long)packets[mode], ok[mode] ? "ok" : "FAILED");
+        }
+    }
+    
+    free(pattern);
+    free(echoed);
+    free(bounce);
+    free(samples);
+}
+
+// What every segment paid before the demux tables: a walk over all sockets
+static Socket* bench_linear_demux(const IPv4Address* dest, uint16_t dest_port,
+                                  const IPv4Address* src, uint16_t src_port) {
+    Socket* listener = NULL;
+    for (int fd = 0; fd < socket_capacity; fd++) {
+        Socket* sock = socket_table[fd];
+        if (!sock || sock->type != SOCK_STREAM || sock->local.port != dest_port) continue;
+        if (sock->state == SOCKET_LISTEN) {
+            if (!listener) listener = sock;
+        } else if (sock->remote.port == src_port && ipv4_equal(&sock->remote.addr, src) &&
+                   ipv4_equal(&sock->local.addr, dest)) {
+            return sock;
+        }
+    }
+    return listener;
+}
+
+static double bench_round_trip_ns(int client, int server, uint32_t rounds, double* samples) {
+    uint8_t msg = 0x5A, bounce, reply;
+    double start = netstack_now_seconds();
+    if (!bench_ping_pong(client, server, 0, NULL, &msg, &bounce, &reply, 1, rounds, samples)) return -1;
+    return (netstack_now_seconds() - start) / rounds * 1e9;
+}
+
+// Demux with `count` established connections on one listening port:
+// 4-tuple hits, unknown sources falling through to the listener, the
+// linear scan the tables replaced, and a 1-byte round trip over lo with
+// the table empty and then full
+void netstack_demux_benchmark(uint32_t count, uint32_t lookups) {
+    if (count == 0) count = 100000;
+    if (count > SOCKET_LIMIT - 16) count = SOCKET_LIMIT - 16;
+    if (lookups == 0) lookups = 1000000;
+    uint32_t rounds = lookups < 100000 ? lookups : 100000;
+    
+    typedef struct {
+        IPv4Address src;
+        uint16_t src_port;
+        Socket* expect;
+    } Query;
+    Socket** conns = (Socket**)malloc(count * sizeof(Socket*));
+    Query* queries = (Query*)malloc(lookups * sizeof(Query));
+    double* samples = (double*)malloc(rounds * sizeof(double));
+    if (!conns || !queries || !samples) {
+        printf("bench net: out of memory\n");
+        free(conns);
+        free(queries);
+        free(samples);
+        return;
+    }
+    
+    // A wildcard listener and one real connection through it
+    SocketAddress addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.family = AF_INET;
+    netstack_parse_ipv4("127.0.0.1", &addr.addr);
+    int listener = netstack_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    int client = netstack_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    int server = -1;
+    if (listener >= 0 && client >= 0 && netstack_listen(listener, 1) == 0) {
+        EnterCriticalSection(&net_lock);
+        addr.port = find_socket(listener)->local.port;
+        LeaveCriticalSection(&net_lock);
+        if (netstack_connect(client, &addr) == 0) server = netstack_accept(listener, NULL);
+    }
+    if (server < 0) {
+        printf("bench net: cannot set up a loopback connection\n");
+        if (client >= 0) netstack_close(client);
+        if (listener >= 0) netstack_close(listener);
+        free(conns);
+        free(queries);
+        free(samples);
+        return;
+    }
+    double rtt_empty = bench_round_trip_ns(client, server, rounds, samples);
+    
+    // The rest of the connections are only entered into the tables: each
+    // from its own 127.x.y.z, so every 4-tuple is distinct
+    EnterCriticalSection(&net_lock);
+    Socket* listen_sock = find_socket(listener);
+    uint32_t made = 0;
+    for (; made < count; made++) {
+        Socket* sock = socket_alloc(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (!sock) break;
+        sock->state = SOCKET_ESTABLISHED;
+        sock->local.addr = addr.addr;
+        port_hold(sock, addr.port);
+        sock->remote.family = AF_INET;
+        sock->remote.addr.octets[0] = 127;
+        sock->remote.addr.octets[1] = (uint8_t)(1 + (made >> 16));
+        sock->remote.addr.octets[2] = (uint8_t)(made >> 8);
+        sock->remote.addr.octets[3] = (uint8_t)made;
+        sock->remote.port = htons(40000);
+        socket_hash_insert(sock, SOCKET_HASH_CONN);
+        conns[made] = sock;
     }
+    if (made < count) printf("bench net: only %u of %u connections could be created\n", made, count);
+    
+    uint32_t seed = 0x2545F491;
+    for (uint32_t i = 0; i < lookups; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        Socket* sock = made > 0 ? conns[seed % made] : listen_sock;
+        queries[i].src = sock->remote.addr;
+        queries[i].src_port = sock->remote.port;
+        queries[i].expect = sock;
+    }
+    
+    uint32_t longest = 0;
+    for (uint32_t i = 0; i <= conn_hash.mask; i++) {
+        uint32_t chain = 0;
+        for (Socket* sock = conn_hash.buckets[i]; sock; sock = sock->hash_next) chain++;
+        if (chain > longest) longest = chain;
+    }
+    
+    static const char* const modes[] = { "hash 4-tuple", "hash to listener", "linear scan",
+                                         "lo round trip, empty", "lo round trip, full" };
+    uint32_t done[5] = { lookups, lookups, 0, rounds, rounds };
+    double ns[5];
+    int ok[5];
+    
+    uint32_t hits = 0;
+    double start = netstack_now_seconds();
+    for (uint32_t i = 0; i < lookups; i++) {
+        hits += tcp_demux(&addr.addr, addr.port, &queries[i].src, queries[i].src_port) == queries[i].expect;
+    }
+    ns[0] = (netstack_now_seconds() - start) / lookups * 1e9;
+    ok[0] = hits == lookups;
+    
+    // The same sources on another address of this host only match the listener
+    IPv4Address other = interfaces[1].ip;
+    hits = 0;
+    start = netstack_now_seconds();
+    for (uint32_t i = 0; i < lookups; i++) {
+        hits += tcp_demux(&other, addr.port, &queries[i].src, queries[i].src_port) == listen_sock;
+    }
+    ns[1] = (netstack_now_seconds() - start) / lookups * 1e9;
+    ok[1] = hits == lookups;
+    
+    // The scan is O(sockets); keep it to about 10^8 socket visits
+    done[2] = (uint32_t)(100000000.0 / (socket_capacity > 0 ? socket_capacity : 1));
+    if (done[2] > lookups) done[2] = lookups;
+    if (done[2] < 10) done[2] = lookups < 10 ? lookups : 10;
+    hits = 0;
+    start = netstack_now_seconds();
+    for (uint32_t i = 0; i < done[2]; i++) {
+        hits += bench_linear_demux(&addr.addr, addr.port, &queries[i].src, queries[i].src_port) == queries[i].expect;
+    }
+    ns[2] = (netstack_now_seconds() - start) / (done[2] ? done[2] : 1) * 1e9;
+    ok[2] = hits == done[2];
+    int open = socket_count, slots = socket_capacity;
+    uint32_t conn_buckets = conn_hash.mask + 1;
+    LeaveCriticalSection(&net_lock);
+    
+    ns[3] = rtt_empty;
+    ok[3] = rtt_empty >= 0;
+    ns[4] = bench_round_trip_ns(client, server, rounds, samples);
+    ok[4] = ns[4] >= 0;
+    
+    EnterCriticalSection(&net_lock);
+    for (uint32_t i = 0; i < made; i++) socket_free(conns[i]);
+    LeaveCriticalSection(&net_lock);
+    netstack_close(client);
+    netstack_close(server);
+    netstack_close(listener);
+    
+    printf("bench net: demux with %u connections on port %d, %d sockets in %d fd slots\n",
+           made, ntohs(addr.port), open, slots);
+    printf("  %u connection buckets, longest chain %u\n", conn_buckets, longest);
+    printf("  %-22s %10s %10s %8s\n", "", "Ops", "ns/op", "Check");
+    for (int mode = 0; mode < 5; mode++) {
+        printf("  %-22s %10u %10.1f %8s\n", modes[mode], done[mode], ok[mode] ? ns[mode] : 0.0,
+               ok[mode] ? "ok" : "FAILED");
+    }
+    
+    free(conns);
+    free(queries);
+    free(samples);
 }
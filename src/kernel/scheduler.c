@@ -1,27 +1,34 @@
 #include "kernel/scheduler.h"
+#include "kernel/bench_baselines.h"
 #include "kernel/privilege.h"
+#include "kernel/mmu.h"
+#include "kernel/timer.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <windows.h>
 
 // Global scheduler state
 static Scheduler g_scheduler;
 static int g_scheduler_initialized = 0;
 
-// Helper: Allocate queue node
-static ProcessQueueNode* alloc_queue_node(Process* process) {
-    ProcessQueueNode* node = (ProcessQueueNode*)malloc(sizeof(ProcessQueueNode));
-    if (!node) return NULL;
-    
-    node->process = process;
-    node->next = NULL;
-    node->prev = NULL;
-    return node;
+// CPU the calling host thread is running, 0 outside vCPU threads
+static _Thread_local uint32_t g_sched_this_cpu = 0;
+
+// Run queues are intrusive lists linked through the Process itself, so
+// enqueue, dequeue and removal are O(1) with no allocation.  Each level
+// has a bit in RunQueue.ready_mask, and picking the next process is a ctz
+// of that mask.  Level 0 runs first.
+
+static inline uint32_t sched_ctz(uint32_t value) {
+    return (uint32_t)__builtin_ctz(value);
 }
 
-// Helper: Free queue node
-static void free_queue_node(ProcessQueueNode* node) {
-    free(node);
+static double sched_now_seconds(void) {
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
 }
 
 // Initialize process queue
@@ -33,65 +40,209 @@ static void queue_init(ProcessQueue* queue) {
 
 // Enqueue process at tail
 static void queue_enqueue(ProcessQueue* queue, Process* process) {
-    ProcessQueueNode* node = alloc_queue_node(process);
-    if (!node) return;
-    
+    process->run_next = NULL;
+    process->run_prev = queue->tail;
     if (queue->tail) {
-        queue->tail->next = node;
-        node->prev = queue->tail;
-        queue->tail = node;
+        queue->tail->run_next = process;
     } else {
-        queue->head = queue->tail = node;
+        queue->head = process;
     }
-    
+    queue->tail = process;
     queue->count++;
 }
 
 // Dequeue process from head
 static Process* queue_dequeue(ProcessQueue* queue) {
-    if (!queue->head) return NULL;
-    
-    ProcessQueueNode* node = queue->head;
-    Process* process = node->process;
+    Process* process = queue->head;
+    if (!process) return NULL;
     
-    queue->head = node->next;
+    queue->head = process->run_next;
     if (queue->head) {
-        queue->head->prev = NULL;
+        queue->head->run_prev = NULL;
     } else {
         queue->tail = NULL;
     }
-    
+    process->run_next = process->run_prev = NULL;
     queue->count--;
-    free_queue_node(node);
-    
     return process;
 }
 
-// Remove specific process from queue
+// Unlink a process known to be on the queue
 static void queue_remove(ProcessQueue* queue, Process* process) {
-    ProcessQueueNode* node = queue->head;
-    
-    while (node) {
-        if (node->process == process) {
-            // Unlink node
-            if (node->prev) {
-                node->prev->next = node->next;
-            } else {
-                queue->head = node->next;
-            }
-            
-            if (node->next) {
-                node->next->prev = node->prev;
-            } else {
-                queue->tail = node->prev;
-            }
-            
-            queue->count--;
-            free_queue_node(node);
-            return;
+    if (process->run_prev) {
+        process->run_prev->run_next = process->run_next;
+    } else {
+        queue->head = process->run_next;
+    }
+    if (process->run_next) {
+        process->run_next->run_prev = process->run_prev;
+    } else {
+        queue->tail = process->run_prev;
+    }
+    process->run_next = process->run_prev = NULL;
+    queue->count--;
+}
+
+static void runq_push(RunQueue* rq, Process* process, uint32_t level) {
+    process->run_level = (uint8_t)level;
+    process->run_state = SCHED_RUN_READY;
+    queue_enqueue(&rq->levels[level], process);
+    rq->ready_mask |= 1u << level;
+    rq->count++;
+}
+
+static void runq_remove(RunQueue* rq, Process* process) {
+    ProcessQueue* queue = &rq->levels[process->run_level];
+    queue_remove(queue, process);
+    if (queue->count == 0) rq->ready_mask &= ~(1u << process->run_level);
+    process->run_state = SCHED_RUN_NONE;
+    rq->count--;
+}
+
+static Process* runq_pop(RunQueue* rq) {
+    if (!rq->ready_mask) return NULL;
+    
+    uint32_t level = sched_ctz(rq->ready_mask);
+    ProcessQueue* queue = &rq->levels[level];
+    Process* process = queue_dequeue(queue);
+    if (queue->count == 0) rq->ready_mask &= ~(1u << level);
+    process->run_state = SCHED_RUN_NONE;
+    rq->count--;
+    return process;
+}
+
+// Run queue level for a process under the current policy
+static uint32_t scheduler_level_of(Process* process) {
+    uint32_t level;
+    switch (g_scheduler.algorithm) {
+        case SCHED_ROUND_ROBIN:
+            return 0;
+        case SCHED_MULTILEVEL:
+            level = (uint32_t)process->priority + process->demotions;
+            break;
+        default:
+            level = (uint32_t)process->priority;
+            break;
+    }
+    return level < SCHEDULER_MAX_QUEUES ? level : SCHEDULER_MAX_QUEUES - 1;
+}
+
+// Time slice at a level: lower MLFQ levels run longer, less often
+static uint32_t scheduler_quantum_of(Process* process) {
+    if (g_scheduler.algorithm != SCHED_MULTILEVEL) return g_scheduler.quantum_ms;
+    return g_scheduler.quantum_ms * (1u + process->demotions);
+}
+
+// SMP.  Each CPU owns a run queue and its lock; a CPU whose queue runs dry
+// steals the most urgent process of the longest queue, and every
+// SCHEDULER_BALANCE_INTERVAL ticks queues that differ by more than one
+// process are evened out.  Balancing holds two queue locks, taken in CPU
+// order; everything else holds one at a time.
+
+static void sched_cpu_push(SchedulerCPU* cpu, Process* process, uint32_t level) {
+    EnterCriticalSection(&cpu->lock);
+    process->run_cpu = (uint8_t)cpu->id;
+    runq_push(&cpu->run_queue, process, level);
+    LeaveCriticalSection(&cpu->lock);
+}
+
+static Process* sched_cpu_pop(SchedulerCPU* cpu) {
+    if (cpu->run_queue.count == 0) return NULL;   // Racy peek; the pop decides
+    
+    EnterCriticalSection(&cpu->lock);
+    Process* process = runq_pop(&cpu->run_queue);
+    LeaveCriticalSection(&cpu->lock);
+    return process;
+}
+
+static SchedulerCPU* sched_busiest(SchedulerCPU* cpus, uint32_t count, uint32_t skip) {
+    SchedulerCPU* busiest = NULL;
+    int most = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        int queued = cpus[i].run_queue.count;
+        if (i != skip && queued > most) {
+            most = queued;
+            busiest = &cpus[i];
         }
-        node = node->next;
     }
+    return busiest;
+}
+
+// Next process for cpus[self]: its own queue first, then a steal
+static Process* sched_pick(SchedulerCPU* cpus, uint32_t count, uint32_t self) {
+    Process* process = sched_cpu_pop(&cpus[self]);
+    if (process || count == 1) return process;
+    
+    SchedulerCPU* victim = sched_busiest(cpus, count, self);
+    if (victim && (process = sched_cpu_pop(victim)) != NULL) {
+        process->run_cpu = (uint8_t)self;
+        cpus[self].steals++;
+    }
+    return process;
+}
+
+// Move processes from the longest queue to the shortest until no two
+// differ by more than one.  Returns how many moved.
+static uint32_t sched_balance(SchedulerCPU* cpus, uint32_t count) {
+    uint32_t moved = 0;
+    while (count > 1 && moved < 64) {
+        SchedulerCPU* busiest = &cpus[0];
+        SchedulerCPU* idlest = &cpus[0];
+        for (uint32_t i = 1; i < count; i++) {
+            if (cpus[i].run_queue.count > busiest->run_queue.count) busiest = &cpus[i];
+            if (cpus[i].run_queue.count < idlest->run_queue.count) idlest = &cpus[i];
+        }
+        if (busiest->run_queue.count - idlest->run_queue.count <= 1) break;
+        
+        // Both locks across the move, so the process is never off every
+        // queue where scheduler_remove_from_queue() can't find it
+        SchedulerCPU* first = busiest->id < idlest->id ? busiest : idlest;
+        SchedulerCPU* second = first == busiest ? idlest : busiest;
+        EnterCriticalSection(&first->lock);
+        EnterCriticalSection(&second->lock);
+        Process* process = runq_pop(&busiest->run_queue);
+        if (process) {
+            process->run_cpu = (uint8_t)idlest->id;
+            runq_push(&idlest->run_queue, process, process->run_level);
+        }
+        LeaveCriticalSection(&second->lock);
+        LeaveCriticalSection(&first->lock);
+        if (!process) break;
+        idlest->migrations++;
+        moved++;
+    }
+    return moved;
+}
+
+// CPU for a process becoming ready: the one it last ran on, unless that
+// queue is longer than the shortest by more than one
+static SchedulerCPU* sched_place(Process* process) {
+    SchedulerCPU* cpus = g_scheduler.cpus;
+    SchedulerCPU* idlest = &cpus[0];
+    for (uint32_t i = 1; i < g_scheduler.cpu_count; i++) {
+        if (cpus[i].run_queue.count < idlest->run_queue.count) idlest = &cpus[i];
+    }
+    
+    if (process->run_cpu < g_scheduler.cpu_count &&
+        cpus[process->run_cpu].run_queue.count <= idlest->run_queue.count + 1) {
+        return &cpus[process->run_cpu];
+    }
+    return idlest;
+}
+
+// CPU a process is running on, or NULL
+static SchedulerCPU* sched_running_on(Process* process) {
+    if (process->run_cpu < g_scheduler.cpu_count &&
+        g_scheduler.cpus[process->run_cpu].current_process == process) {
+        return &g_scheduler.cpus[process->run_cpu];
+    }
+    return NULL;
+}
+
+static int scheduler_host_cpus(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
 }
 
 // Initialize scheduler
@@ -105,28 +256,33 @@ int scheduler_init(void) {
     // Set default configuration
     g_scheduler.algorithm = SCHED_ROUND_ROBIN;
     g_scheduler.quantum_ms = SCHEDULER_QUANTUM_MS;
-    g_scheduler.current_process = NULL;
     g_scheduler.idle_process = NULL;
     g_scheduler.preemption_enabled = 1;
     g_scheduler.scheduling_enabled = 0;  // Not started yet
     
-    // Initialize queues
-    queue_init(&g_scheduler.ready_queue);
-    queue_init(&g_scheduler.blocked_queue);
+    // One CPU per host thread running guest code, and the interpreter is a
+    // single instance.  The per-CPU queues, stealing and balancing only see
+    // more than one CPU under bench smp.
+    g_scheduler.cpu_count = 1;
     
-    // Initialize priority queues for multi-level scheduling
-    for (int i = 0; i < SCHEDULER_MAX_QUEUES; i++) {
-        g_scheduler.priority_queues[i] = (ProcessQueue*)malloc(sizeof(ProcessQueue));
-        if (g_scheduler.priority_queues[i]) {
-            queue_init(g_scheduler.priority_queues[i]);
+    // Initialize queues
+    for (uint32_t c = 0; c < g_scheduler.cpu_count; c++) {
+        SchedulerCPU* cpu = &g_scheduler.cpus[c];
+        cpu->id = c;
+        InitializeCriticalSection(&cpu->lock);
+        InitializeCriticalSection(&cpu->switch_lock);
+        for (int i = 0; i < SCHEDULER_MAX_QUEUES; i++) {
+            queue_init(&cpu->run_queue.levels[i]);
         }
     }
+    queue_init(&g_scheduler.blocked_queue);
+    InitializeCriticalSection(&g_scheduler.blocked_lock);
     
     g_scheduler_initialized = 1;
     
-    printf("[SCHEDULER] Initialized (%s, quantum=%dms)\n",
+    printf("[SCHEDULER] Initialized (%s, quantum=%dms, %u CPU%s)\n",
            g_scheduler.algorithm == SCHED_ROUND_ROBIN ? "Round-Robin" : "Priority",
-           g_scheduler.quantum_ms);
+           g_scheduler.quantum_ms, g_scheduler.cpu_count, g_scheduler.cpu_count == 1 ? "" : "s");
     
     return 0;
 }
@@ -135,13 +291,22 @@ int scheduler_init(void) {
 void scheduler_cleanup(void) {
     if (!g_scheduler_initialized) return;
     
-    // Free priority queues
-    for (int i = 0; i < SCHEDULER_MAX_QUEUES; i++) {
-        if (g_scheduler.priority_queues[i]) {
-            free(g_scheduler.priority_queues[i]);
-            g_scheduler.priority_queues[i] = NULL;
+    // Processes belong to the process table; just forget them
+    for (uint32_t c = 0; c < g_scheduler.cpu_count; c++) {
+        SchedulerCPU* cpu = &g_scheduler.cpus[c];
+        while (runq_pop(&cpu->run_queue)) {
         }
+        cpu->current_process = NULL;
+        DeleteCriticalSection(&cpu->lock);
+        DeleteCriticalSection(&cpu->switch_lock);
     }
+    Process* process;
+    while ((process = queue_dequeue(&g_scheduler.blocked_queue)) != NULL) {
+        timer_cancel(&process->sleep_timer);
+        process->run_state = SCHED_RUN_NONE;
+    }
+    DeleteCriticalSection(&g_scheduler.blocked_lock);
+    g_scheduler.sleeping = 0;
     
     g_scheduler_initialized = 0;
     printf("[SCHEDULER] Cleaned up\n");
@@ -150,7 +315,9 @@ void scheduler_cleanup(void) {
 // Start scheduler
 void scheduler_start(void) {
     g_scheduler.scheduling_enabled = 1;
-    g_scheduler.last_schedule_time = 0; // Would get real time here
+    g_scheduler.last_schedule_time = g_scheduler.ticks;
+    g_scheduler.last_boost_tick = g_scheduler.ticks;
+    g_scheduler.last_balance_tick = g_scheduler.ticks;
     printf("[SCHEDULER] Started\n");
 }
 
@@ -162,93 +329,157 @@ void scheduler_stop(void) {
 
 // Enqueue process to ready queue
 void scheduler_enqueue_ready(Process* process) {
-    if (!process) return;
+    if (!process || !g_scheduler_initialized) return;
     
+    scheduler_remove_from_queue(process);
     process->state = PROC_STATE_RUNNING;  // Use correct enum name
-    queue_enqueue(&g_scheduler.ready_queue, process);
+    sched_cpu_push(sched_place(process), process, scheduler_level_of(process));
+    timer_kick();   // An idle clock goes back to ticking
 }
 
 // Enqueue process to blocked queue
 void scheduler_enqueue_blocked(Process* process) {
-    if (!process) return;
+    if (!process || !g_scheduler_initialized) return;
     
+    scheduler_remove_from_queue(process);
     process->state = PROC_STATE_SLEEPING;  // Use correct enum name
+    EnterCriticalSection(&g_scheduler.blocked_lock);
+    process->run_state = SCHED_RUN_BLOCKED;
     queue_enqueue(&g_scheduler.blocked_queue, process);
+    LeaveCriticalSection(&g_scheduler.blocked_lock);
 }
 
-// Remove process from any queue
+// Remove process from any queue, and cancel its sleep timer.  The timer
+// goes first: its callback takes scheduler locks under the wheel lock, so
+// no scheduler lock may be held while calling into the wheel.
 void scheduler_remove_from_queue(Process* process) {
     if (!process) return;
     
-    queue_remove(&g_scheduler.ready_queue, process);
-    queue_remove(&g_scheduler.blocked_queue, process);
+    if (timer_cancel(&process->sleep_timer)) {
+        InterlockedDecrement(&g_scheduler.sleeping);
+    }
+    
+    // The process can be stolen between reading run_cpu and locking, so
+    // check again under the lock
+    while (process->run_state == SCHED_RUN_READY) {
+        SchedulerCPU* cpu = &g_scheduler.cpus[process->run_cpu];
+        EnterCriticalSection(&cpu->lock);
+        int queued = process->run_state == SCHED_RUN_READY && process->run_cpu == cpu->id;
+        if (queued) runq_remove(&cpu->run_queue, process);
+        LeaveCriticalSection(&cpu->lock);
+        if (queued) break;
+    }
+    if (process->run_state == SCHED_RUN_BLOCKED) {
+        EnterCriticalSection(&g_scheduler.blocked_lock);
+        if (process->run_state == SCHED_RUN_BLOCKED) {
+            queue_remove(&g_scheduler.blocked_queue, process);
+            process->run_state = SCHED_RUN_NONE;
+        }
+        LeaveCriticalSection(&g_scheduler.blocked_lock);
+    }
+}
+
+// Forget a process that is going away: off its queue, and off any CPU it
+// is running on, which picks something else.  Afterwards neither the tick
+// nor a switch can reach it, so it may be freed.
+void scheduler_remove_process(Process* process) {
+    if (!process || !g_scheduler_initialized) return;
+    
+    scheduler_remove_from_queue(process);
+    for (uint32_t c = 0; c < g_scheduler.cpu_count; c++) {
+        SchedulerCPU* cpu = &g_scheduler.cpus[c];
+        EnterCriticalSection(&cpu->switch_lock);
+        int running = cpu->current_process == process;
+        if (running) cpu->current_process = NULL;
+        LeaveCriticalSection(&cpu->switch_lock);
+        if (running) scheduler_schedule_cpu(c);
+    }
 }
 
 // Dequeue next ready process
 Process* scheduler_dequeue_ready(void) {
-    return queue_dequeue(&g_scheduler.ready_queue);
+    return scheduler_pick_next_process();
 }
 
-// Pick next process to run
+// Pick next process to run on this thread's CPU: the head of the highest
+// nonempty level, or a process stolen from another CPU if there is none.
+// Round-robin keeps everything on level 0, so this is plain FIFO there.
 Process* scheduler_pick_next_process(void) {
-    switch (g_scheduler.algorithm) {
-        case SCHED_ROUND_ROBIN:
-            // Simple round-robin: pick first from ready queue
-            return scheduler_dequeue_ready();
-            
-        case SCHED_PRIORITY:
-            // Priority-based: search priority queues from highest to lowest
-            for (int i = SCHEDULER_MAX_QUEUES - 1; i >= 0; i--) {
-                if (g_scheduler.priority_queues[i]->count > 0) {
-                    return queue_dequeue(g_scheduler.priority_queues[i]);
-                }
-            }
-            return NULL;
-            
-        default:
-            return scheduler_dequeue_ready();
+    if (!g_scheduler_initialized) return NULL;
+    
+    uint32_t self = scheduler_current_cpu();
+    Process* process = sched_pick(g_scheduler.cpus, g_scheduler.cpu_count, self);
+    if (process && process->run_cpu != self) {
+        process->run_cpu = (uint8_t)self;
     }
+    return process;
 }
 
 // Main scheduling function
 void scheduler_schedule(void) {
-    if (!g_scheduler_initialized || !g_scheduler.scheduling_enabled) {
+    scheduler_schedule_cpu(scheduler_current_cpu());
+}
+
+// Pick the next process for one CPU and switch to it
+void scheduler_schedule_cpu(uint32_t cpu_id) {
+    if (!g_scheduler_initialized || !g_scheduler.scheduling_enabled ||
+        cpu_id >= g_scheduler.cpu_count) {
         return;
     }
     
     // Switch to kernel mode for scheduling
     privilege_enter_kernel_mode();
     
-    Process* old_process = g_scheduler.current_process;
-    Process* new_process = scheduler_pick_next_process();
+    // A thread standing in for another CPU may be switching it while that
+    // CPU's own thread yields; switch_lock makes them take turns.  Queue
+    // locks nest inside it.  Whatever the tick asked for happens now.
+    SchedulerCPU* cpu = &g_scheduler.cpus[cpu_id];
+    EnterCriticalSection(&cpu->switch_lock);
+    InterlockedAnd(&g_scheduler.resched_mask, ~(LONG)(1u << cpu_id));
+    
+    // The running process competes again unless it blocked or exited.
+    // It goes behind its level's peers on this CPU, so equal levels
+    // round-robin.
+    Process* old_process = cpu->current_process;
+    if (old_process && old_process->state == PROC_STATE_RUNNING &&
+        old_process->run_state == SCHED_RUN_NONE) {
+        sched_cpu_push(cpu, old_process, scheduler_level_of(old_process));
+    }
+    
+    Process* new_process = sched_pick(g_scheduler.cpus, g_scheduler.cpu_count, cpu_id);
     
     // If no process to run, use idle process
     if (!new_process) {
         new_process = g_scheduler.idle_process;
     }
     
-    // If same process, nothing to do
+    // If same process, it just gets a fresh slice
     if (new_process == old_process) {
+        if (new_process) {
+            cpu->current_quantum_remaining = scheduler_quantum_of(new_process);
+        }
+        LeaveCriticalSection(&cpu->switch_lock);
         return;
     }
     
-    // Perform context switch
-    if (old_process && old_process->state == PROC_STATE_RUNNING) {
-        old_process->state = PROC_STATE_RUNNING;  // Keep as running, will be enqueued
-        scheduler_enqueue_ready(old_process);
-    }
-    
+    cpu->current_process = new_process;
     if (new_process) {
         new_process->state = PROC_STATE_RUNNING;
-        g_scheduler.current_process = new_process;
-        
-        // Perform actual context switch
-        scheduler_context_switch(old_process, new_process);
+        new_process->run_cpu = (uint8_t)cpu_id;
+        // Registers, address space and privilege level are those of the
+        // CPU this thread runs; another thread's CPU switches on its own
+        if (cpu_id == scheduler_current_cpu()) {
+            mmu_current_cpu = cpu_id % FRAME_CPU_COUNT;   // This CPU's frame cache, TLB and address space
+            scheduler_context_switch(old_process, new_process);
+        }
         
         // Update statistics
+        cpu->context_switches++;
         g_scheduler.total_context_switches++;
-        g_scheduler.current_quantum_remaining = g_scheduler.quantum_ms;
+        g_scheduler.last_schedule_time = g_scheduler.ticks;
+        cpu->current_quantum_remaining = scheduler_quantum_of(new_process);
     }
+    LeaveCriticalSection(&cpu->switch_lock);
 }
 
 // Voluntary yield
@@ -269,20 +500,98 @@ void scheduler_preempt(void) {
     scheduler_schedule();
 }
 
-// Called on timer interrupt
+// Quantum accounting for one CPU; returns nonzero if it should switch
+static int scheduler_tick_cpu(SchedulerCPU* cpu) {
+    Process* current = cpu->current_process;
+    int preempt = 0;
+    
+    if (!current || current == g_scheduler.idle_process) {
+        cpu->idle_ticks++;
+        return cpu->run_queue.count > 0;
+    }
+    cpu->busy_ticks++;
+    
+    // A process that uses up its allotment at a level drops a level, and
+    // time spent before a yield counts, so yielding just short of the end
+    // of each slice does not keep a CPU hog at the top
+    current->slice_used++;
+    if (g_scheduler.algorithm == SCHED_MULTILEVEL &&
+        current->slice_used >= scheduler_quantum_of(current)) {
+        current->slice_used = 0;
+        if (scheduler_level_of(current) < SCHEDULER_MAX_QUEUES - 1) {
+            current->demotions++;
+            g_scheduler.total_demotions++;
+        }
+        preempt = 1;
+    }
+    
+    // Decrement quantum
+    if (cpu->current_quantum_remaining > 0) {
+        cpu->current_quantum_remaining--;
+    }
+    if (cpu->current_quantum_remaining == 0) {
+        preempt = 1;
+    }
+    
+    // A wakeup or boost may have made something more urgent ready
+    uint32_t ready_mask = cpu->run_queue.ready_mask;
+    if (ready_mask && sched_ctz(ready_mask) < scheduler_level_of(current)) {
+        preempt = 1;
+    }
+    return preempt;
+}
+
+// Called on timer interrupt, once per millisecond while any CPU has work.
+// Sleepers are woken by their timers, which the IRQ runs just before this.
+// The IRQ may be delivered on the clock thread, which must not touch a
+// CPU's MMU state, so this only does the accounting and flags the CPUs
+// that should switch; scheduler_preempt_point() switches them.
 void scheduler_tick(void) {
     if (!g_scheduler_initialized || !g_scheduler.scheduling_enabled) {
         return;
     }
     
-    // Decrement quantum
-    if (g_scheduler.current_quantum_remaining > 0) {
-        g_scheduler.current_quantum_remaining--;
+    uint64_t now = ++g_scheduler.ticks;
+    
+    if (g_scheduler.algorithm == SCHED_MULTILEVEL &&
+        now - g_scheduler.last_boost_tick >= SCHEDULER_BOOST_INTERVAL) {
+        scheduler_boost_priorities();
+    }
+    if (g_scheduler.cpu_count > 1 &&
+        now - g_scheduler.last_balance_tick >= SCHEDULER_BALANCE_INTERVAL) {
+        scheduler_balance();
+    }
+    
+    // If quantum expired, ask for a preemption.  switch_lock keeps the
+    // running process from being switched away and freed meanwhile.
+    for (uint32_t c = 0; c < g_scheduler.cpu_count; c++) {
+        SchedulerCPU* cpu = &g_scheduler.cpus[c];
+        EnterCriticalSection(&cpu->switch_lock);
+        int preempt = scheduler_tick_cpu(cpu);
+        LeaveCriticalSection(&cpu->switch_lock);
+        if (preempt && g_scheduler.preemption_enabled) {
+            InterlockedOr(&g_scheduler.resched_mask, (LONG)(1u << c));
+        }
     }
+}
+
+// Switch the CPUs the tick flagged.  Called by a vCPU's own thread where
+// it is safe to switch: between translated blocks, on syscall return and
+// between shell commands.  Signals timers posted are delivered first, so a
+// killed process is not switched to.
+void scheduler_preempt_point(void) {
+    if (!g_scheduler_initialized) return;
     
-    // If quantum expired, preempt
-    if (g_scheduler.current_quantum_remaining == 0 && g_scheduler.preemption_enabled) {
-        scheduler_preempt();
+    process_deliver_signals();
+    if (!g_scheduler.scheduling_enabled) return;
+    
+    uint32_t self = scheduler_current_cpu();
+    LONG mine = (LONG)(1u << self);
+    if (!(g_scheduler.resched_mask & mine)) return;
+    
+    if (InterlockedAnd(&g_scheduler.resched_mask, ~mine) & mine) {
+        g_scheduler.total_preemptions++;
+        scheduler_schedule_cpu(self);
     }
 }
 
@@ -290,11 +599,11 @@ void scheduler_tick(void) {
 void scheduler_block_process(Process* process) {
     if (!process) return;
     
-    scheduler_remove_from_queue(process);
     scheduler_enqueue_blocked(process);
     
-    if (process == g_scheduler.current_process) {
-        scheduler_schedule();  // Switch to another process
+    SchedulerCPU* cpu = sched_running_on(process);
+    if (cpu) {
+        scheduler_schedule_cpu(cpu->id);  // Switch to another process
     }
 }
 
@@ -302,16 +611,30 @@ void scheduler_block_process(Process* process) {
 void scheduler_unblock_process(Process* process) {
     if (!process) return;
     
-    queue_remove(&g_scheduler.blocked_queue, process);
     scheduler_enqueue_ready(process);
 }
 
+// Runs on the clock thread when a sleep is over
+static void scheduler_sleep_expired(KernelTimer* timer, void* arg) {
+    (void)timer;
+    InterlockedDecrement(&g_scheduler.sleeping);
+    g_scheduler.total_wakeups++;
+    scheduler_unblock_process((Process*)arg);
+}
+
 // Sleep process for milliseconds
 void scheduler_sleep_process(Process* process, uint32_t ms) {
-    if (!process) return;
+    if (!process || !g_scheduler_initialized) return;
     
-    // Would set wakeup time here
-    scheduler_block_process(process);
+    scheduler_enqueue_blocked(process);
+    timer_setup(&process->sleep_timer, scheduler_sleep_expired, process);
+    InterlockedIncrement(&g_scheduler.sleeping);
+    timer_arm(&process->sleep_timer, ms);
+    
+    SchedulerCPU* cpu = sched_running_on(process);
+    if (cpu) {
+        scheduler_schedule_cpu(cpu->id);
+    }
 }
 
 // Wake process
@@ -351,8 +674,10 @@ void scheduler_context_switch(Process* old_proc, Process* new_proc) {
     // Load new process context
     scheduler_load_context(new_proc);
     
-    // Switch page directory if MMU is enabled
-    // Would call mmu_switch_page_directory(new_proc->page_directory) here
+    // Switch page directory if the process has its own address space
+    if (new_proc->page_directory) {
+        mmu_switch_page_directory(new_proc->page_directory);
+    }
     
     // Switch to user mode if new process is user process
     if (new_proc->pid > 0) {  // PID 0 is kernel
@@ -367,6 +692,25 @@ void scheduler_context_switch(Process* old_proc, Process* new_proc) {
 // Set scheduling algorithm
 void scheduler_set_algorithm(SchedulerAlgorithm algo) {
     g_scheduler.algorithm = algo;
+    
+    // Levels mean something else now; requeue everything that is ready
+    for (uint32_t c = 0; c < g_scheduler.cpu_count; c++) {
+        SchedulerCPU* cpu = &g_scheduler.cpus[c];
+        ProcessQueue moved;
+        Process* process;
+        queue_init(&moved);
+        
+        EnterCriticalSection(&cpu->lock);
+        while ((process = runq_pop(&cpu->run_queue)) != NULL) {
+            queue_enqueue(&moved, process);
+        }
+        while ((process = queue_dequeue(&moved)) != NULL) {
+            process->demotions = 0;
+            process->slice_used = 0;
+            runq_push(&cpu->run_queue, process, scheduler_level_of(process));
+        }
+        LeaveCriticalSection(&cpu->lock);
+    }
     printf("[SCHEDULER] Algorithm changed to %d\n", algo);
 }
 
@@ -376,19 +720,63 @@ void scheduler_set_quantum(uint32_t ms) {
     printf("[SCHEDULER] Quantum set to %dms\n", ms);
 }
 
-// Boost priorities (for aging)
+// Boost priorities (for aging).  Every process goes back to its base
+// level so long-running work that was demoted cannot starve.
 void scheduler_boost_priorities(void) {
-    // Move processes from lower priority queues to higher ones
-    // This prevents starvation
-    printf("[SCHEDULER] Priority boost\n");
+    g_scheduler.last_boost_tick = g_scheduler.ticks;
+    g_scheduler.total_boosts++;
+    
+    for (uint32_t c = 0; c < g_scheduler.cpu_count; c++) {
+        SchedulerCPU* cpu = &g_scheduler.cpus[c];
+        RunQueue* rq = &cpu->run_queue;
+        
+        EnterCriticalSection(&cpu->lock);
+        uint32_t mask = rq->ready_mask & ~1u;
+        while (mask) {
+            uint32_t level = sched_ctz(mask);
+            mask &= mask - 1;
+            
+            Process* process;
+            while ((process = rq->levels[level].head) != NULL) {
+                runq_remove(rq, process);
+                process->demotions = 0;
+                process->slice_used = 0;
+                runq_push(rq, process, scheduler_level_of(process));
+            }
+        }
+        LeaveCriticalSection(&cpu->lock);
+        
+        // Demoted processes that are running rise too
+        EnterCriticalSection(&cpu->switch_lock);
+        if (cpu->current_process) {
+            cpu->current_process->demotions = 0;
+            cpu->current_process->slice_used = 0;
+        }
+        LeaveCriticalSection(&cpu->switch_lock);
+    }
+    
+    EnterCriticalSection(&g_scheduler.blocked_lock);
+    for (Process* process = g_scheduler.blocked_queue.head; process; process = process->run_next) {
+        process->demotions = 0;
+        process->slice_used = 0;
+    }
+    LeaveCriticalSection(&g_scheduler.blocked_lock);
+}
+
+// Even out run queue lengths across CPUs
+void scheduler_balance(void) {
+    if (!g_scheduler_initialized) return;
+    
+    g_scheduler.last_balance_tick = g_scheduler.ticks;
+    sched_balance(g_scheduler.cpus, g_scheduler.cpu_count);
 }
 
 // Check if should preempt
 int scheduler_should_preempt(Process* current, Process* candidate) {
     if (!current || !candidate) return 0;
     
-    // Simple policy: always preempt if candidate has higher priority
-    return (candidate->priority > current->priority);
+    // Preempt if the candidate would run from a higher (lower numbered) level
+    return scheduler_level_of(candidate) < scheduler_level_of(current);
 }
 
 // Get scheduler state
@@ -398,7 +786,8 @@ Scheduler* scheduler_get_state(void) {
 
 // Get current process
 Process* scheduler_get_current_process(void) {
-    return g_scheduler.current_process;
+    if (!g_scheduler_initialized) return NULL;
+    return g_scheduler.cpus[scheduler_current_cpu()].current_process;
 }
 
 // Get context switch count
@@ -406,11 +795,295 @@ uint64_t scheduler_get_context_switches(void) {
     return g_scheduler.total_context_switches;
 }
 
+// Whether the clock must keep ticking: something is running or waiting to
+int scheduler_has_work(void) {
+    if (!g_scheduler_initialized || !g_scheduler.scheduling_enabled) return 0;
+    
+    for (uint32_t c = 0; c < g_scheduler.cpu_count; c++) {
+        SchedulerCPU* cpu = &g_scheduler.cpus[c];
+        if (cpu->run_queue.count > 0 ||
+            (cpu->current_process && cpu->current_process != g_scheduler.idle_process)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+uint32_t scheduler_cpu_count(void) {
+    return g_scheduler_initialized ? g_scheduler.cpu_count : 1;
+}
+
+uint32_t scheduler_current_cpu(void) {
+    return g_sched_this_cpu < g_scheduler.cpu_count ? g_sched_this_cpu : 0;
+}
+
 // Dump scheduler queues
 void scheduler_dump_queues(void) {
-    printf("[SCHEDULER] Ready queue: %d processes\n", g_scheduler.ready_queue.count);
-    printf("[SCHEDULER] Blocked queue: %d processes\n", g_scheduler.blocked_queue.count);
+    uint64_t steals = 0, migrations = 0;
+    for (uint32_t c = 0; c < g_scheduler.cpu_count; c++) {
+        RunQueue* rq = &g_scheduler.cpus[c].run_queue;
+        printf("[SCHEDULER] CPU %u ready queue: %d processes (mask 0x%02x)\n", c, rq->count, rq->ready_mask);
+        for (int i = 0; i < SCHEDULER_MAX_QUEUES; i++) {
+            if (rq->levels[i].count > 0) {
+                printf("[SCHEDULER]   Level %d: %d processes\n", i, rq->levels[i].count);
+            }
+        }
+        steals += g_scheduler.cpus[c].steals;
+        migrations += g_scheduler.cpus[c].migrations;
+    }
+    printf("[SCHEDULER] Blocked queue: %d processes (%u sleeping)\n",
+           g_scheduler.blocked_queue.count, (unsigned)g_scheduler.sleeping);
     printf("[SCHEDULER] Context switches: %llu\n", g_scheduler.total_context_switches);
     printf("[SCHEDULER] Preemptions: %llu\n", g_scheduler.total_preemptions);
     printf("[SCHEDULER] Yields: %llu\n", g_scheduler.total_yields);
+    printf("[SCHEDULER] Demotions: %llu, boosts: %llu, timer wakeups: %llu\n",
+           g_scheduler.total_demotions, g_scheduler.total_boosts, g_scheduler.total_wakeups);
+    printf("[SCHEDULER] Steals: %llu, migrations: %llu\n", steals, migrations);
+}
+
+// Per-CPU table for top/htop
+void scheduler_print_cpu_stats(void) {
+    if (!g_scheduler_initialized) {
+        printf("Scheduler not running\n");
+        return;
+    }
+    
+    printf("%-5s %-16s %6s %10s %7s %7s %6s\n", "CPU", "RUNNING", "READY", "SWITCHES", "STEALS", "MIGR", "%BUSY");
+    for (uint32_t c = 0; c < g_scheduler.cpu_count; c++) {
+        SchedulerCPU* cpu = &g_scheduler.cpus[c];
+        uint64_t ticks = cpu->busy_ticks + cpu->idle_ticks;
+        printf("cpu%-2u %-16s %6d %10llu %7llu %7llu %5.1f%%\n", c,
+               cpu->current_process ? cpu->current_process->name : "(idle)",
+               cpu->run_queue.count, cpu->context_switches, cpu->steals, cpu->migrations,
+               ticks ? 100.0 * (double)cpu->busy_ticks / (double)ticks : 0.0);
+    }
+}
+
+// Run queue cost with `tasks` runnable processes spread over the levels:
+// pick + re-enqueue (a context switch), removing a random process and
+// putting it back (block/unblock).  Uses private queues, so the live
+// scheduler is not disturbed.  Sleep timers are bench timer's business.
+void scheduler_benchmark(uint32_t tasks, uint64_t operations) {
+    if (tasks == 0) tasks = 10000;
+    if (operations == 0) operations = 1000000;
+    
+    Process* procs = (Process*)calloc(tasks, sizeof(Process));
+    LegacyQueue* legacy = (LegacyQueue*)calloc(SCHEDULER_MAX_QUEUES, sizeof(LegacyQueue));
+    RunQueue* rq = (RunQueue*)calloc(1, sizeof(RunQueue));
+    if (!procs || !legacy || !rq) {
+        printf("bench sched: out of memory\n");
+        free(procs);
+        free(legacy);
+        free(rq);
+        return;
+    }
+    
+    for (uint32_t i = 0; i < tasks; i++) {
+        procs[i].pid = (int)i + 1;
+        procs[i].run_level = (uint8_t)(i % SCHEDULER_MAX_QUEUES);
+        runq_push(rq, &procs[i], procs[i].run_level);
+        legacy_enqueue(&legacy[procs[i].run_level], &procs[i]);
+    }
+    
+    printf("bench sched: %u runnable tasks on %d levels, %llu operations\n",
+           tasks, SCHEDULER_MAX_QUEUES, (unsigned long long)operations);
+    
+    // Pick the most urgent and requeue it one level down (wrapping), as a
+    // demoting MLFQ would; the bitmap must always give the lowest level
+    uint32_t bad = 0;
+    double start = sched_now_seconds();
+    for (uint64_t i = 0; i < operations; i++) {
+        uint32_t expect = sched_ctz(rq->ready_mask);
+        Process* process = runq_pop(rq);
+        if (process->run_level != expect) bad++;
+        runq_push(rq, process, (process->run_level + 1u) % SCHEDULER_MAX_QUEUES);
+    }
+    double pick_seconds = sched_now_seconds() - start;
+    
+    uint32_t seed = 0x2545F491;
+    start = sched_now_seconds();
+    for (uint64_t i = 0; i < operations; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        Process* process = &procs[seed % tasks];
+        uint32_t level = process->run_level;
+        runq_remove(rq, process);
+        runq_push(rq, process, level);
+    }
+    double remove_seconds = sched_now_seconds() - start;
+    if (rq->count != (int)tasks) bad++;
+    
+    // Legacy: the scan is cheap to pick but each enqueue mallocs, and the
+    // linear remove is O(tasks), so it gets fewer rounds
+    uint64_t legacy_rounds = operations < 20000 ? operations : 20000;
+    start = sched_now_seconds();
+    for (uint64_t i = 0; i < operations; i++) {
+        Process* process = legacy_pick(legacy);
+        process->run_level = (uint8_t)((process->run_level + 1u) % SCHEDULER_MAX_QUEUES);
+        legacy_enqueue(&legacy[process->run_level], process);
+    }
+    double legacy_pick_seconds = sched_now_seconds() - start;
+    
+    start = sched_now_seconds();
+    for (uint64_t i = 0; i < legacy_rounds; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        Process* process = &procs[seed % tasks];
+        legacy_remove(legacy, process);
+        legacy_enqueue(&legacy[process->run_level], process);
+    }
+    double legacy_remove_seconds = sched_now_seconds() - start;
+    
+    printf("  %-24s %12s %12s %10s\n", "", "Bitmap", "Legacy", "Speedup");
+    printf("  %-24s %9.1f ns %9.1f ns %9.1fx\n", "pick + enqueue",
+           pick_seconds * 1e9 / (double)operations,
+           legacy_pick_seconds * 1e9 / (double)operations,
+           pick_seconds > 0 ? legacy_pick_seconds / pick_seconds : 0.0);
+    printf("  %-24s %9.1f ns %9.1f ns %9.1fx\n", "remove + enqueue",
+           remove_seconds * 1e9 / (double)operations,
+           legacy_remove_seconds * 1e9 / (double)legacy_rounds,
+           remove_seconds > 0 && legacy_rounds > 0 ?
+               (legacy_remove_seconds / (double)legacy_rounds) / (remove_seconds / (double)operations) : 0.0);
+    printf("  Checks: %s\n", bad ? "FAILED" : "ok");
+    
+    legacy_clear(legacy);
+    free(legacy);
+    free(rq);
+    free(procs);
+}
+
+// Run queue scaling: independent CPU-bound processes on 1..max_cpus
+// private run queues, each drained by a host thread with its own dispatch
+// loop and stealing.  A slice is a computed loop, not interpreted guest
+// code, so this measures the queues and stealing, not the VM.
+typedef struct {
+    Process process;            // First, so a picked Process* is the task
+    uint32_t remaining;         // Slices still to run
+    uint32_t state;             // Work result, the same on any CPU count
+} SmpTask;
+
+typedef struct {
+    SchedulerCPU* cpus;
+    uint32_t count;
+    uint32_t self;
+    volatile LONG* unfinished;
+} SmpWorker;
+
+#define SCHED_SMP_SLICE_WORK    20000   // xorshift rounds per time slice
+
+static DWORD WINAPI sched_smp_worker(LPVOID param) {
+    SmpWorker* worker = (SmpWorker*)param;
+    SchedulerCPU* cpu = &worker->cpus[worker->self];
+    g_sched_this_cpu = worker->self;
+    
+    while (*worker->unfinished > 0) {
+        SmpTask* task = (SmpTask*)sched_pick(worker->cpus, worker->count, worker->self);
+        if (!task) {
+            cpu->idle_ticks++;
+            Sleep(0);
+            continue;
+        }
+        
+        uint32_t x = task->state;
+        for (int i = 0; i < SCHED_SMP_SLICE_WORK; i++) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+        }
+        task->state = x;
+        cpu->busy_ticks++;
+        cpu->context_switches++;
+        
+        if (--task->remaining > 0) {
+            sched_cpu_push(cpu, &task->process, task->process.run_level);
+        } else {
+            InterlockedDecrement(worker->unfinished);
+        }
+    }
+    return 0;
+}
+
+void scheduler_smp_benchmark(uint32_t max_cpus, uint32_t tasks, uint32_t slices) {
+    int host_cpus = scheduler_host_cpus();
+    if (max_cpus == 0) max_cpus = (uint32_t)host_cpus;
+    if (max_cpus > SCHEDULER_MAX_CPUS) max_cpus = SCHEDULER_MAX_CPUS;
+    if (tasks == 0) tasks = 256;
+    if (slices == 0) slices = 64;
+    
+    SmpTask* work = (SmpTask*)calloc(tasks, sizeof(SmpTask));
+    SchedulerCPU* cpus = (SchedulerCPU*)calloc(SCHEDULER_MAX_CPUS, sizeof(SchedulerCPU));
+    if (!work || !cpus) {
+        printf("bench smp: out of memory\n");
+        free(work);
+        free(cpus);
+        return;
+    }
+    
+    printf("bench smp: %u synthetic processes x %u slices, up to %u run queue threads (%d host cores)\n",
+           tasks, slices, max_cpus, host_cpus);
+    printf("  Slices are computed loops, not guest code; the VM itself runs on one CPU\n");
+    printf("  %7s %10s %14s %8s %8s %8s\n", "Threads", "Time", "Slices/s", "Speedup", "Steals", "Result");
+    
+    double base_rate = 0.0;
+    uint64_t expect = 0;
+    for (uint32_t count = 1; ; count = count * 2 < max_cpus ? count * 2 : max_cpus) {
+        memset(cpus, 0, SCHEDULER_MAX_CPUS * sizeof(SchedulerCPU));
+        for (uint32_t c = 0; c < count; c++) {
+            cpus[c].id = c;
+            InitializeCriticalSection(&cpus[c].lock);
+        }
+        
+        // Everything starts on CPU 0, as after a burst of forks there;
+        // the other CPUs have to steal their share
+        memset(work, 0, tasks * sizeof(SmpTask));
+        for (uint32_t i = 0; i < tasks; i++) {
+            work[i].process.pid = (int)i + 1;
+            work[i].remaining = slices;
+            work[i].state = 0x9E3779B9u ^ i;
+            runq_push(&cpus[0].run_queue, &work[i].process, i % SCHEDULER_MAX_QUEUES);
+        }
+        
+        volatile LONG unfinished = (LONG)tasks;
+        SmpWorker workers[SCHEDULER_MAX_CPUS];
+        HANDLE handles[SCHEDULER_MAX_CPUS];
+        uint32_t started = 0;
+        
+        double start = sched_now_seconds();
+        for (uint32_t c = 1; c < count; c++) {
+            workers[c] = (SmpWorker){ cpus, count, c, &unfinished };
+            handles[started] = CreateThread(NULL, 0, sched_smp_worker, &workers[c], 0, NULL);
+            if (handles[started]) started++;
+        }
+        workers[0] = (SmpWorker){ cpus, count, 0, &unfinished };
+        sched_smp_worker(&workers[0]);
+        if (started > 0) {
+            WaitForMultipleObjects((DWORD)started, handles, TRUE, INFINITE);
+            for (uint32_t t = 0; t < started; t++) {
+                CloseHandle(handles[t]);
+            }
+        }
+        double seconds = sched_now_seconds() - start;
+        g_sched_this_cpu = 0;
+        
+        uint64_t sum = 0, steals = 0;
+        for (uint32_t i = 0; i < tasks; i++) sum += work[i].state;
+        for (uint32_t c = 0; c < count; c++) {
+            steals += cpus[c].steals;
+            DeleteCriticalSection(&cpus[c].lock);
+        }
+        if (count == 1) expect = sum;
+        
+        double rate = seconds > 0 ? (double)tasks * slices / seconds : 0.0;
+        if (count == 1) base_rate = rate;
+        printf("  %7u %8.1f ms %14.0f %7.2fx %8llu %8s\n", count, seconds * 1e3, rate,
+               base_rate > 0 ? rate / base_rate : 0.0, (unsigned long long)steals,
+               sum == expect ? "ok" : "WRONG");
+        
+        if (count == max_cpus) break;
+    }
+    
+    free(cpus);
+    free(work);
 }
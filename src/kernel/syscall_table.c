@@ -1,241 +1,530 @@
 #include "kernel/syscall_table.h"
 #include "kernel/privilege.h"
 #include "kernel/network_stack.h"
+#include "kernel/scheduler.h"
+#include "kernel/timer.h"
+#include "kernel/io_ring.h"
 #include "system/process.h"
-#include "vfs/vfs.h"
+#include "vfs/vfs_file.h"
 #include "memory.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <windows.h>
 
-// File descriptor table (0=stdin, 1=stdout, 2=stderr)
-#define MAX_FDS 256
+// File descriptors live in the current process's table (vfs/vfs_file.h)
+// and refer to shared open files: dup() and fork() share the position, and
+// file reads and writes work on the VNode's buffer in place.  Calls made
+// outside any process use the kernel's own table.
+static VFSFdTable* g_kernel_fds = NULL;
+
+// File mappings hand out the VNode's own buffer, pinned by map_count
+#define MAX_FILE_MAPPINGS 64
+
+// splice() from a socket or pipe into a file receives at most this much
+// at a time, so the file only grows by what actually arrives
+#define SPLICE_RECV_CHUNK (64 * 1024)
 typedef struct {
-    int in_use;
-    char* path;
-    void* data;
-    size_t size;
-    size_t position;
-    int flags;  // O_RDONLY, O_WRONLY, O_RDWR
-} FileDescriptor;
+    uint32_t addr;
+    uint32_t length;
+    VNode* node;
+    int writable;
+} FileMapping;
 
-static FileDescriptor g_fd_table[MAX_FDS] = {0};
-static int next_fd = 3;  // Start after stdin/stdout/stderr
+static FileMapping g_file_mappings[MAX_FILE_MAPPINGS];
 
 // Global syscall table
 static SyscallTableEntry g_syscall_table[MAX_SYSCALLS];
 
+// Trace mask, one bit per syscall, and where traced calls log to
+static uint32_t g_syscall_trace[MAX_SYSCALLS / 32];
+static FILE* g_syscall_trace_file = NULL;   // NULL: stdout
+
+static SyscallStats g_syscall_stats[MAX_SYSCALLS];
+static uint64_t g_syscall_invalid = 0;      // Numbers past the table
+static uint64_t g_zero_copy_bytes = 0;      // Moved fd to fd without a user buffer
+static double g_syscall_qpc_ns = 0.0;       // Nanoseconds per QPC count
+
+#define SYSCALL_TRACED(num) (g_syscall_trace[(num) >> 5] & (1u << ((num) & 31)))
+#define SYSCALL_TRACE(num, ...) \
+    do { \
+        if (SYSCALL_TRACED(num)) fprintf(g_syscall_trace_file ? g_syscall_trace_file : stdout, __VA_ARGS__); \
+    } while (0)
+
 // Syscall implementations
 
 int sys_exit(uint32_t status, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5) {
-    printf("[SYSCALL] exit(%d)\n", status);
+    SYSCALL_TRACE(SYS_exit, "[SYSCALL] exit(%d)\n", status);
     // Would terminate current process here
     return 0;
 }
 
 int sys_fork(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5) {
-    printf("[SYSCALL] fork() - creating child process\n");
-    // Would create new process here
-    return 0;  // Return child PID
-}
-
-int sys_read(uint32_t fd, uint32_t buf, uint32_t count, uint32_t arg4, uint32_t arg5) {
-    printf("[SYSCALL] read(fd=%d, count=%d)\n", fd, count);
+    SYSCALL_TRACE(SYS_fork, "[SYSCALL] fork() - creating child process\n");
     
-    if (!buf) {
-        printf("[SYSCALL] read: invalid buffer\n");
+    Process* current = scheduler_get_current_process();
+    int child = process_fork(current ? current->pid : 1);
+    if (child < 0) {
+        SYSCALL_TRACE(SYS_fork, "[SYSCALL] fork: could not create child process\n");
         return -1;
     }
+    return child;  // Return child PID
+}
+
+static VFSFdTable* current_fds(void) {
+    Process* current = scheduler_get_current_process();
+    return current && current->fd_table ? current->fd_table : g_kernel_fds;
+}
+
+// The open file behind fd, optionally only of one VFS_FILE_* kind
+static VFSFile* fd_get(uint32_t fd, int kind) {
+    VFSFile* file = vfs_fd_get(current_fds(), (int)fd);
+    if (!file || (kind && file->kind != kind)) return NULL;
+    return file;
+}
+
+static void fd_close_socket(VFSFile* file) {
+    netstack_close(file->socket);
+}
+
+// Wrap a network stack socket in an fd
+static int fd_install_socket(int socket) {
+    if (socket < 0) return -1;
     
-    // Handle stdin (fd=0)
-    if (fd == 0) {
-        // Would read from terminal input
-        printf("[SYSCALL] read: stdin not yet implemented\n");
-        return 0;
+    VFSFile* file = vfs_file_socket(socket, fd_close_socket);
+    if (!file) {
+        netstack_close(socket);
+        return -1;
     }
+    int fd = vfs_fd_install(current_fds(), file, 0);
+    if (fd < 0) vfs_file_release(file);
+    return fd;
+}
+
+int sys_read(uint32_t fd, uint32_t buf, uint32_t count, uint32_t arg4, uint32_t arg5) {
+    SYSCALL_TRACE(SYS_read, "[SYSCALL] read(fd=%d, count=%d)\n", fd, count);
     
-    // Validate file descriptor
-    if (fd < 3 || fd >= MAX_FDS || !g_fd_table[fd].in_use) {
-        printf("[SYSCALL] read: invalid fd\n");
+    if (!buf) {
+        SYSCALL_TRACE(SYS_read, "[SYSCALL] read: invalid buffer\n");
         return -1;
     }
     
-    FileDescriptor* file = &g_fd_table[fd];
-    
-    // Check if opened for reading
-    if ((file->flags & 0x03) == 1) {  // O_WRONLY
-        printf("[SYSCALL] read: file not open for reading\n");
+    VFSFile* file = fd_get(fd, 0);
+    if (!file) {
+        SYSCALL_TRACE(SYS_read, "[SYSCALL] read: invalid fd\n");
         return -1;
     }
-    
-    // Calculate how much to read
-    size_t available = file->size - file->position;
-    size_t to_read = (count < available) ? count : available;
-    
-    if (to_read == 0) {
-        return 0;  // EOF
+    if (file->kind == VFS_FILE_SOCKET) {
+        return netstack_recv(file->socket, (void*)buf, count, 0);
     }
     
-    // Copy data to buffer
-    memcpy((void*)buf, (char*)file->data + file->position, to_read);
-    file->position += to_read;
-    
-    printf("[SYSCALL] read: read %zu bytes (pos now %zu/%zu)\n", 
-           to_read, file->position, file->size);
-    return (int)to_read;
+    int got = vfs_file_read(file, (void*)buf, count);
+    SYSCALL_TRACE(SYS_read, "[SYSCALL] read: returned %d (pos now %zu)\n", got, file->position);
+    return got;
 }
 
 int sys_write(uint32_t fd, uint32_t buf, uint32_t count, uint32_t arg4, uint32_t arg5) {
+    SYSCALL_TRACE(SYS_write, "[SYSCALL] write(fd=%d, count=%d)\n", fd, count);
+    
     if (!buf) {
-        printf("[SYSCALL] write: invalid buffer\n");
+        SYSCALL_TRACE(SYS_write, "[SYSCALL] write: invalid buffer\n");
         return -1;
     }
     
-    // Handle stdout/stderr (fd=1,2)
-    if (fd == 1 || fd == 2) {
-        const char* data = (const char*)buf;
-        for (size_t i = 0; i < count; i++) {
-            putchar(data[i]);
-        }
-        fflush(stdout);
-        return count;
-    }
-    
-    printf("[SYSCALL] write(fd=%d, count=%d)\n", fd, count);
-    
-    // Validate file descriptor
-    if (fd < 3 || fd >= MAX_FDS || !g_fd_table[fd].in_use) {
-        printf("[SYSCALL] write: invalid fd\n");
+    VFSFile* file = fd_get(fd, 0);
+    if (!file) {
+        SYSCALL_TRACE(SYS_write, "[SYSCALL] write: invalid fd\n");
         return -1;
     }
+    if (file->kind == VFS_FILE_SOCKET) {
+        return netstack_send(file->socket, (const void*)buf, count, 0);
+    }
+    
+    int written = vfs_file_write(file, (const void*)buf, count);
+    SYSCALL_TRACE(SYS_write, "[SYSCALL] write: returned %d (pos now %zu)\n", written, file->position);
+    return written;
+}
+
+int sys_open(uint32_t pathname, uint32_t flags, uint32_t mode, uint32_t arg4, uint32_t arg5) {
+    const char* path_str = (const char*)pathname;
+    if (!path_str) return -1;
     
-    FileDescriptor* file = &g_fd_table[fd];
+    SYSCALL_TRACE(SYS_open, "[SYSCALL] open(path=%s, flags=0x%X, mode=0x%X)\n", path_str, flags, mode);
     
-    // Check if opened for writing
-    if ((file->flags & 0x03) == 0) {  // O_RDONLY
-        printf("[SYSCALL] write: file not open for writing\n");
+    // Missing, a directory, not permitted, or truncating a mapped file
+    VFSFile* file = vfs_file_open(path_str, (int)(flags & ~SYS_O_CLOEXEC));
+    if (!file) {
+        SYSCALL_TRACE(SYS_open, "[SYSCALL] open: cannot open %s\n", path_str);
         return -1;
     }
     
-    // Expand buffer if needed
-    size_t new_pos = file->position + count;
-    if (new_pos > file->size) {
-        // Reallocate buffer
-        void* new_data = realloc(file->data, new_pos);
-        if (!new_data) {
-            printf("[SYSCALL] write: allocation failed\n");
-            return -1;
-        }
-        file->data = new_data;
-        file->size = new_pos;
+    VFSFdTable* fds = current_fds();
+    int fd = vfs_fd_install(fds, file, 0);
+    if (fd < 0) {
+        vfs_file_release(file);
+        SYSCALL_TRACE(SYS_open, "[SYSCALL] open: too many open files\n");
+        return -1;
     }
+    if (flags & SYS_O_CLOEXEC) fds->fd_flags[fd] = VFS_FD_CLOEXEC;
     
-    // Write data
-    memcpy((char*)file->data + file->position, (const void*)buf, count);
-    file->position += count;
+    SYSCALL_TRACE(SYS_open, "[SYSCALL] open: opened fd=%d (size=%zu bytes)\n", fd, file->node->size);
+    return fd;
+}
+
+int sys_close(uint32_t fd, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5) {
+    SYSCALL_TRACE(SYS_close, "[SYSCALL] close(fd=%d)\n", fd);
     
-    // Write back to VFS
-    if (vfs_write_file(file->path, file->data, file->size) != 0) {
-        printf("[SYSCALL] write: failed to write to VFS\n");
-        return -1;
+    // The open file itself closes with its last descriptor
+    int result = vfs_fd_close(current_fds(), (int)fd);
+    if (result < 0) {
+        SYSCALL_TRACE(SYS_close, "[SYSCALL] close: invalid fd\n");
     }
+    return result;
+}
+
+int sys_dup(uint32_t oldfd, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5) {
+    SYSCALL_TRACE(SYS_dup, "[SYSCALL] dup(fd=%d)\n", oldfd);
+    
+    VFSFile* file = fd_get(oldfd, 0);
+    if (!file) return -1;
     
-    printf("[SYSCALL] write: wrote %d bytes (pos now %zu/%zu)\n", 
-           count, file->position, file->size);
-    return count;
+    int fd = vfs_fd_install(current_fds(), vfs_file_retain(file), 0);
+    if (fd < 0) vfs_file_release(file);
+    return fd;
 }
 
-int sys_open(uint32_t pathname, uint32_t flags, uint32_t mode, uint32_t arg4, uint32_t arg5) {
-    const char* path_str = (const char*)pathname;
-    if (!path_str) return -1;
+int sys_dup2(uint32_t oldfd, uint32_t newfd, uint32_t arg3, uint32_t arg4, uint32_t arg5) {
+    SYSCALL_TRACE(SYS_dup2, "[SYSCALL] dup2(fd=%d, newfd=%d)\n", oldfd, newfd);
     
-    printf("[SYSCALL] open(path=%s, flags=0x%X, mode=0x%X)\n", path_str, flags, mode);
+    VFSFile* file = fd_get(oldfd, 0);
+    if (!file || newfd >= VFS_MAX_FDS) return -1;
+    if (oldfd == newfd) return (int)newfd;
     
-    // Find free file descriptor
-    int fd = -1;
-    for (int i = 3; i < MAX_FDS; i++) {
-        if (!g_fd_table[i].in_use) {
-            fd = i;
-            break;
+    return vfs_fd_install_at(current_fds(), (int)newfd, vfs_file_retain(file));
+}
+
+int sys_fcntl(uint32_t fd, uint32_t cmd, uint32_t arg, uint32_t arg4, uint32_t arg5) {
+    SYSCALL_TRACE(SYS_fcntl, "[SYSCALL] fcntl(fd=%d, cmd=%d, arg=0x%X)\n", fd, cmd, arg);
+    
+    VFSFdTable* fds = current_fds();
+    VFSFile* file = fd_get(fd, 0);
+    if (!file) return -1;
+    
+    switch (cmd) {
+        case SYS_F_DUPFD:
+        case SYS_F_DUPFD_CLOEXEC: {
+            if (arg >= VFS_MAX_FDS) return -1;
+            int new_fd = vfs_fd_install(fds, vfs_file_retain(file), (int)arg);
+            if (new_fd < 0) {
+                vfs_file_release(file);
+                return -1;
+            }
+            if (cmd == SYS_F_DUPFD_CLOEXEC) fds->fd_flags[new_fd] = VFS_FD_CLOEXEC;
+            return new_fd;
+        }
+        case SYS_F_GETFD:
+            return fds->fd_flags[fd];
+        case SYS_F_SETFD:
+            fds->fd_flags[fd] = arg & VFS_FD_CLOEXEC;
+            return 0;
+        case SYS_F_GETFL:
+            return file->flags;
+        case SYS_F_SETFL:
+            // Only the status flags change; the access mode is fixed at open
+            file->flags = (file->flags & ~VFS_O_SETFL_MASK) | (int)(arg & VFS_O_SETFL_MASK);
+            return 0;
+        default:
+            SYSCALL_TRACE(SYS_fcntl, "[SYSCALL] fcntl: unsupported command %d\n", cmd);
+            return -1;
+    }
+}
+
+// pipe(fds): fds[0] reads what fds[1] writes
+int sys_pipe(uint32_t pipefd, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5) {
+    SYSCALL_TRACE(SYS_pipe, "[SYSCALL] pipe()\n");
+    
+    uint32_t* out = (uint32_t*)pipefd;
+    if (!out) return -1;
+    
+    VFSFile* read_end;
+    VFSFile* write_end;
+    if (vfs_pipe_create(&read_end, &write_end) != 0) return -1;
+    
+    VFSFdTable* fds = current_fds();
+    int read_fd = vfs_fd_install(fds, read_end, 0);
+    int write_fd = read_fd >= 0 ? vfs_fd_install(fds, write_end, 0) : -1;
+    if (write_fd < 0) {
+        if (read_fd >= 0) {
+            vfs_fd_close(fds, read_fd);
+        } else {
+            vfs_file_release(read_end);
         }
+        vfs_file_release(write_end);
+        SYSCALL_TRACE(SYS_pipe, "[SYSCALL] pipe: too many open files\n");
+        return -1;
     }
     
-    if (fd == -1) {
-        printf("[SYSCALL] open: too many open files\n");
+    out[0] = (uint32_t)read_fd;
+    out[1] = (uint32_t)write_fd;
+    return 0;
+}
+
+// Scatter/gather I/O.  Vectors hold 32-bit addresses like every pointer
+// argument; a short read or write ends the transfer early.
+int sys_readv(uint32_t fd, uint32_t iov, uint32_t iovcnt, uint32_t arg4, uint32_t arg5) {
+    SYSCALL_TRACE(SYS_readv, "[SYSCALL] readv(fd=%d, iovcnt=%d)\n", fd, iovcnt);
+    if (!iov || iovcnt > SYS_IOV_MAX) return -1;
+    
+    const SyscallIoVec* vec = (const SyscallIoVec*)iov;
+    VFSFile* file = fd_get(fd, 0);
+    if (!file || !vfs_file_readable(file)) {
+        SYSCALL_TRACE(SYS_readv, "[SYSCALL] readv: invalid fd\n");
         return -1;
     }
     
-    // Check if file exists in VFS
-    VNode* node = vfs_find_node(path_str);
-    if (!node) {
-        // If O_CREAT flag, create the file
-        if (flags & 0x40) {  // O_CREAT = 0x40
-            if (vfs_create_file(path_str) != 0) {
-                printf("[SYSCALL] open: failed to create file\n");
-                return -1;
-            }
-            node = vfs_find_node(path_str);
-            if (!node) return -1;
+    int total = 0;
+    for (uint32_t i = 0; i < iovcnt; i++) {
+        if (vec[i].len == 0) continue;
+        if (!vec[i].base) return total ? total : -1;
+        
+        int got;
+        if (file->kind == VFS_FILE_SOCKET) {
+            got = netstack_recv(file->socket, (void*)vec[i].base, vec[i].len, 0);
         } else {
-            printf("[SYSCALL] open: file not found\n");
-            return -1;
+            got = vfs_file_read(file, (void*)vec[i].base, vec[i].len);
         }
+        if (got < 0) return total ? total : -1;
+        total += got;
+        if ((uint32_t)got < vec[i].len) break;
     }
-    
-    // Check if it's a directory
-    if (node->is_directory) {
-        printf("[SYSCALL] open: is a directory\n");
+    return total;
+}
+
+int sys_writev(uint32_t fd, uint32_t iov, uint32_t iovcnt, uint32_t arg4, uint32_t arg5) {
+    SYSCALL_TRACE(SYS_writev, "[SYSCALL] writev(fd=%d, iovcnt=%d)\n", fd, iovcnt);
+    if (!iov || iovcnt > SYS_IOV_MAX) return -1;
+    
+    const SyscallIoVec* vec = (const SyscallIoVec*)iov;
+    VFSFile* file = fd_get(fd, 0);
+    if (!file || !vfs_file_writable(file)) {
+        SYSCALL_TRACE(SYS_writev, "[SYSCALL] writev: invalid fd\n");
         return -1;
     }
     
-    // Read file contents
-    void* data = NULL;
-    size_t size = 0;
-    if (vfs_read_file(path_str, &data, &size) != 0) {
-        printf("[SYSCALL] open: failed to read file\n");
-        return -1;
+    if (file->kind != VFS_FILE_NODE) {
+        int total = 0;
+        for (uint32_t i = 0; i < iovcnt; i++) {
+            if (!vec[i].base || !vec[i].len) continue;
+            int sent = file->kind == VFS_FILE_SOCKET
+                ? netstack_send(file->socket, (const void*)vec[i].base, vec[i].len, 0)
+                : vfs_file_write(file, (const void*)vec[i].base, vec[i].len);
+            if (sent < 0) return total ? total : -1;
+            total += sent;
+            if ((uint32_t)sent < vec[i].len) break;
+        }
+        return total;
     }
     
-    // Setup file descriptor
-    g_fd_table[fd].in_use = 1;
-    g_fd_table[fd].path = strdup(path_str);
-    g_fd_table[fd].data = data;
-    g_fd_table[fd].size = size;
-    g_fd_table[fd].position = 0;
-    g_fd_table[fd].flags = flags;
+    // Grow the file once for the whole vector, then copy each piece in
+    size_t offset = vfs_file_write_offset(file);
+    size_t total = 0;
+    for (uint32_t i = 0; i < iovcnt; i++) {
+        total += vec[i].base ? vec[i].len : 0;
+    }
+    if (total == 0) return 0;
     
-    printf("[SYSCALL] open: opened fd=%d (size=%zu bytes)\n", fd, size);
-    return fd;
+    char* target = total <= INT32_MAX ? vfs_file_reserve(file, offset, total) : NULL;
+    if (!target) {
+        SYSCALL_TRACE(SYS_writev, "[SYSCALL] writev: cannot grow file\n");
+        return -1;
+    }
+    for (uint32_t i = 0; i < iovcnt; i++) {
+        if (!vec[i].base || !vec[i].len) continue;
+        memcpy(target, (const void*)vec[i].base, vec[i].len);
+        target += vec[i].len;
+    }
+    vfs_file_commit(file, offset, total);
+    file->position = offset + total;
+    return (int)total;
 }
 
-int sys_close(uint32_t fd, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5) {
-    printf("[SYSCALL] close(fd=%d)\n", fd);
+// Move up to `count` bytes from a file to any fd without a user buffer:
+// to a socket the file's own bytes are handed to the stack, to a file
+// they're copied node to node.  Returns bytes moved.
+static int fd_transfer_from_file(VFSFile* in, size_t* in_offset,
+                                 VFSFile* out, size_t* out_offset, size_t count) {
+    size_t length = count;
+    const uint8_t* data = vfs_file_peek(in, *in_offset, &length);
+    if (length == 0) return 0;
+    if (length > INT32_MAX) length = INT32_MAX;
+    
+    int moved;
+    if (out->kind == VFS_FILE_SOCKET) {
+        moved = netstack_send(out->socket, data, (uint32_t)length, 0);
+    } else if (out->kind == VFS_FILE_NODE) {
+        if (out->node == in->node) return -1;   // Overlapping copy within one file
+        // Growing the destination can't move the source, it's another node
+        moved = vfs_file_store(out, *out_offset, data, length);
+        if (moved > 0) *out_offset += (size_t)moved;
+    } else {
+        moved = vfs_file_write(out, data, length);  // Console or pipe
+    }
+    if (moved > 0) {
+        *in_offset += (size_t)moved;
+        g_zero_copy_bytes += (uint64_t)moved;
+    }
+    return moved;
+}
+
+static VFSFile* fd_get_output(uint32_t fd) {
+    VFSFile* file = fd_get(fd, 0);
+    return file && vfs_file_writable(file) ? file : NULL;
+}
+
+int sys_sendfile(uint32_t out_fd, uint32_t in_fd, uint32_t offset, uint32_t count, uint32_t arg5) {
+    SYSCALL_TRACE(SYS_sendfile, "[SYSCALL] sendfile(out=%d, in=%d, count=%d)\n", out_fd, in_fd, count);
     
-    if (fd < 3 || fd >= MAX_FDS) {
-        printf("[SYSCALL] close: invalid fd\n");
+    VFSFile* in = fd_get(in_fd, VFS_FILE_NODE);
+    VFSFile* out = fd_get_output(out_fd);
+    if (!in || !vfs_file_readable(in) || !out) {
+        SYSCALL_TRACE(SYS_sendfile, "[SYSCALL] sendfile: invalid fd\n");
         return -1;
     }
     
-    if (!g_fd_table[fd].in_use) {
-        printf("[SYSCALL] close: fd not open\n");
+    // With an offset pointer the input position stays put
+    uint32_t* offset_ptr = (uint32_t*)offset;
+    size_t in_offset = offset_ptr ? *offset_ptr : in->position;
+    size_t out_offset = vfs_file_write_offset(out);
+    
+    int moved = fd_transfer_from_file(in, &in_offset, out, &out_offset, count);
+    if (moved < 0) return -1;
+    
+    if (offset_ptr) {
+        *offset_ptr = (uint32_t)in_offset;
+    } else {
+        in->position = in_offset;
+    }
+    if (out->kind == VFS_FILE_NODE) out->position = out_offset;
+    return moved;
+}
+
+// splice(in, in_offset_ptr, out, out_offset_ptr, len): like sendfile in
+// either direction.  File to anything goes through the file's buffer;
+// a socket or pipe to a file reads straight into the destination node.
+int sys_splice(uint32_t fd_in, uint32_t off_in, uint32_t fd_out, uint32_t off_out, uint32_t len) {
+    SYSCALL_TRACE(SYS_splice, "[SYSCALL] splice(in=%d, out=%d, len=%d)\n", fd_in, fd_out, len);
+    
+    VFSFile* in = fd_get(fd_in, 0);
+    VFSFile* out = fd_get_output(fd_out);
+    if (!in || !out || !vfs_file_readable(in)) {
+        SYSCALL_TRACE(SYS_splice, "[SYSCALL] splice: invalid fd\n");
         return -1;
     }
+    if ((off_in && in->kind != VFS_FILE_NODE) || (off_out && out->kind != VFS_FILE_NODE)) {
+        return -1;  // Only files have offsets
+    }
     
-    // Cleanup file descriptor
-    if (g_fd_table[fd].path) {
-        free(g_fd_table[fd].path);
-        g_fd_table[fd].path = NULL;
+    uint32_t* in_ptr = (uint32_t*)off_in;
+    uint32_t* out_ptr = (uint32_t*)off_out;
+    int out_is_file = out->kind == VFS_FILE_NODE;
+    size_t out_offset = out_ptr ? *out_ptr : vfs_file_write_offset(out);
+    int moved;
+    
+    if (in->kind == VFS_FILE_NODE) {
+        size_t in_offset = in_ptr ? *in_ptr : in->position;
+        moved = fd_transfer_from_file(in, &in_offset, out, &out_offset, len);
+        if (moved < 0) return -1;
+        if (in_ptr) {
+            *in_ptr = (uint32_t)in_offset;
+        } else {
+            in->position = in_offset;
+        }
+    } else if (out_is_file) {
+        // Receive into the destination node's buffer in place, a chunk at
+        // a time until the source runs dry
+        if (len > INT32_MAX) len = INT32_MAX;
+        size_t size_before = out->node->size;
+        moved = 0;
+        while ((uint32_t)moved < len) {
+            uint32_t chunk = len - (uint32_t)moved < SPLICE_RECV_CHUNK ? len - (uint32_t)moved : SPLICE_RECV_CHUNK;
+            void* target = vfs_file_reserve(out, out_offset, chunk);
+            int got = -1;
+            if (target) {
+                got = in->kind == VFS_FILE_SOCKET
+                    ? netstack_recv(in->socket, target, chunk, 0)
+                    : vfs_file_read(in, target, chunk);
+            }
+            if (got <= 0) {
+                if (got < 0 && moved == 0) moved = -1;
+                break;
+            }
+            vfs_file_commit(out, out_offset, (size_t)got);
+            out_offset += (size_t)got;
+            moved += got;
+            if ((uint32_t)got < chunk) break;
+        }
+        // Reserving past the end zero-fills the gap; nothing came to follow it
+        if (moved <= 0 && out->node->size != size_before) {
+            out->node->size = size_before;
+        }
+        if (moved < 0) return -1;
+        g_zero_copy_bytes += (uint64_t)moved;
+    } else {
+        SYSCALL_TRACE(SYS_splice, "[SYSCALL] splice: one end must be a file\n");
+        return -1;
     }
     
-    // Note: don't free data as it belongs to VFS
-    g_fd_table[fd].data = NULL;
-    g_fd_table[fd].size = 0;
-    g_fd_table[fd].position = 0;
-    g_fd_table[fd].flags = 0;
-    g_fd_table[fd].in_use = 0;
+    if (out_is_file) {
+        if (out_ptr) {
+            *out_ptr = (uint32_t)out_offset;
+        } else {
+            out->position = out_offset;
+        }
+    }
+    return moved;
+}
+
+static void fd_close_ring(VFSFile* file) {
+    io_ring_destroy((IoRing*)file->object);
+}
+
+// io_uring_setup(entries, ring): `ring` is guest memory of
+// IO_RING_BYTES(entries) for the queues; returns an fd for the ring
+int sys_io_uring_setup(uint32_t entries, uint32_t ring_addr, uint32_t arg3, uint32_t arg4, uint32_t arg5) {
+    SYSCALL_TRACE(SYS_io_uring_setup, "[SYSCALL] io_uring_setup(entries=%d, ring=0x%08X)\n", entries, ring_addr);
+    
+    VFSFdTable* fds = current_fds();
+    IoRing* ring = io_ring_create((IoRingShared*)ring_addr, entries, fds);
+    if (!ring) {
+        SYSCALL_TRACE(SYS_io_uring_setup, "[SYSCALL] io_uring_setup: invalid ring\n");
+        return -1;
+    }
     
-    printf("[SYSCALL] close: closed fd=%d\n", fd);
-    return 0;
+    VFSFile* file = vfs_file_object(ring, fd_close_ring);
+    if (!file) {
+        io_ring_destroy(ring);
+        return -1;
+    }
+    int fd = vfs_fd_install(fds, file, 0);
+    if (fd < 0) vfs_file_release(file);
+    return fd;
+}
+
+// Submit up to to_submit queued entries, then with IO_ENTER_GETEVENTS wait
+// until min_complete completions are ready.  Returns entries submitted.
+int sys_io_uring_enter(uint32_t fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags, uint32_t arg5) {
+    SYSCALL_TRACE(SYS_io_uring_enter, "[SYSCALL] io_uring_enter(fd=%d, submit=%d, wait=%d)\n",
+                  fd, to_submit, min_complete);
+    
+    VFSFile* file = fd_get(fd, VFS_FILE_OBJECT);
+    if (!file) return -1;
+    
+    IoRing* ring = (IoRing*)file->object;
+    int submitted = to_submit ? io_ring_submit(ring, to_submit) : 0;
+    if ((flags & IO_ENTER_GETEVENTS) && min_complete > 0) {
+        io_ring_wait(ring, min_complete);
+    }
+    return submitted;
 }
 
 int sys_getpid(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5) {
@@ -248,19 +537,44 @@ int sys_getuid(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint3
     return 0;  // Would get from process structure
 }
 
+// Runs on the clock thread.  SIGALRM's default action ends the process,
+// which frees its address space and files, so that is left to a vCPU.
+static void sys_alarm_expired(KernelTimer* timer, void* arg) {
+    Process* process = (Process*)arg;
+    printf("[SYSCALL] alarm: SIGALRM for PID %d\n", process->pid);
+    process_post_signal(process, PROC_SIG_ALRM);
+}
+
+int sys_alarm(uint32_t seconds, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5) {
+    Process* current = scheduler_get_current_process();
+    if (!current) {
+        SYSCALL_TRACE(SYS_alarm, "[SYSCALL] alarm: no current process\n");
+        return -1;
+    }
+    
+    // A new alarm replaces the old one; report what was left of it
+    uint64_t left_ms = timer_remaining(&current->alarm_timer);
+    timer_cancel(&current->alarm_timer);
+    if (seconds > 0) {
+        timer_setup(&current->alarm_timer, sys_alarm_expired, current);
+        timer_arm(&current->alarm_timer, (uint64_t)seconds * 1000);
+    }
+    return (int)((left_ms + 999) / 1000);
+}
+
 int sys_brk(uint32_t addr, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5) {
-    printf("[SYSCALL] brk(addr=0x%08X)\n", addr);
+    SYSCALL_TRACE(SYS_brk, "[SYSCALL] brk(addr=0x%08X)\n", addr);
     // Would adjust process heap
     return addr;  // Return new break address
 }
 
 int sys_mmap(uint32_t addr, uint32_t length, uint32_t prot, uint32_t flags, uint32_t fd) {
-    printf("[SYSCALL] mmap(addr=0x%08X, length=%d, prot=0x%X, flags=0x%X, fd=%d)\n",
+    SYSCALL_TRACE(SYS_mmap, "[SYSCALL] mmap(addr=0x%08X, length=%d, prot=0x%X, flags=0x%X, fd=%d)\n",
            addr, length, prot, flags, fd);
     
-    // Validate length
-    if (length == 0 || length > memory_get_free()) {
-        printf("[SYSCALL] mmap: invalid length or insufficient memory\n");
+    // Validate length; file mappings take no guest memory
+    if (length == 0 || ((flags & 0x20) && length > memory_get_free())) {
+        SYSCALL_TRACE(SYS_mmap, "[SYSCALL] mmap: invalid length or insufficient memory\n");
         return 0;  // Return NULL
     }
     
@@ -274,14 +588,14 @@ int sys_mmap(uint32_t addr, uint32_t length, uint32_t prot, uint32_t flags, uint
         
         // Check if we have space
         if (mmap_base + aligned_length > 0x60000000) {  // 1.5GB limit
-            printf("[SYSCALL] mmap: address space exhausted\n");
+            SYSCALL_TRACE(SYS_mmap, "[SYSCALL] mmap: address space exhausted\n");
             return 0;
         }
         
         // Map the memory
         void* mapped = memory_map(mmap_base, aligned_length);
         if (!mapped) {
-            printf("[SYSCALL] mmap: mapping failed\n");
+            SYSCALL_TRACE(SYS_mmap, "[SYSCALL] mmap: mapping failed\n");
             return 0;
         }
         
@@ -293,43 +607,81 @@ int sys_mmap(uint32_t addr, uint32_t length, uint32_t prot, uint32_t flags, uint
         uint32_t result = mmap_base;
         mmap_base += aligned_length;
         
-        printf("[SYSCALL] mmap: mapped %d bytes at 0x%08X\n", aligned_length, result);
+        SYSCALL_TRACE(SYS_mmap, "[SYSCALL] mmap: mapped %d bytes at 0x%08X\n", aligned_length, result);
         return result;
     }
     
-    // File-backed mapping
-    if (fd >= 3 && fd < MAX_FDS && g_fd_table[fd].in_use) {
-        FileDescriptor* file = &g_fd_table[fd];
+    VFSFile* file = fd_get(fd, VFS_FILE_NODE);
+    if (file && file->node->data && file->node->size > 0) {
+        VNode* node = file->node;
+        uint32_t map_size = (length < node->size) ? length : (uint32_t)node->size;
+        int writable = (prot & 0x2) != 0;   // PROT_WRITE
+        
+        // Shared or read-only: hand out the node's own buffer, pinned
+        // until munmap, so stores land in the file and nothing is copied
+        if (!writable || (flags & 0x01)) {  // MAP_SHARED
+            if (writable && !vfs_file_writable(file)) return 0;
+            
+            for (int i = 0; i < MAX_FILE_MAPPINGS; i++) {
+                if (g_file_mappings[i].node) continue;
+                
+                uint32_t result = (uint32_t)(uintptr_t)node->data;
+                g_file_mappings[i].addr = result;
+                g_file_mappings[i].length = map_size;
+                g_file_mappings[i].node = node;
+                g_file_mappings[i].writable = writable;
+                node->map_count++;
+                if (writable) node->digest_valid = 0;   // Stores land without a commit
+                
+                SYSCALL_TRACE(SYS_mmap, "[SYSCALL] mmap: mapped %d bytes of %s in place\n",
+                       map_size, file->path);
+                return result;
+            }
+            SYSCALL_TRACE(SYS_mmap, "[SYSCALL] mmap: too many file mappings\n");
+            return 0;
+        }
         
-        // Allocate memory
+        // Private writable mappings get their own copy
         static uint32_t file_mmap_base = 0x30000000;  // Start at 768MB
         
-        uint32_t map_size = (length < file->size) ? length : file->size;
         void* mapped = memory_map(file_mmap_base, map_size);
         
         if (mapped) {
             // Copy file data to mapped region
-            memcpy(mapped, file->data, map_size);
+            memcpy(mapped, node->data, map_size);
             
             uint32_t result = file_mmap_base;
             file_mmap_base += map_size;
             
-            printf("[SYSCALL] mmap: file-backed mapping of %d bytes at 0x%08X\n", 
+            SYSCALL_TRACE(SYS_mmap, "[SYSCALL] mmap: private copy of %d bytes at 0x%08X\n", 
                    map_size, result);
             return result;
         }
     }
     
-    printf("[SYSCALL] mmap: unsupported mapping type\n");
+    SYSCALL_TRACE(SYS_mmap, "[SYSCALL] mmap: unsupported mapping type\n");
     return 0;
 }
 
 int sys_munmap(uint32_t addr, uint32_t length, uint32_t arg3, uint32_t arg4, uint32_t arg5) {
-    printf("[SYSCALL] munmap(addr=0x%08X, length=%d)\n", addr, length);
+    SYSCALL_TRACE(SYS_munmap, "[SYSCALL] munmap(addr=0x%08X, length=%d)\n", addr, length);
+    
+    // In-place file mappings: unpin the node, committing any stores
+    for (int i = 0; i < MAX_FILE_MAPPINGS; i++) {
+        FileMapping* mapping = &g_file_mappings[i];
+        if (!mapping->node || mapping->addr != addr) continue;
+        
+        VNode* node = mapping->node;
+        node->map_count--;
+        int result = mapping->writable ? vfs_sync_node(node) : 0;
+        memset(mapping, 0, sizeof(FileMapping));
+        SYSCALL_TRACE(SYS_munmap, "[SYSCALL] munmap: unmapped %s\n", node->name);
+        return result;
+    }
     
     // Validate address
     if (addr < 0x30000000 || addr >= 0x60000000) {
-        printf("[SYSCALL] munmap: invalid address\n");
+        SYSCALL_TRACE(SYS_munmap, "[SYSCALL] munmap: invalid address\n");
         return -1;
     }
     
@@ -338,68 +690,86 @@ int sys_munmap(uint32_t addr, uint32_t length, uint32_t arg3, uint32_t arg4, uin
     int result = memory_unmap(ptr, length);
     
     if (result == 0) {
-        printf("[SYSCALL] munmap: unmapped %d bytes at 0x%08X\n", length, addr);
+        SYSCALL_TRACE(SYS_munmap, "[SYSCALL] munmap: unmapped %d bytes at 0x%08X\n", length, addr);
     } else {
-        printf("[SYSCALL] munmap: failed to unmap\n");
+        SYSCALL_TRACE(SYS_munmap, "[SYSCALL] munmap: failed to unmap\n");
     }
     
     return result;
 }
 
 int sys_socket(uint32_t domain, uint32_t type, uint32_t protocol, uint32_t arg4, uint32_t arg5) {
-    printf("[SYSCALL] socket(domain=%d, type=%d, protocol=%d)\n", domain, type, protocol);
-    return netstack_socket(domain, type, protocol);
+    SYSCALL_TRACE(SYS_socket, "[SYSCALL] socket(domain=%d, type=%d, protocol=%d)\n", domain, type, protocol);
+    return fd_install_socket(netstack_socket(domain, type, protocol));
 }
 
 int sys_bind(uint32_t sockfd, uint32_t addr, uint32_t addrlen, uint32_t arg4, uint32_t arg5) {
-    printf("[SYSCALL] bind(sockfd=%d, addr=0x%08X, addrlen=%d)\n", sockfd, addr, addrlen);
-    if (!addr) return -1;
-    return netstack_bind(sockfd, (const SocketAddress*)addr);
+    SYSCALL_TRACE(SYS_bind, "[SYSCALL] bind(sockfd=%d, addr=0x%08X, addrlen=%d)\n", sockfd, addr, addrlen);
+    VFSFile* sock = fd_get(sockfd, VFS_FILE_SOCKET);
+    if (!addr || !sock) return -1;
+    return netstack_bind(sock->socket, (const SocketAddress*)addr);
 }
 
 int sys_connect(uint32_t sockfd, uint32_t addr, uint32_t addrlen, uint32_t arg4, uint32_t arg5) {
-    printf("[SYSCALL] connect(sockfd=%d, addr=0x%08X, addrlen=%d)\n", sockfd, addr, addrlen);
-    if (!addr) return -1;
-    return netstack_connect(sockfd, (const SocketAddress*)addr);
+    SYSCALL_TRACE(SYS_connect, "[SYSCALL] connect(sockfd=%d, addr=0x%08X, addrlen=%d)\n", sockfd, addr, addrlen);
+    VFSFile* sock = fd_get(sockfd, VFS_FILE_SOCKET);
+    if (!addr || !sock) return -1;
+    return netstack_connect(sock->socket, (const SocketAddress*)addr);
 }
 
 int sys_listen(uint32_t sockfd, uint32_t backlog, uint32_t arg3, uint32_t arg4, uint32_t arg5) {
-    printf("[SYSCALL] listen(sockfd=%d, backlog=%d)\n", sockfd, backlog);
-    return netstack_listen(sockfd, backlog);
+    SYSCALL_TRACE(SYS_listen, "[SYSCALL] listen(sockfd=%d, backlog=%d)\n", sockfd, backlog);
+    VFSFile* sock = fd_get(sockfd, VFS_FILE_SOCKET);
+    if (!sock) return -1;
+    return netstack_listen(sock->socket, backlog);
 }
 
 int sys_accept(uint32_t sockfd, uint32_t addr, uint32_t addrlen, uint32_t arg4, uint32_t arg5) {
-    printf("[SYSCALL] accept(sockfd=%d)\n", sockfd);
-    return netstack_accept(sockfd, (SocketAddress*)addr);
+    SYSCALL_TRACE(SYS_accept, "[SYSCALL] accept(sockfd=%d)\n", sockfd);
+    VFSFile* sock = fd_get(sockfd, VFS_FILE_SOCKET);
+    if (!sock) return -1;
+    return fd_install_socket(netstack_accept(sock->socket, (SocketAddress*)addr));
 }
 
 int sys_send(uint32_t sockfd, uint32_t buf, uint32_t len, uint32_t flags, uint32_t arg5) {
-    printf("[SYSCALL] send(sockfd=%d, len=%d, flags=%d)\n", sockfd, len, flags);
-    if (!buf) return -1;
-    return netstack_send(sockfd, (const void*)buf, len, flags);
+    SYSCALL_TRACE(SYS_send, "[SYSCALL] send(sockfd=%d, len=%d, flags=%d)\n", sockfd, len, flags);
+    VFSFile* sock = fd_get(sockfd, VFS_FILE_SOCKET);
+    if (!buf || !sock) return -1;
+    return netstack_send(sock->socket, (const void*)buf, len, flags);
 }
 
 int sys_recv(uint32_t sockfd, uint32_t buf, uint32_t len, uint32_t flags, uint32_t arg5) {
-    printf("[SYSCALL] recv(sockfd=%d, len=%d, flags=%d)\n", sockfd, len, flags);
-    if (!buf) return -1;
-    return netstack_recv(sockfd, (void*)buf, len, flags);
+    SYSCALL_TRACE(SYS_recv, "[SYSCALL] recv(sockfd=%d, len=%d, flags=%d)\n", sockfd, len, flags);
+    VFSFile* sock = fd_get(sockfd, VFS_FILE_SOCKET);
+    if (!buf || !sock) return -1;
+    return netstack_recv(sock->socket, (void*)buf, len, flags);
 }
 
 int sys_sendto(uint32_t sockfd, uint32_t buf, uint32_t len, uint32_t flags, uint32_t dest_addr) {
-    printf("[SYSCALL] sendto(sockfd=%d, len=%d, flags=%d)\n", sockfd, len, flags);
-    if (!buf) return -1;
-    return netstack_sendto(sockfd, (const void*)buf, len, (const SocketAddress*)dest_addr, flags);
+    SYSCALL_TRACE(SYS_sendto, "[SYSCALL] sendto(sockfd=%d, len=%d, flags=%d)\n", sockfd, len, flags);
+    VFSFile* sock = fd_get(sockfd, VFS_FILE_SOCKET);
+    if (!buf || !sock) return -1;
+    return netstack_sendto(sock->socket, (const void*)buf, len, (const SocketAddress*)dest_addr, flags);
 }
 
 int sys_recvfrom(uint32_t sockfd, uint32_t buf, uint32_t len, uint32_t flags, uint32_t src_addr) {
-    printf("[SYSCALL] recvfrom(sockfd=%d, len=%d, flags=%d)\n", sockfd, len, flags);
-    if (!buf) return -1;
-    return netstack_recvfrom(sockfd, (void*)buf, len, (SocketAddress*)src_addr, flags);
+    SYSCALL_TRACE(SYS_recvfrom, "[SYSCALL] recvfrom(sockfd=%d, len=%d, flags=%d)\n", sockfd, len, flags);
+    VFSFile* sock = fd_get(sockfd, VFS_FILE_SOCKET);
+    if (!buf || !sock) return -1;
+    return netstack_recvfrom(sock->socket, (void*)buf, len, (SocketAddress*)src_addr, flags);
 }
 
 // Initialize syscall table
 void syscall_table_init(void) {
     memset(g_syscall_table, 0, sizeof(g_syscall_table));
+    memset(g_syscall_trace, 0, sizeof(g_syscall_trace));
+    syscall_reset_stats();
+    
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    g_syscall_qpc_ns = 1e9 / (double)freq.QuadPart;
+    
+    if (!g_kernel_fds) g_kernel_fds = vfs_fdtable_create();
     
     // Register syscall handlers
     g_syscall_table[SYS_exit].handler = sys_exit;
@@ -426,6 +796,46 @@ void syscall_table_init(void) {
     g_syscall_table[SYS_close].name = "close";
     g_syscall_table[SYS_close].arg_count = 1;
     
+    g_syscall_table[SYS_dup].handler = sys_dup;
+    g_syscall_table[SYS_dup].name = "dup";
+    g_syscall_table[SYS_dup].arg_count = 1;
+    
+    g_syscall_table[SYS_dup2].handler = sys_dup2;
+    g_syscall_table[SYS_dup2].name = "dup2";
+    g_syscall_table[SYS_dup2].arg_count = 2;
+    
+    g_syscall_table[SYS_fcntl].handler = sys_fcntl;
+    g_syscall_table[SYS_fcntl].name = "fcntl";
+    g_syscall_table[SYS_fcntl].arg_count = 3;
+    
+    g_syscall_table[SYS_pipe].handler = sys_pipe;
+    g_syscall_table[SYS_pipe].name = "pipe";
+    g_syscall_table[SYS_pipe].arg_count = 1;
+    
+    g_syscall_table[SYS_readv].handler = sys_readv;
+    g_syscall_table[SYS_readv].name = "readv";
+    g_syscall_table[SYS_readv].arg_count = 3;
+    
+    g_syscall_table[SYS_writev].handler = sys_writev;
+    g_syscall_table[SYS_writev].name = "writev";
+    g_syscall_table[SYS_writev].arg_count = 3;
+    
+    g_syscall_table[SYS_sendfile].handler = sys_sendfile;
+    g_syscall_table[SYS_sendfile].name = "sendfile";
+    g_syscall_table[SYS_sendfile].arg_count = 4;
+    
+    g_syscall_table[SYS_splice].handler = sys_splice;
+    g_syscall_table[SYS_splice].name = "splice";
+    g_syscall_table[SYS_splice].arg_count = 5;
+    
+    g_syscall_table[SYS_io_uring_setup].handler = sys_io_uring_setup;
+    g_syscall_table[SYS_io_uring_setup].name = "io_uring_setup";
+    g_syscall_table[SYS_io_uring_setup].arg_count = 2;
+    
+    g_syscall_table[SYS_io_uring_enter].handler = sys_io_uring_enter;
+    g_syscall_table[SYS_io_uring_enter].name = "io_uring_enter";
+    g_syscall_table[SYS_io_uring_enter].arg_count = 4;
+    
     g_syscall_table[SYS_getpid].handler = sys_getpid;
     g_syscall_table[SYS_getpid].name = "getpid";
     g_syscall_table[SYS_getpid].arg_count = 0;
@@ -434,6 +844,10 @@ void syscall_table_init(void) {
     g_syscall_table[SYS_getuid].name = "getuid";
     g_syscall_table[SYS_getuid].arg_count = 0;
     
+    g_syscall_table[SYS_alarm].handler = sys_alarm;
+    g_syscall_table[SYS_alarm].name = "alarm";
+    g_syscall_table[SYS_alarm].arg_count = 1;
+    
     g_syscall_table[SYS_brk].handler = sys_brk;
     g_syscall_table[SYS_brk].name = "brk";
     g_syscall_table[SYS_brk].arg_count = 1;
@@ -482,43 +896,245 @@ void syscall_table_init(void) {
     g_syscall_table[SYS_recvfrom].name = "recvfrom";
     g_syscall_table[SYS_recvfrom].arg_count = 5;
     
-    printf("[SYSCALL_TABLE] Initialized with %d syscalls\n", 21);
+    printf("[SYSCALL_TABLE] Initialized with %d syscalls\n", 31);
+}
+
+static void syscall_account(SyscallStats* stats, int result, int64_t ticks) {
+    uint64_t ns = ticks > 0 ? (uint64_t)((double)ticks * g_syscall_qpc_ns) : 0;
+    uint32_t bucket = ns ? 64 - (uint32_t)__builtin_clzll(ns) : 0;
+    
+    stats->calls++;
+    if (result < 0) stats->errors++;
+    stats->total_ns += ns;
+    if (ns > stats->max_ns) stats->max_ns = ns;
+    stats->buckets[bucket < SYSCALL_LATENCY_BUCKETS ? bucket : SYSCALL_LATENCY_BUCKETS - 1]++;
 }
 
-// Dispatch syscall
+// Dispatch syscall.  The untraced path does no I/O: a table lookup, the
+// handler between two clock reads, the counters, and on the way out a
+// check for a switch the tick asked for.
 int syscall_dispatch(uint32_t syscall_num, uint32_t arg1, uint32_t arg2, 
                      uint32_t arg3, uint32_t arg4, uint32_t arg5) {
-    // Check privilege
-    if (g_privilege_context.current_level != PRIVILEGE_USER) {
-        // Syscalls should be called from user mode
-        // (Kernel mode can call functions directly)
-    }
-    
     // Validate syscall number
     if (syscall_num >= MAX_SYSCALLS) {
-        printf("[SYSCALL] Invalid syscall number: %d\n", syscall_num);
+        g_syscall_invalid++;
         return -1;
     }
     
-    // Check if handler exists
-    if (!g_syscall_table[syscall_num].handler) {
-        printf("[SYSCALL] Unimplemented syscall: %d\n", syscall_num);
+    SyscallTableEntry* entry = &g_syscall_table[syscall_num];
+    SyscallStats* stats = &g_syscall_stats[syscall_num];
+    if (!entry->handler) {
+        SYSCALL_TRACE(syscall_num, "[SYSCALL] Unimplemented syscall: %u\n", syscall_num);
+        syscall_account(stats, -1, 0);
         return -1;
     }
+    SYSCALL_TRACE(syscall_num, "[SYSCALL] Dispatching: %s\n", entry->name);
+    
+    // Switch to kernel mode for calls from user mode, and only then back;
+    // kernel callers stay in kernel mode
+    int from_user = g_privilege_context.current_level == PRIVILEGE_USER;
+    if (from_user) privilege_enter_kernel_mode();
+    
+    LARGE_INTEGER start, end;
+    QueryPerformanceCounter(&start);
+    int result = entry->handler(arg1, arg2, arg3, arg4, arg5);
+    QueryPerformanceCounter(&end);
     
-    // Log syscall (for debugging)
-    if (g_syscall_table[syscall_num].name) {
-        printf("[SYSCALL] Dispatching: %s\n", g_syscall_table[syscall_num].name);
+    if (from_user) privilege_enter_user_mode();
+    
+    syscall_account(stats, result, end.QuadPart - start.QuadPart);
+    if (result < 0) {
+        SYSCALL_TRACE(syscall_num, "[SYSCALL] %s returned %d\n", entry->name, result);
     }
+    scheduler_preempt_point();
+    return result;
+}
+
+void syscall_trace_set(uint32_t syscall_num, int enabled) {
+    if (syscall_num >= MAX_SYSCALLS) return;
     
-    // Switch to kernel mode
-    privilege_enter_kernel_mode();
+    if (enabled) {
+        g_syscall_trace[syscall_num >> 5] |= 1u << (syscall_num & 31);
+    } else {
+        g_syscall_trace[syscall_num >> 5] &= ~(1u << (syscall_num & 31));
+    }
+}
+
+void syscall_trace_all(int enabled) {
+    memset(g_syscall_trace, enabled ? 0xFF : 0, sizeof(g_syscall_trace));
+}
+
+int syscall_is_traced(uint32_t syscall_num) {
+    return syscall_num < MAX_SYSCALLS && SYSCALL_TRACED(syscall_num) != 0;
+}
+
+int syscall_lookup(const char* name) {
+    if (!name) return -1;
     
-    // Call handler
-    int result = g_syscall_table[syscall_num].handler(arg1, arg2, arg3, arg4, arg5);
+    for (int i = 0; i < MAX_SYSCALLS; i++) {
+        if (g_syscall_table[i].name && strcmp(g_syscall_table[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char* syscall_name(uint32_t syscall_num) {
+    return syscall_num < MAX_SYSCALLS ? g_syscall_table[syscall_num].name : NULL;
+}
+
+const SyscallStats* syscall_get_stats(uint32_t syscall_num) {
+    return syscall_num < MAX_SYSCALLS ? &g_syscall_stats[syscall_num] : NULL;
+}
+
+void syscall_reset_stats(void) {
+    memset(g_syscall_stats, 0, sizeof(g_syscall_stats));
+    g_syscall_invalid = 0;
+    g_zero_copy_bytes = 0;
+}
+
+// Upper bound of the bucket holding the given fraction of calls
+static uint64_t syscall_percentile_ns(const SyscallStats* stats, double fraction) {
+    uint64_t target = (uint64_t)((double)stats->calls * fraction);
+    uint64_t seen = 0;
+    for (int i = 0; i < SYSCALL_LATENCY_BUCKETS; i++) {
+        seen += stats->buckets[i];
+        if (seen > target) return 1ull << i;
+    }
+    return 1ull << (SYSCALL_LATENCY_BUCKETS - 1);
+}
+
+void syscall_dump_stats(void) {
+    printf("[SYSCALL] Statistics:\n");
+    printf("  %-5s %-12s %12s %10s %10s %9s %9s %11s %s\n",
+           "Num", "Name", "Calls", "Errors", "Avg ns", "p50 <", "p99 <", "Max ns", "Trace");
+    
+    uint64_t total = 0;
+    for (int i = 0; i < MAX_SYSCALLS; i++) {
+        const SyscallStats* stats = &g_syscall_stats[i];
+        if (stats->calls == 0) continue;
+        
+        printf("  %-5d %-12s %12llu %10llu %10.1f %9llu %9llu %11llu %s\n", i,
+               g_syscall_table[i].name ? g_syscall_table[i].name : "?",
+               (unsigned long long)stats->calls, (unsigned long long)stats->errors,
+               (double)stats->total_ns / (double)stats->calls,
+               (unsigned long long)syscall_percentile_ns(stats, 0.50),
+               (unsigned long long)syscall_percentile_ns(stats, 0.99),
+               (unsigned long long)stats->max_ns, SYSCALL_TRACED(i) ? "on" : "");
+        total += stats->calls;
+    }
+    if (total == 0) {
+        printf("  No syscalls dispatched yet\n");
+    }
+    if (g_syscall_invalid > 0) {
+        printf("  Invalid syscall numbers: %llu\n", (unsigned long long)g_syscall_invalid);
+    }
+    if (g_zero_copy_bytes > 0) {
+        printf("  Bytes moved by sendfile/splice: %llu\n", (unsigned long long)g_zero_copy_bytes);
+    }
+}
+
+void syscall_dump_histogram(uint32_t syscall_num) {
+    const SyscallStats* stats = syscall_get_stats(syscall_num);
+    if (!stats) return;
+    
+    const char* name = g_syscall_table[syscall_num].name;
+    printf("[SYSCALL] %s (%u): %llu calls, %llu errors\n", name ? name : "?", syscall_num,
+           (unsigned long long)stats->calls, (unsigned long long)stats->errors);
+    if (stats->calls == 0) return;
+    
+    uint64_t peak = 0;
+    for (int i = 0; i < SYSCALL_LATENCY_BUCKETS; i++) {
+        if (stats->buckets[i] > peak) peak = stats->buckets[i];
+    }
+    for (int i = 0; i < SYSCALL_LATENCY_BUCKETS; i++) {
+        if (stats->buckets[i] == 0) continue;
+        
+        int width = (int)(stats->buckets[i] * 40 / peak);
+        printf("  < %9llu ns %10llu %.*s\n", 1ull << i, (unsigned long long)stats->buckets[i],
+               width > 0 ? width : 1, "########################################");
+    }
+}
+
+static double syscall_now_seconds(void) {
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+}
+
+// Cost per call of a cheap syscall called directly, through the quiet
+// dispatch path, and traced (logging to the null device), plus the
+// unimplemented-syscall path.  The live counters are left as they were.
+void syscall_benchmark(uint32_t count) {
+    if (count == 0) count = 1000000;
+    
+    SyscallStats* saved = (SyscallStats*)malloc(sizeof(g_syscall_stats));
+    if (!saved) {
+        printf("syscallstat: out of memory\n");
+        return;
+    }
+    memcpy(saved, g_syscall_stats, sizeof(g_syscall_stats));
+    uint64_t saved_invalid = g_syscall_invalid;
+    uint32_t saved_trace[MAX_SYSCALLS / 32];
+    memcpy(saved_trace, g_syscall_trace, sizeof(saved_trace));
+    
+    static const char* const paths[] = { "direct call", "dispatch", "dispatch, traced", "unimplemented" };
+    double seconds[4] = { 0 };
+    volatile int sink = 0;
+    
+    double start = syscall_now_seconds();
+    for (uint32_t i = 0; i < count; i++) {
+        sink += sys_getpid(0, 0, 0, 0, 0);
+    }
+    seconds[0] = syscall_now_seconds() - start;
     
-    // Return to user mode
-    privilege_enter_user_mode();
+    syscall_trace_set(SYS_getpid, 0);
+    start = syscall_now_seconds();
+    for (uint32_t i = 0; i < count; i++) {
+        sink += syscall_dispatch(SYS_getpid, 0, 0, 0, 0, 0);
+    }
+    seconds[1] = syscall_now_seconds() - start;
+    
+    FILE* null_file = fopen("NUL", "w");
+    int traced = null_file != NULL;
+    if (traced) {
+        g_syscall_trace_file = null_file;
+        syscall_trace_set(SYS_getpid, 1);
+        start = syscall_now_seconds();
+        for (uint32_t i = 0; i < count; i++) {
+            sink += syscall_dispatch(SYS_getpid, 0, 0, 0, 0, 0);
+        }
+        seconds[2] = syscall_now_seconds() - start;
+        g_syscall_trace_file = NULL;
+        fclose(null_file);
+    }
     
-    return result;
+    syscall_trace_set(SYS_pause, 0);
+    start = syscall_now_seconds();
+    for (uint32_t i = 0; i < count; i++) {
+        sink += syscall_dispatch(SYS_pause, 0, 0, 0, 0, 0);
+    }
+    seconds[3] = syscall_now_seconds() - start;
+    
+    SyscallStats getpid_stats = g_syscall_stats[SYS_getpid];
+    memcpy(g_syscall_stats, saved, sizeof(g_syscall_stats));
+    g_syscall_invalid = saved_invalid;
+    memcpy(g_syscall_trace, saved_trace, sizeof(saved_trace));
+    free(saved);
+    (void)sink;
+    
+    printf("syscallstat: %u calls per path\n", count);
+    printf("  %-18s %10s %14s\n", "", "ns/call", "calls/s");
+    for (int i = 0; i < 4; i++) {
+        if (i == 2 && !traced) {
+            printf("  %-18s %10s %14s\n", paths[i], "-", "-");
+            continue;
+        }
+        printf("  %-18s %10.1f %14.0f\n", paths[i], seconds[i] * 1e9 / (double)count,
+               seconds[i] > 0 ? (double)count / seconds[i] : 0.0);
+    }
+    printf("  getpid handler time: avg %.1f ns, p99 < %llu ns\n",
+           getpid_stats.calls ? (double)getpid_stats.total_ns / (double)getpid_stats.calls : 0.0,
+           (unsigned long long)syscall_percentile_ns(&getpid_stats, 0.99));
 }
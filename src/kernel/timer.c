@@ -0,0 +1,531 @@
+#include "kernel/timer.h"
+#include "kernel/bench_baselines.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+// Timing wheel.  A pending timer sits in exactly one slot list: level 0
+// if it is due within 64 ticks, otherwise the level whose span holds its
+// distance, in the slot for its expiry at that level's granularity.
+// Crossing a level's slot boundary cascades that slot's timers down.
+// occupied[] has a bit per nonempty slot, so stretches of time with
+// nothing due are skipped rather than stepped through tick by tick.
+#define TIMER_WHEEL_MASK    (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_RANGE   (1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+typedef struct {
+    KernelTimer* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    uint64_t now;               // Everything due at or before this has run
+    uint64_t count;
+    uint64_t armed;
+    uint64_t cancelled;
+    uint64_t fired;
+    uint64_t cascaded;
+} TimerWheel;
+
+static TimerWheel g_wheel;
+static CRITICAL_SECTION g_timer_lock;   // Recursive, so callbacks can use the API
+static int g_timer_initialized = 0;
+static TimerStats g_timer_stats;
+
+// Clock thread
+static HANDLE g_clock_thread = NULL;
+static HANDLE g_clock_event = NULL;
+static volatile LONG g_clock_running = 0;
+static volatile LONG g_clock_sleeping = 0;     // In a sleep longer than a tick
+static volatile uint64_t g_clock_deadline = 0;
+static void (*g_clock_irq)(void) = NULL;
+static int (*g_clock_busy)(void) = NULL;
+static double g_clock_start = 0.0;
+
+static inline uint32_t timer_ctz(uint64_t value) {
+    return (uint32_t)__builtin_ctzll(value);
+}
+
+static double timer_now_seconds(void) {
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+}
+
+// Host time since timer_init(), in ticks
+static uint64_t timer_host_ticks(void) {
+    return (uint64_t)((timer_now_seconds() - g_clock_start) * 1000.0);
+}
+
+static void wheel_insert(TimerWheel* w, KernelTimer* timer) {
+    uint64_t delta = timer->expires > w->now ? timer->expires - w->now : 0;
+    uint32_t level = 0, index;
+
+    if (delta < TIMER_WHEEL_SLOTS) {
+        // Overdue timers (only from a cascade) go in the slot being run
+        index = (uint32_t)((delta ? timer->expires : w->now) & TIMER_WHEEL_MASK);
+    } else {
+        uint64_t expires = timer->expires;
+        if (delta >= TIMER_WHEEL_RANGE) {
+            // Past the top level: park at its far end and cascade again later
+            delta = TIMER_WHEEL_RANGE - 1;
+            expires = w->now + delta;
+        }
+        level = (63 - (uint32_t)__builtin_clzll(delta)) / TIMER_WHEEL_BITS;
+        index = (uint32_t)((expires >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK);
+    }
+
+    KernelTimer** head = &w->slots[level][index];
+    timer->prev = NULL;
+    timer->next = *head;
+    if (*head) (*head)->prev = timer;
+    *head = timer;
+    w->occupied[level] |= 1ull << index;
+    timer->slot = (uint16_t)(level * TIMER_WHEEL_SLOTS + index + 1);
+    w->count++;
+}
+
+static void wheel_unlink(TimerWheel* w, KernelTimer* timer) {
+    uint32_t level = (timer->slot - 1u) / TIMER_WHEEL_SLOTS;
+    uint32_t index = (timer->slot - 1u) % TIMER_WHEEL_SLOTS;
+
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        w->slots[level][index] = timer->next;
+        if (!timer->next) w->occupied[level] &= ~(1ull << index);
+    }
+    if (timer->next) timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+    timer->slot = 0;
+    w->count--;
+}
+
+static void wheel_cascade(TimerWheel* w, uint32_t level, uint32_t index) {
+    KernelTimer* timer = w->slots[level][index];
+    w->slots[level][index] = NULL;
+    w->occupied[level] &= ~(1ull << index);
+
+    while (timer) {
+        KernelTimer* next = timer->next;
+        w->count--;
+        wheel_insert(w, timer);
+        w->cascaded++;
+        timer = next;
+    }
+}
+
+// Advance one tick: cascade any level whose slot boundary this is, then
+// run the level 0 slot.  Returns the number of timers fired.
+static uint64_t wheel_step(TimerWheel* w) {
+    uint64_t now = ++w->now;
+    uint64_t fired = 0;
+
+    for (uint32_t level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        uint32_t shift = level * TIMER_WHEEL_BITS;
+        if (now & ((1ull << shift) - 1)) break;
+        wheel_cascade(w, level, (uint32_t)((now >> shift) & TIMER_WHEEL_MASK));
+    }
+
+    // Callbacks may arm and cancel timers, so take the head each time
+    uint32_t index = (uint32_t)(now & TIMER_WHEEL_MASK);
+    KernelTimer* timer;
+    while ((timer = w->slots[0][index]) != NULL) {
+        wheel_unlink(w, timer);
+        if (timer->period) {
+            timer->expires += timer->period;
+            if (timer->expires <= now) timer->expires = now + timer->period;
+            wheel_insert(w, timer);
+        }
+        w->fired++;
+        fired++;
+        timer->callback(timer, timer->arg);   // A one-shot timer may be freed here
+    }
+    return fired;
+}
+
+static uint64_t wheel_advance(TimerWheel* w, uint64_t target) {
+    uint64_t fired = 0;
+    while (w->now < target) {
+        if (w->count == 0) {
+            w->now = target;
+            break;
+        }
+
+        // Nothing can happen before the next occupied level 0 slot in this
+        // rotation or the next cascade boundary, whichever is first
+        uint64_t base = w->now & ~(uint64_t)TIMER_WHEEL_MASK;
+        uint32_t index = (uint32_t)(w->now & TIMER_WHEEL_MASK);
+        uint64_t ahead = index == TIMER_WHEEL_MASK ? 0 : w->occupied[0] & (~0ull << (index + 1));
+        uint64_t next = ahead ? base + timer_ctz(ahead) : base + TIMER_WHEEL_SLOTS;
+        if (next > target) {
+            w->now = target;
+            break;
+        }
+        w->now = next - 1;
+        fired += wheel_step(w);
+    }
+    return fired;
+}
+
+// Earliest tick at which anything can fire or cascade: exact for level 0,
+// a slot's cascade time above that
+static uint64_t wheel_next_expiry(const TimerWheel* w) {
+    if (w->count == 0) return UINT64_MAX;
+
+    uint64_t best = UINT64_MAX;
+    for (uint32_t level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint64_t occupied = w->occupied[level];
+        if (!occupied) continue;
+
+        uint32_t shift = level * TIMER_WHEEL_BITS;
+        uint64_t position = w->now >> shift;
+        uint32_t current = (uint32_t)(position & TIMER_WHEEL_MASK);
+        uint64_t rotation = position - current;
+        uint64_t ahead = current == TIMER_WHEEL_MASK ? 0 : occupied & (~0ull << (current + 1));
+        uint64_t slot = ahead ? rotation + timer_ctz(ahead)
+                              : rotation + TIMER_WHEEL_SLOTS + timer_ctz(occupied);
+        if ((slot << shift) < best) best = slot << shift;
+    }
+    return best;
+}
+
+int timer_init(void) {
+    if (g_timer_initialized) return 0;
+
+    memset(&g_wheel, 0, sizeof(g_wheel));
+    memset(&g_timer_stats, 0, sizeof(g_timer_stats));
+    InitializeCriticalSection(&g_timer_lock);
+    g_clock_start = timer_now_seconds();
+    g_timer_initialized = 1;
+    return 0;
+}
+
+void timer_cleanup(void) {
+    if (!g_timer_initialized) return;
+
+    timer_stop_clock();
+    EnterCriticalSection(&g_timer_lock);
+    for (uint32_t level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (uint32_t index = 0; index < TIMER_WHEEL_SLOTS; index++) {
+            while (g_wheel.slots[level][index]) {
+                wheel_unlink(&g_wheel, g_wheel.slots[level][index]);
+            }
+        }
+    }
+    LeaveCriticalSection(&g_timer_lock);
+    DeleteCriticalSection(&g_timer_lock);
+    g_timer_initialized = 0;
+}
+
+// The clock thread plays the interval timer.  While the busy check says
+// some CPU has work it raises the IRQ every tick; otherwise it sleeps
+// until the next timer is due (at most TIMER_IDLE_MAX_MS), so an idle VM
+// costs a handful of wakeups a second instead of a thousand.
+static DWORD WINAPI timer_clock_proc(LPVOID param) {
+    (void)param;
+    while (g_clock_running) {
+        g_timer_stats.clock_wakeups++;
+        if (g_clock_irq) {
+            g_clock_irq();
+        } else {
+            timer_advance(timer_host_ticks());
+        }
+
+        uint64_t now = timer_host_ticks();
+        uint64_t wait = 1;
+        if (!(g_clock_busy && g_clock_busy())) {
+            EnterCriticalSection(&g_timer_lock);
+            uint64_t next = wheel_next_expiry(&g_wheel);
+            uint64_t wheel_now = g_wheel.now;
+            LeaveCriticalSection(&g_timer_lock);
+
+            wait = next == UINT64_MAX ? TIMER_IDLE_MAX_MS : next > wheel_now ? next - wheel_now : 1;
+            if (wait > TIMER_IDLE_MAX_MS) wait = TIMER_IDLE_MAX_MS;
+            if (wait > 1) g_timer_stats.idle_sleeps++;
+        }
+
+        g_clock_deadline = now + wait;
+        InterlockedExchange(&g_clock_sleeping, wait > 1);
+        WaitForSingleObject(g_clock_event, (DWORD)wait);
+        InterlockedExchange(&g_clock_sleeping, 0);
+
+        uint64_t slept = timer_host_ticks() - now;
+        if (slept > 1) g_timer_stats.ticks_skipped += slept - 1;
+    }
+    return 0;
+}
+
+int timer_start_clock(void (*irq)(void)) {
+    if (!g_timer_initialized && timer_init() != 0) return -1;
+    if (g_clock_running) return 0;
+
+    g_clock_irq = irq;
+    g_clock_event = CreateEventA(NULL, FALSE, FALSE, NULL);
+    if (!g_clock_event) {
+        printf("[TIMER] Could not create clock event\n");
+        return -1;
+    }
+
+    g_clock_running = 1;
+    g_clock_thread = CreateThread(NULL, 0, timer_clock_proc, NULL, 0, NULL);
+    if (!g_clock_thread) {
+        printf("[TIMER] Could not start clock thread\n");
+        g_clock_running = 0;
+        CloseHandle(g_clock_event);
+        g_clock_event = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void timer_stop_clock(void) {
+    if (!g_clock_running) return;
+
+    g_clock_running = 0;
+    SetEvent(g_clock_event);
+    WaitForSingleObject(g_clock_thread, INFINITE);
+    CloseHandle(g_clock_thread);
+    CloseHandle(g_clock_event);
+    g_clock_thread = NULL;
+    g_clock_event = NULL;
+}
+
+int timer_clock_running(void) {
+    return g_clock_running != 0;
+}
+
+void timer_kick(void) {
+    if (g_clock_sleeping && g_clock_event) {
+        SetEvent(g_clock_event);
+    }
+}
+
+void timer_set_busy_check(int (*busy)(void)) {
+    g_clock_busy = busy;
+}
+
+void timer_setup(KernelTimer* timer, TimerCallback callback, void* arg) {
+    memset(timer, 0, sizeof(KernelTimer));
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+static void timer_arm_at(KernelTimer* timer, uint64_t delay_ms, uint32_t period) {
+    if (!g_timer_initialized || !timer->callback) return;
+    if (delay_ms == 0) delay_ms = 1;
+
+    EnterCriticalSection(&g_timer_lock);
+    if (timer->slot) wheel_unlink(&g_wheel, timer);
+
+    // The wheel lags the host clock while the clock thread sleeps, so
+    // count from whichever is later
+    uint64_t now = timer_host_ticks();
+    if (now < g_wheel.now) now = g_wheel.now;
+    timer->expires = now + delay_ms;
+    timer->period = period;
+    wheel_insert(&g_wheel, timer);
+    g_wheel.armed++;
+    LeaveCriticalSection(&g_timer_lock);
+
+    if (timer->expires < g_clock_deadline) timer_kick();
+}
+
+void timer_arm(KernelTimer* timer, uint64_t delay_ms) {
+    timer_arm_at(timer, delay_ms, 0);
+}
+
+void timer_arm_periodic(KernelTimer* timer, uint32_t period_ms) {
+    timer_arm_at(timer, period_ms, period_ms ? period_ms : 1);
+}
+
+int timer_cancel(KernelTimer* timer) {
+    if (!g_timer_initialized || !timer) return 0;
+
+    // Taking the lock also waits out a callback running on the clock
+    // thread, so the timer can be freed once this returns
+    EnterCriticalSection(&g_timer_lock);
+    int pending = timer->slot != 0;
+    if (pending) {
+        wheel_unlink(&g_wheel, timer);
+        g_wheel.cancelled++;
+    }
+    timer->period = 0;
+    LeaveCriticalSection(&g_timer_lock);
+    return pending;
+}
+
+int timer_pending(const KernelTimer* timer) {
+    return timer && timer->slot != 0;
+}
+
+uint64_t timer_remaining(const KernelTimer* timer) {
+    if (!timer_pending(timer)) return 0;
+
+    uint64_t now = timer_host_ticks();
+    if (now < g_wheel.now) now = g_wheel.now;
+    return timer->expires > now ? timer->expires - now : 0;
+}
+
+uint64_t timer_now(void) {
+    return g_wheel.now;
+}
+
+uint64_t timer_clock_ticks(void) {
+    return g_timer_initialized ? timer_host_ticks() : 0;
+}
+
+uint64_t timer_advance(uint64_t now) {
+    if (!g_timer_initialized) return 0;
+
+    EnterCriticalSection(&g_timer_lock);
+    uint64_t fired = wheel_advance(&g_wheel, now);
+    LeaveCriticalSection(&g_timer_lock);
+    return fired;
+}
+
+uint64_t timer_next_expiry(void) {
+    if (!g_timer_initialized) return UINT64_MAX;
+
+    EnterCriticalSection(&g_timer_lock);
+    uint64_t next = wheel_next_expiry(&g_wheel);
+    LeaveCriticalSection(&g_timer_lock);
+    return next;
+}
+
+TimerStats* timer_get_stats(void) {
+    g_timer_stats.armed = g_wheel.armed;
+    g_timer_stats.cancelled = g_wheel.cancelled;
+    g_timer_stats.fired = g_wheel.fired;
+    g_timer_stats.cascaded = g_wheel.cascaded;
+    g_timer_stats.pending = g_wheel.count;
+    return &g_timer_stats;
+}
+
+void timer_dump_stats(void) {
+    TimerStats* stats = timer_get_stats();
+    printf("[TIMER] Wheel at tick %llu, %llu pending\n",
+           (unsigned long long)g_wheel.now, (unsigned long long)stats->pending);
+    printf("[TIMER] Armed %llu, cancelled %llu, fired %llu, cascaded %llu\n",
+           (unsigned long long)stats->armed, (unsigned long long)stats->cancelled,
+           (unsigned long long)stats->fired, (unsigned long long)stats->cascaded);
+    printf("[TIMER] Clock %s: %llu wakeups, %llu idle sleeps, %llu ticks skipped\n",
+           g_clock_running ? "running" : "stopped",
+           (unsigned long long)stats->clock_wakeups, (unsigned long long)stats->idle_sleeps,
+           (unsigned long long)stats->ticks_skipped);
+}
+
+typedef struct {
+    TimerWheel* wheel;
+    uint64_t fired;
+    uint64_t wrong;             // Fired at a tick other than its expiry
+} TimerBenchContext;
+
+static void timer_bench_fire(KernelTimer* timer, void* arg) {
+    TimerBenchContext* context = (TimerBenchContext*)arg;
+    context->fired++;
+    if (timer->expires != context->wheel->now) context->wrong++;
+}
+
+// Arm `count` timers up to ~17 minutes out, cancel every other one, then
+// run time forward until the rest have fired; the same on a binary heap
+void timer_benchmark(uint32_t count) {
+    if (count == 0) count = 1000000;
+
+    const uint64_t horizon = 1u << 20;
+    TimerWheel* wheel = (TimerWheel*)calloc(1, sizeof(TimerWheel));
+    KernelTimer* timers = (KernelTimer*)calloc(count, sizeof(KernelTimer));
+    uint64_t* delays = (uint64_t*)malloc(count * sizeof(uint64_t));
+    TimerHeap heap;
+    int heap_ok = timer_heap_init(&heap, count) == 0;
+    if (!wheel || !timers || !delays || !heap_ok) {
+        printf("bench timer: out of memory\n");
+        if (heap_ok) timer_heap_destroy(&heap);
+        free(wheel);
+        free(timers);
+        free(delays);
+        return;
+    }
+
+    uint32_t seed = 0x2545F491;
+    for (uint32_t i = 0; i < count; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        delays[i] = 1 + seed % (horizon - 1);
+    }
+
+    TimerBenchContext context = { wheel, 0, 0 };
+    double seconds[2][3];
+
+    double start = timer_now_seconds();
+    for (uint32_t i = 0; i < count; i++) {
+        timers[i].callback = timer_bench_fire;
+        timers[i].arg = &context;
+        timers[i].expires = wheel->now + delays[i];
+        wheel_insert(wheel, &timers[i]);
+    }
+    seconds[0][0] = timer_now_seconds() - start;
+
+    start = timer_now_seconds();
+    for (uint32_t i = 0; i < count; i += 2) {
+        wheel_unlink(wheel, &timers[i]);
+    }
+    seconds[0][1] = timer_now_seconds() - start;
+
+    start = timer_now_seconds();
+    wheel_advance(wheel, horizon);
+    seconds[0][2] = timer_now_seconds() - start;
+    uint64_t expect = count / 2;
+    int wheel_ok = context.fired == expect && context.wrong == 0 && wheel->count == 0;
+    uint64_t cascaded = wheel->cascaded;
+
+    start = timer_now_seconds();
+    for (uint32_t i = 0; i < count; i++) {
+        timer_heap_push(&heap, i, delays[i]);
+    }
+    seconds[1][0] = timer_now_seconds() - start;
+
+    start = timer_now_seconds();
+    for (uint32_t i = 0; i < count; i += 2) {
+        timer_heap_remove(&heap, i);
+    }
+    seconds[1][1] = timer_now_seconds() - start;
+
+    start = timer_now_seconds();
+    uint64_t popped = 0, last = 0, disorder = 0;
+    while (heap.count > 0) {
+        uint32_t id = heap.heap[0];
+        if (heap.expires[id] < last) disorder++;
+        last = heap.expires[id];
+        timer_heap_remove(&heap, id);
+        popped++;
+    }
+    seconds[1][2] = timer_now_seconds() - start;
+    heap_ok = popped == expect && disorder == 0;
+
+    static const char* const phases[] = { "arm", "cancel", "expire" };
+    uint64_t ops[] = { count, (count + 1) / 2, expect };
+    printf("bench timer: %u timers over %llu ticks\n", count, (unsigned long long)horizon);
+    printf("  %-8s %12s %12s %9s\n", "", "Wheel", "Heap", "Speedup");
+    for (int phase = 0; phase < 3; phase++) {
+        printf("  %-8s %9.1f ns %9.1f ns %8.1fx\n", phases[phase],
+               seconds[0][phase] * 1e9 / (double)ops[phase], seconds[1][phase] * 1e9 / (double)ops[phase],
+               seconds[0][phase] > 0 ? seconds[1][phase] / seconds[0][phase] : 0.0);
+    }
+    printf("  Cascades: %llu (%.2f per timer fired)\n", (unsigned long long)cascaded,
+           expect ? (double)cascaded / (double)expect : 0.0);
+    printf("  Checks: wheel %s, heap %s\n", wheel_ok ? "ok" : "FAILED", heap_ok ? "ok" : "FAILED");
+
+    if (g_timer_initialized) {
+        TimerStats* stats = timer_get_stats();
+        uint64_t ticks = timer_host_ticks();
+        printf("  Kernel clock: %llu wakeups in %llu ticks since boot (%llu skipped while idle)\n",
+               (unsigned long long)stats->clock_wakeups, (unsigned long long)ticks,
+               (unsigned long long)stats->ticks_skipped);
+    }
+
+    free(wheel);
+    free(timers);
+    free(delays);
+    timer_heap_destroy(&heap);
+}
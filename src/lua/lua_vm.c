@@ -56,11 +56,13 @@ int lua_vm_vfs_read(lua_State* L) {
                     return 1;
                 }
                 
+                node->capacity = 0;
                 node->data = malloc(size + 1);
                 if (node->data) {
                     fread(node->data, 1, size, f);
                     ((char*)node->data)[size] = '\0';
                     node->size = size;
+                    vfs_account_node(node);
                 }
                 fclose(f);
             }
@@ -104,10 +106,12 @@ int lua_vm_vfs_write(lua_State* L) {
                 free(node->data);
             }
             
+            node->capacity = 0;
             node->data = malloc(strlen(content) + 1);
             if (node->data) {
                 strcpy((char*)node->data, content);
                 node->size = strlen(content);
+                vfs_account_node(node);
                 lua_pushboolean(L, 1);
                 return 1;
             }
@@ -352,11 +356,13 @@ int lua_vm_load_script(const char* vm_path) {
             long size = ftell(f);
             fseek(f, 0, SEEK_SET);
             
+            node->capacity = 0;
             node->data = malloc(size + 1);
             if (node->data) {
                 fread(node->data, 1, size, f);
                 ((char*)node->data)[size] = '\0';
                 node->size = size;
+                vfs_account_node(node);
             }
             fclose(f);
         }
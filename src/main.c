@@ -176,6 +176,7 @@ int main(int argc, char* argv[]) {
     // Check for special command line modes
     int batch_mode = 0;
     const char* game_mode = NULL;
+    int memory_flags = 0;
     
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--batch-mode") == 0) {
@@ -184,6 +185,16 @@ int main(int argc, char* argv[]) {
         } else if (strcmp(argv[i], "--game") == 0 && i + 1 < argc) {
             game_mode = argv[i + 1];
             break;
+        } else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc) {
+            size_t size = memory_parse_size(argv[++i]);
+            if (size == 0) {
+                fprintf(stderr, "Invalid --memory size '%s' (e.g. 512M, 4G; at most 4G)\n", argv[i]);
+                return 1;
+            }
+            memory_configure(size, memory_flags);
+        } else if (strcmp(argv[i], "--large-pages") == 0) {
+            memory_flags |= MEMORY_LARGE_PAGES;
+            memory_configure(memory_configured_size(), memory_flags);
         }
     }
     
@@ -303,9 +314,9 @@ int main(int argc, char* argv[]) {
 
     // Apply resource limits
 #if ZORA_VERBOSE_BOOT
-    printf("Setting memory limit to %d MB...\n", MEMORY_SIZE / (1024 * 1024));
+    printf("Setting memory limit to %zu MB...\n", memory_configured_size() / (1024 * 1024));
 #endif
-    sandbox_set_memory_limit(MEMORY_SIZE);
+    sandbox_set_memory_limit(memory_configured_size());
     sandbox_set_cpu_limit(80); // 80% CPU limit
     
     // Enable strict sandbox mode
@@ -355,11 +366,11 @@ int main(int argc, char* argv[]) {
     }
 
 #if ZORA_VERBOSE_BOOT
-    printf("Initializing memory (%d MB)...\n", MEMORY_SIZE / (1024 * 1024));
+    printf("Initializing memory (%zu MB)...\n", memory_configured_size() / (1024 * 1024));
 #endif
-    Memory* mem = memory_init(MEMORY_SIZE);
+    Memory* mem = memory_init(memory_configured_size());
     if (mem == NULL) {
-        fprintf(stderr, "CRITICAL: Failed to initialize memory (requested %d MB)\n", MEMORY_SIZE / (1024 * 1024));
+        fprintf(stderr, "CRITICAL: Failed to initialize memory (requested %zu MB)\n", memory_configured_size() / (1024 * 1024));
         fprintf(stderr, "This could be due to insufficient system memory or memory limits.\n");
         goto cleanup;
     }
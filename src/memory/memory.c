@@ -3,8 +3,233 @@
 #include <string.h>
 #include <stdint.h>
 #include "memory.h"
+#include "cpu.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#endif
 
 static Memory* vm_memory = NULL;
+static size_t memory_requested_size = MEMORY_SIZE;
+static int memory_requested_flags = 0;
+
+void memory_configure(size_t size, int flags) {
+    if (size == 0) size = MEMORY_SIZE;
+    if (size > MEMORY_MAX_SIZE) size = (size_t)MEMORY_MAX_SIZE;
+    memory_requested_size = (size + 0xFFF) & ~(size_t)0xFFF;
+    memory_requested_flags = flags;
+}
+
+size_t memory_configured_size(void) {
+    return memory_requested_size;
+}
+
+size_t memory_parse_size(const char* text) {
+    if (!text) return 0;
+
+    char* end = NULL;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text) return 0;
+
+    switch (*end) {
+        case 'k': case 'K': value <<= 10; end++; break;
+        case 'g': case 'G': value <<= 30; end++; break;
+        case 'm': case 'M': end++; // fall through
+        case '\0': value <<= 20; break;
+        default: return 0;
+    }
+    if ((*end == 'b' || *end == 'B') && end[1] == '\0') end++;
+    if (*end != '\0' || value == 0 || value > MEMORY_MAX_SIZE) return 0;
+    return (size_t)value;
+}
+
+// ===== Host arenas =====
+//
+// Guest RAM is reserved, never committed up front.  On POSIX hosts the
+// kernel populates a MAP_NORESERVE mapping on first touch by itself.
+// Windows needs a hand: the range is reserved PAGE_NOACCESS and a vectored
+// exception handler commits the 64 KB chunk around any access that faults
+// inside it, then resumes the faulting instruction.  Every pointer into
+// guest RAM (the CPU, the TLB, memory_map() users) keeps working unchanged.
+
+#ifdef _WIN32
+#define MEMORY_MAX_ARENAS 4
+
+static Memory* volatile memory_arenas[MEMORY_MAX_ARENAS];
+static PVOID memory_fault_handle = NULL;
+
+// Commit the chunk holding offset.  Committing twice is harmless; the bit
+// only makes sure the chunk is counted once.
+static int memory_commit_chunk(Memory* mem, size_t offset) {
+    size_t chunk = offset / MEMORY_COMMIT_CHUNK;
+    size_t start = chunk * MEMORY_COMMIT_CHUNK;
+    size_t length = mem->size - start < MEMORY_COMMIT_CHUNK ? mem->size - start : MEMORY_COMMIT_CHUNK;
+
+    if (!VirtualAlloc(mem->data + start, length, MEM_COMMIT, PAGE_READWRITE)) return -1;
+    if (!InterlockedBitTestAndSet(&mem->committed[chunk / 32], (LONG)(chunk % 32))) {
+        InterlockedExchangeAddSizeT((volatile SIZE_T*)&mem->allocated, length);
+    }
+    return 0;
+}
+
+static LONG CALLBACK memory_fault_handler(PEXCEPTION_POINTERS info) {
+    EXCEPTION_RECORD* record = info->ExceptionRecord;
+    if (record->ExceptionCode != EXCEPTION_ACCESS_VIOLATION || record->NumberParameters < 2) {
+        return EXCEPTION_CONTINUE_SEARCH;
+    }
+
+    uintptr_t address = (uintptr_t)record->ExceptionInformation[1];
+    for (int i = 0; i < MEMORY_MAX_ARENAS; i++) {
+        Memory* mem = memory_arenas[i];
+        if (!mem || !mem->committed) continue;
+        uintptr_t base = (uintptr_t)mem->data;
+        if (address < base || address - base >= mem->size) continue;
+        return memory_commit_chunk(mem, address - base) == 0 ? EXCEPTION_CONTINUE_EXECUTION
+                                                              : EXCEPTION_CONTINUE_SEARCH;
+    }
+    return EXCEPTION_CONTINUE_SEARCH;
+}
+
+// Large pages need SeLockMemoryPrivilege in the process token
+static int memory_enable_large_pages(void) {
+    HANDLE token;
+    TOKEN_PRIVILEGES privileges;
+
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) return 0;
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    int ok = LookupPrivilegeValueA(NULL, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid) &&
+             AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL) &&
+             GetLastError() == ERROR_SUCCESS;
+    CloseHandle(token);
+    return ok;
+}
+
+static int memory_reserve(Memory* mem, size_t size, int flags) {
+    SIZE_T large = GetLargePageMinimum();
+
+    // Large pages cannot be committed lazily: all or nothing, up front
+    if ((flags & MEMORY_LARGE_PAGES) && large && memory_enable_large_pages()) {
+        size_t rounded = (size + large - 1) & ~(size_t)(large - 1);
+        mem->data = VirtualAlloc(NULL, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (mem->data) {
+            mem->large_pages = 1;
+            mem->allocated = rounded;
+            return 0;
+        }
+        printf("memory: large pages unavailable (error %lu), committing on demand instead\n", GetLastError());
+    }
+
+    size_t chunks = (size + MEMORY_COMMIT_CHUNK - 1) / MEMORY_COMMIT_CHUNK;
+    mem->committed = calloc((chunks + 31) / 32, sizeof(long));
+    mem->data = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+    if (!mem->committed || !mem->data) {
+        free((void*)mem->committed);
+        mem->committed = NULL;
+        if (mem->data) VirtualFree(mem->data, 0, MEM_RELEASE);
+        mem->data = NULL;
+        return -1;
+    }
+
+    if (!memory_fault_handle) memory_fault_handle = AddVectoredExceptionHandler(1, memory_fault_handler);
+    for (int i = 0; i < MEMORY_MAX_ARENAS; i++) {
+        if (!memory_arenas[i]) {
+            memory_arenas[i] = mem;
+            return 0;
+        }
+    }
+
+    printf("memory: too many guest RAM arenas\n");
+    VirtualFree(mem->data, 0, MEM_RELEASE);
+    free((void*)mem->committed);
+    mem->data = NULL;
+    mem->committed = NULL;
+    return -1;
+}
+
+static void memory_release(Memory* mem) {
+    for (int i = 0; i < MEMORY_MAX_ARENAS; i++) {
+        if (memory_arenas[i] == mem) memory_arenas[i] = NULL;
+    }
+    if (mem->data) VirtualFree(mem->data, 0, MEM_RELEASE);
+    free((void*)mem->committed);
+    mem->data = NULL;
+    mem->committed = NULL;
+}
+
+static size_t memory_committed_bytes(const Memory* mem) {
+    return mem->allocated;
+}
+
+size_t memory_get_host_resident(void) {
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return counters.WorkingSetSize;
+}
+
+static double memory_now_seconds(void) {
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+}
+
+#else
+
+static int memory_reserve(Memory* mem, size_t size, int flags) {
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (data == MAP_FAILED) return -1;
+    mem->data = data;
+#ifdef MADV_HUGEPAGE
+    // Transparent huge pages stay demand-populated, just 2 MB at a time
+    if ((flags & MEMORY_LARGE_PAGES) && madvise(data, size, MADV_HUGEPAGE) == 0) mem->large_pages = 1;
+#endif
+    return 0;
+}
+
+static void memory_release(Memory* mem) {
+    if (mem->data) munmap(mem->data, mem->size);
+    mem->data = NULL;
+}
+
+// The kernel does the committing, so ask it which pages are resident
+static size_t memory_committed_bytes(const Memory* mem) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t resident = 0;
+    unsigned char vector[4096];
+
+    for (size_t offset = 0; offset < mem->size; offset += sizeof(vector) * page) {
+        size_t length = mem->size - offset;
+        if (length > sizeof(vector) * page) length = sizeof(vector) * page;
+        if (mincore(mem->data + offset, length, vector) != 0) return mem->allocated;
+        for (size_t i = 0; i < (length + page - 1) / page; i++) {
+            if (vector[i] & 1) resident += page;
+        }
+    }
+    return resident;
+}
+
+size_t memory_get_host_resident(void) {
+    unsigned long pages_total = 0, pages_resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (!statm) return 0;
+    int fields = fscanf(statm, "%lu %lu", &pages_total, &pages_resident);
+    fclose(statm);
+    return fields == 2 ? (size_t)pages_resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+}
+
+static double memory_now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+#endif
 
 Memory* memory_init(size_t size) {
     // Check if already initialized
@@ -14,48 +239,42 @@ Memory* memory_init(size_t size) {
 #endif
         return vm_memory;
     }
-    
+
+    if (size == 0 || size > MEMORY_MAX_SIZE) {
+        fprintf(stderr, "Invalid VM memory size: %zu bytes\n", size);
+        return NULL;
+    }
+
     // Allocate memory structure
-    vm_memory = malloc(sizeof(Memory));
+    vm_memory = calloc(1, sizeof(Memory));
     if (!vm_memory) {
         fprintf(stderr, "Failed to allocate memory structure\n");
         return NULL;
     }
-    
-    // Initialize the memory structure
-    vm_memory->size = size;
-    vm_memory->allocated = 0;
-    vm_memory->initialized = 0;
-    
-    // Allocate the actual memory buffer
+
+    // Reserve the guest RAM; pages arrive zeroed when first touched
 #if ZORA_VERBOSE_BOOT
-    printf("Allocating %zu bytes (%zu MB) for VM memory...\n", size, size / (1024 * 1024));
+    printf("Reserving %zu bytes (%zu MB) for VM memory...\n", size, size / (1024 * 1024));
 #endif
-    vm_memory->data = malloc(size);
-    if (!vm_memory->data) {
-        fprintf(stderr, "Failed to allocate %zu bytes for VM memory\n", size);
+    vm_memory->size = size;
+    if (memory_reserve(vm_memory, size, memory_requested_flags) != 0) {
+        fprintf(stderr, "Failed to reserve %zu bytes for VM memory\n", size);
         free(vm_memory);
         vm_memory = NULL;
         return NULL;
     }
-    
-    // Initialize memory to zero
-    memset(vm_memory->data, 0, size);
-    vm_memory->allocated = size;
     vm_memory->initialized = 1;
-    
+
 #if ZORA_VERBOSE_BOOT
-    printf("Memory initialized successfully: %zu MB allocated\n", size / (1024 * 1024));
+    printf("Memory initialized successfully: %zu MB reserved%s\n", size / (1024 * 1024),
+           vm_memory->large_pages ? " (large pages)" : "");
 #endif
     return vm_memory;
 }
 
 void memory_cleanup(void) {
     if (vm_memory) {
-        if (vm_memory->data) {
-            free(vm_memory->data);
-            vm_memory->data = NULL;
-        }
+        memory_release(vm_memory);
         free(vm_memory);
         vm_memory = NULL;
         printf("Memory cleaned up\n");
@@ -74,6 +293,7 @@ void memory_write(uint32_t address, uint8_t value) {
         return;
     }
     vm_memory->data[address] = value;
+    cpu_invalidate_code(address, 1);
 }
 
 int memory_read_block(uint32_t address, uint8_t* buffer, size_t size) {
@@ -89,6 +309,8 @@ int memory_write_block(uint32_t address, const uint8_t* buffer, size_t size) {
         return -1;
     }
     memcpy(vm_memory->data + address, buffer, size);
+    // Anything the CPU translated from this range is stale now
+    cpu_invalidate_code(address, (uint32_t)size);
     return 0;
 }
 
@@ -142,9 +364,70 @@ size_t memory_get_total(void) {
 }
 
 size_t memory_get_used(void) {
-    return vm_memory ? vm_memory->allocated : 0;
+    if (!vm_memory) return 0;
+    size_t used = memory_committed_bytes(vm_memory);
+    return used < vm_memory->size ? used : vm_memory->size;
 }
 
 size_t memory_get_free(void) {
-    return vm_memory ? (vm_memory->size - vm_memory->allocated) : 0;
-}
\ No newline at end of file
+    return vm_memory ? (vm_memory->size - memory_get_used()) : 0;
+}
+
+static size_t memory_grown(size_t before) {
+    size_t now = memory_get_host_resident();
+    return now > before ? now - before : 0;
+}
+
+// Boot cost of guest RAM: reserving a lazy arena of the given size against
+// the old malloc + memset of MEMORY_SIZE, then what touching it costs
+void memory_boot_benchmark(size_t size) {
+    if (size == 0) size = (size_t)MEMORY_MAX_SIZE;
+    if (size > MEMORY_MAX_SIZE) size = (size_t)MEMORY_MAX_SIZE;
+
+    size_t rss_start = memory_get_host_resident();
+    double start = memory_now_seconds();
+    uint8_t* volatile eager = malloc(MEMORY_SIZE);   // volatile: keep the memset
+    if (!eager) {
+        printf("bench mem: out of memory\n");
+        return;
+    }
+    memset(eager, 0, MEMORY_SIZE);
+    double eager_seconds = memory_now_seconds() - start;
+    size_t eager_rss = memory_grown(rss_start);
+    free(eager);
+
+    Memory arena;
+    memset(&arena, 0, sizeof(arena));
+    arena.size = size;
+    rss_start = memory_get_host_resident();
+    start = memory_now_seconds();
+    // Always the lazy path, whatever --large-pages asked for: large pages
+    // are committed up front, which here would be the whole arena
+    if (memory_reserve(&arena, size, 0) != 0) {
+        printf("bench mem: could not reserve %zu MB\n", size >> 20);
+        return;
+    }
+    double reserve_seconds = memory_now_seconds() - start;
+    size_t reserve_rss = memory_grown(rss_start);
+
+    // First touch of one byte every 16 MB, like a guest scattering allocations
+    uint32_t touches = 0;
+    start = memory_now_seconds();
+    for (size_t offset = 0; offset < size; offset += 16u << 20) {
+        arena.data[offset] = (uint8_t)offset | 1;
+        touches++;
+    }
+    double touch_seconds = memory_now_seconds() - start;
+    size_t touch_rss = memory_grown(rss_start);
+    size_t committed = memory_committed_bytes(&arena);
+    memory_release(&arena);
+
+    printf("bench mem: guest RAM boot cost\n");
+    printf("  Eager %4zu MB malloc+memset: %8.3f ms, host RSS +%zu MB\n",
+           (size_t)MEMORY_SIZE >> 20, eager_seconds * 1000.0, eager_rss >> 20);
+    printf("  Lazy %5zu MB reserve:       %8.3f ms, host RSS +%zu KB\n",
+           size >> 20, reserve_seconds * 1000.0, reserve_rss >> 10);
+    printf("  First touch of %u pages:     %8.3f ms (%.1f us each), %zu KB committed, host RSS +%zu KB\n",
+           touches, touch_seconds * 1000.0, touches ? touch_seconds * 1e6 / touches : 0.0,
+           committed >> 10, touch_rss >> 10);
+}
@@ -6,6 +6,7 @@
 #include "shell.h"  // Include MERL shell header
 #include "vfs.h"    // Include VFS header
 #include "syscall.h" // Include syscall header
+#include "kernel/scheduler.h"
 
 merl_vm_context_t* g_merl_vm_ctx = NULL;
 
@@ -76,8 +77,10 @@ int merl_cmd_vmstat(void) {
 int merl_cmd_cpuinfo(void) {
     printf("=== CPU Information ===\n");
     printf("Architecture: Zora Virtual CPU\n");
-    printf("Cores: 1\n");
+    printf("Cores: %u\n", scheduler_cpu_count());
     printf("Speed: Variable\n");
+    printf("\n");
+    scheduler_print_cpu_stats();
     return 0;
 }
 
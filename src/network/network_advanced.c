@@ -7,6 +7,7 @@
 #include <iphlpapi.h>
 #include <icmpapi.h>
 #include "network/network_advanced.h"
+#include "kernel/net_route.h"
 
 #pragma comment(lib, "ws2_32.lib")
 #pragma comment(lib, "iphlpapi.lib")
@@ -25,6 +26,8 @@ int advanced_network_init(void) {
     net_state = calloc(1, sizeof(AdvancedNetworkState));
     if (!net_state) {
         printf("Failed to allocate network state\n");
+        free(net_state);
+        net_state = NULL;
         return -1;
     }
     
@@ -56,10 +59,7 @@ int advanced_network_init(void) {
     network_add_dns_server("8.8.4.4");
     network_add_dns_server("1.1.1.1");
     
-    // Set up default routing
-    network_set_default_route("10.0.2.1", "eth0");
-    network_add_route("127.0.0.0", "127.0.0.1", "255.0.0.0", "lo", 0);
-    network_add_route("10.0.2.0", "0.0.0.0", "255.255.255.0", "eth0", 0);
+    // Default routes come with the network stack's routing table
     
     // Initialize security settings
     net_state->firewall_enabled = 1;
@@ -84,7 +84,7 @@ int advanced_network_init(void) {
     printf("Advanced Network Stack initialized successfully\n");
     printf("Network Configuration:\n");
     printf("  Interfaces: %d\n", net_state->interface_count);
-    printf("  Routes: %d\n", net_state->route_count);
+    printf("  Routes: %u\n", netstack_route_count());
     printf("  DNS Servers: %d\n", net_state->dns_server_count);
     printf("  Firewall: %s\n", net_state->firewall_enabled ? "ENABLED" : "DISABLED");
     printf("  Namespace: %s\n", net_state->namespace_name);
@@ -222,33 +222,37 @@ void network_show_interface_details(const char* name) {
            iface->tx_packets, iface->tx_bytes, iface->tx_errors);
 }
 
-// Routing functions
+// Routing functions.  There is one routing table, the network stack's,
+// so routes added here are the ones sockets use and the other way round.
+// The stack picks a route's interface from its gateway or destination.
+static int route_parse(const char* text, uint32_t* addr) {
+    struct in_addr in;
+    if (inet_pton(AF_INET, text, &in) != 1) return -1;
+    *addr = ntohl(in.s_addr);
+    return 0;
+}
+
+static void route_format(uint32_t addr, char* text, size_t size) {
+    struct in_addr in;
+    in.s_addr = htonl(addr);
+    inet_ntop(AF_INET, &in, text, size);
+}
+
+// `iface` is only a hint; the network stack picks the interface itself
 int network_add_route(const char* dest, const char* gateway, const char* netmask, const char* iface, int metric) {
-    if (!net_state || net_state->route_count >= MAX_ROUTES) {
+    (void)iface;
+    if (!net_state) {
         return -1;
     }
     
-    RouteEntry* route = &net_state->routes[net_state->route_count];
-    
-    strncpy(route->destination, dest, sizeof(route->destination) - 1);
-    route->destination[sizeof(route->destination) - 1] = '\0';
-    
-    strncpy(route->gateway, gateway, sizeof(route->gateway) - 1);
-    route->gateway[sizeof(route->gateway) - 1] = '\0';
-    
-    strncpy(route->netmask, netmask, sizeof(route->netmask) - 1);
-    route->netmask[sizeof(route->netmask) - 1] = '\0';
-    
-    strncpy(route->iface, iface, sizeof(route->iface) - 1);
-    route->iface[sizeof(route->iface) - 1] = '\0';
-    
-    route->metric = metric;
-    route->is_default = (strcmp(dest, "0.0.0.0") == 0);
-    
-    net_state->route_count++;
-    printf("Added route: %s/%s via %s dev %s metric %d\n", 
-           dest, netmask, gateway, iface, metric);
+    uint32_t dest_addr, gateway_addr, mask;
+    if (route_parse(dest, &dest_addr) < 0 || route_parse(gateway, &gateway_addr) < 0 ||
+        route_parse(netmask, &mask) < 0 || netstack_route_add(dest_addr, mask, gateway_addr, metric) != 0) {
+        printf("Invalid route: %s/%s via %s\n", dest, netmask, gateway);
+        return -1;
+    }
     
+    printf("Added route: %s/%s via %s metric %d\n", dest, netmask, gateway, metric);
     return 0;
 }
 
@@ -256,6 +260,18 @@ int network_set_default_route(const char* gateway, const char* iface) {
     return network_add_route("0.0.0.0", gateway, "0.0.0.0", iface, 100);
 }
 
+static void show_route(const NetRoute* route, void* arg) {
+    char destination[16], gateway[16], netmask[16];
+    (void)arg;
+    route_format(route->dest, destination, sizeof(destination));
+    route_format(route->gateway, gateway, sizeof(gateway));
+    route_format(route->mask, netmask, sizeof(netmask));
+    
+    printf("%-15s %-15s %-15s %-5s %-6d %-6d %-6d %s\n",
+           destination, gateway, netmask,
+           route->gateway ? "UG" : "U", route->metric, 0, 0, route->iface);
+}
+
 void network_show_routing_table(void) {
     if (!net_state) {
         printf("Network not initialized\n");
@@ -264,18 +280,25 @@ void network_show_routing_table(void) {
     
     printf("Kernel IP routing table\n");
     printf("Destination     Gateway         Genmask         Flags Metric Ref    Use Iface\n");
-    
-    for (int i = 0; i < net_state->route_count; i++) {
-        RouteEntry* route = &net_state->routes[i];
-        char flags[8] = "";
-        
-        if (route->is_default) strcat(flags, "UG");
-        else strcat(flags, "U");
-        
-        printf("%-15s %-15s %-15s %-5s %-6d %-6d %-6d %s\n",
-               route->destination, route->gateway, route->netmask,
-               flags, route->metric, 0, 0, route->iface);
+    netstack_route_walk(show_route, NULL);
+}
+
+// Longest-prefix match for a destination address
+int network_find_route(const char* destination, RouteEntry* route) {
+    uint32_t addr;
+    NetRoute found;
+    if (!net_state || !route || route_parse(destination, &addr) < 0 || netstack_route_lookup(addr, &found) != 0) {
+        return -1;
     }
+    
+    memset(route, 0, sizeof(*route));
+    route_format(found.dest, route->destination, sizeof(route->destination));
+    route_format(found.gateway, route->gateway, sizeof(route->gateway));
+    route_format(found.mask, route->netmask, sizeof(route->netmask));
+    strncpy(route->iface, found.iface, sizeof(route->iface) - 1);
+    route->metric = found.metric;
+    route->is_default = found.mask == 0;
+    return 0;
 }
 
 // Real socket operations
@@ -591,7 +614,19 @@ void network_show_listening_ports(void) {
     printf("443     TCP       httpd\n");
 }
 
+// Removes the most specific route for the network address `dest`, if it
+// goes through `gateway`
 int network_remove_route(const char* dest, const char* gateway) {
+    uint32_t dest_addr, gateway_addr;
+    if (!net_state || route_parse(dest, &dest_addr) < 0 || route_parse(gateway, &gateway_addr) < 0) {
+        printf("Invalid route: %s via %s\n", dest, gateway);
+        return -1;
+    }
+    
+    if (netstack_route_remove(dest_addr, gateway_addr) != 0) {
+        printf("No route to %s via %s\n", dest, gateway);
+        return -1;
+    }
     printf("Removing route: %s via %s\n", dest, gateway);
     return 0;
 }
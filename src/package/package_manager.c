@@ -4,6 +4,7 @@
 #include <time.h>
 #include "package/package_manager.h"
 #include "vfs/vfs.h"
+#include "system/hash.h"
 
 static PackageManager* pm_state = NULL;
 
@@ -190,6 +191,9 @@ int package_manager_init(void) {
 void package_manager_cleanup(void) {
     if (pm_state) {
         printf("Cleaning up package manager...\n");
+        for (int i = 0; i < pm_state->package_count; i++) {
+            free(pm_state->packages[i].installed_digests);
+        }
         free(pm_state);
         pm_state = NULL;
     }
@@ -389,6 +393,45 @@ int pm_list_installed_packages(void) {
 }
 
 // Package installation simulation
+static PackageInfo* pm_find_package(const char* package_name) {
+    for (int i = 0; i < pm_state->package_count; i++) {
+        if (strcmp(pm_state->packages[i].name, package_name) == 0) {
+            return &pm_state->packages[i];
+        }
+    }
+    return NULL;
+}
+
+// Hash the installed files in one parallel batch; digests[i]/results[i] line up with installed_files
+static int pm_hash_installed_files(PackageInfo* pkg, HashDigest* digests, int* results) {
+    const char* paths[256];
+    for (int i = 0; i < pkg->installed_file_count; i++) {
+        paths[i] = pkg->installed_files[i];
+    }
+    return hash_files(paths, pkg->installed_file_count, HASH_SHA256, digests, results, 0);
+}
+
+// Remember what each installed file looked like so integrity checks have a reference
+static void pm_record_file_digests(PackageInfo* pkg) {
+    HashDigest digests[256];
+    int results[256];
+    
+    free(pkg->installed_digests);
+    pkg->installed_digests = NULL;
+    if (pkg->installed_file_count <= 0) return;
+    
+    pkg->installed_digests = calloc(pkg->installed_file_count, sizeof(InstalledFileDigest));
+    if (!pkg->installed_digests) return;
+    
+    pm_hash_installed_files(pkg, digests, results);
+    for (int i = 0; i < pkg->installed_file_count; i++) {
+        if (results[i] == 0) {
+            memcpy(pkg->installed_digests[i].sha256, digests[i].sha256, HASH_SHA256_SIZE);
+            pkg->installed_digests[i].hashed = 1;
+        }
+    }
+}
+
 int pm_install_package(const char* package_name) {
     if (!pm_state) {
         printf("Package manager not initialized\n");
@@ -463,6 +506,7 @@ int pm_install_package(const char* package_name) {
     sprintf(pkg->installed_files[1], "/usr/local/lib/lib%s.so", pkg->name);
     sprintf(pkg->installed_files[2], "/usr/local/share/%s/README", pkg->name);
     pkg->installed_file_count = 3;
+    pm_record_file_digests(pkg);
     
     pm_state->total_packages_installed++;
     pm_state->total_installed_size += pkg->size_installed;
@@ -533,6 +577,8 @@ int pm_remove_package(const char* package_name) {
     pm_state->total_packages_installed--;
     pm_state->total_installed_size -= pkg->size_installed;
     pkg->installed_file_count = 0;
+    free(pkg->installed_digests);
+    pkg->installed_digests = NULL;
     
     printf("\nPackage '%s' removed successfully!\n", package_name);
     
@@ -675,7 +721,59 @@ int pm_create_package(const char* source_dir, const char* package_name, const ch
 }
 
 int pm_verify_package_integrity(const char* package_name) {
+    if (!pm_state) {
+        printf("Package manager not initialized\n");
+        return -1;
+    }
+    
+    PackageInfo* pkg = pm_find_package(package_name);
+    if (!pkg) {
+        printf("Package '%s' not found\n", package_name);
+        return -1;
+    }
+    if (pkg->status != PKG_INSTALLED) {
+        printf("Package '%s' is not installed\n", package_name);
+        return -1;
+    }
+    
     printf("Verifying package integrity: %s\n", package_name);
+    
+    HashDigest digests[256];
+    int results[256];
+    int ok = 0, modified = 0, missing = 0, unrecorded = 0;
+    
+    if (pkg->installed_file_count > 0) {
+        pm_hash_installed_files(pkg, digests, results);
+    }
+    
+    for (int i = 0; i < pkg->installed_file_count; i++) {
+        const char* path = pkg->installed_files[i];
+        const InstalledFileDigest* recorded = pkg->installed_digests ? &pkg->installed_digests[i] : NULL;
+        int hashed = recorded && recorded->hashed;
+        if (results[i] != 0) {
+            if (hashed) {
+                printf("  MISSING   %s\n", path);
+                missing++;
+            } else {
+                unrecorded++;
+            }
+        } else if (!hashed) {
+            printf("  UNTRACKED %s (no digest recorded at install)\n", path);
+            unrecorded++;
+        } else if (memcmp(digests[i].sha256, recorded->sha256, HASH_SHA256_SIZE) != 0) {
+            printf("  MODIFIED  %s\n", path);
+            modified++;
+        } else {
+            ok++;
+        }
+    }
+    
+    printf("%d OK, %d modified, %d missing, %d without a recorded digest\n",
+           ok, modified, missing, unrecorded);
+    if (modified > 0 || missing > 0) {
+        printf("Package integrity check FAILED\n");
+        return -1;
+    }
     printf("Package integrity OK\n");
     return 0;
 }
@@ -693,7 +791,24 @@ int pm_which_package_owns_file(const char* filepath) {
 }
 
 int pm_audit_installed_packages(void) {
+    if (!pm_state) {
+        printf("Package manager not initialized\n");
+        return -1;
+    }
+    
     printf("Auditing installed packages...\n");
+    int failed = 0;
+    for (int i = 0; i < pm_state->package_count; i++) {
+        if (pm_state->packages[i].status != PKG_INSTALLED) continue;
+        if (pm_verify_package_integrity(pm_state->packages[i].name) != 0) {
+            failed++;
+        }
+    }
+    
+    if (failed > 0) {
+        printf("%d package%s failed verification\n", failed, failed == 1 ? "" : "s");
+        return -1;
+    }
     printf("All packages verified successfully\n");
     return 0;
 }
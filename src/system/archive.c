@@ -0,0 +1,1444 @@
+#include "system/archive.h"
+#include "vfs/vfs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define ARCHIVE_IO_CHUNK (64 * 1024)
+#define TAR_BLOCK 512
+
+// ===== Shared helpers =====
+
+static void archive_join_path(char* out, size_t size, const char* base_dir, const char* name) {
+    if (name[0] == '/' || !base_dir || base_dir[0] == '\0') {
+        snprintf(out, size, "%s", name);
+    } else if (strcmp(base_dir, "/") == 0) {
+        snprintf(out, size, "/%s", name);
+    } else {
+        snprintf(out, size, "%s/%s", base_dir, name);
+    }
+
+    // Drop trailing slashes (but keep "/")
+    size_t len = strlen(out);
+    while (len > 1 && out[len - 1] == '/') {
+        out[--len] = '\0';
+    }
+}
+
+// Reject absolute member names and parent-directory escapes
+static int archive_member_is_safe(const char* name) {
+    if (!name[0] || name[0] == '/' || name[0] == '\\') return 0;
+
+    const char* p = name;
+    while (*p) {
+        const char* end = strpbrk(p, "/\\");
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len == 2 && p[0] == '.' && p[1] == '.') return 0;
+        if (!end) break;
+        p = end + 1;
+    }
+    return 1;
+}
+
+// A symlink stored as `member` may point anywhere inside the tree being
+// extracted: relative, and never climbing above the extraction directory
+// from the link's own directory
+static int archive_link_is_safe(const char* member, const char* target) {
+    if (!target[0] || target[0] == '/' || target[0] == '\\') return 0;
+
+    int depth = 0;
+    for (const char* p = member; (p = strpbrk(p, "/\\")) != NULL; p++) {
+        depth++;
+    }
+
+    const char* p = target;
+    while (*p) {
+        const char* end = strpbrk(p, "/\\");
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len == 2 && p[0] == '.' && p[1] == '.') {
+            if (--depth < 0) return 0;
+        } else if (len > 0 && !(len == 1 && p[0] == '.')) {
+            depth++;
+        }
+        if (!end) break;
+        p = end + 1;
+    }
+    return 1;
+}
+
+// mkdir -p inside the VFS
+static int archive_make_dirs(const char* path) {
+    char partial[512];
+    size_t len = strlen(path);
+    if (len >= sizeof(partial)) return -1;
+
+    for (size_t i = 1; i <= len; i++) {
+        if (path[i] == '/' || path[i] == '\0') {
+            memcpy(partial, path, i);
+            partial[i] = '\0';
+
+            VNode* node = vfs_find_node(partial);
+            if (!node) {
+                if (vfs_mkdir(partial) != 0) return -1;
+            } else if (!node->is_directory) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int archive_make_parent_dirs(const char* path) {
+    char parent[512];
+    snprintf(parent, sizeof(parent), "%s", path);
+
+    char* slash = strrchr(parent, '/');
+    if (!slash || slash == parent) return 0;
+    *slash = '\0';
+    return archive_make_dirs(parent);
+}
+
+static void put16(unsigned char* p, uint32_t v) {
+    p[0] = (unsigned char)(v & 0xFF);
+    p[1] = (unsigned char)((v >> 8) & 0xFF);
+}
+
+static void put32(unsigned char* p, uint32_t v) {
+    put16(p, v & 0xFFFF);
+    put16(p + 2, v >> 16);
+}
+
+static uint32_t get16(const unsigned char* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+static uint32_t get32(const unsigned char* p) {
+    return get16(p) | (get16(p + 2) << 16);
+}
+
+static double archive_now_seconds(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+// ===== Parallel gzip (pigz-style) =====
+//
+// Input is cut into fixed-size blocks that are deflated independently, each
+// primed with the preceding 32 KB as a dictionary so the ratio stays close to
+// a single-stream deflate.  Every block but the last ends with a sync flush,
+// which byte-aligns the output, so the compressed blocks can simply be
+// concatenated.  Block CRCs are merged with crc32_combine().
+
+typedef size_t (*GzipReadFn)(void* ctx, unsigned char* buffer, size_t size);
+typedef int (*GzipWriteFn)(void* ctx, const unsigned char* buffer, size_t size);
+
+typedef struct {
+    const unsigned char* input;
+    size_t length;
+    const unsigned char* dict;
+    size_t dict_length;
+    int last;
+    int level;
+    unsigned char* output;
+    size_t output_capacity;
+    size_t output_length;
+    uLong crc;
+    int status;
+} GzipJob;
+
+typedef struct {
+    GzipJob* jobs;
+    int count;
+    int first;
+    int stride;
+} GzipWorker;
+
+static void gzip_compress_job(GzipJob* job) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+
+    job->status = -1;
+    job->output_length = 0;
+    job->crc = crc32(0L, job->input, (uInt)job->length);
+
+    if (deflateInit2(&zs, job->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return;
+    }
+
+    if (job->dict_length > 0) {
+        deflateSetDictionary(&zs, job->dict, (uInt)job->dict_length);
+    }
+
+    zs.next_in = (Bytef*)job->input;
+    zs.avail_in = (uInt)job->length;
+    zs.next_out = job->output;
+    zs.avail_out = (uInt)job->output_capacity;
+
+    int ret = deflate(&zs, job->last ? Z_FINISH : Z_SYNC_FLUSH);
+    int ok = job->last ? (ret == Z_STREAM_END)
+                       : (ret == Z_OK && zs.avail_in == 0 && zs.avail_out > 0);
+    if (ok) {
+        job->output_length = job->output_capacity - zs.avail_out;
+        job->status = 0;
+    }
+
+    deflateEnd(&zs);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI gzip_worker_proc(LPVOID param) {
+    GzipWorker* worker = (GzipWorker*)param;
+    for (int i = worker->first; i < worker->count; i += worker->stride) {
+        gzip_compress_job(&worker->jobs[i]);
+    }
+    return 0;
+}
+#endif
+
+static void gzip_run_jobs(GzipJob* jobs, int count, int threads) {
+    if (threads > count) threads = count;
+
+#ifdef _WIN32
+    if (threads > 1) {
+        HANDLE handles[ARCHIVE_MAX_THREADS];
+        GzipWorker workers[ARCHIVE_MAX_THREADS];
+        int started = 0;
+
+        for (int t = 0; t < threads; t++) {
+            workers[t].jobs = jobs;
+            workers[t].count = count;
+            workers[t].first = t;
+            workers[t].stride = threads;
+            handles[started] = CreateThread(NULL, 0, gzip_worker_proc, &workers[t], 0, NULL);
+            if (!handles[started]) {
+                // Fall back to doing this worker's share inline
+                gzip_worker_proc(&workers[t]);
+                continue;
+            }
+            started++;
+        }
+
+        if (started > 0) {
+            WaitForMultipleObjects((DWORD)started, handles, TRUE, INFINITE);
+            for (int t = 0; t < started; t++) {
+                CloseHandle(handles[t]);
+            }
+        }
+        return;
+    }
+#endif
+
+    for (int i = 0; i < count; i++) {
+        gzip_compress_job(&jobs[i]);
+    }
+}
+
+static int gzip_parallel(GzipReadFn read_fn, void* read_ctx, GzipWriteFn write_fn, void* write_ctx,
+                         int threads, int level, uint64_t* bytes_in, uint64_t* bytes_out) {
+    if (threads < 1) threads = 1;
+    if (threads > ARCHIVE_MAX_THREADS) threads = ARCHIVE_MAX_THREADS;
+    if (level < 1 || level > 9) level = Z_DEFAULT_COMPRESSION;
+
+    int jobs_per_batch = threads == 1 ? 1 : threads * 2;
+    size_t batch_capacity = (size_t)jobs_per_batch * ARCHIVE_GZIP_BLOCK_SIZE;
+    size_t output_capacity = compressBound(ARCHIVE_GZIP_BLOCK_SIZE) + 64;
+
+    // [ 32 KB dictionary carried over from the previous batch | batch input ]
+    unsigned char* window = malloc(ARCHIVE_GZIP_DICT_SIZE + batch_capacity);
+    GzipJob* jobs = calloc((size_t)jobs_per_batch, sizeof(GzipJob));
+    unsigned char* outputs = malloc(output_capacity * (size_t)jobs_per_batch);
+    if (!window || !jobs || !outputs) {
+        free(window);
+        free(jobs);
+        free(outputs);
+        return -1;
+    }
+
+    unsigned char* data = window + ARCHIVE_GZIP_DICT_SIZE;
+    size_t dict_length = 0;
+    uLong crc = crc32(0L, Z_NULL, 0);
+    uint64_t total_in = 0;
+    uint64_t total_out = 0;
+    int result = 0;
+
+    // Fixed gzip header: no name, no mtime, OS = NTFS
+    static const unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0x0b };
+    if (write_fn(write_ctx, header, sizeof(header)) != 0) result = -1;
+    total_out += sizeof(header);
+
+    while (result == 0) {
+        size_t filled = 0;
+        while (filled < batch_capacity) {
+            size_t n = read_fn(read_ctx, data + filled, batch_capacity - filled);
+            if (n == 0) break;
+            filled += n;
+        }
+        int eof = filled < batch_capacity;
+
+        int count = 0;
+        size_t offset = 0;
+        do {
+            GzipJob* job = &jobs[count];
+            size_t length = filled - offset;
+            if (length > ARCHIVE_GZIP_BLOCK_SIZE) length = ARCHIVE_GZIP_BLOCK_SIZE;
+
+            size_t history = offset + dict_length;
+            if (history > ARCHIVE_GZIP_DICT_SIZE) history = ARCHIVE_GZIP_DICT_SIZE;
+
+            job->input = data + offset;
+            job->length = length;
+            job->dict = data + offset - history;
+            job->dict_length = history;
+            job->level = level;
+            job->output = outputs + output_capacity * (size_t)count;
+            job->output_capacity = output_capacity;
+            offset += length;
+            job->last = eof && offset >= filled;
+            count++;
+        } while (offset < filled);
+
+        gzip_run_jobs(jobs, count, threads);
+
+        for (int i = 0; i < count; i++) {
+            if (jobs[i].status != 0 ||
+                write_fn(write_ctx, jobs[i].output, jobs[i].output_length) != 0) {
+                result = -1;
+                break;
+            }
+            crc = crc32_combine(crc, jobs[i].crc, (z_off_t)jobs[i].length);
+            total_out += jobs[i].output_length;
+        }
+        total_in += filled;
+
+        if (eof) break;
+
+        // Slide the last 32 KB of history down in front of the next batch
+        size_t keep = dict_length + filled;
+        if (keep > ARCHIVE_GZIP_DICT_SIZE) keep = ARCHIVE_GZIP_DICT_SIZE;
+        memmove(data - keep, data + filled - keep, keep);
+        dict_length = keep;
+    }
+
+    if (result == 0) {
+        unsigned char trailer[8];
+        put32(trailer, (uint32_t)crc);
+        put32(trailer + 4, (uint32_t)(total_in & 0xFFFFFFFFu));
+        if (write_fn(write_ctx, trailer, sizeof(trailer)) != 0) result = -1;
+        total_out += sizeof(trailer);
+    }
+
+    if (bytes_in) *bytes_in = total_in;
+    if (bytes_out) *bytes_out = total_out;
+
+    free(window);
+    free(jobs);
+    free(outputs);
+    return result;
+}
+
+static size_t gzip_read_stream(void* ctx, unsigned char* buffer, size_t size) {
+    return vfs_stream_read((VFSStream*)ctx, buffer, size);
+}
+
+static int gzip_write_stream(void* ctx, const unsigned char* buffer, size_t size) {
+    if (size == 0) return 0;
+    return vfs_stream_write((VFSStream*)ctx, buffer, size) == size ? 0 : -1;
+}
+
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    size_t pos;
+} GzipMemoryReader;
+
+static size_t gzip_read_memory(void* ctx, unsigned char* buffer, size_t size) {
+    GzipMemoryReader* reader = (GzipMemoryReader*)ctx;
+    size_t available = reader->size - reader->pos;
+    if (size > available) size = available;
+    memcpy(buffer, reader->data + reader->pos, size);
+    reader->pos += size;
+    return size;
+}
+
+static int gzip_write_discard(void* ctx, const unsigned char* buffer, size_t size) {
+    (void)ctx;
+    (void)buffer;
+    (void)size;
+    return 0;
+}
+
+int archive_default_threads(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int cpus = (int)info.dwNumberOfProcessors;
+#else
+    int cpus = 1;
+#endif
+    if (cpus < 1) cpus = 1;
+    if (cpus > ARCHIVE_MAX_THREADS) cpus = ARCHIVE_MAX_THREADS;
+    return cpus;
+}
+
+int archive_gzip_stream(VFSStream* in, VFSStream* out, int threads, int level, ArchiveStats* stats) {
+    if (!in || !out) return -1;
+
+    uint64_t bytes_in = 0, bytes_out = 0;
+    int result = gzip_parallel(gzip_read_stream, in, gzip_write_stream, out,
+                               threads, level, &bytes_in, &bytes_out);
+    if (stats) {
+        stats->bytes_in = bytes_in;
+        stats->bytes_out = bytes_out;
+        stats->entries = 1;
+    }
+    return result;
+}
+
+int archive_gzip_buffer(const unsigned char* data, size_t size, int threads, int level,
+                        size_t* compressed_size) {
+    GzipMemoryReader reader = { data, size, 0 };
+    uint64_t bytes_out = 0;
+    int result = gzip_parallel(gzip_read_memory, &reader, gzip_write_discard, NULL,
+                               threads, level, NULL, &bytes_out);
+    if (compressed_size) *compressed_size = (size_t)bytes_out;
+    return result;
+}
+
+int archive_gunzip_stream(VFSStream* in, VFSStream* out, ArchiveStats* stats) {
+    if (!in || !out) return -1;
+
+    unsigned char* in_buffer = malloc(ARCHIVE_IO_CHUNK);
+    unsigned char* out_buffer = malloc(ARCHIVE_IO_CHUNK);
+    if (!in_buffer || !out_buffer) {
+        free(in_buffer);
+        free(out_buffer);
+        return -1;
+    }
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // 15 + 32: auto-detect gzip/zlib headers
+    if (inflateInit2(&zs, 15 + 32) != Z_OK) {
+        free(in_buffer);
+        free(out_buffer);
+        return -1;
+    }
+
+    uint64_t total_in = 0, total_out = 0;
+    int result = 0;
+    int finished = 0;
+
+    while (result == 0 && !finished) {
+        if (zs.avail_in == 0) {
+            size_t n = vfs_stream_read(in, in_buffer, ARCHIVE_IO_CHUNK);
+            if (n == 0) {
+                // Input ended in the middle of a member
+                result = -1;
+                break;
+            }
+            total_in += n;
+            zs.next_in = in_buffer;
+            zs.avail_in = (uInt)n;
+        }
+
+        do {
+            zs.next_out = out_buffer;
+            zs.avail_out = ARCHIVE_IO_CHUNK;
+
+            int ret = inflate(&zs, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+                result = -1;
+                break;
+            }
+
+            size_t produced = ARCHIVE_IO_CHUNK - zs.avail_out;
+            if (produced > 0 && vfs_stream_write(out, out_buffer, produced) != produced) {
+                result = -1;
+                break;
+            }
+            total_out += produced;
+
+            if (ret == Z_STREAM_END) {
+                // Concatenated members (e.g. from `cat a.gz b.gz`) continue the stream
+                if (zs.avail_in == 0 && vfs_stream_eof(in)) {
+                    finished = 1;
+                    break;
+                }
+                inflateReset(&zs);
+            }
+        } while (zs.avail_out == 0 || (zs.avail_in > 0 && result == 0));
+    }
+
+    inflateEnd(&zs);
+    free(in_buffer);
+    free(out_buffer);
+
+    if (stats) {
+        stats->bytes_in = total_in;
+        stats->bytes_out = total_out;
+        stats->entries = 1;
+    }
+    return result;
+}
+
+void archive_gzip_benchmark(size_t size_mb, int max_threads, int level) {
+    if (size_mb == 0) size_mb = 64;
+    if (max_threads < 1) max_threads = archive_default_threads();
+    if (max_threads > ARCHIVE_MAX_THREADS) max_threads = ARCHIVE_MAX_THREADS;
+
+    size_t size = size_mb * 1024 * 1024;
+    unsigned char* data = malloc(size);
+    if (!data) {
+        printf("gzip: benchmark: cannot allocate %zu MB\n", size_mb);
+        return;
+    }
+
+    // Log-like text with a small vocabulary: compresses roughly like source code
+    static const char* words[] = {
+        "kernel", "process", "memory", "vfs", "node", "syscall", "thread", "zora",
+        "page", "frame", "socket", "packet", "0x1f8b", "scheduler", "\n", "=", ";"
+    };
+    unsigned int seed = 0x5eed1234u;
+    size_t pos = 0;
+    while (pos < size) {
+        seed = seed * 1103515245u + 12345u;
+        const char* word = words[(seed >> 16) % (sizeof(words) / sizeof(words[0]))];
+        size_t len = strlen(word);
+        for (size_t i = 0; i < len && pos < size; i++) data[pos++] = (unsigned char)word[i];
+        if (pos < size) data[pos++] = ' ';
+    }
+
+    printf("gzip benchmark: %zu MB synthetic input, level %d\n", size_mb, level);
+    printf("  %-8s %-10s %-10s %-8s\n", "threads", "MB/s", "ratio", "speedup");
+
+    double baseline = 0.0;
+    for (int threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+        size_t compressed = 0;
+        double start = archive_now_seconds();
+        int ok = archive_gzip_buffer(data, size, threads, level, &compressed) == 0;
+        double elapsed = archive_now_seconds() - start;
+
+        if (!ok) {
+            printf("  %-8d failed\n", threads);
+            continue;
+        }
+
+        double mbps = elapsed > 0 ? (double)size_mb / elapsed : 0.0;
+        if (threads == 1) baseline = mbps;
+        printf("  %-8d %-10.1f %-10.3f %.2fx\n", threads, mbps,
+               (double)compressed / (double)size, baseline > 0 ? mbps / baseline : 1.0);
+
+        if (threads == max_threads) break;
+    }
+
+    free(data);
+}
+
+// ===== tar (ustar) =====
+
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+} TarHeader;
+
+static unsigned int tar_header_checksum(const TarHeader* header) {
+    const unsigned char* bytes = (const unsigned char*)header;
+    unsigned int sum = 0;
+    for (size_t i = 0; i < sizeof(TarHeader); i++) {
+        // The checksum field itself counts as spaces
+        if (i >= offsetof(TarHeader, checksum) && i < offsetof(TarHeader, checksum) + 8) {
+            sum += ' ';
+        } else {
+            sum += bytes[i];
+        }
+    }
+    return sum;
+}
+
+static int tar_set_name(TarHeader* header, const char* name) {
+    size_t len = strlen(name);
+    if (len < sizeof(header->name)) {
+        memcpy(header->name, name, len);
+        return 0;
+    }
+
+    // Split into ustar prefix/name at a '/'
+    const char* split = name + len;
+    while (split > name) {
+        split--;
+        if (*split == '/' && (size_t)(split - name) < sizeof(header->prefix) &&
+            strlen(split + 1) < sizeof(header->name)) {
+            memcpy(header->prefix, name, (size_t)(split - name));
+            strcpy(header->name, split + 1);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int tar_write_header(VFSStream* out, const char* name, VNode* node, char type, size_t size) {
+    TarHeader header;
+    memset(&header, 0, sizeof(header));
+
+    if (tar_set_name(&header, name) != 0) return -1;
+
+    snprintf(header.mode, sizeof(header.mode), "%07o", node->mode & 07777);
+    snprintf(header.uid, sizeof(header.uid), "%07o", 0);
+    snprintf(header.gid, sizeof(header.gid), "%07o", 0);
+    snprintf(header.size, sizeof(header.size), "%011llo", (unsigned long long)size);
+    snprintf(header.mtime, sizeof(header.mtime), "%011llo",
+             (unsigned long long)(node->modified_time > 0 ? node->modified_time : time(NULL)));
+    header.typeflag = type;
+    if (type == '2' && node->symlink_target) {
+        strncpy(header.linkname, node->symlink_target, sizeof(header.linkname) - 1);
+    }
+    memcpy(header.magic, "ustar", 6);
+    memcpy(header.version, "00", 2);
+    strncpy(header.uname, node->owner, sizeof(header.uname) - 1);
+    strncpy(header.gname, node->group, sizeof(header.gname) - 1);
+
+    snprintf(header.checksum, sizeof(header.checksum), "%06o", tar_header_checksum(&header));
+    header.checksum[7] = ' ';
+
+    return vfs_stream_write(out, &header, sizeof(header)) == sizeof(header) ? 0 : -1;
+}
+
+static int tar_add_path(VFSStream* out, const char* full_path, const char* member,
+                        int flags, ArchiveStats* stats) {
+    VNode* node = vfs_find_node(full_path);
+    if (!node) {
+        printf("tar: %s: No such file or directory\n", member);
+        return -1;
+    }
+
+    // Never archive the archive into itself
+    if (node == out->node) return 0;
+
+    if (node->is_symlink) {
+        if (flags & ARCHIVE_VERBOSE) printf("%s -> %s\n", member, node->symlink_target);
+        stats->entries++;
+        return tar_write_header(out, member, node, '2', 0);
+    }
+
+    if (node->is_directory) {
+        char dir_member[512];
+        snprintf(dir_member, sizeof(dir_member), "%s/", member);
+        if (flags & ARCHIVE_VERBOSE) printf("%s\n", dir_member);
+        if (tar_write_header(out, dir_member, node, '5', 0) != 0) return -1;
+        stats->entries++;
+
+        int result = 0;
+        for (VNode* child = node->children; child; child = child->next) {
+            char child_path[512], child_member[512];
+            snprintf(child_path, sizeof(child_path), "%s/%s",
+                     strcmp(full_path, "/") == 0 ? "" : full_path, child->name);
+            snprintf(child_member, sizeof(child_member), "%s/%s", member, child->name);
+            if (tar_add_path(out, child_path, child_member, flags, stats) != 0) result = -1;
+        }
+        return result;
+    }
+
+    VFSStream* in = vfs_stream_open(full_path, "rb");
+    if (!in) {
+        printf("tar: %s: Cannot open\n", member);
+        return -1;
+    }
+
+    size_t size = vfs_stream_size(in);
+    if (tar_write_header(out, member, node, '0', size) != 0) {
+        printf("tar: %s: Name too long or write error\n", member);
+        vfs_stream_close(in);
+        return -1;
+    }
+
+    unsigned char buffer[TAR_BLOCK * 32];
+    size_t n;
+    size_t copied = 0;
+    int result = 0;
+    while ((n = vfs_stream_read(in, buffer, sizeof(buffer))) > 0) {
+        if (vfs_stream_write(out, buffer, n) != n) {
+            result = -1;
+            break;
+        }
+        copied += n;
+    }
+    vfs_stream_close(in);
+
+    size_t padding = (TAR_BLOCK - (copied % TAR_BLOCK)) % TAR_BLOCK;
+    if (result == 0 && padding > 0) {
+        memset(buffer, 0, padding);
+        if (vfs_stream_write(out, buffer, padding) != padding) result = -1;
+    }
+    if (result != 0) {
+        printf("tar: %s: Write error\n", member);
+        return -1;
+    }
+
+    if (flags & ARCHIVE_VERBOSE) printf("%s\n", member);
+    stats->entries++;
+    stats->bytes_in += copied;
+    return 0;
+}
+
+int archive_tar_create(const char* archive_path, const char* base_dir,
+                       char** members, int member_count, int flags, ArchiveStats* stats) {
+    ArchiveStats local;
+    if (!stats) stats = &local;
+    memset(stats, 0, sizeof(*stats));
+
+    VFSStream* out = vfs_stream_open(archive_path, "wb");
+    if (!out) {
+        printf("tar: cannot create '%s'\n", archive_path);
+        return -1;
+    }
+
+    int result = 0;
+    for (int i = 0; i < member_count; i++) {
+        char full_path[512];
+        archive_join_path(full_path, sizeof(full_path), base_dir, members[i]);
+
+        // Store names relative, the way tar strips a leading '/'
+        const char* member = members[i];
+        while (*member == '/') member++;
+        char trimmed[512];
+        snprintf(trimmed, sizeof(trimmed), "%s", *member ? member : ".");
+        size_t len = strlen(trimmed);
+        while (len > 1 && trimmed[len - 1] == '/') trimmed[--len] = '\0';
+
+        if (tar_add_path(out, full_path, trimmed, flags, stats) != 0) result = -1;
+    }
+
+    // Two zero blocks terminate the archive
+    unsigned char zero_block[TAR_BLOCK * 2];
+    memset(zero_block, 0, sizeof(zero_block));
+    if (vfs_stream_write(out, zero_block, sizeof(zero_block)) != sizeof(zero_block)) result = -1;
+
+    stats->bytes_out = vfs_stream_size(out);
+    if (vfs_stream_close(out) != 0) result = -1;
+    return result;
+}
+
+static int tar_block_is_zero(const unsigned char* block) {
+    for (int i = 0; i < TAR_BLOCK; i++) {
+        if (block[i]) return 0;
+    }
+    return 1;
+}
+
+int archive_tar_extract(const char* archive_path, const char* dest_dir, int flags, ArchiveStats* stats) {
+    ArchiveStats local;
+    if (!stats) stats = &local;
+    memset(stats, 0, sizeof(*stats));
+
+    VFSStream* in = vfs_stream_open(archive_path, "rb");
+    if (!in) {
+        printf("tar: cannot access '%s': No such file or directory\n", archive_path);
+        return -1;
+    }
+    stats->bytes_in = vfs_stream_size(in);
+
+    int result = 0;
+    TarHeader header;
+    unsigned char buffer[TAR_BLOCK * 32];
+
+    while (vfs_stream_read(in, &header, sizeof(header)) == sizeof(header)) {
+        if (tar_block_is_zero((const unsigned char*)&header)) break;
+
+        char field[13];
+        memcpy(field, header.checksum, 8);
+        field[8] = '\0';
+        if ((unsigned int)strtoul(field, NULL, 8) != tar_header_checksum(&header)) {
+            printf("tar: skipping to next header (bad checksum)\n");
+            result = -1;
+            break;
+        }
+
+        char name[512];
+        char short_name[101], prefix[156];
+        memcpy(short_name, header.name, 100);
+        short_name[100] = '\0';
+        memcpy(prefix, header.prefix, 155);
+        prefix[155] = '\0';
+        if (prefix[0]) {
+            snprintf(name, sizeof(name), "%s/%s", prefix, short_name);
+        } else {
+            snprintf(name, sizeof(name), "%s", short_name);
+        }
+
+        memcpy(field, header.size, 12);
+        field[12] = '\0';
+        size_t size = (size_t)strtoull(field, NULL, 8);
+        size_t padded = ((size + TAR_BLOCK - 1) / TAR_BLOCK) * TAR_BLOCK;
+        char type = header.typeflag ? header.typeflag : '0';
+
+        if (flags & ARCHIVE_LIST) {
+            if (flags & ARCHIVE_VERBOSE) {
+                printf("%c %10zu %s\n", type == '5' ? 'd' : (type == '2' ? 'l' : '-'), size, name);
+            } else {
+                printf("%s\n", name);
+            }
+            stats->entries++;
+            vfs_stream_seek(in, (long long)padded, SEEK_CUR);
+            continue;
+        }
+
+        size_t name_len = strlen(name);
+        while (name_len > 1 && name[name_len - 1] == '/') name[--name_len] = '\0';
+
+        if (!archive_member_is_safe(name)) {
+            printf("tar: %s: Member name is unsafe, skipping\n", name);
+            vfs_stream_seek(in, (long long)padded, SEEK_CUR);
+            continue;
+        }
+
+        char full_path[512];
+        archive_join_path(full_path, sizeof(full_path), dest_dir, name);
+        if (flags & ARCHIVE_VERBOSE) printf("%s\n", name);
+
+        if (type == '5') {
+            if (archive_make_dirs(full_path) != 0) {
+                printf("tar: %s: Cannot create directory\n", name);
+                result = -1;
+            }
+            stats->entries++;
+            vfs_stream_seek(in, (long long)padded, SEEK_CUR);
+            continue;
+        }
+
+        if (type == '2') {
+            char target[101];
+            memcpy(target, header.linkname, 100);
+            target[100] = '\0';
+            if (!archive_link_is_safe(name, target)) {
+                printf("tar: %s: Link target '%s' is unsafe, skipping\n", name, target);
+                vfs_stream_seek(in, (long long)padded, SEEK_CUR);
+                continue;
+            }
+            archive_make_parent_dirs(full_path);
+            if (vfs_create_symlink(full_path, target) != 0) result = -1;
+            stats->entries++;
+            vfs_stream_seek(in, (long long)padded, SEEK_CUR);
+            continue;
+        }
+
+        if (type != '0' && type != '7') {
+            // Hard links, devices and FIFOs have no VFS equivalent
+            printf("tar: %s: Unsupported entry type '%c', skipping\n", name, type);
+            vfs_stream_seek(in, (long long)padded, SEEK_CUR);
+            continue;
+        }
+
+        archive_make_parent_dirs(full_path);
+        VFSStream* out = vfs_stream_open(full_path, "wb");
+        if (!out) {
+            printf("tar: %s: Cannot open for writing\n", name);
+            vfs_stream_seek(in, (long long)padded, SEEK_CUR);
+            result = -1;
+            continue;
+        }
+
+        size_t remaining = size;
+        int written = 1;
+        while (remaining > 0) {
+            size_t want = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+            size_t n = vfs_stream_read(in, buffer, want);
+            if (n == 0) break;
+            if (written && vfs_stream_write(out, buffer, n) != n) written = 0;
+            remaining -= n;
+        }
+        if (vfs_stream_close(out) != 0) written = 0;
+        if (!written) {
+            printf("tar: %s: Write error\n", name);
+            result = -1;
+        }
+
+        memcpy(field, header.mode, 8);
+        field[8] = '\0';
+        unsigned int mode = (unsigned int)strtoul(field, NULL, 8);
+        if (mode) vfs_chmod(full_path, mode & 0777);
+
+        if (remaining > 0) {
+            printf("tar: %s: Unexpected end of archive\n", name);
+            result = -1;
+            break;
+        }
+
+        vfs_stream_seek(in, (long long)(padded - size), SEEK_CUR);
+        stats->entries++;
+        stats->bytes_out += size;
+    }
+
+    vfs_stream_close(in);
+    return result;
+}
+
+// ===== zip =====
+
+#define ZIP_LOCAL_SIG    0x04034b50u
+#define ZIP_DESC_SIG     0x08074b50u
+#define ZIP_CENTRAL_SIG  0x02014b50u
+#define ZIP_END_SIG      0x06054b50u
+#define ZIP_MAX_COMMENT  0xFFFF
+
+typedef struct {
+    char name[512];
+    uint32_t crc;
+    uint32_t compressed_size;
+    uint32_t uncompressed_size;
+    uint32_t offset;
+    uint16_t flags;
+    uint16_t method;
+    uint16_t dos_time;
+    uint16_t dos_date;
+    uint32_t external_attr;
+} ZipEntry;
+
+typedef struct {
+    ZipEntry* entries;
+    int count;
+    int capacity;
+} ZipDirectory;
+
+static ZipEntry* zip_add_entry(ZipDirectory* dir) {
+    if (dir->count == dir->capacity) {
+        int new_capacity = dir->capacity ? dir->capacity * 2 : 16;
+        ZipEntry* grown = realloc(dir->entries, (size_t)new_capacity * sizeof(ZipEntry));
+        if (!grown) return NULL;
+        dir->entries = grown;
+        dir->capacity = new_capacity;
+    }
+    ZipEntry* entry = &dir->entries[dir->count++];
+    memset(entry, 0, sizeof(*entry));
+    return entry;
+}
+
+static void zip_dos_datetime(time_t t, uint16_t* dos_time, uint16_t* dos_date) {
+    struct tm* tm_info = localtime(&t);
+    if (!tm_info || tm_info->tm_year < 80) {
+        *dos_time = 0;
+        *dos_date = (1 << 5) | 1; // 1980-01-01
+        return;
+    }
+    *dos_time = (uint16_t)((tm_info->tm_hour << 11) | (tm_info->tm_min << 5) | (tm_info->tm_sec / 2));
+    *dos_date = (uint16_t)(((tm_info->tm_year - 80) << 9) | ((tm_info->tm_mon + 1) << 5) | tm_info->tm_mday);
+}
+
+static int zip_write_local_header(VFSStream* out, const ZipEntry* entry) {
+    unsigned char header[30];
+    size_t name_len = strlen(entry->name);
+
+    put32(header, ZIP_LOCAL_SIG);
+    put16(header + 4, 20);
+    put16(header + 6, entry->flags);
+    put16(header + 8, entry->method);
+    put16(header + 10, entry->dos_time);
+    put16(header + 12, entry->dos_date);
+    // CRC and sizes follow in the data descriptor (flag bit 3)
+    put32(header + 14, 0);
+    put32(header + 18, 0);
+    put32(header + 22, 0);
+    put16(header + 26, (uint32_t)name_len);
+    put16(header + 28, 0);
+
+    if (vfs_stream_write(out, header, sizeof(header)) != sizeof(header)) return -1;
+    return vfs_stream_write(out, entry->name, name_len) == name_len ? 0 : -1;
+}
+
+static int zip_deflate_member(VFSStream* in, VFSStream* out, ZipEntry* entry) {
+    unsigned char* in_buffer = malloc(ARCHIVE_IO_CHUNK);
+    unsigned char* out_buffer = malloc(ARCHIVE_IO_CHUNK);
+    if (!in_buffer || !out_buffer) {
+        free(in_buffer);
+        free(out_buffer);
+        return -1;
+    }
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(in_buffer);
+        free(out_buffer);
+        return -1;
+    }
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    uint64_t total_in = 0, total_out = 0;
+    int result = 0;
+    int flush;
+
+    do {
+        size_t n = vfs_stream_read(in, in_buffer, ARCHIVE_IO_CHUNK);
+        crc = crc32(crc, in_buffer, (uInt)n);
+        total_in += n;
+        flush = vfs_stream_eof(in) ? Z_FINISH : Z_NO_FLUSH;
+
+        zs.next_in = in_buffer;
+        zs.avail_in = (uInt)n;
+        do {
+            zs.next_out = out_buffer;
+            zs.avail_out = ARCHIVE_IO_CHUNK;
+            if (deflate(&zs, flush) == Z_STREAM_ERROR) {
+                result = -1;
+                break;
+            }
+            size_t produced = ARCHIVE_IO_CHUNK - zs.avail_out;
+            if (produced > 0 && vfs_stream_write(out, out_buffer, produced) != produced) {
+                result = -1;
+                break;
+            }
+            total_out += produced;
+        } while (zs.avail_out == 0);
+    } while (flush != Z_FINISH && result == 0);
+
+    deflateEnd(&zs);
+    free(in_buffer);
+    free(out_buffer);
+
+    entry->crc = (uint32_t)crc;
+    entry->uncompressed_size = (uint32_t)total_in;
+    entry->compressed_size = (uint32_t)total_out;
+    return result;
+}
+
+static int zip_add_path(VFSStream* out, ZipDirectory* dir, const char* full_path,
+                        const char* member, int flags, ArchiveStats* stats) {
+    VNode* node = vfs_find_node(full_path);
+    if (!node) {
+        printf("zip: %s: No such file or directory\n", member);
+        return -1;
+    }
+    if (node == out->node) return 0;
+
+    // Links to files are stored as the file.  A link to a directory may
+    // lead back to one of its parents, and unzip cannot recreate links, so
+    // it is left out.
+    int is_link = node->is_symlink;
+    node = vfs_resolve_symlink(node);
+    if (!node) return -1;
+    if (is_link && node->is_directory) {
+        printf("zip: %s: Symbolic link to a directory, skipping\n", member);
+        return 0;
+    }
+
+    ZipEntry* entry = zip_add_entry(dir);
+    if (!entry) return -1;
+
+    zip_dos_datetime(node->modified_time, &entry->dos_time, &entry->dos_date);
+    entry->offset = (uint32_t)vfs_stream_tell(out);
+
+    if (node->is_directory) {
+        snprintf(entry->name, sizeof(entry->name), "%s/", member);
+        entry->method = 0;
+        entry->external_attr = ((uint32_t)(040000 | (node->mode & 0777)) << 16) | 0x10;
+        if (zip_write_local_header(out, entry) != 0) return -1;
+        if (flags & ARCHIVE_VERBOSE) printf("  adding: %s\n", entry->name);
+        stats->entries++;
+
+        int result = 0;
+        for (VNode* child = node->children; child; child = child->next) {
+            char child_path[512], child_member[512];
+            snprintf(child_path, sizeof(child_path), "%s/%s",
+                     strcmp(full_path, "/") == 0 ? "" : full_path, child->name);
+            snprintf(child_member, sizeof(child_member), "%s/%s", member, child->name);
+            if (zip_add_path(out, dir, child_path, child_member, flags, stats) != 0) result = -1;
+        }
+        return result;
+    }
+
+    snprintf(entry->name, sizeof(entry->name), "%s", member);
+    entry->method = 8;
+    entry->flags = 0x0008;
+    entry->external_attr = (uint32_t)(0100000 | (node->mode & 0777)) << 16;
+
+    VFSStream* in = vfs_stream_open(full_path, "rb");
+    if (!in) {
+        dir->count--;
+        printf("zip: %s: Cannot open\n", member);
+        return -1;
+    }
+
+    ZipEntry* current = entry;
+    int result = zip_write_local_header(out, current);
+    if (result == 0) result = zip_deflate_member(in, out, current);
+    vfs_stream_close(in);
+
+    if (result == 0) {
+        unsigned char descriptor[16];
+        put32(descriptor, ZIP_DESC_SIG);
+        put32(descriptor + 4, current->crc);
+        put32(descriptor + 8, current->compressed_size);
+        put32(descriptor + 12, current->uncompressed_size);
+        if (vfs_stream_write(out, descriptor, sizeof(descriptor)) != sizeof(descriptor)) result = -1;
+    }
+    if (result != 0) printf("zip: %s: Write error\n", member);
+
+    if (flags & ARCHIVE_VERBOSE) {
+        int saved = current->uncompressed_size > 0
+            ? (int)(100 - (uint64_t)current->compressed_size * 100 / current->uncompressed_size) : 0;
+        printf("  adding: %s (deflated %d%%)\n", member, saved);
+    }
+    stats->entries++;
+    stats->bytes_in += current->uncompressed_size;
+    return result;
+}
+
+int archive_zip_create(const char* archive_path, const char* base_dir,
+                       char** members, int member_count, int flags, ArchiveStats* stats) {
+    ArchiveStats local;
+    if (!stats) stats = &local;
+    memset(stats, 0, sizeof(*stats));
+
+    VFSStream* out = vfs_stream_open(archive_path, "wb");
+    if (!out) {
+        printf("zip: cannot create '%s'\n", archive_path);
+        return -1;
+    }
+
+    ZipDirectory dir = { NULL, 0, 0 };
+    int result = 0;
+
+    for (int i = 0; i < member_count; i++) {
+        char full_path[512];
+        archive_join_path(full_path, sizeof(full_path), base_dir, members[i]);
+
+        const char* member = members[i];
+        while (*member == '/') member++;
+        char trimmed[512];
+        snprintf(trimmed, sizeof(trimmed), "%s", member);
+        size_t len = strlen(trimmed);
+        while (len > 0 && trimmed[len - 1] == '/') trimmed[--len] = '\0';
+        if (len == 0) continue;
+
+        if (zip_add_path(out, &dir, full_path, trimmed, flags, stats) != 0) result = -1;
+    }
+
+    // Central directory
+    uint32_t central_offset = (uint32_t)vfs_stream_tell(out);
+    for (int i = 0; i < dir.count; i++) {
+        const ZipEntry* entry = &dir.entries[i];
+        unsigned char header[46];
+        size_t name_len = strlen(entry->name);
+
+        put32(header, ZIP_CENTRAL_SIG);
+        put16(header + 4, (3 << 8) | 20);   // made by: UNIX, so external attrs carry the mode
+        put16(header + 6, 20);
+        put16(header + 8, entry->flags);
+        put16(header + 10, entry->method);
+        put16(header + 12, entry->dos_time);
+        put16(header + 14, entry->dos_date);
+        put32(header + 16, entry->crc);
+        put32(header + 20, entry->compressed_size);
+        put32(header + 24, entry->uncompressed_size);
+        put16(header + 28, (uint32_t)name_len);
+        put16(header + 30, 0);
+        put16(header + 32, 0);
+        put16(header + 34, 0);
+        put16(header + 36, 0);
+        put32(header + 38, entry->external_attr);
+        put32(header + 42, entry->offset);
+
+        if (vfs_stream_write(out, header, sizeof(header)) != sizeof(header) ||
+            vfs_stream_write(out, entry->name, name_len) != name_len) {
+            result = -1;
+        }
+    }
+    uint32_t central_size = (uint32_t)vfs_stream_tell(out) - central_offset;
+
+    unsigned char end[22];
+    put32(end, ZIP_END_SIG);
+    put16(end + 4, 0);
+    put16(end + 6, 0);
+    put16(end + 8, (uint32_t)dir.count);
+    put16(end + 10, (uint32_t)dir.count);
+    put32(end + 12, central_size);
+    put32(end + 16, central_offset);
+    put16(end + 20, 0);
+    if (vfs_stream_write(out, end, sizeof(end)) != sizeof(end)) result = -1;
+
+    stats->bytes_out = vfs_stream_size(out);
+    free(dir.entries);
+    if (vfs_stream_close(out) != 0) result = -1;
+    return result;
+}
+
+static int zip_inflate_member(VFSStream* in, VFSStream* out, size_t compressed_size,
+                              int method, uLong* crc_out, size_t* size_out) {
+    unsigned char* in_buffer = malloc(ARCHIVE_IO_CHUNK);
+    unsigned char* out_buffer = malloc(ARCHIVE_IO_CHUNK);
+    if (!in_buffer || !out_buffer) {
+        free(in_buffer);
+        free(out_buffer);
+        return -1;
+    }
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    size_t total_out = 0;
+    size_t remaining = compressed_size;
+    int result = 0;
+
+    if (method == 0) {
+        while (remaining > 0) {
+            size_t n = vfs_stream_read(in, in_buffer,
+                                       remaining < ARCHIVE_IO_CHUNK ? remaining : ARCHIVE_IO_CHUNK);
+            if (n == 0) {
+                result = -1;
+                break;
+            }
+            crc = crc32(crc, in_buffer, (uInt)n);
+            if (vfs_stream_write(out, in_buffer, n) != n) {
+                result = -1;
+                break;
+            }
+            total_out += n;
+            remaining -= n;
+        }
+    } else {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        if (inflateInit2(&zs, -15) != Z_OK) {
+            free(in_buffer);
+            free(out_buffer);
+            return -1;
+        }
+
+        int ret = Z_OK;
+        while (ret != Z_STREAM_END && result == 0) {
+            if (zs.avail_in == 0) {
+                if (remaining == 0) {
+                    result = -1;
+                    break;
+                }
+                size_t n = vfs_stream_read(in, in_buffer,
+                                           remaining < ARCHIVE_IO_CHUNK ? remaining : ARCHIVE_IO_CHUNK);
+                if (n == 0) {
+                    result = -1;
+                    break;
+                }
+                remaining -= n;
+                zs.next_in = in_buffer;
+                zs.avail_in = (uInt)n;
+            }
+
+            zs.next_out = out_buffer;
+            zs.avail_out = ARCHIVE_IO_CHUNK;
+            ret = inflate(&zs, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END) {
+                result = -1;
+                break;
+            }
+
+            size_t produced = ARCHIVE_IO_CHUNK - zs.avail_out;
+            crc = crc32(crc, out_buffer, (uInt)produced);
+            if (produced > 0 && vfs_stream_write(out, out_buffer, produced) != produced) {
+                result = -1;
+                break;
+            }
+            total_out += produced;
+        }
+        inflateEnd(&zs);
+    }
+
+    free(in_buffer);
+    free(out_buffer);
+    *crc_out = crc;
+    *size_out = total_out;
+    return result;
+}
+
+int archive_zip_extract(const char* archive_path, const char* dest_dir, int flags, ArchiveStats* stats) {
+    ArchiveStats local;
+    if (!stats) stats = &local;
+    memset(stats, 0, sizeof(*stats));
+
+    VFSStream* in = vfs_stream_open(archive_path, "rb");
+    if (!in) {
+        printf("unzip: cannot find or open %s\n", archive_path);
+        return -1;
+    }
+
+    size_t archive_size = vfs_stream_size(in);
+    stats->bytes_in = archive_size;
+
+    // Locate the end-of-central-directory record (it may be followed by a comment)
+    size_t tail = archive_size < 22 + ZIP_MAX_COMMENT ? archive_size : 22 + ZIP_MAX_COMMENT;
+    unsigned char* tail_buffer = malloc(tail ? tail : 1);
+    if (!tail_buffer) {
+        vfs_stream_close(in);
+        return -1;
+    }
+    vfs_stream_seek(in, (long long)(archive_size - tail), SEEK_SET);
+    size_t tail_read = vfs_stream_read(in, tail_buffer, tail);
+
+    long end_pos = -1;
+    for (long i = (long)tail_read - 22; i >= 0; i--) {
+        if (get32(tail_buffer + i) == ZIP_END_SIG) {
+            end_pos = i;
+            break;
+        }
+    }
+    if (end_pos < 0) {
+        printf("unzip: %s: End-of-central-directory signature not found\n", archive_path);
+        free(tail_buffer);
+        vfs_stream_close(in);
+        return -1;
+    }
+
+    uint32_t entry_count = get16(tail_buffer + end_pos + 10);
+    uint32_t central_offset = get32(tail_buffer + end_pos + 16);
+    free(tail_buffer);
+
+    // unzip -d creates the extraction directory on demand
+    if (!(flags & ARCHIVE_LIST) && dest_dir && archive_make_dirs(dest_dir) != 0) {
+        printf("unzip: cannot create extraction directory: %s\n", dest_dir);
+        vfs_stream_close(in);
+        return -1;
+    }
+
+    if (flags & ARCHIVE_LIST) {
+        printf("  Length      Date    Time    Name\n");
+        printf("---------  ---------- -----   ----\n");
+    }
+
+    int result = 0;
+    uint64_t listed_total = 0;
+    size_t central_pos = central_offset;
+
+    for (uint32_t i = 0; i < entry_count; i++) {
+        unsigned char header[46];
+        vfs_stream_seek(in, (long long)central_pos, SEEK_SET);
+        if (vfs_stream_read(in, header, sizeof(header)) != sizeof(header) ||
+            get32(header) != ZIP_CENTRAL_SIG) {
+            printf("unzip: %s: Bad central directory\n", archive_path);
+            result = -1;
+            break;
+        }
+
+        uint32_t method = get16(header + 10);
+        uint32_t dos_time = get16(header + 12);
+        uint32_t dos_date = get16(header + 14);
+        uint32_t crc = get32(header + 16);
+        uint32_t compressed_size = get32(header + 20);
+        uint32_t uncompressed_size = get32(header + 24);
+        uint32_t name_len = get16(header + 28);
+        uint32_t extra_len = get16(header + 30);
+        uint32_t comment_len = get16(header + 32);
+        uint32_t external_attr = get32(header + 38);
+        uint32_t local_offset = get32(header + 42);
+
+        char name[512];
+        size_t keep = name_len < sizeof(name) - 1 ? name_len : sizeof(name) - 1;
+        vfs_stream_read(in, name, keep);
+        name[keep] = '\0';
+        central_pos += sizeof(header) + name_len + extra_len + comment_len;
+
+        int is_dir = keep > 0 && name[keep - 1] == '/';
+
+        if (flags & ARCHIVE_LIST) {
+            printf("%9u  %04u-%02u-%02u %02u:%02u   %s\n", uncompressed_size,
+                   ((dos_date >> 9) & 0x7F) + 1980, (dos_date >> 5) & 0x0F, dos_date & 0x1F,
+                   (dos_time >> 11) & 0x1F, (dos_time >> 5) & 0x3F, name);
+            listed_total += uncompressed_size;
+            stats->entries++;
+            continue;
+        }
+
+        size_t name_end = strlen(name);
+        while (name_end > 0 && name[name_end - 1] == '/') name[--name_end] = '\0';
+
+        if (!archive_member_is_safe(name)) {
+            printf("unzip: %s: Member name is unsafe, skipping\n", name);
+            continue;
+        }
+
+        char full_path[512];
+        archive_join_path(full_path, sizeof(full_path), dest_dir, name);
+
+        if (is_dir) {
+            if (flags & ARCHIVE_VERBOSE) printf("   creating: %s/\n", name);
+            if (archive_make_dirs(full_path) != 0) result = -1;
+            stats->entries++;
+            continue;
+        }
+
+        if (method != 0 && method != 8) {
+            printf("unzip: %s: Unsupported compression method %u\n", name, method);
+            result = -1;
+            continue;
+        }
+
+        unsigned char local[30];
+        vfs_stream_seek(in, (long long)local_offset, SEEK_SET);
+        if (vfs_stream_read(in, local, sizeof(local)) != sizeof(local) || get32(local) != ZIP_LOCAL_SIG) {
+            printf("unzip: %s: Bad local header\n", name);
+            result = -1;
+            continue;
+        }
+        vfs_stream_seek(in, (long long)(get16(local + 26) + get16(local + 28)), SEEK_CUR);
+
+        archive_make_parent_dirs(full_path);
+        VFSStream* out = vfs_stream_open(full_path, "wb");
+        if (!out) {
+            printf("unzip: %s: Cannot open for writing\n", name);
+            result = -1;
+            continue;
+        }
+
+        if (flags & ARCHIVE_VERBOSE) printf("  inflating: %s\n", name);
+
+        uLong actual_crc = 0;
+        size_t actual_size = 0;
+        int ok = zip_inflate_member(in, out, compressed_size, (int)method, &actual_crc, &actual_size) == 0;
+        if (vfs_stream_close(out) != 0) {
+            printf("unzip: %s: Write error\n", name);
+            result = -1;
+            continue;
+        }
+
+        if (!ok || actual_crc != crc || actual_size != uncompressed_size) {
+            printf("unzip: %s: Bad CRC or size\n", name);
+            result = -1;
+            continue;
+        }
+
+        unsigned int mode = (external_attr >> 16) & 0777;
+        if (mode) vfs_chmod(full_path, mode);
+
+        stats->entries++;
+        stats->bytes_out += actual_size;
+    }
+
+    if (flags & ARCHIVE_LIST) {
+        printf("---------                     -------\n");
+        printf("%9llu                     %d files\n", (unsigned long long)listed_total, stats->entries);
+    }
+
+    vfs_stream_close(in);
+    return result;
+}
@@ -12,39 +12,17 @@
 #include <dirent.h>
 #endif
 
-// Helper function to count inodes recursively
-static int count_inodes_recursive(VNode* node) {
-    if (!node) return 0;
-    
-    int count = 1;  // Count this node
-    
-    if (node->is_directory && node->children) {
-        VNode* child = node->children;
-        while (child) {
-            count += count_inodes_recursive(child);
-            child = child->next;
-        }
-    }
-    
-    return count;
-}
+// Per-user block quotas set with disk_set_quota()
+#define DISK_MAX_QUOTAS 32
+#define DISK_DEFAULT_QUOTA (1024ULL * 1024 * 1024)  // 1GB
 
-// Helper function to calculate directory size recursively
-static uint64_t calculate_size_recursive(VNode* node) {
-    if (!node) return 0;
-    
-    uint64_t total = node->size;
-    
-    if (node->is_directory && node->children) {
-        VNode* child = node->children;
-        while (child) {
-            total += calculate_size_recursive(child);
-            child = child->next;
-        }
-    }
-    
-    return total;
-}
+typedef struct {
+    char user[64];
+    uint64_t limit;
+} DiskQuotaLimit;
+
+static DiskQuotaLimit disk_quotas[DISK_MAX_QUOTAS];
+static int disk_quota_count = 0;
 
 // Initialize disk management
 int disk_init(void) {
@@ -69,13 +47,13 @@ int disk_get_info(const char* path, DiskInfo* info) {
     if (node) {
         VirtualFS* vfs = vfs_get_instance();
         
-        // Calculate total size by traversing VFS
+        // Usage comes from the root's subtree aggregates
         info->total_size = 1024ULL * 1024 * 1024 * 10; // 10GB virtual
-        info->used_size = (vfs && vfs->root) ? calculate_size_recursive(vfs->root) : 0;
+        info->used_size = (vfs && vfs->root) ? vfs->root->tree_size : 0;
         info->available_size = info->total_size - info->used_size;
         info->usage_percent = (int)((info->used_size * 100) / info->total_size);
         info->total_inodes = 100000;
-        info->used_inodes = (vfs && vfs->root) ? count_inodes_recursive(vfs->root) : 0;
+        info->used_inodes = (vfs && vfs->root) ? vfs->root->tree_inodes : 0;
         info->available_inodes = info->total_inodes - info->used_inodes;
         info->readonly = 0;
         return 0;
@@ -235,7 +213,7 @@ uint64_t disk_calculate_directory_size(const char* path, int recursive) {
     }
     
     if (node->is_directory && recursive) {
-        return calculate_size_recursive(node);
+        return node->tree_size;
     } else if (node->is_directory) {
         // Only direct children
         uint64_t total = 0;
@@ -328,17 +306,38 @@ int disk_find_large_files(const char* path, uint64_t min_size, DiskEntry** entri
 
 // Quota management
 int disk_set_quota(const char* user, uint64_t quota_bytes) {
-    // Store quota settings (simplified - in a real system this would be persistent)
-    // For now just accept the value
+    if (!user) return -1;
+    
+    for (int i = 0; i < disk_quota_count; i++) {
+        if (strcmp(disk_quotas[i].user, user) == 0) {
+            disk_quotas[i].limit = quota_bytes;
+            return 0;
+        }
+    }
+    if (disk_quota_count >= DISK_MAX_QUOTAS) return -1;
+    
+    strncpy(disk_quotas[disk_quota_count].user, user, sizeof(disk_quotas[0].user) - 1);
+    disk_quotas[disk_quota_count].user[sizeof(disk_quotas[0].user) - 1] = '\0';
+    disk_quotas[disk_quota_count].limit = quota_bytes;
+    disk_quota_count++;
     return 0;
 }
 
 int disk_get_quota(const char* user, uint64_t* quota_bytes, uint64_t* used_bytes) {
     if (!user || !quota_bytes || !used_bytes) return -1;
     
-    // Simplified: return defaults
-    *quota_bytes = 1024ULL * 1024 * 1024; // 1GB
-    *used_bytes = 0; // Would need to track per-user usage
+    *quota_bytes = DISK_DEFAULT_QUOTA;
+    for (int i = 0; i < disk_quota_count; i++) {
+        if (strcmp(disk_quotas[i].user, user) == 0) {
+            *quota_bytes = disk_quotas[i].limit;
+            break;
+        }
+    }
+    
+    // The VFS keeps per-owner totals current, so this is a table lookup
+    unsigned long long used = 0;
+    vfs_get_usage(user, &used, NULL);
+    *used_bytes = used;
     
     return 0;
 }
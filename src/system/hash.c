@@ -0,0 +1,808 @@
+#include "system/hash.h"
+#include "vfs/vfs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HASH_XXH3_SSE2 1
+#endif
+
+static double hash_now_seconds(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// ===== SHA-256 (FIPS 180-4) =====
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_compress(uint32_t state[8], const uint8_t* block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (int i = 0; i < 64; i++) {
+        uint32_t s1 = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+        uint32_t s0 = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void hash_sha256_init(HashSha256* ctx) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->length = 0;
+    ctx->buffered = 0;
+}
+
+void hash_sha256_update(HashSha256* ctx, const void* data, size_t size) {
+    const uint8_t* p = (const uint8_t*)data;
+    ctx->length += size;
+
+    if (ctx->buffered > 0) {
+        size_t take = 64 - ctx->buffered;
+        if (take > size) take = size;
+        memcpy(ctx->buffer + ctx->buffered, p, take);
+        ctx->buffered += take;
+        p += take;
+        size -= take;
+        if (ctx->buffered < 64) return;
+        sha256_compress(ctx->state, ctx->buffer);
+        ctx->buffered = 0;
+    }
+
+    while (size >= 64) {
+        sha256_compress(ctx->state, p);
+        p += 64;
+        size -= 64;
+    }
+
+    memcpy(ctx->buffer, p, size);
+    ctx->buffered = size;
+}
+
+void hash_sha256_final(HashSha256* ctx, uint8_t out[HASH_SHA256_SIZE]) {
+    uint64_t bits = ctx->length * 8;
+
+    ctx->buffer[ctx->buffered++] = 0x80;
+    if (ctx->buffered > 56) {
+        memset(ctx->buffer + ctx->buffered, 0, 64 - ctx->buffered);
+        sha256_compress(ctx->state, ctx->buffer);
+        ctx->buffered = 0;
+    }
+    memset(ctx->buffer + ctx->buffered, 0, 56 - ctx->buffered);
+    for (int i = 0; i < 8; i++) {
+        ctx->buffer[56 + i] = (uint8_t)(bits >> (56 - 8 * i));
+    }
+    sha256_compress(ctx->state, ctx->buffer);
+
+    for (int i = 0; i < 8; i++) {
+        out[i * 4] = (uint8_t)(ctx->state[i] >> 24);
+        out[i * 4 + 1] = (uint8_t)(ctx->state[i] >> 16);
+        out[i * 4 + 2] = (uint8_t)(ctx->state[i] >> 8);
+        out[i * 4 + 3] = (uint8_t)ctx->state[i];
+    }
+}
+
+void hash_sha256(const void* data, size_t size, uint8_t out[HASH_SHA256_SIZE]) {
+    HashSha256 ctx;
+    hash_sha256_init(&ctx);
+    hash_sha256_update(&ctx, data, size);
+    hash_sha256_final(&ctx, out);
+}
+
+// ===== XXH3-64 (seed 0, default secret) =====
+
+#define XXH_PRIME32_1   0x9E3779B1U
+#define XXH_PRIME32_2   0x85EBCA77U
+#define XXH_PRIME32_3   0xC2B2AE3DU
+#define XXH_PRIME64_1   0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2   0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3   0x165667B19E3779F9ULL
+#define XXH_PRIME64_4   0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5   0x27D4EB2F165667C5ULL
+#define XXH_PRIME_MX1   0x165667919E3779F9ULL
+#define XXH_PRIME_MX2   0x9FB21C651E98DF25ULL
+
+#define XXH_STRIPE_LEN          64
+#define XXH_SECRET_SIZE         192
+#define XXH_SECRET_CONSUME_RATE 8
+#define XXH_STRIPES_PER_BLOCK   ((XXH_SECRET_SIZE - XXH_STRIPE_LEN) / XXH_SECRET_CONSUME_RATE)
+#define XXH_BLOCK_LEN           (XXH_STRIPE_LEN * XXH_STRIPES_PER_BLOCK)
+#define XXH_SECRET_LASTACC      7
+#define XXH_SECRET_MERGEACCS    11
+#define XXH_MIDSIZE_MAX         240
+
+static const uint8_t xxh3_secret[XXH_SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static uint64_t mul128_fold64(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 product = (unsigned __int128)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+    uint64_t lo_lo = (a & 0xFFFFFFFFULL) * (b & 0xFFFFFFFFULL);
+    uint64_t hi_lo = (a >> 32) * (b & 0xFFFFFFFFULL);
+    uint64_t lo_hi = (a & 0xFFFFFFFFULL) * (b >> 32);
+    uint64_t hi_hi = (a >> 32) * (b >> 32);
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFFULL) + lo_hi;
+    uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFFULL);
+    return lower ^ upper;
+#endif
+}
+
+static uint64_t swap64(uint64_t x) {
+    x = ((x & 0x00FF00FF00FF00FFULL) << 8) | ((x >> 8) & 0x00FF00FF00FF00FFULL);
+    x = ((x & 0x0000FFFF0000FFFFULL) << 16) | ((x >> 16) & 0x0000FFFF0000FFFFULL);
+    return (x << 32) | (x >> 32);
+}
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t xxh64_avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static uint64_t xxh3_avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= XXH_PRIME_MX1;
+    h ^= h >> 32;
+    return h;
+}
+
+static uint64_t xxh3_rrmxmx(uint64_t h, uint64_t length) {
+    h ^= rotl64(h, 49) ^ rotl64(h, 24);
+    h *= XXH_PRIME_MX2;
+    h ^= (h >> 35) + length;
+    h *= XXH_PRIME_MX2;
+    return h ^ (h >> 28);
+}
+
+static uint64_t xxh3_mix16(const uint8_t* input, const uint8_t* secret) {
+    return mul128_fold64(read64(input) ^ read64(secret), read64(input + 8) ^ read64(secret + 8));
+}
+
+static uint64_t xxh3_short(const uint8_t* input, size_t length) {
+    const uint8_t* secret = xxh3_secret;
+
+    if (length == 0) {
+        return xxh64_avalanche(read64(secret + 56) ^ read64(secret + 64));
+    }
+    if (length <= 3) {
+        uint32_t combined = ((uint32_t)input[0] << 16) | ((uint32_t)input[length >> 1] << 24) |
+                            (uint32_t)input[length - 1] | ((uint32_t)length << 8);
+        uint64_t bitflip = (uint64_t)(read32(secret) ^ read32(secret + 4));
+        return xxh64_avalanche((uint64_t)combined ^ bitflip);
+    }
+    if (length <= 8) {
+        uint64_t bitflip = read64(secret + 8) ^ read64(secret + 16);
+        uint64_t input64 = (uint64_t)read32(input + length - 4) + ((uint64_t)read32(input) << 32);
+        return xxh3_rrmxmx(input64 ^ bitflip, length);
+    }
+    if (length <= 16) {
+        uint64_t bitflip1 = read64(secret + 24) ^ read64(secret + 32);
+        uint64_t bitflip2 = read64(secret + 40) ^ read64(secret + 48);
+        uint64_t lo = read64(input) ^ bitflip1;
+        uint64_t hi = read64(input + length - 8) ^ bitflip2;
+        uint64_t acc = length + swap64(lo) + hi + mul128_fold64(lo, hi);
+        return xxh3_avalanche(acc);
+    }
+    if (length <= 128) {
+        uint64_t acc = length * XXH_PRIME64_1;
+        if (length > 32) {
+            if (length > 64) {
+                if (length > 96) {
+                    acc += xxh3_mix16(input + 48, secret + 96);
+                    acc += xxh3_mix16(input + length - 64, secret + 112);
+                }
+                acc += xxh3_mix16(input + 32, secret + 64);
+                acc += xxh3_mix16(input + length - 48, secret + 80);
+            }
+            acc += xxh3_mix16(input + 16, secret + 32);
+            acc += xxh3_mix16(input + length - 32, secret + 48);
+        }
+        acc += xxh3_mix16(input, secret);
+        acc += xxh3_mix16(input + length - 16, secret + 16);
+        return xxh3_avalanche(acc);
+    }
+
+    // 129..240 bytes
+    uint64_t acc = length * XXH_PRIME64_1;
+    int rounds = (int)length / 16;
+    for (int i = 0; i < 8; i++) {
+        acc += xxh3_mix16(input + 16 * i, secret + 16 * i);
+    }
+    acc = xxh3_avalanche(acc);
+    for (int i = 8; i < rounds; i++) {
+        acc += xxh3_mix16(input + 16 * i, secret + 16 * (i - 8) + 3);
+    }
+    acc += xxh3_mix16(input + length - 16, secret + 136 - 17);
+    return xxh3_avalanche(acc);
+}
+
+// One 64-byte stripe into the eight accumulators
+static void xxh3_accumulate_512(uint64_t* acc, const uint8_t* input, const uint8_t* secret) {
+#ifdef HASH_XXH3_SSE2
+    __m128i* xacc = (__m128i*)acc;
+    for (int i = 0; i < 4; i++) {
+        __m128i data = _mm_loadu_si128((const __m128i*)(input + 16 * i));
+        __m128i key = _mm_loadu_si128((const __m128i*)(secret + 16 * i));
+        __m128i data_key = _mm_xor_si128(data, key);
+        __m128i data_key_hi = _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+        __m128i product = _mm_mul_epu32(data_key, data_key_hi);
+        __m128i data_swap = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        __m128i sum = _mm_add_epi64(_mm_loadu_si128(xacc + i), data_swap);
+        _mm_storeu_si128(xacc + i, _mm_add_epi64(product, sum));
+    }
+#else
+    for (int i = 0; i < 8; i++) {
+        uint64_t data = read64(input + 8 * i);
+        uint64_t data_key = data ^ read64(secret + 8 * i);
+        acc[i ^ 1] += data;
+        acc[i] += (data_key & 0xFFFFFFFFULL) * (data_key >> 32);
+    }
+#endif
+}
+
+static void xxh3_scramble(uint64_t* acc, const uint8_t* secret) {
+#ifdef HASH_XXH3_SSE2
+    __m128i* xacc = (__m128i*)acc;
+    const __m128i prime = _mm_set1_epi32((int)XXH_PRIME32_1);
+    for (int i = 0; i < 4; i++) {
+        __m128i a = _mm_loadu_si128(xacc + i);
+        a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+        a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i*)(secret + 16 * i)));
+        __m128i a_hi = _mm_shuffle_epi32(a, _MM_SHUFFLE(0, 3, 0, 1));
+        __m128i product_lo = _mm_mul_epu32(a, prime);
+        __m128i product_hi = _mm_mul_epu32(a_hi, prime);
+        _mm_storeu_si128(xacc + i, _mm_add_epi64(product_lo, _mm_slli_epi64(product_hi, 32)));
+    }
+#else
+    for (int i = 0; i < 8; i++) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= read64(secret + 8 * i);
+        acc[i] = a * XXH_PRIME32_1;
+    }
+#endif
+}
+
+static void xxh3_accumulate(uint64_t* acc, const uint8_t* input, const uint8_t* secret, size_t stripes) {
+    for (size_t n = 0; n < stripes; n++) {
+        xxh3_accumulate_512(acc, input + n * XXH_STRIPE_LEN, secret + n * XXH_SECRET_CONSUME_RATE);
+    }
+}
+
+static void xxh3_init_acc(uint64_t acc[8]) {
+    acc[0] = XXH_PRIME32_3;
+    acc[1] = XXH_PRIME64_1;
+    acc[2] = XXH_PRIME64_2;
+    acc[3] = XXH_PRIME64_3;
+    acc[4] = XXH_PRIME64_4;
+    acc[5] = XXH_PRIME32_2;
+    acc[6] = XXH_PRIME64_5;
+    acc[7] = XXH_PRIME32_1;
+}
+
+static uint64_t xxh3_merge(const uint64_t acc[8], uint64_t start) {
+    const uint8_t* secret = xxh3_secret + XXH_SECRET_MERGEACCS;
+    uint64_t result = start;
+    for (int i = 0; i < 4; i++) {
+        result += mul128_fold64(acc[2 * i] ^ read64(secret + 16 * i),
+                                acc[2 * i + 1] ^ read64(secret + 16 * i + 8));
+    }
+    return xxh3_avalanche(result);
+}
+
+static uint64_t xxh3_long(const uint8_t* input, size_t length) {
+    uint64_t acc[8];
+    xxh3_init_acc(acc);
+
+    size_t blocks = (length - 1) / XXH_BLOCK_LEN;
+    for (size_t n = 0; n < blocks; n++) {
+        xxh3_accumulate(acc, input + n * XXH_BLOCK_LEN, xxh3_secret, XXH_STRIPES_PER_BLOCK);
+        xxh3_scramble(acc, xxh3_secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN);
+    }
+
+    size_t stripes = ((length - 1) - XXH_BLOCK_LEN * blocks) / XXH_STRIPE_LEN;
+    xxh3_accumulate(acc, input + blocks * XXH_BLOCK_LEN, xxh3_secret, stripes);
+    xxh3_accumulate_512(acc, input + length - XXH_STRIPE_LEN,
+                        xxh3_secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN - XXH_SECRET_LASTACC);
+
+    return xxh3_merge(acc, length * XXH_PRIME64_1);
+}
+
+uint64_t hash_xxh3(const void* data, size_t size) {
+    const uint8_t* input = (const uint8_t*)data;
+    if (size <= XXH_MIDSIZE_MAX) return xxh3_short(input, size);
+    return xxh3_long(input, size);
+}
+
+void hash_xxh3_init(HashXxh3* ctx) {
+    xxh3_init_acc(ctx->acc);
+    ctx->buffered = 0;
+    ctx->length = 0;
+    ctx->stripes_in_block = 0;
+}
+
+static void xxh3_consume_stripes(HashXxh3* ctx, const uint8_t* input, size_t stripes) {
+    if (XXH_STRIPES_PER_BLOCK - ctx->stripes_in_block <= stripes) {
+        size_t to_block_end = XXH_STRIPES_PER_BLOCK - ctx->stripes_in_block;
+        size_t after = stripes - to_block_end;
+        xxh3_accumulate(ctx->acc, input, xxh3_secret + ctx->stripes_in_block * XXH_SECRET_CONSUME_RATE,
+                        to_block_end);
+        xxh3_scramble(ctx->acc, xxh3_secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN);
+        xxh3_accumulate(ctx->acc, input + to_block_end * XXH_STRIPE_LEN, xxh3_secret, after);
+        ctx->stripes_in_block = after;
+    } else {
+        xxh3_accumulate(ctx->acc, input, xxh3_secret + ctx->stripes_in_block * XXH_SECRET_CONSUME_RATE,
+                        stripes);
+        ctx->stripes_in_block += stripes;
+    }
+}
+
+// The buffer is only consumed once more input arrives, so the final
+// partial stripe is always still buffered when the digest is taken
+void hash_xxh3_update(HashXxh3* ctx, const void* data, size_t size) {
+    const uint8_t* input = (const uint8_t*)data;
+    const size_t buffer_stripes = sizeof(ctx->buffer) / XXH_STRIPE_LEN;
+    ctx->length += size;
+
+    if (ctx->buffered + size <= sizeof(ctx->buffer)) {
+        memcpy(ctx->buffer + ctx->buffered, input, size);
+        ctx->buffered += size;
+        return;
+    }
+
+    if (ctx->buffered > 0) {
+        size_t fill = sizeof(ctx->buffer) - ctx->buffered;
+        memcpy(ctx->buffer + ctx->buffered, input, fill);
+        input += fill;
+        size -= fill;
+        xxh3_consume_stripes(ctx, ctx->buffer, buffer_stripes);
+        ctx->buffered = 0;
+    }
+
+    if (size > sizeof(ctx->buffer)) {
+        do {
+            xxh3_consume_stripes(ctx, input, buffer_stripes);
+            input += sizeof(ctx->buffer);
+            size -= sizeof(ctx->buffer);
+        } while (size > sizeof(ctx->buffer));
+        // Keep the last consumed stripe around for a short final stripe
+        memcpy(ctx->buffer + sizeof(ctx->buffer) - XXH_STRIPE_LEN, input - XXH_STRIPE_LEN, XXH_STRIPE_LEN);
+    }
+
+    memcpy(ctx->buffer, input, size);
+    ctx->buffered = size;
+}
+
+uint64_t hash_xxh3_final(const HashXxh3* ctx) {
+    if (ctx->length <= XXH_MIDSIZE_MAX) {
+        return xxh3_short(ctx->buffer, (size_t)ctx->length);
+    }
+
+    HashXxh3 copy = *ctx;
+    if (copy.buffered >= XXH_STRIPE_LEN) {
+        size_t stripes = (copy.buffered - 1) / XXH_STRIPE_LEN;
+        xxh3_consume_stripes(&copy, copy.buffer, stripes);
+        xxh3_accumulate_512(copy.acc, copy.buffer + copy.buffered - XXH_STRIPE_LEN,
+                            xxh3_secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN - XXH_SECRET_LASTACC);
+    } else {
+        uint8_t last_stripe[XXH_STRIPE_LEN];
+        size_t catchup = XXH_STRIPE_LEN - copy.buffered;
+        memcpy(last_stripe, copy.buffer + sizeof(copy.buffer) - catchup, catchup);
+        memcpy(last_stripe + catchup, copy.buffer, copy.buffered);
+        xxh3_accumulate_512(copy.acc, last_stripe,
+                            xxh3_secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN - XXH_SECRET_LASTACC);
+    }
+
+    return xxh3_merge(copy.acc, copy.length * XXH_PRIME64_1);
+}
+
+// ===== File hashing =====
+
+// One algorithm over one file; content is either in memory or streamed from the host
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    const char* host_path;
+    unsigned int algorithm;
+    HashDigest* digest;
+    int status;
+} HashJob;
+
+typedef struct {
+    HashJob* jobs;
+    int count;
+    volatile long* next;
+} HashWorker;
+
+static int hash_stream_host(const char* host_path, unsigned int algorithms, HashDigest* digest) {
+    FILE* file = fopen(host_path, "rb");
+    if (!file) return -1;
+
+    uint8_t* chunk = malloc(HASH_CHUNK_SIZE);
+    if (!chunk) {
+        fclose(file);
+        return -1;
+    }
+
+    HashXxh3 xxh3;
+    HashSha256 sha256;
+    hash_xxh3_init(&xxh3);
+    hash_sha256_init(&sha256);
+
+    size_t got;
+    while ((got = fread(chunk, 1, HASH_CHUNK_SIZE, file)) > 0) {
+        if (algorithms & HASH_XXH3) hash_xxh3_update(&xxh3, chunk, got);
+        if (algorithms & HASH_SHA256) hash_sha256_update(&sha256, chunk, got);
+    }
+    int failed = ferror(file);
+    fclose(file);
+    free(chunk);
+    if (failed) return -1;
+
+    if (algorithms & HASH_XXH3) digest->xxh3 = hash_xxh3_final(&xxh3);
+    if (algorithms & HASH_SHA256) hash_sha256_final(&sha256, digest->sha256);
+    return 0;
+}
+
+static void hash_run_job(HashJob* job) {
+    if (job->host_path) {
+        job->status = hash_stream_host(job->host_path, job->algorithm, job->digest);
+        return;
+    }
+
+    if (job->algorithm == HASH_XXH3) {
+        job->digest->xxh3 = hash_xxh3(job->data, job->size);
+    } else {
+        hash_sha256(job->data, job->size, job->digest->sha256);
+    }
+    job->status = 0;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI hash_worker_proc(LPVOID param) {
+    HashWorker* worker = (HashWorker*)param;
+    for (;;) {
+        long index = InterlockedIncrement(worker->next) - 1;
+        if (index >= worker->count) break;
+        hash_run_job(&worker->jobs[index]);
+    }
+    return 0;
+}
+#endif
+
+// Jobs are pulled from a shared counter, so one large file does not hold up the rest
+static void hash_run_jobs(HashJob* jobs, int count, int threads) {
+    if (threads > count) threads = count;
+    if (threads > HASH_MAX_THREADS) threads = HASH_MAX_THREADS;
+
+#ifdef _WIN32
+    if (threads > 1) {
+        HANDLE handles[HASH_MAX_THREADS];
+        volatile long next = 0;
+        HashWorker worker = { jobs, count, &next };
+        int started = 0;
+
+        for (int t = 0; t < threads; t++) {
+            handles[started] = CreateThread(NULL, 0, hash_worker_proc, &worker, 0, NULL);
+            if (handles[started]) started++;
+        }
+
+        // Whatever no thread picked up (or all of it, if none started) runs here
+        hash_worker_proc(&worker);
+
+        if (started > 0) {
+            WaitForMultipleObjects((DWORD)started, handles, TRUE, INFINITE);
+            for (int t = 0; t < started; t++) {
+                CloseHandle(handles[t]);
+            }
+        }
+        return;
+    }
+#endif
+
+    for (int i = 0; i < count; i++) {
+        hash_run_job(&jobs[i]);
+    }
+}
+
+int hash_default_threads(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int cpus = (int)info.dwNumberOfProcessors;
+#else
+    int cpus = 1;
+#endif
+    if (cpus < 1) cpus = 1;
+    if (cpus > HASH_MAX_THREADS) cpus = HASH_MAX_THREADS;
+    return cpus;
+}
+
+// Node loading and cache updates stay on the calling thread; workers only read content
+int hash_files(const char** paths, int count, unsigned int algorithms,
+               HashDigest* digests, int* results, int threads) {
+    if (!paths || !digests || !results || count <= 0) return -1;
+    algorithms &= HASH_XXH3 | HASH_SHA256;
+    if (threads < 1) threads = hash_default_threads();
+
+    VNode** nodes = calloc(count, sizeof(VNode*));
+    HashJob* jobs = calloc((size_t)count * 2, sizeof(HashJob));
+    if (!nodes || !jobs) {
+        free(nodes);
+        free(jobs);
+        return -1;
+    }
+
+    int job_count = 0;
+    for (int i = 0; i < count; i++) {
+        memset(&digests[i], 0, sizeof(HashDigest));
+        results[i] = -1;
+
+        VNode* node = vfs_find_node(paths[i]);
+        if (node && node->is_symlink) node = vfs_resolve_symlink(node);
+        if (!node || node->is_directory) continue;
+        nodes[i] = node;
+        results[i] = 0;
+
+        // Reuse whatever the node already has cached
+        unsigned int cached = node->digest_valid & algorithms;
+        if (cached & HASH_XXH3) digests[i].xxh3 = node->digest_xxh3;
+        if (cached & HASH_SHA256) memcpy(digests[i].sha256, node->digest_sha256, HASH_SHA256_SIZE);
+        digests[i].valid = cached;
+
+        unsigned int needed = algorithms & ~cached;
+        if (!needed) continue;
+
+        if (!node->data && node->host_path) vfs_load_file_content(node);
+        const char* host_path = NULL;
+        if (!node->data && node->size > 0) {
+            // Too large to load into the VFS: stream it from the host instead
+            if (!node->host_path) {
+                results[i] = -1;
+                continue;
+            }
+            host_path = node->host_path;
+        }
+
+        for (unsigned int bit = HASH_XXH3; bit <= HASH_SHA256; bit <<= 1) {
+            if (!(needed & bit)) continue;
+            HashJob* job = &jobs[job_count++];
+            job->data = node->data ? (const uint8_t*)node->data : (const uint8_t*)"";
+            job->size = node->data ? node->size : 0;
+            job->host_path = host_path;
+            job->algorithm = bit;
+            job->digest = &digests[i];
+            job->status = -1;
+        }
+    }
+
+    hash_run_jobs(jobs, job_count, threads);
+
+    for (int j = 0; j < job_count; j++) {
+        int index = (int)(jobs[j].digest - digests);
+        if (jobs[j].status == 0) {
+            digests[index].valid |= jobs[j].algorithm;
+        } else {
+            results[index] = -1;
+        }
+    }
+
+    int failures = 0;
+    for (int i = 0; i < count; i++) {
+        if (results[i] != 0) {
+            failures++;
+            continue;
+        }
+        VNode* node = nodes[i];
+        // While the data is mapped, stores through the mapping can change
+        // it at any time, so nothing is cached until munmap
+        if (node->map_count > 0) continue;
+        if (digests[i].valid & HASH_XXH3) node->digest_xxh3 = digests[i].xxh3;
+        if (digests[i].valid & HASH_SHA256) memcpy(node->digest_sha256, digests[i].sha256, HASH_SHA256_SIZE);
+        node->digest_valid |= digests[i].valid;
+    }
+
+    free(nodes);
+    free(jobs);
+    return failures == 0 ? 0 : -1;
+}
+
+int hash_file(const char* path, unsigned int algorithms, HashDigest* digest) {
+    int result = -1;
+    // Two algorithms on one file can still run side by side
+    hash_files(&path, 1, algorithms, digest, &result, 2);
+    return result;
+}
+
+int hash_host_file(const char* host_path, unsigned int algorithms, HashDigest* digest) {
+    if (!host_path || !digest) return -1;
+    memset(digest, 0, sizeof(*digest));
+    algorithms &= HASH_XXH3 | HASH_SHA256;
+    if (hash_stream_host(host_path, algorithms, digest) != 0) return -1;
+    digest->valid = algorithms;
+    return 0;
+}
+
+void hash_format_sha256(const uint8_t digest[HASH_SHA256_SIZE], char out[2 * HASH_SHA256_SIZE + 1]) {
+    static const char hex[] = "0123456789abcdef";
+    for (int i = 0; i < HASH_SHA256_SIZE; i++) {
+        out[i * 2] = hex[digest[i] >> 4];
+        out[i * 2 + 1] = hex[digest[i] & 0x0F];
+    }
+    out[2 * HASH_SHA256_SIZE] = '\0';
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+int hash_parse_sha256(const char* hex, uint8_t digest[HASH_SHA256_SIZE]) {
+    for (int i = 0; i < HASH_SHA256_SIZE; i++) {
+        int hi = hex_value(hex[i * 2]);
+        int lo = hi < 0 ? -1 : hex_value(hex[i * 2 + 1]);
+        if (lo < 0) return -1;
+        digest[i] = (uint8_t)((hi << 4) | lo);
+    }
+    return 0;
+}
+
+// ===== Benchmark =====
+
+void hash_benchmark(size_t size_mb, int threads) {
+    if (size_mb == 0) size_mb = 64;
+    if (threads < 1) threads = hash_default_threads();
+
+    size_t size = size_mb * 1024 * 1024;
+    uint8_t* data = malloc(size);
+    if (!data) {
+        printf("hash: cannot allocate %zu MB\n", size_mb);
+        return;
+    }
+
+    uint32_t seed = 0x12345678u;
+    for (size_t i = 0; i < size; i += 4) {
+        seed = seed * 1664525u + 1013904223u;
+        memcpy(data + i, &seed, size - i < 4 ? size - i : 4);
+    }
+
+    double start = hash_now_seconds();
+    uint64_t xxh3 = hash_xxh3(data, size);
+    double xxh3_time = hash_now_seconds() - start;
+
+    uint8_t sha256[HASH_SHA256_SIZE];
+    start = hash_now_seconds();
+    hash_sha256(data, size, sha256);
+    double sha256_time = hash_now_seconds() - start;
+
+    // The same buffer cut into one file per job, as sha256sum over many files would see it
+    int files = threads * 4;
+    size_t file_size = size / files;
+    HashDigest* digests = calloc(files, sizeof(HashDigest));
+    HashJob* jobs = calloc(files, sizeof(HashJob));
+    double serial_time = 0, parallel_time = 0;
+    if (digests && jobs && file_size > 0) {
+        for (int pass = 0; pass < 2; pass++) {
+            for (int i = 0; i < files; i++) {
+                jobs[i].data = data + (size_t)i * file_size;
+                jobs[i].size = file_size;
+                jobs[i].host_path = NULL;
+                jobs[i].algorithm = HASH_SHA256;
+                jobs[i].digest = &digests[i];
+            }
+            start = hash_now_seconds();
+            hash_run_jobs(jobs, files, pass == 0 ? 1 : threads);
+            if (pass == 0) serial_time = hash_now_seconds() - start;
+            else parallel_time = hash_now_seconds() - start;
+        }
+    }
+
+    char hex[2 * HASH_SHA256_SIZE + 1];
+    hash_format_sha256(sha256, hex);
+
+    printf("hash benchmark: %zu MB\n", size_mb);
+#ifdef HASH_XXH3_SSE2
+    printf("  xxh3 (SSE2):     %8.1f MB/s  %016llx\n", size_mb / xxh3_time, (unsigned long long)xxh3);
+#else
+    printf("  xxh3 (scalar):   %8.1f MB/s  %016llx\n", size_mb / xxh3_time, (unsigned long long)xxh3);
+#endif
+    printf("  sha256:          %8.1f MB/s  %.16s...\n", size_mb / sha256_time, hex);
+    if (serial_time > 0 && parallel_time > 0) {
+        printf("  sha256 %d files: %8.1f MB/s on 1 thread, %.1f MB/s on %d (%.2fx)\n",
+               files, size_mb / serial_time, size_mb / parallel_time, threads,
+               serial_time / parallel_time);
+    }
+
+    free(jobs);
+    free(digests);
+    free(data);
+}
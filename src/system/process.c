@@ -1,10 +1,29 @@
 #include "system/process.h"
+#include "kernel/mmu.h"
+#include "kernel/scheduler.h"
+#include "vfs/vfs_file.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <windows.h>
 
 static ProcessTable g_process_table = {0};
+static volatile long g_signals_posted = 0;     // Some process has a pending_signal
+
+// Free a process's address space.  If this thread is running in it, go
+// back to the kernel's first; destroying it then drops the TLB entries
+// tagged with its ASID, so the ASID can be handed out again.
+static void process_free_address_space(Process* proc) {
+    PageDirectory* dir = (PageDirectory*)proc->page_directory;
+    if (!dir) return;
+    
+    if (dir == mmu_get_current_page_directory()) {
+        mmu_switch_page_directory(mmu_get_kernel_page_directory());
+    }
+    mmu_destroy_page_directory(dir);
+    proc->page_directory = NULL;
+}
 
 // Initialize process management system
 int process_init(void) {
@@ -25,6 +44,7 @@ int process_init(void) {
     init->start_time = time(NULL);
     init->memory_used = 0;
     init->cpu_percent = 0.0f;
+    init->fd_table = vfs_fdtable_create();
     
     g_process_table.processes[0] = init;
     g_process_table.process_count = 1;
@@ -36,6 +56,9 @@ int process_init(void) {
 void process_cleanup(void) {
     for (int i = 0; i < MAX_PROCESSES; i++) {
         if (g_process_table.processes[i]) {
+            scheduler_remove_process(g_process_table.processes[i]);
+            process_free_address_space(g_process_table.processes[i]);
+            vfs_fdtable_destroy(g_process_table.processes[i]->fd_table);
             free(g_process_table.processes[i]);
             g_process_table.processes[i] = NULL;
         }
@@ -76,6 +99,11 @@ int process_create(const char* name, const char* args, ProcessPriority priority)
     proc->start_time = time(NULL);
     proc->memory_used = 1024 * 1024; // Default 1MB
     proc->cpu_percent = 0.0f;
+    proc->fd_table = vfs_fdtable_create();
+    if (!proc->fd_table) {
+        free(proc);
+        return -1;
+    }
     
     g_process_table.processes[slot] = proc;
     g_process_table.process_count++;
@@ -83,6 +111,40 @@ int process_create(const char* name, const char* args, ProcessPriority priority)
     return proc->pid;
 }
 
+// Fork a process.  The child gets a copy-on-write clone of the parent's
+// address space, so this costs page tables rather than memory, and a copy
+// of its descriptor table sharing every open file.
+int process_fork(int pid) {
+    Process* parent = process_get(pid);
+    if (!parent) return -1;
+    
+    PageDirectory* dir = NULL;
+    if (parent->page_directory) {
+        dir = mmu_clone_page_directory(parent->page_directory);
+        if (!dir) return -1;
+    }
+    
+    int child_pid = process_create(parent->name, parent->args, parent->priority);
+    Process* child = child_pid > 0 ? process_get(child_pid) : NULL;
+    if (!child) {
+        mmu_destroy_page_directory(dir);
+        return -1;
+    }
+    
+    child->ppid = parent->pid;
+    child->memory_used = parent->memory_used;
+    child->page_directory = dir;
+    
+    VFSFdTable* fds = vfs_fdtable_clone(parent->fd_table);
+    if (!fds) {
+        process_kill(child_pid, PROC_SIG_KILL);
+        return -1;
+    }
+    vfs_fdtable_destroy(child->fd_table);
+    child->fd_table = fds;
+    return child_pid;
+}
+
 // Kill a process
 int process_kill(int pid, int signal) {
     Process* proc = process_get(pid);
@@ -93,7 +155,8 @@ int process_kill(int pid, int signal) {
         return -1;
     }
     
-    if (signal == PROC_SIG_KILL || signal == PROC_SIG_TERM) {
+    // SIGALRM's default action is to terminate
+    if (signal == PROC_SIG_KILL || signal == PROC_SIG_TERM || signal == PROC_SIG_ALRM) {
         // Mark as zombie first
         proc->state = PROC_STATE_ZOMBIE;
         proc->exit_code = signal;
@@ -102,6 +165,10 @@ int process_kill(int pid, int signal) {
         for (int i = 0; i < MAX_PROCESSES; i++) {
             if (g_process_table.processes[i] && 
                 g_process_table.processes[i]->pid == pid) {
+                scheduler_remove_process(g_process_table.processes[i]);
+                timer_cancel(&g_process_table.processes[i]->alarm_timer);
+                process_free_address_space(g_process_table.processes[i]);
+                vfs_fdtable_destroy(g_process_table.processes[i]->fd_table);
                 free(g_process_table.processes[i]);
                 g_process_table.processes[i] = NULL;
                 g_process_table.process_count--;
@@ -244,6 +311,24 @@ int process_send_signal(int pid, int signal) {
     return process_kill(pid, signal);
 }
 
+// The callback that posts runs under the timer lock, and process_kill()
+// cancels the alarm before freeing, so proc is still there
+void process_post_signal(Process* proc, int signal) {
+    InterlockedExchange(&proc->pending_signal, signal);
+    InterlockedExchange(&g_signals_posted, 1);
+}
+
+void process_deliver_signals(void) {
+    if (!g_signals_posted || !InterlockedExchange(&g_signals_posted, 0)) return;
+    
+    for (int i = 0; i < MAX_PROCESSES; i++) {
+        Process* proc = g_process_table.processes[i];
+        if (proc && proc->pending_signal) {
+            process_kill(proc->pid, (int)InterlockedExchange(&proc->pending_signal, 0));
+        }
+    }
+}
+
 // Search and filtering
 int process_find_by_state(ProcessState state, int** pid_list) {
     if (!pid_list) return -1;
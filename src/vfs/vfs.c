@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <time.h>
 #include "platform/platform.h"
+#include "system/hash.h"
 
 // Debug control - set to 0 to disable verbose debug output
 #define VFS_DEBUG_VERBOSE 0
@@ -28,6 +29,30 @@ static char* vfs_get_host_path(VNode* node);
 static int vfs_ensure_host_directory(const char* host_path);
 static int vfs_sync_to_host(VNode* node);
 
+// Source of VNode::generation values
+static unsigned long vfs_generation_counter = 0;
+
+// Bytes and inodes charged to each owner (only nodes attached under root)
+#define VFS_MAX_USAGE_OWNERS 64
+
+typedef struct {
+    char owner[50];
+    unsigned long long bytes;
+    unsigned long long inodes;
+} VFSUsage;
+
+static VFSUsage vfs_usage[VFS_MAX_USAGE_OWNERS];
+static int vfs_usage_count = 0;
+
+static void vfs_init_accounting(VNode* node) {
+    node->accounted_size = node->size;
+    node->tree_size = node->size;
+    node->tree_inodes = 1;
+    node->tree_dirs = node->is_directory ? 1 : 0;
+    node->digest_valid = 0;
+    node->capacity = 0;
+}
+
 // Create directory node
 VNode* vfs_create_directory_node(const char* name) {
     VNode* node = malloc(sizeof(VNode));
@@ -40,10 +65,14 @@ VNode* vfs_create_directory_node(const char* name) {
     node->symlink_target = NULL;
     node->size = 0;
     node->data = NULL;
+    node->map_count = 0;
+    node->open_count = 0;
     node->host_path = NULL;
     node->parent = NULL;
     node->children = NULL;
     node->next = NULL;
+    node->generation = ++vfs_generation_counter;
+    vfs_init_accounting(node);
     
     // Set default permissions and ownership
     vfs_set_default_permissions(node, vfs_current_user, vfs_current_group);
@@ -64,10 +93,14 @@ VNode* vfs_create_file_node(const char* name) {
     node->symlink_target = NULL;
     node->size = 0;
     node->data = NULL;
+    node->map_count = 0;
+    node->open_count = 0;
     node->host_path = NULL;
     node->parent = NULL;
     node->children = NULL;
     node->next = NULL;
+    node->generation = ++vfs_generation_counter;
+    vfs_init_accounting(node);
     
     // Set default permissions and ownership
     vfs_set_default_permissions(node, vfs_current_user, vfs_current_group);
@@ -76,13 +109,121 @@ VNode* vfs_create_file_node(const char* name) {
     return node;
 }
 
+static void vfs_usage_add(const char* owner, long long bytes, long long inodes) {
+    for (int i = 0; i < vfs_usage_count; i++) {
+        if (strcmp(vfs_usage[i].owner, owner) == 0) {
+            vfs_usage[i].bytes += bytes;
+            vfs_usage[i].inodes += inodes;
+            return;
+        }
+    }
+    if (vfs_usage_count >= VFS_MAX_USAGE_OWNERS) return;
+    
+    VFSUsage* usage = &vfs_usage[vfs_usage_count++];
+    strncpy(usage->owner, owner, sizeof(usage->owner) - 1);
+    usage->owner[sizeof(usage->owner) - 1] = '\0';
+    usage->bytes = bytes;
+    usage->inodes = inodes;
+}
+
+// Charge (sign 1) or refund (sign -1) every node of a subtree to its owner
+static void vfs_usage_subtree(VNode* node, int sign) {
+    vfs_usage_add(node->owner, sign * (long long)node->accounted_size, sign);
+    for (VNode* child = node->children; child; child = child->next) {
+        vfs_usage_subtree(child, sign);
+    }
+}
+
+// Apply a delta to a node and all of its ancestors; returns the topmost node
+static VNode* vfs_propagate(VNode* node, long long bytes, long long inodes, long long dirs) {
+    VNode* top = node;
+    for (; node; node = node->parent) {
+        node->tree_size += bytes;
+        node->tree_inodes += inodes;
+        node->tree_dirs += dirs;
+        top = node;
+    }
+    return top;
+}
+
+void vfs_account_node(VNode* node) {
+    if (!node) return;
+    node->digest_valid = 0;
+    if (node->size == node->accounted_size) return;
+    
+    long long delta = (long long)node->size - (long long)node->accounted_size;
+    node->accounted_size = node->size;
+    
+    VNode* top = vfs_propagate(node, delta, 0, 0);
+    if (vm_fs && top == vm_fs->root) {
+        vfs_usage_add(node->owner, delta, 0);
+    }
+}
+
+int vfs_get_usage(const char* owner, unsigned long long* bytes, unsigned long long* inodes) {
+    if (!owner) return -1;
+    
+    for (int i = 0; i < vfs_usage_count; i++) {
+        if (strcmp(vfs_usage[i].owner, owner) == 0) {
+            if (bytes) *bytes = vfs_usage[i].bytes;
+            if (inodes) *inodes = vfs_usage[i].inodes;
+            return 0;
+        }
+    }
+    if (bytes) *bytes = 0;
+    if (inodes) *inodes = 0;
+    return 0;
+}
+
 // Add child to parent
 void vfs_add_child(VNode* parent, VNode* child) {
     if (!parent || !child) return;
     
+    // Pick up any size set on the node before it was attached
+    vfs_account_node(child);
+    
     child->parent = parent;
     child->next = parent->children;
     parent->children = child;
+    vfs_touch_directory(parent);
+    
+    VNode* top = vfs_propagate(parent, child->tree_size, child->tree_inodes, child->tree_dirs);
+    if (vm_fs && top == vm_fs->root) {
+        vfs_usage_subtree(child, 1);
+    }
+}
+
+// Take an already unlinked child's totals back out of its former ancestors
+static void vfs_detach_accounting(VNode* parent, VNode* child) {
+    vfs_touch_directory(parent);
+    
+    VNode* top = vfs_propagate(parent, -(long long)child->tree_size,
+                               -(long long)child->tree_inodes, -(long long)child->tree_dirs);
+    if (vm_fs && top == vm_fs->root) {
+        vfs_usage_subtree(child, -1);
+    }
+    child->parent = NULL;
+    child->next = NULL;
+}
+
+// Unlink a child from its parent's list; the node itself is left to the caller
+static void vfs_remove_child(VNode* parent, VNode* child) {
+    VNode* prev = NULL;
+    for (VNode* current = parent->children; current; prev = current, current = current->next) {
+        if (current != child) continue;
+        
+        if (prev) {
+            prev->next = current->next;
+        } else {
+            parent->children = current->next;
+        }
+        vfs_detach_accounting(parent, child);
+        return;
+    }
+}
+
+void vfs_touch_directory(VNode* dir) {
+    if (dir) dir->generation = ++vfs_generation_counter;
 }
 
 // Load file content from host filesystem (on-demand)
@@ -113,6 +254,7 @@ int vfs_load_file_content(VNode* node) {
     fseek(f, 0, SEEK_SET);
     
     // Allocate memory for content plus null terminator
+    node->capacity = 0;
     node->data = malloc(size + 1);
     if (!node->data) {
         printf("VFS: Memory allocation failed for: %s\n", node->host_path);
@@ -137,6 +279,7 @@ int vfs_load_file_content(VNode* node) {
     // Null-terminate for text files
     ((char*)node->data)[size] = '\0';
     node->size = size;
+    vfs_account_node(node);
     
     // Debug message disabled to reduce clutter
     // printf("VFS: Loaded file content: %s (%zu bytes)\n", node->name, node->size);
@@ -310,10 +453,14 @@ int vfs_init(void) {
     vm_fs->root->is_directory = 1;
     vm_fs->root->size = 0;
     vm_fs->root->data = NULL;
+    vm_fs->root->map_count = 0;
+    vm_fs->root->open_count = 0;
     vm_fs->root->host_path = NULL;
     vm_fs->root->parent = NULL;
     vm_fs->root->children = NULL;
     vm_fs->root->next = NULL;
+    vm_fs->root->generation = ++vfs_generation_counter;
+    vfs_init_accounting(vm_fs->root);
     
     vm_fs->current_dir = vm_fs->root;
     
@@ -795,23 +942,8 @@ int vfs_rmdir(const char* path) {
     }
 
     // Remove from parent's children list
-    VNode* parent = node->parent;
-    if (parent) {
-        VNode* prev = NULL;
-        VNode* current = parent->children;
-        
-        while (current) {
-            if (current == node) {
-                if (prev) {
-                    prev->next = current->next;
-                } else {
-                    parent->children = current->next;
-                }
-                break;
-            }
-            prev = current;
-            current = current->next;
-        }
+    if (node->parent) {
+        vfs_remove_child(node->parent, node);
     }
 
     free(node);
@@ -822,6 +954,17 @@ int vfs_rmdir(const char* path) {
         return -1;
     }
 
+    // The buffer of a mapped file must outlive the mapping
+    if (node->map_count > 0) {
+        printf("VFS: '%s' is mapped; unmap it before deleting\n", path);
+        return -1;
+    }
+    // Open files point at the node itself
+    if (node->open_count > 0) {
+        printf("VFS: '%s' is open; close it before deleting\n", path);
+        return -1;
+    }
+
     // NEW: Delete from host filesystem first
     if (strlen(host_root_directory) > 0) {
         char* host_path = vfs_get_host_path(node);
@@ -831,23 +974,8 @@ int vfs_rmdir(const char* path) {
     }
 
     // Remove from parent's children list
-    VNode* parent = node->parent;
-    if (parent) {
-        VNode* prev = NULL;
-        VNode* current = parent->children;
-        
-        while (current) {
-            if (current == node) {
-                if (prev) {
-                    prev->next = current->next;
-                } else {
-                    parent->children = current->next;
-                }
-                break;
-            }
-            prev = current;
-            current = current->next;
-        }
+    if (node->parent) {
+        vfs_remove_child(node->parent, node);
     }
 
     if (node->data) {
@@ -875,10 +1003,19 @@ int vfs_write_file(const char* path, const void* data, size_t size) {
         return -1;
     }
 
+    // A mapped buffer can't be replaced, only overwritten within its size
+    if (node->map_count > 0) {
+        if (size > node->size || !data) return -1;
+        memcpy(node->data, data, size);
+        node->size = size;
+        return vfs_sync_node(node);
+    }
+    
     // Update VFS data
     if (node->data) {
         free(node->data);
     }
+    node->capacity = 0;
     
     if (size > 0 && data) {
         node->data = malloc(size);
@@ -889,6 +1026,7 @@ int vfs_write_file(const char* path, const void* data, size_t size) {
         node->data = NULL;
         node->size = 0;
     }
+    vfs_account_node(node);
     
     // Update modification time
     node->modified_time = time(NULL);
@@ -901,6 +1039,43 @@ int vfs_write_file(const char* path, const void* data, size_t size) {
     return 0;
 }
 
+// Commit an in-place modification of a file node (used by VFS streams)
+int vfs_sync_node(VNode* node) {
+    if (!node || node->is_directory) return -1;
+    
+    vfs_account_node(node);
+    node->modified_time = time(NULL);
+    
+    if (strlen(host_root_directory) > 0) {
+        return vfs_sync_to_host(node);
+    }
+    return 0;
+}
+
+// Make room behind a file node's data for `needed` bytes and a NUL, never
+// shrinking it below the current size.  Every writer of the node shares
+// its capacity; a mapped buffer can't move, so it only takes writes
+// within its size.
+int vfs_reserve_node(VNode* node, size_t needed) {
+    if (!node || node->is_directory) return -1;
+    if (needed < node->size) needed = node->size;
+    if (node->data && needed < node->capacity) return 0;
+    if (node->map_count > 0) return needed <= node->size ? 0 : -1;
+    if (needed >= SIZE_MAX / 2) return -1;
+    
+    size_t capacity = node->capacity > 4096 ? node->capacity : 4096;
+    while (capacity < needed + 1) {
+        capacity *= 2;
+    }
+    
+    void* data = realloc(node->data, capacity);
+    if (!data) return -1;
+    
+    node->data = data;
+    node->capacity = capacity;
+    return 0;
+}
+
 // Read data from a file in VFS (with on-demand loading)
 int vfs_read_file(const char* path, void** data, size_t* size) {
     VNode* node = vfs_find_node(path);
@@ -971,10 +1146,14 @@ int vfs_create_symlink(const char* link_path, const char* target_path) {
     link->symlink_target = strdup(target_path);
     link->size = strlen(target_path);
     link->data = NULL;
+    link->map_count = 0;
+    link->open_count = 0;
     link->host_path = NULL;
     link->parent = NULL;
     link->children = NULL;
     link->next = NULL;
+    link->generation = ++vfs_generation_counter;
+    vfs_init_accounting(link);
     
     // Set permissions for symlink (usually 777)
     vfs_set_default_permissions(link, vfs_current_user, vfs_current_group);
@@ -1076,9 +1255,7 @@ int vfs_mount_root_autodiscover(const char* host_root) {
                 // Add to root directory
                 VNode* root = vfs_find_node("/");
                 if (root) {
-                    file_node->parent = root;
-                    file_node->next = root->children;
-                    root->children = file_node;
+                    vfs_add_child(root, file_node);
                 }
             }
         }
@@ -1134,8 +1311,11 @@ int vfs_chown(const char* path, const char* owner, const char* group) {
     }
     
     if (owner) {
+        // Found from root, so the node is charged to its current owner
+        vfs_usage_add(node->owner, -(long long)node->accounted_size, -1);
         strncpy(node->owner, owner, sizeof(node->owner) - 1);
         node->owner[sizeof(node->owner) - 1] = '\0';
+        vfs_usage_add(node->owner, (long long)node->accounted_size, 1);
     }
     
     if (group) {
@@ -1283,9 +1463,7 @@ static int vfs_sync_directory_from_host(const char* host_path, VNode* vfs_node,
                 // Create new directory in VFS
                 VNode* new_dir = vfs_create_directory_node(find_data.cFileName);
                 if (new_dir) {
-                    new_dir->parent = vfs_node;
-                    new_dir->next = vfs_node->children;
-                    vfs_node->children = new_dir;
+                    vfs_add_child(vfs_node, new_dir);
                     if (verbose) {
                         printf("[LIVE-SYNC] Added directory: %s\n", find_data.cFileName);
                     }
@@ -1303,9 +1481,7 @@ static int vfs_sync_directory_from_host(const char* host_path, VNode* vfs_node,
                 // Create new file in VFS
                 VNode* new_file = vfs_create_file_node(find_data.cFileName);
                 if (new_file) {
-                    new_file->parent = vfs_node;
-                    new_file->next = vfs_node->children;
-                    vfs_node->children = new_file;
+                    vfs_add_child(vfs_node, new_file);
                     
                     // Load file content from host
                     FILE* file = fopen(full_path, "rb");
@@ -1325,6 +1501,7 @@ static int vfs_sync_directory_from_host(const char* host_path, VNode* vfs_node,
                         }
                         fclose(file);
                     }
+                    vfs_account_node(new_file);
                     
                     // Set proper modification time
                     new_file->modified_time = time(NULL);
@@ -1349,11 +1526,10 @@ static int vfs_sync_directory_from_host(const char* host_path, VNode* vfs_node,
                         time_t file_time = (time_t)((uli.QuadPart - 116444736000000000ULL) / 10000000ULL);
                         
                         if (file_time > original_mod_time) {
-                            // File was modified, reload it
-                            if (existing->data) {
-                                free(existing->data);
-                                existing->data = NULL;
-                            }
+                            // Timestamp moved; read the host copy and only replace ours if the bytes differ
+                            void* new_data = NULL;
+                            size_t new_size = 0;
+                            int read_ok = 0;
                             
                             FILE* file = fopen(full_path, "rb");
                             if (file) {
@@ -1362,22 +1538,44 @@ static int vfs_sync_directory_from_host(const char* host_path, VNode* vfs_node,
                                 fseek(file, 0, SEEK_SET);
                                 
                                 if (file_size > 0) {
-                                    existing->data = malloc(file_size);
-                                    if (existing->data) {
-                                        fread(existing->data, 1, file_size, file);
-                                        existing->size = file_size;
+                                    new_data = malloc(file_size);
+                                    if (new_data && fread(new_data, 1, file_size, file) == (size_t)file_size) {
+                                        new_size = (size_t)file_size;
+                                        read_ok = 1;
                                     }
                                 } else {
-                                    existing->size = 0; // Empty file
+                                    read_ok = 1; // Empty file
                                 }
                                 fclose(file);
                             }
                             
-                            existing->modified_time = file_time;
+                            int unchanged = 0;
+                            if (read_ok && new_size == existing->size) {
+                                if (!(existing->digest_valid & HASH_XXH3) && existing->data) {
+                                    existing->digest_xxh3 = hash_xxh3(existing->data, existing->size);
+                                    existing->digest_valid |= HASH_XXH3;
+                                }
+                                unchanged = (existing->digest_valid & HASH_XXH3) &&
+                                            existing->digest_xxh3 == hash_xxh3(new_data ? new_data : "", new_size);
+                            }
                             
-                            if (verbose) {
-                                printf("[LIVE-SYNC] Updated file: %s (%zu bytes)\n", find_data.cFileName, existing->size);
+                            if (unchanged) {
+                                free(new_data);
+                            } else if (read_ok && existing->map_count == 0) {
+                                free(existing->data);
+                                existing->data = new_data;
+                                existing->capacity = 0;
+                                existing->size = new_size;
+                                vfs_account_node(existing);
+                                
+                                if (verbose) {
+                                    printf("[LIVE-SYNC] Updated file: %s (%zu bytes)\n", find_data.cFileName, existing->size);
+                                }
+                            } else {
+                                free(new_data);
                             }
+                            
+                            existing->modified_time = file_time;
                         }
                     }
                     CloseHandle(hFile);
@@ -1394,7 +1592,8 @@ static int vfs_sync_directory_from_host(const char* host_path, VNode* vfs_node,
     while (child) {
         VNode* next = child->next;
         
-        if (!child->is_directory && child->modified_time == 0) {
+        if (!child->is_directory && child->modified_time == 0 && child->map_count == 0 &&
+            child->open_count == 0) {
             // This file was not found on host, remove it from VFS
             if (verbose) {
                 printf("[LIVE-SYNC] Removed file: %s (no longer exists on host)\n", child->name);
@@ -1405,6 +1604,7 @@ static int vfs_sync_directory_from_host(const char* host_path, VNode* vfs_node,
             } else {
                 vfs_node->children = next;
             }
+            vfs_detach_accounting(vfs_node, child);
             
             if (child->data) {
                 free(child->data);
@@ -0,0 +1,399 @@
+#include "vfs_file.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+// Pipe: a ring buffer shared by one read-end and one write-end file.  Each
+// end counts as open until its VFSFile's last reference is released.
+struct VFSPipe {
+    CRITICAL_SECTION lock;
+    uint8_t* buffer;
+    size_t head;                    // Next byte to read
+    size_t count;                   // Bytes buffered
+    int readers;
+    int writers;
+};
+
+static VFSFile* vfs_file_alloc(int kind, int flags) {
+    VFSFile* file = calloc(1, sizeof(VFSFile));
+    if (!file) return NULL;
+
+    file->kind = kind;
+    file->flags = flags;
+    file->refs = 1;
+    return file;
+}
+
+VFSFile* vfs_file_open(const char* path, int flags) {
+    if (!path) return NULL;
+
+    VNode* node = vfs_find_node(path);
+    if (!node && (flags & VFS_O_CREAT)) {
+        if (vfs_create_file(path) != 0) return NULL;
+        node = vfs_find_node(path);
+    }
+    if (!node) return NULL;
+
+    node = vfs_resolve_symlink(node);
+    if (!node || node->is_directory) return NULL;
+
+    int access = flags & VFS_O_ACCMODE;
+    if ((access != VFS_O_WRONLY && !vfs_check_permission(path, vfs_current_user, VFS_S_IRUSR >> 6)) ||
+        (access != VFS_O_RDONLY && !vfs_check_permission(path, vfs_current_user, VFS_S_IWUSR >> 6))) {
+        return NULL;
+    }
+
+    // Host-backed content loads on first open; after that every open of the
+    // node shares its one buffer
+    if (!node->data && node->host_path && vfs_load_file_content(node) != 0) {
+        return NULL;
+    }
+
+    int truncate = (flags & VFS_O_TRUNC) && access != VFS_O_RDONLY;
+    if (truncate && node->map_count > 0) return NULL;
+
+    VFSFile* file = vfs_file_alloc(VFS_FILE_NODE, flags & ~(VFS_O_CREAT | VFS_O_TRUNC));
+    if (!file) return NULL;
+
+    file->path = strdup(path);
+    file->node = node;
+    node->open_count++;
+    if (truncate) {
+        free(node->data);
+        node->data = NULL;
+        node->size = 0;
+        node->capacity = 0;
+        file->dirty = 1;
+    }
+    return file;
+}
+
+VFSFile* vfs_file_console(int flags) {
+    return vfs_file_alloc(VFS_FILE_CONSOLE, flags);
+}
+
+VFSFile* vfs_file_socket(int socket, void (*on_close)(VFSFile* file)) {
+    VFSFile* file = vfs_file_alloc(VFS_FILE_SOCKET, VFS_O_RDWR);
+    if (!file) return NULL;
+
+    file->socket = socket;
+    file->on_close = on_close;
+    return file;
+}
+
+VFSFile* vfs_file_object(void* object, void (*on_close)(VFSFile* file)) {
+    VFSFile* file = vfs_file_alloc(VFS_FILE_OBJECT, VFS_O_RDWR);
+    if (!file) return NULL;
+
+    file->object = object;
+    file->on_close = on_close;
+    return file;
+}
+
+int vfs_pipe_create(VFSFile** read_end, VFSFile** write_end) {
+    if (!read_end || !write_end) return -1;
+
+    VFSPipe* pipe = calloc(1, sizeof(VFSPipe));
+    VFSFile* reader = vfs_file_alloc(VFS_FILE_PIPE, VFS_O_RDONLY);
+    VFSFile* writer = vfs_file_alloc(VFS_FILE_PIPE, VFS_O_WRONLY);
+    uint8_t* buffer = malloc(VFS_PIPE_SIZE);
+    if (!pipe || !reader || !writer || !buffer) {
+        free(pipe);
+        free(reader);
+        free(writer);
+        free(buffer);
+        return -1;
+    }
+
+    InitializeCriticalSection(&pipe->lock);
+    pipe->buffer = buffer;
+    pipe->readers = 1;
+    pipe->writers = 1;
+    reader->pipe = pipe;
+    writer->pipe = pipe;
+    *read_end = reader;
+    *write_end = writer;
+    return 0;
+}
+
+VFSFile* vfs_file_retain(VFSFile* file) {
+    if (file) InterlockedIncrement((volatile LONG*)&file->refs);
+    return file;
+}
+
+// Drop one end of a pipe; the pipe goes when both have
+static void vfs_pipe_close_end(VFSFile* file) {
+    VFSPipe* pipe = file->pipe;
+
+    EnterCriticalSection(&pipe->lock);
+    if ((file->flags & VFS_O_ACCMODE) == VFS_O_RDONLY) {
+        pipe->readers--;
+    } else {
+        pipe->writers--;
+    }
+    int last = pipe->readers == 0 && pipe->writers == 0;
+    LeaveCriticalSection(&pipe->lock);
+
+    if (last) {
+        DeleteCriticalSection(&pipe->lock);
+        free(pipe->buffer);
+        free(pipe);
+    }
+}
+
+int vfs_file_release(VFSFile* file) {
+    if (!file) return -1;
+    if (InterlockedDecrement((volatile LONG*)&file->refs) > 0) return 0;
+
+    int result = 0;
+    if (file->on_close) file->on_close(file);
+    if (file->kind == VFS_FILE_NODE) {
+        result = vfs_file_sync(file);
+        file->node->open_count--;
+    } else if (file->kind == VFS_FILE_PIPE) {
+        vfs_pipe_close_end(file);
+    }
+    free(file->path);
+    free(file);
+    return result;
+}
+
+int vfs_file_readable(const VFSFile* file) {
+    return (file->flags & VFS_O_ACCMODE) != VFS_O_WRONLY;
+}
+
+int vfs_file_writable(const VFSFile* file) {
+    return (file->flags & VFS_O_ACCMODE) != VFS_O_RDONLY;
+}
+
+const uint8_t* vfs_file_peek(VFSFile* file, size_t offset, size_t* length) {
+    VNode* node = file->kind == VFS_FILE_NODE ? file->node : NULL;
+    if (!node || !node->data || offset >= node->size) {
+        *length = 0;
+        return NULL;
+    }
+    if (*length > node->size - offset) *length = node->size - offset;
+    return (const uint8_t*)node->data + offset;
+}
+
+void* vfs_file_reserve(VFSFile* file, size_t offset, size_t size) {
+    if (file->kind != VFS_FILE_NODE || vfs_reserve_node(file->node, offset + size) != 0) return NULL;
+
+    // Zero-fill any gap left by writing past the end
+    VNode* node = file->node;
+    if (offset > node->size) {
+        memset((char*)node->data + node->size, 0, offset - node->size);
+        node->size = offset;
+        node->digest_valid = 0;
+        file->dirty = 1;
+    }
+    return (char*)node->data + offset;
+}
+
+// The data changed here, so cached digests go now rather than at sync:
+// hashing the file before it is closed must not see the old ones
+void vfs_file_commit(VFSFile* file, size_t offset, size_t size) {
+    if (size == 0) return;
+    if (offset + size > file->node->size) file->node->size = offset + size;
+    file->node->digest_valid = 0;
+    file->dirty = 1;
+}
+
+int vfs_file_store(VFSFile* file, size_t offset, const void* data, size_t size) {
+    if (size == 0) return 0;
+    if (size > INT32_MAX) return -1;
+
+    void* target = vfs_file_reserve(file, offset, size);
+    if (!target) return -1;
+    memcpy(target, data, size);
+    vfs_file_commit(file, offset, size);
+    return (int)size;
+}
+
+size_t vfs_file_write_offset(const VFSFile* file) {
+    if (file->kind != VFS_FILE_NODE) return 0;
+    return (file->flags & VFS_O_APPEND) ? file->node->size : file->position;
+}
+
+// Commit written data: terminator, accounting, host write-through
+int vfs_file_sync(VFSFile* file) {
+    if (file->kind != VFS_FILE_NODE || !file->dirty) return 0;
+
+    VNode* node = file->node;
+    if (node->data && node->capacity > node->size) {
+        ((char*)node->data)[node->size] = '\0';
+    }
+    file->dirty = 0;
+    return vfs_sync_node(node);
+}
+
+static int vfs_pipe_read(VFSPipe* pipe, void* buffer, size_t size) {
+    EnterCriticalSection(&pipe->lock);
+    if (pipe->count == 0) {
+        // Empty: end of file once every writer is gone, otherwise try again
+        int result = pipe->writers > 0 ? -1 : 0;
+        LeaveCriticalSection(&pipe->lock);
+        return result;
+    }
+
+    if (size > pipe->count) size = pipe->count;
+    size_t first = VFS_PIPE_SIZE - pipe->head;
+    if (first > size) first = size;
+    memcpy(buffer, pipe->buffer + pipe->head, first);
+    memcpy((uint8_t*)buffer + first, pipe->buffer, size - first);
+    pipe->head = (pipe->head + size) % VFS_PIPE_SIZE;
+    pipe->count -= size;
+    LeaveCriticalSection(&pipe->lock);
+    return (int)size;
+}
+
+static int vfs_pipe_write(VFSPipe* pipe, const void* buffer, size_t size) {
+    EnterCriticalSection(&pipe->lock);
+    size_t space = VFS_PIPE_SIZE - pipe->count;
+    if (pipe->readers == 0 || space == 0) {
+        LeaveCriticalSection(&pipe->lock);
+        return -1;          // Broken pipe, or full
+    }
+
+    if (size > space) size = space;
+    size_t tail = (pipe->head + pipe->count) % VFS_PIPE_SIZE;
+    size_t first = VFS_PIPE_SIZE - tail;
+    if (first > size) first = size;
+    memcpy(pipe->buffer + tail, buffer, first);
+    memcpy(pipe->buffer, (const uint8_t*)buffer + first, size - first);
+    pipe->count += size;
+    LeaveCriticalSection(&pipe->lock);
+    return (int)size;
+}
+
+int vfs_file_read(VFSFile* file, void* buffer, size_t size) {
+    if (!file || !buffer || !vfs_file_readable(file)) return -1;
+    if (size > INT32_MAX) size = INT32_MAX;
+
+    switch (file->kind) {
+        case VFS_FILE_NODE: {
+            size_t length = size;
+            const uint8_t* data = vfs_file_peek(file, file->position, &length);
+            if (length == 0) return 0;  // EOF
+            memcpy(buffer, data, length);
+            file->position += length;
+            return (int)length;
+        }
+        case VFS_FILE_PIPE:
+            return vfs_pipe_read(file->pipe, buffer, size);
+        case VFS_FILE_CONSOLE:
+            return 0;                   // No terminal input behind it yet
+        default:
+            return -1;
+    }
+}
+
+int vfs_file_write(VFSFile* file, const void* buffer, size_t size) {
+    if (!file || !buffer || !vfs_file_writable(file)) return -1;
+    if (size > INT32_MAX) size = INT32_MAX;
+
+    switch (file->kind) {
+        case VFS_FILE_NODE: {
+            size_t offset = vfs_file_write_offset(file);
+            int written = vfs_file_store(file, offset, buffer, size);
+            if (written > 0) file->position = offset + (size_t)written;
+            return written;
+        }
+        case VFS_FILE_PIPE:
+            return vfs_pipe_write(file->pipe, buffer, size);
+        case VFS_FILE_CONSOLE:
+            fwrite(buffer, 1, size, stdout);
+            fflush(stdout);
+            return (int)size;
+        default:
+            return -1;
+    }
+}
+
+// ===== DESCRIPTOR TABLES =====
+
+static void vfs_fd_mark(VFSFdTable* table, int fd, VFSFile* file) {
+    table->files[fd] = file;
+    table->fd_flags[fd] = 0;
+    table->used[fd >> 5] |= 1u << (fd & 31);
+    table->open_count++;
+}
+
+VFSFdTable* vfs_fdtable_create(void) {
+    VFSFdTable* table = calloc(1, sizeof(VFSFdTable));
+    if (!table) return NULL;
+
+    static const int console_flags[3] = { VFS_O_RDONLY, VFS_O_WRONLY, VFS_O_WRONLY };
+    for (int fd = 0; fd < 3; fd++) {
+        VFSFile* console = vfs_file_console(console_flags[fd]);
+        if (!console) {
+            vfs_fdtable_destroy(table);
+            return NULL;
+        }
+        vfs_fd_mark(table, fd, console);
+    }
+    return table;
+}
+
+VFSFdTable* vfs_fdtable_clone(const VFSFdTable* table) {
+    if (!table) return vfs_fdtable_create();
+
+    VFSFdTable* copy = malloc(sizeof(VFSFdTable));
+    if (!copy) return NULL;
+
+    memcpy(copy, table, sizeof(VFSFdTable));
+    for (int fd = 0; fd < VFS_MAX_FDS; fd++) {
+        if (copy->files[fd]) vfs_file_retain(copy->files[fd]);
+    }
+    return copy;
+}
+
+void vfs_fdtable_destroy(VFSFdTable* table) {
+    if (!table) return;
+
+    for (int fd = 0; fd < VFS_MAX_FDS; fd++) {
+        if (table->files[fd]) vfs_file_release(table->files[fd]);
+    }
+    free(table);
+}
+
+int vfs_fd_install(VFSFdTable* table, VFSFile* file, int min_fd) {
+    if (!table || !file || min_fd < 0 || min_fd >= VFS_MAX_FDS) return -1;
+
+    // First clear bit at or above min_fd
+    for (int word = min_fd >> 5; word < VFS_MAX_FDS / 32; word++) {
+        uint32_t free_bits = ~table->used[word];
+        if (word == min_fd >> 5) free_bits &= ~0u << (min_fd & 31);
+        if (free_bits) {
+            int fd = (word << 5) + __builtin_ctz(free_bits);
+            vfs_fd_mark(table, fd, file);
+            return fd;
+        }
+    }
+    return -1;
+}
+
+int vfs_fd_install_at(VFSFdTable* table, int fd, VFSFile* file) {
+    if (!table || !file || fd < 0 || fd >= VFS_MAX_FDS) return -1;
+
+    if (table->files[fd]) vfs_fd_close(table, fd);
+    vfs_fd_mark(table, fd, file);
+    return fd;
+}
+
+VFSFile* vfs_fd_get(const VFSFdTable* table, int fd) {
+    if (!table || fd < 0 || fd >= VFS_MAX_FDS) return NULL;
+    return table->files[fd];
+}
+
+int vfs_fd_close(VFSFdTable* table, int fd) {
+    VFSFile* file = vfs_fd_get(table, fd);
+    if (!file) return -1;
+
+    table->files[fd] = NULL;
+    table->fd_flags[fd] = 0;
+    table->used[fd >> 5] &= ~(1u << (fd & 31));
+    table->open_count--;
+    return vfs_file_release(file);
+}
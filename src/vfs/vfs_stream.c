@@ -0,0 +1,151 @@
+#include "vfs_stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Grow the node buffer so that at least `needed` bytes (plus terminator) fit
+static int vfs_stream_reserve(VFSStream* stream, size_t needed) {
+    if (vfs_reserve_node(stream->node, needed) == 0) return 0;
+    stream->error = 1;
+    return -1;
+}
+
+VFSStream* vfs_stream_open(const char* path, const char* mode) {
+    if (!path || !mode) return NULL;
+
+    int writing = strchr(mode, 'w') != NULL;
+    int appending = strchr(mode, 'a') != NULL;
+
+    VNode* node = vfs_find_node(path);
+    if (!node && (writing || appending)) {
+        if (vfs_create_file(path) != 0) return NULL;
+        node = vfs_find_node(path);
+    }
+    if (!node) return NULL;
+
+    node = vfs_resolve_symlink(node);
+    if (!node || node->is_directory) return NULL;
+
+    int required = (writing || appending) ? (VFS_S_IWUSR >> 6) : (VFS_S_IRUSR >> 6);
+    if (!vfs_check_permission(path, vfs_current_user, required)) {
+        printf("VFS: Permission denied opening '%s'\n", path);
+        return NULL;
+    }
+
+    // Host-backed files are loaded on demand; a truncating open doesn't need them
+    if (!node->data && node->host_path && !writing) {
+        if (vfs_load_file_content(node) != 0) return NULL;
+    }
+
+    if (writing && node->map_count > 0) {
+        printf("VFS: '%s' is mapped; cannot truncate it\n", path);
+        return NULL;
+    }
+
+    VFSStream* stream = calloc(1, sizeof(VFSStream));
+    if (!stream) return NULL;
+
+    stream->node = node;
+    strncpy(stream->path, path, sizeof(stream->path) - 1);
+    stream->writable = writing || appending;
+
+    if (writing) {
+        free(node->data);
+        node->data = NULL;
+        node->size = 0;
+        node->capacity = 0;
+        node->digest_valid = 0;
+    } else if (appending) {
+        stream->pos = node->size;
+    }
+
+    return stream;
+}
+
+size_t vfs_stream_read(VFSStream* stream, void* buffer, size_t size) {
+    if (!stream || !buffer || !stream->node->data) return 0;
+    if (stream->pos >= stream->node->size) return 0;
+
+    size_t available = stream->node->size - stream->pos;
+    if (size > available) size = available;
+
+    memcpy(buffer, (const char*)stream->node->data + stream->pos, size);
+    stream->pos += size;
+    return size;
+}
+
+size_t vfs_stream_write(VFSStream* stream, const void* buffer, size_t size) {
+    if (!stream || !stream->writable || !buffer || size == 0) return 0;
+
+    if (vfs_stream_reserve(stream, stream->pos + size) != 0) return 0;
+
+    memcpy((char*)stream->node->data + stream->pos, buffer, size);
+    stream->node->digest_valid = 0;
+    stream->pos += size;
+    if (stream->pos > stream->node->size) {
+        stream->node->size = stream->pos;
+    }
+    return size;
+}
+
+int vfs_stream_seek(VFSStream* stream, long long offset, int whence) {
+    if (!stream) return -1;
+
+    long long base;
+    switch (whence) {
+        case SEEK_SET: base = 0; break;
+        case SEEK_CUR: base = (long long)stream->pos; break;
+        case SEEK_END: base = (long long)stream->node->size; break;
+        default: return -1;
+    }
+
+    long long target = base + offset;
+    if (target < 0) return -1;
+
+    // Seeking past the end of a writable stream zero-fills the gap, like a sparse write
+    if ((size_t)target > stream->node->size) {
+        if (!stream->writable) return -1;
+        if (vfs_stream_reserve(stream, (size_t)target) != 0) return -1;
+        memset((char*)stream->node->data + stream->node->size, 0,
+               (size_t)target - stream->node->size);
+        stream->node->size = (size_t)target;
+        stream->node->digest_valid = 0;
+    }
+
+    stream->pos = (size_t)target;
+    return 0;
+}
+
+size_t vfs_stream_tell(VFSStream* stream) {
+    return stream ? stream->pos : 0;
+}
+
+size_t vfs_stream_size(VFSStream* stream) {
+    return stream ? stream->node->size : 0;
+}
+
+int vfs_stream_eof(VFSStream* stream) {
+    return !stream || stream->pos >= stream->node->size;
+}
+
+int vfs_stream_close(VFSStream* stream) {
+    if (!stream) return -1;
+
+    int result = stream->error ? -1 : 0;
+
+    if (stream->writable) {
+        VNode* node = stream->node;
+
+        // Keep the NUL-terminator convention used by vfs_load_file_content()
+        if (node->data && node->capacity > node->size) {
+            ((char*)node->data)[node->size] = '\0';
+        }
+
+        if (vfs_sync_node(node) != 0) {
+            result = -1;
+        }
+    }
+
+    free(stream);
+    return result;
+}